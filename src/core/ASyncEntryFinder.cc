@@ -18,17 +18,53 @@
 #include "core/EntriesCache.h"
 #include "core/ASyncEntryFinder.h"
 
-ASyncEntryFinder::ASyncEntryFinder(DatabaseThread *dbConn) : ASyncQuery(dbConn)
+ASyncEntryFinder::ASyncEntryFinder(DatabaseThread *dbConn) : ASyncQuery(dbConn), _batched(false), _batchSize(minBatchSize), _recordLastRow(false)
 {
-	connect(this, SIGNAL(result(const QList<QVariant> &)), this, SLOT(_loadEntry(const QList<QVariant> &)));
 }
 
 ASyncEntryFinder::~ASyncEntryFinder()
 {
 }
 
-void ASyncEntryFinder::_loadEntry(const QList<QVariant> &record)
+void ASyncEntryFinder::processResult(const SQLite::Query &query)
 {
-	if (record.size() < 2) return;
-	emit result(EntryRef(record[0].toUInt(), record[1].toUInt()));
+	if (query.columnsCount() < 2) return;
+	EntryRef ref(query.valueUInt(0), query.valueUInt(1));
+	if (_recordLastRow) _lastRow = rowValues(query);
+	if (!_batched) {
+		emit result(ref);
+		return;
+	}
+
+	if (_batch.isEmpty()) {
+		_batch.reserve(_batchSize);
+		if (!_batchTimer.isValid()) _batchTimer.start();
+	}
+	_batch << ref;
+	if (_batch.size() >= _batchSize || _batchTimer.elapsed() >= maxBatchDelay) {
+		flushBatch();
+		_batchSize = qMin(_batchSize * 2, (int)maxBatchSize);
+	}
+}
+
+void ASyncEntryFinder::flushBatch()
+{
+	if (!_batch.isEmpty()) {
+		emit results(_batch);
+		_batch = QVector<EntryRef>();
+	}
+	_batchTimer.restart();
+}
+
+void ASyncEntryFinder::resultsEnd(bool aborted)
+{
+	// Results of an aborted query are not wanted anymore
+	if (!aborted) {
+		flushBatch();
+		if (!_lastRow.isEmpty()) emit lastRow(_lastRow);
+	}
+	_lastRow.clear();
+	_batch = QVector<EntryRef>();
+	_batchSize = minBatchSize;
+	_batchTimer.invalidate();
 }
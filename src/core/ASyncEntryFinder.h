@@ -20,6 +20,8 @@
 #define __CORE_ASYNCENTRYFINDER_H_
 
 #include <QtDebug>
+#include <QVector>
+#include <QElapsedTimer>
 
 #include "core/ASyncQuery.h"
 #include "core/EntriesCache.h"
@@ -33,18 +35,53 @@
  * integers that represent the type and identifier of entries, used to
  * construct an EntryRef.
  *
+ * In batched mode, results are emitted in chunks through results()
+ * instead of one by one through result(). Chunks start small so the first
+ * results are shown quickly, and grow as long as results keep coming. A
+ * chunk is also sent if it has not been for maxBatchDelay milliseconds.
+ *
+ * If setRecordLastRow() is enabled, all the columns of the last result are
+ * emitted through lastRow() once the query completes. This is used to fetch
+ * the next page of results of a keyset-paginated query.
  */
 class ASyncEntryFinder : public ASyncQuery {
 	Q_OBJECT
-protected slots:
-	void _loadEntry(const QList<QVariant> &record);
+private:
+	bool _batched;
+	QVector<EntryRef> _batch;
+	int _batchSize;
+	QElapsedTimer _batchTimer;
+	bool _recordLastRow;
+	QList<QVariant> _lastRow;
+
+	void flushBatch();
+
+protected:
+	virtual void processResult(const SQLite::Query &query);
+	virtual void resultsEnd(bool aborted);
 
 public:
+	static const int minBatchSize = 32;
+	static const int maxBatchSize = 4096;
+	static const int maxBatchDelay = 50;
+
 	ASyncEntryFinder(DatabaseThread *dbConn);
 	virtual ~ASyncEntryFinder();
 
+	/// Must not be changed while a query is running
+	void setBatched(bool batched) { _batched = batched; }
+	bool batched() const { return _batched; }
+	/// Must not be changed while a query is running
+	void setRecordLastRow(bool record) { _recordLastRow = record; }
+	bool recordLastRow() const { return _recordLastRow; }
+
 signals:
 	void result(const EntryRef &result);
+	/// Emitted instead of result() in batched mode
+	void results(const QVector<EntryRef> &results);
+	/// Emitted before completed() if recordLastRow() is enabled and the
+	/// query returned at least one result
+	void lastRow(const QList<QVariant> &row);
 };
 
 #endif /* ASYNCENTRYLOADER_H_ */
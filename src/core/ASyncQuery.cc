@@ -18,13 +18,23 @@
 #include "core/Paths.h"
 #include "core/ASyncQuery.h"
 #include "core/Database.h"
+#include "sqlite/Profiler.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
 
 #include <QtDebug>
 
 #include <QMutex>
 #include <QMutexLocker>
 
-ASyncQuery::ASyncQuery(DatabaseThread *dbThread) : _dbConn(dbThread->connection()), _query(&_dbConn->_connection), _active(false)
+static PerfCounter rowsStreamed("Rows streamed by asynchronous queries");
+static PerfHistogram backgroundLatency("Background query latency");
+static PerfHistogram normalLatency("Normal query latency");
+static PerfHistogram interactiveLatency("Interactive query latency");
+// Indexed by priority
+static PerfHistogram *const queryLatency[] = { &backgroundLatency, &normalLatency, &interactiveLatency };
+
+ASyncQuery::ASyncQuery(DatabaseThread *dbThread) : _dbConn(dbThread->connection()), _query(&_dbConn->_connection), _active(false), _priority(Normal), _sentRows(0), _skipRows(0), _waitTime(-1)
 {
 	// Move to database thread
 	moveToThread(dbThread);
@@ -44,10 +54,23 @@ bool ASyncQuery::exec(const QString &qString)
 	// Add us to the connection waiting queue, unless we
 	// are already active
 	if (!_active) {
+		// The query must see the writes still in the journal
+		DatabaseWriter::flush();
 		_currentQuery = qString;
 		_active = true;
+		_sentRows = 0;
+		_skipRows = 0;
+		_waitTime = -1;
+		if (SQLite::QueryProfiler::enabled() || PerfCounters::enabled()) _submitTime.start();
+		else _submitTime.invalidate();
 		_dbConn->_waitingQueueMutex.lock();
-		_dbConn->_waitingQueue << this;
+		_dbConn->_enqueue(this);
+		// Make room for us if a background query is running
+		ASyncQuery *running = _dbConn->_activeQuery;
+		if (_priority == Interactive && running && running->_priority == Background) {
+			_dbConn->_preemptCurrentQuery = true;
+			_dbConn->_connection.interrupt();
+		}
 		_dbConn->_waitingQueueMutex.unlock();
 		// Inform the thread that it has stuff to process!
 		emit queryReady();
@@ -67,70 +90,107 @@ void ASyncQuery::process()
 	Q_ASSERT(_dbConn->_activeQuery == this);
 	// Aborted already??
 	if (_dbConn->_abortCurrentQuery) goto process_abort;
+	// Only measure the first wait if we get preempted
+	if (_submitTime.isValid() && _waitTime == -1) _waitTime = _submitTime.elapsed();
 
 	// Run the query
 	if (!_query.exec(_currentQuery)) {
 		// Got error code - check if it was a real error or if we were just interrupted
-		if (_dbConn->_abortCurrentQuery || _query.lastError().isInterrupted()) {
-/*			if (!_dbConn->_abortCurrentQuery && _query.lastError().number() == SQLITE_INTERRUPT)
-				qDebug() << "WARNING: query interrupted but _abortCurrentQuery not set!";*/
-			goto process_abort;
-		}
+		if (_dbConn->_abortCurrentQuery) goto process_abort;
+		// Interrupted without being aborted: either we have been preempted,
+		// or the interruption was meant for the previous query. Run again.
+		if (_query.lastError().isInterrupted()) goto process_preempt;
 		else {
 			_active = false;
 			emit error(_query.lastError().message());
 			goto process_end;
 		}
 	}
-	if (_query.next()) {
+	while (_query.next()) {
+		// Have we been interrupted while emiting of
+		// results?
 		if (_dbConn->_abortCurrentQuery) goto process_abort;
-		emit firstResult();
-		do {
-			// Wrap the results into a list of QVariants
-			QList<QVariant> record;
-			int colCount = _query.columnsCount();
-			for (int i = 0; i < colCount; ++i) {
-				QVariant value;
-				switch (_query.valueType(i)) {
-				case SQLite::Integer:
-					value = _query.valueInt64(i);
-					break;
-				case SQLite::Float:
-					value = _query.valueDouble(i);
-					break;
-				case SQLite::String:
-					value = _query.valueString(i);
-					break;
-				case SQLite::Blob:
-					value = _query.valueBlob(i);
-					break;
-				default:
-					break;
-				}
-
-				record << value;
-			}
-			emit result(record);
-			// Have we been interrupted while emiting of
-			// results?
-			if (_dbConn->_abortCurrentQuery) {
-				goto process_abort;
-			}
-		} while(_query.next());
+		if (_dbConn->_preemptCurrentQuery) goto process_preempt;
+		// Already emitted before we got preempted
+		if (_skipRows > 0) {
+			--_skipRows;
+			continue;
+		}
+		if (_sentRows == 0) emit firstResult();
+		{
+			TRACE_SCOPE("Query emit");
+			processResult(_query);
+		}
+		++_sentRows;
 	}
+	if (_dbConn->_abortCurrentQuery) goto process_abort;
+	if (_query.lastError().isInterrupted()) goto process_preempt;
 	_active = false;
 	_query.clear();
+	resultsEnd(false);
+	if (_submitTime.isValid()) {
+		if (SQLite::QueryProfiler::enabled()) SQLite::QueryProfiler::recordASync(_currentQuery, _waitTime, _submitTime.elapsed(), _sentRows);
+		queryLatency[_priority]->record(_submitTime.nsecsElapsed() / 1000);
+	}
+	rowsStreamed.add(_sentRows);
 	emit completed();
 	return;
 
 process_abort:
 	_active = false;
 	_query.clear();
+	resultsEnd(true);
 	emit aborted();
 	return;
 
 process_end:
 	_query.clear();
+	return;
+
+process_preempt:
+	_query.clear();
+	_skipRows = _sentRows;
+	// Put ourselves back in the queue. Our abort() may be holding the
+	// queue mutex while waiting for us to return, so do not block on it.
+	while (!_dbConn->_waitingQueueMutex.tryLock(1)) {
+		if (_dbConn->_abortCurrentQuery) goto process_abort;
+	}
+	_dbConn->_enqueue(this, true);
+	_dbConn->_waitingQueueMutex.unlock();
+	emit queryReady();
+}
+
+QList<QVariant> ASyncQuery::rowValues(const SQLite::Query &query)
+{
+	QList<QVariant> record;
+	int colCount = query.columnsCount();
+	for (int i = 0; i < colCount; ++i) {
+		QVariant value;
+		switch (query.valueType(i)) {
+		case SQLite::Integer:
+			value = query.valueInt64(i);
+			break;
+		case SQLite::Float:
+			value = query.valueDouble(i);
+			break;
+		case SQLite::String:
+			value = query.valueString(i);
+			break;
+		case SQLite::Blob:
+			value = query.valueBlob(i);
+			break;
+		default:
+			break;
+		}
+
+		record << value;
+	}
+	return record;
+}
+
+void ASyncQuery::processResult(const SQLite::Query &query)
+{
+	emit result(rowValues(query));
 }
 
 bool ASyncQuery::abort()
@@ -149,12 +209,12 @@ bool ASyncQuery::abort()
 	return true;
 }
 
-bool ASyncQuery::active()
+bool ASyncQuery::active() const
 {
 	return _active;
 }
 
-ThreadedDatabaseConnection::ThreadedDatabaseConnection() : _waitingQueue(), _waitingQueueMutex(), _activeQuery(0), _queryInProgressMutex(), _abortCurrentQuery(false)
+ThreadedDatabaseConnection::ThreadedDatabaseConnection() : _waitingQueue(), _waitingQueueMutex(), _activeQuery(0), _preemptCurrentQuery(false), _queryInProgressMutex(), _abortCurrentQuery(false), _profileGeneration(0)
 {
 }
 
@@ -174,16 +234,26 @@ ThreadedDatabaseConnection::~ThreadedDatabaseConnection()
 
 bool ThreadedDatabaseConnection::connect(const QString &dbFile)
 {
-	if (!_connection.connect(dbFile)) {
+	if (!_connection.connect(dbFile, SQLite::Connection::WAL)) {
 		qWarning("Cannot open database: %s", _connection.lastError().message().toLatin1().data());
 		return false;
-	}	
+	}
+	// Threaded connections only run searches, make sure they never write
+	_connection.exec("pragma query_only=1");
 	return true;
 }
 
+bool ThreadedDatabaseConnection::connectUserDB()
+{
+	_profileGeneration = Database::profileGeneration();
+	if (_connection.connected()) _connection.close();
+	return Database::openReaderConnection(_connection);
+}
+
 bool ThreadedDatabaseConnection::attach(const QString &dbFile, const QString &alias)
 {
-	if (!_connection.attach(dbFile, alias)) {
+	// Only dictionaries are attached, and they are never written to
+	if (!_connection.attach(dbFile, alias, SQLite::Connection::ReadOnly)) {
 		qWarning("Failed to attach dictionary file %s: %s", dbFile.toLatin1().data(), _connection.lastError().message().toLatin1().data());
 		return false;
 	}
@@ -199,13 +269,23 @@ bool ThreadedDatabaseConnection::detach(const QString &alias)
 	return true;
 }
 
+int ThreadedDatabaseConnection::pendingQueries()
+{
+	QMutexLocker queueLocker(&_waitingQueueMutex);
+	return _waitingQueue.size() + (_activeQuery ? 1 : 0);
+}
+
 void ThreadedDatabaseConnection::processQueries()
 {
 	QMutexLocker queueLocker(&_waitingQueueMutex);
 	if (_waitingQueue.isEmpty()) return;
+	// The profile has been switched since the last query. Holding the queue
+	// mutex prevents the connection from being interrupted meanwhile.
+	if (_profileGeneration != Database::profileGeneration()) connectUserDB();
 	QMutexLocker queryInProgressLocker(&_queryInProgressMutex);
 	// Only set _activeQuery when queryInProgressMutex is acquired
 	_activeQuery = _waitingQueue.dequeue();
+	_preemptCurrentQuery = false;
 	queueLocker.unlock();
 	Q_ASSERT(_activeQuery != 0);
 	Q_ASSERT(_activeQuery->active() == true);
@@ -214,6 +294,13 @@ void ThreadedDatabaseConnection::processQueries()
 	_activeQuery = 0;
 }
 
+void ThreadedDatabaseConnection::_enqueue(ASyncQuery *query, bool first)
+{
+	int i = 0;
+	while (i < _waitingQueue.size() && (first ? _waitingQueue[i]->priority() > query->priority() : _waitingQueue[i]->priority() >= query->priority())) ++i;
+	_waitingQueue.insert(i, query);
+}
+
 void ThreadedDatabaseConnection::_abortRunningQuery(ASyncQuery *query)
 {
 	// Block any new incoming queries from being executed while we stop the current one
@@ -262,14 +349,8 @@ void DatabaseThread::run()
 	// Create our connection in the thread space
 	_connection = new ThreadedDatabaseConnection();
 
-	// Connect to the main database
-	connection()->connect(Database::instance()->userDBFile());
-
-	// Attach all databases
-	const QMap<QString, QString> &dbsToAttach(Database::attachedDBs());
-	foreach (const QString &alias, dbsToAttach.keys()) {
-	        connection()->attach(dbsToAttach[alias], alias);
-	}
+	// Connect to the main database and attach all databases
+	connection()->connectUserDB();
 
 	// Add to instances list
 	_instances << this;
@@ -279,3 +360,60 @@ void DatabaseThread::run()
 	// And enter event loop
 	QThread::exec();
 }
+
+DatabaseThreadPool *DatabaseThreadPool::_instance = 0;
+
+DatabaseThreadPool::DatabaseThreadPool()
+{
+	// At least two threads so that a long search does not block everything
+	// else, but do not waste connections either
+	_maxThreads = qBound(2, QThread::idealThreadCount(), 4);
+}
+
+DatabaseThreadPool::~DatabaseThreadPool()
+{
+	foreach (DatabaseThread *thread, _threads) {
+		if (_users[thread] > 0) qWarning("DatabaseThreadPool: deleting thread %p that is still in use", thread);
+		delete thread;
+	}
+}
+
+DatabaseThreadPool &DatabaseThreadPool::instance()
+{
+	if (!_instance) _instance = new DatabaseThreadPool();
+	return *_instance;
+}
+
+void DatabaseThreadPool::cleanup()
+{
+	delete _instance;
+	_instance = 0;
+}
+
+DatabaseThread *DatabaseThreadPool::acquire()
+{
+	QMutexLocker lock(&_mutex);
+	DatabaseThread *best = 0;
+	int bestQueries = 0;
+	foreach (DatabaseThread *thread, _threads) {
+		int queries = thread->connection()->pendingQueries();
+		if (!best || queries < bestQueries || (queries == bestQueries && _users[thread] < _users[best])) {
+			best = thread;
+			bestQueries = queries;
+		}
+	}
+	// Start a new thread if all the existing ones are being used
+	if ((!best || _users[best] > 0) && _threads.size() < _maxThreads) {
+		best = new DatabaseThread();
+		_threads << best;
+	}
+	++_users[best];
+	return best;
+}
+
+void DatabaseThreadPool::release(DatabaseThread *thread)
+{
+	QMutexLocker lock(&_mutex);
+	if (!_users.contains(thread)) return;
+	--_users[thread];
+}
@@ -27,6 +27,8 @@
 #include <QMutex>
 #include <QQueue>
 #include <QSet>
+#include <QHash>
+#include <QElapsedTimer>
 
 class DatabaseThread;
 class ThreadedDatabaseConnection;
@@ -39,12 +41,45 @@ struct sqlite3;
 class ASyncQuery : public QObject
 {
 	Q_OBJECT
+public:
+	/**
+	 * Queries are run by order of priority, and in order of submission
+	 * within the same priority. Submitting an Interactive query
+	 * interrupts a running Background query, which is then run again
+	 * once the queries of higher priority are done.
+	 */
+	typedef enum { Background = 0, Normal = 1, Interactive = 2 } Priority;
+
 private:
 	ThreadedDatabaseConnection *_dbConn;
 	SQLite::Query _query;
 	/// Whether the query is executing or has a pending execution
 	bool _active;
 	QString _currentQuery;
+	Priority _priority;
+	/// Number of results already emitted for the current query
+	int _sentRows;
+	/// Number of results to skip because they have been emitted before the
+	/// query was preempted
+	int _skipRows;
+	/// Only valid when queries are profiled
+	QElapsedTimer _submitTime;
+	qint64 _waitTime;
+
+protected:
+	/**
+	 * Called from the database thread for every result row. The default
+	 * implementation wraps the row into a list of QVariants and emits
+	 * result() with it. Subclasses can read the columns directly instead.
+	 */
+	virtual void processResult(const SQLite::Query &query);
+	/**
+	 * Called from the database thread after the last result has been
+	 * processed, right before completed() or aborted() is emitted.
+	 */
+	virtual void resultsEnd(bool aborted) {}
+	/// Wraps the columns of the current row of query into a list of QVariants
+	static QList<QVariant> rowValues(const SQLite::Query &query);
 
 public:
 	ASyncQuery(DatabaseThread *dbConn);
@@ -52,6 +87,10 @@ public:
 	/// Returns the last error raised by this query
 	const SQLite::Error &lastError() { return _query.lastError(); }
 
+	Priority priority() const { return _priority; }
+	/// Takes effect on the next call to exec()
+	void setPriority(Priority priority) { _priority = priority; }
+
 	/**
 	 * Starts running the query given as argument. The ASyncQuery will emit
 	 * the following signals to notify of results, in that order:
@@ -82,7 +121,7 @@ public:
 	 */
 	bool abort();
 
-	bool active();
+	bool active() const;
 
 public slots:
 	/**
@@ -137,6 +176,9 @@ private:
 
 	/// Pointer to the currently executing query
 	ASyncQuery *_activeQuery;
+	/// Set when the running query must make room for a query of higher
+	/// priority
+	bool _preemptCurrentQuery;
 	/// Hold by the DB thread whenever a query is active.
 	/// Used to ensure an interrupted query has actually
 	/// been completely interrupted.
@@ -144,6 +186,8 @@ private:
 	/// Whenever the user requests the current query to be
 	/// aborted, this boolean is set to true.
 	bool _abortCurrentQuery;
+	/// Profile generation of the user database we are connected to
+	int _profileGeneration;
 
 	/**
 	 * Abort the currently running query, if any. When this function returns,
@@ -155,6 +199,13 @@ private:
 	 */
 	void _abortRunningQuery(ASyncQuery *query);
 
+	/**
+	 * Inserts query into the waiting queue according to its priority.
+	 * Must be called with _waitingQueueMutex held. If first is true, the
+	 * query is put before the other queries of the same priority.
+	 */
+	void _enqueue(ASyncQuery *query, bool first = false);
+
 	/**
 	 * Only DatabaseThread can create instances of us.
 	 */
@@ -174,8 +225,16 @@ public:
 	 */
 	bool attach(const QString &dbFile, const QString &alias);
 	bool detach(const QString &alias);
+	/**
+	 * (Re)connects to the user database of the current profile and attaches
+	 * the dictionaries to it. Queries are run on the new database from the
+	 * next one, so switching profiles does not need to restart the thread.
+	 */
+	bool connectUserDB();
 	/// Returns the last error that happened on this connection
 	const SQLite::Error &lastError() { return _connection.lastError(); }
+	/// Number of queries running or waiting to be run on this connection
+	int pendingQueries();
 
 public slots:
 	/**
@@ -205,4 +264,41 @@ public:
 	static const QSet<DatabaseThread *> &instances() { return _instances; }
 };
 
+/**
+ * Shares a set of database threads between the components that need to
+ * run asynchronous queries, so that e.g. the detailed view does not have to
+ * wait for a long-running search to complete before displaying its
+ * content.
+ *
+ * Components acquire a thread for their ASyncQuery instances when they are
+ * created, and release it when they are destroyed. The least loaded thread
+ * is returned, and new threads are started until the maximum count is
+ * reached. Abort guarantees are those of the thread's connection: aborting
+ * a query never affects other queries sharing the same thread.
+ */
+class DatabaseThreadPool
+{
+private:
+	static DatabaseThreadPool *_instance;
+
+	QList<DatabaseThread *> _threads;
+	/// Number of components using each thread
+	QHash<DatabaseThread *, int> _users;
+	int _maxThreads;
+	QMutex _mutex;
+
+	DatabaseThreadPool();
+	~DatabaseThreadPool();
+
+public:
+	static DatabaseThreadPool &instance();
+	/// Stops all threads. Must be called before the user database is closed.
+	static void cleanup();
+
+	DatabaseThread *acquire();
+	void release(DatabaseThread *thread);
+
+	int maxThreads() const { return _maxThreads; }
+};
+
 #endif /* ASYNCQUERY_H_ */
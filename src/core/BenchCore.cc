@@ -0,0 +1,374 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark of the hot paths of the core library: text conversions, search
+ * string splitting, the REGEXP function and katakana tokenizer of SQLite,
+ * query building, entry loading and the entries cache. Each benchmark prints one JSON object per
+ * line, so that results can be compared between revisions.
+ *
+ * Benchmarks using the dictionaries are skipped if jmdict.db and
+ * kanjidic2.db cannot be found, see lookForFile().
+ */
+
+#include "core/Paths.h"
+#include "core/TextTools.h"
+#include "core/SearchCommand.h"
+#include "core/Database.h"
+#include "core/EntriesCache.h"
+#include "core/EntrySearcherManager.h"
+#include "core/QueryBuilder.h"
+#include "core/Plugin.h"
+#include "core/jmdict/JMdictPlugin.h"
+#include "core/jmdict/JMdictEntry.h"
+#include "core/kanjidic2/Kanjidic2Plugin.h"
+#include "core/kanjidic2/Kanjidic2Entry.h"
+#include "sqlite/SQLite.h"
+#include "sqlite/Connection.h"
+#include "sqlite/Query.h"
+
+#include "sqlite3.h"
+
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QStringList>
+#include <QtDebug>
+
+#include <stdio.h>
+
+/// Keeps the results of the benchmarked calls from being optimized away
+static volatile int sink;
+/// Only benchmarks which name contains this are run
+static QString filter;
+
+/**
+ * Times one benchmark and prints its result once done.
+ */
+class Bench
+{
+private:
+	QString _name;
+	QElapsedTimer _timer;
+
+public:
+	Bench(const QString &name) : _name(name) { _timer.start(); }
+	bool enabled() const { return filter.isEmpty() || _name.contains(filter); }
+	void restart() { _timer.restart(); }
+
+	void done(int ops)
+	{
+		qint64 nsecs = qMax(_timer.nsecsElapsed(), (qint64)1);
+		printf("{\"name\":\"%s\",\"ops\":%d,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f}\n", _name.toUtf8().constData(), ops, (double)nsecs / qMax(ops, 1), ops * 1e9 / nsecs);
+		fflush(stdout);
+	}
+};
+
+static const int textIterations = 100000;
+
+static void benchTextTools()
+{
+	QStringList romaji, hiragana, mixed;
+	romaji << "taberu" << "kyouryoku" << "shinkansen" << "gakkou" << "chotto" << "nihongo";
+	hiragana << QString::fromUtf8("たべる") << QString::fromUtf8("きょうりょく") << QString::fromUtf8("しんかんせん") << QString::fromUtf8("がっこう");
+	mixed << QString::fromUtf8("日本語") << QString::fromUtf8("食べる") << "word" << QString::fromUtf8("カタカナ") << QString::fromUtf8("ちょっと");
+
+	Bench romajiToKana("text/romajiToKana");
+	if (romajiToKana.enabled()) {
+		for (int i = 0; i < textIterations; i++) sink = TextTools::romajiToKana(romaji[i % romaji.size()]).size();
+		romajiToKana.done(textIterations);
+	}
+
+	// A long pasted sentence, with double consonants and n which the trie
+	// has to look ahead for
+	QStringList longWords;
+	for (int i = 0; i < 50; i++) longWords << "kyouhanninnikattekonnnichiha" << "shinkansenniryokoushimasu" << "gakkoudechottomatte";
+	QString longRomaji(longWords.join(" "));
+	const int longIterations = 1000;
+	Bench romajiToKanaLong("text/romajiToKana/long");
+	if (romajiToKanaLong.enabled()) {
+		for (int i = 0; i < longIterations; i++) sink = TextTools::romajiToKana(longRomaji).size();
+		romajiToKanaLong.done(longIterations);
+	}
+
+	Bench hiragana2Katakana("text/hiragana2Katakana");
+	if (hiragana2Katakana.enabled()) {
+		for (int i = 0; i < textIterations; i++) sink = TextTools::hiragana2Katakana(hiragana[i % hiragana.size()]).size();
+		hiragana2Katakana.done(textIterations);
+	}
+
+	Bench classifiers("text/classifiers");
+	if (classifiers.enabled()) {
+		for (int i = 0; i < textIterations; i++) {
+			const QString &s = mixed[i % mixed.size()];
+			sink = TextTools::isKana(s) + TextTools::isKanji(s) + TextTools::isRomaji(s) + TextTools::isJapanese(s);
+		}
+		classifiers.done(textIterations);
+	}
+}
+
+static void benchSplitSearchString()
+{
+	QStringList parts;
+	for (int i = 0; i < 500; i++) parts << QString("word%1").arg(i) << QString::fromUtf8("食べる") << ":jlpt=4" << "\"quoted words\"";
+	QString sentence(parts.join(" "));
+	// An unterminated quote at the end must not make the scanner backtrack
+	QString unterminated(sentence + " \"unterminated");
+	const int iterations = 200;
+
+	Bench longString("search/splitSearchString/long");
+	if (longString.enabled()) {
+		for (int i = 0; i < iterations; i++) sink = SearchCommand::splitSearchString(sentence).size();
+		longString.done(iterations);
+		if (sink != parts.size()) qCritical("splitSearchString returned %d words instead of %d", sink, parts.size());
+	}
+
+	Bench unterminatedQuote("search/splitSearchString/unterminatedQuote");
+	if (unterminatedQuote.enabled()) {
+		for (int i = 0; i < iterations; i++) sink = SearchCommand::splitSearchString(unterminated).size();
+		unterminatedQuote.done(iterations);
+		if (sink != 0) qCritical("splitSearchString accepted an unterminated quote");
+	}
+}
+
+static const int sqliteRows = 20000;
+static const int sqliteQueries = 50;
+
+/**
+ * Runs the same REGEXP queries on the words table with the given engine, so
+ * that the engines can be compared.
+ */
+static void benchRegexp(SQLite::Connection &connection, const QString &name, sqlite3ext_regexp_engine engine)
+{
+	Bench regexp(name);
+	if (!regexp.enabled()) return;
+	if (sqlite3ext_register_regexp(connection.sqlite3Handler(), engine) != SQLITE_OK) {
+		qCritical("Cannot register the REGEXP engine of %s", name.toUtf8().constData());
+		return;
+	}
+	SQLite::Query query(&connection);
+	regexp.restart();
+	for (int i = 0; i < sqliteQueries; i++) {
+		query.exec(QString("select count(*) from words where reading regexp '^%1.%2'").arg(QChar(0x3042 + i % 46)).arg(QChar(0x3044 + i % 40)));
+		if (query.next()) sink = query.valueInt(0);
+	}
+	regexp.done(sqliteQueries * sqliteRows);
+}
+
+static void benchSQLite()
+{
+	SQLite::Connection connection;
+	if (!connection.connect(":memory:")) {
+		qCritical("Cannot create benchmark database");
+		return;
+	}
+	SQLite::Query query(&connection);
+	query.exec("create table words(reading TEXT)");
+	query.exec("create virtual table wordsText using fts3(reading, TOKENIZE katakana)");
+	connection.transaction();
+	SQLite::Query insert(&connection);
+	SQLite::Query insertText(&connection);
+	insert.prepare("insert into words values(?)");
+	insertText.prepare("insert into wordsText values(?)");
+	Bench tokenizer("sqlite/katakanaTokenizer/insert");
+	for (int i = 0; i < sqliteRows; i++) {
+		// Kana strings of a few characters, different for each row
+		QString reading;
+		for (int n = i + 1; n > 0; n /= 46) reading += QChar(0x3042 + n % 46);
+		insert.bindValue(reading);
+		insert.exec();
+		insert.reset();
+		insertText.bindValue(reading);
+		insertText.exec();
+		insertText.reset();
+	}
+	connection.commit();
+	if (tokenizer.enabled()) tokenizer.done(sqliteRows);
+
+	Bench match("sqlite/katakanaTokenizer/match");
+	if (match.enabled()) {
+		for (int i = 0; i < sqliteQueries; i++) {
+			query.exec(QString("select count(*) from wordsText where reading match '%1*'").arg(QChar(0x3042 + i % 46)));
+			if (query.next()) sink = query.valueInt(0);
+		}
+		match.done(sqliteQueries);
+	}
+
+	benchRegexp(connection, "sqlite/regexp/qregexp", SQLITE3EXT_REGEXP_QREGEXP);
+	benchRegexp(connection, "sqlite/regexp/pcre", SQLITE3EXT_REGEXP_PCRE);
+}
+
+static void benchBuildQuery()
+{
+	QStringList searches;
+	searches << "taberu" << QString::fromUtf8("食べる") << QString::fromUtf8("たべ*") << "eat" << ":jlpt=4 :kanji" << QString::fromUtf8("*ます");
+	const int iterations = 2000;
+
+	Bench cold("search/buildQuery/cold");
+	if (cold.enabled()) {
+		for (int i = 0; i < iterations; i++) {
+			EntrySearcherManager::instance().clearQueryCache();
+			QueryBuilder query;
+			EntrySearcherManager::instance().buildQuery(searches[i % searches.size()], query);
+			sink = query.buildSqlStatement().size();
+		}
+		cold.done(iterations);
+	}
+
+	Bench warm("search/buildQuery/warm");
+	if (warm.enabled()) {
+		for (int i = 0; i < iterations; i++) {
+			QueryBuilder query;
+			EntrySearcherManager::instance().buildQuery(searches[i % searches.size()], query);
+			sink = query.buildSqlStatement().size();
+		}
+		warm.done(iterations);
+	}
+}
+
+static QList<EntryRef> sampleRefs(EntryType type, const QString &table, int count)
+{
+	QList<EntryRef> ret;
+	SQLite::Query query(Database::connection());
+	query.exec(QString("select id from %1 order by id limit %2").arg(table).arg(count));
+	while (query.next()) ret << EntryRef(type, query.valueUInt(0));
+	return ret;
+}
+
+static void benchLoader(const QString &name, const QList<EntryRef> &refs)
+{
+	if (refs.isEmpty()) return;
+
+	// Cold loads go directly through the loader, without caching
+	Bench cold(name + "/loadEntry/cold");
+	if (cold.enabled()) {
+		EntryLoader *loader = EntriesCache::instance().loaderFor(refs[0].type());
+		foreach (const EntryRef &ref, refs) {
+			Entry *entry = loader->loadEntry(ref.id());
+			sink = entry->writings().size();
+			delete entry;
+		}
+		cold.done(refs.size());
+	}
+
+	// Warm loads get the entries from the cache
+	QList<EntryPointer> keep(EntriesCache::getMany(refs));
+	Bench warm(name + "/loadEntry/warm");
+	if (warm.enabled()) {
+		foreach (const EntryRef &ref, refs) {
+			QList<EntryRef> one;
+			one << ref;
+			sink = EntriesCache::getMany(one).size();
+		}
+		warm.done(refs.size());
+	}
+}
+
+class CacheContentionThread : public QThread
+{
+private:
+	const QList<EntryRef> &_refs;
+	int _iterations;
+
+public:
+	CacheContentionThread(const QList<EntryRef> &refs, int iterations) : _refs(refs), _iterations(iterations) {}
+
+	void run()
+	{
+		for (int i = 0; i < _iterations; i++) {
+			QList<EntryRef> one;
+			one << _refs[i % _refs.size()];
+			sink = EntriesCache::getMany(one).size();
+		}
+	}
+};
+
+static void benchCacheContention(const QList<EntryRef> &refs)
+{
+	if (refs.isEmpty()) return;
+	Bench contention("cache/get/contention");
+	if (!contention.enabled()) return;
+	const int iterations = 20000;
+	int threads = qMax(QThread::idealThreadCount(), 2);
+
+	// Make sure the entries are cached, so only the cache is measured
+	QList<EntryPointer> keep(EntriesCache::getMany(refs));
+	QList<CacheContentionThread *> workers;
+	for (int i = 0; i < threads; i++) workers << new CacheContentionThread(refs, iterations);
+	contention.restart();
+	foreach (CacheContentionThread *worker, workers) worker->start();
+	foreach (CacheContentionThread *worker, workers) worker->wait();
+	contention.done(threads * iterations);
+	qDeleteAll(workers);
+}
+
+static void benchDictionaries()
+{
+	QStringList dbErrors;
+	if (lookForFile("jmdict.db").isEmpty() || lookForFile("kanjidic2.db").isEmpty()) {
+		qWarning("Dictionaries not found, skipping the benchmarks using them");
+		return;
+	}
+	if (!Database::init(QString(), true, dbErrors)) {
+		qCritical("%s", dbErrors.join("\n").toUtf8().constData());
+		return;
+	}
+	Plugin *kanjidic2Plugin = new Kanjidic2Plugin();
+	Plugin *jmdictPlugin = new JMdictPlugin();
+	if (Plugin::registerPlugin(kanjidic2Plugin) && Plugin::registerPlugin(jmdictPlugin)) {
+		benchBuildQuery();
+		QList<EntryRef> jmdictRefs(sampleRefs(JMDICTENTRY_GLOBALID, "jmdict.entries", 1000));
+		QList<EntryRef> kanjiRefs(sampleRefs(KANJIDIC2ENTRY_GLOBALID, "kanjidic2.entries", 1000));
+		benchLoader("jmdict", jmdictRefs);
+		benchLoader("kanjidic2", kanjiRefs);
+		benchCacheContention(jmdictRefs);
+	} else qCritical("Cannot register the dictionary plugins");
+
+	Plugin::removePlugin("JMdict");
+	Plugin::removePlugin("kanjidic2");
+	delete jmdictPlugin;
+	delete kanjidic2Plugin;
+	Database::stop();
+}
+
+void printUsage(char *argv[])
+{
+	qCritical("Usage: %s [filter]\nRuns the benchmarks that have filter in their name, or all of them", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setOrganizationDomain(__ORGANIZATION_NAME);
+	QCoreApplication::setApplicationName(__APPLICATION_NAME);
+	sqlite3ext_init();
+
+	if (argc > 2) { printUsage(argv); return 1; }
+	if (argc == 2) filter = QString::fromUtf8(argv[1]);
+
+	__userProfile = QStandardPaths::standardLocations(QStandardPaths::AppDataLocation)[0];
+
+	benchTextTools();
+	benchSplitSearchString();
+	benchSQLite();
+
+	EntriesCache::init();
+	benchDictionaries();
+	EntriesCache::cleanup();
+	return 0;
+}
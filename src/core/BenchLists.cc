@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark of the list trees: insert, random lookup, sequential
+ * iteration, range moves and removal, for the in-memory, arena and
+ * database-backed trees. For the latter the number of SQL statements
+ * executed per operation is reported as well.
+ */
+
+#include "core/OrderedRBNode.h"
+#include "core/OrderedRBArenaNode.h"
+#include "core/OrderedRBDBNode.h"
+#include "core/DBList.h"
+#include "sqlite/Connection.h"
+
+#include "sqlite3.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QtDebug>
+
+#include <random>
+#include <stdio.h>
+
+struct BenchValue {
+	quint32 v;
+};
+
+template <> QString DBListEntry<BenchValue>::tableDataMembers()
+{
+	return "v INTEGER";
+}
+
+template <> void DBListEntry<BenchValue>::bindDataValues(SQLite::Query &query) const
+{
+	query.bindValue(data.v);
+}
+
+template <> void DBListEntry<BenchValue>::readDataValues(SQLite::Query &query, int start)
+{
+	data.v = query.valueUInt(start);
+}
+
+typedef OrderedRBTree<OrderedRBMemTree<BenchValue> > BenchMemTree;
+typedef OrderedRBTree<OrderedRBArenaTree<BenchValue> > BenchArenaTree;
+typedef OrderedRBTree<OrderedRBDBTree<BenchValue> > BenchDBTree;
+
+/// Number of statements executed on the benchmark connection so far
+static quint64 statements = 0;
+/// Keeps the values read by lookups from being optimized away
+static volatile quint32 sink;
+
+#if SQLITE_VERSION_NUMBER >= 3014000
+static int countStatement(unsigned int, void *, void *, void *)
+{
+	++statements;
+	return 0;
+}
+#endif
+
+/**
+ * Times one phase of the benchmark. Phases on the DB-backed tree run in
+ * their own transaction, so that what is measured is the work done by the
+ * tree rather than the syncing of every change to the disk.
+ */
+class BenchPhase
+{
+private:
+	QElapsedTimer _timer;
+	quint64 _statements;
+	SQLite::Connection *_connection;
+
+public:
+	BenchPhase(SQLite::Connection *connection) : _statements(statements), _connection(connection)
+	{
+		if (_connection) _connection->transaction();
+		_timer.start();
+	}
+
+	void done(const char *tree, int size, const char *op, int ops)
+	{
+		qint64 nsecs = qMax(_timer.nsecsElapsed(), (qint64)1);
+		if (_connection) _connection->commit();
+		printf("%-6s %7d %-8s %12.0f ops/s %8.2f queries/op\n", tree, size, op, ops * 1e9 / nsecs, (double)(statements - _statements) / ops);
+		fflush(stdout);
+	}
+};
+
+template <class Tree> static bool benchTree(const char *name, Tree &tree, int size, SQLite::Connection *connection)
+{
+	std::mt19937 rng(size);
+	BenchValue val;
+
+	BenchPhase insert(connection);
+	for (int i = 0; i < size; i++) {
+		val.v = i;
+		if (!tree.insert(val, rng() % (i + 1))) return false;
+	}
+	insert.done(name, size, "insert", size);
+
+	BenchPhase lookup(connection);
+	for (int i = 0; i < size; i++) sink = tree.getNode(rng() % size)->value().v;
+	lookup.done(name, size, "lookup", size);
+
+	BenchPhase iterate(connection);
+	for (typename Tree::Iterator it = tree.iterator(0); it.isValid(); ++it) sink = it.value().v;
+	iterate.done(name, size, "iterate", size);
+
+	// Move ranges of 1% of the tree around
+	const int moveSize = qMax(1, size / 100);
+	const int moves = 100;
+	BenchPhase move(connection);
+	for (int i = 0; i < moves; i++) {
+		if (!tree.moveRange(rng() % (size - moveSize + 1), moveSize, tree, rng() % (size - moveSize + 1))) return false;
+	}
+	move.done(name, size, "move", moves);
+
+	BenchPhase remove(connection);
+	for (int i = size; i > 0; i--) {
+		if (!tree.remove(rng() % i)) return false;
+	}
+	remove.done(name, size, "remove", size);
+	return true;
+}
+
+void printUsage(char *argv[])
+{
+	qCritical("Usage: %s [size,...]\nRuns the benchmark on trees of the given sizes (1000,10000,100000 by default)", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QList<int> sizes;
+	if (argc > 2) { printUsage(argv); return 1; }
+	if (argc == 2) {
+		foreach (const QString &size, QString(argv[1]).split(',')) {
+			bool ok;
+			sizes << size.toInt(&ok);
+			if (!ok || sizes.last() <= 0) { printUsage(argv); return 1; }
+		}
+	}
+	else sizes << 1000 << 10000 << 100000;
+
+	QTemporaryDir dir;
+	SQLite::Connection connection;
+	if (!dir.isValid() || !connection.connect(dir.path() + "/lists.db")) {
+		qCritical("Cannot create benchmark database");
+		return 1;
+	}
+#if SQLITE_VERSION_NUMBER >= 3014000
+	sqlite3_trace_v2(connection.sqlite3Handler(), SQLITE_TRACE_STMT, countStatement, 0);
+#else
+	qWarning("SQLite is too old to count statements, queries per operation will be 0");
+#endif
+	DBList<BenchValue> dbAccess("benchLists");
+	if (!dbAccess.createTables(&connection) || !dbAccess.prepareForConnection(&connection)) {
+		qCritical("Cannot create benchmark tables");
+		return 1;
+	}
+
+	foreach (int size, sizes) {
+		{
+			BenchMemTree tree;
+			if (!benchTree("memory", tree, size, 0)) {
+				qCritical("In-memory benchmark failed");
+				return 1;
+			}
+		}
+		{
+			BenchArenaTree tree;
+			if (!benchTree("arena", tree, size, 0)) {
+				qCritical("Arena benchmark failed");
+				return 1;
+			}
+		}
+		{
+			BenchDBTree tree;
+			tree.tree()->setDBAccess(&dbAccess);
+			if (!tree.tree()->newList() || !benchTree("db", tree, size, &connection)) {
+				qCritical("Database benchmark failed: %s", connection.lastError().message().toUtf8().constData());
+				return 1;
+			}
+			tree.tree()->removeList();
+		}
+	}
+	return 0;
+}
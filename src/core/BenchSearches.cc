@@ -0,0 +1,263 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Replays a workload of recorded searches the way the results view runs
+ * them: the query is built by EntrySearcherManager, run by an
+ * ASyncEntryFinder on a database thread, and the first page of results is
+ * loaded. For every search the time to the first result, the time to
+ * complete it (including loading the first page) and its number of results
+ * are measured. Percentiles are then printed as JSON lines, by kind of
+ * search, so that plan regressions show up on the searches they affect.
+ *
+ * The workload has one search per line, with any filter commands it used.
+ * Empty lines and lines starting with # are ignored.
+ */
+
+#include "core/Paths.h"
+#include "core/TextTools.h"
+#include "core/Database.h"
+#include "core/ASyncEntryFinder.h"
+#include "core/EntriesCache.h"
+#include "core/EntrySummary.h"
+#include "core/EntrySearcher.h"
+#include "core/EntrySearcherManager.h"
+#include "core/SearchCommand.h"
+#include "core/QueryBuilder.h"
+#include "core/Plugin.h"
+#include "core/jmdict/JMdictPlugin.h"
+#include "core/kanjidic2/Kanjidic2Plugin.h"
+#include "sqlite/Query.h"
+
+#include "sqlite3.h"
+
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QVector>
+#include <QtDebug>
+
+#include <algorithm>
+#include <stdio.h>
+
+/// Number of results loaded after a search, like the first page of the results view
+static const int pageSize = 50;
+/// Keeps the loaded summaries from being optimized away
+static volatile int sink;
+
+/**
+ * Records the time of the first result and the results of the query, from
+ * the database thread. They are only read once the query has completed.
+ */
+class ReplayFinder : public ASyncEntryFinder
+{
+private:
+	const QElapsedTimer *_timer;
+	qint64 _firstResult;
+	QList<EntryRef> _refs;
+
+protected:
+	virtual void processResult(const SQLite::Query &query)
+	{
+		if (_firstResult < 0) _firstResult = _timer->nsecsElapsed();
+		_refs << EntryRef(query.valueUInt(0), query.valueUInt(1));
+		ASyncEntryFinder::processResult(query);
+	}
+
+public:
+	ReplayFinder(DatabaseThread *thread, const QElapsedTimer *timer) : ASyncEntryFinder(thread), _timer(timer), _firstResult(-1) {}
+	void reset() { _firstResult = -1; _refs.clear(); }
+	qint64 firstResult() const { return _firstResult; }
+	const QList<EntryRef> &refs() const { return _refs; }
+};
+
+struct ReplayStats
+{
+	QVector<qint64> firstResult;
+	QVector<qint64> complete;
+	QVector<qint64> rows;
+};
+
+/**
+ * Returns the kind of search, as reported by the percentiles: wildcard,
+ * kana, kanji, romaji, mean, or filter for searches with only commands.
+ */
+static QString searchKind(const QString &search)
+{
+	QStringList terms(SearchCommand::splitSearchString(search));
+	foreach (const QString &term, terms) {
+		if (!term.startsWith(':') && (term.contains('*') || term.contains('?'))) return "wildcard";
+	}
+	foreach (const QString &term, terms) {
+		if (term.startsWith(":mean=")) return "mean";
+		if (term.startsWith(':')) continue;
+		// Take the first word, without its quotes
+		QString word(term);
+		word.remove('"');
+		if (TextTools::isKana(word)) return "kana";
+		if (TextTools::isJapanese(word)) return "kanji";
+		if (TextTools::isRomaji(word)) return EntrySearcher::allowRomajiSearch() ? "romaji" : "mean";
+		return "other";
+	}
+	return "filter";
+}
+
+/// Compile options of SQLite, so runs of differently built libraries can be
+/// told apart when comparing them
+static QString sqliteOptions()
+{
+	QStringList options;
+	SQLite::Query query(Database::threadConnection());
+	if (!query.exec("pragma compile_options")) return QString();
+	while (query.next()) options << query.valueString(0);
+	return options.join(" ");
+}
+
+static double percentile(QVector<qint64> values, int pct)
+{
+	if (values.isEmpty()) return 0;
+	std::sort(values.begin(), values.end());
+	return values[qMin(values.size() - 1, values.size() * pct / 100)];
+}
+
+static void printStats(const QString &kind, const ReplayStats &stats)
+{
+	printf("{\"kind\":\"%s\",\"searches\":%d,"
+		"\"first_result_ms\":{\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f},"
+		"\"complete_ms\":{\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f},"
+		"\"rows\":{\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f}}\n",
+		kind.toUtf8().constData(), stats.complete.size(),
+		percentile(stats.firstResult, 50) / 1e6, percentile(stats.firstResult, 90) / 1e6, percentile(stats.firstResult, 99) / 1e6,
+		percentile(stats.complete, 50) / 1e6, percentile(stats.complete, 90) / 1e6, percentile(stats.complete, 99) / 1e6,
+		percentile(stats.rows, 50), percentile(stats.rows, 90), percentile(stats.rows, 99));
+	fflush(stdout);
+}
+
+static bool replay(const QStringList &searches, int runs, bool details)
+{
+	DatabaseThread *thread = DatabaseThreadPool::instance().acquire();
+	QElapsedTimer timer;
+	ReplayFinder *finder = new ReplayFinder(thread, &timer);
+	QEventLoop loop;
+	QObject::connect(finder, SIGNAL(completed()), &loop, SLOT(quit()));
+	QObject::connect(finder, SIGNAL(aborted()), &loop, SLOT(quit()));
+	QObject::connect(finder, SIGNAL(error(QString)), &loop, SLOT(quit()));
+
+	QMap<QString, ReplayStats> stats;
+	for (int run = 0; run < runs; run++) {
+		foreach (const QString &search, searches) {
+			finder->reset();
+			timer.start();
+			QueryBuilder query;
+			if (!EntrySearcherManager::instance().buildQuery(search, query)) {
+				qWarning("Invalid search: %s", search.toUtf8().constData());
+				continue;
+			}
+			if (!finder->exec(query.buildSqlStatement())) {
+				qWarning("Cannot run search: %s", search.toUtf8().constData());
+				continue;
+			}
+			loop.exec();
+			qint64 firstResult = finder->firstResult() < 0 ? timer.nsecsElapsed() : finder->firstResult();
+			sink = EntriesCache::getSummaries(finder->refs().mid(0, pageSize)).size();
+			qint64 complete = timer.nsecsElapsed();
+
+			QString kind(searchKind(search));
+			int rows = finder->refs().size();
+			foreach (const QString &k, QStringList() << kind << "all") {
+				ReplayStats &s = stats[k];
+				s.firstResult << firstResult;
+				s.complete << complete;
+				s.rows << rows;
+			}
+			if (details) printf("{\"search\":\"%s\",\"kind\":\"%s\",\"first_result_ms\":%.2f,\"complete_ms\":%.2f,\"rows\":%d}\n", QString(search).replace('\\', "\\\\").replace('"', "\\\"").toUtf8().constData(), kind.toUtf8().constData(), firstResult / 1e6, complete / 1e6, rows);
+		}
+	}
+	delete finder;
+	DatabaseThreadPool::instance().release(thread);
+
+	for (QMap<QString, ReplayStats>::const_iterator it = stats.constBegin(); it != stats.constEnd(); ++it)
+		printStats(it.key(), it.value());
+	return !stats.isEmpty();
+}
+
+void printUsage(char *argv[])
+{
+	qCritical("Usage: %s [--runs=<n>] [--details] workload_file\nReplays the searches of workload_file, one per line, and prints the percentiles of their latencies by kind of search\n--runs replays the workload n times (default 1)\n--details also prints the measures of every search", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setOrganizationDomain(__ORGANIZATION_NAME);
+	QCoreApplication::setApplicationName(__APPLICATION_NAME);
+
+	int runs = 1;
+	bool details = false;
+	QString workloadFile;
+	QStringList args(app.arguments());
+	for (int i = 1; i < args.size(); i++) {
+		bool ok = true;
+		if (args[i].startsWith("--runs=")) ok = (runs = args[i].mid(7).toInt()) > 0;
+		else if (args[i] == "--details") details = true;
+		else if (args[i].startsWith("--") || !workloadFile.isEmpty()) ok = false;
+		else workloadFile = args[i];
+		if (!ok) { printUsage(argv); return 1; }
+	}
+	if (workloadFile.isEmpty()) { printUsage(argv); return 1; }
+
+	QFile file(workloadFile);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qCritical("Cannot open workload file %s", workloadFile.toUtf8().constData());
+		return 1;
+	}
+	QStringList searches;
+	while (!file.atEnd()) {
+		QString line(QString::fromUtf8(file.readLine()).trimmed());
+		if (!line.isEmpty() && !line.startsWith('#')) searches << line;
+	}
+
+	__userProfile = QStandardPaths::standardLocations(QStandardPaths::AppDataLocation)[0];
+
+	// Always on a temporary user database, so that results only depend on
+	// the dictionaries
+	EntriesCache::init();
+	QStringList dbErrors;
+	if (!Database::init(QString(), true, dbErrors)) {
+		qCritical("%s", dbErrors.join("\n").toUtf8().constData());
+		return 1;
+	}
+	Plugin *kanjidic2Plugin = new Kanjidic2Plugin();
+	Plugin *jmdictPlugin = new JMdictPlugin();
+	bool ok = Plugin::registerPlugin(kanjidic2Plugin) && Plugin::registerPlugin(jmdictPlugin);
+	if (!ok) qCritical("Cannot register the dictionary plugins");
+	// Identifies the dictionaries the results were measured on
+	else printf("{\"jmdict\":\"%s\",\"dataStamp\":\"%s\",\"sqlite\":\"%s\",\"sqliteOptions\":\"%s\"}\n", JMdictPlugin::instance()->dictVersion().toUtf8().constData(), Database::dataStamp().toUtf8().constData(), sqlite3_libversion(), sqliteOptions().toUtf8().constData());
+	if (ok) ok = replay(searches, runs, details);
+
+	DatabaseThreadPool::cleanup();
+	Plugin::removePlugin("JMdict");
+	Plugin::removePlugin("kanjidic2");
+	delete jmdictPlugin;
+	delete kanjidic2Plugin;
+	Database::stop();
+	EntriesCache::cleanup();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/BuilderInputs.h"
+#include "sqlite/Connection.h"
+#include "sqlite/Query.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+
+QString inputsChecksum(int revision, const QStringList &files, const QStringList &languages, SQLite::FTS::Version ftsVersion)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	QStringList langs(languages);
+	langs.sort();
+	hash.addData(QByteArray::number(revision));
+	hash.addData(langs.join(",").toUtf8());
+	hash.addData(QByteArray::number(ftsVersion));
+	foreach (const QString &fName, QStringList(files) << QCoreApplication::applicationFilePath()) {
+		QFile file(fName);
+		if (!file.open(QFile::ReadOnly)) return QString();
+		hash.addData(QFileInfo(fName).fileName().toUtf8());
+		hash.addData(&file);
+	}
+	return hash.result().toHex();
+}
+
+QString previousInputsChecksum(const QString &dstDir, const QString &mainDB, const QStringList &dbs)
+{
+	QDir dir(dstDir);
+	foreach (const QString &db, QStringList(dbs) << mainDB) if (!dir.exists(db)) return QString();
+	SQLite::Connection connection;
+	if (!connection.connect(dir.absoluteFilePath(mainDB), SQLite::Connection::ReadOnly)) return QString();
+	SQLite::Query query(&connection);
+	// Fails on databases that predate the checksum
+	if (!query.exec("select inputsChecksum from info") || !query.next()) return QString();
+	return query.valueString(0);
+}
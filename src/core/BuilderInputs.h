@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_BUILDER_INPUTS_H
+#define __CORE_BUILDER_INPUTS_H
+
+#include "sqlite/FTS.h"
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Hash of everything the databases of a builder are built from: the
+ * revision of their schema, the languages, the FTS version, the files and
+ * the builder itself. A build with unchanged inputs can be skipped. Returns
+ * a null string if a file cannot be read.
+ */
+QString inputsChecksum(int revision, const QStringList &files, const QStringList &languages, SQLite::FTS::Version ftsVersion);
+
+/**
+ * Returns the inputs checksum stored in the info table of mainDB in dstDir,
+ * or a null string if any of mainDB and dbs does not exist.
+ */
+QString previousInputsChecksum(const QString &dstDir, const QString &mainDB, const QStringList &dbs);
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/BuilderStatistics.h"
+#include "sqlite/Query.h"
+
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include <QPair>
+
+#include <algorithm>
+
+/// Number of outliers printed for each distribution
+#define MAX_PRINTED_OUTLIERS 10
+
+bool BuilderStatistics::setThresholds(const QString &spec)
+{
+	foreach (const QString &threshold, spec.split(',', QString::SkipEmptyParts)) {
+		QStringList parts(threshold.split('='));
+		bool ok = false;
+		if (parts.size() == 2) _thresholds[parts[0]] = parts[1].toLongLong(&ok);
+		if (!ok) {
+			qCritical("Invalid threshold %s", threshold.toUtf8().constData());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BuilderStatistics::distribution(SQLite::Connection &connection, const QString &name, const QString &sql, qint64 defaultThreshold)
+{
+	QString key(QString(name).replace(' ', '_'));
+	qint64 threshold = _thresholds.value(key, defaultThreshold);
+
+	SQLite::Query query(&connection);
+	if (!query.exec(sql)) {
+		qCritical("%s: %s", name.toUtf8().constData(), query.lastError().message().toUtf8().constData());
+		return false;
+	}
+	QVector<qint64> values;
+	QVector<QPair<qint64, qint64> > over;
+	double sum = 0;
+	while (query.next()) {
+		qint64 value = query.valueInt64(1);
+		values << value;
+		sum += value;
+		if (value > threshold) over << QPair<qint64, qint64>(value, query.valueInt64(0));
+	}
+
+	QTextStream out(stdout);
+	if (values.isEmpty()) {
+		out << name << ": no rows\n";
+		return true;
+	}
+	std::sort(values.begin(), values.end());
+	int n = values.size();
+	out << name << ": n=" << n << " min=" << values[0] << " p50=" << values[n / 2] << " p90=" << values[n * 9 / 10]
+	    << " p99=" << values[n * 99 / 100] << " max=" << values[n - 1] << " mean=" << QString::number(sum / n, 'f', 2) << "\n";
+	if (!over.isEmpty()) {
+		// Largest values first
+		std::sort(over.begin(), over.end());
+		std::reverse(over.begin(), over.end());
+		QStringList keys;
+		for (int i = 0; i < over.size() && i < MAX_PRINTED_OUTLIERS; i++) keys << QString("%1 (%2)").arg(over[i].second).arg(over[i].first);
+		out << "  " << over.size() << " over " << key << "=" << threshold << ": " << keys.join(", ") << (over.size() > MAX_PRINTED_OUTLIERS ? ", ..." : "") << "\n";
+		_outliers += over.size();
+	}
+	return true;
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_BUILDER_STATISTICS_H
+#define __CORE_BUILDER_STATISTICS_H
+
+#include "sqlite/Connection.h"
+
+#include <QMap>
+#include <QString>
+
+/**
+ * Statistics the dictionary builders print in --stats mode, to catch data
+ * that makes entries slow to load: entries with too many rows, large
+ * blobs, or long texts to index.
+ *
+ * Each distribution comes from a query returning (key, value) rows. Keys
+ * whose value is over the threshold of the distribution are reported as
+ * outliers. Thresholds have defaults that can be changed by name.
+ */
+class BuilderStatistics
+{
+private:
+	QMap<QString, qint64> _thresholds;
+	int _outliers;
+
+public:
+	BuilderStatistics() : _outliers(0) {}
+
+	/**
+	 * Parses a list of name=max thresholds, separated by commas, that
+	 * replace the defaults given to distribution(). Names are those
+	 * printed, with spaces replaced by underscores.
+	 */
+	bool setThresholds(const QString &spec);
+
+	/**
+	 * Prints the distribution of the values of the (key, value) rows sql
+	 * returns, and the keys whose value is over the threshold.
+	 */
+	bool distribution(SQLite::Connection &connection, const QString &name, const QString &sql, qint64 defaultThreshold);
+
+	/// Number of keys over their threshold so far
+	int outliers() const { return _outliers; }
+};
+
+#endif
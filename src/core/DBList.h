@@ -36,6 +36,9 @@ template <class T> struct DBListEntry
 	quint32 right;
 
 	T data;
+	/// Id of the list the entry belongs to, kept so that list membership
+	/// can be looked up from the data through a single index
+	quint32 listId;
 
 	// The following methods must be specialized by instances of this template.
 	
@@ -77,7 +80,9 @@ private:
 	SQLite::Connection *_connection;
 
 	SQLite::Query getEntryQuery;
+	SQLite::Query getPageQuery;
 	SQLite::Query insertEntryQuery;
+	SQLite::Query updateEntryQuery;
 	SQLite::Query removeEntryQuery;
 
 	SQLite::Query newListQuery;
@@ -85,6 +90,11 @@ private:
 	SQLite::Query insertListQuery;
 	SQLite::Query removeListQuery;
 
+	int _dataMembersCount;
+
+	/// Reads an entry from a query returning full rows
+	DBListEntry<T> readEntry(SQLite::Query &query) const;
+
 public:
 	DBList(const QString &tableName, SQLite::Connection *connection = 0);
 	const QString &tableName() const { return _tableName; }
@@ -98,9 +108,17 @@ public:
 	bool createTables(SQLite::Connection *connection);
 	/// Returns the entry list corresponding to the given row id
 	DBListEntry<T> getEntry(quint32 rowid);
+	/// Returns the entry with the given rowid along with all its descendants
+	/// down to depth levels below it, using a single query. This allows trees
+	/// to load a whole page of nodes at once instead of one per hop.
+	QList<DBListEntry<T> > getPage(quint32 rowid, int depth);
 	/// Inserts the given entry into a list, returns the rowid
 	/// If the entry already exists, replaces it.
 	quint32 insertEntry(const DBListEntry<T> &entry);
+	/// Updates an entry that already exists in place. Cheaper than
+	/// insertEntry() since the row and its index entries are not
+	/// deleted and recreated.
+	bool updateEntry(const DBListEntry<T> &entry);
 	/// Removes the given entry from a list
 	bool removeEntry(quint32 rowid);
 
@@ -116,14 +134,15 @@ public:
 	SQLite::Connection *connection() { return _connection; }
 };
 
-template <class T> DBList<T>::DBList(const QString &tableName, SQLite::Connection *connection) : _tableName(tableName)
+template <class T> DBList<T>::DBList(const QString &tableName, SQLite::Connection *connection) : _tableName(tableName), _dataMembersCount(DBListEntry<T>::tableDataMembers().count(',') + 1)
 {
 	prepareForConnection(connection);
 }
 
 template <class T> bool DBList<T>::createTables(SQLite::Connection *connection)
 {
-	if (!connection->exec(QString("CREATE TABLE %1(rowid INTEGER PRIMARY KEY, leftSize INTEGER, red TINYINT, parent INTEGER, left INTEGER, right INTEGER, %2)").arg(_tableName).arg(DBListEntry<T>::tableDataMembers()))) return false;
+	// listId comes last since it has been added to existing tables afterwards
+	if (!connection->exec(QString("CREATE TABLE %1(rowid INTEGER PRIMARY KEY, leftSize INTEGER, red TINYINT, parent INTEGER, left INTEGER, right INTEGER, %2, listId INTEGER)").arg(_tableName).arg(DBListEntry<T>::tableDataMembers()))) return false;
 	if (!connection->exec(QString("CREATE TABLE %1Roots(listId INTEGER PRIMARY KEY, rootId INTEGER, label TEXT)").arg(DBList<T>::tableName()))) return false;
 	// Entry for root list (rowid = 0)
 	//if (!connection->exec(QString("insert into %1Root values(0, 0, \"\")").arg(DBList<T>::tableName()))) return false;
@@ -134,7 +153,9 @@ template <class T> bool DBList<T>::prepareForConnection(SQLite::Connection *conn
 {
 	_connection = connection;
 	getEntryQuery.useWith(_connection);
+	getPageQuery.useWith(_connection);
 	insertEntryQuery.useWith(_connection);
+	updateEntryQuery.useWith(_connection);
 	removeEntryQuery.useWith(_connection);
 
 	newListQuery.useWith(_connection);
@@ -142,14 +163,21 @@ template <class T> bool DBList<T>::prepareForConnection(SQLite::Connection *conn
 	insertListQuery.useWith(connection);
 	removeListQuery.useWith(connection);
 
-	int nbDataMembers = DBListEntry<T>::tableDataMembers().count(',') + 1;
+	int nbDataMembers = _dataMembersCount;
 	QStringList dataHoldersList;
 	while (nbDataMembers-- > 0) dataHoldersList << "?";
 	QString dataHolders(dataHoldersList.join(", "));
+	// Column names are the first word of each data member definition
+	QStringList dataSetters;
+	foreach (const QString &member, DBListEntry<T>::tableDataMembers().split(',')) {
+		dataSetters << QString("%1 = ?").arg(member.trimmed().section(' ', 0, 0));
+	}
 
 	if (connection) {
 		if (!getEntryQuery.prepare(QString("select * from %1 where rowid = ?").arg(_tableName))) return false;
-		if (!insertEntryQuery.prepare(QString("insert or replace into %1 values(?, ?, ?, ?, ?, ?, %2)").arg(_tableName).arg(dataHolders))) return false;
+		if (!getPageQuery.prepare(QString("with recursive page as (select *, 0 as depth from %1 where rowid = ? union all select %1.*, page.depth + 1 from page join %1 on %1.rowid in (page.left, page.right) where page.depth < ?) select * from page").arg(_tableName))) return false;
+		if (!insertEntryQuery.prepare(QString("insert or replace into %1 values(?, ?, ?, ?, ?, ?, %2, ?)").arg(_tableName).arg(dataHolders))) return false;
+		if (!updateEntryQuery.prepare(QString("update %1 set leftSize = ?, red = ?, parent = ?, left = ?, right = ?, %2, listId = ? where rowid = ?").arg(_tableName).arg(dataSetters.join(", ")))) return false;
 		if (!removeEntryQuery.prepare(QString("delete from %1 where rowid == ?").arg(_tableName))) return false;
 
 		if (!newListQuery.prepare(QString("insert into %1Roots values(NULL, 0, \"\")").arg(_tableName))) return false;
@@ -160,6 +188,21 @@ template <class T> bool DBList<T>::prepareForConnection(SQLite::Connection *conn
 	return true;
 }
 
+template <class T> DBListEntry<T> DBList<T>::readEntry(SQLite::Query &query) const
+{
+	DBListEntry<T> ret;
+	ret.rowId = query.valueUInt(0);
+	ret.leftSize = query.valueUInt(1);
+	ret.red = query.valueBool(2);
+	ret.parent = query.valueUInt(3);
+	ret.left = query.valueUInt(4);
+	ret.right = query.valueUInt(5);
+
+	ret.readDataValues(query, 6);
+	ret.listId = query.valueUInt(6 + _dataMembersCount);
+	return ret;
+}
+
 template <class T> DBListEntry<T> DBList<T>::getEntry(quint32 rowid)
 {
 	DBListEntry<T> ret;
@@ -169,18 +212,25 @@ template <class T> DBListEntry<T> DBList<T>::getEntry(quint32 rowid)
 		ret.rowId = 0;
 		return ret;
 	}
-	ret.rowId = getEntryQuery.valueUInt(0);
-	ret.leftSize = getEntryQuery.valueUInt(1);
-	ret.red = getEntryQuery.valueBool(2);
-	ret.parent = getEntryQuery.valueUInt(3);
-	ret.left = getEntryQuery.valueUInt(4);
-	ret.right = getEntryQuery.valueUInt(5);
-
-	ret.readDataValues(getEntryQuery, 6);
+	ret = readEntry(getEntryQuery);
 	getEntryQuery.reset();
 	return ret;
 }
 
+template <class T> QList<DBListEntry<T> > DBList<T>::getPage(quint32 rowid, int depth)
+{
+	QList<DBListEntry<T> > ret;
+	getPageQuery.bindValue(rowid);
+	getPageQuery.bindValue(depth);
+	if (!getPageQuery.exec()) {
+		getPageQuery.reset();
+		return ret;
+	}
+	while (getPageQuery.next()) ret << readEntry(getPageQuery);
+	getPageQuery.reset();
+	return ret;
+}
+
 template <class T> quint32 DBList<T>::insertEntry(const DBListEntry<T> &entry)
 {
 	if (entry.rowId == 0) insertEntryQuery.bindNullValue();
@@ -191,6 +241,7 @@ template <class T> quint32 DBList<T>::insertEntry(const DBListEntry<T> &entry)
 	insertEntryQuery.bindValue(entry.left);
 	insertEntryQuery.bindValue(entry.right);
 	entry.bindDataValues(insertEntryQuery);
+	insertEntryQuery.bindValue(entry.listId);
 
 	if (!insertEntryQuery.exec()) {
 		insertEntryQuery.reset();
@@ -198,6 +249,24 @@ template <class T> quint32 DBList<T>::insertEntry(const DBListEntry<T> &entry)
 	} else return insertEntryQuery.lastInsertId();
 }
 
+template <class T> bool DBList<T>::updateEntry(const DBListEntry<T> &entry)
+{
+	if (entry.rowId == 0) return false;
+	updateEntryQuery.bindValue(entry.leftSize);
+	updateEntryQuery.bindValue(entry.red);
+	updateEntryQuery.bindValue(entry.parent);
+	updateEntryQuery.bindValue(entry.left);
+	updateEntryQuery.bindValue(entry.right);
+	entry.bindDataValues(updateEntryQuery);
+	updateEntryQuery.bindValue(entry.listId);
+	updateEntryQuery.bindValue(entry.rowId);
+
+	if (!updateEntryQuery.exec()) {
+		updateEntryQuery.reset();
+		return false;
+	} else return true;
+}
+
 template <class T> bool DBList<T>::removeEntry(quint32 rowid)
 {
 	if (rowid == 0) return false;
@@ -17,25 +17,311 @@
 
 #include "sqlite3.h"
 #include "sqlite/SQLite.h"
+#include "sqlite/Profiler.h"
 
 #include "core/Paths.h"
 #include "core/TextTools.h"
 #include "core/Database.h"
 #include "core/ASyncQuery.h"
 #include "core/EntryListDB.h"
+#include "core/EntryListCache.h"
+#include "core/EntriesCache.h"
+#include "core/QueryBuilder.h"
+#include "core/Tag.h"
+#include "core/EntrySearcherManager.h"
 
 #include <QtDebug>
 #include <QSemaphore>
 #include <QQueue>
+#include <QFileInfo>
+#include <QThreadStorage>
+#include <QThreadPool>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QRegExp>
 
-#define USERDB_REVISION 11
+#define USERDB_REVISION 19
 
 #define ASSERT(Q) if (!(Q)) return false
 #define QUERY(Q) if (!query.exec(Q)) return false
 
 QString Database::_userDBFile;
+QMutex Database::_userDBFileMutex;
+QString Database::_profile;
+QAtomicInt Database::_profileGeneration;
 Database *Database::_instance = 0;
 QMap<QString, QString> Database::_attachedDBs;
+QSet<QString> Database::_fts5DBs;
+QMutex Database::_attachedDBsMutex;
+QMap<QString, qint64> Database::_mappedDBs;
+QAtomicInt Database::_stopPreloading;
+QAtomicInt Database::_attachGeneration;
+UserDBUpgradeHandler Database::_upgradeHandler = 0;
+PreferenceItem<int> Database::cacheSize("", "dbCacheSize", 4096);
+PreferenceItem<int> Database::mmapSize("", "dbMmapSize", 256);
+PreferenceItem<bool> Database::dictionariesInMemory("", "dictionariesInMemory", false);
+PreferenceItem<int> Database::dictionariesInMemoryMaxSize("", "dictionariesInMemoryMaxSize", 1024);
+PreferenceItem<bool> Database::profileQueries("", "profileQueries", false);
+PreferenceItem<int> Database::slowQueryThreshold("", "slowQueryThreshold", 50);
+PreferenceItem<int> Database::backupInterval("", "userDBBackupInterval", 30);
+
+/**
+ * Inserts the row VALUES into TABLE unless a row already matches KEY.
+ * Triggers cannot use INSERT OR IGNORE for this: most user data is written
+ * with INSERT OR REPLACE, whose conflict resolution overrides the one of
+ * the statements of the triggers it fires.
+ */
+#define INSERT_MISSING(TABLE, VALUES, KEY) "INSERT INTO " TABLE " SELECT " VALUES " WHERE NOT EXISTS (SELECT 1 FROM " TABLE " WHERE " KEY "); "
+
+#define LISTS LISTS_DB_TABLES_PREFIX
+/// Updates the counters of the list of ROW for its addition (OP = +) or removal (OP = -)
+#define ITEM_STATS(OP, ROW) "UPDATE " LISTS "Stats SET nbItems = nbItems " OP " 1, " \
+	"nbStudied = nbStudied " OP " (SELECT count(*) FROM training t WHERE t.type = " ROW ".type AND t.id = " ROW ".id), " \
+	"nbKnown = nbKnown " OP " (SELECT count(*) FROM training t WHERE t.type = " ROW ".type AND t.id = " ROW ".id AND t.score >= 95) " \
+	"WHERE listId = " ROW ".listId;"
+/// Number of times the entry of the training ROW appears in the list being updated
+#define ITEM_OCCURRENCES(ROW) "(SELECT count(*) FROM " LISTS " l WHERE l.type = " ROW ".type AND l.id = " ROW ".id AND l.listId = " LISTS "Stats.listId)"
+/// Selects the lists containing the entry of the training ROW
+#define LISTS_OF(ROW) "listId IN (SELECT listId FROM " LISTS " l WHERE l.type = " ROW ".type AND l.id = " ROW ".id)"
+
+/**
+ * Creates the counters of every list and the triggers that keep them up
+ * to date as list items and training data change, so they can be displayed
+ * without reading the lists. Entries are considered known from the same
+ * score as Entry::alreadyKnown().
+ */
+static bool createListsStatistics(SQLite::Query &query)
+{
+	QUERY("CREATE TABLE " LISTS "Stats(listId INTEGER PRIMARY KEY, nbItems INTEGER NOT NULL DEFAULT 0, nbStudied INTEGER NOT NULL DEFAULT 0, nbKnown INTEGER NOT NULL DEFAULT 0)");
+	QUERY("INSERT INTO " LISTS "Stats SELECT l.listId, count(*), count(t.type), count(CASE WHEN t.score >= 95 THEN 1 END) "
+		"FROM " LISTS " l LEFT JOIN training t ON t.type = l.type AND t.id = l.id GROUP BY l.listId");
+
+	// List items
+	QUERY("CREATE TRIGGER " LISTS "Stats_itemAdded AFTER INSERT ON " LISTS " BEGIN "
+		INSERT_MISSING(LISTS "Stats", "NEW.listId, 0, 0, 0", "listId = NEW.listId")
+		ITEM_STATS("+", "NEW") " END");
+	QUERY("CREATE TRIGGER " LISTS "Stats_itemRemoved AFTER DELETE ON " LISTS " BEGIN "
+		ITEM_STATS("-", "OLD") " END");
+	// Nodes are rewritten by rebalancing, only count the items that actually changed
+	QUERY("CREATE TRIGGER " LISTS "Stats_itemChanged AFTER UPDATE OF type, id, listId ON " LISTS " "
+		"WHEN OLD.listId IS NOT NEW.listId OR OLD.type IS NOT NEW.type OR OLD.id IS NOT NEW.id BEGIN "
+		ITEM_STATS("-", "OLD") " "
+		INSERT_MISSING(LISTS "Stats", "NEW.listId, 0, 0, 0", "listId = NEW.listId")
+		ITEM_STATS("+", "NEW") " END");
+	QUERY("CREATE TRIGGER " LISTS "Stats_listRemoved AFTER DELETE ON " LISTS "Roots BEGIN "
+		"DELETE FROM " LISTS "Stats WHERE listId = OLD.listId; END");
+
+	// Training data. Entries are written with INSERT OR REPLACE, which does not
+	// run the delete triggers, so forget the replaced row first.
+	QUERY("CREATE TRIGGER " LISTS "Stats_trainingReplaced BEFORE INSERT ON training BEGIN "
+		"UPDATE " LISTS "Stats SET nbStudied = nbStudied - " ITEM_OCCURRENCES("NEW") ", "
+		"nbKnown = nbKnown - " ITEM_OCCURRENCES("NEW") " * (SELECT count(*) FROM training t WHERE t.type = NEW.type AND t.id = NEW.id AND t.score >= 95) "
+		"WHERE " LISTS_OF("NEW") " AND EXISTS (SELECT 1 FROM training t WHERE t.type = NEW.type AND t.id = NEW.id); END");
+	QUERY("CREATE TRIGGER " LISTS "Stats_trainingAdded AFTER INSERT ON training BEGIN "
+		"UPDATE " LISTS "Stats SET nbStudied = nbStudied + " ITEM_OCCURRENCES("NEW") ", "
+		"nbKnown = nbKnown + " ITEM_OCCURRENCES("NEW") " * (NEW.score >= 95) WHERE " LISTS_OF("NEW") "; END");
+	QUERY("CREATE TRIGGER " LISTS "Stats_trainingRemoved AFTER DELETE ON training BEGIN "
+		"UPDATE " LISTS "Stats SET nbStudied = nbStudied - " ITEM_OCCURRENCES("OLD") ", "
+		"nbKnown = nbKnown - " ITEM_OCCURRENCES("OLD") " * (OLD.score >= 95) WHERE " LISTS_OF("OLD") "; END");
+	QUERY("CREATE TRIGGER " LISTS "Stats_trainingChanged AFTER UPDATE OF score ON training "
+		"WHEN (OLD.score >= 95) != (NEW.score >= 95) BEGIN "
+		"UPDATE " LISTS "Stats SET nbKnown = nbKnown + " ITEM_OCCURRENCES("NEW") " * ((NEW.score >= 95) - (OLD.score >= 95)) WHERE " LISTS_OF("NEW") "; END");
+	return true;
+}
+
+#undef LISTS_OF
+#undef ITEM_OCCURRENCES
+#undef ITEM_STATS
+#undef LISTS
+
+/// Adds 1 (OP = +) or removes 1 (OP = -) to the number of entries due with ROW
+#define DUE_COUNT(OP, ROW) INSERT_MISSING("trainingDue", ROW ".type, " ROW ".dueDate, 0", "type = " ROW ".type AND dueDate = " ROW ".dueDate") \
+	"UPDATE trainingDue SET nbEntries = nbEntries " OP " 1 WHERE type = " ROW ".type AND dueDate = " ROW ".dueDate; " \
+	"DELETE FROM trainingDue WHERE type = " ROW ".type AND dueDate = " ROW ".dueDate AND nbEntries = 0;"
+
+/**
+ * Creates the index giving the entries due for training in order, and the
+ * number of entries due at each date, kept up to date by triggers so that
+ * counting the entries due never has to scan the training table. Due dates
+ * are days, so there are few of them.
+ */
+static bool createTrainingSchedule(SQLite::Query &query)
+{
+	QUERY("CREATE INDEX idx_training_due ON training(type, dueDate)");
+	QUERY("CREATE TABLE trainingDue(type INT NOT NULL, dueDate UNSIGNED INT NOT NULL, nbEntries INTEGER NOT NULL, PRIMARY KEY(type, dueDate))");
+	QUERY("INSERT INTO trainingDue SELECT type, dueDate, count(*) FROM training GROUP BY type, dueDate");
+
+	// Like for the lists statistics, replaced rows must be forgotten first
+	QUERY("CREATE TRIGGER trainingDue_replaced BEFORE INSERT ON training BEGIN "
+		"UPDATE trainingDue SET nbEntries = nbEntries - 1 WHERE type = NEW.type AND dueDate = (SELECT t.dueDate FROM training t WHERE t.type = NEW.type AND t.id = NEW.id); "
+		"DELETE FROM trainingDue WHERE type = NEW.type AND nbEntries = 0; END");
+	QUERY("CREATE TRIGGER trainingDue_added AFTER INSERT ON training BEGIN " DUE_COUNT("+", "NEW") " END");
+	QUERY("CREATE TRIGGER trainingDue_removed AFTER DELETE ON training BEGIN " DUE_COUNT("-", "OLD") " END");
+	QUERY("CREATE TRIGGER trainingDue_changed AFTER UPDATE OF type, dueDate ON training "
+		"WHEN OLD.type IS NOT NEW.type OR OLD.dueDate IS NOT NEW.dueDate BEGIN "
+		DUE_COUNT("-", "OLD") " " DUE_COUNT("+", "NEW") " END");
+	return true;
+}
+
+#undef DUE_COUNT
+
+#define LISTS LISTS_DB_TABLES_PREFIX
+/// Adds 1 (OP = +) or removes 1 (OP = -) to the number of items of the list
+/// of ROW due with its entry, if the entry is studied
+#define ITEM_DUE(OP, ROW) "INSERT INTO " LISTS "Due SELECT " ROW ".listId, t.dueDate, 0 FROM training t WHERE t.type = " ROW ".type AND t.id = " ROW ".id " \
+	"AND NOT EXISTS (SELECT 1 FROM " LISTS "Due d WHERE d.listId = " ROW ".listId AND d.dueDate = t.dueDate); " \
+	"UPDATE " LISTS "Due SET nbItems = nbItems " OP " 1 WHERE listId = " ROW ".listId AND dueDate = (SELECT t.dueDate FROM training t WHERE t.type = " ROW ".type AND t.id = " ROW ".id); " \
+	"DELETE FROM " LISTS "Due WHERE listId = " ROW ".listId AND nbItems = 0;"
+/// Selects the lists containing the entry of the training ROW
+#define LISTS_OF(ROW) "listId IN (SELECT listId FROM " LISTS " l WHERE l.type = " ROW ".type AND l.id = " ROW ".id)"
+/// Adds (OP = +) or removes (OP = -) the items of the entry of the training
+/// ROW to the number of items of their lists due at DUE
+#define ENTRY_DUE(OP, ROW, DUE) "INSERT INTO " LISTS "Due SELECT DISTINCT l.listId, " DUE ", 0 FROM " LISTS " l WHERE l.type = " ROW ".type AND l.id = " ROW ".id " \
+	"AND NOT EXISTS (SELECT 1 FROM " LISTS "Due d WHERE d.listId = l.listId AND d.dueDate = " DUE "); " \
+	"UPDATE " LISTS "Due SET nbItems = nbItems " OP " (SELECT count(*) FROM " LISTS " l WHERE l.type = " ROW ".type AND l.id = " ROW ".id AND l.listId = " LISTS "Due.listId) " \
+	"WHERE dueDate = " DUE " AND " LISTS_OF(ROW) "; " \
+	"DELETE FROM " LISTS "Due WHERE dueDate = " DUE " AND nbItems = 0 AND " LISTS_OF(ROW) ";"
+/// Due date of the training data replaced by NEW
+#define REPLACED_DUE "(SELECT t.dueDate FROM training t WHERE t.type = NEW.type AND t.id = NEW.id)"
+
+/**
+ * Creates the number of items of each list due at each date, kept up to
+ * date by triggers like the other lists counters, so the items due in a
+ * list are counted without reading it.
+ */
+static bool createListsSchedule(SQLite::Query &query)
+{
+	QUERY("CREATE TABLE " LISTS "Due(listId INTEGER NOT NULL, dueDate UNSIGNED INT NOT NULL, nbItems INTEGER NOT NULL, PRIMARY KEY(listId, dueDate))");
+	QUERY("INSERT INTO " LISTS "Due SELECT l.listId, t.dueDate, count(*) FROM " LISTS " l JOIN training t ON t.type = l.type AND t.id = l.id GROUP BY l.listId, t.dueDate");
+
+	// List items
+	QUERY("CREATE TRIGGER " LISTS "Due_itemAdded AFTER INSERT ON " LISTS " BEGIN " ITEM_DUE("+", "NEW") " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_itemRemoved AFTER DELETE ON " LISTS " BEGIN " ITEM_DUE("-", "OLD") " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_itemChanged AFTER UPDATE OF type, id, listId ON " LISTS " "
+		"WHEN OLD.listId IS NOT NEW.listId OR OLD.type IS NOT NEW.type OR OLD.id IS NOT NEW.id BEGIN "
+		ITEM_DUE("-", "OLD") " " ITEM_DUE("+", "NEW") " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_listRemoved AFTER DELETE ON " LISTS "Roots BEGIN "
+		"DELETE FROM " LISTS "Due WHERE listId = OLD.listId; END");
+
+	// Training data, written with INSERT OR REPLACE
+	QUERY("CREATE TRIGGER " LISTS "Due_trainingReplaced BEFORE INSERT ON training "
+		"WHEN EXISTS (SELECT 1 FROM training t WHERE t.type = NEW.type AND t.id = NEW.id) BEGIN "
+		ENTRY_DUE("-", "NEW", REPLACED_DUE) " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_trainingAdded AFTER INSERT ON training BEGIN " ENTRY_DUE("+", "NEW", "NEW.dueDate") " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_trainingRemoved AFTER DELETE ON training BEGIN " ENTRY_DUE("-", "OLD", "OLD.dueDate") " END");
+	QUERY("CREATE TRIGGER " LISTS "Due_trainingChanged AFTER UPDATE OF type, id, dueDate ON training "
+		"WHEN OLD.type IS NOT NEW.type OR OLD.id IS NOT NEW.id OR OLD.dueDate IS NOT NEW.dueDate BEGIN "
+		ENTRY_DUE("-", "OLD", "OLD.dueDate") " " ENTRY_DUE("+", "NEW", "NEW.dueDate") " END");
+	return true;
+}
+
+#undef REPLACED_DUE
+#undef ENTRY_DUE
+#undef LISTS_OF
+#undef ITEM_DUE
+#undef LISTS
+
+/**
+ * Creates the indexes covering the study filters (study date, score and
+ * last training date) of each entry type, so they are evaluated as index
+ * range scans that return the ids without reading the training table.
+ */
+static bool createTrainingFilterIndexes(SQLite::Query &query)
+{
+	QUERY("CREATE INDEX idx_training_dateAdded ON training(type, dateAdded, id)");
+	QUERY("CREATE INDEX idx_training_type_score ON training(type, score, id)");
+	QUERY("CREATE INDEX idx_training_dateLastTrain ON training(type, dateLastTrain, id)");
+	return true;
+}
+
+#define TODAY "(CAST(strftime('%s', 'now') AS INTEGER) / 86400)"
+/// Score histogram bucket of ROW
+#define BUCKET(ROW) "min(" ROW ".score / 10, 9)"
+/// Adds DELTA to today's change of the number of entries of type TYPE in BUCKET_OF
+#define SCORE_DELTA(BUCKET_OF, TYPE, DELTA) INSERT_MISSING("trainingScores", TODAY ", " TYPE ", " BUCKET_OF ", 0", "day = " TODAY " AND type = " TYPE " AND bucket = " BUCKET_OF) \
+	"UPDATE trainingScores SET delta = delta " DELTA " WHERE day = " TODAY " AND type = " TYPE " AND bucket = " BUCKET_OF ";"
+/// Training data of the entry replaced by NEW
+#define REPLACED(COLUMN) "(SELECT t." COLUMN " FROM training t WHERE t.type = NEW.type AND t.id = NEW.id)"
+
+/**
+ * Creates the daily statistics of training, kept up to date by triggers
+ * as training data is written (see TrainingStatistics). trainingDaily
+ * counts the answers of each day, and trainingScores the changes of the
+ * score histogram, from which the histogram of any day can be rebuilt
+ * without reading the training events.
+ */
+static bool createTrainingStatistics(SQLite::Query &query)
+{
+	QUERY("CREATE TABLE trainingEvents(day INTEGER PRIMARY KEY, events BLOB NOT NULL)");
+	QUERY("CREATE TABLE trainingDaily(day INTEGER NOT NULL, type INT NOT NULL, nbTrained INTEGER NOT NULL, nbSuccess INTEGER NOT NULL, PRIMARY KEY(day, type))");
+	QUERY("CREATE TABLE trainingScores(day INTEGER NOT NULL, type INT NOT NULL, bucket INT NOT NULL, delta INTEGER NOT NULL, PRIMARY KEY(day, type, bucket))");
+	// The history starts with the current histogram
+	QUERY("INSERT INTO trainingScores SELECT " TODAY ", type, " BUCKET("training") ", count(*) FROM training GROUP BY 2, 3");
+
+	// Entries are written with INSERT OR REPLACE, so answers are the rows
+	// replaced with a greater number of trainings
+	QUERY("CREATE TRIGGER trainingDaily_answered BEFORE INSERT ON training "
+		"WHEN NEW.nbTrained > coalesce(" REPLACED("nbTrained") ", 0) BEGIN "
+		INSERT_MISSING("trainingDaily", "NEW.dateLastTrain / 86400, NEW.type, 0, 0", "day = NEW.dateLastTrain / 86400 AND type = NEW.type")
+		"UPDATE trainingDaily SET nbTrained = nbTrained + NEW.nbTrained - coalesce(" REPLACED("nbTrained") ", 0), "
+		"nbSuccess = nbSuccess + NEW.nbSuccess - coalesce(" REPLACED("nbSuccess") ", 0) "
+		"WHERE day = NEW.dateLastTrain / 86400 AND type = NEW.type; END");
+	QUERY("CREATE TRIGGER trainingScores_added BEFORE INSERT ON training "
+		"WHEN NOT EXISTS (SELECT 1 FROM training t WHERE t.type = NEW.type AND t.id = NEW.id) BEGIN "
+		SCORE_DELTA(BUCKET("NEW"), "NEW.type", "+ 1") " END");
+	QUERY("CREATE TRIGGER trainingScores_changed BEFORE INSERT ON training "
+		"WHEN min(" REPLACED("score") " / 10, 9) != " BUCKET("NEW") " BEGIN "
+		SCORE_DELTA("min(" REPLACED("score") " / 10, 9)", "NEW.type", "- 1") " "
+		SCORE_DELTA(BUCKET("NEW"), "NEW.type", "+ 1") " END");
+	QUERY("CREATE TRIGGER trainingScores_removed AFTER DELETE ON training BEGIN " SCORE_DELTA(BUCKET("OLD"), "OLD.type", "- 1") " END");
+	return true;
+}
+
+#undef REPLACED
+#undef SCORE_DELTA
+#undef BUCKET
+#undef TODAY
+#undef INSERT_MISSING
+
+/// Logs a change to the user data of the entry of ROW, in list LIST
+#define LOG_CHANGE(ROW, LIST) "INSERT INTO entryChanges(type, id, listId) VALUES(coalesce(" ROW ".type, 0), coalesce(" ROW ".id, 0), " LIST "); "
+#define LISTS LISTS_DB_TABLES_PREFIX
+
+/**
+ * Creates the log of the entries whose user data changes, filled by
+ * triggers so that the processes sharing the database know which of their
+ * cached entries and lists are stale (see DatabaseChangesWatcher). Only
+ * the last changes are kept. A process that missed some of them forgets
+ * all its cached user data.
+ */
+static bool createChangesLog(SQLite::Query &query)
+{
+	QUERY("CREATE TABLE entryChanges(seq INTEGER PRIMARY KEY AUTOINCREMENT, type INT NOT NULL, id INTEGER NOT NULL, listId INTEGER)");
+	QUERY("CREATE TRIGGER entryChanges_trim AFTER INSERT ON entryChanges WHEN NEW.seq % 1000 = 0 BEGIN "
+		"DELETE FROM entryChanges WHERE seq <= NEW.seq - 10000; END");
+
+	// Training data is written with INSERT OR REPLACE, which only runs the
+	// insert triggers
+	QUERY("CREATE TRIGGER entryChanges_trainingAdded AFTER INSERT ON training BEGIN " LOG_CHANGE("NEW", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_trainingChanged AFTER UPDATE ON training BEGIN " LOG_CHANGE("NEW", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_trainingRemoved AFTER DELETE ON training BEGIN " LOG_CHANGE("OLD", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_tagAdded AFTER INSERT ON taggedEntries BEGIN " LOG_CHANGE("NEW", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_tagRemoved AFTER DELETE ON taggedEntries BEGIN " LOG_CHANGE("OLD", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_noteAdded AFTER INSERT ON notes BEGIN " LOG_CHANGE("NEW", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_noteChanged AFTER UPDATE ON notes BEGIN " LOG_CHANGE("NEW", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_noteRemoved AFTER DELETE ON notes BEGIN " LOG_CHANGE("OLD", "NULL") " END");
+	QUERY("CREATE TRIGGER entryChanges_itemAdded AFTER INSERT ON " LISTS " BEGIN " LOG_CHANGE("NEW", "NEW.listId") " END");
+	QUERY("CREATE TRIGGER entryChanges_itemRemoved AFTER DELETE ON " LISTS " BEGIN " LOG_CHANGE("OLD", "OLD.listId") " END");
+	// Nodes are rewritten by rebalancing, only log the items that actually changed
+	QUERY("CREATE TRIGGER entryChanges_itemChanged AFTER UPDATE OF type, id, listId ON " LISTS " "
+		"WHEN OLD.listId IS NOT NEW.listId OR OLD.type IS NOT NEW.type OR OLD.id IS NOT NEW.id BEGIN "
+		LOG_CHANGE("OLD", "OLD.listId") LOG_CHANGE("NEW", "NEW.listId") " END");
+	return true;
+}
+
+#undef LISTS
+#undef LOG_CHANGE
 
 /**
  * Creates the user database. The database file on which
@@ -43,16 +329,23 @@ QMap<QString, QString> Database::_attachedDBs;
  */
 bool Database::createUserDB()
 {
-	if (!_connection.transaction()) return false;
-	SQLite::Query query(&_connection);
+	SQLite::Query query(_connection);
+	// Opening the connection already wrote the header, the vacuum mode of
+	// the empty database only changes with a VACUUM
+	QUERY("PRAGMA auto_vacuum = INCREMENTAL");
+	QUERY("VACUUM");
+	if (!_connection->transaction()) return false;
 	// Versions table
 	QUERY("CREATE TABLE versions(id TEXT PRIMARY KEY, version INTEGER)");
-	QUERY(QString("INSERT INTO versions VALUES(\"userDB\", %1)").arg(USERDB_REVISION));
+	QUERY(QString("INSERT INTO versions VALUES('userDB', %1)").arg(USERDB_REVISION));
 
 	// Study table
-	QUERY("CREATE TABLE training(type INT NOT NULL, id INTEGER SECONDARY KEY NOT NULL, score INT NOT NULL, dateAdded UNSIGNED INT NOT NULL, dateLastTrain UNSIGNED INT, nbTrained UNSIGNED INT NOT NULL, nbSuccess UNSIGNED INT NOT NULL, dateLastMistake UNSIGNED INT, CONSTRAINT training_unique_ids UNIQUE(type, id))");
+	QUERY("CREATE TABLE training(type INT NOT NULL, id INTEGER SECONDARY KEY NOT NULL, score INT NOT NULL, dateAdded UNSIGNED INT NOT NULL, dateLastTrain UNSIGNED INT, nbTrained UNSIGNED INT NOT NULL, nbSuccess UNSIGNED INT NOT NULL, dateLastMistake UNSIGNED INT, dueDate UNSIGNED INT NOT NULL DEFAULT 0, interval UNSIGNED INT NOT NULL DEFAULT 0, CONSTRAINT training_unique_ids UNIQUE(type, id))");
 	QUERY("CREATE INDEX idx_training_type_id ON training(type, id)");
 	QUERY("CREATE INDEX idx_training_score ON training(score)");
+	ASSERT(createTrainingSchedule(query));
+	ASSERT(createTrainingFilterIndexes(query));
+	ASSERT(createTrainingStatistics(query));
 
 	// Tags tables
 	QUERY("CREATE VIRTUAL TABLE tags USING fts4(tag)");
@@ -63,7 +356,7 @@ bool Database::createUserDB()
 	QUERY("CREATE VIRTUAL TABLE notesText USING fts4(note)");
 
 	// Sets table
-	QUERY("CREATE TABLE sets(rowid INTEGER PRIMARY KEY, parent INT, position INT NOT NULL, label TEXT, state BLOB)");
+	QUERY("CREATE TABLE sets(rowid INTEGER PRIMARY KEY, parent INT, position INT NOT NULL, label TEXT, state BLOB, results BLOB, resultsStamp TEXT)");
 	QUERY("CREATE INDEX idx_sets_id ON sets(parent, position)");
 	
 	// Lists tables
@@ -71,9 +364,12 @@ bool Database::createUserDB()
 	ASSERT(dbAccess.createTables(query.connection()));
 	ASSERT(dbAccess.prepareForConnection(query.connection()));
 	ASSERT(dbAccess.createDataIndexes(query.connection()));
+	ASSERT(createListsStatistics(query));
+	ASSERT(createListsSchedule(query));
+	ASSERT(createChangesLog(query));
 
 	// Done!
-	if (!_connection.commit()) return false;
+	if (!_connection->commit()) return false;
 	return true;
 }
 
@@ -134,7 +430,7 @@ static bool update4to5(SQLite::Query &query) {
 /// Add the versions table, drop info
 static bool update5to6(SQLite::Query &query) {
 	QUERY("CREATE TABLE versions(id TEXT PRIMARY KEY, version INTEGER)");
-	QUERY("INSERT INTO versions VALUES(\"userDB\", 6)");
+	QUERY("INSERT INTO versions VALUES('userDB', 6)");
 	QUERY("DROP TABLE info");
 
 	return true;
@@ -251,6 +547,96 @@ static bool update10to11(SQLite::Query &query)
 	return true;
 }
 
+/**
+ * Store the results of saved searches along with them.
+ */
+static bool update11to12(SQLite::Query &query)
+{
+	QUERY("ALTER TABLE sets ADD COLUMN results BLOB");
+	QUERY("ALTER TABLE sets ADD COLUMN resultsStamp TEXT");
+
+	return true;
+}
+
+/**
+ * Record the list each list item belongs to, so entries can find their
+ * lists with a single indexed lookup.
+ */
+static bool update12to13(SQLite::Query &query)
+{
+	// Lists migrated by update7to8 were created with the column already
+	bool hasListId = false;
+	QUERY("PRAGMA table_info(" LISTS_DB_TABLES_PREFIX ")");
+	while (query.next()) if (query.valueString(1) == "listId") hasListId = true;
+	if (!hasListId) QUERY("ALTER TABLE " LISTS_DB_TABLES_PREFIX " ADD COLUMN listId INTEGER");
+
+	// Walk down every list from its root
+	QUERY("CREATE TEMP TABLE listMembers(rowid INTEGER PRIMARY KEY, listId INTEGER)");
+	QUERY("WITH RECURSIVE members(rowid, left, right, listId) AS ("
+		"SELECT l.rowid, l.left, l.right, r.listId FROM " LISTS_DB_TABLES_PREFIX "Roots AS r JOIN " LISTS_DB_TABLES_PREFIX " AS l ON l.rowid = r.rootId "
+		"UNION ALL SELECT l.rowid, l.left, l.right, members.listId FROM members JOIN " LISTS_DB_TABLES_PREFIX " AS l ON l.rowid IN (members.left, members.right)) "
+		"INSERT INTO listMembers SELECT rowid, listId FROM members");
+	QUERY("UPDATE " LISTS_DB_TABLES_PREFIX " SET listId = (SELECT listId FROM listMembers WHERE listMembers.rowid = " LISTS_DB_TABLES_PREFIX ".rowid)");
+	QUERY("DROP TABLE listMembers");
+
+	QUERY("DROP INDEX IF EXISTS idx_" LISTS_DB_TABLES_PREFIX "_type_id");
+	QUERY("CREATE INDEX idx_" LISTS_DB_TABLES_PREFIX "_type_id ON " LISTS_DB_TABLES_PREFIX "(type, id, listId)");
+
+	return true;
+}
+
+/// Maintain counters of the items of each list
+static bool update13to14(SQLite::Query &query)
+{
+	return createListsStatistics(query);
+}
+
+/// Schedule the training of entries by due date. Existing entries are due
+/// from the day they were last trained.
+static bool update14to15(SQLite::Query &query)
+{
+	QUERY("ALTER TABLE training ADD COLUMN dueDate UNSIGNED INT NOT NULL DEFAULT 0");
+	QUERY("ALTER TABLE training ADD COLUMN interval UNSIGNED INT NOT NULL DEFAULT 0");
+	QUERY("UPDATE training SET dueDate = (coalesce(dateLastTrain, dateAdded) / 86400) * 86400");
+	return createTrainingSchedule(query);
+}
+
+/// Log training events and maintain daily statistics
+static bool update15to16(SQLite::Query &query)
+{
+	return createTrainingStatistics(query);
+}
+
+/// Index the study filters
+static bool update16to17(SQLite::Query &query)
+{
+	return createTrainingFilterIndexes(query);
+}
+
+/// Log the changes of user data for the other processes
+static bool update17to18(SQLite::Query &query)
+{
+	return createChangesLog(query);
+}
+
+/// Count the items due in each list
+static bool update18to19(SQLite::Query &query)
+{
+	return createListsSchedule(query);
+}
+
+/// Records version as the version of the database, in the table used at
+/// that version
+static bool setUserDBVersion(SQLite::Query &query, int version)
+{
+	if (version < 6) {
+		QUERY(QString("UPDATE info SET version=%1").arg(version));
+	} else {
+		QUERY(QString("UPDATE versions SET version=%1 where id='userDB'").arg(version));
+	}
+	return true;
+}
+
 #undef QUERY
 
 bool (*dbUpdateFuncs[USERDB_REVISION - 1])(SQLite::Query &) = {
@@ -264,27 +650,42 @@ bool (*dbUpdateFuncs[USERDB_REVISION - 1])(SQLite::Query &) = {
 	&update8to9,
 	&update9to10,
 	&update10to11,
+	&update11to12,
+	&update12to13,
+	&update13to14,
+	&update14to15,
+	&update15to16,
+	&update16to17,
+	&update17to18,
+	&update18to19,
 };
 
 /**
  * Upgrade the database from the version number given in parameter to
  * the current version.
+ *
+ * Every step is committed along with the version it brings the database
+ * to, so an interrupted upgrade resumes from the last completed step
+ * instead of starting over.
  */
 bool Database::updateUserDB(int currentVersion)
 {
 	// The database is older than our version of Tagaini - we have to update the database
-	if (!_connection.transaction()) return false;
-	SQLite::Query query2(&_connection);
-	for (; currentVersion < USERDB_REVISION; ++currentVersion) {
+	const int nbSteps = USERDB_REVISION - currentVersion;
+	SQLite::Query query2(_connection);
+	for (int step = 0; currentVersion < USERDB_REVISION; ++currentVersion, ++step) {
+		if (_upgradeHandler) _upgradeHandler(step, nbSteps);
+		if (!_connection->transaction()) return false;
 		if (!dbUpdateFuncs[currentVersion - 1](query2)) goto failed;
 		query2.clear();
+		if (!setUserDBVersion(query2, currentVersion + 1)) goto failed;
+		query2.clear();
+		if (!_connection->commit()) goto failed;
 	}
-	// Update version number
-	if (!query2.exec(QString("UPDATE versions SET version=%1 where id=\"userDB\"").arg(USERDB_REVISION))) goto failed;
-	if (!_connection.commit()) goto failed;
+	if (_upgradeHandler) _upgradeHandler(nbSteps, nbSteps);
 	return true;
 failed:
-	_connection.rollback();
+	_connection->rollback();
 	return false;
 }
 
@@ -297,9 +698,9 @@ failed:
 bool Database::checkUserDB(QStringList &errors)
 {
 	int currentVersion;
-	SQLite::Query query(&_connection);
+	SQLite::Query query(_connection);
 	// Try to get the version from the versions table
-	query.exec("SELECT version FROM versions where id=\"userDB\"");
+	query.exec("SELECT version FROM versions where id='userDB'");
 	if (query.next()) currentVersion = query.valueInt(0);
 	else {
 		// No versions table, we have an older version!
@@ -313,7 +714,7 @@ bool Database::checkUserDB(QStringList &errors)
 		if (currentVersion < USERDB_REVISION) {
 			if (!updateUserDB(currentVersion)) {
 				// Big issue here - start with a temporary database
-				errors << tr("Error while upgrading user database: %1").arg(_connection.lastError().message().toLatin1().constData());
+				errors << tr("Error while upgrading user database: %1").arg(_connection->lastError().message().toLatin1().constData());
 				return false;
 			}
 		}
@@ -325,9 +726,9 @@ bool Database::checkUserDB(QStringList &errors)
 	}
 	else {
 		if (!createUserDB()) {
-			_connection.rollback();
+			_connection->rollback();
 			// Big issue here - start with a temporary database
-			errors << tr("Cannot create user database: %1").arg(_connection.lastError().message().toLatin1().constData());
+			errors << tr("Cannot create user database: %1").arg(_connection->lastError().message().toLatin1().constData());
 			return false;
 		}
 	}
@@ -339,13 +740,23 @@ bool Database::connectUserDB(QString filename, QStringList &errors)
 	// Connect to the user DB
 	if (filename.isEmpty()) filename = defaultDBFile(); 
 
-	if (!_connection.connect(filename)) {
-		errors << tr("Cannot open database: %1").arg(_connection.lastError().message().toLatin1().data());
+	if (!_connection->connect(filename, SQLite::Connection::WAL)) {
+		errors << tr("Cannot open database: %1").arg(_connection->lastError().message().toLatin1().data());
 		return false;
 	}
-	if (!checkUserDB(errors)) return false;
-	_userDBFile = _connection.dbFileName();
-	return true;
+	return checkUserDB(errors);
+}
+
+void Database::setUserDBFile(const QString &file)
+{
+	QMutexLocker lock(&_userDBFileMutex);
+	_userDBFile = file;
+}
+
+QString Database::userDBFile()
+{
+	QMutexLocker lock(&_userDBFileMutex);
+	return _userDBFile;
 }
 
 bool Database::connectToTemporaryDatabase(QStringList &errors)
@@ -355,17 +766,31 @@ bool Database::connectToTemporaryDatabase(QStringList &errors)
 	_tFile->close();
 	
 	// Now reopen the DB using the temporary file and create a clear database
-	_connection.close();
+	_connection->close();
 	return connectUserDB(_tFile->fileName(), errors);
 }
 
-bool Database::init(const QString &userDBFile, bool temporary, QStringList &errors)
+bool Database::init(const QString &userDBFile, bool temporary, QStringList &errors, const QString &profile)
 {
 	_instance = new Database();
+	// The profile is given on the command line
+	if (isValidProfileName(profile)) _profile = profile;
+	else errors << tr("Invalid profile name %1, using the default profile instead.").arg(profile);
+	_instance->_connection = new SQLite::Connection();
+	_instance->_profiles[_profile] = _instance->_connection;
+
+	// Applies to all the connections opened from now on
+	SQLite::Connection::setCacheSize(cacheSize.value());
+	SQLite::Connection::setMmapSize((qint64)mmapSize.value() * 1024 * 1024);
+	if (profileQueries.value()) {
+		SQLite::QueryProfiler::setLogFile(QDir(userProfile()).absoluteFilePath("queries.log"));
+		SQLite::QueryProfiler::setThreshold(slowQueryThreshold.value());
+		SQLite::QueryProfiler::setEnabled(true);
+	}
 
 	// Temporary database explicitly required or cannot connect to user DB:
 	// Switch to the temporary database
-	if (temporary || !_instance->connectUserDB(userDBFile, errors)) {
+	if (temporary || !_instance->connectUserDB(userDBFile.isEmpty() ? profileFile(_profile) : userDBFile, errors)) {
 		if (!_instance->connectToTemporaryDatabase(errors)) {
 			errors << tr("Temporary database fallback failed. The program will now exit.");
 			return false;
@@ -373,31 +798,177 @@ bool Database::init(const QString &userDBFile, bool temporary, QStringList &erro
 			errors << tr("Tagaini is working on a temporary database. This allows the program to work, but user data is unavailable and any change will be lost upon program exit. If you corrupted your database file, please recreate it from the preferences.");
 		}
 	}
+
+	QString file(_instance->_connection->dbFileName());
+	setUserDBFile(file);
+
+	_instance->_checkpointer = new DatabaseCheckpointer(file);
+	_instance->_checkpointer->start(QThread::LowestPriority);
+	// Nothing worth saving in the temporary database
+	if (!_instance->_tFile && backupInterval.value() > 0) {
+		_instance->_backup = new DatabaseBackup(file, backupInterval.value() * 60000UL);
+		_instance->_backup->start(QThread::LowestPriority);
+	}
+	_instance->_writer = new DatabaseWriter(file);
+	_instance->_writer->start();
+	_instance->_changesWatcher = new DatabaseChangesWatcher();
 	return true;
 }
 
+/// Threads reading the dictionaries kept in memory
+static QThreadPool *preloadPool()
+{
+	static QThreadPool pool;
+	return &pool;
+}
+
 void Database::stop()
 {
 	if (!_instance) return;
 
+	_stopPreloading.storeRelease(1);
+	preloadPool()->waitForDone();
+	_stopPreloading.storeRelease(0);
+
+	if (_instance->_changesWatcher) {
+		delete _instance->_changesWatcher;
+		_instance->_changesWatcher = 0;
+	}
+	if (_instance->_backup) {
+		_instance->_backup->stop();
+		delete _instance->_backup;
+		_instance->_backup = 0;
+	}
+
+	// Pending changes must be written before cleaning up
+	if (_instance->_writer) {
+		_instance->_writer->stop();
+		delete _instance->_writer;
+		_instance->_writer = 0;
+	}
+	if (_instance->_checkpointer) {
+		_instance->_checkpointer->stop();
+		delete _instance->_checkpointer;
+		_instance->_checkpointer = 0;
+	}
+
+	foreach (SQLite::Connection *connection, _instance->_profiles) {
+		closeProfile(connection);
+		delete connection;
+	}
+	_instance->_profiles.clear();
+	_instance->_connection = 0;
+	delete _instance;
+	_instance = 0;
+}
+
+void Database::closeProfile(SQLite::Connection *connection)
+{
 	// The query must not live until the end of the method, as the connection is uses
-	// will be deleted before.
+	// will be closed before.
 	{
-		SQLite::Query query(&_instance->_connection);
+		SQLite::Query query(connection);
 
 		// Remove unreferenced tags
 		if (!query.exec("delete from tags where docid not in (select tagId from taggedEntries)")) qWarning("Could not cleanup unused tags!");
 
-		// VACUUM the database
-		if (!query.exec("vacuum")) qWarning("Final VACUUM failed %s", query.lastError().message().toLatin1().data());
+		// Free pages are given back by the checkpointer during the session.
+		// Only databases created before incremental vacuum was enabled, or
+		// that still have too many free pages, need a full VACUUM.
+		bool vacuum = false;
+		if (query.exec("pragma auto_vacuum") && query.next() && query.valueInt(0) != 2) {
+			query.clear();
+			vacuum = query.exec("pragma auto_vacuum = INCREMENTAL");
+		} else {
+			qint64 freePages = 0, pages = 0;
+			if (query.exec("pragma freelist_count") && query.next()) freePages = query.valueInt64(0);
+			if (query.exec("pragma page_count") && query.next()) pages = query.valueInt64(0);
+			vacuum = freePages * 100 > pages * DatabaseCheckpointer::vacuumThreshold;
+		}
+		query.clear();
+		if (vacuum && !query.exec("vacuum")) qWarning("Final VACUUM failed %s", query.lastError().message().toLatin1().data());
 	}
+	// Do not leave a large log behind us
+	if (!connection->checkpoint(true)) qWarning("Final checkpoint failed: %s", connection->lastError().message().toLatin1().data());
 	// Close the database
-	_instance->_connection.close();
-	delete _instance;
-	_instance = 0;
+	connection->close();
 }
 
-Database::Database() : _tFile(0)
+bool Database::isValidProfileName(const QString &profile)
+{
+	return !profile.contains(QRegExp("[^\\w -]"));
+}
+
+QString Database::profileFile(const QString &profile)
+{
+	if (profile.isEmpty()) return defaultDBFile();
+	if (!isValidProfileName(profile)) return QString();
+	return QDir(userProfile()).absoluteFilePath(QString("profiles/%1.db").arg(profile));
+}
+
+QStringList Database::profiles()
+{
+	QStringList ret;
+	ret << QString();
+	QDir dir(QDir(userProfile()).absoluteFilePath("profiles"));
+	foreach (const QFileInfo &file, dir.entryInfoList(QStringList("*.db"), QDir::Files, QDir::Name)) ret << file.completeBaseName();
+	return ret;
+}
+
+bool Database::openProfile(const QString &profile, QStringList &errors)
+{
+	if (_instance->_profiles.contains(profile)) return true;
+	if (!isValidProfileName(profile)) {
+		errors << tr("Invalid profile name %1.").arg(profile);
+		return false;
+	}
+	if (!profile.isEmpty() && !QDir(userProfile()).mkpath("profiles")) {
+		errors << tr("Cannot create the profiles directory.");
+		return false;
+	}
+
+	// The checks and upgrades work on the current connection, so make the
+	// new one current while they run
+	SQLite::Connection *current = _instance->_connection;
+	_instance->_connection = new SQLite::Connection();
+	bool ok = _instance->connectUserDB(profileFile(profile), errors);
+	for (QMap<QString, QString>::const_iterator it = _attachedDBs.constBegin(); ok && it != _attachedDBs.constEnd(); ++it) {
+		ok = _instance->_connection->attach(it.value(), it.key(), SQLite::Connection::ReadOnly);
+		if (!ok) errors << tr("Cannot attach %1: %2").arg(it.value()).arg(_instance->_connection->lastError().message());
+	}
+	if (ok) _instance->_profiles[profile] = _instance->_connection;
+	else delete _instance->_connection;
+	_instance->_connection = current;
+	return ok;
+}
+
+bool Database::switchProfile(const QString &profile, QStringList &errors)
+{
+	if (profile == _profile) return true;
+	if (!openProfile(profile, errors)) return false;
+
+	// Changes made so far belong to the previous profile
+	DatabaseWriter::flush();
+	_instance->_connection = _instance->_profiles[profile];
+	_profile = profile;
+	QString file(_instance->_connection->dbFileName());
+	setUserDBFile(file);
+	if (_instance->_writer) _instance->_writer->setDatabase(file);
+	if (_instance->_checkpointer) _instance->_checkpointer->setDatabase(file);
+	if (_instance->_backup) _instance->_backup->setDatabase(file);
+	if (_instance->_changesWatcher) _instance->_changesWatcher->reset();
+	// Other connections to the user database reconnect when they see it
+	_profileGeneration.ref();
+
+	Tag::reload();
+	EntryListCache::cleanup();
+	EntriesCache::profileChanged();
+	// Queries may refer to the tags and lists of the previous profile
+	EntrySearcherManager::instance().clearQueryCache();
+	return true;
+}
+
+Database::Database() : _tFile(0), _checkpointer(0), _backup(0), _writer(0), _changesWatcher(0), _connection(0)
 {
 	sqlite3ext_init();
 }
@@ -407,6 +978,24 @@ Database::~Database()
 	if (_tFile) delete _tFile;
 }
 
+/**
+ * Records the table sizes gathered by ANALYZE in the attached database
+ * alias, so the query builder can order joins by cost.
+ */
+void Database::loadTableStatistics(const QString &alias)
+{
+	SQLite::Query query(instance()->_connection);
+	// Databases built without ANALYZE have no statistics
+	if (!query.exec("select count(*) from " + alias + ".sqlite_master where name = 'sqlite_stat1'") || !query.next() || query.valueInt(0) == 0) return;
+	if (!query.exec("select tbl, stat from " + alias + ".sqlite_stat1")) return;
+	while (query.next()) {
+		// The first number of stat is the number of rows of the table
+		QString table(alias + "." + query.valueString(0));
+		qint64 rows = query.valueString(1).section(' ', 0, 0).toLongLong();
+		if (rows > QueryBuilder::Join::tableRows(table)) QueryBuilder::Join::setTableRows(table, rows);
+	}
+}
+
 /**
  * Attach the dictionary DB to the opened user database.
  * @return true if the dictionary DB has successfully been attached; false
@@ -415,9 +1004,14 @@ Database::~Database()
 bool Database::attachDictionaryDB(const QString &file, const QString &alias, int expectedVersion)
 {
 #define QUERY(Q) if (!query.exec(Q)) goto error
-	SQLite::Query query(&instance()->_connection);
-	// Try to attach the dictionary DB
-	QUERY("attach database '" + file + "' as " + alias);
+	SQLite::Query query(instance()->_connection);
+	// Try to attach the dictionary DB. Dictionaries are never modified, so
+	// the user DB remains the only writable file.
+	if (!instance()->_connection->attach(file, alias, SQLite::Connection::ReadOnly)) {
+		qCritical() << QString("Failed to attach database: %1").arg(instance()->_connection->lastError().message());
+		qCritical() << QString("Attached dictionary file was %1").arg(file);
+		return false;
+	}
 
 	// Check the version is compatible
 	QUERY("select version from " + alias + ".info");
@@ -426,11 +1020,29 @@ bool Database::attachDictionaryDB(const QString &file, const QString &alias, int
 	if (query.valueInt(0) != expectedVersion) goto errorDetach;
 	// More than one result, not good
 	if (query.next()) goto errorDetach;
-	_attachedDBs[alias] = file;
+	mapDictionary(file, alias);
+	applyDictionaryMapping(*instance()->_connection, alias);
+	{
+		bool fts5 = SQLite::FTS::databaseVersion(*instance()->_connection, alias) == SQLite::FTS::FTS5;
+		QMutexLocker locker(&_attachedDBsMutex);
+		_attachedDBs[alias] = file;
+		if (fts5) _fts5DBs << alias;
+		else _fts5DBs.remove(alias);
+	}
+	_attachGeneration.ref();
+	loadTableStatistics(alias);
+	// Opened profiles share the dictionaries
+	foreach (SQLite::Connection *connection, instance()->_profiles) {
+		if (connection == instance()->_connection) continue;
+		if (!connection->attach(file, alias, SQLite::Connection::ReadOnly))
+			qWarning("Failed to attach dictionary file %s to profile: %s", file.toLatin1().data(), connection->lastError().message().toLatin1().data());
+		else applyDictionaryMapping(*connection, alias);
+	}
 
 	// Now attach the database on all other threaded connections
 	foreach(DatabaseThread *dbThread, DatabaseThread::instances()) {
 		if (!dbThread->connection()->attach(file, alias)) goto errorDetachAll;
+		applyDictionaryMapping(*dbThread->connection(), alias);
 	}
 	return true;
 errorDetachAll:
@@ -445,13 +1057,650 @@ error:
 	return false;
 }
 
+/// Connection of a thread other than the GUI one, see threadConnection()
+struct ThreadConnection
+{
+	SQLite::Connection connection;
+	int profileGeneration;
+	int attachGeneration;
+	/// Dictionaries attached to connection, by alias
+	QMap<QString, QString> attached;
+	ThreadConnection() : profileGeneration(-1), attachGeneration(-1) {}
+};
+
+static QThreadStorage<ThreadConnection *> _threadConnections;
+
+SQLite::Connection *Database::threadConnection()
+{
+	if (QThread::currentThread() == QCoreApplication::instance()->thread()) return connection();
+
+	if (!_threadConnections.hasLocalData()) _threadConnections.setLocalData(new ThreadConnection());
+	ThreadConnection *conn = _threadConnections.localData();
+	if (conn->profileGeneration != profileGeneration()) {
+		conn->profileGeneration = profileGeneration();
+		if (conn->connection.connected()) conn->connection.close();
+		conn->attached.clear();
+		conn->attachGeneration = _attachGeneration.loadAcquire();
+		openReaderConnection(conn->connection, &conn->attached);
+		return &conn->connection;
+	}
+	// Dictionaries may be attached after the connection is opened, e.g.
+	// the language databases the first time a search needs them
+	if (conn->attachGeneration != _attachGeneration.loadAcquire()) {
+		conn->attachGeneration = _attachGeneration.loadAcquire();
+		attachDictionaries(conn->connection, attachedDBsSnapshot(), &conn->attached);
+	}
+	return &conn->connection;
+}
+
+SQLite::FTS::Version Database::ftsVersion(const QString &alias)
+{
+	QMutexLocker locker(&_attachedDBsMutex);
+	return _fts5DBs.contains(alias) ? SQLite::FTS::FTS5 : SQLite::FTS::FTS4;
+}
+
+QMap<QString, QString> Database::attachedDBsSnapshot()
+{
+	QMutexLocker locker(&_attachedDBsMutex);
+	return _attachedDBs;
+}
+
+bool Database::openReaderConnection(SQLite::Connection &connection, QMap<QString, QString> *attached)
+{
+	if (!connection.connect(userDBFile(), SQLite::Connection::WAL)) {
+		qWarning("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+		return false;
+	}
+	// Readers only run searches, make sure they never write
+	connection.exec("pragma query_only=1");
+	return attachDictionaries(connection, attachedDBsSnapshot(), attached);
+}
+
+bool Database::openDictionaryConnection(SQLite::Connection &connection, const QMap<QString, QString> &dbs)
+{
+	if (!connection.connect(":memory:")) {
+		qWarning("Cannot open in-memory database: %s", connection.lastError().message().toLatin1().data());
+		return false;
+	}
+	return attachDictionaries(connection, dbs);
+}
+
+bool Database::attachDictionaries(SQLite::Connection &connection, const QMap<QString, QString> &dbs, QMap<QString, QString> *attached)
+{
+	bool ret = true;
+	if (attached) foreach (const QString &alias, attached->keys()) {
+		if (dbs.value(alias) == attached->value(alias)) continue;
+		connection.detach(alias);
+		attached->remove(alias);
+	}
+	for (QMap<QString, QString>::const_iterator it = dbs.constBegin(); it != dbs.constEnd(); ++it) {
+		if (attached && attached->contains(it.key())) continue;
+		if (!connection.attach(it.value(), it.key(), SQLite::Connection::ReadOnly)) {
+			qWarning("Failed to attach dictionary file %s: %s", it.value().toLatin1().data(), connection.lastError().message().toLatin1().data());
+			ret = false;
+			continue;
+		}
+		applyDictionaryMapping(connection, it.key());
+		if (attached) (*attached)[it.key()] = it.value();
+	}
+	return ret;
+}
+
+/**
+ * Reads a whole dictionary file so its pages are in the OS page cache,
+ * which is what the connections map.
+ */
+class DictionaryPreloader : public QRunnable
+{
+private:
+	QString _file;
+	const QAtomicInt &_stop;
+
+public:
+	DictionaryPreloader(const QString &file, const QAtomicInt &stop) : _file(file), _stop(stop) {}
+
+	virtual void run()
+	{
+		QElapsedTimer timer;
+		timer.start();
+		QFile file(_file);
+		if (!file.open(QIODevice::ReadOnly)) {
+			qWarning("Cannot read dictionary file %s: %s", _file.toUtf8().constData(), file.errorString().toUtf8().constData());
+			return;
+		}
+		QByteArray buffer(4 * 1024 * 1024, 0);
+		while (!_stop.loadAcquire() && file.read(buffer.data(), buffer.size()) > 0);
+		qDebug("Dictionary file %s read in %lld ms", _file.toUtf8().constData(), timer.elapsed());
+	}
+};
+
+/**
+ * Returns the memory that can be used without swapping, in bytes, or -1
+ * if it is not known on this platform.
+ */
+static qint64 availableMemory()
+{
+#if defined(Q_OS_LINUX)
+	QFile file("/proc/meminfo");
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
+	QByteArray line;
+	while (!(line = file.readLine()).isEmpty()) {
+		if (!line.startsWith("MemAvailable:")) continue;
+		// In kB
+		return line.mid(13).trimmed().split(' ').value(0).toLongLong() * 1024;
+	}
+#endif
+	return -1;
+}
+
+void Database::mapDictionary(const QString &file, const QString &alias)
+{
+	if (!dictionariesInMemory.value()) return;
+	qint64 size = QFileInfo(file).size();
+	qint64 total = size;
+	{
+		QMutexLocker locker(&_attachedDBsMutex);
+		foreach (qint64 mapped, _mappedDBs) total += mapped;
+	}
+	if (total > (qint64)dictionariesInMemoryMaxSize.value() * 1024 * 1024) {
+		qWarning("Dictionary file %s does not fit in the memory allowed for dictionaries, reading it from disk", file.toUtf8().constData());
+		return;
+	}
+	// Keep room for the rest of the program and the system
+	qint64 available = availableMemory();
+	if (available >= 0 && size > available / 2) {
+		qWarning("Not enough memory to keep dictionary file %s in memory, reading it from disk", file.toUtf8().constData());
+		return;
+	}
+	{
+		QMutexLocker locker(&_attachedDBsMutex);
+		_mappedDBs[alias] = size;
+	}
+	preloadPool()->start(new DictionaryPreloader(file, _stopPreloading));
+}
+
+void Database::applyDictionaryMapping(SQLite::Connection &connection, const QString &alias)
+{
+	qint64 size;
+	{
+		QMutexLocker locker(&_attachedDBsMutex);
+		size = _mappedDBs.value(alias);
+	}
+	if (size > 0) connection.exec(QString("pragma %1.mmap_size=%2").arg(alias).arg(size));
+}
+
+QString Database::dataStamp()
+{
+	QStringList stamp;
+	// Dictionaries are replaced as a whole when they are updated
+	for (QMap<QString, QString>::const_iterator it = _attachedDBs.constBegin(); it != _attachedDBs.constEnd(); ++it)
+		stamp << QString("%1:%2").arg(it.key()).arg(QFileInfo(it.value()).lastModified().toMSecsSinceEpoch());
+	DatabaseWriter::flush();
+	SQLite::Query query(connection());
+	if (!query.exec("SELECT (SELECT count(*) || '.' || ifnull(max(dateAdded), 0) || '.' || ifnull(max(dateLastTrain), 0) FROM training), "
+		"(SELECT count(*) || '.' || ifnull(max(date), 0) FROM taggedEntries), "
+		"(SELECT count(*) || '.' || ifnull(max(dateLastChange), 0) FROM notes), "
+		"(SELECT count(*) FROM " LISTS_DB_TABLES_PREFIX ")") || !query.next()) return QString();
+	for (int i = 0; i < 4; i++) stamp << query.valueString(i);
+	return stamp.join(" ");
+}
+
 bool Database::detachDictionaryDB(const QString &alias)
 {
-	SQLite::Query query(&instance()->_connection);
+	SQLite::Query query(instance()->_connection);
 	if (!query.exec("detach database " + alias)) {
 		qCritical() << QString("Failed to attach database: %2").arg(query.lastError().message());
 		return false;
 	}
-	_attachedDBs.remove(alias);
+	{
+		QMutexLocker locker(&_attachedDBsMutex);
+		_attachedDBs.remove(alias);
+		_fts5DBs.remove(alias);
+		_mappedDBs.remove(alias);
+	}
+	_attachGeneration.ref();
+	foreach (SQLite::Connection *connection, instance()->_profiles) {
+		if (connection != instance()->_connection) connection->detach(alias);
+	}
 	return true;
 }
+
+DatabaseChangesWatcher::DatabaseChangesWatcher() : QObject(), _dataVersion(0), _lastChange(0)
+{
+	reset();
+	_timer.setInterval(interval);
+	connect(&_timer, SIGNAL(timeout()), this, SLOT(check()));
+	_timer.start();
+}
+
+void DatabaseChangesWatcher::reset()
+{
+	SQLite::Query query(Database::connection());
+	if (query.exec("PRAGMA data_version") && query.next()) _dataVersion = query.valueInt(0);
+	_lastChange = 0;
+	if (query.exec("SELECT max(seq) FROM entryChanges") && query.next()) _lastChange = query.valueInt64(0);
+}
+
+void DatabaseChangesWatcher::check()
+{
+	SQLite::Query query(Database::connection());
+	if (!query.exec("PRAGMA data_version") || !query.next()) return;
+	int version = query.valueInt(0);
+	if (version == _dataVersion) return;
+	_dataVersion = version;
+
+	if (!query.exec("SELECT min(seq), max(seq) FROM entryChanges") || !query.next() || query.valueIsNull(1)) return;
+	qint64 first = query.valueInt64(0);
+	qint64 last = query.valueInt64(1);
+	if (last <= _lastChange) return;
+	// Changes that have been trimmed from the log cannot be known
+	if (first > _lastChange + 1) {
+		_lastChange = last;
+		EntryLoader::resetUserData();
+		EntriesCache::userDataChanged();
+		EntryListCache::clearOwnerCache();
+		return;
+	}
+
+	QList<EntryRef> refs;
+	QSet<quint64> lists;
+	query.prepare("SELECT type, id, listId FROM entryChanges WHERE seq > ? AND seq <= ?");
+	query.bindValue(_lastChange);
+	query.bindValue(last);
+	if (!query.exec()) return;
+	while (query.next()) {
+		// Sub-lists are logged with a null type
+		if (query.valueUInt(0)) refs << EntryRef(query.valueUInt(0), query.valueUInt(1));
+		if (!query.valueIsNull(2)) lists << query.valueUInt64(2);
+	}
+	_lastChange = last;
+
+	foreach (const EntryRef &ref, refs) EntryLoader::markUserData(ref.type(), ref.id());
+	EntriesCache::userDataChanged(refs);
+	foreach (quint64 listId, lists) EntryListCache::reloadList(listId);
+	if (!lists.isEmpty()) EntryListCache::clearOwnerCache();
+}
+
+DatabaseCheckpointer::DatabaseCheckpointer(const QString &dbFile) : _dbFile(dbFile), _stop(false)
+{
+}
+
+DatabaseCheckpointer::~DatabaseCheckpointer()
+{
+	stop();
+}
+
+void DatabaseCheckpointer::stop()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		_wakeUp.wakeAll();
+	}
+	wait();
+}
+
+void DatabaseCheckpointer::setDatabase(const QString &dbFile)
+{
+	QMutexLocker lock(&_mutex);
+	_dbFile = dbFile;
+}
+
+void DatabaseCheckpointer::run()
+{
+	SQLite::Connection connection;
+	QString dbFile(_dbFile);
+	if (!connection.connect(dbFile, SQLite::Connection::WAL)) {
+		qWarning("Checkpointer cannot connect to user database: %s", connection.lastError().message().toLatin1().data());
+		return;
+	}
+	SQLite::Query vacuumQuery(&connection);
+
+	QMutexLocker lock(&_mutex);
+	while (!_stop) {
+		_wakeUp.wait(&_mutex, interval);
+		if (_stop) break;
+		// The profile has been switched
+		if (dbFile != _dbFile) {
+			dbFile = _dbFile;
+			connection.close();
+			if (!connection.connect(dbFile, SQLite::Connection::WAL)) {
+				qWarning("Checkpointer cannot connect to user database: %s", connection.lastError().message().toLatin1().data());
+				return;
+			}
+		}
+		lock.unlock();
+		if (!connection.checkpoint()) qWarning("WAL checkpoint failed: %s", connection.lastError().message().toLatin1().data());
+		// The statement frees one page per step
+		if (!vacuumQuery.exec(QString("pragma incremental_vacuum(%1)").arg(vacuumPages))) qWarning("Incremental vacuum failed: %s", vacuumQuery.lastError().message().toLatin1().data());
+		while (vacuumQuery.next());
+		vacuumQuery.clear();
+		lock.relock();
+	}
+	lock.unlock();
+	connection.close();
+}
+
+DatabaseBackup::DatabaseBackup(const QString &dbFile, unsigned long interval) : _dbFile(dbFile), _interval(interval), _stop(false)
+{
+}
+
+DatabaseBackup::~DatabaseBackup()
+{
+	stop();
+}
+
+void DatabaseBackup::stop()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		_wakeUp.wakeAll();
+	}
+	wait();
+}
+
+void DatabaseBackup::setDatabase(const QString &dbFile)
+{
+	QMutexLocker lock(&_mutex);
+	_dbFile = dbFile;
+	// Abort the backup of the previous database
+	_wakeUp.wakeAll();
+}
+
+QString DatabaseBackup::backupFile(const QString &dbFile, int index)
+{
+	return QString("%1.backup%2").arg(dbFile).arg(index);
+}
+
+bool DatabaseBackup::pause(const QString &dbFile, unsigned long msecs)
+{
+	QMutexLocker lock(&_mutex);
+	if (!_stop && _dbFile == dbFile) _wakeUp.wait(&_mutex, msecs);
+	return !_stop && _dbFile == dbFile;
+}
+
+bool DatabaseBackup::backup(const QString &dbFile)
+{
+	SQLite::Connection source;
+	if (!source.connect(dbFile, SQLite::Connection::WAL)) {
+		qWarning("Backup cannot connect to user database: %s", source.lastError().message().toLatin1().data());
+		return false;
+	}
+	// Only replace the latest backup once the new one is complete
+	const QString tmpFile(backupFile(dbFile, 0));
+	QFile::remove(tmpFile);
+	SQLite::Connection dest;
+	if (!dest.connect(tmpFile)) {
+		qWarning("Cannot create backup file %s: %s", tmpFile.toLocal8Bit().data(), dest.lastError().message().toLatin1().data());
+		return false;
+	}
+	sqlite3_backup *backup = sqlite3_backup_init(dest.sqlite3Handler(), "main", source.sqlite3Handler(), "main");
+	if (!backup) {
+		qWarning("Cannot start backup of user database: %s", dest.lastError().message().toLatin1().data());
+		dest.close();
+		QFile::remove(tmpFile);
+		return false;
+	}
+	// Each step only holds a read transaction on the database. Writes of
+	// other connections make the backup start over at the next step,
+	// which is cheap given the size of the user database.
+	int res;
+	bool aborted = false;
+	do {
+		res = sqlite3_backup_step(backup, pagesPerStep);
+		if (res == SQLITE_OK || res == SQLITE_BUSY || res == SQLITE_LOCKED)
+			aborted = !pause(dbFile, res == SQLITE_OK ? stepDelay : busyDelay);
+	} while (!aborted && (res == SQLITE_OK || res == SQLITE_BUSY || res == SQLITE_LOCKED));
+	sqlite3_backup_finish(backup);
+	dest.close();
+	source.close();
+	if (aborted || res != SQLITE_DONE) {
+		if (!aborted) qWarning("Backup of user database failed: %s", sqlite3_errstr(res));
+		QFile::remove(tmpFile);
+		return false;
+	}
+
+	QFile::remove(backupFile(dbFile, backupsCount));
+	for (int i = backupsCount; i > 1; i--) QFile::rename(backupFile(dbFile, i - 1), backupFile(dbFile, i));
+	if (!QFile::rename(tmpFile, backupFile(dbFile, 1))) {
+		qWarning("Cannot write backup file %s", backupFile(dbFile, 1).toLocal8Bit().data());
+		QFile::remove(tmpFile);
+		return false;
+	}
+	return true;
+}
+
+void DatabaseBackup::run()
+{
+	QMutexLocker lock(&_mutex);
+	while (!_stop) {
+		// Woken up by stop() or setDatabase(), wait again for the new one
+		if (_wakeUp.wait(&_mutex, _interval)) continue;
+		QString dbFile(_dbFile);
+		lock.unlock();
+		backup(dbFile);
+		lock.relock();
+	}
+}
+
+DatabaseWriter *DatabaseWriter::_instance = 0;
+
+static const char *writerStatements[DatabaseWriter::StatementsCount] = {
+	"insert or replace into training values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	"delete from training where type = ? and id = ?",
+	"delete from taggedEntries where type = ? and id = ?",
+	"insert into taggedEntries values(?, ?, ?, ?)",
+	"update notes set dateLastChange = ? where noteId = ?",
+	"update notesText set note = ? where docid = ?",
+	"delete from notes where noteId = ?",
+	"delete from notesText where docid = ?",
+	"insert or ignore into trainingEvents values(?, x'')",
+	"update trainingEvents set events = cast(events || ? as blob) where day = ?",
+};
+
+DatabaseWriter::DatabaseWriter(const QString &dbFile) : _dbFile(dbFile), _writing(false), _flushRequested(false), _batchDepth(0), _synchronous(false), _stop(false)
+{
+	_instance = this;
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+	stop();
+	if (_instance == this) _instance = 0;
+}
+
+void DatabaseWriter::stop()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		_wakeUp.wakeAll();
+	}
+	wait();
+	// The thread may have stopped before writing everything
+	QMutexLocker lock(&_mutex);
+	if (!_journal.isEmpty()) {
+		write(Database::connection(), _journal);
+		_journal.clear();
+	}
+	_pending.clear();
+	_flushed.wakeAll();
+}
+
+static bool bindVariant(SQLite::Query &query, const QVariant &value)
+{
+	switch (value.type()) {
+		case QVariant::Invalid:
+			return query.bindNullValue();
+		case QVariant::String:
+			return query.bindValue(value.toString());
+		case QVariant::ByteArray:
+			return query.bindValue(value.toByteArray());
+		default:
+			return query.bindValue(value.toLongLong());
+	}
+}
+
+bool DatabaseWriter::write(SQLite::Connection *connection, const QList<Operation> &ops)
+{
+	SQLite::Query queries[StatementsCount];
+	bool prepared[StatementsCount] = { false };
+	SQLite::Transaction transaction(connection);
+	if (!transaction.isActive()) {
+		qCritical("Cannot write journal: %s", connection->lastError().message().toLatin1().data());
+		return false;
+	}
+	foreach (const Operation &op, ops) {
+		SQLite::Query &query = queries[op.statement];
+		if (!prepared[op.statement]) {
+			query.useWith(connection);
+			if (!query.prepare(writerStatements[op.statement])) return false;
+			prepared[op.statement] = true;
+		}
+		foreach (const QVariant &value, op.values) bindVariant(query, value);
+		// A failed operation must not prevent the others from being written
+		if (!query.exec()) {
+			qCritical() << "Error executing query: " << query.lastError().message();
+			query.reset();
+		}
+	}
+	return transaction.commit();
+}
+
+void DatabaseWriter::setDatabase(const QString &dbFile)
+{
+	QMutexLocker lock(&_mutex);
+	_dbFile = dbFile;
+}
+
+void DatabaseWriter::switchToSynchronous(const QList<Operation> &ops)
+{
+	_journal = ops + _journal;
+	_writing = false;
+	_synchronous = true;
+	_flushRequested = false;
+	_flushed.wakeAll();
+}
+
+void DatabaseWriter::run()
+{
+	SQLite::Connection connection;
+	QString dbFile(_dbFile);
+	if (!connection.connect(dbFile, SQLite::Connection::WAL)) {
+		qWarning("Writer cannot connect to user database: %s", connection.lastError().message().toLatin1().data());
+		QMutexLocker lock(&_mutex);
+		_synchronous = true;
+		_flushed.wakeAll();
+		return;
+	}
+
+	int failures = 0;
+	QMutexLocker lock(&_mutex);
+	while (true) {
+		if ((_journal.size() < batchSize || _batchDepth > 0) && !_stop && !_flushRequested) _wakeUp.wait(&_mutex, interval);
+		if (!_journal.isEmpty() && (_batchDepth == 0 || _stop || _flushRequested)) {
+			QList<Operation> ops(_journal);
+			_journal.clear();
+			_writing = true;
+			// The profile has been switched, the journal was flushed before
+			bool reconnect = dbFile != _dbFile;
+			dbFile = _dbFile;
+			lock.unlock();
+			if (reconnect) {
+				connection.close();
+				if (!connection.connect(dbFile, SQLite::Connection::WAL)) {
+					qWarning("Writer cannot connect to user database: %s", connection.lastError().message().toLatin1().data());
+					lock.relock();
+					switchToSynchronous(ops);
+					return;
+				}
+			}
+			bool written = write(&connection, ops);
+			lock.relock();
+			_writing = false;
+			if (!written) {
+				// The batch has been rolled back, try it again later
+				if (++failures >= maxFailures) {
+					qCritical("Writer cannot write to user database, writing synchronously from now on");
+					switchToSynchronous(ops);
+					return;
+				}
+				_journal = ops + _journal;
+				continue;
+			}
+			failures = 0;
+			if (_journal.isEmpty()) {
+				_pending.clear();
+				_flushRequested = false;
+				_flushed.wakeAll();
+			}
+		}
+		if (_stop && _journal.isEmpty()) break;
+	}
+	lock.unlock();
+	connection.close();
+}
+
+void DatabaseWriter::enqueue(quint8 type, quint32 id, Statement statement, const QVariantList &values)
+{
+	Operation op = { statement, values };
+	QList<Operation> ops;
+	if (_instance) {
+		QMutexLocker lock(&_instance->_mutex);
+		if (!_instance->_synchronous) {
+			_instance->_journal << op;
+			_instance->_pending << entryKey(type, id);
+			// Only wake the thread up for full batches, or the first
+			// operation would always be written alone
+			if (_instance->_journal.size() >= batchSize && _instance->_batchDepth == 0) _instance->_wakeUp.wakeAll();
+			return;
+		}
+		// Operations recorded before the thread failed to connect
+		ops = _instance->_journal;
+		_instance->_journal.clear();
+		_instance->_pending.clear();
+	}
+	ops << op;
+	write(Database::connection(), ops);
+}
+
+void DatabaseWriter::flush()
+{
+	if (!_instance) return;
+	QMutexLocker lock(&_instance->_mutex);
+	while (!_instance->_synchronous && (!_instance->_journal.isEmpty() || _instance->_writing)) {
+		_instance->_flushRequested = true;
+		_instance->_wakeUp.wakeAll();
+		_instance->_flushed.wait(&_instance->_mutex);
+	}
+	// Operations left by the thread when it could not connect
+	if (_instance->_synchronous && !_instance->_journal.isEmpty()) {
+		QList<Operation> ops(_instance->_journal);
+		_instance->_journal.clear();
+		_instance->_pending.clear();
+		lock.unlock();
+		write(Database::connection(), ops);
+	}
+}
+
+void DatabaseWriter::beginBatch()
+{
+	if (!_instance) return;
+	QMutexLocker lock(&_instance->_mutex);
+	++_instance->_batchDepth;
+}
+
+void DatabaseWriter::endBatch()
+{
+	if (!_instance) return;
+	QMutexLocker lock(&_instance->_mutex);
+	if (--_instance->_batchDepth == 0) _instance->_wakeUp.wakeAll();
+}
+
+bool DatabaseWriter::hasPendingWrites(quint8 type, quint32 id)
+{
+	if (!_instance) return false;
+	QMutexLocker lock(&_instance->_mutex);
+	return _instance->_pending.contains(entryKey(type, id));
+}
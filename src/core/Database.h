@@ -19,54 +19,423 @@
 #define __CORE_DATABASE_H_
 
 #include "sqlite/Connection.h"
+#include "sqlite/FTS.h"
 
 #include "core/Paths.h"
+#include "core/Preferences.h"
 
 #include <QString>
 #include <QVector>
 #include <QMap>
+#include <QSet>
+#include <QVariant>
 #include <QTemporaryFile>
 #include <QDir>
 #include <QCoreApplication>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QTimer>
 
 struct sqlite3;
 
+/**
+ * Low-priority thread that regularly checkpoints the write-ahead log of
+ * the user database. Checkpoints are passive, so they never make a query
+ * or a training write wait.
+ *
+ * After each checkpoint a few free pages are also given back by an
+ * incremental vacuum, so that the database does not need to be vacuumed
+ * when the program exits.
+ */
+class DatabaseCheckpointer : public QThread
+{
+	Q_OBJECT
+private:
+	QString _dbFile;
+	QMutex _mutex;
+	QWaitCondition _wakeUp;
+	bool _stop;
+protected:
+	virtual void run();
+public:
+	/// Time between two checkpoints, in milliseconds
+	static const unsigned long interval = 5000;
+	/// Maximum number of pages freed after each checkpoint
+	static const int vacuumPages = 64;
+	/// Percentage of free pages above which the database is vacuumed on exit
+	static const int vacuumThreshold = 20;
+
+	DatabaseCheckpointer(const QString &dbFile);
+	virtual ~DatabaseCheckpointer();
+	/// Stops the thread and waits for it to terminate
+	void stop();
+	/// Checkpoints dbFile instead from the next checkpoint
+	void setDatabase(const QString &dbFile);
+};
+
+/**
+ * Low-priority thread that regularly backs up the user database while the
+ * program runs, using the online backup API of SQLite. Pages are copied by
+ * small batches with pauses in between, and the thread waits whenever the
+ * database is busy, so the backup never makes the GUI or a training write
+ * wait.
+ *
+ * Backups are written next to the database, the latest one to
+ * backupFile(dbFile, 1), and the previous ones are shifted up to
+ * backupsCount.
+ */
+class DatabaseBackup : public QThread
+{
+	Q_OBJECT
+private:
+	QString _dbFile;
+	unsigned long _interval;
+	QMutex _mutex;
+	QWaitCondition _wakeUp;
+	bool _stop;
+
+	/// Waits for msecs and returns false if the backup of dbFile must be
+	/// aborted
+	bool pause(const QString &dbFile, unsigned long msecs);
+	/// Backs up dbFile, returns false if the backup failed or was aborted
+	bool backup(const QString &dbFile);
+protected:
+	virtual void run();
+public:
+	/// Number of pages copied at once
+	static const int pagesPerStep = 64;
+	/// Pause between two batches of pages, in milliseconds
+	static const unsigned long stepDelay = 20;
+	/// Pause before trying again when the database is busy, in milliseconds
+	static const unsigned long busyDelay = 250;
+	/// Number of backups kept
+	static const int backupsCount = 3;
+
+	/// Backs up dbFile every interval milliseconds
+	DatabaseBackup(const QString &dbFile, unsigned long interval);
+	virtual ~DatabaseBackup();
+	/// Aborts the backup in progress, stops the thread and waits for it to
+	/// terminate
+	void stop();
+	/// Backs up dbFile instead from the next backup
+	void setDatabase(const QString &dbFile);
+
+	/// File of the index-th latest backup of dbFile, starting from 1
+	static QString backupFile(const QString &dbFile, int index);
+};
+
+/**
+ * Write-behind journal of the user data changes that do not need to be
+ * visible immediately to the database: training results, tags and note
+ * edits. Changes are recorded in memory by the GUI thread and written by
+ * this thread in batched transactions using prepared statements, at most
+ * interval milliseconds later, so that answering does not wait for the
+ * disk. The journal is flushed when the database is stopped.
+ *
+ * Entries with pending changes are tracked so that EntryLoader can flush
+ * the journal before reloading their user data.
+ */
+class DatabaseWriter : public QThread
+{
+	Q_OBJECT
+public:
+	/// Statements that can be put into the journal. Values are bound in order.
+	typedef enum {
+		UpdateTraining = 0, RemoveTraining, ClearTags, AddTag, UpdateNote, UpdateNoteText, RemoveNote, RemoveNoteText, AddEventsDay, AppendEvents,
+		StatementsCount
+	} Statement;
+
+private:
+	struct Operation
+	{
+		Statement statement;
+		QVariantList values;
+	};
+
+	QString _dbFile;
+	QMutex _mutex;
+	QWaitCondition _wakeUp;
+	QWaitCondition _flushed;
+	QList<Operation> _journal;
+	/// Entries with operations in the journal or being written
+	QSet<quint64> _pending;
+	/// Whether a batch is being written
+	bool _writing;
+	/// Set by flush() to have the journal written without waiting
+	bool _flushRequested;
+	/// Number of batches in progress, during which the journal is only
+	/// written when flushed
+	int _batchDepth;
+	/// Set if the thread could not connect, operations are then written
+	/// by the thread recording them
+	bool _synchronous;
+	bool _stop;
+
+	static DatabaseWriter *_instance;
+
+	static quint64 entryKey(quint8 type, quint32 id) { return ((quint64)type << 32) | id; }
+	/// Writes ops into connection in a single transaction
+	static bool write(SQLite::Connection *connection, const QList<Operation> &ops);
+	/// Puts ops back at the start of the journal and has it written by the
+	/// threads recording operations from now on. Must be called from the
+	/// thread with _mutex held
+	void switchToSynchronous(const QList<Operation> &ops);
+protected:
+	virtual void run();
+public:
+	/// Maximum time an operation stays in the journal, in milliseconds
+	static const unsigned long interval = 1000;
+	/// Number of operations that triggers a write before interval expires
+	static const int batchSize = 256;
+	/// Number of consecutive failed writes after which the thread stops
+	/// writing
+	static const int maxFailures = 3;
+
+	DatabaseWriter(const QString &dbFile);
+	virtual ~DatabaseWriter();
+	/// Writes the journal, stops the thread and waits for it to terminate
+	void stop();
+	/// Writes the operations recorded from now on into dbFile. The journal
+	/// must have been flushed before.
+	void setDatabase(const QString &dbFile);
+
+	/**
+	 * Records the execution of statement with values, for the entry of the
+	 * given type and id. If no writer is running the statement is executed
+	 * immediately on Database::connection().
+	 */
+	static void enqueue(quint8 type, quint32 id, Statement statement, const QVariantList &values);
+	/// Waits until every recorded operation has been written
+	static void flush();
+	/**
+	 * Operations recorded between beginBatch() and endBatch() are written
+	 * in a single transaction, however many there are, unless the journal
+	 * is flushed meanwhile. Batches can be nested.
+	 */
+	static void beginBatch();
+	/// Ends a batch and has its operations written without waiting
+	static void endBatch();
+	static bool hasPendingWrites(quint8 type, quint32 id);
+};
+
+/**
+ * Watches the changes made to the user data by other connections, e.g. by
+ * other processes sharing the user database, and invalidates the cached
+ * entries and lists they affect. PRAGMA data_version tells cheaply
+ * whether another connection changed the database since the last check,
+ * in which case the changed entries are read from the entryChanges log.
+ *
+ * Runs in the thread that initialized the database.
+ */
+class DatabaseChangesWatcher : public QObject
+{
+	Q_OBJECT
+private:
+	QTimer _timer;
+	int _dataVersion;
+	/// Last change of the log that has been processed
+	qint64 _lastChange;
+
+protected slots:
+	void check();
+
+public:
+	/// Time between two checks, in milliseconds
+	static const int interval = 1000;
+
+	DatabaseChangesWatcher();
+	/// Watches the current user database from its current state
+	void reset();
+};
+
+/**
+ * Called before each step of an upgrade of the user database with the
+ * number of steps done and the total number of steps, and once more when
+ * the upgrade is complete.
+ */
+typedef void (*UserDBUpgradeHandler)(int done, int total);
+
 class Database
 {
 Q_DECLARE_TR_FUNCTIONS(Database)
 private:
 	/// Set to the name of the current user DB file
 	static QString _userDBFile;
+	/// Protects _userDBFile, which is read by the connections of other threads
+	static QMutex _userDBFileMutex;
+	/// Name of the current profile, empty for the default one
+	static QString _profile;
+	/// Incremented every time the profile is switched
+	static QAtomicInt _profileGeneration;
 	/// Temporary file used to create the temporary user DB
 	QTemporaryFile *_tFile;
+	DatabaseCheckpointer *_checkpointer;
+	DatabaseBackup *_backup;
+	DatabaseWriter *_writer;
+	DatabaseChangesWatcher *_changesWatcher;
 	static QMap<QString, QString> _attachedDBs;
+	/// Aliases of the attached dictionaries built with FTS5 indexes
+	static QSet<QString> _fts5DBs;
+	/// Protects _attachedDBs, _fts5DBs and _mappedDBs, which are read by
+	/// the connections of other threads
+	static QMutex _attachedDBsMutex;
+	/// Dictionaries kept in memory, by alias, with their mapping size.
+	/// See mapDictionary()
+	static QMap<QString, qint64> _mappedDBs;
+	/// Set to stop the reading of the mapped dictionaries
+	static QAtomicInt _stopPreloading;
+	/// Incremented every time a dictionary is attached or detached
+	static QAtomicInt _attachGeneration;
 	static Database *_instance;
+	static UserDBUpgradeHandler _upgradeHandler;
 
-	SQLite::Connection _connection;
+	/// Connections of the opened profiles, by name
+	QMap<QString, SQLite::Connection *> _profiles;
+	/// Connection of the current profile
+	SQLite::Connection *_connection;
 	Database();
 	~Database();
 
 	bool createUserDB();
 	bool updateUserDB(int currentVersion);
+	/// Connects _connection to filename, without making it the current user DB
 	bool connectUserDB(QString filename, QStringList &errors);
+	static void setUserDBFile(const QString &file);
 	bool checkUserDB(QStringList &errors);
 	bool connectToTemporaryDatabase(QStringList &errors);
 	void closeDB();
+	/**
+	 * Records the table sizes gathered by ANALYZE in the attached
+	 * database alias, so the query builder can order joins by cost.
+	 */
+	static void loadTableStatistics(const QString &alias);
+	/// Cleans up, checkpoints and closes the database of an opened profile
+	static void closeProfile(SQLite::Connection *connection);
+	/**
+	 * If dictionariesInMemory is set, decides whether the dictionary
+	 * file attached as alias can be kept in memory. If so, it is mapped
+	 * at its full size by every connection and read by a background
+	 * thread, so searches never wait for the disk. Otherwise it is used
+	 * like any file.
+	 */
+	static void mapDictionary(const QString &file, const QString &alias);
+	/// Maps alias entirely in connection if it is kept in memory
+	static void applyDictionaryMapping(SQLite::Connection &connection, const QString &alias);
 
 public:
-	static bool init(const QString &userDBFile, bool temporary, QStringList &errors);
+	/// Sets the handler reporting the progress of the user database upgrade,
+	/// must be called before init()
+	static void setUpgradeHandler(UserDBUpgradeHandler handler) { _upgradeHandler = handler; }
+	/// If userDBFile is empty, the database of profile is used
+	static bool init(const QString &userDBFile, bool temporary, QStringList &errors, const QString &profile = QString());
 	static void stop();
 	static Database *instance() { return _instance; }
-	static SQLite::Connection *connection() { return &_instance->_connection; }
+	static SQLite::Connection *connection() { return _instance->_connection; }
+	/**
+	 * Returns a connection usable from the calling thread: connection()
+	 * from the GUI thread, and a query-only connection opened for the
+	 * thread on its first call otherwise, with the dictionaries attached.
+	 * Connections of other threads are reopened after a profile switch.
+	 */
+	static SQLite::Connection *threadConnection();
+	/**
+	 * Opens connection on the user database of the current profile,
+	 * query-only, with all the dictionaries attached. This is how the
+	 * connections of threadConnection() and of the database threads
+	 * are set up. If attached is given, it receives the attached
+	 * dictionaries for later calls to attachDictionaries().
+	 */
+	static bool openReaderConnection(SQLite::Connection &connection, QMap<QString, QString> *attached = 0);
+	/**
+	 * Opens connection on an in-memory database and attaches dbs to it,
+	 * given as files by alias. For connections that only read dictionaries,
+	 * like those of the entry loaders, so they do not keep the user
+	 * database open.
+	 */
+	static bool openDictionaryConnection(SQLite::Connection &connection, const QMap<QString, QString> &dbs);
+	/**
+	 * Attaches dbs, given as files by alias, to connection in one step,
+	 * read-only. If attached is given, it lists the dictionaries already
+	 * attached to connection: those are not attached again, and those
+	 * that are not in dbs anymore are detached. Returns false if a
+	 * dictionary could not be attached.
+	 */
+	static bool attachDictionaries(SQLite::Connection &connection, const QMap<QString, QString> &dbs, QMap<QString, QString> *attached = 0);
 
-	static const QString &userDBFile() { return _userDBFile; }
+	/// Can be called from any thread
+	static QString userDBFile();
 	static QString defaultDBFile() { return QDir(userProfile()).absoluteFilePath("user.db"); }
 
+	/**
+	 * Profiles let several users share the program, each with their own
+	 * user database. The default profile (with an empty name) uses the
+	 * default user database, and the other ones a database of the profiles
+	 * directory of the user profile.
+	 */
+	static QString profileFile(const QString &profile);
+	/// Profile names are used as file names, so they can only contain
+	/// letters, digits, spaces, dashes and underscores
+	static bool isValidProfileName(const QString &profile);
+	/// Returns the names of the existing profiles, starting with the default one
+	static QStringList profiles();
+	static const QString &currentProfile() { return _profile; }
+	/**
+	 * Opens the database of profile, creating or upgrading it if needed,
+	 * and attaches the dictionaries to it so that it can be switched to
+	 * instantly. Opened profiles remain so until stop() is called.
+	 */
+	static bool openProfile(const QString &profile, QStringList &errors);
+	/**
+	 * Makes profile the current one, opening it first if needed. Pending
+	 * changes are written to the previous profile, and the caches holding
+	 * user data (entries, tags and lists) are invalidated. The dictionaries
+	 * remain attached and the database threads keep running, only
+	 * reconnecting to the new user database before their next query.
+	 *
+	 * Must be called from the GUI thread. Entry lists obtained before must
+	 * not be used anymore.
+	 */
+	static bool switchProfile(const QString &profile, QStringList &errors);
+	/// Allows other connections to the user database to know they must reconnect
+	static int profileGeneration() { return _profileGeneration.loadAcquire(); }
+
 	static bool attachDictionaryDB(const QString &file, const QString &alias, int expectedVersion);
 	static bool detachDictionaryDB(const QString &alias);
 	static const QMap<QString, QString> &attachedDBs() { return _attachedDBs; }
+	/**
+	 * Version of the full-text indexes of the dictionary attached as
+	 * alias, which decides the syntax of its MATCH expressions. Can be
+	 * called from any thread.
+	 */
+	static SQLite::FTS::Version ftsVersion(const QString &alias);
+	/// Copy of attachedDBs() that can be taken from any thread
+	static QMap<QString, QString> attachedDBsSnapshot();
+	/**
+	 * Returns a string that changes whenever the attached dictionaries
+	 * or the user data searches can depend on (study, tags, notes and
+	 * lists) change, or an empty string in case of error.
+	 */
+	static QString dataStamp();
+
+	static const SQLite::Error &lastError() { return _instance->_connection->lastError(); }
 
-	static const SQLite::Error &lastError() { return _instance->_connection.lastError(); }
+	/// Size of the page cache of each database, in KiB
+	static PreferenceItem<int> cacheSize;
+	/// Amount of memory-mapped I/O per database, in MiB. 0 disables it.
+	static PreferenceItem<int> mmapSize;
+	/// Keep the dictionaries in memory, see mapDictionary()
+	static PreferenceItem<bool> dictionariesInMemory;
+	/// Total size of the dictionaries that can be kept in memory, in MiB
+	static PreferenceItem<int> dictionariesInMemoryMaxSize;
+	/// Log the timings of all queries to queries.log in the user profile
+	static PreferenceItem<bool> profileQueries;
+	/// Queries that take longer than this (in ms) also get their plan logged
+	static PreferenceItem<int> slowQueryThreshold;
+	/// Time between two backups of the user database, in minutes. 0
+	/// disables them.
+	static PreferenceItem<int> backupInterval;
 };
 
 #endif
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/DatabaseVerifier.h"
+#include "core/Database.h"
+#include "sqlite/Query.h"
+
+#include <QtDebug>
+#include <QMutexLocker>
+
+DatabaseVerifier *DatabaseVerifier::_instance = 0;
+
+DatabaseVerifier::DatabaseVerifier(DatabaseCorruptionHandler handler) : QThread(), _handler(handler), _stop(false), _connection(0)
+{
+}
+
+DatabaseVerifier::~DatabaseVerifier()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		if (_connection) _connection->interrupt();
+	}
+	wait();
+}
+
+void DatabaseVerifier::startVerification(DatabaseCorruptionHandler handler)
+{
+	if (_instance) return;
+	_instance = new DatabaseVerifier(handler);
+	_instance->_userDBFile = Database::userDBFile();
+	_instance->_dictionaries = Database::attachedDBsSnapshot().values();
+	_instance->start(QThread::LowestPriority);
+}
+
+void DatabaseVerifier::stopVerification()
+{
+	delete _instance;
+	_instance = 0;
+}
+
+bool DatabaseVerifier::verify(const QString &file, const QString &check, SQLite::Connection::OpenFlags flags)
+{
+	SQLite::Connection connection;
+	if (!connection.connect(file, flags)) {
+		_errors << tr("Cannot open %1 to verify it: %2").arg(file).arg(connection.lastError().message());
+		return true;
+	}
+	{
+		QMutexLocker lock(&_mutex);
+		if (_stop) return false;
+		_connection = &connection;
+	}
+	bool ret = true;
+	{
+		SQLite::Query query(&connection);
+		if (!query.exec(QString("pragma %1(%2)").arg(check).arg(maxErrors))) {
+			if (query.lastError().isInterrupted()) ret = false;
+			else _errors << tr("Cannot verify %1: %2").arg(file).arg(query.lastError().message());
+		} else {
+			// A single "ok" row if nothing is wrong
+			QStringList problems;
+			while (query.next()) problems << query.valueString(0);
+			if (query.lastError().isInterrupted()) ret = false;
+			else if (problems != QStringList("ok")) _errors << tr("%1 is corrupted: %2").arg(file).arg(problems.join("; "));
+		}
+	}
+	{
+		QMutexLocker lock(&_mutex);
+		_connection = 0;
+	}
+	connection.close();
+	return ret;
+}
+
+void DatabaseVerifier::run()
+{
+	// The user database is the one that can get corrupted by a crash
+	if (!verify(_userDBFile, "integrity_check", SQLite::Connection::WAL)) return;
+	foreach (const QString &file, _dictionaries) {
+		if (!verify(file, "quick_check", SQLite::Connection::ReadOnly)) return;
+	}
+	if (!_errors.isEmpty()) QMetaObject::invokeMethod(this, "onVerified", Qt::QueuedConnection);
+}
+
+void DatabaseVerifier::onVerified()
+{
+	foreach (const QString &error, _errors) qCritical("%s", error.toUtf8().constData());
+	if (_handler) _handler(_errors);
+}
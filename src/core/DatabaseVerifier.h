@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_DATABASE_VERIFIER_H
+#define __CORE_DATABASE_VERIFIER_H
+
+#include "sqlite/Connection.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QStringList>
+
+/**
+ * Called from the GUI thread with the problems found by the verifier, if
+ * any.
+ */
+typedef void (*DatabaseCorruptionHandler)(const QStringList &errors);
+
+/**
+ * Verifies the integrity of the databases in the background once the
+ * program has started, so startup only checks their versions and does not
+ * take longer as they grow. The user database gets a full integrity check,
+ * the dictionaries, which are never written, a quick check.
+ *
+ * The thread runs with the lowest priority and is interrupted when the
+ * program exits. Problems found are reported to the handler given to
+ * startVerification().
+ */
+class DatabaseVerifier : public QThread
+{
+	Q_OBJECT
+private:
+	static DatabaseVerifier *_instance;
+
+	DatabaseCorruptionHandler _handler;
+	/// Files to verify, taken from the GUI thread since the profile may be
+	/// switched meanwhile
+	QString _userDBFile;
+	QStringList _dictionaries;
+	QMutex _mutex;
+	bool _stop;
+	/// Connection being used by the thread, to interrupt it
+	SQLite::Connection *_connection;
+	QStringList _errors;
+
+	DatabaseVerifier(DatabaseCorruptionHandler handler);
+	virtual ~DatabaseVerifier();
+
+	/**
+	 * Runs check (integrity_check or quick_check) on file and adds the
+	 * problems it reports to _errors. Returns false if the verification
+	 * has been stopped.
+	 */
+	bool verify(const QString &file, const QString &check, SQLite::Connection::OpenFlags flags);
+
+protected:
+	virtual void run();
+
+private slots:
+	void onVerified();
+
+public:
+	/// Maximum number of problems reported by database
+	static const int maxErrors = 10;
+
+	/**
+	 * Starts verifying the user database and the attached dictionaries.
+	 * Must be called from the GUI thread, once the dictionaries are
+	 * attached.
+	 */
+	static void startVerification(DatabaseCorruptionHandler handler);
+	/// Stops the verification and waits for the thread to terminate
+	static void stopVerification();
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/DictionaryWarmer.h"
+#include "sqlite/Query.h"
+
+#include <QtDebug>
+#include <QEvent>
+#include <QMutexLocker>
+
+#include <limits>
+
+DictionaryWarmer *DictionaryWarmer::_instance = 0;
+QList<DictionaryWarmer::Target> DictionaryWarmer::_pendingTargets;
+PreferenceItem<bool> DictionaryWarmer::enabled("", "warmDictionaries", true);
+
+DictionaryWarmer::DictionaryWarmer() : QThread(), _current(0), _nextKey(std::numeric_limits<qint64>::min()), _paused(true), _stop(false), _connection(0)
+{
+	_idleTimer.setSingleShot(true);
+	connect(&_idleTimer, SIGNAL(timeout()), this, SLOT(onIdle()));
+}
+
+DictionaryWarmer::~DictionaryWarmer()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		if (_connection) _connection->interrupt();
+		_wakeUp.wakeAll();
+	}
+	wait();
+}
+
+void DictionaryWarmer::addTarget(const QString &file, const QString &table, const QString &key, const QString &expr, const QString &index)
+{
+	Target target;
+	target.file = file;
+	target.table = table;
+	target.index = index;
+	target.key = key;
+	target.expr = expr;
+	if (!_instance) {
+		_pendingTargets << target;
+		return;
+	}
+	QMutexLocker lock(&_instance->_mutex);
+	_instance->_targets << target;
+	_instance->_wakeUp.wakeAll();
+}
+
+void DictionaryWarmer::removeTargets(const QString &file)
+{
+	for (int i = _pendingTargets.size() - 1; i >= 0; i--)
+		if (_pendingTargets[i].file == file) _pendingTargets.removeAt(i);
+	if (!_instance) return;
+
+	QMutexLocker lock(&_instance->_mutex);
+	QList<Target> &targets(_instance->_targets);
+	for (int i = targets.size() - 1; i >= 0; i--) {
+		if (targets[i].file != file) continue;
+		targets.removeAt(i);
+		// Keep warming the same tree, or start the next one from its beginning
+		if (i < _instance->_current) --_instance->_current;
+		else if (i == _instance->_current) _instance->_nextKey = std::numeric_limits<qint64>::min();
+	}
+}
+
+void DictionaryWarmer::startWarming(QObject *app)
+{
+	if (_instance || !enabled.value()) return;
+	_instance = new DictionaryWarmer();
+	_instance->_targets = _pendingTargets;
+	_pendingTargets.clear();
+	app->installEventFilter(_instance);
+	_instance->_idleTimer.start(idleDelay);
+	_instance->start(QThread::LowestPriority);
+}
+
+void DictionaryWarmer::stopWarming()
+{
+	delete _instance;
+	_instance = 0;
+}
+
+void DictionaryWarmer::pause()
+{
+	QMutexLocker lock(&_mutex);
+	if (_paused) return;
+	_paused = true;
+	// Give the disk back right away
+	if (_connection) _connection->interrupt();
+}
+
+void DictionaryWarmer::resume()
+{
+	QMutexLocker lock(&_mutex);
+	_paused = false;
+	_wakeUp.wakeAll();
+}
+
+bool DictionaryWarmer::eventFilter(QObject *watched, QEvent *event)
+{
+	switch (event->type()) {
+	case QEvent::KeyPress:
+	case QEvent::MouseButtonPress:
+	case QEvent::Wheel:
+		pause();
+		_idleTimer.start(idleDelay);
+		break;
+	default:
+		break;
+	}
+	return QThread::eventFilter(watched, event);
+}
+
+void DictionaryWarmer::onIdle()
+{
+	resume();
+}
+
+bool DictionaryWarmer::warmRange(SQLite::Connection &connection, const Target &target, qint64 &nextKey)
+{
+	SQLite::Query query(&connection);
+	QString from(target.table);
+	if (!target.index.isEmpty()) from += " indexed by " + target.index;
+	if (!query.prepare(QString("select count(%1), max(%2) from (select %2, %1 from %3 where %2 >= ? order by %2 limit %4)").arg(target.expr).arg(target.key).arg(from).arg(rangeSize))) {
+		qWarning("Cannot warm %s of %s: %s", target.table.toUtf8().constData(), target.file.toUtf8().constData(), query.lastError().message().toUtf8().constData());
+		return false;
+	}
+	query.bindValue(nextKey);
+	if (!query.exec() || !query.next()) {
+		// Paused while reading, do this range again later
+		if (query.lastError().isInterrupted()) return true;
+		qWarning("Cannot warm %s of %s: %s", target.table.toUtf8().constData(), target.file.toUtf8().constData(), query.lastError().message().toUtf8().constData());
+		return false;
+	}
+	if (query.valueInt64(0) == 0) return false;
+	qint64 last = query.valueInt64(1);
+	if (last == std::numeric_limits<qint64>::max()) return false;
+	nextKey = last + 1;
+	return true;
+}
+
+void DictionaryWarmer::run()
+{
+	SQLite::Connection connection;
+	QMutexLocker lock(&_mutex);
+	_connection = &connection;
+	while (!_stop) {
+		if (_paused || _current >= _targets.size()) {
+			_wakeUp.wait(&_mutex);
+			continue;
+		}
+		Target target(_targets[_current]);
+		qint64 nextKey = _nextKey;
+		lock.unlock();
+
+		if (connection.dbFileName() != target.file || !connection.connected()) {
+			if (connection.connected()) connection.close();
+			// Only the OS page cache is meant to be warmed, so keep the
+			// cache of this connection small
+			if (connection.connect(target.file, SQLite::Connection::ReadOnly)) connection.exec("pragma cache_size=-256");
+			else qWarning("Cannot open %s to warm it", target.file.toUtf8().constData());
+		}
+		bool more = connection.connected() && warmRange(connection, target, nextKey);
+
+		lock.relock();
+		// Targets may have been removed meanwhile
+		if (_current < _targets.size() && _targets[_current] == target) {
+			if (more) _nextKey = nextKey;
+			else {
+				++_current;
+				_nextKey = std::numeric_limits<qint64>::min();
+			}
+		}
+		if (!_stop && !_paused) _wakeUp.wait(&_mutex, throttle);
+	}
+	_connection = 0;
+	lock.unlock();
+	if (connection.connected()) connection.close();
+}
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_DICTIONARY_WARMER_H
+#define __CORE_DICTIONARY_WARMER_H
+
+#include "core/Preferences.h"
+#include "sqlite/Connection.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QTimer>
+#include <QList>
+
+/**
+ * Reads the hot B-trees of the dictionaries (full-text indexes, tables
+ * and indexes used by every search) while the user is idle, so their
+ * pages are in the OS page cache when the first search needs them. The
+ * dictionaries are memory-mapped, so they benefit from it directly.
+ *
+ * Trees are read by small ranges of keys, separated by a pause to not
+ * compete with the rest of the program. Any key press or mouse click
+ * pauses the warmer until the user has been idle again for a while;
+ * it resumes where it stopped.
+ *
+ * Plugins register their trees using addTarget() when their databases
+ * are attached.
+ */
+class DictionaryWarmer : public QThread
+{
+	Q_OBJECT
+private:
+	struct Target {
+		QString file;
+		QString table;
+		/// Index to read instead of the table, if any
+		QString index;
+		/// Integer column the ranges are made on, that the tree is ordered by
+		QString key;
+		/// Expression that reads what must be warmed internally, e.g. the
+		/// blob of full-text segments
+		QString expr;
+
+		bool operator==(const Target &other) const { return file == other.file && table == other.table && index == other.index; }
+	};
+
+	static DictionaryWarmer *_instance;
+	static QList<Target> _pendingTargets;
+
+	QMutex _mutex;
+	QWaitCondition _wakeUp;
+	QList<Target> _targets;
+	/// Tree being warmed and first key of the next range to read
+	int _current;
+	qint64 _nextKey;
+	bool _paused;
+	bool _stop;
+	/// Connection being used by the thread, to interrupt it
+	SQLite::Connection *_connection;
+	QTimer _idleTimer;
+
+	DictionaryWarmer();
+	virtual ~DictionaryWarmer();
+
+	/// Reads the next range of the current target. Returns false once it is done.
+	bool warmRange(SQLite::Connection &connection, const Target &target, qint64 &nextKey);
+
+protected:
+	virtual void run();
+	virtual bool eventFilter(QObject *watched, QEvent *event);
+
+private slots:
+	void onIdle();
+
+public:
+	static PreferenceItem<bool> enabled;
+	/// Number of keys read at once
+	static const int rangeSize = 2048;
+	/// Pause between two ranges, in milliseconds
+	static const int throttle = 10;
+	/// Time without user activity after which the warmer runs, in milliseconds
+	static const int idleDelay = 2000;
+
+	/**
+	 * Registers a tree to warm, given by its table and optionally the
+	 * index to read instead. key must be an integer column the tree is
+	 * ordered by, and expr what to read from each row.
+	 */
+	static void addTarget(const QString &file, const QString &table, const QString &key, const QString &expr, const QString &index = QString());
+	/// Forgets the trees of file, e.g. because it is being detached
+	static void removeTargets(const QString &file);
+
+	/**
+	 * Starts warming the registered trees once the user is idle, watching
+	 * the events of app for activity. Must be called from the GUI thread.
+	 */
+	static void startWarming(QObject *app);
+	/// Stops warming and waits for the thread to terminate
+	static void stopWarming();
+
+	void pause();
+	void resume();
+};
+
+#endif
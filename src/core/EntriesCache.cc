@@ -17,15 +17,92 @@
 
 #include "tagaini_config.h"
 #include "core/EntriesCache.h"
+#include "core/EntrySummary.h"
+#include "core/Paths.h"
+#include "core/StartupTrace.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
 
 #include <QtDebug>
-#include <QCoreApplication>
 #include <QMutexLocker>
 #include <QWeakPointer>
 #include <QDataStream>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QThread>
+#include <QFile>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSemaphore>
+
+#include <list>
 
 EntriesCache *EntriesCache::_instance = 0;
 PreferenceItem<int> EntriesCache::cacheSize("", "entriesCacheSize", 1000);
+PreferenceItem<int> EntriesCache::cacheMemory("", "entriesCacheMemory", 32768);
+
+/**
+ * Records the time taken by timer to load count entries or summaries of the
+ * given type, averaged per entry.
+ */
+static void recordLoadTime(const char *what, EntryType type, const QElapsedTimer &timer, int count)
+{
+	if (!timer.isValid() || count <= 0) return;
+	PerfCounters::histogram(QString("%1 load time per entry (type %2)").arg(what).arg((int)type)).record(timer.nsecsElapsed() / 1000 / count);
+}
+
+/**
+ * Bulk load of the entries or summaries of a single type. The types of a
+ * batch mixing several of them are loaded in parallel, each from its own
+ * thread and loaders.
+ */
+class EntriesCache::TypeLoad : public QRunnable
+{
+public:
+	EntryType type;
+	QVector<EntryId> ids;
+	bool summaries;
+	QVector<Entry *> entries;
+	QVector<EntrySummary> loadedSummaries;
+	QSemaphore *done;
+
+	TypeLoad(EntryType t, const QVector<EntryId> &i, bool s) : type(t), ids(i), summaries(s), done(0) { setAutoDelete(false); }
+	/// Loads from the calling thread
+	void load();
+	virtual void run() { load(); done->release(); }
+};
+
+void EntriesCache::TypeLoad::load()
+{
+	EntryLoader *loader = EntriesCache::instance().loaderFor(type);
+	QElapsedTimer timer;
+	if (PerfCounters::enabled()) timer.start();
+	if (!loader) return;
+	if (summaries) {
+		TRACE_SCOPE("Summaries load");
+		loadedSummaries = loader->loadSummaries(ids);
+		recordLoadTime("Summary", type, timer, loadedSummaries.size());
+	} else {
+		TRACE_SCOPE("Entries load");
+		entries = loader->loadEntries(ids);
+		recordLoadTime("Entry", type, timer, ids.size());
+	}
+}
+
+void EntriesCache::runLoads(const QList<TypeLoad *> &loads)
+{
+	QSemaphore done;
+	int started = 0;
+	// Only idle threads are used, so the calling thread never waits for
+	// other requests. Loads that get none run from the calling thread.
+	for (int i = 1; i < loads.size(); i++) {
+		loads[i]->done = &done;
+		if (_pool.tryStart(loads[i])) ++started;
+		else loads[i]->load();
+	}
+	if (!loads.isEmpty()) loads[0]->load();
+	done.acquire(started);
+}
 
 QDataStream &operator<<(QDataStream &out, const EntryRef &ref)
 {
@@ -39,14 +116,117 @@ QDataStream &operator>>(QDataStream &in, EntryRef &ref)
 	return in;
 }
 
-EntriesCache::EntriesCache() : _loadedEntriesMutex(QMutex::Recursive), _cacheMutex(QMutex::Recursive)
+/**
+ * Load of an entry that other threads requesting the same entry can wait
+ * for.
+ */
+class PendingLoad
+{
+public:
+	QWaitCondition done;
+	bool finished;
+	EntryPointer entry;
+
+	PendingLoad() : finished(false) {}
+};
+
+class EntriesCache::Shard
+{
+public:
+	struct CachedEntry
+	{
+		EntryPointer entry;
+		/// Memory footprint of the entry when it was cached
+		int footprint;
+
+		CachedEntry(const EntryPointer &e) : entry(e), footprint(e->memoryFootprint()) {}
+	};
+
+	QMutex mutex;
+	QHash<EntryRef, QWeakPointer<Entry> > loadedEntries;
+	QHash<EntryRef, QSharedPointer<PendingLoad> > loading;
+	/// Cached entries, most recently used first
+	std::list<CachedEntry> lru;
+	QHash<EntryRef, std::list<CachedEntry>::iterator> lruPos;
+	/// Sum of the footprints of the entries of lru
+	qint64 bytes;
+	quint64 hits;
+	quint64 misses;
+	quint64 evictions;
+
+	Shard() : bytes(0), hits(0), misses(0), evictions(0) {}
+
+	/**
+	 * Moves entry at the head of the LRU list, adding it if needed. Entries
+	 * pushed out of the list are moved into evicted, which must be released
+	 * after the shard lock since it may trigger the deletion of entries.
+	 */
+	void touch(const EntryRef &key, const EntryPointer &entry, QList<EntryPointer> &evicted);
+};
+
+void EntriesCache::Shard::touch(const EntryRef &key, const EntryPointer &entry, QList<EntryPointer> &evicted)
+{
+	QHash<EntryRef, std::list<CachedEntry>::iterator>::iterator pos(lruPos.find(key));
+	if (pos != lruPos.end()) lru.splice(lru.begin(), lru, pos.value());
+	else {
+		lru.push_front(CachedEntry(entry));
+		lruPos.insert(key, lru.begin());
+		bytes += lru.front().footprint;
+	}
+
+	// Round up so that a small non-zero cache size keeps some entries
+	int capacity = (EntriesCache::cacheSize.value() + nbShards - 1) / nbShards;
+	qint64 budget = (EntriesCache::cacheMemory.value() * Q_INT64_C(1024) + nbShards - 1) / nbShards;
+	// The entry that has just been used is always kept
+	while (lru.size() > 1 && ((int)lruPos.size() > capacity || bytes > budget)) {
+		const CachedEntry &last = lru.back();
+		lruPos.remove(EntryRef(last.entry->type(), last.entry->id()));
+		bytes -= last.footprint;
+		evicted << last.entry;
+		lru.pop_back();
+		++evictions;
+	}
+}
+
+class EntriesCache::LoaderSet
 {
+public:
+	EntryLoaderFactory factory;
+	QMutex mutex;
+	QHash<QThread *, EntryLoader *> loaders;
+
+	LoaderSet(EntryLoaderFactory f) : factory(f) {}
+	~LoaderSet() { qDeleteAll(loaders); }
+};
+
+EntriesCache::EntriesCache() : _shards(new Shard[nbShards])
+{
+	// Loaders are kept per thread, so pool threads must not be recycled
+	_pool.setExpiryTimeout(-1);
+	_pool.setMaxThreadCount(2);
 }
 
 EntriesCache::~EntriesCache()
 {
+	// Pending requests are short and their receivers may still be alive
+	_stop();
 	// Clear the cache to (hopefully) remove all loaded entries
-	_cache.clear();
+	for (int i = 0; i < nbShards; i++) {
+		std::list<Shard::CachedEntry> lru;
+		{
+			QMutexLocker lock(&_shards[i].mutex);
+			lru.swap(_shards[i].lru);
+			_shards[i].lruPos.clear();
+			_shards[i].bytes = 0;
+		}
+	}
+	delete[] _shards;
+	qDeleteAll(_loaders);
+}
+
+EntriesCache::Shard &EntriesCache::shardFor(const EntryRef &ref) const
+{
+	return _shards[qHash(ref) % nbShards];
 }
 
 void EntriesCache::init()
@@ -56,83 +236,468 @@ void EntriesCache::init()
 
 void EntriesCache::cleanup()
 {
+#ifdef DEBUG_ENTRIES_CACHE
+	Statistics stats(statistics());
+	qDebug("Entries cache: %llu hits, %llu misses, %llu evictions, %d entries using %lld bytes", stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes);
+#endif
 	delete _instance;
 	_instance = 0;
 }
 
-bool EntriesCache::addLoader(EntryType type, EntryLoader *loader)
+EntriesCache::Statistics EntriesCache::statistics()
+{
+	return _instance->_statistics();
+}
+
+void EntriesCache::resetStatistics()
+{
+	_instance->_resetStatistics();
+}
+
+EntriesCache::Statistics EntriesCache::_statistics() const
+{
+	Statistics ret = { 0, 0, 0, 0, 0 };
+	for (int i = 0; i < nbShards; i++) {
+		QMutexLocker lock(&_shards[i].mutex);
+		ret.hits += _shards[i].hits;
+		ret.misses += _shards[i].misses;
+		ret.evictions += _shards[i].evictions;
+		ret.entries += _shards[i].lruPos.size();
+		ret.bytes += _shards[i].bytes;
+	}
+	return ret;
+}
+
+void EntriesCache::_resetStatistics()
+{
+	for (int i = 0; i < nbShards; i++) {
+		QMutexLocker lock(&_shards[i].mutex);
+		_shards[i].hits = _shards[i].misses = _shards[i].evictions = 0;
+	}
+}
+
+void EntriesCache::_trim()
+{
+	for (int i = 0; i < nbShards; i++) {
+		Shard &shard = _shards[i];
+		// Deleting entries locks the shard, so release them afterwards
+		QList<EntryPointer> evicted;
+		{
+			QMutexLocker lock(&shard.mutex);
+			int keep = shard.lru.size() / 2;
+			while ((int)shard.lru.size() > keep) {
+				const Shard::CachedEntry &last = shard.lru.back();
+				shard.lruPos.remove(EntryRef(last.entry->type(), last.entry->id()));
+				shard.bytes -= last.footprint;
+				evicted << last.entry;
+				shard.lru.pop_back();
+				++shard.evictions;
+			}
+		}
+	}
+}
+
+bool EntriesCache::addLoader(EntryType type, EntryLoaderFactory factory)
 {
 	if (_loaders.contains(type)) return false;
-	_loaders.insert(type, loader);
+	_loaders.insert(type, new LoaderSet(factory));
 	return true;
 }
 
 bool EntriesCache::removeLoader(EntryType type)
 {
 	if (!_loaders.contains(type)) return false;
-	_loaders.remove(type);
+	delete _loaders.take(type);
 	return true;
 }
 
 EntryLoader *EntriesCache::loaderFor(EntryType type)
 {
-	if (!_loaders.contains(type)) return 0;
-	return _loaders[type];
+	LoaderSet *set = _loaders.value(type);
+	if (!set) return 0;
+
+	// Threads that load entries are long-lived, so their loader is kept
+	// until the type is removed
+	QThread *thread = QThread::currentThread();
+	QMutexLocker lock(&set->mutex);
+	EntryLoader *loader = set->loaders.value(thread);
+	if (!loader) {
+		loader = set->factory();
+		set->loaders.insert(thread, loader);
+	}
+	return loader;
 }
 
-EntryPointer EntriesCache::_get(EntryType type, EntryId id)
+bool EntriesCache::_isLoaded(const EntryRef &ref) const
 {
-	EntryRef key(type, id);
-	// First look if the entry is already loaded
-	// Keep that lock until the Entry is loaded, as the entry searchers
-	// are not thread-safe yet. :(
-	// TODO Make the entry searchers thread-safe!
-	QMutexLocker loadedLocker(&_loadedEntriesMutex);
-	if (_loadedEntries.contains(key)) {
-		return _loadedEntries[key].toStrongRef();
-	}
+	Shard &shard = shardFor(ref);
+	QMutexLocker lock(&shard.mutex);
+	return !shard.loadedEntries.value(ref).isNull();
+}
 
-	// Nope, we must load it from the database
+EntryPointer EntriesCache::_load(EntryType type, EntryId id)
+{
 	EntryLoader *loader = loaderFor(type);
-	Entry *entry = loader ? loader->loadEntry(id) : 0;
+	if (!loader) return EntryPointer();
+
+	QElapsedTimer timer;
+	if (PerfCounters::enabled()) timer.start();
+	Entry *entry;
+	{
+		TRACE_SCOPE("Entry load");
+		entry = loader->loadEntry(id);
+	}
+	recordLoadTime("Entry", type, timer, 1);
 	// If the entry is not found, do not add anything to the cache and return
 	// a null pointer
-	if (!entry) { return EntryPointer(); }
-	// All the signal processing of the entry must take place in the main thread
-	entry->moveToThread(QCoreApplication::instance()->thread());
-
-	// Keep a reference to the entry now - this is needed
-	// for the case the cache size is zero
-	EntryPointer ret(entry, &_removeAndDelete);
-	_cacheMutex.lock();
-	_cache << ret;
-	while (_cache.size() > cacheSize.value()) _cache.removeFirst();
-	// Keep a weak pointer in the list of loaded entries - it is convertible to a
-	// QSharedPointer but will not influence the reference count.
-	_loadedEntries[key] = ret.toWeakRef();
+	if (!entry) return EntryPointer();
+	return EntryPointer(entry, &_removeAndDelete);
+}
+
+EntryPointer EntriesCache::_get(EntryType type, EntryId id)
+{
+	EntryRef key(type, id);
+	Shard &shard = shardFor(key);
+	// Must be released after the shard lock
+	QList<EntryPointer> evicted;
+	QSharedPointer<PendingLoad> pending;
+	{
+		QMutexLocker lock(&shard.mutex);
+		// First look if the entry is already loaded
+		EntryPointer ret(shard.loadedEntries.value(key).toStrongRef());
+		if (ret) {
+			++shard.hits;
+			shard.touch(key, ret, evicted);
+			return ret;
+		}
+
+		// Another thread is loading it, wait for its result
+		pending = shard.loading.value(key);
+		if (pending) {
+			++shard.hits;
+			while (!pending->finished) pending->done.wait(&shard.mutex);
+			return pending->entry;
+		}
+		++shard.misses;
+		pending = QSharedPointer<PendingLoad>(new PendingLoad());
+		shard.loading.insert(key, pending);
+	}
+
+	// Nope, we must load it from the database. Do it without holding the
+	// shard lock so other entries of the shard remain accessible.
+	int generation = _generation.loadAcquire();
+	EntryPointer ret(_load(type, id));
+
+	QMutexLocker lock(&shard.mutex);
+	if (ret && generation == _generation.loadAcquire()) {
+		// Keep a weak pointer in the list of loaded entries - it is convertible to a
+		// QSharedPointer but will not influence the reference count.
+		shard.loadedEntries[key] = ret.toWeakRef();
+		shard.touch(key, ret, evicted);
 #ifdef DEBUG_ENTRIES_CACHE
-	qDebug("Entry <%d,%d> loaded, %d in cache", entry->type(), entry->id(), _loadedEntries.size());
+		qDebug("Entry <%d,%d> loaded, %d in shard", ret->type(), ret->id(), shard.loadedEntries.size());
 #endif
-	_cacheMutex.unlock();
-	loadedLocker.unlock();
+	}
+	pending->entry = ret;
+	pending->finished = true;
+	shard.loading.remove(key);
+	pending->done.wakeAll();
+	lock.unlock();
+
+	return ret;
+}
+
+QList<EntryPointer> EntriesCache::_getMany(const QList<EntryRef> &refs)
+{
+	QHash<EntryRef, EntryPointer> found;
+	// Entries we are going to load, by type
+	QMap<EntryType, QVector<EntryId> > toLoad;
+	QHash<EntryRef, QSharedPointer<PendingLoad> > pendings;
+	QList<EntryRef> othersLoading;
+	QList<EntryPointer> evicted;
+
+	foreach (const EntryRef &key, refs) {
+		if (found.contains(key) || pendings.contains(key) || !key.isValid()) continue;
+		Shard &shard = shardFor(key);
+		QMutexLocker lock(&shard.mutex);
+		EntryPointer entry(shard.loadedEntries.value(key).toStrongRef());
+		if (entry) {
+			++shard.hits;
+			shard.touch(key, entry, evicted);
+			found[key] = entry;
+		}
+		// Already being loaded by another thread, will wait for it later.
+		// _get() will account for it.
+		else if (shard.loading.contains(key)) othersLoading << key;
+		else {
+			++shard.misses;
+			QSharedPointer<PendingLoad> pending(new PendingLoad());
+			shard.loading.insert(key, pending);
+			pendings.insert(key, pending);
+			toLoad[key.type()] << key.id();
+		}
+	}
+
+	int generation = _generation.loadAcquire();
+	QList<TypeLoad *> loads;
+	for (QMap<EntryType, QVector<EntryId> >::const_iterator it = toLoad.constBegin(); it != toLoad.constEnd(); ++it)
+		loads << new TypeLoad(it.key(), it.value(), false);
+	runLoads(loads);
+	foreach (TypeLoad *load, loads) {
+		const QVector<Entry *> &entries = load->entries;
+		for (int i = 0; i < load->ids.size(); i++) {
+			EntryRef key(load->type, load->ids[i]);
+			EntryPointer ret;
+			Entry *entry = i < entries.size() ? entries[i] : 0;
+			if (entry) ret = EntryPointer(entry, &_removeAndDelete);
+
+			Shard &shard = shardFor(key);
+			QMutexLocker lock(&shard.mutex);
+			QSharedPointer<PendingLoad> pending(pendings.value(key));
+			if (ret && generation == _generation.loadAcquire()) {
+				shard.loadedEntries[key] = ret.toWeakRef();
+				shard.touch(key, ret, evicted);
+			}
+			pending->entry = ret;
+			pending->finished = true;
+			shard.loading.remove(key);
+			pending->done.wakeAll();
+			found[key] = ret;
+		}
+	}
+	qDeleteAll(loads);
+
+	// Entries loaded by other threads
+	foreach (const EntryRef &key, othersLoading) found[key] = _get(key.type(), key.id());
+
+	QList<EntryPointer> ret;
+	ret.reserve(refs.size());
+	foreach (const EntryRef &key, refs) ret << found.value(key);
+	return ret;
+}
+
+QVector<EntrySummary> EntriesCache::getSummaries(const QList<EntryRef> &refs)
+{
+	return _instance->_getSummaries(refs);
+}
+
+QVector<EntrySummary> EntriesCache::_getSummaries(const QList<EntryRef> &refs)
+{
+	QVector<EntrySummary> ret(refs.size());
+	// Ids to load and their position in refs, by type
+	QMap<EntryType, QVector<EntryId> > toLoad;
+	QMap<EntryType, QVector<int> > positions;
+	QList<EntryPointer> evicted;
+
+	for (int i = 0; i < refs.size(); i++) {
+		const EntryRef &key = refs[i];
+		if (!key.isValid()) continue;
+		EntryPointer entry;
+		{
+			Shard &shard = shardFor(key);
+			QMutexLocker lock(&shard.mutex);
+			entry = shard.loadedEntries.value(key).toStrongRef();
+			if (entry) {
+				++shard.hits;
+				shard.touch(key, entry, evicted);
+			}
+		}
+		// Loaded entries may have been changed since they were loaded
+		if (entry) ret[i] = EntrySummary(*entry);
+		else {
+			toLoad[key.type()] << key.id();
+			positions[key.type()] << i;
+		}
+	}
 
+	QList<TypeLoad *> loads;
+	for (QMap<EntryType, QVector<EntryId> >::const_iterator it = toLoad.constBegin(); it != toLoad.constEnd(); ++it)
+		loads << new TypeLoad(it.key(), it.value(), true);
+	runLoads(loads);
+	foreach (TypeLoad *load, loads) {
+		const QVector<int> &pos = positions[load->type];
+		const QVector<EntrySummary> &summaries = load->loadedSummaries;
+		if (summaries.size() != load->ids.size()) {
+			QList<EntryRef> fallback;
+			foreach (EntryId id, load->ids) fallback << EntryRef(load->type, id);
+			QList<EntryPointer> entries(_getMany(fallback));
+			for (int j = 0; j < entries.size(); j++)
+				ret[pos[j]] = entries[j] ? EntrySummary(*entries[j]) : EntrySummary(fallback[j]);
+		}
+		else for (int j = 0; j < summaries.size(); j++) ret[pos[j]] = summaries[j];
+	}
+	qDeleteAll(loads);
 	return ret;
 }
 
+/// File format version of cache snapshots
+#define SNAPSHOT_VERSION 1
+
+QString EntriesCache::snapshotFile()
+{
+	return QDir(userProfile()).absoluteFilePath("entries.cache");
+}
+
+QList<EntryRef> EntriesCache::_cachedRefs() const
+{
+	// Shards do not share an LRU list, so interleave them to get an
+	// approximate global order
+	QVector<QList<EntryRef> > shardRefs(nbShards);
+	int longest = 0;
+	for (int i = 0; i < nbShards; i++) {
+		QMutexLocker lock(&_shards[i].mutex);
+		for (std::list<Shard::CachedEntry>::const_iterator it = _shards[i].lru.begin(); it != _shards[i].lru.end(); ++it)
+			shardRefs[i] << EntryRef(it->entry->type(), it->entry->id());
+		longest = qMax(longest, shardRefs[i].size());
+	}
+	QList<EntryRef> ret;
+	for (int j = 0; j < longest; j++)
+		for (int i = 0; i < nbShards; i++) if (j < shardRefs[i].size()) ret << shardRefs[i][j];
+	return ret;
+}
+
+bool EntriesCache::saveSnapshot()
+{
+	QFile file(snapshotFile());
+	if (!file.open(QIODevice::WriteOnly)) {
+		qWarning("Cannot write entries cache snapshot %s", file.fileName().toUtf8().constData());
+		return false;
+	}
+	QDataStream out(&file);
+	out << (quint8)SNAPSHOT_VERSION << _instance->_cachedRefs();
+	return out.status() == QDataStream::Ok;
+}
+
+/**
+ * Loads the entries of a snapshot by chunks, so that destroying the cache
+ * does not have to wait for the whole snapshot to be loaded.
+ */
+class EntriesCache::WarmUp : public QRunnable
+{
+public:
+	static const int chunkSize = 64;
+	virtual void run();
+};
+
+void EntriesCache::WarmUp::run()
+{
+	StartupPhase phase("Entries cache warm-up");
+	QFile file(snapshotFile());
+	if (!file.open(QIODevice::ReadOnly)) return;
+	QDataStream in(&file);
+	quint8 version;
+	QList<EntryRef> refs;
+	in >> version;
+	if (version != SNAPSHOT_VERSION) return;
+	in >> refs;
+	if (in.status() != QDataStream::Ok) return;
+
+	// Load the least recently used entries first, so the most recent ones
+	// are at the head of the LRU lists once done
+	int capacity = EntriesCache::cacheSize.value();
+	if (refs.size() > capacity) refs = refs.mid(0, capacity);
+	for (int i = refs.size(); i > 0 && !_instance->_stopping.loadAcquire(); i -= chunkSize) {
+		int first = qMax(0, i - chunkSize);
+		EntriesCache::getMany(refs.mid(first, i - first));
+	}
+}
+
+void EntriesCache::warmUp()
+{
+	_instance->_pool.start(new WarmUp());
+}
+
+void EntriesCache::stopLoading()
+{
+	_instance->_stop();
+}
+
+void EntriesCache::_stop()
+{
+	_stopping.storeRelease(1);
+	_pool.waitForDone();
+}
+
+void EntriesCache::profileChanged()
+{
+	_instance->_generation.ref();
+	EntryLoader::resetUserData();
+	for (int i = 0; i < nbShards; i++) {
+		// Entries must be released after the shard lock
+		std::list<Shard::CachedEntry> lru;
+		QMutexLocker lock(&_instance->_shards[i].mutex);
+		lru.swap(_instance->_shards[i].lru);
+		_instance->_shards[i].lruPos.clear();
+		_instance->_shards[i].bytes = 0;
+		_instance->_shards[i].loadedEntries.clear();
+	}
+}
+
+void EntriesCache::userDataChanged(const QList<EntryRef> &refs)
+{
+	// Entries being loaded may have read the previous data
+	_instance->_generation.ref();
+	// Entries must be released after the shard locks
+	QList<EntryPointer> released;
+	foreach (const EntryRef &ref, refs) {
+		Shard &shard = _instance->shardFor(ref);
+		QMutexLocker lock(&shard.mutex);
+		QHash<EntryRef, std::list<Shard::CachedEntry>::iterator>::iterator pos(shard.lruPos.find(ref));
+		if (pos == shard.lruPos.end()) continue;
+		released << pos.value()->entry;
+		shard.bytes -= pos.value()->footprint;
+		shard.lru.erase(pos.value());
+		shard.lruPos.erase(pos);
+	}
+}
+
+void EntriesCache::userDataChanged()
+{
+	_instance->_generation.ref();
+	for (int i = 0; i < nbShards; i++) {
+		// Unlike profileChanged(), entries that are still referenced stay
+		// known so that they remain unique
+		std::list<Shard::CachedEntry> lru;
+		QMutexLocker lock(&_instance->_shards[i].mutex);
+		lru.swap(_instance->_shards[i].lru);
+		_instance->_shards[i].lruPos.clear();
+		_instance->_shards[i].bytes = 0;
+	}
+}
+
+void EntriesCache::getAsync(const EntryRef &ref, QObject *receiver, const char *member)
+{
+	EntryRequest *request = new EntryRequest(ref);
+	QObject::connect(request, SIGNAL(loaded(EntryRef, EntryPointer)), receiver, member, Qt::QueuedConnection);
+	_instance->_pool.start(request);
+}
+
+void EntryRequest::run()
+{
+	emit loaded(_ref, _ref.get());
+	deleteLater();
+}
+
 void EntriesCache::_removeAndDelete(const Entry *entry)
 {
-	QMutexLocker loadedEntriesLock(&_instance->_loadedEntriesMutex);
-	// From here we know that the reference counter of our entry will not be changed
-	// Have we created a new reference to this entry by the meantime?
+	EntryRef key(entry->type(), entry->id());
+	Shard &shard = _instance->shardFor(key);
+	{
+		QMutexLocker lock(&shard.mutex);
+		// From here we know that the reference counter of our entry will not be changed
+		// Have we created a new reference to this entry by the meantime?
 #if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
-	if (entry->ref.loadRelaxed() > 0) return;
+		if (entry->ref.loadRelaxed() > 0) return;
 #else
-	if (entry->ref.load() > 0) return;
+		if (entry->ref.load() > 0) return;
 #endif
-	// No, we can safely remove and delete it then!
-	_instance->_loadedEntries.remove(EntryRef(entry->type(), entry->id()));
+		// The entry may have been loaded again after its last reference
+		// was dropped, in which case the new instance must be kept
+		QHash<EntryRef, QWeakPointer<Entry> >::iterator it(shard.loadedEntries.find(key));
+		if (it != shard.loadedEntries.end() && it.value().isNull()) shard.loadedEntries.erase(it);
 #ifdef DEBUG_ENTRIES_CACHE
-	qDebug("Entry <%d,%d> deleted, %d in cache", entry->type(), entry->id(), _instance->_loadedEntries.size());
+		qDebug("Entry <%d,%d> deleted, %d in shard", entry->type(), entry->id(), shard.loadedEntries.size());
 #endif
+	}
 	delete entry;
 }
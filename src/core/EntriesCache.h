@@ -25,10 +25,14 @@
 #include <QHash>
 #include <QPair>
 #include <QObject>
-#include <QQueue>
+#include <QMap>
 #include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QAtomicInt>
 
 class EntryRef;
+class EntrySummary;
 
 /**
  * The EntryCache plays a double role:
@@ -45,15 +49,58 @@ class EntryRef;
  */
 class EntriesCache
 {
+public:
+	struct Statistics
+	{
+		/// Requested entries that were already loaded
+		quint64 hits;
+		/// Requested entries that had to be loaded
+		quint64 misses;
+		/// Entries removed from the cache to keep it under its limits
+		quint64 evictions;
+		int entries;
+		qint64 bytes;
+	};
+
 private:
 	static EntriesCache * _instance;
 
-	QMap<EntryType, EntryLoader *> _loaders;
-	QHash<EntryRef, QWeakPointer<Entry> > _loadedEntries;
-	QMutex _loadedEntriesMutex;
+	/**
+	 * Loaders are not thread-safe, so every thread that loads entries gets
+	 * its own instance of each loader, created on demand by the factory.
+	 */
+	class LoaderSet;
+	QMap<EntryType, LoaderSet *> _loaders;
 
-	QQueue<EntryPointer> _cache;
-	QMutex _cacheMutex;
+	/**
+	 * Loaded entries are spread among shards according to their hash.
+	 * Each shard has its own lock and LRU list of cached entries, so
+	 * threads accessing different entries rarely wait for each other.
+	 */
+	class Shard;
+	static const int nbShards = 16;
+	Shard *_shards;
+	Shard &shardFor(const EntryRef &ref) const;
+
+	/// Threads that run the asynchronous requests of getAsync()
+	QThreadPool _pool;
+	/// Set when the cache is being destroyed, to interrupt the warm up
+	QAtomicInt _stopping;
+	/// Incremented when the cached entries are invalidated, so that entries
+	/// being loaded meanwhile are not cached
+	QAtomicInt _generation;
+	class WarmUp;
+	class TypeLoad;
+	/**
+	 * Runs loads, each one of a different type, in parallel using the
+	 * idle threads of the pool, and returns once they are all done.
+	 */
+	void runLoads(const QList<TypeLoad *> &loads);
+
+	/// Returns the cached entries, the most recently used ones first
+	QList<EntryRef> _cachedRefs() const;
+	/// File the cached entries are saved into between runs
+	static QString snapshotFile();
 
 	/**
 	 * This method is automatically called when the reference count of
@@ -68,6 +115,15 @@ private:
 	friend class Entry;
 
 	EntryPointer _get(EntryType type, EntryId id);
+	EntryPointer _load(EntryType type, EntryId id);
+	QList<EntryPointer> _getMany(const QList<EntryRef> &refs);
+	QVector<EntrySummary> _getSummaries(const QList<EntryRef> &refs);
+	bool _isLoaded(const EntryRef &ref) const;
+	Statistics _statistics() const;
+	void _resetStatistics();
+	void _trim();
+	/// Stops the warm-up and waits for all the jobs of _pool
+	void _stop();
 	EntriesCache();
 	~EntriesCache();
 
@@ -86,14 +142,92 @@ public:
 
 	static EntriesCache &instance() { return *_instance; }
 
-	bool addLoader(EntryType type, EntryLoader *loader);
+	/**
+	 * Returns the entries referenced by refs, in the same order. Entries
+	 * that are not loaded yet are loaded together, running each query of
+	 * their loader only once. Entries that could not be loaded are null.
+	 */
+	static QList<EntryPointer> getMany(const QList<EntryRef> &refs) {
+		return _instance->_getMany(refs);
+	}
+
+	/**
+	 * Returns the summaries of the entries referenced by refs, in the same
+	 * order. Summaries of loaded entries are built from them, the other ones
+	 * are loaded without loading nor caching their entries, unless their
+	 * loader does not support summaries. Entries that could not be loaded
+	 * get an empty summary.
+	 */
+	static QVector<EntrySummary> getSummaries(const QList<EntryRef> &refs);
+
+	/**
+	 * Loads the entry referenced by ref from a background thread, and
+	 * once it is available invokes the slot member of receiver, which
+	 * must have the (EntryRef, EntryPointer) signature, from the thread
+	 * of receiver. The entry is null if it could not be loaded. Nothing
+	 * is invoked if receiver is deleted in the meantime.
+	 */
+	static void getAsync(const EntryRef &ref, QObject *receiver, const char *member);
+
+	/**
+	 * Saves the references of the cached entries, so they can be loaded
+	 * by warmUp() next time the program runs.
+	 */
+	static bool saveSnapshot();
+	/**
+	 * Loads the entries saved by saveSnapshot() in the background, so that
+	 * they are already cached when the user first needs them. Must be
+	 * called once the loaders are registered.
+	 */
+	static void warmUp();
+	/**
+	 * Stops the warm-up and waits for the pending background loads to
+	 * complete. Must be called before the loaders are removed.
+	 */
+	static void stopLoading();
+
+	/**
+	 * Must be called when the user database changes (see
+	 * Database::switchProfile()). The cached entries are forgotten so that
+	 * they are loaded again with the user data of the new database. Entries
+	 * still referenced remain valid, but keep their previous user data.
+	 */
+	static void profileChanged();
+	/**
+	 * Must be called when the user data of the entries of refs has been
+	 * changed by another process (see DatabaseChangesWatcher). The cache
+	 * stops keeping these entries, so they are loaded again with their
+	 * new data once no longer referenced. Entries still referenced
+	 * remain unique, but keep their previous user data.
+	 */
+	static void userDataChanged(const QList<EntryRef> &refs);
+	/// Same as above, for all the cached entries
+	static void userDataChanged();
+
+	/// Must not be called while entries are being loaded
+	bool addLoader(EntryType type, EntryLoaderFactory factory);
+	/// Deletes all the loaders of type. Must not be called while entries
+	/// are being loaded
 	bool removeLoader(EntryType type);
+	/// Returns the loader for type of the calling thread
 	EntryLoader *loaderFor(EntryType type);
+	/// Whether entries of type can be loaded
+	bool hasLoader(EntryType type) const { return _loaders.contains(type); }
 
 	/**
-	 * The size of the cache can be modified in real-time through this value.
+	 * The size of the cache can be modified in real-time through these
+	 * values. cacheSize is the maximum number of cached entries, and
+	 * cacheMemory the maximum memory they may use, in kilobytes. Entries
+	 * are evicted as soon as one of these limits is exceeded.
 	 */
 	static PreferenceItem<int> cacheSize;
+	static PreferenceItem<int> cacheMemory;
+
+	/// Returns the cumulated statistics of all the shards of the cache
+	static Statistics statistics();
+	static void resetStatistics();
+	/// Releases the least recently used half of the cached entries
+	static void trim() { _instance->_trim(); }
 friend class EntryRef;
 };
 
@@ -119,7 +253,7 @@ public:
 	 * Returns true if the entry accessible through this reference is already loaded
 	 * into the cache.
 	 */
-	bool isLoaded() const { return EntriesCache::_instance->_loadedEntries.contains(*this); }
+	bool isLoaded() const { return EntriesCache::_instance->_isLoaded(*this); }
 
 	/**
 	 * Returns a pointer to the entry corresponding to this reference. If needed, the entry will
@@ -129,6 +263,10 @@ public:
 	 * returned pointer actually points to something before using it.
 	 */
 	EntryPointer get() const { return EntriesCache::get(type(), id()); }
+	/**
+	 * Non-blocking version of get(), see EntriesCache::getAsync().
+	 */
+	void getAsync(QObject *receiver, const char *member) const { EntriesCache::getAsync(*this, receiver, member); }
 	bool operator==(const EntryRef &other) const { return static_cast<const QPair<quint8, quint32> >(*this) == other; }
 	bool operator!=(const EntryRef &other) const { return !(*this == other); }
 	friend QDataStream &operator<<(QDataStream &out, const EntryRef &ref);
@@ -143,4 +281,22 @@ inline uint qHash(const EntryRef &key)
 	return ((h1 << 16) | (h1 >> 16)) ^ h2;
 }
 
+/**
+ * Asynchronous load of an entry, run by the thread pool of the EntriesCache.
+ * The request deletes itself once loaded() has been emitted.
+ */
+class EntryRequest : public QObject, public QRunnable
+{
+	Q_OBJECT
+private:
+	EntryRef _ref;
+
+public:
+	EntryRequest(const EntryRef &ref) : _ref(ref) { setAutoDelete(false); }
+	virtual void run();
+
+signals:
+	void loaded(const EntryRef &ref, EntryPointer entry);
+};
+
 #endif
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/EntriesPrefetcher.h"
+
+#include <QMutexLocker>
+
+EntriesPrefetcher::EntriesPrefetcher(QObject *parent) : QThread(parent), _first(0), _hasRequest(false), _stop(false)
+{
+	qRegisterMetaType<QVector<EntrySummary> >("QVector<EntrySummary>");
+}
+
+EntriesPrefetcher::~EntriesPrefetcher()
+{
+	stop();
+}
+
+void EntriesPrefetcher::prefetch(const QList<EntryRef> &refs, int first)
+{
+	if (refs.isEmpty()) return;
+	QMutexLocker lock(&_mutex);
+	if (_stop) return;
+	_refs = refs;
+	_first = first;
+	_hasRequest = true;
+	_wakeUp.wakeAll();
+	lock.unlock();
+	if (!isRunning()) start(QThread::LowPriority);
+}
+
+void EntriesPrefetcher::cancel()
+{
+	QMutexLocker lock(&_mutex);
+	_refs.clear();
+	_hasRequest = false;
+}
+
+void EntriesPrefetcher::stop()
+{
+	{
+		QMutexLocker lock(&_mutex);
+		_stop = true;
+		_hasRequest = false;
+		_wakeUp.wakeAll();
+	}
+	wait();
+}
+
+void EntriesPrefetcher::run()
+{
+	QMutexLocker lock(&_mutex);
+	while (!_stop) {
+		if (!_hasRequest) {
+			_wakeUp.wait(&_mutex);
+			continue;
+		}
+		QList<EntryRef> refs(_refs);
+		int first = _first;
+		_refs.clear();
+		_hasRequest = false;
+
+		for (int i = 0; i < refs.size() && !_hasRequest && !_stop; i += chunkSize) {
+			QList<EntryRef> chunk(refs.mid(i, chunkSize));
+			lock.unlock();
+			emit loaded(first + i, EntriesCache::getSummaries(chunk));
+			lock.relock();
+		}
+	}
+}
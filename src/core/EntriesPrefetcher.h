@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_ENTRIES_PREFETCHER_H_
+#define __CORE_ENTRIES_PREFETCHER_H_
+
+#include "core/EntriesCache.h"
+#include "core/EntrySummary.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QVector>
+
+/**
+ * Loads the summaries of entries from a background thread, so they are
+ * already there when the GUI needs to display them.
+ *
+ * Only the last request matters: a new request replaces the one being
+ * processed, as is the case when the user keeps scrolling. Summaries are
+ * loaded by chunks of chunkSize, and loaded() is emitted after each chunk.
+ */
+class EntriesPrefetcher : public QThread
+{
+	Q_OBJECT
+private:
+	QMutex _mutex;
+	QWaitCondition _wakeUp;
+	QList<EntryRef> _refs;
+	int _first;
+	bool _hasRequest;
+	bool _stop;
+
+protected:
+	virtual void run();
+
+public:
+	static const int chunkSize = 32;
+
+	EntriesPrefetcher(QObject *parent = 0);
+	virtual ~EntriesPrefetcher();
+
+	/**
+	 * Loads refs in the background. first is passed back by loaded()
+	 * to identify the entries, e.g. the row of the first entry in a
+	 * model.
+	 */
+	void prefetch(const QList<EntryRef> &refs, int first);
+	/// Drops the pending request, if any
+	void cancel();
+	/// Stops the thread and waits for it to terminate
+	void stop();
+
+signals:
+	/// Summaries of the entries of a request starting at position first,
+	/// which is relative to the first value of the request
+	void loaded(int first, const QVector<EntrySummary> &summaries);
+};
+
+#endif
@@ -18,34 +18,110 @@
 #include "core/Tag.h"
 #include "core/Entry.h"
 #include "core/Database.h"
+#include "core/EntryLoader.h"
+#include "core/TrainingStatistics.h"
 #include "sqlite/Query.h"
 
 #include <QDebug>
+#include <QAtomicInt>
 
-Entry::Entry(EntryType type, EntryId id) : QObject(0), _type(type), _id(id), _dateAdded(), _dateLastTrain(), _dateLastMistake(), _nbTrained(0), _nbSuccess(0), _score(0), _frequency(-1)
+/// Last version given to an entry. 0 is never used, so it can stand for
+/// "no version".
+static QAtomicInt _lastVersion;
+
+Entry::Entry(EntryType type, EntryId id) : _type(type), _id(id), _dateAdded(), _dateLastTrain(), _dateLastMistake(), _nbTrained(0), _nbSuccess(0), _score(0), _interval(0), _notesLoaded(false), _hasNotes(false), _version(_lastVersion.fetchAndAddRelaxed(1) + 1), _profileGeneration(Database::profileGeneration()), _frequency(-1)
 {
 }
 
+bool Entry::belongsToCurrentProfile() const
+{
+	if (_profileGeneration == Database::profileGeneration()) return true;
+	qWarning("Entry %d:%d belongs to a previous profile, its changes are not saved", type(), id());
+	return false;
+}
+
+void Entry::changed()
+{
+	_version = _lastVersion.fetchAndAddRelaxed(1) + 1;
+	EntryChanges::notify(this);
+}
+
+EntryChanges &EntryChanges::instance()
+{
+	static EntryChanges _instance;
+	return _instance;
+}
+
+void EntryChanges::notify(Entry *entry)
+{
+	EntryChanges &changes = instance();
+	if (!changes._depth) {
+		emit changes.entryChanged(entry);
+		return;
+	}
+	if (!changes._recorded.contains(entry)) {
+		changes._recorded << entry;
+		changes._changed << entry;
+	}
+}
+
+void EntryChanges::begin()
+{
+	instance()._depth++;
+}
+
+void EntryChanges::end()
+{
+	EntryChanges &changes = instance();
+	if (--changes._depth > 0) return;
+	if (changes._changed.isEmpty()) return;
+
+	QList<Entry *> changed(changes._changed);
+	changes._changed.clear();
+	changes._recorded.clear();
+
+	emit changes.entriesChanged(changed);
+	changes._notifying = true;
+	foreach (Entry *entry, changed) emit changes.entryChanged(entry);
+	changes._notifying = false;
+}
+
 Entry::~Entry()
 {
 }
 
-static QString dateToString(const QDateTime &date)
+int Entry::footprint(const QStringList &l)
+{
+	int ret = sizeof(QStringList) + l.size() * sizeof(void *);
+	foreach (const QString &s, l) ret += footprint(s);
+	return ret;
+}
+
+int Entry::memoryFootprint() const
 {
-	if (!date.isValid()) return "null";
-	return QString::number(date.toSecsSinceEpoch());
+	// Hash and list nodes are counted as 16 bytes of overhead each
+	int ret = sizeof(Entry);
+	ret += _tags.size() * (sizeof(Tag) + 16);
+	ret += _lists.size() * (2 * sizeof(quint64) + 16);
+	foreach (const Note &note, _notes) ret += sizeof(Note) + 16 + footprint(note.note());
+	return ret;
+}
+
+static QVariant dateToVariant(const QDateTime &date)
+{
+	if (!date.isValid()) return QVariant();
+	return date.toSecsSinceEpoch();
 }
 
 void Entry::updateTrainingData()
 {
-	QString qString;
 	if (!trained()) removeFromTraining();
 	else {
-	        SQLite::Query query(Database::connection());
-
-		qString = "insert or replace into training values(" + QString::number(type()) + ", " + QString::number(id()) + ", " + QString::number(score()) + ", " + dateToString(dateAdded()) + ", " + dateToString(dateLastTrain()) + ", " + QString::number(nbTrained()) + ", " + QString::number(nbSuccess()) + ", " + dateToString(dateLastMistake()) + ")";
-		if (!query.exec(qString)) qCritical() << "Error executing query: " << query.lastError().message();
-		emit entryChanged(this);
+		QVariantList values;
+		values << type() << id() << score() << dateToVariant(dateAdded()) << dateToVariant(dateLastTrain()) << nbTrained() << nbSuccess() << dateToVariant(dateLastMistake()) << (dateDue().isValid() ? dateDue().toSecsSinceEpoch() : 0) << interval();
+		DatabaseWriter::enqueue(type(), id(), DatabaseWriter::UpdateTraining, values);
+		EntryLoader::markUserData(type(), id());
+		changed();
 	}
 }
 
@@ -53,6 +129,7 @@ void Entry::train(bool success, float factor)
 {
 	// Can not train entries that are not in our study list
 	if (!trained()) return;
+	if (!belongsToCurrentProfile()) return;
 	QDateTime currentTime(QDateTime::currentDateTime());
 	QDateTime lastTrainTime(dateLastTrain());
 	// If this is the first time we train the entry
@@ -78,17 +155,52 @@ void Entry::train(bool success, float factor)
 
 	_score = newScore;
 
+	// The training interval grows faster as the score gets higher, from
+	// 1.3 to 2.5 times the previous one like the SM-2 ease factor, and
+	// mistakes start it over
+	if (!success) schedule(0);
+	else if (interval() == 0) schedule(1);
+	else schedule(qMax(interval() + 1, (unsigned int)(interval() * (1.3f + 1.2f * _score / 100))));
+
 	_nbTrained++;
 	if (success) _nbSuccess++;
 	setDateLastTrained(currentTime);
 	if (!success) setDateLastMistake(currentTime);
 	updateTrainingData();
+	TrainingStatistics::recordAnswer(EntryRef(type(), id()), success, _score);
+}
+
+void Entry::schedule(unsigned int interval)
+{
+	// Due dates are rounded to days so entries trained the same day share
+	// their due date, which keeps the due counts table small
+	qint64 today(QDateTime::currentSecsSinceEpoch() / 86400);
+	setInterval(interval);
+	setDateDue(QDateTime::fromSecsSinceEpoch((today + interval) * 86400));
+}
+
+unsigned int Entry::dueCount(EntryType type)
+{
+	DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	// A type of 0 counts the entries of all types
+	query.prepare("select sum(nbEntries) from trainingDue where dueDate <= ? and (? = 0 or type = ?)");
+	query.bindValue(QDateTime::currentSecsSinceEpoch());
+	query.bindValue(type);
+	query.bindValue(type);
+	if (!query.exec()) {
+		qCritical() << "Error executing query: " << query.lastError().message();
+		return 0;
+	}
+	return query.next() ? query.valueUInt(0) : 0;
 }
 
 void Entry::addToTraining()
 {
 	if (trained()) return;
+	if (!belongsToCurrentProfile()) return;
 	setDateAdded(QDateTime::currentDateTime());
+	schedule(0);
 	setDateLastTrained(QDateTime());
 	setDateLastMistake(QDateTime());
 	updateTrainingData();
@@ -97,6 +209,7 @@ void Entry::addToTraining()
 void Entry::removeFromTraining()
 {
 	if (!trained()) return;
+	if (!belongsToCurrentProfile()) return;
 	// Reset all values to those of a non-trained entry
 	setDateAdded(QDateTime());
 	setDateLastTrained(QDateTime());
@@ -104,15 +217,16 @@ void Entry::removeFromTraining()
 	setNbTrained(0);
 	setNbSuccess(0);
 	_score = 0;
+	setDateDue(QDateTime());
+	setInterval(0);
 	// And delete the entry row from the training table
-	QString qString = QString("delete from training where type = %1 and id = %2").arg(type()).arg(id());
-	SQLite::Query query(Database::connection());
-	if (!query.exec(qString)) qCritical() << "Error executing query: " << query.lastError().message();
-	emit entryChanged(this);
+	DatabaseWriter::enqueue(type(), id(), DatabaseWriter::RemoveTraining, QVariantList() << type() << id());
+	changed();
 }
 
 void Entry::setAlreadyKnown()
 {
+	if (!belongsToCurrentProfile()) return;
 	if (!trained()) addToTraining();
 	if (score() < 95) {
 		_score = 95;
@@ -123,31 +237,60 @@ void Entry::setAlreadyKnown()
 void Entry::resetScore()
 {
 	if (!trained()) return;
+	if (!belongsToCurrentProfile()) return;
 	_score = 0;
+	schedule(0);
 	updateTrainingData();
 }
 
+void Entry::loadNotes() const
+{
+	_notesLoaded = true;
+	if (!_hasNotes) return;
+	if (DatabaseWriter::hasPendingWrites(type(), id())) DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	query.prepare("select noteId, dateAdded, dateLastChange, note from notes join notesText on notes.noteId == notesText.docid where type = ? and id = ? order by dateAdded ASC, noteId ASC");
+	query.bindValue(type());
+	query.bindValue(id());
+	if (!query.exec()) {
+		qCritical() << "Error executing query: " << query.lastError().message();
+		return;
+	}
+	while (query.next()) {
+		_notes << Note(query.valueInt(0), QDateTime::fromSecsSinceEpoch(query.valueInt(1)), QDateTime::fromSecsSinceEpoch(query.valueInt(2)), query.valueString(3));
+	}
+}
+
 const Entry::Note &Entry::addNote(const QString &note)
 {
+	if (!belongsToCurrentProfile()) {
+		static const Note refused((QString()));
+		return refused;
+	}
+	// Load the existing notes first, or the new one would be loaded too
+	if (!_notesLoaded) loadNotes();
 	Note newNote(note);
 	newNote.writeToDB(this);
+	_hasNotes = true;
 	_notes << newNote;
-	emit entryChanged(this);
+	changed();
 	return _notes.last();
 }
 
 void Entry::updateNote(Note &note, const QString &noteText)
 {
+	if (!belongsToCurrentProfile()) return;
 	note.update(noteText);
 	note.writeToDB(this);
-	emit entryChanged(this);
+	changed();
 }
 
 void Entry::deleteNote(Note &note)
 {
+	if (!belongsToCurrentProfile()) return;
 	note.deleteFromDB(this);
 	_notes.removeOne(note);
-	emit entryChanged(this);
+	changed();
 }
 
 void Entry::Note::update(const QString &newNote)
@@ -156,72 +299,69 @@ void Entry::Note::update(const QString &newNote)
 	_dateLastChange = QDateTime::currentDateTime();
 }
 
-void Entry::addToList (quint64 listId)
+void Entry::addToList (quint64 rowid, quint64 listId)
 {
-	if (!_lists.contains(listId)) {
-		_lists << listId;
-		emit entryChanged(this);
+	if (!_lists.contains(rowid) || _lists.value(rowid) != listId) {
+		_lists[rowid] = listId;
+		changed();
 	}
 }
 
-void Entry::removeFromList (quint64 listId)
+void Entry::removeFromList (quint64 rowid)
 {
-	if (_lists.remove(listId))
-		emit entryChanged(this);
+	if (_lists.remove(rowid))
+		changed();
 }
 
 void Entry::Note::writeToDB(const Entry *entry)
 {
+	// Only new notes need to be written now, to get their id
+	if (_id != -1) {
+		DatabaseWriter::enqueue(entry->type(), entry->id(), DatabaseWriter::UpdateNote, QVariantList() << dateLastChange().toSecsSinceEpoch() << _id);
+		DatabaseWriter::enqueue(entry->type(), entry->id(), DatabaseWriter::UpdateNoteText, QVariantList() << note() << _id);
+		return;
+	}
+
 	SQLite::Query query(Database::connection());
-	QString qString;
 
 	// Insert the notes properties
-	qString = QString("insert or replace into notes values(%1, ?, ?, ?, ?)").arg(_id == -1 ? "null" : "?");
-	query.prepare(qString);
-	if (_id != -1) query.bindValue(_id);
+	query.prepare("insert into notes values(null, ?, ?, ?, ?)");
 	query.bindValue(entry->type());
 	query.bindValue(entry->id());
-	query.bindValue(QString::number(dateAdded().toSecsSinceEpoch()));
-	query.bindValue(QString::number(dateLastChange().toSecsSinceEpoch()));
+	query.bindValue(dateAdded().toSecsSinceEpoch());
+	query.bindValue(dateLastChange().toSecsSinceEpoch());
 	if (!query.exec()) {
 		qCritical() << "Error executing query: " << query.lastError().message();
 		return;
 	}
+	EntryLoader::markUserData(entry->type(), entry->id());
 
-	if (_id == -1) {
-		_id = query.lastInsertId();
-		qString = QString("insert or replace into notesText(docid, note) values(%1, ?)").arg(_id);
-	}
-	else qString = QString("update notesText set note = ? where docid = %1").arg(_id);
+	_id = query.lastInsertId();
 	// Now insert the note text
-	query.prepare(qString);
+	query.prepare("insert or replace into notesText(docid, note) values(?, ?)");
+	query.bindValue(_id);
 	query.bindValue(note());
 	if (!query.exec()) qCritical() << "Error executing query: " << query.lastError().message();
 }
 
 void Entry::Note::deleteFromDB(const Entry *entry)
 {
-	SQLite::Query query(Database::connection());
-	query.prepare("delete from notes where noteId = ?");
-	query.bindValue(_id);
-	if (!query.exec()) qCritical() << "Error executing query: " << query.lastError().message();
-	query.prepare("delete from notesText where docid = ?");
-	query.bindValue(_id);
-	if (!query.exec()) qCritical() << "Error executing query: " << query.lastError().message();
+	DatabaseWriter::enqueue(entry->type(), entry->id(), DatabaseWriter::RemoveNote, QVariantList() << _id);
+	DatabaseWriter::enqueue(entry->type(), entry->id(), DatabaseWriter::RemoveNoteText, QVariantList() << _id);
 }
 
 void Entry::setTags(const QStringList &tags)
 {
-	SQLite::Query query(Database::connection());
-	if (!query.exec(QString("delete from taggedEntries where type = %1 and id = %2").arg(type()).arg(id()))) qCritical() << "Error executing query: " << query.lastError().message();
+	if (!belongsToCurrentProfile()) return;
+	DatabaseWriter::enqueue(type(), id(), DatabaseWriter::ClearTags, QVariantList() << type() << id());
 	_tags.clear();
 	addTags(tags);
 }
 
 void Entry::addTags(const QStringList &tags)
 {
-	SQLite::Query query(Database::connection());
-	query.prepare(QString("insert into taggedEntries values(%1, %2, ?, %3)").arg(type()).arg(id()).arg(QDateTime::currentDateTime().toSecsSinceEpoch()));
+	if (!belongsToCurrentProfile()) return;
+	qint64 date(QDateTime::currentDateTime().toSecsSinceEpoch());
 	foreach(const QString &tag, tags) {
 		Tag t = Tag::getOrCreateTag(tag);
 		if (!t.isValid()) {
@@ -230,11 +370,11 @@ void Entry::addTags(const QStringList &tags)
 		}
 		// Do not add tags that we already have
 		if (_tags.contains(t)) continue;
-		query.bindValue(t.id());
-		if (!query.exec()) qCritical() << "Error executing query: " << query.lastError().message();
+		DatabaseWriter::enqueue(type(), id(), DatabaseWriter::AddTag, QVariantList() << type() << id() << t.id() << date);
+		EntryLoader::markUserData(type(), id());
 		_tags << t;
 	}
-	emit entryChanged(this);
+	changed();
 }
 
 bool Entry::Note::operator==(const Note &note)
@@ -251,14 +391,16 @@ QString Entry::mainRepr() const {
 }
 
 QString Entry::shortVersion(VersionLength length) const {
+	return buildShortVersion(mainRepr(), writings(), readings(), meanings(), length);
+}
+
+QString Entry::buildShortVersion(const QString &mRepr, const QStringList &writings, const QStringList &readings, const QStringList &meanings, VersionLength length) {
 	QString text;
-	QStringList writes;
-	QString mRepr(mainRepr());
 	
 	text += mRepr;
 
-	writes = writings();
-	QStringList reads(readings());
+	QStringList writes(writings);
+	QStringList reads(readings);
 	bool reprIsWriting = writes.contains(mRepr);
 	if (reprIsWriting) writes.removeAll(mRepr);
 	else reads.removeAll(mRepr);
@@ -274,7 +416,7 @@ QString Entry::shortVersion(VersionLength length) const {
 	else if (!reads.isEmpty() && length != TinyVersion) text += ", " + reads.join(", ");
 
 	// Senses
-	QStringList means = meanings();
+	const QStringList &means = meanings;
 	bool hasMeaning = !means.isEmpty();
 	if (hasMeaning) {
 		text += ":";
@@ -21,17 +21,22 @@
 #include <QMetaType>
 #include <QDate>
 #include <QSet>
+#include <QMap>
 #include <QObject>
 #include <QSharedPointer>
+#include <QSharedData>
 
 #include "core/Tag.h"
 
 typedef quint8 EntryType;
 typedef quint32 EntryId;
 
-class Entry : public QObject, public QSharedData
+/**
+ * Entries are plain objects so the cache can hold many of them cheaply and
+ * load them from any thread. Their changes are broadcast by EntryChanges.
+ */
+class Entry : public QSharedData
 {
-	Q_OBJECT
 public:
 	// TODO move outside of entry!
 	class Note
@@ -75,10 +80,31 @@ private:
 	unsigned int _nbTrained;
 	unsigned int _nbSuccess;
 	int _score;
+	QDateTime _dateDue;
+	/// Days between the last training and the due date
+	unsigned int _interval;
 
 	QSet<Tag> _tags;
-	QList<Note> _notes;
-	QSet<quint64> _lists;
+	/// Notes are only loaded the first time they are accessed
+	mutable QList<Note> _notes;
+	mutable bool _notesLoaded;
+	/// Whether the entry has notes, set by EntryLoader
+	bool _hasNotes;
+	/// Rowids of the list items referencing this entry, and the lists they belong to
+	QMap<quint64, quint64> _lists;
+	quint32 _version;
+	/// Profile generation the entry was loaded for
+	int _profileGeneration;
+
+	/**
+	 * Entries still held after a profile switch belong to the previous
+	 * profile, so their changes must not be written to the current one.
+	 * Returns false and warns if the entry is such a stale entry.
+	 */
+	bool belongsToCurrentProfile() const;
+
+	/// Gives the entry a new version and notifies EntryChanges
+	void changed();
 
 	/**
 	 * Updates the database with new training information about this
@@ -91,6 +117,11 @@ private:
 	void setDateLastMistake(const QDateTime &date) { _dateLastMistake = date; }
 	void setNbTrained(unsigned int nb) { _nbTrained = nb; }
 	void setNbSuccess(unsigned int nb) { _nbSuccess = nb; }
+	void setDateDue(const QDateTime &date) { _dateDue = date; }
+	void setInterval(unsigned int interval) { _interval = interval; }
+	/// Schedules the next training interval days from now
+	void schedule(unsigned int interval);
+	void loadNotes() const;
 
 	// No copy, ever!
 	Entry(const Entry &);
@@ -99,9 +130,17 @@ protected:
 	qint32 _frequency;
 	Entry(EntryType type, EntryId id);
 
+	/// Approximate number of bytes used by s, for memoryFootprint()
+	static int footprint(const QString &s) { return sizeof(QString) + 24 + s.capacity() * sizeof(QChar); }
+	static int footprint(const QStringList &l);
+
 public:
 	// Role used for models that allow accessing entries
-	enum { EntryRole = Qt::UserRole, EntryRefRole };
+	// LoadedEntryRole returns a null EntryPointer instead of loading the
+	// entry if it is not loaded yet, and is optional.
+	// SummaryRole returns an EntrySummary, which is null if it is not
+	// loaded yet, and is optional.
+	enum { EntryRole = Qt::UserRole, EntryRefRole, LoadedEntryRole, SummaryRole };
 	
 	// Must be public or QSharedPointer won't work
 	virtual ~Entry();
@@ -113,6 +152,15 @@ public:
 	QDateTime dateLastMistake() const { return _dateLastMistake; }
 	unsigned int nbTrained() const { return _nbTrained; }
 	unsigned int nbSuccess() const { return _nbSuccess; }
+	/// Date from which the entry should be trained again
+	QDateTime dateDue() const { return _dateDue; }
+	unsigned int interval() const { return _interval; }
+	bool due() const { return trained() && _dateDue <= QDateTime::currentDateTime(); }
+	/**
+	 * Returns the number of trained entries of the given type (or of all
+	 * types if type is 0) that are due for training.
+	 */
+	static unsigned int dueCount(EntryType type = 0);
 
 	void addToTraining();
 	void removeFromTraining();
@@ -120,11 +168,19 @@ public:
 	void resetScore();
 
 	/**
-	 * Emit the entryChanged() signal unconditionally.
+	 * Notify the change of the entry unconditionally.
 	 * This may be needed if something around the entry has changed
 	 * that may affect it.
 	 */
-	void emitChanged() { emit entryChanged(this); }
+	void emitChanged() { changed(); }
+	/**
+	 * Identifies the current state of this entry. The version changes
+	 * every time the entry is notified as changed, and no two entries, including
+	 * successive instances of the same entry, ever share a version. Views
+	 * can compare it with the version they rendered to know whether they
+	 * are up-to-date.
+	 */
+	quint32 version() const { return _version; }
 	/**
 	 * An entry is considered to be under training if it has been added to the
 	 * training list at some point.
@@ -144,19 +200,27 @@ public:
 	void setTags(const QStringList &tags);
 	void addTags(const QStringList &tags);
 
-	const QList<Note> &notes() const { return _notes; }
-	QList<Note> &notes() { return _notes; }
+	/// Returns whether the entry has notes, without loading them
+	bool hasNotes() const { return _notesLoaded ? !_notes.isEmpty() : _hasNotes; }
+	/**
+	 * Notes can be long and are only needed when the entry is displayed
+	 * in detail, so they are loaded the first time they are accessed.
+	 * This must happen in the main thread.
+	 */
+	const QList<Note> &notes() const { if (!_notesLoaded) loadNotes(); return _notes; }
+	QList<Note> &notes() { if (!_notesLoaded) loadNotes(); return _notes; }
 	const Note &addNote(const QString &note);
 	void updateNote(Note &note, const QString &noteText);
 	void deleteNote(Note &note);
 
 	/**
-	 * Returns the lists indexes this entry belongs to. Indexes are just identified by
-	 * their row number.
+	 * Returns the lists items this entry is referenced by. Items are identified by
+	 * their row number and mapped to the id of the list containing them.
 	 */
-	const QSet<quint64> &lists() const { return _lists; }
-	void addToList(quint64 listId);
-	void removeFromList(quint64 listId);
+	const QMap<quint64, quint64> &lists() const { return _lists; }
+	/// Records that the list item rowid of list listId references this entry
+	void addToList(quint64 rowid, quint64 listId);
+	void removeFromList(quint64 rowid);
 
 	void train(bool success, float factor = 1.0f);
 
@@ -170,19 +234,21 @@ public:
 	 * in menus, etc.
 	 */
 	virtual QString shortVersion(VersionLength length = ShortVersion) const;
+	/// Builds the short version of an entry from its representations
+	static QString buildShortVersion(const QString &mainRepr, const QStringList &writings, const QStringList &readings, const QStringList &meanings, VersionLength length);
 	virtual QString name() const;
 
 	virtual QStringList writings() const = 0;
 	virtual QStringList readings() const = 0;
 	virtual QStringList meanings() const = 0;
 
-signals:
 	/**
-	 * Emitted when the entry has changed and its views
-	 * need to be redrawn.
-	 * TODO should we not use a ConstEntryPointer for safety here?
+	 * Returns the approximate number of bytes of memory used by this entry,
+	 * including the data it owns. Used by the EntriesCache to enforce its
+	 * memory budget. Subclasses should add the size of their own data to
+	 * the value returned by this implementation.
 	 */
-	void entryChanged(Entry *);
+	virtual int memoryFootprint() const;
 
 /**
  * EntryLoader needs to access our private methods in order to completely
@@ -191,9 +257,66 @@ signals:
 friend class EntryLoader;
 };
 
+/**
+ * Broadcasts the changes of all entries through entryChanged(), which
+ * gives the changed entry, and thus its reference and new version. Models
+ * look the entry up in their own reverse index of the rows displaying it,
+ * instead of every entry carrying its own connections.
+ *
+ * Also coalesces the change notifications of entries modified together,
+ * e.g. by a batch operation on a selection. Between begin() and end(),
+ * changed entries are not notified but recorded; end() then emits
+ * entriesChanged() once with all of them, so models can update their rows
+ * in a few ranges instead of one at a time. entryChanged() is emitted for
+ * each entry afterwards for views that only follow a single entry; models
+ * handling entriesChanged() should ignore it while notifying() is true.
+ *
+ * Entries must only be changed from the GUI thread, and the changed
+ * entries must be kept alive by the caller until end() returns.
+ */
+class EntryChanges : public QObject
+{
+	Q_OBJECT
+private:
+	int _depth;
+	bool _notifying;
+	QList<Entry *> _changed;
+	QSet<Entry *> _recorded;
+
+	EntryChanges() : QObject(0), _depth(0), _notifying(false) {}
+
+	/// Emits entryChanged(), or defers it until end()
+	static void notify(Entry *entry);
+
+public:
+	static EntryChanges &instance();
+
+	/// Starts deferring change notifications. Calls can be nested.
+	static void begin();
+	/// Emits the notifications deferred since the outermost begin()
+	static void end();
+	/// True while end() emits entryChanged() for the recorded entries
+	static bool notifying() { return instance()._notifying; }
+
+signals:
+	/**
+	 * Emitted when entry has changed and its views need to be redrawn.
+	 */
+	void entryChanged(Entry *entry);
+	/**
+	 * Emitted by end() with the entries that changed since begin(),
+	 * each of them appearing once.
+	 */
+	void entriesChanged(const QList<Entry *> &entries);
+
+friend class Entry;
+};
+
 // TODO try to remove this, needed by the notes edit dialog
 Q_DECLARE_METATYPE(Entry::Note *)
 
+Q_DECLARE_METATYPE(Entry *)
+
 typedef QSharedPointer<Entry> EntryPointer;
 Q_DECLARE_METATYPE(EntryPointer)
 typedef QSharedPointer<const Entry> ConstEntryPointer;
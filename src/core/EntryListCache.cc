@@ -18,26 +18,47 @@
 #include "EntryListCache.h"
 #include "Database.h"
 
+#include <QDateTime>
+#include <algorithm>
+
 EntryListCache *EntryListCache::_instance = 0;
 
-EntryListCache::EntryListCache() : _dbAccess(LISTS_DB_TABLES_PREFIX)
+/**
+ * Walks from the items selected by condition up to the root of their list,
+ * accumulating their position on the way, and returns the list id and position.
+ */
+static QString pathQuery(const QString &table, const QString &condition)
 {
-	if (!_connection.connect(Database::userDBFile())) {
+	return QString("with recursive path(rowid, parent, pos) as ("
+		"select rowid, parent, leftSize from %1 where %2 "
+		"union all select %1.rowid, %1.parent, path.pos + case when %1.right = path.rowid then %1.leftSize + 1 else 0 end "
+		"from path join %1 on %1.rowid = path.parent) "
+		"select %1Roots.listId, path.pos from path join %1Roots on %1Roots.rootId = path.rowid where path.parent = 0").arg(table).arg(condition);
+}
+
+EntryListCache::EntryListCache() : _dbAccess(LISTS_DB_TABLES_PREFIX), _cachedParents(MAX_CACHED_OWNERS)
+{
+	if (!_connection.connect(Database::userDBFile(), SQLite::Connection::WAL)) {
 		qFatal("EntryListCache cannot connect to user database!");
 	}
 	_dbAccess.prepareForConnection(&_connection);
-	ownerQuery.useWith(&_connection);
-	goUpQuery.useWith(&_connection);
-	listFromRootQuery.useWith(&_connection);
-	ownerQuery.prepare(QString("select rowid from %1 where type = 0 and id = ?").arg(_dbAccess.tableName()));
-	goUpQuery.prepare(QString("select parent, leftSize, right from %1 where rowid = ?").arg(_dbAccess.tableName()));
-	listFromRootQuery.prepare(QString("select listId from %1Roots where rootId = ?").arg(_dbAccess.tableName()));
+	ownerPathQuery.useWith(&_connection);
+	rowIdPathQuery.useWith(&_connection);
+	statisticsQuery.useWith(&_connection);
+	ownerPathQuery.prepare(pathQuery(_dbAccess.tableName(), "type = 0 and id = ?"));
+	rowIdPathQuery.prepare(pathQuery(_dbAccess.tableName(), "rowid = ?"));
+	statisticsQuery.prepare(QString("SELECT s.nbItems, s.nbStudied, s.nbKnown, (SELECT coalesce(sum(d.nbItems), 0) FROM %1Due d WHERE d.listId = s.listId AND d.dueDate <= ?) FROM %1Stats s WHERE s.listId = ?").arg(_dbAccess.tableName()));
 }
 
 EntryListCache::~EntryListCache()
 {
-	foreach (EntryList *list, _cachedLists) {
-		delete list;
+	foreach (CachedList *cached, _cachedLists) {
+#ifdef DEBUG_LISTS
+		EntryList *list = cached->list;
+		qDebug("List %u: %d nodes cached, %llu hits, %llu misses", list->listId(), list->tree()->cachedNodes(), list->tree()->cacheHits(), list->tree()->cacheMisses());
+#endif
+		delete cached->list;
+		delete cached;
 	}
 }
 
@@ -55,80 +76,139 @@ void EntryListCache::cleanup()
 
 EntryList *EntryListCache::_get(quint64 id)
 {
-	QMutexLocker ml(&_cacheLock);
-	if (!_cachedLists.contains(id))  {
+	{
+		QReadLocker rl(&_listsLock);
+		CachedList *cached = _cachedLists.value(id);
+		if (cached) {
+			cached->lastUse.store(_useClock.fetchAndAddRelaxed(1) + 1);
+			return cached->list;
+		}
+	}
+	QWriteLocker wl(&_listsLock);
+	// The list may have been loaded while we were waiting for the lock
+	CachedList *cached = _cachedLists.value(id);
+	if (!cached) {
 		// We know we can only be called with list Ids that actually exist in the DB,
 		// so no need to bother about non-existing entries
-		_cachedLists.insert(id, new EntryList(&_dbAccess, id));
+		cached = new CachedList;
+		cached->list = new EntryList(&_dbAccess, id);
+		_cachedLists.insert(id, cached);
+		trimLists();
 	}
-	// Will always git (see above)
-	return _cachedLists[id];
+	cached->lastUse.store(_useClock.fetchAndAddRelaxed(1) + 1);
+	return cached->list;
 }
 
 EntryList *EntryListCache::_newList()
 {
 	EntryList *ret = new EntryList(&_dbAccess, 0);
 	ret->newList();
-	QMutexLocker ml(&_cacheLock);
-	_cachedLists.insert(ret->listId(), ret);
+	CachedList *cached = new CachedList;
+	cached->list = ret;
+	cached->lastUse.store(_useClock.fetchAndAddRelaxed(1) + 1);
+	QWriteLocker wl(&_listsLock);
+	_cachedLists.insert(ret->listId(), cached);
+	trimLists();
 	return ret;
 }
 
 void EntryListCache::_clearListCache(quint64 id)
 {
-	_cachedLists.remove(id);
+	QWriteLocker wl(&_listsLock);
+	// The list object itself may still be referenced, so only forget it
+	delete _cachedLists.take(id);
 }
 
-QPair<const EntryList *, quint32> EntryListCache::_getOwner(quint64 id)
+void EntryListCache::_reloadList(quint64 id)
 {
-	if (!_cachedParents.contains(id)) {
-		ownerQuery.bindValue(id);
-		ownerQuery.exec();
-		if (!ownerQuery.next()) return QPair<const EntryList *, quint32>();
-		quint64 rowid = ownerQuery.valueUInt64(0);
-		ownerQuery.reset();
+	QWriteLocker wl(&_listsLock);
+	CachedList *cached = _cachedLists.value(id);
+	// Lists that are being modified will refuse to release their nodes
+	if (cached) cached->list->tree()->releaseMemCache();
+}
 
-		_cachedParents[id] = _getIndexFromRowId(rowid);
+void EntryListCache::_listRolledBack(quint64 id)
+{
+	{
+		QWriteLocker wl(&_listsLock);
+		CachedList *cached = _cachedLists.value(id);
+		if (cached) cached->list->tree()->reload();
 	}
-	return _cachedParents[id];
+	_clearOwnerCache();
 }
 
-QPair<const EntryList *, quint32> EntryListCache::_getIndexFromRowId(quint64 rowid)
+void EntryListCache::trimLists(int keep)
 {
-	// Get the initial info about the list
-	goUpQuery.bindValue(rowid);
-	if (!goUpQuery.exec() || !goUpQuery.next()) {
-		qCritical("List inconsistency!");
+	if (_cachedLists.size() <= keep) return;
+	QList<QPair<int, EntryList *> > byUse;
+	foreach (CachedList *cached, _cachedLists) {
+		if (cached->list->tree()->cachedNodes() > 1) byUse << QPair<int, EntryList *>(cached->lastUse.load(), cached->list);
 	}
-	quint64 parent = goUpQuery.valueInt(0);
-	quint32 pos = goUpQuery.valueInt(1);
-	goUpQuery.reset();
-
-	// Go back to the root of the list, and calculate the position of the item
-	while (parent != 0) {
-		goUpQuery.bindValue(parent);
-		if (!goUpQuery.exec() || !goUpQuery.next()) {
-			qCritical("List inconsistency!");
-			break;
-		}
-		quint64 newParent = goUpQuery.valueUInt64(0);
-		quint32 leftSize = goUpQuery.valueUInt(1);
-		quint64 right = goUpQuery.valueUInt64(2);
-		if (rowid == right) pos += leftSize + 1;
-		goUpQuery.reset();
-		rowid = parent;
-		parent = newParent;
+	if (byUse.size() <= keep) return;
+	std::sort(byUse.begin(), byUse.end());
+	// Lists that are being modified will refuse to release their nodes
+	for (int i = 0; i < byUse.size() - keep; i++) byUse[i].second->tree()->releaseMemCache();
+}
+
+EntryListCache::MemoryStatistics EntryListCache::memoryStatistics()
+{
+	MemoryStatistics ret = { 0, 0, 0 };
+	if (!_instance) return ret;
+	{
+		QReadLocker rl(&_instance->_listsLock);
+		ret.lists = _instance->_cachedLists.size();
+		foreach (CachedList *cached, _instance->_cachedLists) ret.loadedNodes += cached->list->tree()->cachedNodes();
+	}
+	QMutexLocker lock(&_instance->_parentsLock);
+	ret.cachedOwners = _instance->_cachedParents.size();
+	return ret;
+}
+
+void EntryListCache::_trim()
+{
+	{
+		QWriteLocker wl(&_listsLock);
+		trimLists(MAX_LOADED_LISTS / 8);
 	}
+	_clearOwnerCache();
+}
 
-	// rowid now contains the root of the containing list, we can look its id up
-	listFromRootQuery.bindValue(rowid);
-	listFromRootQuery.exec();
-	if (!listFromRootQuery.next()) return QPair<const EntryList *, quint32>();
-	else {
-		const EntryList *ret = get(listFromRootQuery.valueUInt64(0));
-		listFromRootQuery.reset();
-		return QPair<const EntryList *, quint32>(ret, pos);
+QPair<const EntryList *, quint32> EntryListCache::resolvePath(SQLite::Query &query, quint64 id)
+{
+	query.bindValue(id);
+	if (!query.exec() || !query.next()) {
+		query.reset();
+		return QPair<const EntryList *, quint32>();
 	}
+	quint64 listId = query.valueUInt64(0);
+	quint32 pos = query.valueUInt(1);
+	query.reset();
+	return QPair<const EntryList *, quint32>(get(listId), pos);
+}
+
+QPair<const EntryList *, quint32> EntryListCache::_getOwner(quint64 id)
+{
+	QMutexLocker ml(&_parentsLock);
+	QPair<const EntryList *, quint32> *owner = _cachedParents.object(id);
+	if (!owner) {
+		owner = new QPair<const EntryList *, quint32>(resolvePath(ownerPathQuery, id));
+		// Do not remember lists that do not exist (yet)
+		if (!owner->first) {
+			QPair<const EntryList *, quint32> ret(*owner);
+			delete owner;
+			return ret;
+		}
+		_cachedParents.insert(id, owner);
+	}
+	return *owner;
+}
+
+QPair<const EntryList *, quint32> EntryListCache::_getIndexFromRowId(quint64 rowid)
+{
+	QMutexLocker ml(&_parentsLock);
+	QPair<const EntryList *, quint32> ret(resolvePath(rowIdPathQuery, rowid));
+	if (!ret.first) qCritical("List inconsistency!");
+	return ret;
 }
 
 quint64 EntryListCache::_getRowIdFromIndex (const QPair<const EntryList *, quint32> &idx)
@@ -138,10 +218,54 @@ quint64 EntryListCache::_getRowIdFromIndex (const QPair<const EntryList *, quint
 
 void EntryListCache::_clearOwnerCache(quint64 id)
 {
+	QMutexLocker ml(&_parentsLock);
 	_cachedParents.remove(id);
 }
 
 void EntryListCache::_clearOwnerCache()
 {
+	QMutexLocker ml(&_parentsLock);
 	_cachedParents.clear();
 }
+
+EntryListStatistics EntryListCache::_statistics(quint64 id)
+{
+	EntryListStatistics ret = { 0, 0, 0, 0 };
+	QMutexLocker ml(&_parentsLock);
+	statisticsQuery.bindValue(QDateTime::currentSecsSinceEpoch());
+	statisticsQuery.bindValue(id);
+	// Lists that never had any item have no counters yet
+	if (statisticsQuery.exec() && statisticsQuery.next()) {
+		ret.items = statisticsQuery.valueUInt(0);
+		ret.studied = statisticsQuery.valueUInt(1);
+		ret.known = statisticsQuery.valueUInt(2);
+		ret.due = statisticsQuery.valueUInt(3);
+	}
+	statisticsQuery.reset();
+	return ret;
+}
+
+EntryListTransaction *EntryListTransaction::_current = 0;
+
+EntryListTransaction::EntryListTransaction() : SQLite::Transaction(EntryListCache::connection()), _parent(_current), _committed(false)
+{
+	_current = this;
+}
+
+EntryListTransaction::~EntryListTransaction()
+{
+	_current = _parent;
+	if (_committed) {
+		// The changes are only kept if the enclosing transaction is committed
+		if (_parent) _parent->_touched << _touched;
+		return;
+	}
+	rollback();
+	foreach (quint64 id, _touched) EntryListCache::listRolledBack(id);
+}
+
+bool EntryListTransaction::commit()
+{
+	_committed = SQLite::Transaction::commit();
+	return _committed;
+}
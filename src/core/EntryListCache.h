@@ -22,23 +22,65 @@
 #include "core/EntryListDB.h"
 
 #include <QPair>
+#include <QCache>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QAtomicInt>
+
+/**
+ * Counters of a list, maintained by the database as its items and their
+ * training data change. Only the direct items of the list are counted.
+ */
+struct EntryListStatistics {
+	quint32 items;
+	/// Items that are in the study list
+	quint32 studied;
+	/// Items whose score marks them as known
+	quint32 known;
+	/// Studied items that are due for training
+	quint32 due;
+};
 
 /**
  * A cache class that is responsible for providing information about the
  * lists. Whenever an entry is changed in the DB, it has to be invalidated
  * here.
  *
- * Methods of this class are thread-safe.
+ * Methods of this class are thread-safe. Lists are looked up under a
+ * read lock, so concurrent lookups of already loaded lists do not block
+ * each other.
+ *
+ * Only the MAX_LOADED_LISTS most recently used lists keep their nodes in
+ * memory, and the owners of at most MAX_CACHED_OWNERS lists are remembered.
  */
 class EntryListCache {
 private:
+	static const int MAX_LOADED_LISTS = 64;
+	static const int MAX_CACHED_OWNERS = 1024;
+
+	struct CachedList {
+		EntryList *list;
+		QAtomicInt lastUse;
+	};
+
 	static EntryListCache *_instance;
 	SQLite::Connection _connection;
-	SQLite::Query ownerQuery, goUpQuery, listFromRootQuery;
+	/// Resolve the list and position of an item with a single query
+	SQLite::Query ownerPathQuery, rowIdPathQuery;
+	SQLite::Query statisticsQuery;
 	EntryListDBAccess _dbAccess;
-	QMap<quint64, EntryList *> _cachedLists;
-	QMap<quint64, QPair<const EntryList *, quint32> > _cachedParents;
-	QMutex _cacheLock;
+	QHash<quint64, CachedList *> _cachedLists;
+	QAtomicInt _useClock;
+	QReadWriteLock _listsLock;
+	QCache<quint64, QPair<const EntryList *, quint32> > _cachedParents;
+	/// Protects _cachedParents and the queries
+	QMutex _parentsLock;
+
+	/// Releases the nodes of the least recently used lists, keeping those
+	/// of the keep most recently used ones. Must be called with _listsLock
+	/// held for writing
+	void trimLists(int keep = MAX_LOADED_LISTS);
+	QPair<const EntryList *, quint32> resolvePath(SQLite::Query &query, quint64 id);
 
 	EntryListCache();
 	~EntryListCache();
@@ -46,11 +88,15 @@ private:
 	EntryList *_get(quint64 id);
 	EntryList *_newList();
 	void _clearListCache(quint64 id);
+	void _reloadList(quint64 id);
+	void _listRolledBack(quint64 id);
 	QPair <const EntryList *, quint32> _getOwner(quint64 id);
 	QPair<const EntryList *, quint32> _getIndexFromRowId(quint64 rowid);
 	quint64 _getRowIdFromIndex(const QPair<const EntryList *, quint32> &idx);
 	void _clearOwnerCache(quint64 id);
 	void _clearOwnerCache();
+	EntryListStatistics _statistics(quint64 id);
+	void _trim();
 
 public:
 	/// Returns a reference to the unique instance of this class.
@@ -62,14 +108,58 @@ public:
 	static EntryList *get(quint64 id) { return instance()._get(id); }
 	static EntryList *newList() { return instance()._newList(); }
 	static void clearListCache(quint64 id) { return instance()._clearListCache(id); }
+	/// Reads the items of list id from the database again the next time
+	/// they are needed, keeping the list object
+	static void reloadList(quint64 id) { if (_instance) _instance->_reloadList(id); }
+	/// Reads list id entirely from the database again, after the changes
+	/// made to it have been rolled back
+	static void listRolledBack(quint64 id) { if (_instance) _instance->_listRolledBack(id); }
 	/// Returns the list that contains the list which id is given in parameter.
 	static QPair<const EntryList *, quint32> getOwner(quint64 id) { return instance()._getOwner(id); }
 	static QPair<const EntryList *, quint32> getIndexFromRowId(quint64 rowid) { return instance()._getIndexFromRowId(rowid); }
 	static quint64 getRowIdFromIndex(const QPair<const EntryList *, quint32> &idx) { return instance()._getRowIdFromIndex(idx); }
 	static void clearOwnerCache(quint64 id) { instance()._clearOwnerCache(id); }
-	static void clearOwnerCache() { instance()._clearOwnerCache(); }
+	static void clearOwnerCache() { if (_instance) _instance->_clearOwnerCache(); }
+	/// Returns the counters of the list which id is given, without reading its items
+	static EntryListStatistics statistics(quint64 id) { return instance()._statistics(id); }
+
+	struct MemoryStatistics {
+		int lists;
+		/// Tree nodes of all the lists that are in memory
+		int loadedNodes;
+		int cachedOwners;
+	};
+	/// Returns what the cache keeps in memory, without instanciating it
+	static MemoryStatistics memoryStatistics();
+	/// Releases the nodes of all but the most recently used lists, and the cached owners
+	static void trim() { if (_instance) _instance->_trim(); }
 	/// Returns the database connection used by the entry list system
 	static SQLite::Connection *connection() { return &instance()._connection; }
 };
 
+/**
+ * Transaction scope on the lists connection. The lists keep their trees
+ * in memory, so rolling back the database is not enough: if the scope is
+ * not committed, the lists given to touch() are read again from the
+ * database. Lists touched by a nested scope that is committed are
+ * reloaded if the enclosing scope is rolled back. Must be used from the
+ * GUI thread, like the lists.
+ */
+class EntryListTransaction : public SQLite::Transaction
+{
+private:
+	EntryListTransaction *_parent;
+	QList<quint64> _touched;
+	bool _committed;
+
+	static EntryListTransaction *_current;
+
+public:
+	EntryListTransaction();
+	~EntryListTransaction();
+	/// Records that list id is changed within this transaction
+	void touch(quint64 id) { _touched << id; }
+	bool commit();
+};
+
 #endif
@@ -17,6 +17,32 @@
 
 #include "core/EntryListDB.h"
 #include "core/EntryListCache.h"
+#include "core/EntryLoader.h"
+
+#include <QDataStream>
+#include <QIODevice>
+
+/**
+ * List exchange format: the magic number and version, followed by the
+ * exported list. A list is its number of items followed by the items
+ * themselves, each item starting with its type. Sub-lists (type 0) are
+ * followed by their label and their own list, entries by their id.
+ */
+#define LIST_EXCHANGE_MAGIC 0x54474c53
+#define LIST_EXCHANGE_VERSION 1
+/// Maximum number of items read before being inserted into a list
+#define LIST_IMPORT_BATCH_SIZE 1024
+/// Maximum nesting of the imported sub-lists
+#define LIST_IMPORT_MAX_DEPTH 64
+
+/// What an import changed in memory, to be undone if it fails
+struct ListImport {
+	/// Lists created for the imported sub-lists
+	QList<quint64> newLists;
+	/// Loaded entries that have been added to a list, with the rowid of
+	/// their item
+	QList<QPair<EntryPointer, quint64> > entries;
+};
 
 template <> QString DBListEntry<EntryListData>::tableDataMembers()
 {
@@ -44,28 +70,165 @@ EntryListDBAccess::EntryListDBAccess(const QString &tableName, SQLite::Connectio
 
 bool EntryListDBAccess::createDataIndexes(SQLite::Connection *connection)
 {
-	if (!connection->exec(QString("CREATE INDEX idx_%1_type_id ON %1(type,id)").arg(tableName()))) return false;
+	// listId is part of the index so that membership is known from it alone
+	if (!connection->exec(QString("CREATE INDEX idx_%1_type_id ON %1(type,id,listId)").arg(tableName()))) return false;
 	if (!connection->exec(QString("CREATE INDEX idx_%1Roots_rootId ON %1Roots(rootId)").arg(tableName()))) return false;
 	return true;
 }
 
+static bool writeList(const EntryList *list, QDataStream &ds)
+{
+	ds << (quint32)list->size();
+	for (EntryList::Iterator it = list->iterator(0); it.isValid(); ++it) {
+		// Reading a sub-list may release the nodes of this one
+		EntryListData data = it.value();
+		ds << data.type;
+		if (data.isList()) {
+			const EntryList *subList = EntryListCache::get(data.id);
+			ds << subList->label();
+			if (!writeList(subList, ds)) return false;
+		}
+		else ds << data.id;
+		if (ds.status() != QDataStream::Ok) return false;
+	}
+	return true;
+}
+
+bool EntryList::exportTo(QIODevice *device) const
+{
+	QDataStream ds(device);
+	ds.setVersion(QDataStream::Qt_5_0);
+	ds << (quint32)LIST_EXCHANGE_MAGIC << (quint32)LIST_EXCHANGE_VERSION;
+	if (!writeList(this, ds)) {
+		qWarning("Error while exporting list %d", listId());
+		return false;
+	}
+	return true;
+}
+
+static bool insertItems(EntryList *list, int index, const QVector<EntryListData> &items, ListImport &import)
+{
+	if (!list->tree()->beginBatch()) return false;
+	if (!list->insertRange(index, items)) {
+		list->tree()->endBatch(false);
+		return false;
+	}
+	for (int i = 0; i < items.size(); i++) {
+		const EntryListData &data = items[i];
+		if (data.isList()) continue;
+		EntryLoader::markUserData(data.type, data.id);
+		// Add the list to the entry if it is loaded
+		EntryRef entry(data.entryRef());
+		if (entry.isLoaded()) {
+			EntryPointer loaded(entry.get());
+			quint64 rowid(EntryListCache::getRowIdFromIndex(QPair<const EntryList *, quint32>(list, index + i)));
+			loaded->addToList(rowid, list->listId());
+			import.entries << QPair<EntryPointer, quint64>(loaded, rowid);
+		}
+	}
+	return list->tree()->endBatch();
+}
+
+static bool readList(EntryList *list, int index, QDataStream &ds, int depth, ListImport &import)
+{
+	if (depth > LIST_IMPORT_MAX_DEPTH) {
+		qWarning("Imported lists are nested too deeply");
+		return false;
+	}
+	quint32 count;
+	ds >> count;
+	QVector<EntryListData> items;
+	items.reserve(qMin(count, (quint32)LIST_IMPORT_BATCH_SIZE));
+	while (count-- > 0) {
+		if (ds.status() != QDataStream::Ok) return false;
+		EntryListData data;
+		ds >> data.type;
+		if (data.isList()) {
+			QString label;
+			ds >> label;
+			EntryList *subList = EntryListCache::newList();
+			if (!subList->listId()) return false;
+			import.newLists << subList->listId();
+			if (!subList->setLabel(label)) return false;
+			if (!readList(subList, 0, ds, depth + 1, import)) return false;
+			data.id = subList->listId();
+		}
+		else {
+			if (!EntriesCache::instance().hasLoader(data.type)) {
+				qWarning("Invalid entry type %d in imported list", data.type);
+				return false;
+			}
+			ds >> data.id;
+		}
+		if (ds.status() != QDataStream::Ok) return false;
+		items << data;
+		if (items.size() == LIST_IMPORT_BATCH_SIZE || count == 0) {
+			if (!insertItems(list, index, items, import)) return false;
+			index += items.size();
+			items.clear();
+		}
+	}
+	return true;
+}
+
+bool EntryList::importFrom(QIODevice *device, int index)
+{
+	if (index < 0 || (unsigned int)index > size()) return false;
+	QDataStream ds(device);
+	ds.setVersion(QDataStream::Qt_5_0);
+	quint32 magic, version;
+	ds >> magic >> version;
+	if (ds.status() != QDataStream::Ok || magic != LIST_EXCHANGE_MAGIC) {
+		qWarning("Not a list exchange file");
+		return false;
+	}
+	if (version > LIST_EXCHANGE_VERSION) {
+		qWarning("List exchange file version %d is not supported", version);
+		return false;
+	}
+
+	ListImport import;
+	bool ok;
+	{
+		EntryListTransaction transaction;
+		if (!transaction.isActive()) return false;
+		transaction.touch(listId());
+		ok = readList(this, index, ds, 0, import);
+		if (ok) ok = transaction.commit();
+	}
+	if (!ok) {
+		qWarning("Error while importing into list %d", listId());
+		// This list has been reloaded, undo the rest of the import
+		for (int i = 0; i < import.entries.size(); i++) import.entries[i].first->removeFromList(import.entries[i].second);
+		foreach (quint64 id, import.newLists) EntryListCache::clearListCache(id);
+	}
+	EntryListCache::clearOwnerCache();
+	return ok;
+}
+
 bool EntryList::remove(int index)
 {
 	TreeType::Node *node = getNode(index);
 	if (!node) return false;
 	const EntryListData &data = node->value();
+	// Lists are only removed as a whole
+	EntryListTransaction transaction;
+	if (!transaction.isActive()) return false;
+	transaction.touch(listId());
 	// We have to recursively erase the child list
 	if (data.isList()) {
+		transaction.touch(data.id);
 		EntryList *list = EntryListCache::get(data.id);
 		while(1) {
 			int ls = list->size();
 			if (ls == 0) break;
 			while (ls--) if (!list->remove(0)) return false;
 		}
+		// Finally, delete the list
+		if (!list->tree()->removeList()) return false;
 		// Invalidate the cache for the removed list
 		EntryListCache::clearListCache(data.id);
-		// Finally, delete the list
-		list->tree()->removeList();
 	}
-	return OrderedRBTree<OrderedRBDBTree<EntryListData> >::remove(index);
+	if (!OrderedRBTree<OrderedRBDBTree<EntryListData> >::remove(index)) return false;
+	return transaction.commit();
 }
@@ -33,6 +33,8 @@
 
 #define LISTS_DB_TABLES_PREFIX "lists"
 
+class QIODevice;
+
 struct EntryListData {
 	quint8 type;
 	quint32 id;
@@ -80,10 +82,24 @@ public:
 
 	/**
 	 * Specialization of the remove method that ensures lists are removed recursively.
-	 * No transaction is performed here, so it is a good idea to have a transaction started
-	 * before calling this method.
+	 * The removal is done within its own EntryListTransaction, which is nested
+	 * into the caller's if one is already started.
 	 */
 	bool remove(int index);
+
+	/**
+	 * Writes the items of this list, sub-lists included, to device in the
+	 * list exchange format. Items are read sequentially, so the nodes kept
+	 * in memory stay bounded by the lists' node caches.
+	 */
+	bool exportTo(QIODevice *device) const;
+	/**
+	 * Reads a list written by exportTo() from device and inserts its items
+	 * at index. Items are inserted by batches of bounded size as balanced
+	 * subtrees, and the whole import is done in a single transaction. If it
+	 * fails, the lists and the loaded entries are left as they were.
+	 */
+	bool importFrom(QIODevice *device, int index);
 // Needed because EntryListModel uses a QMap - but never called, actually.
 friend class QMap<quint64, EntryList>;
 };
@@ -16,23 +16,66 @@
  */
 
 #include "core/EntryLoader.h"
+#include "core/EntrySummary.h"
 #include "core/Database.h"
 
-EntryLoader::EntryLoader()
+#include <QHash>
+#include <QStringList>
+#include <QBitArray>
+#include <QReadWriteLock>
+
+/**
+ * Bitmaps of the ids of each type that have user data. They are built from
+ * the user database the first time they are needed and then kept current by
+ * markUserData(), so entries without user data (i.e. most of them) never
+ * need to query it.
+ */
+static QReadWriteLock _userDataLock;
+static QHash<EntryType, QBitArray> _userData;
+static bool _userDataLoaded = false;
+
+static void setUserDataBit(EntryType type, EntryId id)
+{
+	QBitArray &bits = _userData[type];
+	if ((int)id >= bits.size()) bits.resize(qMax((int)id + 1, bits.size() * 2));
+	bits.setBit(id);
+}
+
+static bool testUserDataBit(EntryType type, EntryId id)
+{
+	QHash<EntryType, QBitArray>::const_iterator it(_userData.constFind(type));
+	return it != _userData.constEnd() && (int)id < it->size() && it->testBit(id);
+}
+
+EntryLoader::EntryLoader() : _profileGeneration(-1)
+{
+	checkProfile();
+}
+
+void EntryLoader::checkProfile()
 {
-	if (!connection.connect(Database::userDBFile())) {
-		qFatal("EntrySearcher cannot connect to user database!");
+	int generation = Database::profileGeneration();
+	if (generation == _profileGeneration) return;
+	_profileGeneration = generation;
+
+	trainQuery.clear();
+	tagsQuery.clear();
+	notesQuery.clear();
+	listsQuery.clear();
+	if (_userConnection.connected()) _userConnection.close();
+	if (!_userConnection.connect(Database::userDBFile(), SQLite::Connection::WAL)) {
+		qFatal("EntryLoader cannot connect to user database!");
 	}
-	trainQuery.useWith(&connection);
-	tagsQuery.useWith(&connection);
-	notesQuery.useWith(&connection);
-	listsQuery.useWith(&connection);
+	trainQuery.useWith(&_userConnection);
+	tagsQuery.useWith(&_userConnection);
+	notesQuery.useWith(&_userConnection);
+	listsQuery.useWith(&_userConnection);
 
 	// Cache queries
-	trainQuery.prepare("select dateAdded, dateLastTrain, nbTrained, nbSuccess, dateLastMistake, score from training where type = ? and id = ?");
+	trainQuery.prepare("select dateAdded, dateLastTrain, nbTrained, nbSuccess, dateLastMistake, score, dueDate, interval from training where type = ? and id = ?");
 	tagsQuery.prepare("select tagId from taggedEntries where type = ? and id = ? order by date");
-	notesQuery.prepare("select noteId, dateAdded, dateLastChange, note from notes join notesText on notes.noteId == notesText.docid where type = ? and id = ? order by dateAdded ASC, noteId ASC");
-	listsQuery.prepare("select rowid from lists where type = ? and id = ?");
+	notesQuery.prepare("select 1 from notes where type = ? and id = ? limit 1");
+	listsQuery.prepare("select rowid, listId from lists where type = ? and id = ?");
 }
 
 EntryLoader::~EntryLoader()
@@ -51,8 +94,67 @@ static QDateTime variantToDate(const SQLite::Query &query, int col)
 	else return QDateTime();
 }
 
+QString EntryLoader::idList(const QVector<EntryId> &ids)
+{
+	QStringList ret;
+	ret.reserve(ids.size());
+	foreach (EntryId id, ids) ret << QString::number(id);
+	return ret.join(",");
+}
+
+void EntryLoader::markUserData(EntryType type, EntryId id)
+{
+	QWriteLocker lock(&_userDataLock);
+	// Bits are set even if the bitmaps are not built yet, since the data
+	// may not be visible to the connection that builds them
+	setUserDataBit(type, id);
+}
+
+void EntryLoader::resetUserData()
+{
+	QWriteLocker lock(&_userDataLock);
+	_userData.clear();
+	_userDataLoaded = false;
+}
+
+bool EntryLoader::mayHaveUserData(EntryType type, EntryId id)
+{
+	{
+		QReadLocker lock(&_userDataLock);
+		if (_userDataLoaded) return testUserDataBit(type, id);
+	}
+
+	QWriteLocker lock(&_userDataLock);
+	if (!_userDataLoaded) {
+		SQLite::Query query(&_userConnection);
+		if (!query.exec("select type, id from training union select type, id from taggedEntries union select type, id from notes union select type, id from lists where type not null")) return true;
+		while (query.next()) setUserDataBit(query.valueUInt(0), query.valueUInt(1));
+		_userDataLoaded = true;
+	}
+	return testUserDataBit(type, id);
+}
+
+QVector<Entry *> EntryLoader::loadEntries(const QVector<EntryId> &ids)
+{
+	QVector<Entry *> ret;
+	ret.reserve(ids.size());
+	foreach (EntryId id, ids) ret << loadEntry(id);
+	return ret;
+}
+
+QVector<EntrySummary> EntryLoader::loadSummaries(const QVector<EntryId> &ids)
+{
+	Q_UNUSED(ids);
+	return QVector<EntrySummary>();
+}
+
 void EntryLoader::loadMiscData(Entry *entry)
 {
+	checkProfile();
+	if (!mayHaveUserData(entry->type(), entry->id())) return;
+	// Changes to this entry may not have reached the database yet
+	if (DatabaseWriter::hasPendingWrites(entry->type(), entry->id())) DatabaseWriter::flush();
+
 	// Load training data
 	trainQuery.bindValue(entry->type());
 	trainQuery.bindValue(entry->id());
@@ -65,6 +167,8 @@ void EntryLoader::loadMiscData(Entry *entry)
 		entry->setNbSuccess(trainQuery.valueInt(3));
 		entry->setDateLastMistake(variantToDate(trainQuery, 4));
 		entry->_score = trainQuery.valueInt(5);
+		entry->setDateDue(variantToDate(trainQuery, 6));
+		entry->setInterval(trainQuery.valueUInt(7));
 	}
 	trainQuery.reset();
 
@@ -76,13 +180,11 @@ void EntryLoader::loadMiscData(Entry *entry)
 		entry->_tags << Tag::getTag(tagsQuery.valueUInt(0));
 	tagsQuery.reset();
 
-	// Notes data
+	// Notes are loaded on demand by Entry::notes()
 	notesQuery.bindValue(entry->type());
 	notesQuery.bindValue(entry->id());
 	notesQuery.exec();
-	while (notesQuery.next()) {
-		entry->_notes << Entry::Note(notesQuery.valueInt(0), QDateTime::fromSecsSinceEpoch(notesQuery.valueInt(1)), QDateTime::fromSecsSinceEpoch(notesQuery.valueInt(2)), notesQuery.valueString(3));
-	}
+	entry->_hasNotes = notesQuery.next();
 	notesQuery.reset();
 	
 	// Lists data
@@ -90,8 +192,98 @@ void EntryLoader::loadMiscData(Entry *entry)
 	listsQuery.bindValue(entry->id());
 	listsQuery.exec();
 	while (listsQuery.next()) {
-		entry->_lists << listsQuery.valueUInt64(0);
+		entry->_lists[listsQuery.valueUInt64(0)] = listsQuery.valueUInt64(1);
 	}
 	listsQuery.reset();
 }
 
+void EntryLoader::loadMiscData(const QVector<Entry *> &entries)
+{
+	checkProfile();
+	QHash<EntryId, Entry *> byId;
+	QVector<EntryId> ids;
+	bool pendingWrites(false);
+	foreach (Entry *entry, entries) {
+		if (!mayHaveUserData(entry->type(), entry->id())) continue;
+		byId[entry->id()] = entry;
+		ids << entry->id();
+		if (!pendingWrites) pendingWrites = DatabaseWriter::hasPendingWrites(entry->type(), entry->id());
+	}
+	if (ids.isEmpty()) return;
+	if (pendingWrites) DatabaseWriter::flush();
+	QString where(QString("type = %1 and id in (%2)").arg(entries[0]->type()).arg(idList(ids)));
+	SQLite::Query query(&_userConnection);
+
+	// Training data
+	query.exec("select id, dateAdded, dateLastTrain, nbTrained, nbSuccess, dateLastMistake, score, dueDate, interval from training where " + where);
+	while (query.next()) {
+		Entry *entry = byId.value(query.valueUInt(0));
+		if (!entry) continue;
+		entry->setDateAdded(variantToDate(query, 1));
+		entry->setDateLastTrained(variantToDate(query, 2));
+		entry->setNbTrained(query.valueInt(3));
+		entry->setNbSuccess(query.valueInt(4));
+		entry->setDateLastMistake(variantToDate(query, 5));
+		entry->_score = query.valueInt(6);
+		entry->setDateDue(variantToDate(query, 7));
+		entry->setInterval(query.valueUInt(8));
+	}
+
+	// Tags data
+	query.exec("select id, tagId from taggedEntries where " + where + " order by date");
+	while (query.next()) {
+		Entry *entry = byId.value(query.valueUInt(0));
+		if (entry) entry->_tags << Tag::getTag(query.valueUInt(1));
+	}
+
+	// Notes are loaded on demand by Entry::notes()
+	query.exec("select distinct id from notes where " + where);
+	while (query.next()) {
+		Entry *entry = byId.value(query.valueUInt(0));
+		if (entry) entry->_hasNotes = true;
+	}
+
+	// Lists data
+	query.exec("select id, rowid, listId from lists where " + where);
+	while (query.next()) {
+		Entry *entry = byId.value(query.valueUInt(0));
+		if (entry) entry->_lists[query.valueUInt64(1)] = query.valueUInt64(2);
+	}
+}
+
+void EntryLoader::loadMiscData(QVector<EntrySummary> &summaries)
+{
+	checkProfile();
+	QHash<EntryId, int> byId;
+	QVector<EntryId> ids;
+	bool pendingWrites(false);
+	for (int i = 0; i < summaries.size(); i++) {
+		const EntryRef &ref = summaries[i].ref();
+		if (!mayHaveUserData(ref.type(), ref.id())) continue;
+		byId[ref.id()] = i;
+		ids << ref.id();
+		if (!pendingWrites) pendingWrites = DatabaseWriter::hasPendingWrites(ref.type(), ref.id());
+	}
+	if (ids.isEmpty()) return;
+	if (pendingWrites) DatabaseWriter::flush();
+	QString where(QString("type = %1 and id in (%2)").arg(summaries[0].ref().type()).arg(idList(ids)));
+	SQLite::Query query(&_userConnection);
+
+	// Summaries only need to know whether there is user data, not what it is
+	query.exec("select id, score, dateAdded from training where " + where);
+	while (query.next()) {
+		if (!byId.contains(query.valueUInt(0))) continue;
+		EntrySummary &summary = summaries[byId[query.valueUInt(0)]];
+		summary._score = query.valueInt(1);
+		if (query.valueType(2) == SQLite::Integer) summary.setFlag(EntrySummary::Trained);
+	}
+
+	query.exec("select distinct id from taggedEntries where " + where);
+	while (query.next()) if (byId.contains(query.valueUInt(0))) summaries[byId[query.valueUInt(0)]].setFlag(EntrySummary::HasTags);
+
+	query.exec("select distinct id from notes where " + where);
+	while (query.next()) if (byId.contains(query.valueUInt(0))) summaries[byId[query.valueUInt(0)]].setFlag(EntrySummary::HasNotes);
+
+	query.exec("select distinct id from lists where " + where);
+	while (query.next()) if (byId.contains(query.valueUInt(0))) summaries[byId[query.valueUInt(0)]].setFlag(EntrySummary::HasLists);
+}
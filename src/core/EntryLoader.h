@@ -22,18 +22,35 @@
 #include "sqlite/Query.h"
 #include "core/Entry.h"
 
+#include <QVector>
+
+class EntrySummary;
+
 /**
  * Base class for loading entries of a given type.
  */
 class EntryLoader
 {
 private:
+	/// Connection to the user db file of the current profile
+	SQLite::Connection _userConnection;
+	/// Profile generation _userConnection has been opened for
+	int _profileGeneration;
 	SQLite::Query trainQuery, tagsQuery, notesQuery, listsQuery;
 
+	/**
+	 * Reconnects to the user database if the profile has been switched
+	 * since the last time user data was loaded.
+	 */
+	void checkProfile();
+
 protected:
 	/**
-	 * Connection to the user db file (and possibly other dbs)
-	 * that is used to load the entries.
+	 * Connection to the dictionary dbs that is used to load the entries,
+	 * opened by the subclasses using Database::openDictionaryConnection().
+	 * Its main database is in memory: loadMiscData() reads user data from
+	 * the connection of the current profile, so that switching profiles
+	 * does not require the dictionaries to be attached again.
 	 */
 	SQLite::Connection connection;
 
@@ -44,6 +61,26 @@ protected:
 	 * has created the right instance for its entry.
 	 */
 	void loadMiscData(Entry *entry);
+	/**
+	 * Same as above, but for several entries of the same type at once.
+	 */
+	void loadMiscData(const QVector<Entry *> &entries);
+	/**
+	 * Sets the training score and user data flags of summaries, which
+	 * must all be of the same type.
+	 */
+	void loadMiscData(QVector<EntrySummary> &summaries);
+
+	/// Returns ids as a comma-separated list, for use in "in" clauses
+	static QString idList(const QVector<EntryId> &ids);
+
+	/**
+	 * Returns true if the user database may contain training data, tags,
+	 * notes or lists for the given entry. False positives are possible,
+	 * but if false is returned then the entry has no user data for sure
+	 * and loadMiscData() does not need to query the database for it.
+	 */
+	bool mayHaveUserData(EntryType type, EntryId id);
 
 public:
 	EntryLoader();
@@ -55,6 +92,47 @@ public:
 	 * case of problem, for instance if there is no other result.
 	 */
 	virtual Entry *loadEntry(EntryId id) = 0;
+
+	/**
+	 * Loads several entries at once. Loaders should run each of
+	 * their queries only once for all the entries. Returns the entries
+	 * in the same order as ids, with null pointers for the ones that
+	 * could not be loaded.
+	 *
+	 * The default implementation calls loadEntry() for every id.
+	 */
+	virtual QVector<Entry *> loadEntries(const QVector<EntryId> &ids);
+
+	/**
+	 * Loads the summaries of several entries at once, in the same order as
+	 * ids. Loaders should only load what summaries need, which is much less
+	 * than full entries.
+	 *
+	 * Returns an empty vector if the loader does not support summaries, in
+	 * which case the full entries are loaded instead. This is what the
+	 * default implementation does.
+	 */
+	virtual QVector<EntrySummary> loadSummaries(const QVector<EntryId> &ids);
+
+	/**
+	 * Must be called whenever user data is written for an entry, so that
+	 * loaders know they must look for it. Removing user data does not
+	 * require any call.
+	 */
+	static void markUserData(EntryType type, EntryId id);
+	/// Forgets which entries have user data, e.g. after switching profiles
+	static void resetUserData();
 };
 
+/**
+ * Creates a new loader instance. Loaders are not thread-safe, so the
+ * EntriesCache uses a factory to create one loader per thread.
+ */
+typedef EntryLoader *(*EntryLoaderFactory)();
+
+template <class T> EntryLoader *createEntryLoader()
+{
+	return new T();
+}
+
 #endif
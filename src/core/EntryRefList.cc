@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/EntryRefList.h"
+
+#include <QDataStream>
+
+#include <algorithm>
+
+void EntryRefList::append(const EntryRef &ref)
+{
+	if (_runs.isEmpty() || _runs.last().type != ref.type()) {
+		Run run = { _ids.size(), ref.type() };
+		_runs << run;
+	}
+	_ids << ref.id();
+}
+
+EntryType EntryRefList::typeAt(int i) const
+{
+	// Last run starting at or before i
+	QVector<Run>::const_iterator it(std::upper_bound(_runs.constBegin(), _runs.constEnd(), i, runBefore));
+	return (it - 1)->type;
+}
+
+QList<EntryRef> EntryRefList::mid(int pos, int length) const
+{
+	if (length < 0 || pos + length > size()) length = size() - pos;
+	QList<EntryRef> ret;
+	ret.reserve(length);
+	for (int i = pos; i < pos + length; i++) ret << at(i);
+	return ret;
+}
+
+QByteArray EntryRefList::toByteArray() const
+{
+	QByteArray ret;
+	QDataStream ds(&ret, QIODevice::WriteOnly);
+	ds << (qint32)_runs.size();
+	foreach (const Run &run, _runs) ds << (qint32)run.first << run.type;
+	ds << _ids;
+	return ret;
+}
+
+EntryRefList EntryRefList::fromByteArray(const QByteArray &data)
+{
+	EntryRefList ret;
+	QDataStream ds(data);
+	qint32 nbRuns;
+	ds >> nbRuns;
+	for (qint32 i = 0; i < nbRuns && ds.status() == QDataStream::Ok; i++) {
+		qint32 first;
+		Run run;
+		ds >> first >> run.type;
+		run.first = first;
+		ret._runs << run;
+	}
+	ds >> ret._ids;
+	if (ds.status() != QDataStream::Ok) return EntryRefList();
+	// Runs must start in order, within the list
+	for (int i = 0; i < ret._runs.size(); i++) {
+		if (ret._runs[i].first >= ret._ids.size() || (i > 0 && ret._runs[i].first <= ret._runs[i - 1].first) || (i == 0 && ret._runs[i].first != 0)) return EntryRefList();
+	}
+	if (ret._runs.isEmpty() != ret._ids.isEmpty()) return EntryRefList();
+	return ret;
+}
+
+QVector<EntryId> EntryRefList::ids(EntryType type) const
+{
+	QVector<EntryId> ret;
+	for (int r = 0; r < _runs.size(); r++) {
+		if (_runs[r].type != type) continue;
+		int end = r + 1 < _runs.size() ? _runs[r + 1].first : _ids.size();
+		for (int i = _runs[r].first; i < end; i++) ret << _ids[i];
+	}
+	return ret;
+}
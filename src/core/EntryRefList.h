@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_ENTRYREFLIST_H
+#define __CORE_ENTRYREFLIST_H
+
+#include "core/EntriesCache.h"
+
+#include <QVector>
+#include <QList>
+#include <QByteArray>
+
+/**
+ * Compact list of entry references, for lists that can hold a very large
+ * number of them such as search results.
+ *
+ * Only the ids are stored for every reference. Their types are stored as
+ * runs of consecutive references of the same type, which are few since
+ * results are usually grouped by type. Appending is amortized O(1) and
+ * accessing a reference is O(log(number of runs)).
+ */
+class EntryRefList
+{
+private:
+	struct Run
+	{
+		/// Position of the first reference of the run
+		int first;
+		EntryType type;
+	};
+
+	QVector<EntryId> _ids;
+	QVector<Run> _runs;
+
+	static bool runBefore(int i, const Run &run) { return i < run.first; }
+
+public:
+	int size() const { return _ids.size(); }
+	bool isEmpty() const { return _ids.isEmpty(); }
+	void reserve(int size) { _ids.reserve(size); }
+	/// Also releases the memory used by the list
+	void clear() { _ids = QVector<EntryId>(); _runs = QVector<Run>(); }
+
+	void append(const EntryRef &ref);
+	EntryRefList &operator<<(const EntryRef &ref) { append(ref); return *this; }
+
+	EntryType typeAt(int i) const;
+	EntryRef at(int i) const { return EntryRef(typeAt(i), _ids[i]); }
+	EntryRef operator[](int i) const { return at(i); }
+	/// Returns length references starting at pos, or all the remaining ones
+	/// if length is -1
+	QList<EntryRef> mid(int pos, int length = -1) const;
+	/// Returns the ids of the references of the given type, in order
+	QVector<EntryId> ids(EntryType type) const;
+
+	/// Compact binary form of the list, e.g. to store it in the database
+	QByteArray toByteArray() const;
+	/// Returns an empty list if data is not valid
+	static EntryRefList fromByteArray(const QByteArray &data);
+};
+
+#endif
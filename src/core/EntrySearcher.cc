@@ -26,7 +26,7 @@
 
 PreferenceItem<bool> EntrySearcher::allowRomajiSearch("", "allowRomajiSearch", false);
 
-EntrySearcher::EntrySearcher(EntryType entryType) :commandMatch(SearchCommand::commandMatch().pattern()), _entryType(entryType)
+EntrySearcher::EntrySearcher(EntryType entryType) : _entryType(entryType)
 {
 	QueryBuilder::Join::addTablePriority("training", -100);
 	QueryBuilder::Join::addTablePriority("notes", -40);
@@ -135,7 +135,10 @@ void EntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBuilder:
 		if (processed) commands.removeOne(command);
 	}
 	if (!notesSearch.isEmpty()) {
-		statement.addWhere(QString("notes.noteId in (select docid from notesText where note match '%1')").arg(notesSearch.join(" ")));
+		QString match(notesSearch.join(" "));
+		statement.addWhere(QString("notes.noteId in (select docid from notesText where note match '%1')").arg(match));
+		// Only evaluated for the notes already selected above
+		statement.setMatchRank(QString("(select ftsrank(matchinfo(notesText, 'pcnalx')) from notesText where note match '%1' and docid = notes.noteId)").arg(match));
 	}
 	if (!tagSearch.isEmpty()) {
 		// Remove duplicates, case insensitively
@@ -156,19 +159,23 @@ QueryBuilder::Column EntrySearcher::canSort(const QString &sort, const QueryBuil
 	else if (sort == "score") {
 		return QueryBuilder::Column("training", "score");
 	}
+	else if (sort == "matchRank" && !statement.matchRank().isEmpty()) {
+		// Entries are ranked by their most relevant note
+		return QueryBuilder::Column("", statement.matchRank(), "max");
+	}
 	return QueryBuilder::Column("0");
 }
 
 bool EntrySearcher::searchToCommands(const QStringList &searches, QList<SearchCommand> &commands) const
 {
 	foreach (const QString &search, searches) {
-		if (commandMatch.exactMatch(search)) {
-			SearchCommand command = SearchCommand::fromString(search);
+		SearchCommand command = SearchCommand::fromString(search);
+		if (command.isValid()) {
 			if (validCommands.contains(command.command())) commands << command;
 			else return false;
 		}
 		else {
-			SearchCommand command = commandFromWord(search);
+			command = commandFromWord(search);
 			if (command.isValid()) commands << command;
 			else return false;
 		}
@@ -33,7 +33,6 @@
 class EntrySearcher
 {
 private:
-	QRegExp commandMatch;
 	EntryType _entryType;
 
 protected:
@@ -86,6 +85,13 @@ public:
 	 */
 	virtual QueryBuilder::Column canSort(const QString &sort, const QueryBuilder::Statement &statement);
 
+	/**
+	 * Returns a string describing the preferences of this searcher that
+	 * change the results of searches. Stored results of saved searches
+	 * are only reused as long as it does not change.
+	 */
+	virtual QString resultsStamp() const { return QString(); }
+
 	/**
 	 * Converts a list of string commands and words into a list of commands,
 	 * provided all the elements are understood by this searcher.
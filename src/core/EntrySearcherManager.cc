@@ -16,34 +16,41 @@
  */
 
 #include "core/Preferences.h"
+#include "core/Database.h"
 #include "core/EntrySearcherManager.h"
+#include "core/Tracer.h"
+#include "core/Lang.h"
+
+#include <QDate>
 
 EntrySearcherManager *EntrySearcherManager::_instance = 0;
 PreferenceItem<bool> EntrySearcherManager::studiedEntriesFirst("mainWindow/resultsView", "studiedEntriesFirst", true);
 
 const int resultsPerPage = 50;
 
-EntrySearcherManager::EntrySearcherManager() : quotedWordsMatch(SearchCommand::quotedWordsMatch().pattern()),
-	validSearchCompoundMatch(SearchCommand::commandMatch().pattern() + "|" + SearchCommand::singleWordMatch().pattern() + "|" + SearchCommand::quotedWordsMatch().pattern()),
-	validSearchMatch(" *((" + validSearchCompoundMatch.pattern() + ") *)* *")
+EntrySearcherManager::EntrySearcherManager() : _queryCache(queryCacheSize)
 {
 	QueryBuilder::Order::orderingWay["jlpt"] = QueryBuilder::Order::DESC;
+	QueryBuilder::Order::orderingWay["matchRank"] = QueryBuilder::Order::DESC;
 }
 
 QStringList EntrySearcherManager::splitSearchString(const QString &searchString)
 {
-	if (!validSearchMatch.exactMatch(searchString)) return QStringList();
-	int pos = 0;
-	QStringList res;
-	while ((pos = validSearchCompoundMatch.indexIn(searchString, pos)) != -1) {
-		QString compound = validSearchCompoundMatch.cap();
-		// Special handling for quoted words
-		if (quotedWordsMatch.exactMatch(compound))
-			compound.remove(compound.size() - 1, 1).remove(0, 1);
-		res << compound;
-		pos += validSearchCompoundMatch.matchedLength();
-	}
-	return res;
+	return SearchCommand::splitSearchString(searchString);
+}
+
+QString EntrySearcherManager::resultsStamp() const
+{
+	QString dataStamp(Database::dataStamp());
+	if (dataStamp.isEmpty()) return QString();
+	QStringList stamp;
+	// Profiles may have the same data stamps
+	stamp << Database::currentProfile();
+	stamp << QString("%1%2").arg(studiedEntriesFirst.value()).arg(EntrySearcher::allowRomajiSearch.value()) << Lang::preferredDictLanguages().join(",");
+	foreach (const EntrySearcher *searcher, _instances) stamp << searcher->resultsStamp();
+	// Relative dates of searches depend on the current day
+	stamp << dataStamp << QDate::currentDate().toString(Qt::ISODate);
+	return stamp.join(" ");
 }
 
 EntrySearcherManager &EntrySearcherManager::instance()
@@ -55,10 +62,12 @@ EntrySearcherManager &EntrySearcherManager::instance()
 void EntrySearcherManager::addInstance(EntrySearcher *searcher)
 {
 	if (!_instances.contains(searcher)) _instances << searcher;
+	clearQueryCache();
 }
 
 bool EntrySearcherManager::removeInstance(EntrySearcher *searcher)
 {
+	clearQueryCache();
 	return _instances.removeOne(searcher);
 }
 
@@ -74,6 +83,51 @@ static void replaceJapaneseWildCards(QString &str)
 }
 
 bool EntrySearcherManager::buildQuery(const QString &search, QueryBuilder &query)
+{
+	TRACE_SCOPE("Query build");
+	// Searchers may read the user data while building the query
+	DatabaseWriter::flush();
+	// Can only use the cache if the query does not contain anything yet
+	bool cacheable = query.statements().isEmpty() && query.orders().isEmpty();
+	if (!cacheable) return _buildQuery(search, query, 0);
+
+	QString searchString(search);
+	replaceJapaneseWildCards(searchString);
+	// Preferences that change how searches are turned into queries, and
+	// the current day relative dates are turned into timestamps from
+	QString key(QString("%1%2%3 %4 %5").arg(studiedEntriesFirst.value()).arg(EntrySearcher::allowRomajiSearch.value()).arg(Lang::preferredDictLanguages().join(",")).arg(QDate::currentDate().toString(Qt::ISODate)).arg(searchString.trimmed()));
+
+	{
+		QMutexLocker lock(&_queryCacheMutex);
+		QueryBuilder *cached = _queryCache.object(key);
+		if (cached) {
+			query = *cached;
+			return true;
+		}
+	}
+
+	// Built without holding the lock, so other threads are not blocked
+	if (!_buildQuery(search, query, 0)) return false;
+	QMutexLocker lock(&_queryCacheMutex);
+	_queryCache.insert(key, new QueryBuilder(query));
+	return true;
+}
+
+bool EntrySearcherManager::buildQuery(const QString &search, QueryBuilder &query, const EntryRefList &restrictTo)
+{
+	DatabaseWriter::flush();
+	return _buildQuery(search, query, &restrictTo);
+}
+
+QString EntrySearcherManager::buildCountStatement(const QString &search)
+{
+	QueryBuilder query;
+	DatabaseWriter::flush();
+	if (!_buildQuery(search, query, 0)) return QString();
+	return query.buildCountSqlStatement();
+}
+
+bool EntrySearcherManager::_buildQuery(const QString &search, QueryBuilder &query, const EntryRefList *restrictTo)
 {
 	QString searchString(search);
 	replaceJapaneseWildCards(searchString);
@@ -86,8 +140,11 @@ bool EntrySearcherManager::buildQuery(const QString &search, QueryBuilder &query
 
 	// First filter ordering commands
 	QStringList orders;
+	// Most relevant matches of full-text searches first
+	orders << "matchRank";
 	if (studiedEntriesFirst.value()) orders << "study" << "score";
-	orders << "matchPos" << "jlpt" << "freq";
+	// JLPT level then frequency, precomputed by the dictionary builders
+	orders << "matchPos" << "relevance";
 
 	// Transform words into commands, if applicable
 	bool validQuery = false;
@@ -102,6 +159,12 @@ bool EntrySearcherManager::buildQuery(const QString &search, QueryBuilder &query
 			// Try to get every command into sql statements
 			searcher->buildStatement(commands, statement);
 			if (commands.isEmpty()) {
+				if (restrictTo) {
+					QStringList ids;
+					foreach (EntryId id, restrictTo->ids(searcher->entryType()))
+						ids << QString::number(id);
+					statement.addWhere(QString("{{leftcolumn}} in (%1)").arg(ids.join(",")));
+				}
 				foreach(const QString &order, orders) {
 					statement.addColumn(searcher->canSort(order, statement));
 				}
@@ -123,6 +186,36 @@ bool EntrySearcherManager::buildQuery(const QString &search, QueryBuilder &query
 	return true;
 }
 
+bool EntrySearcherManager::isRefinement(const QString &previous, const QString &search)
+{
+	QString prevString(previous), searchString(search);
+	replaceJapaneseWildCards(prevString);
+	replaceJapaneseWildCards(searchString);
+	QStringList prevTerms(splitSearchString(prevString.trimmed()));
+	QStringList terms(splitSearchString(searchString.trimmed()));
+	if (prevTerms.isEmpty() || terms.isEmpty() || prevTerms == terms) return false;
+
+	// Every previous term must be matched by a term of the new search
+	foreach (const QString &prevTerm, prevTerms) {
+		int idx = terms.indexOf(prevTerm);
+		if (idx == -1 && prevTerm.size() > 1 && prevTerm.endsWith('*') && !prevTerm.startsWith(':')) {
+			QString prefix(prevTerm.left(prevTerm.size() - 1));
+			// The prefix must not contain other wildcards, and the new
+			// term must be a plain extension of it
+			if (prefix.contains('*') || prefix.contains('?')) return false;
+			for (int i = 0; i < terms.size(); i++) {
+				if (terms[i].size() > prefix.size() && terms[i].startsWith(prefix)) {
+					idx = i;
+					break;
+				}
+			}
+		}
+		if (idx == -1) return false;
+		terms.removeAt(idx);
+	}
+	return true;
+}
+
 EntrySearcher *EntrySearcherManager::getEntrySearcher(EntryType entryType)
 {
 	foreach(EntrySearcher *searcher, _instances)
@@ -21,8 +21,11 @@
 #include "core/Preferences.h"
 #include "core/EntrySearcher.h"
 #include "core/QueryBuilder.h"
+#include "core/EntriesCache.h"
+#include "core/EntryRefList.h"
 
-#include <QRegExp>
+#include <QCache>
+#include <QMutex>
 
 class EntrySearcherManager
 {
@@ -30,9 +33,15 @@ private:
 	static EntrySearcherManager *_instance;
 	QList<EntrySearcher *> _instances;
 
-	QRegExp quotedWordsMatch;
-	QRegExp validSearchCompoundMatch;
-	QRegExp validSearchMatch;
+	/// Queries built for previous searches, by normalized search string.
+	/// Repeated searches get the exact same SQL, and thus also hit the
+	/// prepared statements cache of the database connections.
+	QCache<QString, QueryBuilder> _queryCache;
+	/// Queries are built from several threads, e.g. to count the results
+	/// of filters in the background
+	QMutex _queryCacheMutex;
+
+	bool _buildQuery(const QString &search, QueryBuilder &query, const EntryRefList *restrictTo);
 
 public:
 	EntrySearcherManager();
@@ -41,10 +50,23 @@ public:
 	const QList<EntrySearcher *> &instances() { return _instances; }
 	bool removeInstance(EntrySearcher *searcher);
 
+	static const int queryCacheSize = 64;
+	/// Must be called if something other than the search string changes
+	/// the queries built by the searchers
+	void clearQueryCache() { QMutexLocker lock(&_queryCacheMutex); _queryCache.clear(); }
+
 	static EntrySearcherManager &instance();
 
 	QStringList splitSearchString(const QString &searchString);
 
+	/**
+	 * Returns a string that changes whenever the results of any search
+	 * may change, or an empty string if this cannot be determined. Used
+	 * to tell whether the stored results of a saved search are still
+	 * valid.
+	 */
+	QString resultsStamp() const;
+
 	/**
 	 * Attempts to build the query corresponding to the search string
 	 * using the attached entry searchers. Returns true if a query
@@ -52,6 +74,27 @@ public:
 	 * of the query is unspecified.
 	 */
 	bool buildQuery(const QString &search, QueryBuilder &query);
+	/**
+	 * Same as above, but only considers the entries of restrictTo. Used
+	 * to refine a previous search without scanning the indexes again.
+	 */
+	bool buildQuery(const QString &search, QueryBuilder &query, const EntryRefList &restrictTo);
+
+	/**
+	 * Returns a statement counting the results of search, or an empty
+	 * string if search is not valid. Used to show how many results the
+	 * options of filters would give, so these queries do not go through
+	 * the queries cache.
+	 */
+	QString buildCountStatement(const QString &search);
+
+	/**
+	 * Returns true if the results of search are guaranteed to be a subset
+	 * of those of previous, i.e. search has all the terms of previous plus
+	 * some more, or a trailing-wildcard term of previous has been
+	 * extended (e.g. "tabe*" to "taber*" or "taberu").
+	 */
+	bool isRefinement(const QString &previous, const QString &search);
 
 	/**
 	 * Returns a pointer to the entry searcher capable of handling
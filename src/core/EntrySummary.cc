@@ -0,0 +1,31 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/EntrySummary.h"
+
+EntrySummary::EntrySummary(const Entry &entry) : _ref(entry.type(), entry.id()), _mainRepr(entry.mainRepr()), _writings(entry.writings()), _readings(entry.readings()), _meanings(entry.meanings()), _score(entry.score()), _flags(0), _version(entry.version())
+{
+	if (entry.trained()) setFlag(Trained);
+	if (!entry.tags().isEmpty()) setFlag(HasTags);
+	if (entry.hasNotes()) setFlag(HasNotes);
+	if (!entry.lists().isEmpty()) setFlag(HasLists);
+}
+
+QString EntrySummary::shortVersion(Entry::VersionLength length) const
+{
+	return Entry::buildShortVersion(_mainRepr, _writings, _readings, _meanings, length);
+}
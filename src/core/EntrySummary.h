@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_ENTRY_SUMMARY_H
+#define __CORE_ENTRY_SUMMARY_H
+
+#include "core/EntriesCache.h"
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Compact description of an entry, holding only what is needed to display
+ * it in a list. Summaries are much cheaper to load and to keep around than
+ * full entries, which can still be loaded from their reference when their
+ * details are needed.
+ *
+ * A summary is a snapshot of its entry and is not updated when the entry
+ * changes.
+ */
+class EntrySummary
+{
+public:
+	enum Flag { Trained = 1 << 0, HasTags = 1 << 1, HasNotes = 1 << 2, HasLists = 1 << 3 };
+
+private:
+	EntryRef _ref;
+	QString _mainRepr;
+	QStringList _writings;
+	QStringList _readings;
+	QStringList _meanings;
+	qint16 _score;
+	quint8 _flags;
+	quint32 _version;
+
+	void setFlag(Flag flag) { _flags |= flag; }
+
+public:
+	/// Constructs a null summary
+	EntrySummary() : _score(0), _flags(0), _version(0) {}
+	/// Constructs an empty summary for ref, e.g. for an entry that cannot be loaded
+	explicit EntrySummary(const EntryRef &ref) : _ref(ref), _score(0), _flags(0), _version(0) {}
+	explicit EntrySummary(const Entry &entry);
+
+	bool isNull() const { return !_ref.isValid(); }
+	const EntryRef &ref() const { return _ref; }
+
+	const QString &mainRepr() const { return _mainRepr; }
+	const QStringList &writings() const { return _writings; }
+	const QStringList &readings() const { return _readings; }
+	const QStringList &meanings() const { return _meanings; }
+	int score() const { return _score; }
+	bool trained() const { return _flags & Trained; }
+	bool hasTags() const { return _flags & HasTags; }
+	bool hasNotes() const { return _flags & HasNotes; }
+	bool hasLists() const { return _flags & HasLists; }
+	/// Version of the entry this summary was built from, or 0 if it was
+	/// loaded from the database
+	quint32 version() const { return _version; }
+
+	/// Same as Entry::shortVersion()
+	QString shortVersion(Entry::VersionLength length = Entry::ShortVersion) const;
+
+friend class EntryLoader;
+};
+Q_DECLARE_METATYPE(EntrySummary)
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/GzipDevice.h"
+
+#include <zlib.h>
+
+/// Size of the chunks read from the wrapped device
+#define GZIP_INPUT_CHUNK 65536
+
+GzipDevice::GzipDevice(QIODevice *device, QObject *parent) : QIODevice(parent), _device(device), _stream(0), _compressed(false), _streamEnd(false)
+{
+}
+
+GzipDevice::~GzipDevice()
+{
+	close();
+}
+
+bool GzipDevice::open(OpenMode mode)
+{
+	if ((mode & ReadWrite) != ReadOnly) {
+		setErrorString("GzipDevice can only be opened read-only");
+		return false;
+	}
+	if (!_device->isOpen() && !_device->open(ReadOnly)) {
+		setErrorString(_device->errorString());
+		return false;
+	}
+
+	QByteArray magic(_device->peek(2));
+	_compressed = magic.size() == 2 && (uchar)magic[0] == 0x1f && (uchar)magic[1] == 0x8b;
+	_streamEnd = false;
+	if (_compressed) {
+		_stream = new z_stream_s;
+		_stream->zalloc = Z_NULL;
+		_stream->zfree = Z_NULL;
+		_stream->opaque = Z_NULL;
+		_stream->next_in = Z_NULL;
+		_stream->avail_in = 0;
+		// 16 makes zlib expect a gzip header and trailer
+		if (inflateInit2(_stream, 16 + MAX_WBITS) != Z_OK) {
+			setErrorString("Cannot initialize zlib");
+			delete _stream;
+			_stream = 0;
+			return false;
+		}
+		_inBuffer.resize(GZIP_INPUT_CHUNK);
+	}
+	// Text mode is not supported by the wrapped data
+	return QIODevice::open(mode & ~Text);
+}
+
+void GzipDevice::close()
+{
+	if (!isOpen()) return;
+	if (_stream) {
+		inflateEnd(_stream);
+		delete _stream;
+		_stream = 0;
+	}
+	_inBuffer.clear();
+	QIODevice::close();
+}
+
+qint64 GzipDevice::bytesAvailable() const
+{
+	if (!_compressed) return QIODevice::bytesAvailable() + _device->bytesAvailable();
+	// How much will come out of the stream is unknown until it is
+	// decompressed
+	return QIODevice::bytesAvailable() + (_streamEnd ? 0 : 1);
+}
+
+qint64 GzipDevice::readData(char *data, qint64 maxSize)
+{
+	if (!_compressed) return _device->read(data, maxSize);
+
+	_stream->next_out = (Bytef *)data;
+	_stream->avail_out = (uInt)qMin(maxSize, (qint64)0x7fffffff);
+	while (!_streamEnd && _stream->avail_out > 0) {
+		if (_stream->avail_in == 0) {
+			qint64 size = _device->read(_inBuffer.data(), _inBuffer.size());
+			if (size < 0) {
+				setErrorString(_device->errorString());
+				return -1;
+			}
+			if (size == 0) {
+				setErrorString("Truncated gzip data");
+				return -1;
+			}
+			_stream->next_in = (Bytef *)_inBuffer.data();
+			_stream->avail_in = (uInt)size;
+		}
+		int res = inflate(_stream, Z_NO_FLUSH);
+		if (res == Z_STREAM_END) {
+			// Files may be made of several gzip members
+			if (_stream->avail_in > 0 || !_device->atEnd()) inflateReset(_stream);
+			else _streamEnd = true;
+		}
+		else if (res != Z_OK) {
+			setErrorString(QString("zlib error: %1").arg(_stream->msg ? _stream->msg : "unknown"));
+			return -1;
+		}
+		// Return what is there rather than waiting for more input
+		if ((char *)_stream->next_out != data && _stream->avail_in == 0) break;
+	}
+	return (char *)_stream->next_out - data;
+}
+
+qint64 GzipDevice::writeData(const char *, qint64)
+{
+	return -1;
+}
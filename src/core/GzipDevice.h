@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_GZIPDEVICE_H
+#define __CORE_GZIPDEVICE_H
+
+#include <QIODevice>
+#include <QByteArray>
+
+struct z_stream_s;
+
+/**
+ * Read-only device that decompresses gzip data from another device as it
+ * is read, so the dictionary builders can parse the compressed upstream
+ * files directly. Data that does not start with the gzip magic number is
+ * passed through unchanged.
+ *
+ * The device is sequential and does not take ownership of the wrapped
+ * device.
+ */
+class GzipDevice : public QIODevice
+{
+private:
+	QIODevice *_device;
+	z_stream_s *_stream;
+	QByteArray _inBuffer;
+	bool _compressed;
+	bool _streamEnd;
+
+	GzipDevice(const GzipDevice &);
+	GzipDevice &operator=(const GzipDevice &);
+
+protected:
+	virtual qint64 readData(char *data, qint64 maxSize);
+	virtual qint64 writeData(const char *data, qint64 maxSize);
+
+public:
+	GzipDevice(QIODevice *device, QObject *parent = 0);
+	virtual ~GzipDevice();
+
+	/// Opens the wrapped device if needed. Only ReadOnly is supported.
+	virtual bool open(OpenMode mode);
+	virtual void close();
+	virtual bool isSequential() const { return true; }
+	virtual qint64 bytesAvailable() const;
+
+	bool isCompressed() const { return _compressed; }
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_ITEMSQUEUE_H
+#define __CORE_ITEMSQUEUE_H
+
+#include <QList>
+#include <QQueue>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+/**
+ * Bounded queue of parsed items between the parser of a database builder
+ * and one of its database writers. Batches are implicitly shared, so
+ * pushing the same batch to every writer does not copy it.
+ */
+template <class T> class ItemsQueue
+{
+private:
+	QMutex _mutex;
+	QWaitCondition _notEmpty;
+	QWaitCondition _notFull;
+	QQueue<QList<T> > _batches;
+	int _maxBatches;
+	bool _closed;
+	bool _discarded;
+
+public:
+	/// maxBatches is the number of batches that can wait for the writer
+	/// before the parser blocks
+	ItemsQueue(int maxBatches) : _maxBatches(maxBatches), _closed(false), _discarded(false) {}
+	/// Blocks while the queue is full
+	void push(const QList<T> &batch);
+	/// Returns false once the queue is closed and empty, or discarded
+	bool pop(QList<T> &batch);
+	/// No more batches will be pushed
+	void close();
+	/**
+	 * Called by a writer that stops popping, e.g. after an error: the
+	 * batches queued or pushed afterwards are dropped, so the parser
+	 * never blocks.
+	 */
+	void discard();
+};
+
+template <class T> void ItemsQueue<T>::push(const QList<T> &batch)
+{
+	QMutexLocker lock(&_mutex);
+	while (!_discarded && _batches.size() >= _maxBatches) _notFull.wait(&_mutex);
+	if (_discarded) return;
+	_batches.enqueue(batch);
+	_notEmpty.wakeOne();
+}
+
+template <class T> bool ItemsQueue<T>::pop(QList<T> &batch)
+{
+	QMutexLocker lock(&_mutex);
+	while (_batches.isEmpty() && !_closed && !_discarded) _notEmpty.wait(&_mutex);
+	if (_batches.isEmpty() || _discarded) return false;
+	batch = _batches.dequeue();
+	_notFull.wakeOne();
+	return true;
+}
+
+template <class T> void ItemsQueue<T>::close()
+{
+	QMutexLocker lock(&_mutex);
+	_closed = true;
+	_notEmpty.wakeAll();
+}
+
+template <class T> void ItemsQueue<T>::discard()
+{
+	QMutexLocker lock(&_mutex);
+	_discarded = true;
+	_batches.clear();
+	_notFull.wakeAll();
+}
+
+#endif
@@ -36,7 +36,34 @@ const QStringList &Lang::supportedGUILanguages()
 	return _guiLangs;
 }
 
+LangSnapshot::LangSnapshot() : QObject()
+{
+	// Direct connections, as this object may be created on any thread
+	connect(&Lang::preferredDictLanguage, SIGNAL(valueChanged(QVariant)), this, SLOT(update()), Qt::DirectConnection);
+	connect(&Lang::preferredGUILanguage, SIGNAL(valueChanged(QVariant)), this, SLOT(update()), Qt::DirectConnection);
+	update();
+}
+
+void LangSnapshot::update()
+{
+	QStringList langs(Lang::computePreferredDictLanguages());
+	QWriteLocker locker(&_lock);
+	_preferredDictLanguages = langs;
+}
+
+QStringList LangSnapshot::preferredDictLanguages() const
+{
+	QReadLocker locker(&_lock);
+	return _preferredDictLanguages;
+}
+
 QStringList Lang::preferredDictLanguages()
+{
+	static LangSnapshot snapshot;
+	return snapshot.preferredDictLanguages();
+}
+
+QStringList Lang::computePreferredDictLanguages()
 {
 	QStringList ret;
 	QString userLang;
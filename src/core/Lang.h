@@ -19,10 +19,35 @@
 #define __CORE_LANG_H
 
 #include <QStringList>
+#include <QReadWriteLock>
 #include "core/Preferences.h"
 
+/**
+ * Keeps the preferred dictionary languages computed from the preferences,
+ * so that loaders can read them in their loops. Only recomputed when one
+ * of the preferences it depends on changes.
+ */
+class LangSnapshot : public QObject
+{
+	Q_OBJECT
+private:
+	mutable QReadWriteLock _lock;
+	QStringList _preferredDictLanguages;
+
+private slots:
+	void update();
+
+public:
+	LangSnapshot();
+	QStringList preferredDictLanguages() const;
+};
+
 class Lang
 {
+private:
+	static QStringList computePreferredDictLanguages();
+	friend class LangSnapshot;
+
 public:
 	static PreferenceItem<QString> preferredDictLanguage;
 	static PreferenceItem<QString> preferredGUILanguage;
@@ -34,6 +59,10 @@ public:
 	*/
 	static const QStringList &supportedDictLanguages();
 	static const QStringList &supportedGUILanguages();
+	/**
+	 * Returns the dictionary languages to display, in order of preference.
+	 * Safe to call from any thread.
+	 */
 	static QStringList preferredDictLanguages();
 };
 
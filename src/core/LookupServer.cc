@@ -0,0 +1,337 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/LookupServer.h"
+#include "core/Database.h"
+#include "core/EntrySummary.h"
+#include "core/EntrySearcherManager.h"
+#include "core/QueryBuilder.h"
+#include "core/kanjidic2/Kanjidic2Entry.h"
+#include "sqlite/Query.h"
+
+#include <QRunnable>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QtDebug>
+
+#include <algorithm>
+
+class LookupServerJob : public QRunnable
+{
+public:
+	typedef enum { Search, Entries, Kanji } Kind;
+
+private:
+	LookupServer *_server;
+	int _request;
+	Kind _kind;
+	QString _search;
+	/// Statement of a search, empty if the search is not valid
+	QString _sql;
+	QList<EntryRef> _refs;
+
+	QJsonArray loadEntries(const QList<EntryRef> &refs) const;
+
+public:
+	LookupServerJob(LookupServer *server, int request, Kind kind, const QString &search, const QString &sql, const QList<EntryRef> &refs) : _server(server), _request(request), _kind(kind), _search(search), _sql(sql), _refs(refs) {}
+
+	void run();
+};
+
+QJsonArray LookupServerJob::loadEntries(const QList<EntryRef> &refs) const
+{
+	QJsonArray ret;
+	foreach (const EntryPointer &entry, EntriesCache::getMany(refs)) {
+		if (!entry) continue;
+		if (_kind == Kanji && entry->type() == KANJIDIC2ENTRY_GLOBALID)
+			ret << LookupServer::kanjiJson(*static_cast<const Kanjidic2Entry *>(entry.data()));
+		else ret << LookupServer::entryJson(*entry);
+	}
+	return ret;
+}
+
+void LookupServerJob::run()
+{
+	QJsonObject res;
+	if (_kind == Search) {
+		QList<EntryRef> refs;
+		if (!_sql.isEmpty()) {
+			SQLite::Query query(Database::threadConnection());
+			if (!query.exec(_sql)) qWarning("Search \"%s\" failed: %s", _search.toUtf8().constData(), query.lastError().message().toUtf8().constData());
+			while (query.next()) refs << EntryRef(query.valueUInt(0), query.valueUInt(1));
+		}
+		QJsonArray results;
+		foreach (const EntrySummary &summary, EntriesCache::getSummaries(refs))
+			results << LookupServer::summaryJson(summary);
+		res["search"] = _search;
+		res["results"] = results;
+	} else res["entries"] = loadEntries(_refs);
+
+	QByteArray body(QJsonDocument(res).toJson(QJsonDocument::Compact));
+	// The server waits for the jobs before being destroyed
+	QMetaObject::invokeMethod(_server, "reply", Qt::QueuedConnection, Q_ARG(int, _request), Q_ARG(int, 200), Q_ARG(QByteArray, body));
+}
+
+LookupServer::LookupServer(QThreadPool *pool, int limit, QObject *parent) : QTcpServer(parent), _pool(pool), _limit(limit), _nextRequest(0)
+{
+	connect(this, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+}
+
+LookupServer::~LookupServer()
+{
+	_pool->waitForDone();
+}
+
+void LookupServer::onNewConnection()
+{
+	while (hasPendingConnections()) {
+		QTcpSocket *socket = nextPendingConnection();
+		connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+		connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+		_buffers[socket] = QByteArray();
+	}
+}
+
+void LookupServer::onReadyRead()
+{
+	QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+	if (!socket || !_buffers.contains(socket)) return;
+	QByteArray &buffer = _buffers[socket];
+	buffer += socket->readAll();
+	int end = buffer.indexOf("\r\n\r\n");
+	if (end == -1) {
+		if (buffer.size() > maxRequestSize) {
+			_buffers.remove(socket);
+			respond(socket, 413, "{\"error\":\"request too large\"}");
+		}
+		return;
+	}
+	int lineEnd = buffer.indexOf("\r\n");
+	QByteArray requestLine(buffer.left(lineEnd));
+	QByteArray headers(buffer.mid(lineEnd + 2, end - lineEnd - 2));
+	// Only one request per connection, further data is ignored
+	_buffers.remove(socket);
+	if (!isLocalHost(headers)) {
+		respond(socket, 403, "{\"error\":\"invalid host\"}");
+		return;
+	}
+	handle(socket, requestLine);
+}
+
+bool LookupServer::isLocalHost(const QByteArray &headers) const
+{
+	const QByteArray port(QByteArray::number(serverPort()));
+	int hosts = 0;
+	bool ret = false;
+	foreach (const QByteArray &line, headers.split('\n')) {
+		int colon = line.indexOf(':');
+		if (colon == -1 || line.left(colon).trimmed().toLower() != "host") continue;
+		const QByteArray host(line.mid(colon + 1).trimmed().toLower());
+		ret = host == "localhost:" + port || host == "127.0.0.1:" + port;
+		++hosts;
+	}
+	// Several Host headers are ambiguous and rejected as well
+	return hosts == 1 && ret;
+}
+
+void LookupServer::onDisconnected()
+{
+	QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+	if (!socket) return;
+	_buffers.remove(socket);
+	// Responses of pending requests will be dropped
+	for (QHash<int, Request>::iterator it = _requests.begin(); it != _requests.end(); ++it) {
+		if (it.value().socket == socket) it.value().socket = 0;
+	}
+	socket->deleteLater();
+}
+
+void LookupServer::handle(QTcpSocket *socket, const QByteArray &requestLine)
+{
+	QList<QByteArray> parts(requestLine.split(' '));
+	if (parts.size() != 3 || parts[0] != "GET") {
+		respond(socket, 405, "{\"error\":\"only GET requests are supported\"}");
+		return;
+	}
+	QUrl url(QString::fromLatin1(parts[1]));
+	QUrlQuery params(url);
+	QString endpoint(url.path());
+
+	Request request;
+	request.socket = socket;
+	request.endpoint = endpoint;
+	request.timer.start();
+
+	LookupServerJob::Kind kind;
+	QString search;
+	QString sql;
+	QList<EntryRef> refs;
+	if (endpoint == "/stats") {
+		respond(socket, 200, QJsonDocument(stats()).toJson(QJsonDocument::Compact));
+		return;
+	} else if (endpoint == "/search") {
+		kind = LookupServerJob::Search;
+		search = params.queryItemValue("q", QUrl::FullyDecoded);
+		bool ok;
+		int limit = params.queryItemValue("limit").toInt(&ok);
+		if (!ok || limit < 0) limit = _limit;
+		// Queries must be built from the thread of the searchers
+		QueryBuilder query;
+		if (EntrySearcherManager::instance().buildQuery(search, query)) {
+			if (limit) query.setLimit(QueryBuilder::Limit(limit));
+			sql = query.buildSqlStatement();
+		}
+	} else if (endpoint == "/entries") {
+		kind = LookupServerJob::Entries;
+		foreach (const QString &ref, params.queryItemValue("refs").split(',', QString::SkipEmptyParts)) {
+			QStringList fields(ref.split(':'));
+			bool okType, okId;
+			uint type = fields.size() == 2 ? fields[0].toUInt(&okType) : 0;
+			uint id = fields.size() == 2 ? fields[1].toUInt(&okId) : 0;
+			if (fields.size() != 2 || !okType || !okId) {
+				respond(socket, 400, "{\"error\":\"references must be given as type:id\"}");
+				return;
+			}
+			refs << EntryRef(type, id);
+		}
+	} else if (endpoint == "/kanji") {
+		kind = LookupServerJob::Kanji;
+		QString kanji(params.queryItemValue("k", QUrl::FullyDecoded));
+		for (int i = 0; i < kanji.size(); i++) {
+			if (kanji[i].isHighSurrogate() && i + 1 < kanji.size()) {
+				refs << KanjiEntryRef(kanji.mid(i, 2));
+				i++;
+			} else refs << KanjiEntryRef(kanji.mid(i, 1));
+		}
+	} else {
+		respond(socket, 404, "{\"error\":\"unknown endpoint\"}");
+		return;
+	}
+
+	int id = _nextRequest++;
+	_requests[id] = request;
+	_pool->start(new LookupServerJob(this, id, kind, search, sql, refs));
+}
+
+void LookupServer::reply(int request, int status, const QByteArray &body)
+{
+	if (!_requests.contains(request)) return;
+	Request req(_requests.take(request));
+	if (req.socket) respond(req.socket, status, body);
+	recordLatency(req.endpoint, req.timer.nsecsElapsed() / 1000);
+}
+
+void LookupServer::respond(QTcpSocket *socket, int status, const QByteArray &body)
+{
+	const char *reason;
+	switch (status) {
+	case 200: reason = "OK"; break;
+	case 400: reason = "Bad Request"; break;
+	case 403: reason = "Forbidden"; break;
+	case 404: reason = "Not Found"; break;
+	case 405: reason = "Method Not Allowed"; break;
+	case 413: reason = "Payload Too Large"; break;
+	default: reason = "Error"; break;
+	}
+	QByteArray header(QString("HTTP/1.1 %1 %2\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: %3\r\nConnection: close\r\n\r\n").arg(status).arg(reason).arg(body.size()).toLatin1());
+	socket->write(header);
+	socket->write(body);
+	socket->disconnectFromHost();
+}
+
+void LookupServer::recordLatency(const QString &endpoint, qint64 usecs)
+{
+	QVector<qint64> &samples = _latencies[endpoint];
+	quint64 &served = _served[endpoint];
+	if (samples.size() < latencySamples) samples << usecs;
+	else samples[served % latencySamples] = usecs;
+	++served;
+}
+
+QJsonObject LookupServer::stats() const
+{
+	QJsonObject ret;
+	QJsonObject endpoints;
+	for (QMap<QString, QVector<qint64> >::const_iterator it = _latencies.constBegin(); it != _latencies.constEnd(); ++it) {
+		QVector<qint64> samples(it.value());
+		std::sort(samples.begin(), samples.end());
+		QJsonObject endpoint;
+		endpoint["requests"] = (double)_served[it.key()];
+		endpoint["p50_ms"] = samples[samples.size() / 2] / 1000.0;
+		endpoint["p99_ms"] = samples[samples.size() * 99 / 100] / 1000.0;
+		endpoints[it.key()] = endpoint;
+	}
+	ret["endpoints"] = endpoints;
+
+	EntriesCache::Statistics cache(EntriesCache::statistics());
+	QJsonObject cacheStats;
+	cacheStats["hits"] = (double)cache.hits;
+	cacheStats["misses"] = (double)cache.misses;
+	cacheStats["evictions"] = (double)cache.evictions;
+	cacheStats["entries"] = cache.entries;
+	cacheStats["bytes"] = (double)cache.bytes;
+	ret["cache"] = cacheStats;
+	ret["pending"] = _requests.size();
+	return ret;
+}
+
+QJsonObject LookupServer::summaryJson(const EntrySummary &summary)
+{
+	QJsonObject ret;
+	ret["type"] = (int)summary.ref().type();
+	ret["id"] = (int)summary.ref().id();
+	ret["writings"] = QJsonArray::fromStringList(summary.writings());
+	ret["readings"] = QJsonArray::fromStringList(summary.readings());
+	ret["meanings"] = QJsonArray::fromStringList(summary.meanings());
+	return ret;
+}
+
+QJsonObject LookupServer::entryJson(const Entry &entry)
+{
+	QJsonObject ret;
+	ret["type"] = (int)entry.type();
+	ret["id"] = (int)entry.id();
+	ret["writings"] = QJsonArray::fromStringList(entry.writings());
+	ret["readings"] = QJsonArray::fromStringList(entry.readings());
+	ret["meanings"] = QJsonArray::fromStringList(entry.meanings());
+	ret["frequency"] = entry.frequency();
+	ret["trained"] = entry.trained();
+	ret["score"] = entry.score();
+	return ret;
+}
+
+QJsonObject LookupServer::kanjiJson(const Kanjidic2Entry &entry)
+{
+	QJsonObject ret(entryJson(entry));
+	ret["kanji"] = entry.kanji();
+	ret["grade"] = entry.grade();
+	ret["strokeCount"] = entry.strokeCount();
+	ret["jlpt"] = entry.jlpt();
+	ret["heisig"] = entry.heisig();
+	ret["skip"] = entry.skipCode();
+	ret["fourCorner"] = entry.fourCorner();
+	ret["onyomi"] = QJsonArray::fromStringList(entry.onyomiReadings());
+	ret["kunyomi"] = QJsonArray::fromStringList(entry.kunyomiReadings());
+	ret["nanori"] = QJsonArray::fromStringList(entry.nanoris());
+	QStringList components;
+	foreach (const KanjiComponent *component, entry.rootComponents())
+		components << component->element();
+	ret["components"] = QJsonArray::fromStringList(components);
+	return ret;
+}
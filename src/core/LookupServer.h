@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_LOOKUP_SERVER_H
+#define __CORE_LOOKUP_SERVER_H
+
+#include "core/EntriesCache.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+
+class EntrySummary;
+class Kanjidic2Entry;
+
+/**
+ * Serves dictionary lookups as JSON over HTTP, for local tools that
+ * cannot link against the core library. Endpoints are:
+ *
+ * - /search?q=<search>[&limit=<n>]: runs a search like the search bar
+ *   does and returns the summaries of its results,
+ * - /entries?refs=<type>:<id>,...: returns the given entries,
+ * - /kanji?k=<kanji>: returns the details of the given kanji,
+ * - /stats: returns the request latencies and the entries cache usage.
+ *
+ * Requests are parsed and queries built from the thread of the server,
+ * then run and their entries loaded on the pool, so several clients can
+ * be served concurrently. Every connection serves a single request.
+ *
+ * Only requests which Host header is localhost:<port> or 127.0.0.1:<port>
+ * are served, so that web pages cannot reach the server by making their
+ * own host name resolve to the local address (DNS rebinding).
+ */
+class LookupServer : public QTcpServer
+{
+	Q_OBJECT
+private:
+	struct Request
+	{
+		QTcpSocket *socket;
+		QString endpoint;
+		QElapsedTimer timer;
+	};
+
+	QThreadPool *_pool;
+	int _limit;
+	int _nextRequest;
+	QHash<int, Request> _requests;
+	/// Data received from sockets whose request is not complete yet
+	QHash<QTcpSocket *, QByteArray> _buffers;
+	/// Latest latencies, in microseconds, by endpoint
+	QMap<QString, QVector<qint64> > _latencies;
+	/// Number of requests served, by endpoint
+	QMap<QString, quint64> _served;
+
+	/// True if headers have a Host header naming the server itself
+	bool isLocalHost(const QByteArray &headers) const;
+	void handle(QTcpSocket *socket, const QByteArray &requestLine);
+	void respond(QTcpSocket *socket, int status, const QByteArray &body);
+	void recordLatency(const QString &endpoint, qint64 usecs);
+	QJsonObject stats() const;
+
+private slots:
+	void onNewConnection();
+	void onReadyRead();
+	void onDisconnected();
+	/// Invoked by the jobs once their response is ready
+	void reply(int request, int status, const QByteArray &body);
+
+public:
+	/// Latencies kept by endpoint to compute the percentiles of /stats
+	static const int latencySamples = 4096;
+	/// Requests bigger than this are rejected
+	static const int maxRequestSize = 8192;
+
+	/// limit is the default maximum number of results of searches
+	LookupServer(QThreadPool *pool, int limit, QObject *parent = 0);
+	virtual ~LookupServer();
+
+	static QJsonObject summaryJson(const EntrySummary &summary);
+	static QJsonObject entryJson(const Entry &entry);
+	static QJsonObject kanjiJson(const Kanjidic2Entry &entry);
+
+	friend class LookupServerJob;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/MemoryUsage.h"
+#include "core/EntriesCache.h"
+#include "core/EntryListCache.h"
+#include "core/Database.h"
+
+#include <QtDebug>
+#include <QTextStream>
+
+PreferenceItem<int> MemoryUsage::softLimit("", "memorySoftLimit", 0);
+
+static qint64 entriesCacheBytes()
+{
+	return EntriesCache::statistics().bytes;
+}
+
+static qint64 listNodes()
+{
+	return EntryListCache::memoryStatistics().loadedNodes;
+}
+
+static qint64 listOwners()
+{
+	return EntryListCache::memoryStatistics().cachedOwners;
+}
+
+static qint64 sqliteTotal()
+{
+	return SQLite::Connection::totalMemoryUsed();
+}
+
+static qint64 mainConnection()
+{
+	return Database::connection()->memoryUsed();
+}
+
+static qint64 listsConnection()
+{
+	return EntryListCache::connection()->memoryUsed();
+}
+
+static void trimConnections()
+{
+	Database::connection()->releaseMemory();
+	EntryListCache::connection()->releaseMemory();
+}
+
+qint64 MemoryUsage::Snapshot::totalBytes() const
+{
+	qint64 ret = 0;
+	foreach (const Sample &sample, samples) if (sample.unit == Bytes && sample.value > 0) ret += sample.value;
+	return ret;
+}
+
+QString MemoryUsage::Snapshot::toString() const
+{
+	QString ret;
+	QTextStream out(&ret);
+	out << "Memory usage at " << time.toString(Qt::ISODate) << ":\n";
+	foreach (const Sample &sample, samples) {
+		out << "  " << sample.name << ": ";
+		if (sample.unit != Items) out << sample.value / 1024 << " KiB\n";
+		else out << sample.value << "\n";
+	}
+	out << "  Total: " << totalBytes() / 1024 << " KiB";
+	if (softLimit.value() > 0) out << " (soft limit " << softLimit.value() << " MiB)";
+	out << "\n";
+	return ret;
+}
+
+MemoryUsage::MemoryUsage() : _trims(0)
+{
+	// Sources of the core. SQLite's total includes the connections below
+	Source sources[] = {
+		{ "Entries cache", Bytes, &entriesCacheBytes, &EntriesCache::trim },
+		{ "Loaded list nodes", Items, &listNodes, &EntryListCache::trim },
+		{ "Cached list owners", Items, &listOwners, 0 },
+		{ "SQLite", Bytes, &sqliteTotal, &trimConnections },
+		{ "SQLite main connection", IncludedBytes, &mainConnection, 0 },
+		{ "SQLite lists connection", IncludedBytes, &listsConnection, 0 },
+	};
+	for (unsigned int i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) _sources << sources[i];
+	connect(&_timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+}
+
+MemoryUsage &MemoryUsage::instance()
+{
+	static MemoryUsage usage;
+	return usage;
+}
+
+void MemoryUsage::addSource(const QString &name, Unit unit, Reporter reporter, Trimmer trimmer)
+{
+	Source source = { name, unit, reporter, trimmer };
+	instance()._sources << source;
+}
+
+void MemoryUsage::startMonitoring(int interval)
+{
+	MemoryUsage &usage(instance());
+	usage._lastSnapshot = snapshot();
+	usage._timer.start(interval);
+}
+
+MemoryUsage::Snapshot MemoryUsage::snapshot()
+{
+	Snapshot ret;
+	ret.time = QDateTime::currentDateTime();
+	foreach (const Source &source, instance()._sources) {
+		Sample sample = { source.name, source.unit, source.reporter() };
+		ret.samples << sample;
+	}
+	return ret;
+}
+
+void MemoryUsage::trim()
+{
+	foreach (const Source &source, instance()._sources) if (source.trimmer) source.trimmer();
+}
+
+void MemoryUsage::onTimeout()
+{
+	_lastSnapshot = snapshot();
+	qint64 limit = softLimit.value() * Q_INT64_C(1024) * 1024;
+	if (limit <= 0 || _lastSnapshot.totalBytes() <= limit) return;
+
+	qDebug("Memory usage of %lld KiB above the soft limit, trimming caches", _lastSnapshot.totalBytes() / 1024);
+	trim();
+	++_trims;
+	_lastSnapshot = snapshot();
+}
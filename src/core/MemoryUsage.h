@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_MEMORY_USAGE_H
+#define __CORE_MEMORY_USAGE_H
+
+#include "core/Preferences.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QDateTime>
+#include <QTimer>
+
+/**
+ * Accounts for the memory used by the caches of the program, so growth
+ * over long sessions can be attributed to a subsystem.
+ *
+ * Each subsystem registers a source, which reports either the bytes it
+ * uses or a number of items when its size cannot be measured, and may
+ * provide a function releasing its memory. Sources are sampled
+ * periodically once monitoring started; when the bytes they report exceed
+ * the soft limit, all the sources are asked to trim.
+ *
+ * Sources are sampled and trimmed in the thread monitoring was started
+ * from, which must be the GUI thread if GUI sources are registered.
+ */
+class MemoryUsage : public QObject
+{
+	Q_OBJECT
+public:
+	/// IncludedBytes are part of what another source reports, so they are not added to the total
+	typedef enum { Bytes, IncludedBytes, Items } Unit;
+	/// Returns the current usage of a source
+	typedef qint64 (*Reporter)();
+	/// Releases as much of the memory of a source as it can
+	typedef void (*Trimmer)();
+
+	struct Sample {
+		QString name;
+		Unit unit;
+		qint64 value;
+	};
+	struct Snapshot {
+		QDateTime time;
+		QList<Sample> samples;
+		/// Sum of the samples counted in bytes
+		qint64 totalBytes() const;
+		QString toString() const;
+	};
+
+private:
+	struct Source {
+		QString name;
+		Unit unit;
+		Reporter reporter;
+		Trimmer trimmer;
+	};
+	QList<Source> _sources;
+	QTimer _timer;
+	Snapshot _lastSnapshot;
+	int _trims;
+
+	static MemoryUsage &instance();
+	MemoryUsage();
+
+private slots:
+	void onTimeout();
+
+public:
+	/// Soft limit of the bytes used by all the sources, in MiB. 0 disables it.
+	static PreferenceItem<int> softLimit;
+
+	/**
+	 * Registers a source of memory usage. trimmer may be 0 if the source
+	 * cannot release its memory.
+	 */
+	static void addSource(const QString &name, Unit unit, Reporter reporter, Trimmer trimmer = 0);
+	/// Samples and checks the sources every interval milliseconds
+	static void startMonitoring(int interval = 30000);
+
+	/// Samples all the sources now
+	static Snapshot snapshot();
+	/// Latest snapshot taken by the monitoring
+	static Snapshot lastSnapshot() { return instance()._lastSnapshot; }
+	/// Asks all the sources to release their memory
+	static void trim();
+	/// Number of times the sources were trimmed because of the soft limit
+	static int trims() { return instance()._trims; }
+};
+
+#endif
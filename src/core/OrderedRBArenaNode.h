@@ -0,0 +1,182 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_ORDEREDRBARENANODE_H
+#define __CORE_ORDEREDRBARENANODE_H
+
+#include "core/OrderedRBNode.h"
+
+#include <QVector>
+
+#include <new>
+
+template <class T> class OrderedRBArenaTree;
+
+/**
+ * A compact node type for in-memory trees. Nodes are stored in the node
+ * chunks of their tree and refer to each other through their 32-bit index
+ * in them, and the color is packed into the highest bit of the left size.
+ * Nodes cannot be moved to another tree.
+ */
+template <class T> class OrderedRBArenaNode
+{
+public:
+	typedef enum { BLACK, RED } Color;
+	typedef T ValueType;
+
+private:
+	static const quint32 RED_BIT = 0x80000000;
+
+	OrderedRBArenaTree<T> *_tree;
+	quint32 _index;
+	quint32 _left, _right, _parent;
+	quint32 _leftSizeColor;
+	T _value;
+
+public:
+	OrderedRBArenaNode(OrderedRBArenaTree<T> *tree, quint32 index, const T &va) : _tree(tree), _index(index), _left(0), _right(0), _parent(0), _leftSizeColor(RED_BIT), _value(va)
+	{
+	}
+
+	Color color() const { return _leftSizeColor & RED_BIT ? RED : BLACK; }
+	void setColor(Color col)
+	{
+		if (col == RED) _leftSizeColor |= RED_BIT;
+		else _leftSizeColor &= ~RED_BIT;
+	}
+	quint32 leftSize() const { return _leftSizeColor & ~RED_BIT; }
+	void setLeftSize(quint32 lSize) { _leftSizeColor = (_leftSizeColor & RED_BIT) | lSize; }
+
+	const T &value() const { return _value; }
+	void setValue(const T &nv)
+	{
+		_value = nv;
+	}
+
+	OrderedRBArenaNode<T> *left() const
+	{
+		return _tree->node(_left);
+	}
+	OrderedRBArenaNode<T> *right() const
+	{
+		return _tree->node(_right);
+	}
+	OrderedRBArenaNode<T> *parent() const
+	{
+		return _tree->node(_parent);
+	}
+	void setLeft(OrderedRBArenaNode<T> *nl)
+	{
+		_left = nl ? nl->_index : 0;
+		if (nl) nl->setParent(this);
+	}
+	void setRight(OrderedRBArenaNode<T> *nr)
+	{
+		_right = nr ? nr->_index : 0;
+		if (nr) nr->setParent(this);
+	}
+	void setParent(OrderedRBArenaNode<T> *np)
+	{
+		_parent = np ? np->_index : 0;
+	}
+	bool canAttachToTree(const OrderedRBArenaTree<T> *tree) const { return tree == _tree; }
+	void attachToTree(OrderedRBArenaTree<T> *tree)
+	{
+		Q_UNUSED(tree);
+		Q_ASSERT(tree == _tree);
+	}
+
+friend class OrderedRBArenaTree<T>;
+};
+
+/**
+ * In-memory tree base whose nodes are allocated by chunks of contiguous
+ * nodes instead of one by one. Chunks are never moved, so nodes can still
+ * be handled through pointers, and they are all freed at once when the tree
+ * is destroyed. Indices of removed nodes are reused by the next ones.
+ */
+template <class T> class OrderedRBArenaTree
+{
+public:
+	typedef OrderedRBArenaNode<T> Node;
+
+private:
+	static const int CHUNK_BITS = 10;
+	static const quint32 CHUNK_MASK = (1 << CHUNK_BITS) - 1;
+
+	QVector<Node *> _chunks;
+	/// Number of indices handed out so far, index 0 stands for no node
+	quint32 _allocated;
+	QVector<quint32> _freeIndices;
+	quint32 _root;
+
+	OrderedRBArenaTree(const OrderedRBArenaTree &);
+	OrderedRBArenaTree &operator =(const OrderedRBArenaTree &);
+
+public:
+	OrderedRBArenaTree() : _allocated(1), _root(0)
+	{
+	}
+
+	/// Remove all the in-memory structures, without side-effect on the storage
+	~OrderedRBArenaTree()
+	{
+		if (QTypeInfo<T>::isComplex) {
+			QVector<bool> freed(_allocated, false);
+			foreach (quint32 index, _freeIndices) freed[index] = true;
+			for (quint32 i = 1; i < _allocated; i++) if (!freed[i]) node(i)->~Node();
+		}
+		foreach (Node *chunk, _chunks) ::operator delete(chunk);
+	}
+
+	Node *node(quint32 index) const
+	{
+		if (!index) return 0;
+		return _chunks[index >> CHUNK_BITS] + (index & CHUNK_MASK);
+	}
+
+	Node *root() const { return node(_root); }
+	void setRoot(Node *node) { _root = node ? node->_index : 0; }
+
+	Node *createNode(const T &val)
+	{
+		quint32 index;
+		if (!_freeIndices.isEmpty()) {
+			index = _freeIndices.last();
+			_freeIndices.removeLast();
+		}
+		else {
+			index = _allocated++;
+			if ((index >> CHUNK_BITS) >= (quint32)_chunks.size())
+				_chunks << static_cast<Node *>(::operator new(sizeof(Node) << CHUNK_BITS));
+		}
+		return new (node(index)) Node(this, index, val);
+	}
+	bool aboutToChange() { return true; }
+	bool commitChanges() { return true; }
+	void lookupStarted() const {}
+	quint32 evictions() const { return 0; }
+	void removeNode(Node *node)
+	{
+		quint32 index = node->_index;
+		node->~Node();
+		_freeIndices << index;
+	}
+	void abortChanges() {}
+};
+
+#endif
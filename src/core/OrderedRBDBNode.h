@@ -20,6 +20,7 @@
 #include "core/OrderedRBNode.h"
 
 #include <QSet>
+#include <QHash>
 
 template <class T> class OrderedRBDBTree;
 
@@ -36,11 +37,14 @@ private:
 	mutable OrderedRBDBNode<T> * _left;
 	mutable OrderedRBDBNode<T> * _right;
 	mutable OrderedRBDBNode<T> * _parent;
+	/// Lookup during which this node was last reached, see OrderedRBDBTree::lookupStarted()
+	mutable quint32 _lastUse;
 	DBListEntry<T> e;
 
 public:
-	OrderedRBDBNode(OrderedRBDBTree<T> *tree, const T &va) : OrderedRBNodeBase<T>(), _tree(tree), _left(0), _right(0), _parent(0), e()
+	OrderedRBDBNode(OrderedRBDBTree<T> *tree, const T &va) : OrderedRBNodeBase<T>(), _tree(tree), _left(0), _right(0), _parent(0), _lastUse(tree->_clock), e()
 	{
+		++_tree->_cachedNodes;
 		// Here a new node is to be inserted in the tree - we need to insert it right now into
 		// the DB in order to get its ID.
 		setValue(va);
@@ -49,10 +53,11 @@ public:
 		updateDB();
 	}
 
-	OrderedRBDBNode(OrderedRBDBTree<T> *tree, quint32 rowid) : OrderedRBNodeBase<T>(), _tree(tree), _left(0), _right(0), _parent(0), e()
+	OrderedRBDBNode(OrderedRBDBTree<T> *tree, quint32 rowid) : OrderedRBNodeBase<T>(), _tree(tree), _left(0), _right(0), _parent(0), _lastUse(tree->_clock), e()
 	{
+		++_tree->_cachedNodes;
 		// The new node is expected to exist in the DB with the given ID - just load it.
-		e = _tree->dbAccess()->getEntry(rowid);
+		e = _tree->fetchEntry(rowid);
 		setColor(e.red ?  OrderedRBNodeBase<T>::RED : OrderedRBNodeBase<T>::BLACK);
 		setLeftSize(e.leftSize);
 	}
@@ -61,6 +66,7 @@ public:
 	{
 		// This destructor should not remove the node from the database as it would break data persistency.
 		// In order to permanently remove nodes, removeNode() should be used instead.
+		if (_tree) --_tree->_cachedNodes;
 	}
 
 	void setColor(typename OrderedRBNodeBase<T>::Color col)
@@ -91,6 +97,8 @@ public:
 			_left = new OrderedRBDBNode<T>(_tree, e.left);
 			_left->_parent = const_cast<OrderedRBDBNode<T> *>(this);
 		}
+		else if (_left) ++_tree->_cacheHits;
+		if (_left) _left->_lastUse = _tree->_clock;
 		return _left;
 	}
 	OrderedRBDBNode<T> *right() const
@@ -100,6 +108,8 @@ public:
 			_right = new OrderedRBDBNode<T>(_tree, e.right);
 			_right->_parent = const_cast<OrderedRBDBNode<T> *>(this);
 		}
+		else if (_right) ++_tree->_cacheHits;
+		if (_right) _right->_lastUse = _tree->_clock;
 		return _right;
 	}
 	OrderedRBDBNode<T> *parent() const
@@ -127,20 +137,31 @@ public:
 		e.parent = np ? np->e.rowId : 0;
 		_tree->nodeChanged(this);
 	}
+	bool canAttachToTree(const OrderedRBDBTree<T> *) const { return true; }
 	void attachToTree(OrderedRBDBTree<T> *tree)
 	{
 		if (_tree == tree) return;
-		if (_tree) _tree->forgetNode(this);
+		if (_tree) {
+			_tree->forgetNode(this);
+			--_tree->_cachedNodes;
+		}
 		_tree = tree;
+		++_tree->_cachedNodes;
+		_lastUse = _tree->_clock;
 		_tree->nodeChanged(this);
 	}
 	OrderedRBDBTree<T> *tree() { return _tree; }
 
 	/**
 	 * Called by OrderedRBDBTree for every node that has been marked as being changed.
+	 * Nodes that already have a row are updated in place, others are inserted
+	 * in order to obtain their ID.
 	 */
 	bool updateDB()
 	{
+		// Nodes moved from another list get their new list id here
+		e.listId = _tree->listId();
+		if (e.rowId) return _tree->dbAccess()->updateEntry(e);
 		e.rowId = _tree->dbAccess()->insertEntry(e);
 		return e.rowId != 0;
 	}
@@ -158,6 +179,24 @@ friend class OrderedRBDBTree<T>;
  * Instances of this class need to be connected to a suitable DBList instance in order to fetch and store their data.
  * They also need to be affected a list identifier, from which the root of the tree can be fetched. The documentation
  * of DBList contains details about the DB implementation.
+ *
+ * Nodes changed by an operation are only written once the operation is
+ * complete, no matter how many times rebalancing touched them. Callers
+ * performing many operations in a row (e.g. dropping a large selection into
+ * a list) should enclose them between beginBatch() and endBatch() so that
+ * dirty nodes are written only once for the whole sequence, inside a single
+ * transaction.
+ *
+ * Nodes are not loaded one query per hop: when a node that has not been
+ * fetched yet is needed, the subtree below it is fetched down to PAGE_DEPTH
+ * levels with a single query, so reaching any index of a 100k items list
+ * only takes 2 or 3 queries.
+ *
+ * The number of nodes kept in memory is bounded: once it exceeds cacheSize(),
+ * the next lookup evicts the subtrees that have not been reached during the
+ * last RECENT_LOOKUPS lookups. The root and the paths of recent lookups thus
+ * stay pinned, so nodes returned by a lookup remain valid during the next
+ * ones. Nothing is evicted while changes are pending or a batch is open.
  */
 template <class T> class OrderedRBDBTree
 {
@@ -169,12 +208,52 @@ private:
 	mutable Node *_root;
 	bool mustUpdateRootTable;
 	QSet<Node *> _changedNodes;
+	int _batchDepth;
+	bool _batchFailed;
+	/// Rows fetched as part of a page but not turned into nodes yet
+	QHash<quint32, DBListEntry<T> > _prefetched;
+	/// Incremented at each lookup, used to find cold subtrees
+	mutable quint32 _clock;
+	int _cachedNodes;
+	int _cacheSize;
+	mutable quint64 _cacheHits;
+	mutable quint64 _cacheMisses;
+	/// Number of times in-memory nodes have been released
+	quint32 _evictions;
+
+	void evictColdNodes();
+	void releaseSubtree(Node *node);
+
+friend class OrderedRBDBNode<T>;
+
+	/**
+	 * Writes all the dirty nodes and the root table if needed. Must be
+	 * called within a transaction.
+	 */
+	bool flushChanges()
+	{
+		foreach (Node *n, _changedNodes) {
+			if (!n->updateDB()) return false;
+		}
+		_changedNodes.clear();
+		if (mustUpdateRootTable) {
+			if (!_ldb->insertList(_listInfo)) return false;
+			mustUpdateRootTable = false;
+		}
+		return true;
+	}
 
 protected:
 	DBList<T> *_ldb;
 
 public:
-	OrderedRBDBTree() : _listInfo(), _root(0), mustUpdateRootTable(false), _ldb(0) 
+	/// Number of levels fetched below a node when loading it, i.e. pages
+	/// hold up to 2^(PAGE_DEPTH + 1) - 1 nodes
+	static const int PAGE_DEPTH = 7;
+	/// Number of past lookups whose nodes are never evicted
+	static const quint32 RECENT_LOOKUPS = 64;
+
+	OrderedRBDBTree() : _listInfo(), _root(0), mustUpdateRootTable(false), _batchDepth(0), _batchFailed(false), _clock(0), _cachedNodes(0), _cacheSize(4096), _cacheHits(0), _cacheMisses(0), _evictions(0), _ldb(0)
 	{
 	}
 
@@ -194,12 +273,59 @@ public:
 		mustUpdateRootTable = true;
 	}
 
+	/// Creates a node holding val, it is recorded into the DB right away
+	Node *createNode(const T &val) { return new Node(this, val); }
+
 	bool aboutToChange()
 	{
+		// Within a batch, changes accumulate until endBatch()
+		if (_batchDepth > 0) return !_batchFailed;
 		_changedNodes.clear();
 		return _ldb->connection()->transaction();
 	}
 
+	/**
+	 * Returns the DB entry for rowid, fetching the page it starts if it
+	 * has not been prefetched already.
+	 */
+	DBListEntry<T> fetchEntry(quint32 rowid)
+	{
+		if (_prefetched.contains(rowid)) ++_cacheHits;
+		else {
+			++_cacheMisses;
+			if (_prefetched.size() > _cacheSize) _prefetched.clear();
+			foreach (const DBListEntry<T> &entry, _ldb->getPage(rowid, PAGE_DEPTH))
+				_prefetched[entry.rowId] = entry;
+		}
+		// Rows that are turned into nodes are from now on only read from them
+		if (_prefetched.contains(rowid)) return _prefetched.take(rowid);
+		return _ldb->getEntry(rowid);
+	}
+
+	/**
+	 * Called by OrderedRBTree before looking a node up. Evicts cold nodes
+	 * if the cache has grown past its size.
+	 */
+	void lookupStarted() const
+	{
+		++_clock;
+		if (_cachedNodes > _cacheSize && _batchDepth == 0 && _changedNodes.isEmpty())
+			const_cast<OrderedRBDBTree<T> *>(this)->evictColdNodes();
+	}
+
+	/// Maximum number of nodes to keep in memory
+	int cacheSize() const { return _cacheSize; }
+	void setCacheSize(int size) { _cacheSize = size; }
+	/// Number of nodes currently in memory
+	int cachedNodes() const { return _cachedNodes; }
+	/// Number of node accesses satisfied without querying the database
+	quint64 cacheHits() const { return _cacheHits; }
+	/// Number of node accesses that required a database query
+	quint64 cacheMisses() const { return _cacheMisses; }
+	void resetCacheStatistics() { _cacheHits = _cacheMisses = 0; }
+	/// Changes whenever previously returned nodes may have been deleted
+	quint32 evictions() const { return _evictions; }
+
 	void nodeChanged(Node *n)
 	{
 		_changedNodes << n;
@@ -222,28 +348,63 @@ public:
 
 	bool commitChanges()
 	{
-		foreach (Node *n, _changedNodes) {
-			if (!n->updateDB()) {
-				_ldb->connection()->rollback();
-				return false;
-			}
-		}
-		_changedNodes.clear();
-		if (!_ldb->connection()->commit()) {
+		if (_batchDepth > 0) return true;
+		if (!flushChanges() || !_ldb->connection()->commit()) {
+			_changedNodes.clear();
 			_ldb->connection()->rollback();
 			return false;
 		}
-		if (mustUpdateRootTable) {
-			_ldb->insertList(_listInfo);
-			mustUpdateRootTable = false;
-		}
 		return true;
 	}
 
 	void abortChanges()
 	{
+		// The whole batch will be rolled back by endBatch()
+		if (_batchDepth > 0) {
+			_batchFailed = true;
+			return;
+		}
+		_changedNodes.clear();
+		_ldb->connection()->rollback();
+	}
+
+	/**
+	 * Starts a batch of operations. Until the matching endBatch() call,
+	 * dirty nodes are kept in memory and only written once. Batches can
+	 * be nested, only the outermost one has an effect.
+	 */
+	bool beginBatch()
+	{
+		if (_batchDepth++ > 0) return true;
 		_changedNodes.clear();
+		_batchFailed = false;
+		if (!_ldb->connection()->transaction()) {
+			--_batchDepth;
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Ends a batch started with beginBatch(). When the outermost batch is ended,
+	 * all the nodes changed during the batch are written in its transaction, which
+	 * is then committed. If success is false or an operation of the batch failed,
+	 * the batch is rolled back instead and the in-memory tree reloaded from the
+	 * database. Returns true if the batch has been committed.
+	 */
+	bool endBatch(bool success = true)
+	{
+		if (_batchDepth == 0) return false;
+		if (!success) _batchFailed = true;
+		if (--_batchDepth > 0) return !_batchFailed;
+
+		if (!_batchFailed && flushChanges() && _ldb->connection()->commit()) return true;
+		_changedNodes.clear();
+		mustUpdateRootTable = false;
 		_ldb->connection()->rollback();
+		// Memory structures do not match the database anymore
+		setListId(_listInfo.listId);
+		return false;
 	}
 
 	quint32 listId() const
@@ -302,11 +463,86 @@ public:
 	}
 
 	void clearMemCache();
+
+	/**
+	 * Reads the list from the database again, dropping all its in-memory
+	 * nodes and pending changes, e.g. once the transaction that changed it
+	 * has been rolled back. Refused while a batch is in progress, since
+	 * endBatch() reloads the tree itself if the batch fails.
+	 */
+	bool reload()
+	{
+		if (_batchDepth > 0) return false;
+		_changedNodes.clear();
+		mustUpdateRootTable = false;
+		setListId(_listInfo.listId);
+		return true;
+	}
+
+	/**
+	 * Releases all the in-memory nodes but the root, unless changes
+	 * are pending. Returns true if the nodes have been released.
+	 */
+	bool releaseMemCache()
+	{
+		if (_batchDepth > 0 || !_changedNodes.isEmpty()) return false;
+		clearMemCache();
+		return true;
+	}
 };
 
+template <class T>
+void OrderedRBDBTree<T>::evictColdNodes()
+{
+	if (!_root || _clock <= RECENT_LOOKUPS) return;
+	quint32 cutoff = _clock - RECENT_LOOKUPS;
+	// A node is always reached after its parent, so a cold node heads a cold subtree
+	_root->_lastUse = _clock;
+	++_evictions;
+	QList<Node *> toVisit;
+	toVisit << _root;
+	while (!toVisit.isEmpty()) {
+		Node *node = toVisit.takeLast();
+		if (node->_left) {
+			if (node->_left->_lastUse < cutoff) {
+				releaseSubtree(node->_left);
+				node->_left = 0;
+			}
+			else toVisit << node->_left;
+		}
+		if (node->_right) {
+			if (node->_right->_lastUse < cutoff) {
+				releaseSubtree(node->_right);
+				node->_right = 0;
+			}
+			else toVisit << node->_right;
+		}
+	}
+}
+
+template <class T>
+void OrderedRBDBTree<T>::releaseSubtree(Node *node)
+{
+	QList<Node *> toRelease;
+	toRelease << node;
+	while (!toRelease.isEmpty()) {
+		Node *current = toRelease.takeLast();
+		if (current->_left) toRelease << current->_left;
+		if (current->_right) toRelease << current->_right;
+		// Nodes are in sync with the DB, keep their data so reloading them does not need a query
+		if (_prefetched.size() < _cacheSize) _prefetched[current->e.rowId] = current->e;
+		delete current;
+	}
+}
+
 template <class T>
 void OrderedRBDBTree<T>::clearMemCache()
 {
+	// Do not lose the changes of a pending batch
+	if (_batchDepth > 0 && !_batchFailed && !flushChanges()) _batchFailed = true;
+	_changedNodes.clear();
+	_prefetched.clear();
+	++_evictions;
 	Node *current = _root;
 	while (current) {
 		if (current->_left) current = current->_left;
@@ -25,6 +25,7 @@
 
 #include <QtDebug>
 #include <QtGlobal>
+#include <QVector>
 
 #include "tagaini_config.h"
 
@@ -110,7 +111,8 @@ public:
 	{
 		_parent = np;
 	}
-	void attachToTree(OrderedRBMemTree<T> *tree)
+	bool canAttachToTree(const OrderedRBMemTree<T> *) const { return true; }
+	void attachToTree(OrderedRBMemTree<T> *)
 	{
 	}
 
@@ -159,8 +161,11 @@ public:
 	Node *root() const { return _root; }
 	void setRoot(Node *node) { _root = node; }
 
+	Node *createNode(const T &val) { return new Node(this, val); }
 	bool aboutToChange() { return true; }
 	bool commitChanges() { return true; }
+	void lookupStarted() const {}
+	quint32 evictions() const { return 0; }
 	void removeNode(Node *node) { delete node; }
 	void abortChanges() {}
 };
@@ -172,6 +177,11 @@ private:
 	OrderedRBTree &operator =(const OrderedRBTree &);
 
 	TreeBase _tree;
+	/// Incremented by every change to the structure of the tree
+	quint32 _changes;
+
+	/// Changes whenever nodes previously returned may not be valid anymore
+	quint32 stamp() const { return _changes + _tree.evictions(); }
 
 	void setRoot(typename TreeBase::Node *node);
 	static typename TreeBase::Node *grandParent(const typename TreeBase::Node *const node);
@@ -188,6 +198,35 @@ private:
 	void insertCase4(typename TreeBase::Node *inserted);
 	void insertCase5(typename TreeBase::Node *inserted);
 
+	/**
+	 * Number of black nodes on the path from node to its leaves, node included.
+	 */
+	static int blackHeight(const typename TreeBase::Node *node);
+	/**
+	 * Builds a balanced detached subtree holding the values [from, to[ of vals.
+	 * Nodes at depth redDepth are the leaves of the incomplete last level and
+	 * are colored red, all the others are black.
+	 */
+	typename TreeBase::Node *buildBalanced(const QVector<typename TreeBase::Node::ValueType> &vals, int from, int to, int depth, int redDepth);
+	/**
+	 * Joins the detached subtrees left and right with middle in-between and returns
+	 * the root of the resulting subtree.
+	 * Complexity: O(log n)
+	 */
+	typename TreeBase::Node *join(typename TreeBase::Node *left, typename TreeBase::Node *middle, typename TreeBase::Node *right);
+	/**
+	 * Splits the subtree rooted at node into two detached subtrees, left receiving
+	 * its first index nodes and right the remaining ones.
+	 * Complexity: O(log² n)
+	 */
+	void split(typename TreeBase::Node *node, quint32 index, typename TreeBase::Node *&left, typename TreeBase::Node *&right);
+	/**
+	 * Joins the detached subtrees left and right, using the first node of right
+	 * as the middle node.
+	 * Complexity: O(log² n)
+	 */
+	typename TreeBase::Node *concat(typename TreeBase::Node *left, typename TreeBase::Node *right);
+
 	typedef enum { Left, Right } Side;
 
 	/**
@@ -230,7 +269,7 @@ private:
 public:
 	typedef TreeBase TreeType;
 
-	OrderedRBTree()
+	OrderedRBTree() : _changes(0)
 	{
 	}
 
@@ -253,11 +292,27 @@ public:
 	 * TODO No test to check whether we are inserting out of bounds! (both inferior and superior)
 	 */
 	bool insert(const typename TreeBase::Node::ValueType &val, int index);
+	/**
+	 * Insert all the values of vals, in order, starting at index. The new
+	 * values are built into a balanced subtree which is then joined with
+	 * the two halves of the tree, instead of being inserted one by one.
+	 * Complexity: O(m + log² n)
+	 */
+	bool insertRange(int index, const QVector<typename TreeBase::Node::ValueType> &vals);
 	/**
 	 * Remove the value at position index. Returns true on success, false otherwise.
 	 * Complexity: O(log n)
 	 */
 	bool remove(int index);
+	/**
+	 * Moves the count values starting at from into dest, so that the first of
+	 * them ends up at index to. dest can be this tree, in which case to is
+	 * the index once the range has been removed. The nodes are moved as a
+	 * whole subtree, so only the nodes along the split and join paths are
+	 * changed, plus the moved ones if they change tree.
+	 * Complexity: O(log² n), plus O(count) if dest is another tree
+	 */
+	bool moveRange(int from, int count, OrderedRBTree<TreeBase> &dest, int to);
 	bool clear();
 
 	/**
@@ -282,6 +337,95 @@ public:
 	TreeBase *tree() { return &_tree; }
 	const TreeBase *tree() const { return &_tree; }
 
+	/// Changes whenever values are inserted, removed or moved
+	quint32 changes() const { return _changes; }
+
+	/**
+	 * Bidirectional iterator over the values of the tree. Moving to the next
+	 * or previous value follows the links of the current node, which costs
+	 * O(1) amortized instead of the O(log n) of getNode(). Iterators can be
+	 * kept around: if the tree is modified or nodes are evicted from memory
+	 * meanwhile, they look their position up again on next use.
+	 */
+	class Iterator
+	{
+	private:
+		const OrderedRBTree<TreeBase> *_rbTree;
+		mutable const typename TreeBase::Node *_node;
+		int _index;
+		mutable quint32 _stamp;
+
+		void revalidate() const
+		{
+			if (_rbTree && _stamp != _rbTree->stamp()) {
+				_node = _rbTree->getNode(_index);
+				_stamp = _rbTree->stamp();
+			}
+		}
+
+	public:
+		Iterator() : _rbTree(0), _node(0), _index(0), _stamp(0) {}
+		Iterator(const OrderedRBTree<TreeBase> *rbTree, int index) : _rbTree(rbTree), _node(rbTree->getNode(index)), _index(index), _stamp(rbTree->stamp()) {}
+
+		/// Returns false if the iterator is out of the bounds of the tree
+		bool isValid() const { revalidate(); return _node != 0; }
+		int index() const { return _index; }
+		const typename TreeBase::Node *node() const { revalidate(); return _node; }
+		/// Will crash if the iterator is not valid
+		const typename TreeBase::Node::ValueType &value() const { return node()->value(); }
+
+		Iterator &operator++()
+		{
+			revalidate();
+			++_index;
+			if (!_node) {
+				_node = _rbTree->getNode(_index);
+				_stamp = _rbTree->stamp();
+			}
+			else if (_node->right()) {
+				_node = _node->right();
+				while (_node->left()) _node = _node->left();
+			} else {
+				while (_node->parent() && _node == _node->parent()->right()) _node = _node->parent();
+				_node = _node->parent();
+			}
+			return *this;
+		}
+
+		Iterator &operator--()
+		{
+			revalidate();
+			--_index;
+			if (!_node) {
+				_node = _rbTree->getNode(_index);
+				_stamp = _rbTree->stamp();
+			}
+			else if (_node->left()) {
+				_node = _node->left();
+				while (_node->right()) _node = _node->right();
+			} else {
+				while (_node->parent() && _node == _node->parent()->left()) _node = _node->parent();
+				_node = _node->parent();
+			}
+			return *this;
+		}
+
+		/// Moves to index, by stepping if it is next to the current position
+		void seek(int index)
+		{
+			if (index == _index + 1) ++(*this);
+			else if (index == _index - 1) --(*this);
+			else if (index != _index || _stamp != _rbTree->stamp()) {
+				_index = index;
+				_node = _rbTree->getNode(_index);
+				_stamp = _rbTree->stamp();
+			}
+		}
+	};
+
+	/// Returns an iterator pointing to index
+	Iterator iterator(int index) const { return Iterator(this, index); }
+
 	/**
 	 * Checks whether the tree is valid - causes a fatal error if it is not.
 	 */
@@ -462,6 +606,118 @@ void OrderedRBTree<TreeBase>::insertCase5(typename TreeBase::Node *inserted)
 	}
 }
 
+template <class TreeBase>
+int OrderedRBTree<TreeBase>::blackHeight(const typename TreeBase::Node *node)
+{
+	int ret = 0;
+	for (const typename TreeBase::Node *current = node; current; current = current->left())
+		if (current->color() == TreeBase::Node::BLACK) ++ret;
+	return ret;
+}
+
+template <class TreeBase>
+typename TreeBase::Node *OrderedRBTree<TreeBase>::buildBalanced(const QVector<typename TreeBase::Node::ValueType> &vals, int from, int to, int depth, int redDepth)
+{
+	if (from >= to) return 0;
+	int mid = (from + to) / 2;
+	typename TreeBase::Node *node = _tree.createNode(vals[mid]);
+	node->setColor(depth == redDepth ? TreeBase::Node::RED : TreeBase::Node::BLACK);
+	node->setLeft(buildBalanced(vals, from, mid, depth + 1, redDepth));
+	node->setRight(buildBalanced(vals, mid + 1, to, depth + 1, redDepth));
+	node->setLeftSize(mid - from);
+	return node;
+}
+
+template <class TreeBase>
+typename TreeBase::Node *OrderedRBTree<TreeBase>::join(typename TreeBase::Node *left, typename TreeBase::Node *middle, typename TreeBase::Node *right)
+{
+	// Subtrees coming from a split may have a red root
+	if (left && left->color() == TreeBase::Node::RED) left->setColor(TreeBase::Node::BLACK);
+	if (right && right->color() == TreeBase::Node::RED) right->setColor(TreeBase::Node::BLACK);
+	int lHeight = blackHeight(left);
+	int rHeight = blackHeight(right);
+
+	if (lHeight == rHeight) {
+		middle->setLeft(left);
+		middle->setRight(right);
+		middle->setLeftSize(size(left));
+		middle->setColor(TreeBase::Node::BLACK);
+		return middle;
+	}
+
+	middle->setColor(TreeBase::Node::RED);
+	if (lHeight > rHeight) {
+		// Follow the right spine of left down to a black node of the same black height as right
+		typename TreeBase::Node *parent = 0, *current = left;
+		int height = lHeight;
+		while (current && !(current->color() == TreeBase::Node::BLACK && height == rHeight)) {
+			if (current->color() == TreeBase::Node::BLACK) --height;
+			parent = current;
+			current = current->right();
+		}
+		if (current) detach(current);
+		parent->setRight(middle);
+		middle->setLeft(current);
+		middle->setRight(right);
+		middle->setLeftSize(size(current));
+	} else {
+		// Follow the left spine of right, every node on it gets left and middle on its left side
+		quint32 added = size(left) + 1;
+		typename TreeBase::Node *parent = 0, *current = right;
+		int height = rHeight;
+		while (current && !(current->color() == TreeBase::Node::BLACK && height == lHeight)) {
+			if (current->color() == TreeBase::Node::BLACK) --height;
+			current->setLeftSize(current->leftSize() + added);
+			parent = current;
+			current = current->left();
+		}
+		if (current) detach(current);
+		parent->setLeft(middle);
+		middle->setLeft(left);
+		middle->setRight(current);
+		middle->setLeftSize(added - 1);
+	}
+	// Now fix a possible red violation like for an insertion
+	insertCase1(middle);
+	typename TreeBase::Node *root = middle;
+	while (root->parent()) root = root->parent();
+	root->setColor(TreeBase::Node::BLACK);
+	return root;
+}
+
+template <class TreeBase>
+void OrderedRBTree<TreeBase>::split(typename TreeBase::Node *node, quint32 index, typename TreeBase::Node *&left, typename TreeBase::Node *&right)
+{
+	if (!node) {
+		left = right = 0;
+		return;
+	}
+	typename TreeBase::Node *l = node->left();
+	typename TreeBase::Node *r = node->right();
+	quint32 lSize = node->leftSize();
+	if (l) detach(l);
+	if (r) detach(r);
+
+	typename TreeBase::Node *sub;
+	if (index <= lSize) {
+		split(l, index, left, sub);
+		right = join(sub, node, r);
+	} else {
+		split(r, index - lSize - 1, sub, right);
+		left = join(l, node, sub);
+	}
+}
+
+template <class TreeBase>
+typename TreeBase::Node *OrderedRBTree<TreeBase>::concat(typename TreeBase::Node *left, typename TreeBase::Node *right)
+{
+	if (!left) return right;
+	if (!right) return left;
+	typename TreeBase::Node *first, *rest;
+	split(right, 1, first, rest);
+	return join(left, first, rest);
+}
+
 template <class TreeBase>
 void OrderedRBTree<TreeBase>::removeOneChildNode(typename TreeBase::Node *node)
 {
@@ -640,6 +896,7 @@ void OrderedRBTree<TreeBase>::removeCase6(typename TreeBase::Node *parent, Side
 template <class TreeBase>
 const typename TreeBase::Node *OrderedRBTree<TreeBase>::getNode(int index) const
 {
+	_tree.lookupStarted();
 	const typename TreeBase::Node *current = _tree.root();
 	unsigned int baseIdx = 0;
 
@@ -658,7 +915,9 @@ const typename TreeBase::Node *OrderedRBTree<TreeBase>::getNode(int index) const
 template <class TreeBase>
 bool OrderedRBTree<TreeBase>::insertNode(typename TreeBase::Node *node, int index)
 {
+	if (!node->canAttachToTree(&_tree)) return false;
 	if (!_tree.aboutToChange()) return false;
+	++_changes;
 
 	typename TreeBase::Node *current = _tree.root();
 	unsigned int baseIdx = 0;
@@ -720,6 +979,7 @@ bool OrderedRBTree<TreeBase>::removeNode(typename TreeBase::Node *node)
 	if (!node) return false;
 
 	if (!_tree.aboutToChange()) return false;
+	++_changes;
 	// Node has two childs, replace its value with the leftmost value at its
 	// right side and replace that latter node with its right child before deleting it.
 	if (node->left() && node->right()) {
@@ -766,7 +1026,7 @@ const typename TreeBase::Node::ValueType & OrderedRBTree<TreeBase>::operator[](i
 template <class TreeBase>
 bool OrderedRBTree<TreeBase>::insert(const typename TreeBase::Node::ValueType &val, int index)
 {
-	typename TreeBase::Node *newNode = new typename TreeBase::Node(&_tree, val);
+	typename TreeBase::Node *newNode = _tree.createNode(val);
 
 	if (!insertNode(newNode, index)) {
 		_tree.removeNode(newNode);
@@ -775,6 +1035,37 @@ bool OrderedRBTree<TreeBase>::insert(const typename TreeBase::Node::ValueType &v
 	return true;
 }
 
+template <class TreeBase>
+bool OrderedRBTree<TreeBase>::insertRange(int index, const QVector<typename TreeBase::Node::ValueType> &vals)
+{
+	if (vals.isEmpty()) return true;
+	if (index < 0 || (unsigned int)index > size()) return false;
+	if (!_tree.aboutToChange()) return false;
+	++_changes;
+
+	typename TreeBase::Node *left, *right, *result;
+	split(_tree.root(), index, left, right);
+	// The first and last values are used as the middle nodes of the two joins
+	typename TreeBase::Node *first = _tree.createNode(vals.first());
+	if (vals.size() == 1) result = join(left, first, right);
+	else {
+		typename TreeBase::Node *last = _tree.createNode(vals.last());
+		int count = vals.size() - 2;
+		int redDepth = 0;
+		while ((2 << redDepth) - 1 <= count) ++redDepth;
+		typename TreeBase::Node *middle = buildBalanced(vals, 1, vals.size() - 1, 0, redDepth);
+		result = join(join(left, first, middle), last, right);
+	}
+	setRoot(result);
+
+	if (!_tree.commitChanges()) {
+		_tree.abortChanges();
+		return false;
+	}
+	CHECK_VALID
+	return true;
+}
+
 template <class TreeBase>
 bool OrderedRBTree<TreeBase>::remove(int index)
 {
@@ -785,10 +1076,70 @@ bool OrderedRBTree<TreeBase>::remove(int index)
 	return ret;
 }
 
+template <class TreeBase>
+bool OrderedRBTree<TreeBase>::moveRange(int from, int count, OrderedRBTree<TreeBase> &dest, int to)
+{
+	if (count <= 0) return true;
+	unsigned int srcSize = size();
+	if (from < 0 || (unsigned int)(from + count) > srcSize) return false;
+	unsigned int destSize = &dest == this ? srcSize - count : dest.size();
+	if (to < 0 || (unsigned int)to > destSize) return false;
+	if (&dest != this && !getNode(from)->canAttachToTree(&dest._tree)) return false;
+
+	if (!_tree.aboutToChange()) return false;
+	if (&dest != this && !dest._tree.aboutToChange()) {
+		_tree.abortChanges();
+		return false;
+	}
+	++_changes;
+	if (&dest != this) ++dest._changes;
+
+	// Cut the range out of the source tree
+	typename TreeBase::Node *before, *range, *after, *rest;
+	split(_tree.root(), from, before, rest);
+	split(rest, count, range, after);
+	setRoot(concat(before, after));
+
+	// Give the moved nodes to the destination tree
+	if (&dest != this) {
+		QVector<typename TreeBase::Node *> pending;
+		pending << range;
+		while (!pending.isEmpty()) {
+			typename TreeBase::Node *node = pending.last();
+			pending.pop_back();
+			node->attachToTree(&dest._tree);
+			if (node->left()) pending << node->left();
+			if (node->right()) pending << node->right();
+		}
+	}
+
+	// And join it into the destination
+	dest.split(dest._tree.root(), to, before, after);
+	dest.setRoot(dest.concat(dest.concat(before, range), after));
+
+	if (&dest != this) {
+		if (!dest._tree.commitChanges()) {
+			dest._tree.abortChanges();
+			_tree.abortChanges();
+			return false;
+		}
+	}
+	if (!_tree.commitChanges()) {
+		_tree.abortChanges();
+		return false;
+	}
+	CHECK_VALID
+#ifdef DEBUG_LISTS
+	if (&dest != this) dest.checkValid();
+#endif
+	return true;
+}
+
 template <class TreeBase>
 bool OrderedRBTree<TreeBase>::clear()
 {
 	if (!_tree.aboutToChange()) return false;
+	++_changes;
 	typename TreeBase::Node *current = _tree.root();
 	while (current) {
 		if (current->left()) current = current->left();
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_PACK_READER_H
+#define __CORE_PACK_READER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QtEndian>
+
+/**
+ * Reads the little-endian numbers and the strings of a packed record,
+ * never past its end. Strings are UTF-8 preceded by their 16 bits size,
+ * as written by the database builders with a little-endian QDataStream.
+ */
+class PackReader
+{
+private:
+	const uchar *_pos;
+	const uchar *_end;
+	bool _ok;
+
+public:
+	PackReader(const uchar *pos, const uchar *end) : _pos(pos), _end(end), _ok(true) {}
+	bool ok() const { return _ok; }
+	template <typename T> T read()
+	{
+		if (!_ok || _end - _pos < (qptrdiff)sizeof(T)) { _ok = false; return 0; }
+		T ret = qFromLittleEndian<T>(_pos);
+		_pos += sizeof(T);
+		return ret;
+	}
+	QString readString()
+	{
+		quint16 size = read<quint16>();
+		if (!_ok || _end - _pos < size) { _ok = false; return QString(); }
+		QString ret(QString::fromUtf8(reinterpret_cast<const char *>(_pos), size));
+		_pos += size;
+		return ret;
+	}
+	QVector<int> readIndices()
+	{
+		QVector<int> ret(read<quint8>());
+		for (int i = 0; i < ret.size(); i++) ret[i] = read<quint8>();
+		return ret;
+	}
+	/// Reads bytes preceded by their 8 bits size
+	QByteArray readBytes()
+	{
+		quint8 size = read<quint8>();
+		if (!_ok || _end - _pos < size) { _ok = false; return QByteArray(); }
+		QByteArray ret(reinterpret_cast<const char *>(_pos), size);
+		_pos += size;
+		return ret;
+	}
+};
+
+#endif
@@ -67,3 +67,43 @@ QString lookForFile(const QString &name)
 	return resFile.fileName();
 	
 }
+
+QStringList installPendingFiles()
+{
+	QStringList ret;
+	QDir dir(userProfile());
+	foreach (const QString &pending, dir.entryList(QStringList("*.pending"), QDir::Files)) {
+		// name.<stamp>.pending
+		QString base(pending.left(pending.size() - 8));
+		int dot = base.lastIndexOf('.');
+		if (dot <= 0) continue;
+		QString name(base.left(dot));
+		QString stamp(base.mid(dot + 1));
+		// Renaming is atomic if nothing is at the destination, so the old
+		// file is moved away first and only removed once the new one is
+		// in place
+		QString old(name + ".old");
+		dir.remove(old);
+		if (dir.exists(name) && !dir.rename(name, old)) {
+			qWarning("Cannot replace %s with its update", dir.filePath(name).toLocal8Bit().constData());
+			continue;
+		}
+		if (!dir.rename(pending, name)) {
+			qWarning("Cannot install the update of %s", dir.filePath(name).toLocal8Bit().constData());
+			if (dir.exists(old)) dir.rename(old, name);
+			continue;
+		}
+		dir.remove(old);
+		QFile stampFile(dir.filePath(name + ".stamp"));
+		if (stampFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) stampFile.write(stamp.toUtf8());
+		ret << name;
+	}
+	return ret;
+}
+
+QString installedFileStamp(const QString &name)
+{
+	QFile stampFile(QDir(userProfile()).filePath(name + ".stamp"));
+	if (!stampFile.open(QIODevice::ReadOnly)) return QString();
+	return QString::fromUtf8(stampFile.readAll()).trimmed();
+}
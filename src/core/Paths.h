@@ -19,6 +19,7 @@
 #define __CORE_PATHS_H
 
 #include <QString>
+#include <QStringList>
 
 #define _QUOTEMACRO(x) #x
 #define QUOTEMACRO(x) _QUOTEMACRO(x)
@@ -42,4 +43,15 @@ inline const QString& userProfile()
  */
 QString lookForFile(const QString &name);
 
+/**
+ * Puts in place the files downloaded into the user profile during the
+ * previous run. A download of name is kept as name.<stamp>.pending until
+ * it is complete, and is moved over name here, before anything opens it.
+ * The stamp is written into name.stamp, so downloaders know which version
+ * is installed. Returns the names of the installed files.
+ */
+QStringList installPendingFiles();
+/// Stamp of the file of the user profile installed by installPendingFiles()
+QString installedFileStamp(const QString &name);
+
 #endif
@@ -0,0 +1,194 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/PerfCounters.h"
+#include "core/EntriesCache.h"
+#include "core/Database.h"
+#include "core/MemoryUsage.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QMap>
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+
+QAtomicInt PerfCounters::_enabled(0);
+PreferenceItem<bool> PerfCounters::collect("", "perfCounters", false);
+
+/**
+ * Counters and histograms are registered by their constructor, which may
+ * run during static initialization. Keeping the registry in a function
+ * ensures it exists by then.
+ */
+struct PerfRegistry
+{
+	QMutex mutex;
+	QList<PerfCounter *> counters;
+	QList<PerfHistogram *> histograms;
+	/// Histograms created by PerfCounters::histogram(), owned by the registry
+	QMap<QString, PerfHistogram *> named;
+
+	static PerfRegistry &instance()
+	{
+		static PerfRegistry registry;
+		return registry;
+	}
+};
+
+PerfCounter::PerfCounter(const QString &name) : _name(name), _value(0)
+{
+	PerfRegistry &registry(PerfRegistry::instance());
+	QMutexLocker lock(&registry.mutex);
+	registry.counters << this;
+}
+
+PerfHistogram::PerfHistogram(const QString &name) : _name(name), _count(0), _sum(0)
+{
+	for (int i = 0; i < nbBuckets; i++) _buckets[i].store(0);
+	PerfRegistry &registry(PerfRegistry::instance());
+	QMutexLocker lock(&registry.mutex);
+	registry.histograms << this;
+}
+
+void PerfHistogram::record(qint64 usecs)
+{
+	if (usecs < 0) usecs = 0;
+	// Bucket i holds the values below 2^i us
+	int bucket = 0;
+	while (bucket < nbBuckets - 1 && usecs >= (Q_INT64_C(1) << bucket)) ++bucket;
+	_buckets[bucket].fetchAndAddRelaxed(1);
+	_count.fetchAndAddRelaxed(1);
+	_sum.fetchAndAddRelaxed(usecs);
+}
+
+double PerfHistogram::mean() const
+{
+	quint64 count = _count.load();
+	return count ? (double)_sum.load() / count : 0.0;
+}
+
+qint64 PerfHistogram::percentile(int pct) const
+{
+	quint64 count = _count.load();
+	if (!count) return 0;
+	quint64 target = (count * pct + 99) / 100;
+	quint64 seen = 0;
+	for (int i = 0; i < nbBuckets; i++) {
+		seen += _buckets[i].load();
+		if (seen >= target) return Q_INT64_C(1) << i;
+	}
+	return Q_INT64_C(1) << (nbBuckets - 1);
+}
+
+void PerfHistogram::reset()
+{
+	for (int i = 0; i < nbBuckets; i++) _buckets[i].store(0);
+	_count.store(0);
+	_sum.store(0);
+}
+
+void PerfCounters::setEnabled(bool enabled)
+{
+	_enabled.store(enabled ? 1 : 0);
+}
+
+QList<PerfCounter *> PerfCounters::counters()
+{
+	PerfRegistry &registry(PerfRegistry::instance());
+	QMutexLocker lock(&registry.mutex);
+	return registry.counters;
+}
+
+QList<PerfHistogram *> PerfCounters::histograms()
+{
+	PerfRegistry &registry(PerfRegistry::instance());
+	QMutexLocker lock(&registry.mutex);
+	return registry.histograms;
+}
+
+PerfHistogram &PerfCounters::histogram(const QString &name)
+{
+	PerfRegistry &registry(PerfRegistry::instance());
+	{
+		QMutexLocker lock(&registry.mutex);
+		PerfHistogram *histogram = registry.named.value(name);
+		if (histogram) return *histogram;
+	}
+	// The constructor registers the histogram, so create it unlocked
+	PerfHistogram *histogram = new PerfHistogram(name);
+	QMutexLocker lock(&registry.mutex);
+	PerfHistogram *existing = registry.named.value(name);
+	if (existing) {
+		// Another thread created it meanwhile
+		registry.histograms.removeOne(histogram);
+		delete histogram;
+		return *existing;
+	}
+	registry.named[name] = histogram;
+	return *histogram;
+}
+
+void PerfCounters::reset()
+{
+	foreach (PerfCounter *counter, counters()) counter->reset();
+	foreach (PerfHistogram *histogram, histograms()) histogram->reset();
+	EntriesCache::resetStatistics();
+}
+
+QString PerfCounters::report()
+{
+	QString ret;
+	QTextStream out(&ret);
+
+	EntriesCache::Statistics cache(EntriesCache::statistics());
+	out << "Entries cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions << " evictions, " << cache.entries << " entries using " << cache.bytes << " bytes\n";
+	SQLite::Connection *connection = Database::connection();
+	if (connection) out << "Statements cache (main connection): " << connection->statementCacheHits() << " hits, " << connection->statementCacheMisses() << " misses\n";
+
+	// Taken periodically by the monitoring, if it runs
+	MemoryUsage::Snapshot memory(MemoryUsage::lastSnapshot());
+	if (!memory.samples.isEmpty()) out << "\n" << memory.toString() << "Caches trimmed " << MemoryUsage::trims() << " times because of the soft limit\n";
+
+	if (!enabled()) {
+		out << "\nPerformance counters are not being collected.\n";
+		return ret;
+	}
+
+	out << "\nCounters:\n";
+	foreach (PerfCounter *counter, counters()) out << "  " << counter->name() << ": " << counter->value() << "\n";
+
+	out << "\nTimings (us): count, mean, p50, p90, p99\n";
+	foreach (PerfHistogram *histogram, histograms()) {
+		if (!histogram->count()) continue;
+		out << "  " << histogram->name() << ": " << histogram->count() << ", " << qRound64(histogram->mean()) << ", " << histogram->percentile(50) << ", " << histogram->percentile(90) << ", " << histogram->percentile(99) << "\n";
+	}
+	return ret;
+}
+
+bool PerfCounters::dump(const QString &file)
+{
+	QFile f(file);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		qWarning("Cannot write performance counters to %s: %s", f.fileName().toLocal8Bit().constData(), f.errorString().toLocal8Bit().constData());
+		return false;
+	}
+	QTextStream out(&f);
+	out << "Performance counters of " << QDateTime::currentDateTime().toString(Qt::ISODate) << "\n\n" << report();
+	out.flush();
+	return f.error() == QFile::NoError;
+}
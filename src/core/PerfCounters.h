@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_PERF_COUNTERS_H
+#define __CORE_PERF_COUNTERS_H
+
+#include "core/Preferences.h"
+
+#include <QAtomicInteger>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QString>
+#include <QList>
+
+class PerfCounter;
+class PerfHistogram;
+
+/**
+ * Registry of the performance counters and histograms of the program.
+ * Collection is disabled by default, in which case the counters cost a
+ * single test of a flag. The report also includes the statistics that are
+ * always kept, like those of the entries cache.
+ */
+class PerfCounters
+{
+private:
+	static QAtomicInt _enabled;
+
+public:
+	/// Whether counters are collected, and the Performance page shown
+	static PreferenceItem<bool> collect;
+
+	static bool enabled() { return _enabled.load(); }
+	static void setEnabled(bool enabled);
+
+	static QList<PerfCounter *> counters();
+	static QList<PerfHistogram *> histograms();
+	/**
+	 * Returns the histogram of the given name, creating it if needed.
+	 * Slower than a static histogram, so only use it for names that are
+	 * built at runtime.
+	 */
+	static PerfHistogram &histogram(const QString &name);
+	/// Resets all the counters and histograms
+	static void reset();
+
+	/// Returns the values of all the counters, as text
+	static QString report();
+	/// Writes report() into file. Returns false if it cannot be written.
+	static bool dump(const QString &file);
+};
+
+/**
+ * Counter of events, e.g. rows streamed by queries. Counters are meant to
+ * be static objects, which are registered when constructed and listed by
+ * PerfCounters::report(). Adding to a counter does nothing unless
+ * PerfCounters::enabled().
+ */
+class PerfCounter
+{
+private:
+	const QString _name;
+	QAtomicInteger<quint64> _value;
+
+public:
+	explicit PerfCounter(const QString &name);
+
+	const QString &name() const { return _name; }
+	quint64 value() const { return _value.load(); }
+	void add(quint64 n = 1) { if (PerfCounters::enabled()) _value.fetchAndAddRelaxed(n); }
+	void reset() { _value.store(0); }
+};
+
+/**
+ * Distribution of durations, in microseconds. Values are counted in buckets
+ * of powers of two, so percentiles are only accurate within a factor of
+ * two, but recording is a single atomic increment per bucket.
+ */
+class PerfHistogram
+{
+public:
+	/// The last bucket counts all the values above 2^(nbBuckets - 2) us
+	static const int nbBuckets = 32;
+
+private:
+	const QString _name;
+	QAtomicInteger<quint64> _buckets[nbBuckets];
+	QAtomicInteger<quint64> _count;
+	QAtomicInteger<quint64> _sum;
+
+public:
+	explicit PerfHistogram(const QString &name);
+
+	const QString &name() const { return _name; }
+	quint64 count() const { return _count.load(); }
+	/// Mean of the recorded values
+	double mean() const;
+	/// Upper bound of the bucket containing the pct percentile
+	qint64 percentile(int pct) const;
+
+	void record(qint64 usecs);
+	void reset();
+};
+
+/**
+ * Measures the time until it is destroyed and records it into a histogram,
+ * if the counters are enabled.
+ */
+class PerfTimer
+{
+private:
+	PerfHistogram &_histogram;
+	QElapsedTimer _timer;
+
+public:
+	PerfTimer(PerfHistogram &histogram) : _histogram(histogram) { if (PerfCounters::enabled()) _timer.start(); }
+	~PerfTimer() { if (_timer.isValid()) _histogram.record(_timer.nsecsElapsed() / 1000); }
+};
+
+#endif
@@ -22,6 +22,18 @@
 
 #include <QMap>
 
+/**
+ * Base class of the plugins providing a type of dictionary entries.
+ *
+ * On registration, a dictionary plugin attaches its databases and gives
+ * the EntriesCache a factory for its EntryLoader, and the
+ * EntrySearcherManager its EntrySearcher. Searchers only translate search
+ * commands into SQL statements returning entry ids, so all searches run
+ * through the same paged and asynchronous queries. Loaders should
+ * implement EntryLoader::loadEntries() and EntryLoader::loadSummaries(),
+ * which the cache and the prefetchers use to load whole pages of results
+ * at once.
+ */
 class Plugin
 {
 private:
@@ -19,8 +19,13 @@
 
 #include <QtDebug>
 #include <QStringList>
+#include <QSet>
+#include <QRegExp>
+
+#include <climits>
 
 QHash<QString, int> QueryBuilder::Join::_tablePriority;
+QHash<QString, qint64> QueryBuilder::Join::_tableRows;
 QHash<QString, QueryBuilder::Order::Way> QueryBuilder::Order::orderingWay;
 
 bool QueryBuilder::Column::operator==(const Column &c) const
@@ -47,6 +52,16 @@ int QueryBuilder::Join::tablePriority(const QString &table)
 	return _tablePriority[table];
 }
 
+void QueryBuilder::Join::setTableRows(const QString &table, qint64 rows)
+{
+	_tableRows[table] = rows;
+}
+
+qint64 QueryBuilder::Join::tableRows(const QString &table)
+{
+	return _tableRows.value(table, -1);
+}
+
 bool QueryBuilder::Join::operator<(const Join &join) const
 {
 	return (tablePriority(table1()) > tablePriority(join.table1()));
@@ -130,19 +145,66 @@ void QueryBuilder::Statement::addWhere(const Where &where, int pos)
 	_wheres.insert(pos, where);
 }
 
-QueryBuilder::Column QueryBuilder::Statement::leftColumn() const
+/**
+ * Orders joins by estimated cost. Cross joins on the entry id whose table
+ * is filtered by a WHERE statement come first, smallest table first, since
+ * they restrict the candidates the most. Other joins on the entry id
+ * follow, then joins on another table that must come after it. Within a
+ * group joins keep their priority order.
+ */
+class JoinCost
 {
-	QList<Join> jList(joins());
-	int previousTablePriority = 0;
-	if (!firstTable().isEmpty()) {
-		previousTablePriority = QueryBuilder::Join::tablePriority(firstTable());
-		QueryBuilder::Join::addTablePriority(firstTable(), 65536);
+private:
+	const QString &_firstTable;
+	QSet<QString> _filtered;
+
+	int group(const QueryBuilder::Join &join) const
+	{
+		if (join.hasRightPart()) return 3;
+		if (join.type() == QueryBuilder::Join::Left) return 2;
+		return _filtered.contains(join.table1()) ? 0 : 1;
+	}
+
+	qint64 rows(const QueryBuilder::Join &join) const
+	{
+		if (group(join) != 0) return 0;
+		qint64 rows = QueryBuilder::Join::tableRows(join.table1());
+		return rows == -1 ? LLONG_MAX : rows;
+	}
+
+public:
+	JoinCost(const QString &firstTable, const QList<QueryBuilder::Join> &joins, const QList<QueryBuilder::Where> &wheres) : _firstTable(firstTable)
+	{
+		QStringList whereStrs;
+		foreach (const QueryBuilder::Where &where, wheres) whereStrs << where.toString();
+		QString allWheres(whereStrs.join(" "));
+		foreach (const QueryBuilder::Join &join, joins)
+			if (allWheres.contains(join.table1() + ".")) _filtered << join.table1();
 	}
-	std::sort(jList.begin(), jList.end());
-	if (!firstTable().isEmpty()) {
-		QueryBuilder::Join::addTablePriority(firstTable(), previousTablePriority);
+
+	bool operator()(const QueryBuilder::Join &j1, const QueryBuilder::Join &j2) const
+	{
+		bool first1 = !_firstTable.isEmpty() && j1.table1() == _firstTable;
+		bool first2 = !_firstTable.isEmpty() && j2.table1() == _firstTable;
+		if (first1 != first2) return first1;
+		int g1 = group(j1), g2 = group(j2);
+		if (g1 != g2) return g1 < g2;
+		qint64 r1 = rows(j1), r2 = rows(j2);
+		if (r1 != r2) return r1 < r2;
+		return j1 < j2;
 	}
-	return jList[0].column1();
+};
+
+QList<QueryBuilder::Join> QueryBuilder::Statement::sortedJoins() const
+{
+	QList<Join> jList(joins());
+	std::stable_sort(jList.begin(), jList.end(), JoinCost(firstTable(), jList, wheres()));
+	return jList;
+}
+
+QueryBuilder::Column QueryBuilder::Statement::leftColumn() const
+{
+	return sortedJoins()[0].column1();
 }
 
 QString QueryBuilder::Where::toString() const {
@@ -156,6 +218,24 @@ QString QueryBuilder::Where::toString() const {
 	}
 }
 
+QString QueryBuilder::Where::leftColumnSubselect() const
+{
+	QRegExp subselectMatch("^\\{\\{leftcolumn\\}\\} in \\((select .*)\\)$", Qt::CaseInsensitive);
+	if (!_wheres.isEmpty() || !subselectMatch.exactMatch(_constraint)) return QString();
+	QString subselect(subselectMatch.cap(1));
+	// The opening parenthesis must be closed by the last character only,
+	// e.g. not in "{{leftcolumn}} in (select ...) or {{leftcolumn}} in (...)"
+	int depth = 0;
+	bool quoted = false;
+	for (int i = 0; i < subselect.size(); i++) {
+		if (subselect[i] == '\'') quoted = !quoted;
+		if (quoted) continue;
+		if (subselect[i] == '(') depth++;
+		else if (subselect[i] == ')' && --depth < 0) return QString();
+	}
+	return depth == 0 ? subselect : QString();
+}
+
 void QueryBuilder::Where::addWhere(const Where &where, int pos)
 {
 	if (_wheres.contains(where)) return;
@@ -169,16 +249,7 @@ QString QueryBuilder::Statement::sqlStatementRightPart() const
 	QString res;
 
 	const Join *leftJoin = 0;
-	QList<Join> jList(joins());
-	int previousTablePriority = 0;
-	if (!firstTable().isEmpty()) {
-		previousTablePriority = QueryBuilder::Join::tablePriority(firstTable());
-		QueryBuilder::Join::addTablePriority(firstTable(), 65536);
-	}
-	std::sort(jList.begin(), jList.end());
-	if (!firstTable().isEmpty()) {
-		QueryBuilder::Join::addTablePriority(firstTable(), previousTablePriority);
-	}
+	QList<Join> jList(sortedJoins());
 
 	if (!_joins.isEmpty()) {
 		res += " FROM ";
@@ -198,9 +269,17 @@ QString QueryBuilder::Statement::sqlStatementRightPart() const
 		QStringList whereStrs;
 		if (leftJoin->hasAdditionalCondition()) whereStrs << "(" + leftJoin->additionalCondition() + ")";
 
+		// Filters that are subselects on the left column are intersected
+		// into a single set, computed once before the rows are scanned,
+		// instead of each being probed for every row
+		QStringList subselects;
 		foreach (const Where &where, wheres()) {
-			whereStrs << "(" + where.toString() + ")";
+			QString subselect(where.leftColumnSubselect());
+			if (!subselect.isEmpty()) subselects << subselect;
+			else whereStrs << "(" + where.toString() + ")";
 		}
+		if (subselects.size() == 1) whereStrs << "({{leftcolumn}} IN (" + subselects[0] + "))";
+		else if (subselects.size() > 1) whereStrs << "({{leftcolumn}} IN (SELECT * FROM (" + subselects.join(") INTERSECT SELECT * FROM (") + ")))";
 		res += whereStrs.join(" AND ");
 	}
 
@@ -289,6 +368,86 @@ QString QueryBuilder::buildSqlStatement(bool order) const
 	return res;
 }
 
+QString QueryBuilder::buildCountSqlStatement() const
+{
+	if (statements().size() == 0) return "";
+	return "SELECT count(*) FROM (" + buildSqlStatement(false) + ")";
+}
+
+static QString sqlLiteral(const QVariant &value)
+{
+	if (value.isNull()) return "NULL";
+	switch (value.type()) {
+	case QVariant::Int:
+	case QVariant::UInt:
+	case QVariant::LongLong:
+	case QVariant::ULongLong:
+		return value.toString();
+	case QVariant::Double:
+		return QString::number(value.toDouble(), 'g', 17);
+	default:
+		return "'" + value.toString().replace('\'', "''") + "'";
+	}
+}
+
+QString QueryBuilder::buildKeysetSqlStatement(const QList<QVariant> &after) const
+{
+	if (statements().size() == 0) return "";
+	int nbColumns = statements()[0].columns().size();
+	if (nbColumns < 2) return "";
+
+	// Orders refer to the result columns by their position
+	QList<int> keys;
+	QList<Order::Way> ways;
+	foreach (const Order &order, _orders) {
+		bool ok;
+		int col = order.factor().toInt(&ok) - 1;
+		if (!ok || col < 0 || col >= nbColumns) return "";
+		keys << col;
+		ways << order.way();
+	}
+	keys << 0 << 1;
+	ways << Order::ASC << Order::ASC;
+
+	QStringList columnNames;
+	for (int i = 0; i < nbColumns; i++) columnNames << QString("c%1").arg(i);
+
+	QString res = "WITH results(" + columnNames.join(", ") + ") AS (" + buildSqlStatement(false) + ") SELECT * FROM results";
+
+	if (!after.isEmpty()) {
+		if (after.size() != nbColumns) return "";
+		// (k0 > v0) OR (k0 = v0 AND k1 > v1) OR ... NULL values come
+		// first in ascending order and last in descending order.
+		QStringList conds;
+		QStringList equals;
+		for (int i = 0; i < keys.size(); i++) {
+			const QString &col = columnNames[keys[i]];
+			const QVariant &value = after[keys[i]];
+			QString next;
+			if (ways[i] == Order::ASC) {
+				if (value.isNull()) next = col + " IS NOT NULL";
+				else next = col + " > " + sqlLiteral(value);
+			}
+			else if (!value.isNull()) next = "(" + col + " < " + sqlLiteral(value) + " OR " + col + " IS NULL)";
+			if (!next.isEmpty()) conds << "(" + QStringList(equals + QStringList(next)).join(" AND ") + ")";
+			equals << col + " IS " + sqlLiteral(value);
+		}
+		// The last row was already the last possible one
+		if (conds.isEmpty()) conds << "0";
+		res += " WHERE " + conds.join(" OR ");
+	}
+
+	res += " ORDER BY ";
+	for (int i = 0; i < keys.size(); i++) {
+		if (i > 0) res += ", ";
+		res += columnNames[keys[i]] + (ways[i] == Order::ASC ? " ASC" : " DESC");
+	}
+
+	if (_limit.active()) res += QString(" LIMIT %1").arg(_limit.nbResults());
+
+	return res;
+}
+
 void QueryBuilder::addStatement(const Statement &statement, int pos)
 {
 	if (pos == -1) pos = _statements.size();
@@ -22,6 +22,7 @@
 #include <QList>
 #include <QHash>
 #include <QStringList>
+#include <QVariant>
 
 class QueryBuilder
 {
@@ -63,6 +64,7 @@ public:
 		Column _column2;
 		QString _additionalCondition;
 		static QHash<QString, int> _tablePriority;
+		static QHash<QString, qint64> _tableRows;
 
 	public:
 		/**
@@ -101,6 +103,18 @@ public:
 		 */
 		static int tablePriority(const QString &table);
 
+		/**
+		 * Records the estimated number of rows of a database table, as
+		 * given by the sqlite_stat1 table of its database.
+		 */
+		static void setTableRows(const QString &table, qint64 rows);
+
+		/**
+		 * Returns the estimated number of rows of the table, or -1 if
+		 * it is unknown.
+		 */
+		static qint64 tableRows(const QString &table);
+
 		/**
 		 * Compares two joins according to their types and priorities.
 		 * Left joins are superior to cross joins, and higher priorities
@@ -129,6 +143,11 @@ public:
 		Where(const QString &constraint) : _constraint(constraint) {}
 		const QString &constraint() const { return _constraint; }
 		QString toString() const;
+		/**
+		 * Returns the subselect of this constraint if it is of the form
+		 * {{leftcolumn}} IN (SELECT ...), or an empty string otherwise.
+		 */
+		QString leftColumnSubselect() const;
 		void addWhere(const Where &where, int pos = -1);
 
 		bool operator==(const Where &c) const;
@@ -206,12 +225,20 @@ public:
 		GroupBy _groupBy;
 
 		QString sqlStatementRightPart() const;
+		/**
+		 * Returns the joins in the order they must appear in the
+		 * request. The first one gives the left column.
+		 */
+		QList<Join> sortedJoins() const;
 		QString sqlStatementGroupPart() const;
 
 		/// Shortcuts the normal join sort system and
 		/// put the table named here first - dirty hack,
 		/// but useful to improve speed on some requests.
 		QString _firstTable;
+		/// Full-text relevance of each row, if the statement ranks its
+		/// results (e.g. note searches)
+		QString _matchRank;
 
 	public:
 		Statement() : _distinct(false) {}
@@ -256,6 +283,9 @@ public:
 
 		const QString &firstTable() const { return _firstTable; }
 		void setFirstTable(const QString &table) { _firstTable = table; }
+
+		const QString &matchRank() const { return _matchRank; }
+		void setMatchRank(const QString &rank) { _matchRank = rank; }
 	};
 
 private:
@@ -274,6 +304,24 @@ public:
 	 * Builds the SQL statement corresponding to the query.
 	 */
 	QString buildSqlStatement(bool order = true) const;
+	/**
+	 * Builds a statement returning the results that come right after the
+	 * row whose column values are given in after, in the order of the query.
+	 * The entry type and id are used as last sort keys so rows are always
+	 * in a strict order. If after is empty, the first results are returned.
+	 * Only the number of results of the limit is taken into account.
+	 *
+	 * Contrary to a limit with an offset, a page is not slower to get
+	 * the farther it is in the results.
+	 *
+	 * Returns an empty string if the orders of the query cannot be used as
+	 * keys.
+	 */
+	QString buildKeysetSqlStatement(const QList<QVariant> &after) const;
+	/**
+	 * Builds a statement returning the total number of results of the query.
+	 */
+	QString buildCountSqlStatement() const;
 
 	/// Add an union
 	void addStatement(const Statement &statement, int pos = -1);
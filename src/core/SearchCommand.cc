@@ -17,37 +17,117 @@
 
 #include "core/SearchCommand.h"
 
-#include <QtDebug>
-
 SearchCommand SearchCommand::_invalid("invalid");
 
-static QString singleWordString = "(-?[\\w\\*\\?\\-\\._:]+)";
-static QString quotedWordsString = "\"([^\"]*)\"";
-static QString argString = singleWordString + "|" + quotedWordsString;
+static bool isIdentifierChar(const QChar &c)
+{
+	return c.isLetterOrNumber() || c.isMark() || c == '_';
+}
 
-QRegExp SearchCommand::_singleWordMatch(singleWordString);
-QRegExp SearchCommand::_quotedWordsMatch(quotedWordsString);
-QRegExp SearchCommand::_argMatch(argString);
-QRegExp SearchCommand::_commandMatch(":(\\w+)(?:=(?:(?:" + argString + QString::fromUtf8(")(?:[,、](?:") + argString + "))*))?");
+static bool isWordChar(const QChar &c)
+{
+	return isIdentifierChar(c) || c == '*' || c == '?' || c == '-' || c == '.' || c == ':';
+}
 
-SearchCommand SearchCommand::fromString(const QString &string)
+static bool isArgumentSeparator(const QChar &c)
+{
+	return c == ',' || c == QChar(0x3001);
+}
+
+/**
+ * The scan functions below try to read a given kind of token at pos. On
+ * success they return true and move pos to the end of the token, otherwise
+ * pos is left unchanged.
+ */
+bool SearchCommand::scanWord(const QString &string, int &pos)
+{
+	int end = pos;
+	while (end < string.size() && isWordChar(string[end])) ++end;
+	if (end == pos) return false;
+	pos = end;
+	return true;
+}
+
+bool SearchCommand::scanQuotedWords(const QString &string, int &pos)
+{
+	if (pos >= string.size() || string[pos] != '"') return false;
+	int end = string.indexOf('"', pos + 1);
+	if (end == -1) return false;
+	pos = end + 1;
+	return true;
+}
+
+bool SearchCommand::scanArgument(const QString &string, int &pos, QString *arg)
 {
-	if (!_commandMatch.exactMatch(string)) {
-		qDebug("Cannot match command string!");
-		return SearchCommand::invalid();
+	int start = pos;
+	if (scanWord(string, pos)) {
+		if (arg) *arg = string.mid(start, pos - start);
+		return true;
 	}
-	QStringList caps;
-	SearchCommand ret(_commandMatch.cap(1));
-	int pos = string.indexOf('=');
-	if (pos != -1) while((pos = _argMatch.indexIn(string, pos)) != -1) {
-		// Whether we matched a single word or a string
-		if (_argMatch.cap(1) == "") ret.addArgument(_argMatch.cap(2));
-		else ret.addArgument(_argMatch.cap(1));
-		pos += _argMatch.matchedLength();
+	if (scanQuotedWords(string, pos)) {
+		if (arg) *arg = string.mid(start + 1, pos - start - 2);
+		return true;
 	}
+	return false;
+}
+
+bool SearchCommand::scanCommand(const QString &string, int &pos, SearchCommand *command)
+{
+	if (pos >= string.size() || string[pos] != ':') return false;
+	int end = pos + 1;
+	// Dashes separate the words of command names, e.g. :similar-meaning
+	while (end < string.size() && (isIdentifierChar(string[end]) || (end > pos + 1 && string[end] == '-' && end + 1 < string.size() && isIdentifierChar(string[end + 1])))) ++end;
+	if (end == pos + 1) return false;
+	if (command) *command = SearchCommand(string.mid(pos + 1, end - pos - 1));
+	if (end < string.size() && string[end] == '=') {
+		++end;
+		QString arg;
+		QString *argPtr = command ? &arg : 0;
+		if (!scanArgument(string, end, argPtr)) return false;
+		if (command) command->addArgument(arg);
+		while (end < string.size() && isArgumentSeparator(string[end])) {
+			++end;
+			if (!scanArgument(string, end, argPtr)) return false;
+			if (command) command->addArgument(arg);
+		}
+	}
+	pos = end;
+	return true;
+}
+
+SearchCommand SearchCommand::fromString(const QString &string)
+{
+	int pos = 0;
+	SearchCommand ret;
+	if (!scanCommand(string, pos, &ret) || pos != string.size()) return SearchCommand::invalid();
 	return ret;
 }
 
+QStringList SearchCommand::splitSearchString(const QString &string)
+{
+	QStringList res;
+	int pos = 0;
+	while (pos < string.size()) {
+		if (string[pos] == ' ') {
+			++pos;
+			continue;
+		}
+		int start = pos;
+		if (scanQuotedWords(string, pos)) {
+			res << string.mid(start + 1, pos - start - 2);
+			continue;
+		}
+		// Keep the longest of a command or a word, e.g. :a.b is a word
+		int commandEnd = start, wordEnd = start;
+		scanCommand(string, commandEnd, 0);
+		scanWord(string, wordEnd);
+		pos = qMax(commandEnd, wordEnd);
+		if (pos == start) return QStringList();
+		res << string.mid(start, pos - start);
+	}
+	return res;
+}
+
 bool SearchCommand::operator==(const SearchCommand &c) const
 {
 	return command() == c.command() && args() == c.args();
@@ -19,7 +19,6 @@
 #define __CORE_SEARCHCOMMAND_H
 
 #include <QStringList>
-#include <QRegExp>
 
 /**
  * Describes a command, as recognized by instances of the
@@ -32,17 +31,11 @@ private:
 	QStringList _args;
 	static SearchCommand _invalid;
 
-	static QRegExp _singleWordMatch;
-	static QRegExp _quotedWordsMatch;
-	static QRegExp _argMatch;
-	static QRegExp _commandMatch;
+	static bool scanWord(const QString &string, int &pos);
+	static bool scanQuotedWords(const QString &string, int &pos);
+	static bool scanArgument(const QString &string, int &pos, QString *arg);
+	static bool scanCommand(const QString &string, int &pos, SearchCommand *command);
 
-public:
-	static const QRegExp singleWordMatch() { return _singleWordMatch; }
-	static const QRegExp quotedWordsMatch() { return _quotedWordsMatch; }
-	static const QRegExp argMatch() { return _argMatch; }
-	static const QRegExp commandMatch() { return _commandMatch; }
-	
 public:
 	SearchCommand() {}
 	SearchCommand(const QString &command) : _command(command) {}
@@ -67,6 +60,16 @@ public:
 	 */
 	static SearchCommand fromString(const QString &string);
 
+	/**
+	 * Splits a search string into its words, quoted words and
+	 * commands. Quotes around quoted words are removed. Returns
+	 * an empty list if the string contains anything else.
+	 *
+	 * The string is read only once, without backtracking, so that
+	 * long pasted sentences do not freeze the search bar.
+	 */
+	static QStringList splitSearchString(const QString &string);
+
 	bool operator==(const SearchCommand &c) const;
 };
 
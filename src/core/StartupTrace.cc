@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/StartupTrace.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
+#include <QtDebug>
+
+StartupTrace *StartupTrace::_instance = 0;
+PreferenceItem<bool> StartupTrace::enabled("", "traceStartup", false);
+
+StartupTrace::StartupTrace() : _phase(0), _phaseStart(0), _idleMark(0)
+{
+	_timer.start();
+}
+
+void StartupTrace::start(bool force)
+{
+	if (_instance || !(force || enabled.value())) return;
+	_instance = new StartupTrace();
+}
+
+void StartupTrace::cleanup()
+{
+	delete _instance;
+	_instance = 0;
+}
+
+void StartupTrace::phaseDone(const char *name, qint64 startTime)
+{
+	if (!_instance) return;
+	qint64 now = _instance->_timer.elapsed();
+	bool background = QThread::currentThread() != QCoreApplication::instance()->thread();
+	// qDebug() is thread-safe, so phases of other threads can be printed as is
+	qDebug("Startup: %-24s %6lld ms, done at %6lld ms%s", name, now - startTime, now, background ? " (background)" : "");
+}
+
+void StartupTrace::beginPhase(const char *name)
+{
+	if (!_instance) return;
+	endPhase();
+	_instance->_phase = name;
+	_instance->_phaseStart = _instance->_timer.elapsed();
+}
+
+void StartupTrace::endPhase()
+{
+	if (!_instance || !_instance->_phase) return;
+	phaseDone(_instance->_phase, _instance->_phaseStart);
+	_instance->_phase = 0;
+}
+
+void StartupTrace::markWhenIdle(const char *name)
+{
+	if (!_instance) return;
+	_instance->_idleMark = name;
+	QTimer::singleShot(0, _instance, SLOT(onIdle()));
+}
+
+void StartupTrace::onIdle()
+{
+	if (_idleMark) phaseDone(_idleMark, 0);
+	_idleMark = 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_STARTUPTRACE_H
+#define __CORE_STARTUPTRACE_H
+
+#include "core/Preferences.h"
+
+#include <QObject>
+#include <QElapsedTimer>
+
+/**
+ * Opt-in report of the time taken by each phase of the startup. Phases of
+ * the GUI thread follow each other: beginPhase() ends the previous one.
+ * Phases run in the background are measured by a StartupPhase instance.
+ *
+ * Every phase is printed with qDebug() once done, with its duration and the
+ * time it ended at since start(), so the phases that are on the critical
+ * path to the display of the main window can be told apart from those that
+ * run alongside it.
+ */
+class StartupTrace : public QObject
+{
+	Q_OBJECT
+private:
+	static StartupTrace *_instance;
+
+	QElapsedTimer _timer;
+	/// Phase of the GUI thread in progress, if any
+	const char *_phase;
+	qint64 _phaseStart;
+	const char *_idleMark;
+
+	StartupTrace();
+
+private slots:
+	void onIdle();
+
+public:
+	static PreferenceItem<bool> enabled;
+
+	/**
+	 * Starts the clock if tracing is enabled or force is true. Must be
+	 * called from the GUI thread before any other method.
+	 */
+	static void start(bool force = false);
+	static void cleanup();
+	static bool isTracing() { return _instance != 0; }
+
+	/// Milliseconds since start(), 0 if not tracing
+	static qint64 elapsed() { return _instance ? _instance->_timer.elapsed() : 0; }
+	/// Reports that name, started at startTime, is done. Thread-safe.
+	static void phaseDone(const char *name, qint64 startTime);
+	/// Ends the current phase of the GUI thread and starts name
+	static void beginPhase(const char *name);
+	/// Ends the current phase of the GUI thread
+	static void endPhase();
+	/// Reports name once the GUI thread has processed its pending events
+	static void markWhenIdle(const char *name);
+};
+
+/**
+ * Reports the phase it lives for, for phases that are not run on the GUI
+ * thread.
+ */
+class StartupPhase
+{
+private:
+	const char *_name;
+	qint64 _start;
+
+public:
+	StartupPhase(const char *name) : _name(name), _start(StartupTrace::elapsed()) {}
+	~StartupPhase() { StartupTrace::phaseDone(_name, _start); }
+};
+
+#endif
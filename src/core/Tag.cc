@@ -22,15 +22,58 @@
 
 #include <QtDebug>
 
+#include <algorithm>
+
 Tag Tag::_invalid(0, "");
 TagsListModel Tag::knownTags;
+QVector<QString> Tag::_names;
+QHash<QString, quint32> Tag::_ids;
+QReadWriteLock Tag::_lock;
+
+static bool tagLessThan(const QString &t1, const QString &t2)
+{
+	return t1.compare(t2, Qt::CaseInsensitive) < 0;
+}
+
+int TagsListModel::lowerBound(const QString &str) const
+{
+	return std::lower_bound(_data.constBegin(), _data.constEnd(), str, tagLessThan) - _data.constBegin();
+}
+
+bool TagsListModel::contains(const QString &str) const
+{
+	int pos = lowerBound(str);
+	return pos < _data.size() && !_data[pos].compare(str, Qt::CaseInsensitive);
+}
+
+bool TagsListModel::containsPrefix(const QString &prefix) const
+{
+	int pos = lowerBound(prefix);
+	return pos < _data.size() && _data[pos].startsWith(prefix, Qt::CaseInsensitive);
+}
+
+bool TagsListModel::containsMatch(const QString &str) const
+{
+	// Trailing wildcards are the only ones the tags filter produces
+	int wildcard = str.indexOf(QRegExp("[*?\\[]"));
+	if (wildcard == str.size() - 1 && str.endsWith('*')) return containsPrefix(str.left(wildcard));
+	return _data.indexOf(QRegExp(str, Qt::CaseInsensitive, QRegExp::Wildcard)) != -1;
+}
 
 void TagsListModel::operator<<(const QString &str)
 {
-	 if (!_data.contains(str)) {
-		 _data << str;
-		 std::sort(_data.begin(), _data.end());
-	 }
+	int pos = lowerBound(str);
+	if (pos < _data.size() && _data[pos] == str) return;
+	beginInsertRows(QModelIndex(), pos, pos);
+	_data.insert(pos, str);
+	endInsertRows();
+}
+
+void TagsListModel::clear()
+{
+	beginResetModel();
+	_data.clear();
+	endResetModel();
 }
 
 QVariant TagsListModel::data(const QModelIndex &index, int role) const
@@ -39,12 +82,22 @@ QVariant TagsListModel::data(const QModelIndex &index, int role) const
 	return QVariant();
 }
 
+void Tag::addKnownTag(quint32 id, const QString &name)
+{
+	if ((int)id >= _names.size()) _names.resize(id + 1);
+	_names[id] = name;
+	_ids[name.toLower()] = id;
+}
+
 void Tag::init()
 {
+	QWriteLocker lock(&_lock);
 	SQLite::Query query(Database::connection());
-	query.exec("select tag from tags");
+	query.exec("select docid, tag from tags");
 	while (query.next()) {
-		knownTags << query.valueString(0);
+		QString name(query.valueString(1));
+		addKnownTag(query.valueUInt(0), name);
+		knownTags << name;
 	}
 }
 
@@ -52,22 +105,31 @@ void Tag::cleanup()
 {
 }
 
-Tag Tag::getTag(const QString &tagString)
+void Tag::reload()
 {
-	SQLite::Query query(Database::connection());
+	{
+		QWriteLocker lock(&_lock);
+		_names.clear();
+		_ids.clear();
+		knownTags.clear();
+	}
+	init();
+}
 
-	query.exec(QString("select docid, tag from tags where tag match '%1'").arg(tagString));
-	if (!query.next()) return _invalid;
-	return Tag(query.valueInt(0), query.valueString(1));
+Tag Tag::getTag(const QString &tagString)
+{
+	QReadLocker lock(&_lock);
+	// Tags were matched case-insensitively by the full-text index
+	quint32 id = _ids.value(tagString.toLower());
+	if (!id) return _invalid;
+	return Tag(id, _names[id]);
 }
 
 Tag Tag::getTag(quint32 id)
 {
-	SQLite::Query query(Database::connection());
-
-	query.exec(QString("select docid, tag from tags where docid = %1").arg(id));
-	if (!query.next()) return _invalid;
-	return Tag(query.valueInt(0), query.valueString(1));
+	QReadLocker lock(&_lock);
+	if (!id || (int)id >= _names.size() || _names[id].isNull()) return _invalid;
+	return Tag(id, _names[id]);
 }
 
 Tag Tag::getOrCreateTag(const QString &tagString)
@@ -75,19 +137,24 @@ Tag Tag::getOrCreateTag(const QString &tagString)
 	Tag tag(getTag(tagString));
 	if (tag.isValid()) return tag;
 
-	SQLite::Query query(Database::connection());
-	if (!query.exec(QString("insert into tags values('%1')").arg(tagString))) {
-		qCritical() << "Error executing query: " << query.lastError().message();
-		return _invalid;
-	}
-	if (!query.exec(QString("select docid from tags where tag match '%1'").arg(tagString))) {
-		qCritical() << "Error executing query: " << query.lastError().message();
-		return _invalid;
+	{
+		QWriteLocker lock(&_lock);
+		// Another thread may have created it in between
+		quint32 id = _ids.value(tagString.toLower());
+		if (id) return Tag(id, _names[id]);
+
+		SQLite::Query query(Database::connection());
+		query.prepare("insert into tags values(?)");
+		query.bindValue(tagString);
+		if (!query.exec()) {
+			qCritical() << "Error executing query: " << query.lastError().message();
+			return _invalid;
+		}
+		id = query.lastInsertId();
+		addKnownTag(id, tagString);
 	}
-	query.next();
-	int id = query.valueInt(0);
 	knownTags << tagString;
-	return Tag(id, tagString);
+	return getTag(tagString);
 }
 
 bool Tag::operator==(const Tag &tag) const
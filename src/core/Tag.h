@@ -23,11 +23,16 @@
 #include <QDateTime>
 #include <QList>
 #include <QStringList>
+#include <QVector>
+#include <QReadWriteLock>
 #include <QAbstractItemModel>
 #include <QCoreApplication>
 
 /**
  * Provides a model of all the tags that we met so far for the completer.
+ *
+ * Tags are kept sorted case-insensitively, so looking up a tag or the tags
+ * starting with a prefix is a binary search instead of a scan of the list.
  */
 class TagsListModel : public QAbstractListModel
 {
@@ -35,14 +40,21 @@ class TagsListModel : public QAbstractListModel
 private:
 	QStringList _data;
 
+	/// Returns the position of the first tag not lower than str
+	int lowerBound(const QString &str) const;
+
 public:
 	TagsListModel(QObject *parent = 0) : QAbstractListModel(parent) {}
 	virtual ~TagsListModel() {}
 	int rowCount(const QModelIndex &parent = QModelIndex()) const { return _data.size(); }
 	QVariant data(const QModelIndex &index, int role) const;
-	bool contains(const QString &str) const { return _data.contains(str, Qt::CaseInsensitive); }
-	bool containsMatch(const QString &str) const { return _data.indexOf(QRegExp(str, Qt::CaseInsensitive, QRegExp::Wildcard)) != -1; }
+	bool contains(const QString &str) const;
+	/// Returns true if a tag matches the wildcard pattern str
+	bool containsMatch(const QString &str) const;
+	/// Returns true if a tag starts with prefix
+	bool containsPrefix(const QString &prefix) const;
 	const QStringList &contents() const { return _data; }
+	void clear();
 
 	void operator<<(const QString &str);
 };
@@ -60,6 +72,16 @@ private:
 	static Tag _invalid;
 	/// A set of all the tags we know, used for auto-completion
 	static TagsListModel knownTags;
+	/// Names of all the tags, indexed by id. Tags returned by getTag()
+	/// share their name with this table.
+	static QVector<QString> _names;
+	/// Ids of all the tags, by case-folded name
+	static QHash<QString, quint32> _ids;
+	/// Entries are loaded from other threads
+	static QReadWriteLock _lock;
+
+	/// Records a tag of the database, _lock must be held for writing
+	static void addKnownTag(quint32 id, const QString &name);
 
 	quint32 _id;
 	QString _name;
@@ -70,6 +92,8 @@ private:
 public:
 	static void init();
 	static void cleanup();
+	/// Forgets the known tags and loads those of the current user database
+	static void reload();
 	static TagsListModel *knownTagsModel() { return &knownTags; }
 
 	quint32 id() const { return _id; }
@@ -89,7 +113,8 @@ public:
 
 	/**
 	 * Returns the tag corresponding to the string given as argument,
-	 * or the invalid tag if none is found.
+	 * or the invalid tag if none is found. Tags are all loaded by init(),
+	 * so neither this nor getTag(quint32) query the database.
 	 */
 	static Tag getTag(const QString &tagString);
 
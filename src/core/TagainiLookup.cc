@@ -0,0 +1,253 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Headless lookup tool. Runs each search given on the command line, or
+ * each line of the standard input if there are none, the same way the
+ * search bar of the main program would, and writes the results on the
+ * standard output as one JSON object or one TSV row per result.
+ *
+ * Queries are built from the main thread, as the entry searchers are not
+ * thread-safe, then run and their entries loaded on a pool of threads.
+ * Results are written in the order of the searches.
+ *
+ * With --listen, lookups are served over HTTP instead, see LookupServer.
+ */
+
+#include "core/Paths.h"
+#include "core/Database.h"
+#include "core/EntriesCache.h"
+#include "core/EntrySummary.h"
+#include "core/EntrySearcherManager.h"
+#include "core/QueryBuilder.h"
+#include "core/Plugin.h"
+#include "core/LookupServer.h"
+#include "core/jmdict/JMdictPlugin.h"
+#include "core/kanjidic2/Kanjidic2Plugin.h"
+#include "sqlite/Query.h"
+
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QMutex>
+#include <QMap>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QtDebug>
+
+#include <stdio.h>
+
+typedef enum { JSONOutput, TSVOutput } OutputFormat;
+
+/**
+ * Writes the output of the lookups in the order of their searches, as
+ * they may complete in any order.
+ */
+class LookupWriter
+{
+private:
+	QMutex _mutex;
+	QMap<int, QByteArray> _pending;
+	int _next;
+	/// Limits the number of searches not written yet
+	QSemaphore _slots;
+
+public:
+	LookupWriter(int maxPending) : _next(0), _slots(maxPending) {}
+	/// Must be called before queueing a new lookup
+	void reserve() { _slots.acquire(); }
+	void write(int seq, const QByteArray &output)
+	{
+		QMutexLocker locker(&_mutex);
+		_pending[seq] = output;
+		int written = 0;
+		while (!_pending.isEmpty() && _pending.constBegin().key() == _next) {
+			const QByteArray &data = _pending.constBegin().value();
+			fwrite(data.constData(), 1, data.size(), stdout);
+			_pending.erase(_pending.begin());
+			++_next;
+			++written;
+		}
+		if (written) {
+			fflush(stdout);
+			_slots.release(written);
+		}
+	}
+};
+
+static QString tsvField(const QStringList &values)
+{
+	QString ret(values.join("; "));
+	ret.replace('\t', ' ').replace('\n', ' ');
+	return ret;
+}
+
+class LookupJob : public QRunnable
+{
+private:
+	int _seq;
+	QString _search;
+	/// Empty if the search is not valid
+	QString _sql;
+	OutputFormat _format;
+	LookupWriter *_writer;
+
+public:
+	LookupJob(int seq, const QString &search, const QString &sql, OutputFormat format, LookupWriter *writer) : _seq(seq), _search(search), _sql(sql), _format(format), _writer(writer) {}
+
+	void run()
+	{
+		QList<EntryRef> refs;
+		if (!_sql.isEmpty()) {
+			SQLite::Query query(Database::threadConnection());
+			if (!query.exec(_sql)) qWarning("Search \"%s\" failed: %s", _search.toUtf8().constData(), query.lastError().message().toUtf8().constData());
+			while (query.next()) refs << EntryRef(query.valueUInt(0), query.valueUInt(1));
+		}
+		QVector<EntrySummary> summaries(EntriesCache::getSummaries(refs));
+
+		QByteArray output;
+		if (_format == JSONOutput) {
+			QJsonArray results;
+			foreach (const EntrySummary &summary, summaries)
+				results << LookupServer::summaryJson(summary);
+			QJsonObject line;
+			line["search"] = _search;
+			line["results"] = results;
+			output = QJsonDocument(line).toJson(QJsonDocument::Compact) + '\n';
+		} else {
+			QString search(_search);
+			search.replace('\t', ' ');
+			foreach (const EntrySummary &summary, summaries) {
+				output += QString("%1\t%2\t%3\t%4\t%5\t%6\n").arg(search).arg((int)summary.ref().type()).arg(summary.ref().id()).arg(tsvField(summary.writings())).arg(tsvField(summary.readings())).arg(tsvField(summary.meanings())).toUtf8();
+			}
+		}
+		_writer->write(_seq, output);
+	}
+};
+
+static void printUsage(char *argv[])
+{
+	qCritical("Usage: %s [--format=json|tsv] [--limit=<n>] [--threads=<n>] [--user-db=<file>] [--listen=<port>] [search ...]\nRuns each search, or each line of the standard input if no search is given, and writes their results on the standard output\n--format selects JSON lines (default) or TSV rows (search, type, id, writings, readings, meanings)\n--limit sets the maximum number of results per search, 0 for no limit (default 10)\n--threads sets the number of threads running the searches (default: number of CPUs)\n--user-db uses the study data of the given user database instead of a temporary one\n--listen serves the lookups over HTTP on the given local port instead, see LookupServer.h", argv[0]);
+}
+
+/// Runs searches, or the lines of the standard input, and writes their results
+static int lookup(QThreadPool &pool, const QStringList &searches, OutputFormat format, int limit)
+{
+	LookupWriter writer(pool.maxThreadCount() * 16);
+
+	QFile input;
+	if (searches.isEmpty() && !input.open(stdin, QIODevice::ReadOnly)) {
+		qCritical("Cannot read the standard input");
+		return 1;
+	}
+	for (int seq = 0; ; seq++) {
+		QString search;
+		if (input.isOpen()) {
+			if (input.atEnd()) break;
+			search = QString::fromUtf8(input.readLine()).trimmed();
+		} else if (seq < searches.size()) search = searches[seq];
+		else break;
+
+		QueryBuilder query;
+		QString sql;
+		if (EntrySearcherManager::instance().buildQuery(search, query)) {
+			if (limit) query.setLimit(QueryBuilder::Limit(limit));
+			sql = query.buildSqlStatement();
+		}
+		writer.reserve();
+		pool.start(new LookupJob(seq, search, sql, format, &writer));
+	}
+	pool.waitForDone();
+	return 0;
+}
+
+/// Serves lookups on port until the program is terminated
+static int serve(QThreadPool &pool, int port, int limit)
+{
+	LookupServer server(&pool, limit);
+	if (!server.listen(QHostAddress::LocalHost, port)) {
+		qCritical("Cannot listen on port %d: %s", port, server.errorString().toUtf8().constData());
+		return 1;
+	}
+	return QCoreApplication::exec();
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setOrganizationDomain(__ORGANIZATION_NAME);
+	QCoreApplication::setApplicationName(__APPLICATION_NAME);
+
+	OutputFormat format = JSONOutput;
+	int limit = 10;
+	int threads = QThread::idealThreadCount();
+	int port = 0;
+	QString userDBFile;
+	QStringList searches;
+	QStringList args(app.arguments());
+	for (int i = 1; i < args.size(); i++) {
+		const QString &arg = args[i];
+		bool ok = true;
+		if (arg == "--format=json") format = JSONOutput;
+		else if (arg == "--format=tsv") format = TSVOutput;
+		else if (arg.startsWith("--limit=")) limit = arg.mid(8).toInt(&ok);
+		else if (arg.startsWith("--threads=")) threads = arg.mid(10).toInt(&ok);
+		else if (arg.startsWith("--user-db=")) userDBFile = arg.mid(10);
+		else if (arg.startsWith("--listen=")) ok = (port = arg.mid(9).toInt()) > 0 && port < 65536;
+		else if (arg.startsWith("--")) ok = false;
+		else searches << arg;
+		if (!ok || limit < 0) {
+			printUsage(argv);
+			return 1;
+		}
+	}
+	if (threads < 1) threads = 1;
+
+	__userProfile = QStandardPaths::standardLocations(QStandardPaths::AppDataLocation)[0];
+
+	EntriesCache::init();
+	QStringList dbErrors;
+	if (!Database::init(userDBFile, userDBFile.isEmpty(), dbErrors)) {
+		qCritical("%s", dbErrors.join("\n").toUtf8().constData());
+		return 1;
+	}
+
+	Plugin *kanjidic2Plugin = new Kanjidic2Plugin();
+	Plugin *jmdictPlugin = new JMdictPlugin();
+	if (!Plugin::registerPlugin(kanjidic2Plugin) || !Plugin::registerPlugin(jmdictPlugin)) {
+		qCritical("Cannot register the dictionary plugins");
+		return 1;
+	}
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(threads);
+	// Keep the threads, and thus their connections and loaders, around
+	pool.setExpiryTimeout(-1);
+	int ret = port ? serve(pool, port, limit) : lookup(pool, searches, format, limit);
+
+	Plugin::removePlugin("JMdict");
+	Plugin::removePlugin("kanjidic2");
+	delete jmdictPlugin;
+	delete kanjidic2Plugin;
+	Database::stop();
+	EntriesCache::cleanup();
+	return ret;
+}
@@ -16,9 +16,17 @@
  */
 
 #include <QtDebug>
+#include <QVector>
+#include <QSet>
 
 #include "TextTools.h"
 
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define UNICODE_HIRAGANA_BEGIN 0x3040
 #define UNICODE_HIRAGANA_END 0x309F
 
@@ -109,53 +117,111 @@ bool isRomajiChar(const QChar c) {
 	return c <= 255;
 }
 
+#ifdef __SSE2__
+/// Returns the lanes of v that are between lo and hi, inclusive
+static inline __m128i inRange(__m128i v, ushort lo, ushort hi)
+{
+	__m128i offset = _mm_sub_epi16(v, _mm_set1_epi16((short)lo));
+	return _mm_cmpeq_epi16(_mm_subs_epu16(offset, _mm_set1_epi16((short)(hi - lo))), _mm_setzero_si128());
+}
+#endif
+
+/**
+ * Adds the script of the character at s[pos] to mask, and returns the number
+ * of code units it uses.
+ */
+static inline int addScript(const QChar *s, int size, int pos, uint &mask)
+{
+	const QChar c = s[pos];
+	uint script;
+	int len = 1;
+	if (c.isHighSurrogate() && pos + 1 < size && s[pos + 1].isLowSurrogate()) {
+		script = isKanjiChar(QChar::surrogateToUcs4(c, s[pos + 1])) ? KanjiScript : OtherScript;
+		len = 2;
+	}
+	else if (isHiraganaChar(c)) script = HiraganaScript;
+	else if (isKatakanaChar(c)) script = KatakanaScript;
+	else if (!c.isSurrogate() && isKanjiChar(c.unicode())) script = KanjiScript;
+	else if (isPunctuationChar(c)) script = JapanesePunctuationScript;
+	else if (isRomajiChar(c)) script = RomajiScript;
+	else script = OtherScript;
+	// Surrogate pairs are never punctuation, as in the per character tests
+	if (len == 1 && c.isPunct()) script <<= PunctShift;
+	mask |= script;
+	return len;
+}
+
+uint scripts(const QString &string)
+{
+	const QChar *s = string.constData();
+	const int size = string.size();
+	uint mask = 0;
+	int i = 0;
+
+#ifdef __SSE2__
+	// Fast path for blocks of 8 characters that are letters or digits of
+	// a single code unit, none of which are punctuation. Other blocks are
+	// processed character by character.
+	while (i + 8 <= size) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+		__m128i romaji = _mm_or_si128(_mm_or_si128(inRange(v, '0', '9'), inRange(v, 'A', 'Z')), inRange(v, 'a', 'z'));
+		__m128i hiragana = inRange(v, UNICODE_HIRAGANA_BEGIN, UNICODE_HIRAGANA_END);
+		// Ranges exclude 0x30A0 and 0x30FB, which are punctuation
+		__m128i katakana = _mm_or_si128(_mm_or_si128(inRange(v, 0x30A1, 0x30FA), inRange(v, 0x30FC, UNICODE_KATAKANA_END)), inRange(v, UNICODE_KATAKANA_EXT_BEGIN, UNICODE_KATAKANA_EXT_END));
+		__m128i kanji = _mm_or_si128(_mm_or_si128(inRange(v, UNICODE_CJK_BEGIN, UNICODE_CJK_END), inRange(v, UNICODE_CJK_EXTA_BEGIN, UNICODE_CJK_EXTA_END)), inRange(v, UNICODE_CJK_COMPAT_BEGIN, UNICODE_CJK_COMPAT_END));
+		__m128i known = _mm_or_si128(_mm_or_si128(romaji, hiragana), _mm_or_si128(katakana, kanji));
+		if (_mm_movemask_epi8(known) == 0xffff) {
+			if (_mm_movemask_epi8(romaji)) mask |= RomajiScript;
+			if (_mm_movemask_epi8(hiragana)) mask |= HiraganaScript;
+			if (_mm_movemask_epi8(katakana)) mask |= KatakanaScript;
+			if (_mm_movemask_epi8(kanji)) mask |= KanjiScript;
+			i += 8;
+		}
+		// A surrogate pair may end after the block, in which case i goes past it
+		else for (int end = i + 8; i < end; ) i += addScript(s, size, i, mask);
+	}
+#endif
+	while (i < size) i += addScript(s, size, i, mask);
+	return mask;
+}
+
+/// Returns true if the characters of string only belong to allowed
+static inline bool onlyScripts(const QString &string, uint allowed)
+{
+	return (scripts(string) & ~allowed) == 0;
+}
+
+static const uint allScripts = HiraganaScript | KatakanaScript | KanjiScript | JapanesePunctuationScript | RomajiScript | OtherScript;
+
 bool isHiragana(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++)
-		if (!(isHiraganaChar(string[i]) || string[i].isPunct())) return false;
-	return true;
+	// Punctuation is accepted here only
+	return onlyScripts(string, HiraganaScript | (allScripts << PunctShift));
 }
 
 bool isKatakana(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++)
-		if (!isKatakanaChar(string[i]) || string[i].isPunct()) return false;
-	return true;
+	return onlyScripts(string, KatakanaScript);
 }
 
 bool isKana(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++)
-		if (!isKanaChar(string[i]) || string[i].isPunct()) return false;
-	return true;
+	return onlyScripts(string, HiraganaScript | KatakanaScript);
 }
 
 bool isKanji(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++) {
-		const QChar &c = string[i];
-		if (!isKanjiChar(string, i) || c.isPunct()) return false;
-		if (c.isHighSurrogate()) i++;
-	}
-	return true;
+	return onlyScripts(string, KanjiScript);
 }
 
 bool isJapanese(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++) {
-		const QChar &c = string[i];
-		if (!isJapaneseChar(string, i) || string[i].isPunct()) return false;
-		if (c.isHighSurrogate()) i++;
-	}
-	return true;
+	return onlyScripts(string, HiraganaScript | KatakanaScript | KanjiScript | JapanesePunctuationScript);
 }
 
 bool isRomaji(const QString & string)
 {
-	for (int i = 0; i < string.size(); i++) {
-		if (!isRomajiChar(string[i]) || string[i].isPunct()) return false;
-	}
-	return true;
+	return onlyScripts(string, RomajiScript);
 }
 
 KanaTable hiraganaTable = {
@@ -198,145 +264,222 @@ KanaTable katakanaTable = {
 	{ QChar(0x30f3), QChar(0x0000), QChar(0x0000), QChar(0x0000), QChar(0x0000) }, // ン
 };
 
-static QMap<QChar, KanaInfo> _kanaInfos;
+/// Information about each character of the hiragana block, from U+3041 to U+3096
+static constexpr KanaInfo hiraganaInfos[] = {
+	{ "a", KanaInfo::Small, KanaInfo::Common }, // ぁ
+	{ "a", KanaInfo::Normal, KanaInfo::Common }, // あ
+	{ "i", KanaInfo::Small, KanaInfo::Common }, // ぃ
+	{ "i", KanaInfo::Normal, KanaInfo::Common }, // い
+	{ "u", KanaInfo::Small, KanaInfo::Common }, // ぅ
+	{ "u", KanaInfo::Normal, KanaInfo::Common }, // う
+	{ "e", KanaInfo::Small, KanaInfo::Common }, // ぇ
+	{ "e", KanaInfo::Normal, KanaInfo::Common }, // え
+	{ "o", KanaInfo::Small, KanaInfo::Common }, // ぉ
+	{ "o", KanaInfo::Normal, KanaInfo::Common }, // お
+	{ "ka", KanaInfo::Normal, KanaInfo::Common }, // か
+	{ "ga", KanaInfo::Normal, KanaInfo::Common }, // が
+	{ "ki", KanaInfo::Normal, KanaInfo::Common }, // き
+	{ "gi", KanaInfo::Normal, KanaInfo::Common }, // ぎ
+	{ "ku", KanaInfo::Normal, KanaInfo::Common }, // く
+	{ "gu", KanaInfo::Normal, KanaInfo::Common }, // ぐ
+	{ "ke", KanaInfo::Normal, KanaInfo::Common }, // け
+	{ "ge", KanaInfo::Normal, KanaInfo::Common }, // げ
+	{ "ko", KanaInfo::Normal, KanaInfo::Common }, // こ
+	{ "go", KanaInfo::Normal, KanaInfo::Common }, // ご
+	{ "sa", KanaInfo::Normal, KanaInfo::Common }, // さ
+	{ "za", KanaInfo::Normal, KanaInfo::Common }, // ざ
+	{ "shi", KanaInfo::Normal, KanaInfo::Common }, // し
+	{ "ji", KanaInfo::Normal, KanaInfo::Common }, // じ
+	{ "su", KanaInfo::Normal, KanaInfo::Common }, // す
+	{ "zu", KanaInfo::Normal, KanaInfo::Common }, // ず
+	{ "se", KanaInfo::Normal, KanaInfo::Common }, // せ
+	{ "ze", KanaInfo::Normal, KanaInfo::Common }, // ぜ
+	{ "so", KanaInfo::Normal, KanaInfo::Common }, // そ
+	{ "zo", KanaInfo::Normal, KanaInfo::Common }, // ぞ
+	{ "ta", KanaInfo::Normal, KanaInfo::Common }, // た
+	{ "da", KanaInfo::Normal, KanaInfo::Common }, // だ
+	{ "chi", KanaInfo::Normal, KanaInfo::Common }, // ち
+	{ "dji", KanaInfo::Normal, KanaInfo::Common }, // ぢ
+	{ "tsu", KanaInfo::Small, KanaInfo::Common }, // っ
+	{ "tsu", KanaInfo::Normal, KanaInfo::Common }, // つ
+	{ "dzu", KanaInfo::Normal, KanaInfo::Common }, // づ
+	{ "te", KanaInfo::Normal, KanaInfo::Common }, // て
+	{ "de", KanaInfo::Normal, KanaInfo::Common }, // で
+	{ "to", KanaInfo::Normal, KanaInfo::Common }, // と
+	{ "do", KanaInfo::Normal, KanaInfo::Common }, // ど
+	{ "na", KanaInfo::Normal, KanaInfo::Common }, // な
+	{ "ni", KanaInfo::Normal, KanaInfo::Common }, // に
+	{ "nu", KanaInfo::Normal, KanaInfo::Common }, // ぬ
+	{ "ne", KanaInfo::Normal, KanaInfo::Common }, // ね
+	{ "no", KanaInfo::Normal, KanaInfo::Common }, // の
+	{ "ha", KanaInfo::Normal, KanaInfo::Common }, // は
+	{ "ba", KanaInfo::Normal, KanaInfo::Common }, // ば
+	{ "pa", KanaInfo::Normal, KanaInfo::Common }, // ぱ
+	{ "hi", KanaInfo::Normal, KanaInfo::Common }, // ひ
+	{ "bi", KanaInfo::Normal, KanaInfo::Common }, // び
+	{ "pi", KanaInfo::Normal, KanaInfo::Common }, // ぴ
+	{ "fu", KanaInfo::Normal, KanaInfo::Common }, // ふ
+	{ "bu", KanaInfo::Normal, KanaInfo::Common }, // ぶ
+	{ "pu", KanaInfo::Normal, KanaInfo::Common }, // ぷ
+	{ "he", KanaInfo::Normal, KanaInfo::Common }, // へ
+	{ "be", KanaInfo::Normal, KanaInfo::Common }, // べ
+	{ "pe", KanaInfo::Normal, KanaInfo::Common }, // ぺ
+	{ "ho", KanaInfo::Normal, KanaInfo::Common }, // ほ
+	{ "bo", KanaInfo::Normal, KanaInfo::Common }, // ぼ
+	{ "po", KanaInfo::Normal, KanaInfo::Common }, // ぽ
+	{ "ma", KanaInfo::Normal, KanaInfo::Common }, // ま
+	{ "mi", KanaInfo::Normal, KanaInfo::Common }, // み
+	{ "mu", KanaInfo::Normal, KanaInfo::Common }, // む
+	{ "me", KanaInfo::Normal, KanaInfo::Common }, // め
+	{ "mo", KanaInfo::Normal, KanaInfo::Common }, // も
+	{ "ya", KanaInfo::Small, KanaInfo::Common }, // ゃ
+	{ "ya", KanaInfo::Normal, KanaInfo::Common }, // や
+	{ "yu", KanaInfo::Small, KanaInfo::Common }, // ゅ
+	{ "yu", KanaInfo::Normal, KanaInfo::Common }, // ゆ
+	{ "yo", KanaInfo::Small, KanaInfo::Common }, // ょ
+	{ "yo", KanaInfo::Normal, KanaInfo::Common }, // よ
+	{ "ra", KanaInfo::Normal, KanaInfo::Common }, // ら
+	{ "ri", KanaInfo::Normal, KanaInfo::Common }, // り
+	{ "ru", KanaInfo::Normal, KanaInfo::Common }, // る
+	{ "re", KanaInfo::Normal, KanaInfo::Common }, // れ
+	{ "ro", KanaInfo::Normal, KanaInfo::Common }, // ろ
+	{ "wa", KanaInfo::Small, KanaInfo::Common }, // ゎ
+	{ "wa", KanaInfo::Normal, KanaInfo::Common }, // わ
+	{ "wi", KanaInfo::Normal, KanaInfo::Rare }, // ゐ
+	{ "we", KanaInfo::Normal, KanaInfo::Rare }, // ゑ
+	{ "wo", KanaInfo::Normal, KanaInfo::Common }, // を
+	{ "n", KanaInfo::Normal, KanaInfo::Common }, // ん
+	{ "vu", KanaInfo::Normal, KanaInfo::Rare }, // ゔ
+	{ "ka", KanaInfo::Small, KanaInfo::Common }, // ゕ
+	{ "ke", KanaInfo::Small, KanaInfo::Common }, // ゖ
+};
 
-static void initKanaInfos()
-{
-	// Hiragana
-	_kanaInfos[QChar(0x3041)] = KanaInfo("a", KanaInfo::Small);
-	_kanaInfos[QChar(0x3043)] = KanaInfo("i", KanaInfo::Small);
-	_kanaInfos[QChar(0x3045)] = KanaInfo("u", KanaInfo::Small);
-	_kanaInfos[QChar(0x3047)] = KanaInfo("e", KanaInfo::Small);
-	_kanaInfos[QChar(0x3049)] = KanaInfo("o", KanaInfo::Small);
-
-	_kanaInfos[QChar(0x3042)] = KanaInfo("a");
-	_kanaInfos[QChar(0x3044)] = KanaInfo("i");
-	_kanaInfos[QChar(0x3046)] = KanaInfo("u");
-	_kanaInfos[QChar(0x3048)] = KanaInfo("e");
-	_kanaInfos[QChar(0x304a)] = KanaInfo("o");
-
-	_kanaInfos[QChar(0x3095)] = KanaInfo("ka", KanaInfo::Small);
-	_kanaInfos[QChar(0x304b)] = KanaInfo("ka");
-	_kanaInfos[QChar(0x304d)] = KanaInfo("ki");
-	_kanaInfos[QChar(0x304f)] = KanaInfo("ku");
-	_kanaInfos[QChar(0x3096)] = KanaInfo("ke", KanaInfo::Small);
-	_kanaInfos[QChar(0x3051)] = KanaInfo("ke");
-	_kanaInfos[QChar(0x3053)] = KanaInfo("ko");
-
-	_kanaInfos[QChar(0x304c)] = KanaInfo("ga");
-	_kanaInfos[QChar(0x304e)] = KanaInfo("gi");
-	_kanaInfos[QChar(0x3050)] = KanaInfo("gu");
-	_kanaInfos[QChar(0x3052)] = KanaInfo("ge");
-	_kanaInfos[QChar(0x3054)] = KanaInfo("go");
-
-	_kanaInfos[QChar(0x3055)] = KanaInfo("sa");
-	_kanaInfos[QChar(0x3057)] = KanaInfo("shi");
-	_kanaInfos[QChar(0x3059)] = KanaInfo("su");
-	_kanaInfos[QChar(0x305b)] = KanaInfo("se");
-	_kanaInfos[QChar(0x305d)] = KanaInfo("so");
-
-	_kanaInfos[QChar(0x3056)] = KanaInfo("za");
-	_kanaInfos[QChar(0x3058)] = KanaInfo("ji");
-	_kanaInfos[QChar(0x305a)] = KanaInfo("zu");
-	_kanaInfos[QChar(0x305c)] = KanaInfo("ze");
-	_kanaInfos[QChar(0x305e)] = KanaInfo("zo");
-
-	_kanaInfos[QChar(0x305f)] = KanaInfo("ta");
-	_kanaInfos[QChar(0x3061)] = KanaInfo("chi");
-	_kanaInfos[QChar(0x3063)] = KanaInfo("tsu", KanaInfo::Small);
-	_kanaInfos[QChar(0x3064)] = KanaInfo("tsu");
-	_kanaInfos[QChar(0x3066)] = KanaInfo("te");
-	_kanaInfos[QChar(0x3068)] = KanaInfo("to");
-
-	_kanaInfos[QChar(0x3060)] = KanaInfo("da");
-	_kanaInfos[QChar(0x3062)] = KanaInfo("dji");
-	_kanaInfos[QChar(0x3065)] = KanaInfo("dzu");
-	_kanaInfos[QChar(0x3067)] = KanaInfo("de");
-	_kanaInfos[QChar(0x3069)] = KanaInfo("do");
-
-	_kanaInfos[QChar(0x306a)] = KanaInfo("na");
-	_kanaInfos[QChar(0x306b)] = KanaInfo("ni");
-	_kanaInfos[QChar(0x306c)] = KanaInfo("nu");
-	_kanaInfos[QChar(0x306d)] = KanaInfo("ne");
-	_kanaInfos[QChar(0x306e)] = KanaInfo("no");
-
-	_kanaInfos[QChar(0x306f)] = KanaInfo("ha");
-	_kanaInfos[QChar(0x3072)] = KanaInfo("hi");
-	_kanaInfos[QChar(0x3075)] = KanaInfo("fu");
-	_kanaInfos[QChar(0x3078)] = KanaInfo("he");
-	_kanaInfos[QChar(0x307b)] = KanaInfo("ho");
-
-	_kanaInfos[QChar(0x3070)] = KanaInfo("ba");
-	_kanaInfos[QChar(0x3073)] = KanaInfo("bi");
-	_kanaInfos[QChar(0x3076)] = KanaInfo("bu");
-	_kanaInfos[QChar(0x3079)] = KanaInfo("be");
-	_kanaInfos[QChar(0x307c)] = KanaInfo("bo");
-
-	_kanaInfos[QChar(0x3071)] = KanaInfo("pa");
-	_kanaInfos[QChar(0x3074)] = KanaInfo("pi");
-	_kanaInfos[QChar(0x3077)] = KanaInfo("pu");
-	_kanaInfos[QChar(0x307a)] = KanaInfo("pe");
-	_kanaInfos[QChar(0x307d)] = KanaInfo("po");
-
-	_kanaInfos[QChar(0x307e)] = KanaInfo("ma");
-	_kanaInfos[QChar(0x307f)] = KanaInfo("mi");
-	_kanaInfos[QChar(0x3080)] = KanaInfo("mu");
-	_kanaInfos[QChar(0x3081)] = KanaInfo("me");
-	_kanaInfos[QChar(0x3082)] = KanaInfo("mo");
-
-	_kanaInfos[QChar(0x3083)] = KanaInfo("ya", KanaInfo::Small);
-	_kanaInfos[QChar(0x3084)] = KanaInfo("ya");
-	_kanaInfos[QChar(0x3085)] = KanaInfo("yu", KanaInfo::Small);
-	_kanaInfos[QChar(0x3086)] = KanaInfo("yu");
-	_kanaInfos[QChar(0x3087)] = KanaInfo("yo", KanaInfo::Small);
-	_kanaInfos[QChar(0x3088)] = KanaInfo("yo");
-
-	_kanaInfos[QChar(0x3089)] = KanaInfo("ra");
-	_kanaInfos[QChar(0x308a)] = KanaInfo("ri");
-	_kanaInfos[QChar(0x308b)] = KanaInfo("ru");
-	_kanaInfos[QChar(0x308c)] = KanaInfo("re");
-	_kanaInfos[QChar(0x308d)] = KanaInfo("ro");
-
-	_kanaInfos[QChar(0x308e)] = KanaInfo("wa", KanaInfo::Small);
-	_kanaInfos[QChar(0x308f)] = KanaInfo("wa");
-	_kanaInfos[QChar(0x3090)] = KanaInfo("wi", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x3091)] = KanaInfo("we", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x3092)] = KanaInfo("wo");
-
-	_kanaInfos[QChar(0x3094)] = KanaInfo("vu", KanaInfo::Normal, KanaInfo::Rare);
-
-	_kanaInfos[QChar(0x3093)] = KanaInfo("n");
-
-	// Katakana
-	// Lazy loop for katakana that have a hiragana equivalent
-	foreach (const QChar hira, _kanaInfos.keys()) {
-		_kanaInfos[hiraganaChar2Katakana(hira)] = _kanaInfos[hira];
-	}
-	// Other katakana
-	_kanaInfos[QChar(0x30f7)] = KanaInfo("va", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30f8)] = KanaInfo("vi", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30f9)] = KanaInfo("ve", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30fa)] = KanaInfo("vo", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30f0)] = KanaInfo("wi", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30f1)] = KanaInfo("we", KanaInfo::Normal, KanaInfo::Rare);
-	_kanaInfos[QChar(0x30f2)] = KanaInfo("wo", KanaInfo::Normal, KanaInfo::Rare);
-}
+/// Information about each character of the katakana block, from U+30A1 to U+30FA
+static constexpr KanaInfo katakanaInfos[] = {
+	{ "a", KanaInfo::Small, KanaInfo::Common }, // ァ
+	{ "a", KanaInfo::Normal, KanaInfo::Common }, // ア
+	{ "i", KanaInfo::Small, KanaInfo::Common }, // ィ
+	{ "i", KanaInfo::Normal, KanaInfo::Common }, // イ
+	{ "u", KanaInfo::Small, KanaInfo::Common }, // ゥ
+	{ "u", KanaInfo::Normal, KanaInfo::Common }, // ウ
+	{ "e", KanaInfo::Small, KanaInfo::Common }, // ェ
+	{ "e", KanaInfo::Normal, KanaInfo::Common }, // エ
+	{ "o", KanaInfo::Small, KanaInfo::Common }, // ォ
+	{ "o", KanaInfo::Normal, KanaInfo::Common }, // オ
+	{ "ka", KanaInfo::Normal, KanaInfo::Common }, // カ
+	{ "ga", KanaInfo::Normal, KanaInfo::Common }, // ガ
+	{ "ki", KanaInfo::Normal, KanaInfo::Common }, // キ
+	{ "gi", KanaInfo::Normal, KanaInfo::Common }, // ギ
+	{ "ku", KanaInfo::Normal, KanaInfo::Common }, // ク
+	{ "gu", KanaInfo::Normal, KanaInfo::Common }, // グ
+	{ "ke", KanaInfo::Normal, KanaInfo::Common }, // ケ
+	{ "ge", KanaInfo::Normal, KanaInfo::Common }, // ゲ
+	{ "ko", KanaInfo::Normal, KanaInfo::Common }, // コ
+	{ "go", KanaInfo::Normal, KanaInfo::Common }, // ゴ
+	{ "sa", KanaInfo::Normal, KanaInfo::Common }, // サ
+	{ "za", KanaInfo::Normal, KanaInfo::Common }, // ザ
+	{ "shi", KanaInfo::Normal, KanaInfo::Common }, // シ
+	{ "ji", KanaInfo::Normal, KanaInfo::Common }, // ジ
+	{ "su", KanaInfo::Normal, KanaInfo::Common }, // ス
+	{ "zu", KanaInfo::Normal, KanaInfo::Common }, // ズ
+	{ "se", KanaInfo::Normal, KanaInfo::Common }, // セ
+	{ "ze", KanaInfo::Normal, KanaInfo::Common }, // ゼ
+	{ "so", KanaInfo::Normal, KanaInfo::Common }, // ソ
+	{ "zo", KanaInfo::Normal, KanaInfo::Common }, // ゾ
+	{ "ta", KanaInfo::Normal, KanaInfo::Common }, // タ
+	{ "da", KanaInfo::Normal, KanaInfo::Common }, // ダ
+	{ "chi", KanaInfo::Normal, KanaInfo::Common }, // チ
+	{ "dji", KanaInfo::Normal, KanaInfo::Common }, // ヂ
+	{ "tsu", KanaInfo::Small, KanaInfo::Common }, // ッ
+	{ "tsu", KanaInfo::Normal, KanaInfo::Common }, // ツ
+	{ "dzu", KanaInfo::Normal, KanaInfo::Common }, // ヅ
+	{ "te", KanaInfo::Normal, KanaInfo::Common }, // テ
+	{ "de", KanaInfo::Normal, KanaInfo::Common }, // デ
+	{ "to", KanaInfo::Normal, KanaInfo::Common }, // ト
+	{ "do", KanaInfo::Normal, KanaInfo::Common }, // ド
+	{ "na", KanaInfo::Normal, KanaInfo::Common }, // ナ
+	{ "ni", KanaInfo::Normal, KanaInfo::Common }, // ニ
+	{ "nu", KanaInfo::Normal, KanaInfo::Common }, // ヌ
+	{ "ne", KanaInfo::Normal, KanaInfo::Common }, // ネ
+	{ "no", KanaInfo::Normal, KanaInfo::Common }, // ノ
+	{ "ha", KanaInfo::Normal, KanaInfo::Common }, // ハ
+	{ "ba", KanaInfo::Normal, KanaInfo::Common }, // バ
+	{ "pa", KanaInfo::Normal, KanaInfo::Common }, // パ
+	{ "hi", KanaInfo::Normal, KanaInfo::Common }, // ヒ
+	{ "bi", KanaInfo::Normal, KanaInfo::Common }, // ビ
+	{ "pi", KanaInfo::Normal, KanaInfo::Common }, // ピ
+	{ "fu", KanaInfo::Normal, KanaInfo::Common }, // フ
+	{ "bu", KanaInfo::Normal, KanaInfo::Common }, // ブ
+	{ "pu", KanaInfo::Normal, KanaInfo::Common }, // プ
+	{ "he", KanaInfo::Normal, KanaInfo::Common }, // ヘ
+	{ "be", KanaInfo::Normal, KanaInfo::Common }, // ベ
+	{ "pe", KanaInfo::Normal, KanaInfo::Common }, // ペ
+	{ "ho", KanaInfo::Normal, KanaInfo::Common }, // ホ
+	{ "bo", KanaInfo::Normal, KanaInfo::Common }, // ボ
+	{ "po", KanaInfo::Normal, KanaInfo::Common }, // ポ
+	{ "ma", KanaInfo::Normal, KanaInfo::Common }, // マ
+	{ "mi", KanaInfo::Normal, KanaInfo::Common }, // ミ
+	{ "mu", KanaInfo::Normal, KanaInfo::Common }, // ム
+	{ "me", KanaInfo::Normal, KanaInfo::Common }, // メ
+	{ "mo", KanaInfo::Normal, KanaInfo::Common }, // モ
+	{ "ya", KanaInfo::Small, KanaInfo::Common }, // ャ
+	{ "ya", KanaInfo::Normal, KanaInfo::Common }, // ヤ
+	{ "yu", KanaInfo::Small, KanaInfo::Common }, // ュ
+	{ "yu", KanaInfo::Normal, KanaInfo::Common }, // ユ
+	{ "yo", KanaInfo::Small, KanaInfo::Common }, // ョ
+	{ "yo", KanaInfo::Normal, KanaInfo::Common }, // ヨ
+	{ "ra", KanaInfo::Normal, KanaInfo::Common }, // ラ
+	{ "ri", KanaInfo::Normal, KanaInfo::Common }, // リ
+	{ "ru", KanaInfo::Normal, KanaInfo::Common }, // ル
+	{ "re", KanaInfo::Normal, KanaInfo::Common }, // レ
+	{ "ro", KanaInfo::Normal, KanaInfo::Common }, // ロ
+	{ "wa", KanaInfo::Small, KanaInfo::Common }, // ヮ
+	{ "wa", KanaInfo::Normal, KanaInfo::Common }, // ワ
+	{ "wi", KanaInfo::Normal, KanaInfo::Rare }, // ヰ
+	{ "we", KanaInfo::Normal, KanaInfo::Rare }, // ヱ
+	{ "wo", KanaInfo::Normal, KanaInfo::Rare }, // ヲ
+	{ "n", KanaInfo::Normal, KanaInfo::Common }, // ン
+	{ "vu", KanaInfo::Normal, KanaInfo::Rare }, // ヴ
+	{ "ka", KanaInfo::Small, KanaInfo::Common }, // ヵ
+	{ "ke", KanaInfo::Small, KanaInfo::Common }, // ヶ
+	{ "va", KanaInfo::Normal, KanaInfo::Rare }, // ヷ
+	{ "vi", KanaInfo::Normal, KanaInfo::Rare }, // ヸ
+	{ "ve", KanaInfo::Normal, KanaInfo::Rare }, // ヹ
+	{ "vo", KanaInfo::Normal, KanaInfo::Rare }, // ヺ
+};
+
+static constexpr KanaInfo noKanaInfo = { "", KanaInfo::Normal, KanaInfo::Common };
+
+/// Row of hiraganaTable of each character of the hiragana block, from
+/// U+3041 to U+3096, or -1 if it is not in the table
+static constexpr signed char hiraganaRows[] = {
+	-1, 0, -1, 0, -1, 0, -1, 0, -1, 0, 1, 2, 1, 2, 1, 2,
+	1, 2, 1, 2, 3, 4, 3, 4, 3, 4, 3, 4, 3, 4, 5, 6,
+	5, 6, -1, 5, 6, 5, 6, 5, 6, 7, 7, 7, 7, 7, 8, 9,
+	10, 8, 9, 10, 8, 9, 10, 8, 9, 10, 8, 9, 10, 11, 11, 11,
+	11, 11, -1, 12, -1, 12, -1, 12, 13, 13, 13, 13, 13, -1, 14, 14,
+	14, 14, 16, 15, -1, -1,
+};
+
+static constexpr ushort firstHiragana = 0x3041;
+static constexpr ushort firstKatakana = 0x30a1;
+static constexpr ushort nbHiragana = sizeof(hiraganaInfos) / sizeof(hiraganaInfos[0]);
+static constexpr ushort nbKatakana = sizeof(katakanaInfos) / sizeof(katakanaInfos[0]);
+static_assert(sizeof(hiraganaRows) == nbHiragana, "hiraganaRows must cover the hiragana block");
 
 int kanasTableRow(const QChar c)
 {
-	for (unsigned int i = 0; i < KANASTABLE_NBROWS; i++) {
-		if (c < hiraganaTable[i][0] || c > hiraganaTable[i][4]) continue;
-		for (int j = 0; j < 5; j++) {
-			if (c == hiraganaTable[i][j]) return i;
-		}
-	}
-	return -1;
+	ushort index = c.unicode() - firstHiragana;
+	return index < nbHiragana ? hiraganaRows[index] : -1;
 }
 
 const KanaInfo &kanaInfo(const QChar c)
 {
-	if (_kanaInfos.isEmpty()) initKanaInfos();
-	return _kanaInfos[c];
+	ushort index = c.unicode() - firstHiragana;
+	if (index < nbHiragana) return hiraganaInfos[index];
+	index = c.unicode() - firstKatakana;
+	if (index < nbKatakana) return katakanaInfos[index];
+	return noKanaInfo;
 }
 
 QChar hiraganaChar2Katakana(const QChar hira)
@@ -358,6 +501,80 @@ QString hiragana2Katakana(const QString &hira)
 	return kata;
 }
 
+QList<quint32> bigrams(const QString &s)
+{
+	QString n(hiragana2Katakana(s).toLower());
+	QList<quint32> ret;
+	for (int i = 0; i + 1 < n.size(); i++) {
+		quint32 bigram = ((quint32)n[i].unicode() << 16) | n[i + 1].unicode();
+		if (!ret.contains(bigram)) ret << bigram;
+	}
+	return ret;
+}
+
+QString reversed(const QString &s)
+{
+	QString ret;
+	ret.reserve(s.size());
+	for (int i = s.size() - 1; i >= 0; i--) {
+		if (s[i].isLowSurrogate() && i > 0 && s[i - 1].isHighSurrogate()) {
+			ret += s[i - 1];
+			ret += s[i];
+			i--;
+		} else ret += s[i];
+	}
+	return ret;
+}
+
+/// Returns the vowel of kana c, or 0 if it does not end with a vowel
+static char kanaVowel(const QChar c)
+{
+	const char *reading = kanaInfo(c).reading;
+	if (!reading[0]) return 0;
+	char last = reading[strlen(reading) - 1];
+	return strchr("aiueo", last) ? last : 0;
+}
+
+QString fuzzyKana(const QString &s)
+{
+	QString ret;
+	ret.reserve(s.size());
+	char vowel = 0;
+	foreach (QChar c, hiragana2Katakana(s)) {
+		// The voiced kana decompose into their unvoiced form and a mark
+		if (c.decompositionTag() == QChar::Canonical) c = c.decomposition()[0];
+		// Long vowel mark and small tsu
+		if (c.unicode() == 0x30fc || c.unicode() == 0x30c3) continue;
+		const KanaInfo &info = kanaInfo(c);
+		// Vowels lengthening the previous kana, i.e. the same vowel, or
+		// u after o and i after e
+		if (vowel && info.size == KanaInfo::Normal && info.reading[0] && !info.reading[1]) {
+			char v = info.reading[0];
+			if (v == vowel || (vowel == 'o' && v == 'u') || (vowel == 'e' && v == 'i')) continue;
+		}
+		ret += c;
+		vowel = kanaVowel(c);
+	}
+	return ret;
+}
+
+int editDistance(const QString &a, const QString &b)
+{
+	// Only keep the previous row of the distances matrix
+	QVector<int> row(b.size() + 1);
+	for (int j = 0; j <= b.size(); j++) row[j] = j;
+	for (int i = 1; i <= a.size(); i++) {
+		int diagonal = row[0];
+		row[0] = i;
+		for (int j = 1; j <= b.size(); j++) {
+			int above = row[j];
+			row[j] = qMin(qMin(above, row[j - 1]) + 1, diagonal + (a[i - 1] == b[j - 1] ? 0 : 1));
+			diagonal = above;
+		}
+	}
+	return row[b.size()];
+}
+
 QString unicodeToSingleChar(unsigned int unicode)
 {
 	QString ret;
@@ -379,177 +596,250 @@ unsigned int singleCharToUnicode(const QString &chr, int pos)
 	else return 0;
 }
 
-static QMap<QString, QString> __kanaTranscribe()
-{
-	QMap<QString, QString> ret;
-#define T(a, b) ret.insert(a, QString::fromUtf8(b));
-	T("a", "ア");
-	T("i", "イ");
-	T("u", "ウ");
-	T("e", "エ");
-	T("o", "オ");
-	T("ka", "カ");
-	T("ki", "キ");
-	T("ku", "ク");
-	T("ke", "ケ");
-	T("ko", "コ");
-	T("ga", "ガ");
-	T("gi", "ギ");
-	T("gu", "グ");
-	T("ge", "ゲ");
-	T("go", "ゴ");
-	T("sa", "サ");
-	T("si", "シ");
-	T("shi", "シ");
-	T("su", "ス");
-	T("se", "セ");
-	T("so", "ソ");
-	T("za", "ザ");
-	T("zi", "ジ");
-	T("ji", "ジ");
-	T("zu", "ズ");
-	T("ze", "ゼ");
-	T("zo", "ゾ");
-	T("ta", "タ");
-	T("ti", "チ");
-	T("chi", "チ");
-	T("tu", "ツ");
-	T("tsu", "ツ");
-	T("te", "テ");
-	T("to", "ト");
-	T("da", "ダ");
-	T("di", "ヂ");
-	T("du", "ヅ");
-	T("de", "デ");
-	T("do", "ド");
-	T("na", "ナ");
-	T("ni", "ニ");
-	T("nu", "ヌ");
-	T("ne", "ネ");
-	T("no", "ノ");
-	T("ha", "ハ");
-	T("hi", "ヒ");
-	T("hu", "フ");
-	T("fu", "フ");
-	T("he", "ヘ");
-	T("ho", "ホ");
-	T("ba", "バ");
-	T("bi", "ビ");
-	T("bu", "ブ");
-	T("be", "ベ");
-	T("bo", "ボ");
-	T("pa", "パ");
-	T("pi", "ピ");
-	T("pu", "プ");
-	T("pe", "ペ");
-	T("po", "ポ");
-	T("ma", "マ");
-	T("mi", "ミ");
-	T("mu", "ム");
-	T("me", "メ");
-	T("mo", "モ");
-	T("ya", "ヤ");
-	T("yu", "ユ");
-	T("yo", "ヨ");
-	T("ra", "ラ");
-	T("ri", "リ");
-	T("ru", "ル");
-	T("re", "レ");
-	T("ro", "ロ");
-	T("wa", "ワ");
-	T("wi", "ウィ");
-	T("wu", "ウ");
-	T("we", "ウェ");
-	T("wo", "ヲ");
-	T("va", "ヴァ");
-	T("vi", "ヴィ");
-	T("vu", "ヴ");
-	T("ve", "ヴェ");
-	T("vo", "ヴォ");
-	T("fa", "ファ");
-	T("fi", "フィ");
-	T("fe", "フェ");
-	T("fo", "フォ");
-	T("-", "ー");
-	T("kwa", "クァ");
-	T("kwi", "クィ");
-	T("kwe", "クェ");
-	T("kwo", "クォ");
-	T("kya", "キャ");
-	T("kyu", "キュ");
-	T("kye", "キェ");
-	T("kyo", "キョ");
-	T("gya", "ギャ");
-	T("gyu", "ギュ");
-	T("gye", "ギェ");
-	T("gyo", "ギョ");
-	T("sha", "シャ");
-	T("shu", "シュ");
-	T("she", "シェ");
-	T("sho", "ショ");
-	T("ja", "ジャ");
-	T("ju", "ジュ");
-	T("je", "ジェ");
-	T("jo", "ジョ");
-	T("cha", "チャ");
-	T("chu", "チュ");
-	T("che", "チェ");
-	T("cho", "チョ");
-	T("dja", "ヂャ");
-	T("dju", "ヂュ");
-	T("djo", "ヂョ");
-	T("nya", "ニャ");
-	T("nyu", "ニュ");
-	T("nye", "ニェ");
-	T("nyo", "ニョ");
-	T("hya", "ヒャ");
-	T("hyu", "ヒュ");
-	T("hye", "ヒェ");
-	T("hyo", "ヒョ");
-	T("bya", "ビャ");
-	T("byu", "ビュ");
-	T("bye", "ビェ");
-	T("byo", "ビョ");
-	T("pya", "ピャ");
-	T("pyu", "ピュ");
-	T("pye", "ピェ");
-	T("pyo", "ピョ");
-	T("mya", "ミャ");
-	T("myu", "ミュ");
-	T("myo", "ミョ");
-	T("rya", "リャ");
-	T("ryu", "リュ");
-	T("ryo", "リョ");
-	T("wyu", "ウュ");
-	T("vya", "ヴャ");
-	T("vyu", "ヴュ");
-	T("vye", "ヴィェ");
-	T("vyo", "ヴョ");
-	T("tsa", "ツァ");
-	T("tsi", "ツィ");
-	T("tse", "ツェ");
-	T("tso", "ツォ");
-	T("tsyu", "ツュ");
-	T("tyu", "テュ");
-	T("fya", "フャ");
-	T("fyu", "フュ");
-	T("fye", "フィェ");
-	T("fyo", "フョ");
-	T("mye", "ミェ");
-	T("rye", "リェ");
-
-	T("la", "ァ");
-	T("li", "ィ");
-	T("lu", "ゥ");
-	T("le", "ェ");
-	T("lo", "ォ");
-	T("yi", "イィ");
-	T("ye", "イェ");
+/// Romaji to katakana transcriptions. No romaji is a prefix of another.
+static const struct { const char *romaji; const char *kana; } kanaTranscribeTable[] = {
+#define T(a, b) { a, b },
+	T("a", "ア")
+	T("i", "イ")
+	T("u", "ウ")
+	T("e", "エ")
+	T("o", "オ")
+	T("ka", "カ")
+	T("ki", "キ")
+	T("ku", "ク")
+	T("ke", "ケ")
+	T("ko", "コ")
+	T("ga", "ガ")
+	T("gi", "ギ")
+	T("gu", "グ")
+	T("ge", "ゲ")
+	T("go", "ゴ")
+	T("sa", "サ")
+	T("si", "シ")
+	T("shi", "シ")
+	T("su", "ス")
+	T("se", "セ")
+	T("so", "ソ")
+	T("za", "ザ")
+	T("zi", "ジ")
+	T("ji", "ジ")
+	T("zu", "ズ")
+	T("ze", "ゼ")
+	T("zo", "ゾ")
+	T("ta", "タ")
+	T("ti", "チ")
+	T("chi", "チ")
+	T("tu", "ツ")
+	T("tsu", "ツ")
+	T("te", "テ")
+	T("to", "ト")
+	T("da", "ダ")
+	T("di", "ヂ")
+	T("du", "ヅ")
+	T("de", "デ")
+	T("do", "ド")
+	T("na", "ナ")
+	T("ni", "ニ")
+	T("nu", "ヌ")
+	T("ne", "ネ")
+	T("no", "ノ")
+	T("ha", "ハ")
+	T("hi", "ヒ")
+	T("hu", "フ")
+	T("fu", "フ")
+	T("he", "ヘ")
+	T("ho", "ホ")
+	T("ba", "バ")
+	T("bi", "ビ")
+	T("bu", "ブ")
+	T("be", "ベ")
+	T("bo", "ボ")
+	T("pa", "パ")
+	T("pi", "ピ")
+	T("pu", "プ")
+	T("pe", "ペ")
+	T("po", "ポ")
+	T("ma", "マ")
+	T("mi", "ミ")
+	T("mu", "ム")
+	T("me", "メ")
+	T("mo", "モ")
+	T("ya", "ヤ")
+	T("yu", "ユ")
+	T("yo", "ヨ")
+	T("ra", "ラ")
+	T("ri", "リ")
+	T("ru", "ル")
+	T("re", "レ")
+	T("ro", "ロ")
+	T("wa", "ワ")
+	T("wi", "ウィ")
+	T("wu", "ウ")
+	T("we", "ウェ")
+	T("wo", "ヲ")
+	T("va", "ヴァ")
+	T("vi", "ヴィ")
+	T("vu", "ヴ")
+	T("ve", "ヴェ")
+	T("vo", "ヴォ")
+	T("fa", "ファ")
+	T("fi", "フィ")
+	T("fe", "フェ")
+	T("fo", "フォ")
+	T("-", "ー")
+	T("kwa", "クァ")
+	T("kwi", "クィ")
+	T("kwe", "クェ")
+	T("kwo", "クォ")
+	T("kya", "キャ")
+	T("kyu", "キュ")
+	T("kye", "キェ")
+	T("kyo", "キョ")
+	T("gya", "ギャ")
+	T("gyu", "ギュ")
+	T("gye", "ギェ")
+	T("gyo", "ギョ")
+	T("sha", "シャ")
+	T("shu", "シュ")
+	T("she", "シェ")
+	T("sho", "ショ")
+	T("ja", "ジャ")
+	T("ju", "ジュ")
+	T("je", "ジェ")
+	T("jo", "ジョ")
+	T("cha", "チャ")
+	T("chu", "チュ")
+	T("che", "チェ")
+	T("cho", "チョ")
+	T("dja", "ヂャ")
+	T("dju", "ヂュ")
+	T("djo", "ヂョ")
+	T("nya", "ニャ")
+	T("nyu", "ニュ")
+	T("nye", "ニェ")
+	T("nyo", "ニョ")
+	T("hya", "ヒャ")
+	T("hyu", "ヒュ")
+	T("hye", "ヒェ")
+	T("hyo", "ヒョ")
+	T("bya", "ビャ")
+	T("byu", "ビュ")
+	T("bye", "ビェ")
+	T("byo", "ビョ")
+	T("pya", "ピャ")
+	T("pyu", "ピュ")
+	T("pye", "ピェ")
+	T("pyo", "ピョ")
+	T("mya", "ミャ")
+	T("myu", "ミュ")
+	T("myo", "ミョ")
+	T("rya", "リャ")
+	T("ryu", "リュ")
+	T("ryo", "リョ")
+	T("wyu", "ウュ")
+	T("vya", "ヴャ")
+	T("vyu", "ヴュ")
+	T("vye", "ヴィェ")
+	T("vyo", "ヴョ")
+	T("tsa", "ツァ")
+	T("tsi", "ツィ")
+	T("tse", "ツェ")
+	T("tso", "ツォ")
+	T("tsyu", "ツュ")
+	T("tyu", "テュ")
+	T("fya", "フャ")
+	T("fyu", "フュ")
+	T("fye", "フィェ")
+	T("fyo", "フョ")
+	T("mye", "ミェ")
+	T("rye", "リェ")
+
+	T("la", "ァ")
+	T("li", "ィ")
+	T("lu", "ゥ")
+	T("le", "ェ")
+	T("lo", "ォ")
+	T("yi", "イィ")
+	T("ye", "イェ")
 
 #undef T
+};
 
-	return ret;
-}
+/**
+ * Trie of the romaji of kanaTranscribeTable, built once so that romajiToKana()
+ * can transcribe its input in a single pass without creating substrings.
+ * Its alphabet is the lowercase letters and '-'.
+ */
+class RomajiTrie
+{
+private:
+	static const int alphabetSize = 27;
+	struct Node
+	{
+		qint16 next[alphabetSize];
+		/// Index of the kana of this node in _kana, or -1
+		qint16 kana;
+	};
+	QVector<Node> _nodes;
+	QVector<QString> _kana;
+
+	static int symbol(ushort c)
+	{
+		if (c >= 'a' && c <= 'z') return c - 'a';
+		if (c == '-') return 26;
+		return -1;
+	}
+
+	int addNode()
+	{
+		Node node;
+		for (int i = 0; i < alphabetSize; i++) node.next[i] = -1;
+		node.kana = -1;
+		_nodes << node;
+		return _nodes.size() - 1;
+	}
+
+public:
+	RomajiTrie()
+	{
+		addNode();
+		for (size_t i = 0; i < sizeof(kanaTranscribeTable) / sizeof(kanaTranscribeTable[0]); i++) {
+			int node = 0;
+			for (const char *c = kanaTranscribeTable[i].romaji; *c; c++) {
+				int s = symbol(*c);
+				if (_nodes[node].next[s] == -1) {
+					int n = addNode();
+					_nodes[node].next[s] = n;
+				}
+				node = _nodes[node].next[s];
+			}
+			_nodes[node].kana = _kana.size();
+			_kana << QString::fromUtf8(kanaTranscribeTable[i].kana);
+		}
+	}
+
+	/**
+	 * Returns the kana of the romaji starting at pos in src, which must be
+	 * lowercase, and sets len to the length of the romaji. Returns 0 if
+	 * no romaji starts at pos.
+	 */
+	const QString *match(const QChar *src, int size, int pos, int &len) const
+	{
+		int node = 0;
+		for (int i = pos; i < size; i++) {
+			int s = symbol(src[i].unicode());
+			if (s == -1) return 0;
+			node = _nodes[node].next[s];
+			if (node == -1) return 0;
+			// No romaji is a prefix of another one, so the first one found is it
+			if (_nodes[node].kana != -1) {
+				len = i - pos + 1;
+				return &_kana[_nodes[node].kana];
+			}
+		}
+		return 0;
+	}
+};
 
 static QSet<QChar> __nodouble()
 {
@@ -560,7 +850,7 @@ static QSet<QChar> __nodouble()
 	return ret;
 }
 
-static const QMap<QString, QString> kanaTranscribe(__kanaTranscribe());
+static const RomajiTrie romajiTrie;
 static const QSet<QChar> nodouble(__nodouble());
 
 QString romajiToKana(const QString &_src)
@@ -571,36 +861,36 @@ QString romajiToKana(const QString &_src)
 	int i;
 
 	QString src = _src.toLower();
+	const QChar *chars = src.constData();
+	int size = src.size();
+	ret.reserve(size);
 
-	for (i = 0; i < src.size();) {
-		QString part = src.mid(i);
-		int p = i;
+	for (i = 0; i < size;) {
+		const QChar c = chars[i];
 
-		if (part.size() > 1 && part[0] == part[1] && !nodouble.contains(part[0])) {
+		if (i + 1 < size && c == chars[i + 1] && !nodouble.contains(c)) {
 			ret += tt;
 			i += 1;
+			continue;
 		}
-		if (p != i) continue;
-		foreach (const QString &roma, kanaTranscribe.keys()) {
-			if (part.startsWith(roma)) {
-				ret += kanaTranscribe[roma];
-				i += roma.size();
-				break;
-			}
+		int len;
+		const QString *kana = romajiTrie.match(chars, size, i, len);
+		if (kana) {
+			ret += *kana;
+			i += len;
+			continue;
 		}
-		if (p != i) continue;
-		if (part.startsWith("n")) {
+		if (c == 'n') {
 			ret += nn;
 			i += 1;
-			if (part.size() > 1 && part[1] == 'n') i += 1;
+			if (i < size && chars[i] == 'n') i += 1;
+			continue;
 		}
-		if (p != i) continue;
-		if (isPunctuationChar(part[0]) || part[0] == '*') {
-			ret += part[0];
+		if (isPunctuationChar(c) || c == '*') {
+			ret += c;
 			i += 1;
 			continue;
 		}
-		if (p != i) continue;
 		// Did not match, return empty string
 		return "";
 	}
@@ -20,6 +20,7 @@
 
 #include <QChar>
 #include <QString>
+#include <QList>
 
 namespace TextTools {
 	/**
@@ -55,6 +56,29 @@ namespace TextTools {
 	bool isJapaneseChar(const QString &s, int pos = 0);
 	bool isRomajiChar(const QChar c);
 
+	/**
+	 * Scripts a character can belong to, as returned by scripts(). Every
+	 * character belongs to exactly one of them.
+	 */
+	enum Script {
+		HiraganaScript = 1 << 0,
+		KatakanaScript = 1 << 1,
+		KanjiScript = 1 << 2,
+		/// Japanese punctuation block, see isPunctuationChar()
+		JapanesePunctuationScript = 1 << 3,
+		/// Latin-1 characters, see isRomajiChar()
+		RomajiScript = 1 << 4,
+		OtherScript = 1 << 5
+	};
+	/// Script flags of characters for which QChar::isPunct() is true are
+	/// shifted by this value
+	static const int PunctShift = 8;
+	/**
+	 * Returns the script flags of all the characters of string, computed
+	 * in a single pass. Surrogate pairs count as a single character.
+	 */
+	uint scripts(const QString &string);
+
 	bool isHiragana(const QString & string);
 	bool isKatakana(const QString & string);
 	bool isKana(const QString & string);
@@ -72,20 +96,50 @@ namespace TextTools {
 
 	QString romajiToKana(const QString &src);
 
-	class KanaInfo  {
-	public:
+	/**
+	 * Returns the distinct pairs of consecutive characters of s, each
+	 * encoded as its two UTF-16 code units. Kana are converted to katakana
+	 * and letters to lowercase first, like the REGEXP function of the
+	 * database does, so that bigram indexes can be used to find the
+	 * candidates of a regular expression.
+	 */
+	QList<quint32> bigrams(const QString &s);
+
+	/**
+	 * Returns s with its characters in reverse order. Surrogate pairs are
+	 * kept in order so the result remains valid UTF-16.
+	 */
+	QString reversed(const QString &s);
+
+	/**
+	 * Returns the key under which kana string s is searched by fuzzy kana
+	 * searches, so that common misspellings share the same key: kana are
+	 * converted to katakana, voiced and semi-voiced marks are stripped,
+	 * and long vowels (including the ー mark) and small tsu are dropped.
+	 * For instance おばあさん, おばさん and オーバサン all give オハサン.
+	 */
+	QString fuzzyKana(const QString &s);
+
+	/**
+	 * Returns the Levenshtein distance between a and b, i.e. the number of
+	 * characters to insert, remove or substitute to turn a into b.
+	 */
+	int editDistance(const QString &a, const QString &b);
+
+	struct KanaInfo {
 		typedef enum { Small, Normal } Size;
 		typedef enum { Common, Rare } Usage;
-		QString reading;
+		/// Romaji reading, empty for characters that are not kana
+		const char *reading;
 		Size size;
 		Usage usage;
-
-		// For QMap
-		KanaInfo() {}
-		KanaInfo(const QString &_reading, Size _size = Normal, Usage _usage = Common)
-			: reading(_reading), size(_size), usage(_usage) {}
 	};
 
+	/**
+	 * Returns the information about kana c, read from tables indexed by
+	 * the hiragana and katakana blocks. The reading is empty if c is not
+	 * a kana.
+	 */
 	const KanaInfo &kanaInfo(const QChar c);
 
 #define KANASTABLE_NBROWS 17
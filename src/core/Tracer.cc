@@ -0,0 +1,237 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/Tracer.h"
+#include "sqlite/Profiler.h"
+
+#include <QtDebug>
+#include <QCoreApplication>
+#include <QThread>
+#include <QThreadStorage>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QMap>
+#include <QFile>
+#include <QTextStream>
+
+QAtomicInt Tracer::_enabled(0);
+
+/// Number of events kept per thread
+#define TRACE_BUFFER_SIZE 16384
+
+struct TraceEvent
+{
+	const char *name;
+	qint64 start;
+	qint64 end;
+	int tid;
+};
+
+/**
+ * Ring buffer of events, only written by the thread it is given to.
+ * Readers copy the events and then drop those that may have been
+ * overwritten while they were copied.
+ */
+struct TraceBuffer
+{
+	QVector<TraceEvent> events;
+	QAtomicInteger<quint64> written;
+	/// Whether a thread is using this buffer
+	bool inUse;
+
+	TraceBuffer() : events(TRACE_BUFFER_SIZE), written(0), inUse(true) {}
+};
+
+/**
+ * Buffers are kept after their thread exits, so its events can still be
+ * exported, and given to the next thread that needs one.
+ */
+struct TraceRegistry
+{
+	QMutex mutex;
+	QList<TraceBuffer *> buffers;
+	QMap<int, QString> threadNames;
+	int nextTid;
+
+	TraceRegistry() : nextTid(1) {}
+
+	static TraceRegistry &instance()
+	{
+		static TraceRegistry registry;
+		return registry;
+	}
+};
+
+/// Per-thread tracing state, deleted by QThreadStorage when the thread exits
+struct TraceThread
+{
+	TraceBuffer *buffer;
+	int tid;
+
+	TraceThread() : buffer(0), tid(0) {}
+	~TraceThread()
+	{
+		TraceRegistry &registry(TraceRegistry::instance());
+		QMutexLocker lock(&registry.mutex);
+		if (buffer) buffer->inUse = false;
+	}
+};
+
+static QThreadStorage<TraceThread *> _traceThreads;
+
+static TraceThread *currentTraceThread()
+{
+	if (_traceThreads.hasLocalData()) return _traceThreads.localData();
+
+	TraceThread *thread = new TraceThread();
+	TraceRegistry &registry(TraceRegistry::instance());
+	QThread *qthread = QThread::currentThread();
+	QMutexLocker lock(&registry.mutex);
+	foreach (TraceBuffer *buffer, registry.buffers) if (!buffer->inUse) {
+		buffer->inUse = true;
+		thread->buffer = buffer;
+		break;
+	}
+	if (!thread->buffer) {
+		thread->buffer = new TraceBuffer();
+		registry.buffers << thread->buffer;
+	}
+	thread->tid = registry.nextTid++;
+	QString name(qthread->objectName());
+	if (name.isEmpty()) {
+		if (QCoreApplication::instance() && qthread == QCoreApplication::instance()->thread()) name = "UI thread";
+		else name = QString("%1 %2").arg(qthread->metaObject()->className()).arg(thread->tid);
+	}
+	registry.threadNames[thread->tid] = name;
+	lock.unlock();
+	_traceThreads.setLocalData(thread);
+	return thread;
+}
+
+struct TraceClock
+{
+	QElapsedTimer timer;
+	TraceClock() { timer.start(); }
+};
+
+static const QElapsedTimer &traceClock()
+{
+	static TraceClock clock;
+	return clock.timer;
+}
+
+/// Records the prepare and step durations reported by the SQLite module
+static void traceSQLite(const char *stage, qint64 duration)
+{
+	if (!Tracer::enabled()) return;
+	qint64 end = Tracer::now();
+	Tracer::record(stage, end - duration, end);
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+	// Start the clock before any event can be recorded
+	traceClock();
+	_enabled.store(enabled ? 1 : 0);
+	SQLite::QueryProfiler::setTraceHandler(enabled ? &traceSQLite : 0);
+}
+
+qint64 Tracer::now()
+{
+	return traceClock().nsecsElapsed();
+}
+
+void Tracer::record(const char *name, qint64 start, qint64 end)
+{
+	TraceThread *thread = currentTraceThread();
+	TraceBuffer *buffer = thread->buffer;
+	quint64 index = buffer->written.load();
+	TraceEvent &event = buffer->events[index % TRACE_BUFFER_SIZE];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	event.tid = thread->tid;
+	buffer->written.storeRelease(index + 1);
+}
+
+void Tracer::clear()
+{
+	TraceRegistry &registry(TraceRegistry::instance());
+	QMutexLocker lock(&registry.mutex);
+	// Clearing a buffer while its thread writes into it could keep a
+	// half-written event at worst, which is fine for a debugging tool
+	foreach (TraceBuffer *buffer, registry.buffers) buffer->written.storeRelease(0);
+}
+
+/// Escapes str for use in a JSON string
+static QString jsonString(const QString &str)
+{
+	QString ret(str);
+	ret.replace('\\', "\\\\").replace('"', "\\\"");
+	return ret;
+}
+
+bool Tracer::exportTrace(const QString &file)
+{
+	QList<TraceEvent> events;
+	TraceRegistry &registry(TraceRegistry::instance());
+	QMap<int, QString> threadNames;
+	{
+		QMutexLocker lock(&registry.mutex);
+		threadNames = registry.threadNames;
+		foreach (TraceBuffer *buffer, registry.buffers) {
+			quint64 written = buffer->written.loadAcquire();
+			quint64 first = written > TRACE_BUFFER_SIZE ? written - TRACE_BUFFER_SIZE : 0;
+			QList<TraceEvent> copied;
+			for (quint64 i = first; i < written; i++) copied << buffer->events[i % TRACE_BUFFER_SIZE];
+			// Drop the events that have been overwritten during the copy,
+			// including the one that may be being written
+			quint64 after = buffer->written.loadAcquire();
+			quint64 overwritten = after + 1 > TRACE_BUFFER_SIZE ? after + 1 - TRACE_BUFFER_SIZE : 0;
+			if (overwritten > first) copied = copied.mid(qMin<quint64>(overwritten - first, copied.size()));
+			events << copied;
+		}
+	}
+
+	QFile f(file);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		qWarning("Cannot write trace to %s: %s", f.fileName().toLocal8Bit().constData(), f.errorString().toLocal8Bit().constData());
+		return false;
+	}
+	QTextStream out(&f);
+	out.setCodec("UTF-8");
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	// Thread names, so the threads are labelled in the viewer
+	for (QMap<int, QString>::const_iterator it = threadNames.constBegin(); it != threadNames.constEnd(); ++it) {
+		if (!first) out << ",\n";
+		first = false;
+		out << QString("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%1,\"args\":{\"name\":\"%2\"}}").arg(it.key()).arg(jsonString(it.value()));
+	}
+	// Timestamps are in microseconds
+	foreach (const TraceEvent &event, events) {
+		if (!first) out << ",\n";
+		first = false;
+		out << QString("{\"name\":\"%1\",\"ph\":\"X\",\"pid\":1,\"tid\":%2,\"ts\":%3,\"dur\":%4}").arg(jsonString(event.name)).arg(event.tid).arg(event.start / 1000.0, 0, 'f', 3).arg((event.end - event.start) / 1000.0, 0, 'f', 3);
+	}
+	out << "\n]}\n";
+	out.flush();
+	return f.error() == QFile::NoError;
+}
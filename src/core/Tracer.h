@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_TRACER_H
+#define __CORE_TRACER_H
+
+#include <QAtomicInt>
+#include <QString>
+
+/**
+ * Records the duration of scoped stages (query building, query steps,
+ * entry loading, painting...) for inspection in chrome://tracing or
+ * Perfetto.
+ *
+ * Each thread records into its own fixed-size ring buffer, so recording
+ * takes no lock and only the latest events of each thread are kept.
+ * Nothing is recorded unless tracing is enabled, in which case a traced
+ * scope costs a single test of a flag.
+ *
+ * Names must be string literals, since only their address is recorded.
+ */
+class Tracer
+{
+private:
+	static QAtomicInt _enabled;
+
+public:
+	static bool enabled() { return _enabled.load(); }
+	static void setEnabled(bool enabled);
+
+	/// Current time on the tracing clock, in nanoseconds
+	static qint64 now();
+	/// Records an event of the current thread, start and end from now()
+	static void record(const char *name, qint64 start, qint64 end);
+
+	/// Drops all the recorded events
+	static void clear();
+	/**
+	 * Writes the recorded events of all threads into file, using the
+	 * Chrome trace event format. Returns false if the file cannot be
+	 * written.
+	 */
+	static bool exportTrace(const QString &file);
+};
+
+/**
+ * Records the time between its construction and destruction under the
+ * given name, if tracing is enabled. Use it through TRACE_SCOPE.
+ */
+class TraceScope
+{
+private:
+	const char *_name;
+	qint64 _start;
+
+public:
+	TraceScope(const char *name) : _name(name), _start(Tracer::enabled() ? Tracer::now() : -1) {}
+	~TraceScope() { if (_start >= 0) Tracer::record(_name, _start, Tracer::now()); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
+
+#endif
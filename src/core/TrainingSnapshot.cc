@@ -0,0 +1,110 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TrainingSnapshot.h"
+#include "core/Database.h"
+#include "sqlite/Query.h"
+
+#include <QRandomGenerator>
+#include <QtDebug>
+
+void TrainingSnapshot::clear()
+{
+	_entries = QVector<EntryRef>();
+	_weights = QVector<quint32>();
+	_totalWeight = 0;
+	_drawn = 0;
+	_ahead.clear();
+}
+
+bool TrainingSnapshot::loadQuery(const QString &queryString, EntryType type, Bias bias)
+{
+	clear();
+	// The query must see the latest training results
+	DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	if (!query.exec(queryString)) {
+		qWarning() << "Error executing training query:" << query.lastError().message();
+		return false;
+	}
+	// Index 0 of the Fenwick tree is unused
+	if (bias != QueryOrder) _weights << 0;
+	int scoreColumn(type ? 1 : 2);
+	while (query.next()) {
+		if (type) _entries << EntryRef(type, query.valueUInt(0));
+		else _entries << EntryRef(query.valueInt(0), query.valueUInt(1));
+		if (bias == QueryOrder) continue;
+		quint32 w(1);
+		if (bias == ScoreBias) w = 101 - qBound(0, query.valueInt(scoreColumn), 100);
+		_weights << w;
+		_totalWeight += w;
+	}
+	// Turn the weights into a Fenwick tree in linear time
+	for (int i = 1; i < _weights.size(); i++) {
+		int parent(i + (i & -i));
+		if (parent < _weights.size()) _weights[parent] += _weights[i];
+	}
+	return true;
+}
+
+quint32 TrainingSnapshot::weight(int index) const
+{
+	// Difference of the prefix sums up to index + 1 and index
+	int i(index + 1);
+	quint32 res(_weights[i]);
+	int stop(i - (i & -i));
+	for (i--; i > stop; i -= (i & -i)) res -= _weights[i];
+	return res;
+}
+
+void TrainingSnapshot::addWeight(int index, qint32 delta)
+{
+	for (int i = index + 1; i < _weights.size(); i += (i & -i)) _weights[i] += delta;
+	_totalWeight += delta;
+}
+
+int TrainingSnapshot::find(quint32 value) const
+{
+	// Index of the entry whose cumulated weight range contains value
+	int pos(0);
+	int step(1);
+	while (step * 2 < _weights.size()) step *= 2;
+	for (; step > 0; step /= 2) {
+		if (pos + step < _weights.size() && _weights[pos + step] <= value) {
+			pos += step;
+			value -= _weights[pos];
+		}
+	}
+	return pos;
+}
+
+EntryRef TrainingSnapshot::draw()
+{
+	if (_drawn >= _entries.size()) return EntryRef();
+	if (_weights.isEmpty()) return _entries[_drawn++];
+	if (_totalWeight == 0) return EntryRef();
+	int index(find(QRandomGenerator::global()->bounded(_totalWeight)));
+	addWeight(index, -(qint32)weight(index));
+	_drawn++;
+	return _entries[index];
+}
+
+QList<EntryRef> TrainingSnapshot::peek(int count)
+{
+	while (_ahead.size() < count && _drawn < _entries.size()) _ahead << draw();
+	return _ahead.mid(0, count);
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_TRAININGSNAPSHOT_H
+#define __CORE_TRAININGSNAPSHOT_H
+
+#include "core/EntriesCache.h"
+
+#include <QVector>
+#include <QList>
+#include <QString>
+
+/**
+ * In-memory snapshot of the entries to train during a session.
+ *
+ * The query selecting the entries is run once when the session starts and
+ * its results are copied into the snapshot, so picking the next entry does
+ * not need to touch the database nor to keep a statement running for the
+ * whole duration of the session. Training results are still written
+ * through Entry::train().
+ *
+ * Entries are picked randomly without replacement. With ScoreBias, the
+ * chances of an entry to be picked are proportional to 101 - its score,
+ * like the range of the values biased_random() used to sort them by. The
+ * weights are kept in a Fenwick tree, so loading is linear and picking an
+ * entry is O(log n) instead of having SQLite evaluate and sort the whole
+ * training set. With QueryOrder, entries are simply returned in order,
+ * e.g. by due date.
+ */
+class TrainingSnapshot
+{
+public:
+	/// QueryOrder picks the entries in the order of the query
+	typedef enum { NoBias, ScoreBias, QueryOrder } Bias;
+
+private:
+	QVector<EntryRef> _entries;
+	/// Fenwick tree of the weights of the entries not picked yet
+	QVector<quint32> _weights;
+	quint32 _totalWeight;
+	/// Number of entries drawn, including the ones in _ahead
+	int _drawn;
+	/// Entries drawn by peek() and not returned by next() yet
+	QList<EntryRef> _ahead;
+
+	bool loadQuery(const QString &query, EntryType type, Bias bias);
+	quint32 weight(int index) const;
+	void addWeight(int index, qint32 delta);
+	int find(quint32 value) const;
+	EntryRef draw();
+
+public:
+	TrainingSnapshot() : _totalWeight(0), _drawn(0) {}
+
+	/**
+	 * Replaces the snapshot by the results of query, which must return
+	 * the type, id and score of the entries as its three first columns
+	 * (the score is only used with ScoreBias and may be null). Returns
+	 * false and leaves the snapshot empty if the query failed.
+	 */
+	bool load(const QString &query, Bias bias) { return loadQuery(query, 0, bias); }
+	/**
+	 * Same as above, for queries which only return the id and score of
+	 * entries of the given type.
+	 */
+	bool loadType(const QString &query, EntryType type, Bias bias) { return loadQuery(query, type, bias); }
+	void clear();
+
+	int size() const { return _entries.size(); }
+	/// Number of entries already returned by next()
+	int position() const { return _drawn - _ahead.size(); }
+	bool atEnd() const { return _ahead.isEmpty() && _drawn >= _entries.size(); }
+	/// Returns an invalid reference if all the entries have been picked
+	EntryRef next() { return _ahead.isEmpty() ? draw() : _ahead.takeFirst(); }
+	/**
+	 * Returns the (at most) count entries next() will return next, e.g.
+	 * to load them in advance.
+	 */
+	QList<EntryRef> peek(int count);
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TrainingStatistics.h"
+#include "core/Database.h"
+#include "sqlite/Query.h"
+
+#include <QDateTime>
+#include <QtEndian>
+#include <QtDebug>
+
+qint64 TrainingStatistics::today()
+{
+	return QDateTime::currentSecsSinceEpoch() / 86400;
+}
+
+void TrainingStatistics::encode(const Event &event, char *data)
+{
+	qToLittleEndian<quint32>(event.entry.id(), data);
+	data[4] = event.entry.type();
+	data[5] = event.success;
+	data[6] = event.score;
+	data[7] = 0;
+	qToLittleEndian<quint32>(event.time, data + 8);
+}
+
+TrainingStatistics::Event TrainingStatistics::decode(const char *data)
+{
+	Event event;
+	event.entry = EntryRef((quint8)data[4], qFromLittleEndian<quint32>(data));
+	event.success = data[5] != 0;
+	event.score = data[6];
+	event.time = qFromLittleEndian<quint32>(data + 8);
+	return event;
+}
+
+void TrainingStatistics::recordAnswer(const EntryRef &entry, bool success, quint8 score)
+{
+	qint64 now(QDateTime::currentSecsSinceEpoch());
+	Event event;
+	event.entry = entry;
+	event.success = success;
+	event.score = score;
+	event.time = now % 86400;
+	QByteArray data(eventSize, 0);
+	encode(event, data.data());
+
+	qint64 day(now / 86400);
+	DatabaseWriter::enqueue(entry.type(), entry.id(), DatabaseWriter::AddEventsDay, QVariantList() << day);
+	DatabaseWriter::enqueue(entry.type(), entry.id(), DatabaseWriter::AppendEvents, QVariantList() << data << day);
+}
+
+QMap<qint64, TrainingStatistics::Day> TrainingStatistics::daily(qint64 from, qint64 to, EntryType type)
+{
+	QMap<qint64, Day> ret;
+	DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	QString qString(QString("select day, sum(nbTrained), sum(nbSuccess) from trainingDaily where day between %1 and %2").arg(from).arg(to));
+	if (type) qString += QString(" and type = %1").arg(type);
+	qString += " group by day";
+	if (!query.exec(qString)) {
+		qCritical() << "Error executing query: " << query.lastError().message();
+		return ret;
+	}
+	while (query.next()) {
+		Day &day = ret[query.valueInt64(0)];
+		day.nbTrained = query.valueUInt(1);
+		day.nbSuccess = query.valueUInt(2);
+	}
+	return ret;
+}
+
+QVector<quint32> TrainingStatistics::scoreHistogram(qint64 day, EntryType type)
+{
+	QVector<quint32> ret(scoreBuckets, 0);
+	DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	// The histogram is the sum of all the changes up to that day
+	QString qString(QString("select bucket, sum(delta) from trainingScores where day <= %1").arg(day));
+	if (type) qString += QString(" and type = %1").arg(type);
+	qString += " group by bucket";
+	if (!query.exec(qString)) {
+		qCritical() << "Error executing query: " << query.lastError().message();
+		return ret;
+	}
+	while (query.next()) {
+		int bucket = query.valueInt(0);
+		qint64 count = query.valueInt64(1);
+		if (bucket >= 0 && bucket < scoreBuckets && count > 0) ret[bucket] = count;
+	}
+	return ret;
+}
+
+QList<TrainingStatistics::Event> TrainingStatistics::events(qint64 day)
+{
+	QList<Event> ret;
+	DatabaseWriter::flush();
+	SQLite::Query query(Database::connection());
+	if (!query.exec(QString("select events from trainingEvents where day = %1").arg(day))) {
+		qCritical() << "Error executing query: " << query.lastError().message();
+		return ret;
+	}
+	if (!query.next()) return ret;
+	QByteArray data(query.valueBlobRaw(0));
+	for (int i = 0; i + eventSize <= data.size(); i += eventSize) ret << decode(data.constData() + i);
+	return ret;
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_TRAININGSTATISTICS_H
+#define __CORE_TRAININGSTATISTICS_H
+
+#include "core/EntriesCache.h"
+
+#include <QVector>
+#include <QMap>
+
+/**
+ * Statistics of the study progress over time.
+ *
+ * Every answer is appended to a log made of one row per day, holding the
+ * answers of that day as an array of fixed-size records. Appending only
+ * grows the blob of the current day, and a day of intensive training only
+ * takes a few kilobytes. The log is the history from which any statistic
+ * can be computed again; the ones displayed over long periods are rolled
+ * up by triggers of the training table as training data is written:
+ * trainingDaily counts the answers of each day, and trainingScores the
+ * changes of the score histogram.
+ *
+ * Days are counted in UTC since the epoch, like the due dates.
+ */
+class TrainingStatistics
+{
+public:
+	/// An answer of the log
+	struct Event
+	{
+		EntryRef entry;
+		bool success;
+		/// Score of the entry after the answer
+		quint8 score;
+		/// Seconds since the beginning of the day
+		quint32 time;
+	};
+
+	/// Answers of a day
+	struct Day
+	{
+		quint32 nbTrained;
+		quint32 nbSuccess;
+
+		Day() : nbTrained(0), nbSuccess(0) {}
+		/// Proportion of successful answers, or 0 if nothing was trained
+		float retention() const { return nbTrained ? (float)nbSuccess / nbTrained : 0.0f; }
+	};
+
+	/// Size of an event in the log
+	static const int eventSize = 12;
+	/// Number of buckets of the score histogram, 10 points of score each
+	static const int scoreBuckets = 10;
+
+	static qint64 today();
+
+	/**
+	 * Appends the answer to entry to the log of today. The event is
+	 * written by DatabaseWriter with the training data of the entry.
+	 */
+	static void recordAnswer(const EntryRef &entry, bool success, quint8 score);
+	/**
+	 * Returns the answers of the days between from and to included,
+	 * for entries of the given type or of all types if type is 0. Days
+	 * without any answer are left out.
+	 */
+	static QMap<qint64, Day> daily(qint64 from, qint64 to, EntryType type = 0);
+	/**
+	 * Returns the number of entries of the given type (or of all types)
+	 * in each bucket of scores at the end of day.
+	 */
+	static QVector<quint32> scoreHistogram(qint64 day, EntryType type = 0);
+	/// Returns the answers logged on day, in order
+	static QList<Event> events(qint64 day);
+
+	/// Encodes an event into the eventSize bytes pointed by data
+	static void encode(const Event &event, char *data);
+	static Event decode(const char *data);
+};
+
+#endif
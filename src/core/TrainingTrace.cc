@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TrainingTrace.h"
+#include "core/Paths.h"
+
+#include <QDir>
+#include <QTimer>
+#include <QDateTime>
+#include <QtDebug>
+
+TrainingTrace *TrainingTrace::_instance = 0;
+PreferenceItem<bool> TrainingTrace::enabled("training", "traceLatency", false);
+
+TrainingTrace::TrainingTrace() : _trainer(0), _answerTime(0), _active(false), _record(0), _renderedRecord(0)
+{
+	_log.setFileName(logFile());
+	if (!_log.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		qWarning("Cannot open training trace %s", _log.fileName().toUtf8().constData());
+		return;
+	}
+	if (_log.size() == 0) _log.write("# trainer answer(ms) written queried loaded rendered (us)\n");
+}
+
+TrainingTrace::~TrainingTrace()
+{
+	if (_active) writeRecord();
+}
+
+QString TrainingTrace::logFile()
+{
+	return QDir(userProfile()).absoluteFilePath("training-trace.log");
+}
+
+void TrainingTrace::writeRecord()
+{
+	_active = false;
+	if (!_log.isOpen()) return;
+	QString line(QString("%1 %2").arg(_trainer).arg(_answerTime));
+	for (int i = 0; i < StagesCount; i++) line += QString(" %1").arg(_stages[i]);
+	line += "\n";
+	_log.write(line.toLatin1());
+	// Traces are used to understand hiccups, possibly followed by a crash
+	_log.flush();
+}
+
+void TrainingTrace::answered(char trainer)
+{
+	if (!enabled.value()) return;
+	if (!_instance) _instance = new TrainingTrace();
+	if (_instance->_active) _instance->writeRecord();
+	_instance->_trainer = trainer;
+	_instance->_answerTime = QDateTime::currentMSecsSinceEpoch();
+	for (int i = 0; i < StagesCount; i++) _instance->_stages[i] = -1;
+	_instance->_active = true;
+	++_instance->_record;
+	_instance->_timer.start();
+}
+
+void TrainingTrace::mark(Stage stage)
+{
+	if (!_instance || !_instance->_active) return;
+	_instance->_stages[stage] = _instance->_timer.nsecsElapsed() / 1000;
+}
+
+void TrainingTrace::renderPending()
+{
+	if (!_instance || !_instance->_active) return;
+	_instance->_renderedRecord = _instance->_record;
+	// Layout and paint events are posted, so are processed before the timer fires
+	QTimer::singleShot(0, _instance, SLOT(onRendered()));
+}
+
+void TrainingTrace::onRendered()
+{
+	// Another answer may have been given meanwhile
+	if (!_active || _renderedRecord != _record) return;
+	mark(Rendered);
+	writeRecord();
+}
+
+void TrainingTrace::cleanup()
+{
+	delete _instance;
+	_instance = 0;
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_TRAININGTRACE_H
+#define __CORE_TRAININGTRACE_H
+
+#include "core/Preferences.h"
+
+#include <QObject>
+#include <QFile>
+#include <QElapsedTimer>
+
+/**
+ * Opt-in recorder of the latency of the trainers. For every answer, the
+ * time at which each stage that follows it completes is measured, from the
+ * press of the answer button to the display of the next entry:
+ *
+ * # Written: the training data of the entry has been recorded,
+ * # Queried: the next entry to train has been picked,
+ * # Loaded: the next entry is available,
+ * # Rendered: the next entry has been laid out and painted.
+ *
+ * Records are appended to logFile(), one line per answer: the trainer
+ * (Y for the yes/no trainer, R for the reading practice), the time of the
+ * answer in milliseconds since the epoch, then the time of each stage in
+ * microseconds since the answer, or -1 if the stage did not happen.
+ * analyzetrainingtrace.py prints the latency percentiles of each stage.
+ *
+ * Must only be used from the GUI thread.
+ */
+class TrainingTrace : public QObject
+{
+	Q_OBJECT
+public:
+	typedef enum { Written = 0, Queried, Loaded, Rendered, StagesCount } Stage;
+
+private:
+	static TrainingTrace *_instance;
+
+	QFile _log;
+	QElapsedTimer _timer;
+	char _trainer;
+	qint64 _answerTime;
+	qint64 _stages[StagesCount];
+	/// Whether a record is in progress
+	bool _active;
+	/// Number of the record in progress, and of the one waiting to be rendered
+	quint32 _record, _renderedRecord;
+
+	TrainingTrace();
+	void writeRecord();
+
+private slots:
+	void onRendered();
+
+public:
+	virtual ~TrainingTrace();
+
+	static PreferenceItem<bool> enabled;
+	static QString logFile();
+
+	/// Starts the record of an answer, writing the previous one if it was not complete
+	static void answered(char trainer);
+	/// Records the completion of stage for the current answer
+	static void mark(Stage stage);
+	/// Records the Rendered stage once the pending events, i.e. layout and
+	/// paint, have been processed, and writes the record
+	static void renderPending();
+	/// Writes the record in progress, if any
+	static void cleanup();
+};
+
+#endif
@@ -56,6 +56,8 @@ bool skipTag(QXmlStreamReader& reader, const QStringRef &tag);
 #define COMMENT if (reader.tokenType() == QXmlStreamReader::Comment) {
 #define DOCUMENT_TYPE_DEFINITION if (reader.tokenType() == QXmlStreamReader::DTD) {
 #define TEXT reader.text().toString()
+// Same as TEXT, but refers to the reader's buffer and is only valid until the next token
+#define TEXTREF reader.text()
 #define DONE continue; }
 
 #define __TAG_PRE(tag) if (reader.tokenType() == QXmlStreamReader::StartElement && reader.name() == tag) {
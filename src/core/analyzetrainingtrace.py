@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+#  Copyright (C) 2008  Alexandre Courbot
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Prints the latency percentiles of each stage of the training traces
+recorded by TrainingTrace (enable the traceLatency setting of the training
+section of the configuration), per trainer.
+
+The latency of a stage is the time between the completion of the previous
+stage that happened and its own completion, the first stage starting when
+the answer button is pressed. The total is the time between the answer and
+the display of the next entry."""
+
+import argparse, os, sys
+
+STAGES = ['written', 'queried', 'loaded', 'rendered']
+TRAINERS = {'Y': 'Yes/no trainer', 'R': 'Reading practice'}
+PERCENTILES = [50, 90, 99]
+
+def percentile(values, p):
+	"""Nearest-rank percentile of the sorted list values."""
+	rank = max(1, -(-len(values) * p // 100))
+	return values[rank - 1]
+
+def parse(path, since):
+	"""Returns the latencies of each stage, in microseconds, by trainer."""
+	ret = {}
+	with open(path) as f:
+		for line in f:
+			fields = line.split()
+			if not fields or fields[0].startswith('#'): continue
+			if len(fields) != 2 + len(STAGES): continue
+			if int(fields[1]) < since: continue
+			stages = ret.setdefault(fields[0], dict((s, []) for s in STAGES + ['total']))
+			previous = 0
+			for stage, value in zip(STAGES, map(int, fields[2:])):
+				if value < 0: continue
+				stages[stage].append(value - previous)
+				previous = value
+			if int(fields[-1]) >= 0: stages['total'].append(int(fields[-1]))
+	return ret
+
+def main():
+	parser = argparse.ArgumentParser(description = __doc__, formatter_class = argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('trace', help = 'trace file, i.e. training-trace.log of the user profile directory')
+	parser.add_argument('--since', type = int, default = 0, help = 'only consider the answers given after this time, in milliseconds since the epoch')
+	args = parser.parse_args()
+
+	if not os.path.exists(args.trace): sys.exit("%s not found" % args.trace)
+
+	traces = parse(args.trace, args.since)
+	if not traces:
+		print("No answers recorded")
+		return 0
+	header = "%-10s %7s" % ('stage', 'count') + ''.join(" %8s" % ("p%d" % p) for p in PERCENTILES) + " %8s" % 'max'
+	for trainer in sorted(traces):
+		print("%s (latencies in ms)" % TRAINERS.get(trainer, trainer))
+		print(header)
+		for stage in STAGES + ['total']:
+			values = sorted(traces[trainer][stage])
+			if not values: continue
+			print("%-10s %7d" % (stage, len(values)) + ''.join(" %8.1f" % (percentile(values, p) / 1000.0) for p in PERCENTILES) + " %8.1f" % (values[-1] / 1000.0))
+		print()
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+#  Copyright (C) 2008  Alexandre Courbot
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Runs the dictionary builders on pinned inputs and records, for each of
+them, the time taken by every phase, wall time, peak RSS and the size of
+the databases produced, as JSON. If sqlite3_analyzer is found, the page
+statistics of each database are recorded as well.
+
+The inputs directory must contain JMdict (or JMdict.gz), kanjidic2.xml(.gz),
+kanjivg.xml(.gz) and tatoeba/{sentences,links,jpn_indices}.csv. Their
+checksums are recorded so that results of different inputs are not
+compared.
+
+With --baseline, results are compared against a previous run and the
+script fails if a builder got slower, bigger or produced bigger databases
+by more than the tolerance."""
+
+import argparse, hashlib, json, os, re, shutil, subprocess, sys, tempfile, time
+
+PHASE_RE = re.compile(r'^(?:(\w+): )?(.+?) (?:took|done in) (\d+) ms$')
+ANALYZER_RE = re.compile(r'^([A-Za-z][^.]*?)\.{2,}\s*([0-9.]+)')
+
+def findInput(inputs, names):
+	for name in names:
+		path = os.path.join(inputs, name)
+		if os.path.exists(path): return path
+	sys.exit("None of %s found in %s" % (', '.join(names), inputs))
+
+def checksum(path):
+	h = hashlib.sha256()
+	with open(path, 'rb') as f:
+		for block in iter(lambda: f.read(1 << 20), b''): h.update(block)
+	return h.hexdigest()
+
+def run(command, cwd):
+	"""Runs command, returning its phases, wall time and peak RSS."""
+	start = time.time()
+	proc = subprocess.Popen(command, cwd = cwd, stdout = subprocess.DEVNULL, stderr = subprocess.PIPE, universal_newlines = True)
+	phases = {}
+	for line in proc.stderr:
+		m = PHASE_RE.match(line.strip())
+		if not m: continue
+		phase = m.group(2) if not m.group(1) else "%s: %s" % (m.group(1), m.group(2))
+		phases[phase] = phases.get(phase, 0) + int(m.group(3))
+	# wait4() gives the resources used by this child only
+	_, status, usage = os.wait4(proc.pid, 0)
+	proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+	if proc.returncode != 0: sys.exit("%s failed with status %d" % (command[0], proc.returncode))
+	return {
+		'phases_ms': phases,
+		'wall_ms': int((time.time() - start) * 1000),
+		# ru_maxrss is in kilobytes on Linux, bytes on macOS
+		'peak_rss_kb': usage.ru_maxrss // 1024 if sys.platform == 'darwin' else usage.ru_maxrss,
+	}
+
+def analyze(analyzer, db):
+	"""Returns the statistics of the whole file from sqlite3_analyzer."""
+	out = subprocess.run([analyzer, db], stdout = subprocess.PIPE, stderr = subprocess.DEVNULL, universal_newlines = True).stdout
+	stats = {}
+	for line in out.splitlines():
+		# The report for the whole file comes before the per-table ones
+		if line.startswith('*** Page counts'): break
+		m = ANALYZER_RE.match(line)
+		if m: stats[m.group(1).strip()] = float(m.group(2))
+	return stats
+
+def databases(outDir, analyzer, names):
+	ret = {}
+	for name in sorted(os.listdir(outDir)):
+		if name not in names: continue
+		path = os.path.join(outDir, name)
+		ret[name] = { 'size': os.path.getsize(path) }
+		if analyzer: ret[name]['pages'] = analyze(analyzer, path)
+	return ret
+
+def compare(results, baseline, tolerance):
+	"""Prints the changes from baseline and returns whether none of them
+	is a regression."""
+	if baseline.get('inputs') != results['inputs']:
+		print("Baseline was measured on different inputs, not comparing")
+		return True
+	ok = True
+	def check(what, old, new):
+		nonlocal ok
+		if not old: return
+		change = (new - old) / float(old)
+		flag = ''
+		if change > tolerance:
+			flag = '  REGRESSION'
+			ok = False
+		print("%-50s %12d -> %12d (%+.1f%%)%s" % (what, old, new, change * 100, flag))
+	for builder, res in sorted(results['builders'].items()):
+		old = baseline['builders'].get(builder)
+		if not old: continue
+		check("%s wall ms" % builder, old['wall_ms'], res['wall_ms'])
+		check("%s peak RSS kB" % builder, old['peak_rss_kb'], res['peak_rss_kb'])
+		for phase, ms in sorted(res['phases_ms'].items()):
+			if phase in old['phases_ms']: check("%s %s ms" % (builder, phase), old['phases_ms'][phase], ms)
+		for db, stats in sorted(res['databases'].items()):
+			if db in old['databases']: check("%s size" % db, old['databases'][db]['size'], stats['size'])
+	return ok
+
+def main():
+	parser = argparse.ArgumentParser(description = __doc__, formatter_class = argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('--inputs', required = True, help = 'directory of the pinned inputs')
+	parser.add_argument('--source', required = True, help = 'source directory of Tagaini Jisho')
+	parser.add_argument('--jmdict', required = True, help = 'build_jmdict_db executable')
+	parser.add_argument('--kanjidic2', required = True, help = 'build_kanji_db executable')
+	parser.add_argument('--tatoeba', required = True, help = 'build_tatoeba_db executable')
+	parser.add_argument('--output', required = True, help = 'JSON file to write the results to')
+	parser.add_argument('--baseline', help = 'results of a previous run to compare against')
+	parser.add_argument('--tolerance', type = float, default = 0.15, help = 'relative increase reported as a regression (default 0.15)')
+	args = parser.parse_args()
+
+	inputs = os.path.abspath(args.inputs)
+	jmdict = findInput(inputs, ['JMdict', 'JMdict.gz'])
+	kanjidic2 = findInput(inputs, ['kanjidic2.xml', 'kanjidic2.xml.gz'])
+	kanjivg = findInput(inputs, ['kanjivg.xml', 'kanjivg.xml.gz'])
+	tatoeba = [findInput(inputs, ['tatoeba/%s.csv' % f]) for f in ('sentences', 'links', 'jpn_indices')]
+	analyzer = shutil.which('sqlite3_analyzer')
+
+	results = { 'inputs': {}, 'builders': {} }
+	for path in [jmdict, kanjidic2, kanjivg] + tatoeba:
+		results['inputs'][os.path.relpath(path, inputs)] = checksum(path)
+
+	work = tempfile.mkdtemp(prefix = 'bench_builders')
+	try:
+		# The builders all take their data files from a source directory,
+		# which gets the pinned Tatoeba exports
+		srcDir = os.path.join(work, 'src')
+		os.makedirs(os.path.join(srcDir, '3rdparty'))
+		os.symlink(os.path.join(os.path.abspath(args.source), 'src'), os.path.join(srcDir, 'src'))
+		os.symlink(os.path.join(inputs, 'tatoeba'), os.path.join(srcDir, '3rdparty', 'tatoeba'))
+		# A fresh output directory, so no build is skipped or reuses
+		# previous data
+		outDir = os.path.join(work, 'out')
+		os.makedirs(outDir)
+
+		builds = [
+			('build_jmdict_db', [args.jmdict, jmdict, srcDir, outDir], ['jmdict.db', 'jmdict-en.db']),
+			('build_kanji_db', [args.kanjidic2, kanjidic2, kanjivg, srcDir, outDir], ['kanjidic2.db', 'kanjidic2-en.db']),
+			# Needs jmdict.db
+			('build_tatoeba_db', [args.tatoeba, srcDir, outDir], ['tatoeba.db']),
+		]
+		for name, command, dbs in builds:
+			print("Running %s" % name)
+			res = run([os.path.abspath(command[0])] + command[1:], work)
+			res['databases'] = databases(outDir, analyzer, dbs)
+			results['builders'][name] = res
+	finally:
+		shutil.rmtree(work)
+
+	with open(args.output, 'w') as f:
+		json.dump(results, f, indent = 2, sort_keys = True)
+	print("Results written to %s" % args.output)
+
+	if args.baseline:
+		with open(args.baseline) as f:
+			if not compare(results, json.load(f), args.tolerance): return 1
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+#  Copyright (C) 2008  Alexandre Courbot
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Runs search_benchmark on a workload of recorded searches and records its
+percentiles by kind of search, with the SQLite library and compile options
+they were measured with, as JSON.
+
+With --baseline, results are compared against a previous run, e.g. one made
+with SQLITE_TUNED_BUILD disabled, and the script fails if a kind of search
+got slower by more than the tolerance. Runs on different dictionaries are
+not compared."""
+
+import argparse, json, subprocess, sys
+
+MEASURES = [('complete_ms', 'p50'), ('complete_ms', 'p90'), ('first_result_ms', 'p50'), ('first_result_ms', 'p90')]
+
+def run(benchmark, workload, runs):
+	"""Runs benchmark, returning its header and its statistics by kind."""
+	proc = subprocess.run([benchmark, '--runs=%d' % runs, workload], stdout = subprocess.PIPE, universal_newlines = True)
+	if proc.returncode != 0: sys.exit("%s failed with status %d" % (benchmark, proc.returncode))
+	results = { 'kinds': {} }
+	for line in proc.stdout.splitlines():
+		if not line.startswith('{'): continue
+		stats = json.loads(line)
+		if 'kind' in stats: results['kinds'][stats.pop('kind')] = stats
+		else: results['header'] = stats
+	return results
+
+def compare(results, baseline, tolerance):
+	"""Prints the changes from baseline and returns whether none of them
+	is a regression."""
+	header, old = results.get('header', {}), baseline.get('header', {})
+	if header.get('dataStamp') != old.get('dataStamp'):
+		print("Baseline was measured on different dictionaries, not comparing")
+		return True
+	if header.get('sqliteOptions') != old.get('sqliteOptions'):
+		print("SQLite %s (%s) -> %s (%s)" % (old.get('sqlite'), old.get('sqliteOptions'), header.get('sqlite'), header.get('sqliteOptions')))
+	ok = True
+	for kind, stats in sorted(results['kinds'].items()):
+		oldStats = baseline['kinds'].get(kind)
+		if not oldStats: continue
+		for measure, pct in MEASURES:
+			before, after = oldStats[measure][pct], stats[measure][pct]
+			if not before: continue
+			change = (after - before) / before
+			flag = ''
+			if change > tolerance:
+				flag = '  REGRESSION'
+				ok = False
+			print("%-40s %10.2f -> %10.2f (%+.1f%%)%s" % ("%s %s %s" % (kind, measure, pct), before, after, change * 100, flag))
+	return ok
+
+def main():
+	parser = argparse.ArgumentParser(description = __doc__, formatter_class = argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('--benchmark', required = True, help = 'search_benchmark executable')
+	parser.add_argument('--workload', required = True, help = 'file of recorded searches')
+	parser.add_argument('--runs', type = int, default = 3, help = 'number of times the workload is replayed (default 3)')
+	parser.add_argument('--output', required = True, help = 'JSON file to write the results to')
+	parser.add_argument('--baseline', help = 'results of a previous run to compare against')
+	parser.add_argument('--tolerance', type = float, default = 0.15, help = 'relative increase reported as a regression (default 0.15)')
+	args = parser.parse_args()
+
+	results = run(args.benchmark, args.workload, args.runs)
+	with open(args.output, 'w') as f:
+		json.dump(results, f, indent = 2, sort_keys = True)
+	print("Results written to %s" % args.output)
+
+	if args.baseline:
+		with open(args.baseline) as f:
+			if not compare(results, json.load(f), args.tolerance): return 1
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -18,14 +18,34 @@
 #include "sqlite/Connection.h"
 #include "sqlite/Query.h"
 #include "sqlite/SQLite.h"
+#include "sqlite/Compression.h"
+#include "sqlite/FTS.h"
 #include "core/TextTools.h"
+#include "core/GzipDevice.h"
+#include "core/BuilderStatistics.h"
+#include "core/BuilderInputs.h"
+#include "core/ItemsQueue.h"
 #include "core/jmdict/JMdictParser.h"
 #include "core/jmdict/JMdictEntry.h"
+#include "core/jmdict/JMdictPack.h"
+#include "core/jmdict/JMdictMeaningVectors.h"
 
 #include <QStringList>
 #include <QByteArray>
 #include <QFile>
 #include <QDir>
+#include <QThread>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QMap>
+#include <QHash>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #include <QtDebug>
 
@@ -36,16 +56,82 @@
 #define EXEC_STMT(query, stmt) if (!query.exec(stmt)) { qCritical(" EXEC_STMT failed, line %d: %s", __LINE__, query.lastError().message().toUtf8().data()); return false; }
 #define ASSERT(cond) { if (!cond) { qCritical("%s: assert condition failed, line %d", __FILE__, __LINE__); return false; } }
 
+/// Senses are added to the glosses of display rows until they reach this
+/// number of characters, which is more than a results row can show
+#define DISPLAY_GLOSSES_LENGTH 256
+
+/// Number of entries the parser hands to the database writers at once
+#define ITEMS_BATCH_SIZE 256
+/// Number of batches that can wait for a writer before the parser blocks
+#define MAX_QUEUED_BATCHES 16
+
+class JMdictDBWriter;
+
+/**
+ * Parses JMdict on the calling thread, and writes the main and language
+ * databases from one writer thread per database. Each writer also
+ * finalizes its database once all entries are written, so indexing,
+ * compression and VACUUM of the databases run in parallel.
+ */
 class JMdictDBParser : public JMdictParser
 {
 public:
-	JMdictDBParser(const QStringList &languages, QString sourceDirectory, QString destinationDirectory) : JMdictParser(languages) {
+	/// Prepared queries inserting into a language database
+	class LanguageQueries
+	{
+	public:
+		SQLite::Query insertGlossText;
+		SQLite::Query insertGloss;
+		SQLite::Query insertGlosses;
+		SQLite::Query insertDisplayGlosses;
+		SQLite::Query removeGlosses;
+		SQLite::Query removeDisplayGlosses;
+		SQLite::Query insertStaleEntry;
+		/// glossText docids are given explicitly from this one. Its
+		/// content is deleted after building, so FTS would reuse the
+		/// docids of the stale index entries of an updated database.
+		qint64 firstNewDocid;
+		qint64 nextDocid;
+		/// Entries whose glosses blob must be compressed when updating
+		QList<qint64> updatedIds;
+
+		LanguageQueries() : firstNewDocid(0), nextDocid(0) {}
+	};
+
+	JMdictDBParser(const QStringList &languages, QString sourceDirectory, QString destinationDirectory, bool updateDatabases) : JMdictParser(languages) {
 		srcDir = sourceDirectory;
 		dstDir = destinationDirectory;
+		update = updateDatabases;
+		changedCount = 0;
+		nextKanjiDocid = nextKanaDocid = 0;
+		ftsVersion = SQLite::FTS::FTS4;
 	}
+	virtual ~JMdictDBParser() { qDeleteAll(removeMainQueries); }
+	/// Stored in the info table, see inputsChecksum()
+	QString inputsChecksum;
+	/// Version of the FTS tables to create. When updating, the one of
+	/// the existing databases
+	SQLite::FTS::Version ftsVersion;
+
 	virtual bool onItemParsed(const JMdictItem &entry);
+	bool insertMainItem(const JMdictItem &entry);
+	bool insertLanguageItem(const JMdictItem &entry, const QString &lang);
+	/// Remove the rows of an entry when updating the databases
+	bool removeMainItem(int id);
+	bool removeLanguageItem(int id, const QString &lang);
+	/// Starts the writer threads, once all databases are ready
+	void startWriters();
+	/// Hands the remaining entries to the writers and waits for them
+	bool finishWriters();
+	/// Run by the writer thread of handle
+	bool writeDatabase(const QString &handle, ItemsQueue<JMdictItem> &queue);
+	bool finalizeMain();
+	bool finalizeLanguage(const QString &lang);
 	bool createMainDatabase();
 	bool createMainTables();
+	bool prepareMainUpdate();
+	bool createMainStagingTables();
+	bool flushMainStagingTables();
 	bool createMainIndexes();
 	bool finalizeSensesTable();
 	bool finalizeMainDatabase();
@@ -54,51 +140,121 @@ public:
 	bool fillMainInfoTable();
 	bool createLanguagesDatabases();
 	bool createLanguagesTables();
-	bool createLanguagesIndexes();
-	bool finalizeLanguagesDatabases();
+	bool prepareLanguagesUpdate();
+	bool createLanguagesStagingTables();
+	bool flushLanguageStagingTables(const QString &lang);
+	bool createLanguageIndexes(const QString &lang);
 	bool prepareLanguagesQueries();
-	bool clearLanguagesQueries();
-	bool fillLanguagesInfoTable();
+	bool clearLanguageQueries(const QString &lang);
+	bool fillLanguageInfoTable(const QString &lang);
+	bool compressLanguageGlosses(const QString &lang);
 	bool parseJMFs(const QStringList &supportedLanguages);
+	/// Applies the JMF files and JLPT levels to existing databases
+	bool applyOverlays();
+	bool applyJMFOverlay(const QString &fName, const QString &lang);
+	bool applyJMFEntry(const QString &lang, int id, const QMap<int, QStringList> &replacements, SQLite::CompressionDictionary &compressor);
 	bool parseJMF(const QString &fname, const QString &lang);
 	bool insertJLPTLevel(const QString& fName, int level);
 	bool insertJLPTLevels();
+	bool computeRelevance();
+	bool createKanjiWordsTable();
 	bool populateEntitiesTable();
+	void sortEntities();
 private:
+	/// All opened before the writers start, and only looked up afterwards
 	QMap<QString, SQLite::Connection> connections;
 	QString dstDir, srcDir;
+	/// Whether the existing databases of dstDir are updated in place
+	bool update;
+	/// Content hashes of the entries of the database being updated.
+	/// Only read once the writers have started.
+	QHash<int, quint64> oldHashes;
+	/// Entries met by the parser
+	QSet<int> seenIds;
+	/// Entries that are no longer part of JMdict, set before the
+	/// writers are told that no more entries will come
+	QList<int> removedIds;
+	int changedCount;
 	SQLite::Query insertEntryQuery;
+	SQLite::Query insertEntryHashQuery;
+	QList<SQLite::Query *> removeMainQueries;
 	SQLite::Query insertKanjiTextQuery;
 	SQLite::Query insertKanjiQuery;
 	SQLite::Query insertKanjiCharQuery;
+	SQLite::Query insertKanjiBigramQuery;
+	SQLite::Query insertKanaBigramQuery;
 	SQLite::Query insertKanaTextQuery;
 	SQLite::Query insertKanaQuery;
 	SQLite::Query insertSenseQuery;
 	SQLite::Query insertJLPTQuery;
-	QMap<QString, SQLite::Query> insertGlossTextQueries;
-	QMap<QString, SQLite::Query> insertGlossQueries;
-	QMap<QString, SQLite::Query> insertGlossesQueries;
+	SQLite::Query insertDisplayRowQuery;
+	/// Docids of the text tables, which are loaded from staging tables
+	qint64 nextKanjiDocid, nextKanaDocid;
+	QMap<QString, LanguageQueries> languageQueries;
 	// lang ; id ; pri ; str
 	QMap<QString, QMap<int, QMap<int, QStringList> > > jmf;
+	QList<JMdictItem> batch;
+	QList<JMdictDBWriter *> writers;
+
+	/// Returns the replacement glosses for a sense, or 0. Does not
+	/// modify jmf so that writers can call it concurrently.
+	const QStringList *jmfGlosses(const QString &lang, int id, int sense) const;
+	/// Hash of everything an entry contributes to the databases
+	quint64 entryHash(const JMdictItem &entry) const;
 
 	bool openDatabase(QString databaseName, QString handle);
+	static bool insertBigrams(SQLite::Query &query, const QString &text, qint64 docid);
 	bool closeDatabase(QString handle);
 };
 
-bool JMdictDBParser::onItemParsed(const JMdictItem &entry)
+class JMdictDBWriter : public QThread
+{
+private:
+	JMdictDBParser *_parser;
+	QString _handle;
+	bool _success;
+
+protected:
+	virtual void run()
+	{
+		_success = _parser->writeDatabase(_handle, queue);
+		if (!_success) queue.discard();
+	}
+
+public:
+	ItemsQueue<JMdictItem> queue;
+
+	JMdictDBWriter(JMdictDBParser *parser, const QString &handle) : _parser(parser), _handle(handle), _success(false), queue(MAX_QUEUED_BATCHES) {}
+	bool success() const { return _success; }
+};
+
+bool JMdictDBParser::insertBigrams(SQLite::Query &query, const QString &text, qint64 docid)
+{
+	foreach (quint32 bigram, TextTools::bigrams(text)) {
+		BIND(query, bigram);
+		BIND(query, docid);
+		EXEC(query);
+	}
+	return true;
+}
+
+bool JMdictDBParser::insertMainItem(const JMdictItem &entry)
 {
 	// Insert writings
 	int kanjiCount = 0;
 	quint8 idx = 0;
 	foreach (const JMdictKanjiWritingItem &kWriting, entry.kanji) {
+		qint64 rowId = nextKanjiDocid++;
+		BIND(insertKanjiTextQuery, rowId);
 		BIND(insertKanjiTextQuery, kWriting.writing);
+		BIND(insertKanjiTextQuery, TextTools::reversed(kWriting.writing));
 		EXEC(insertKanjiTextQuery);
-		qint64 rowId = insertKanjiTextQuery.lastInsertId();
 		BIND(insertKanjiQuery, entry.id);
 		BIND(insertKanjiQuery, idx);
 		BIND(insertKanjiQuery, rowId);
 		AUTO_BIND(insertKanjiQuery, kWriting.frequency, 0);
 		EXEC(insertKanjiQuery);
+		ASSERT(insertBigrams(insertKanjiBigramQuery, kWriting.writing, rowId));
 
 		// Insert kanji mappings
 		for (int i = 0; i < kWriting.writing.size(); ) {
@@ -121,9 +277,12 @@ bool JMdictDBParser::onItemParsed(const JMdictItem &entry)
 	// Insert readings
 	idx = 0;
 	foreach (const JMdictKanaReadingItem &kReading, entry.kana) {
+		qint64 rowId = nextKanaDocid++;
+		BIND(insertKanaTextQuery, rowId);
 		BIND(insertKanaTextQuery, kReading.reading);
+		BIND(insertKanaTextQuery, TextTools::reversed(kReading.reading));
+		BIND(insertKanaTextQuery, TextTools::fuzzyKana(kReading.reading));
 		EXEC(insertKanaTextQuery);
-		qint64 rowId = insertKanaTextQuery.lastInsertId();
 		BIND(insertKanaQuery, entry.id);
 		BIND(insertKanaQuery, idx);
 		BIND(insertKanaQuery, rowId);
@@ -133,14 +292,12 @@ bool JMdictDBParser::onItemParsed(const JMdictItem &entry)
 		foreach (quint8 res, kReading.restrictedTo) restrictedToList << QString::number(res);
 		AUTO_BIND(insertKanaQuery, restrictedToList.join(","), "");
 		EXEC(insertKanaQuery);
+		ASSERT(insertBigrams(insertKanaBigramQuery, kReading.reading, rowId));
 		++idx;
 	}
 
-	// Insert senses and glosses
+	// Insert senses
 	idx = 0;
-	QMap<QString, QStringList> allGlosses;
-	foreach (const QString &lang, languages)
-		allGlosses[lang] = QStringList();
 	foreach (const JMdictSenseItem &sense, entry.senses) {
 		BIND(insertSenseQuery, entry.id);
 		BIND(insertSenseQuery, idx);
@@ -155,40 +312,272 @@ bool JMdictDBParser::onItemParsed(const JMdictItem &entry)
 		foreach (quint8 res, sense.restrictedToKana) restrictedToList << QString::number(res);
 		AUTO_BIND(insertSenseQuery, restrictedToList.join(","), "");
 		EXEC(insertSenseQuery);
-
-
-		// Insert the gloss for all languages (search table)
-		foreach (const QString &lang, languages) {
-			// Do we have a replacement for the glosses?
-			const QStringList &glosses = jmf[lang][entry.id][idx].isEmpty() ?
-				sense.gloss[lang] : jmf[lang][entry.id][idx];
-			if (glosses.isEmpty()) {
-				allGlosses[lang] << QString();
-				continue;
-			}
-			allGlosses[lang] << glosses.join("\n");
-			BIND(insertGlossTextQueries[lang], glosses.join(", "));
-			EXEC(insertGlossTextQueries[lang]);
-			BIND(insertGlossQueries[lang], entry.id);
-			BIND(insertGlossQueries[lang], insertGlossTextQueries[lang].lastInsertId());
-			EXEC(insertGlossQueries[lang]);
-		}
 		++idx;
 	}
-	// For every language, insert all glosses of an entry (load table)
-	foreach (const QString &lang, languages) {
-		QString all(allGlosses[lang].join("\n\n"));
-		if (all.split("\n", QString::SkipEmptyParts).empty()) continue;
-		BIND(insertGlossesQueries[lang], entry.id);
-		BIND(insertGlossesQueries[lang], qCompress(all.toUtf8(), 9));
-		EXEC(insertGlossesQueries[lang])
-	}
+
+	// Insert display row
+	QStringList writings, readings;
+	foreach (const JMdictKanjiWritingItem &kWriting, entry.kanji) writings << kWriting.writing;
+	foreach (const JMdictKanaReadingItem &kReading, entry.kana) readings << kReading.reading;
+	BIND(insertDisplayRowQuery, entry.id);
+	BIND(insertDisplayRowQuery, writings.join("\n"));
+	BIND(insertDisplayRowQuery, readings.join("\n"));
+	EXEC(insertDisplayRowQuery);
 
 	// Insert entry
 	BIND(insertEntryQuery, entry.id);
 	AUTO_BIND(insertEntryQuery, entry.frequency, 0);
 	BIND(insertEntryQuery, kanjiCount);
 	EXEC(insertEntryQuery);
+
+	BIND(insertEntryHashQuery, entry.id);
+	BIND(insertEntryHashQuery, entryHash(entry));
+	EXEC(insertEntryHashQuery);
+	return true;
+}
+
+bool JMdictDBParser::removeMainItem(int id)
+{
+	foreach (SQLite::Query *query, removeMainQueries) {
+		BIND((*query), id);
+		EXEC((*query));
+	}
+	return true;
+}
+
+const QStringList *JMdictDBParser::jmfGlosses(const QString &lang, int id, int sense) const
+{
+	QMap<QString, QMap<int, QMap<int, QStringList> > >::const_iterator langIt(jmf.constFind(lang));
+	if (langIt == jmf.constEnd()) return 0;
+	QMap<int, QMap<int, QStringList> >::const_iterator idIt(langIt->constFind(id));
+	if (idIt == langIt->constEnd()) return 0;
+	QMap<int, QStringList>::const_iterator senseIt(idIt->constFind(sense));
+	if (senseIt == idIt->constEnd() || senseIt->isEmpty()) return 0;
+	return &senseIt.value();
+}
+
+quint64 JMdictDBParser::entryHash(const JMdictItem &entry) const
+{
+	QByteArray data;
+	QDataStream stream(&data, QIODevice::WriteOnly);
+	stream << entry.id << entry.frequency;
+	foreach (const JMdictKanjiWritingItem &kWriting, entry.kanji)
+		stream << kWriting.writing << kWriting.frequency;
+	foreach (const JMdictKanaReadingItem &kReading, entry.kana)
+		stream << kReading.reading << kReading.noKanji << kReading.frequency << kReading.restrictedTo;
+	int idx = 0;
+	foreach (const JMdictSenseItem &sense, entry.senses) {
+		stream << sense.pos << sense.misc << sense.dialect << sense.field << sense.restrictedToKanji << sense.restrictedToKana;
+		foreach (const QString &lang, languages) {
+			const QStringList *replacement = jmfGlosses(lang, entry.id, idx);
+			stream << lang << (replacement ? *replacement : sense.gloss.value(lang));
+		}
+		++idx;
+	}
+	return (quint64(qHash(data, 0)) << 32) | qHash(data, 0x9e3779b9);
+}
+
+/// Display rows only need the first senses, uncompressed
+static QString displayGlosses(const QStringList &allGlosses)
+{
+	QStringList display;
+	int length = 0;
+	foreach (const QString &glosses, allGlosses) {
+		if (length >= DISPLAY_GLOSSES_LENGTH) break;
+		display << glosses;
+		length += glosses.size();
+	}
+	return display.join("\n\n");
+}
+
+bool JMdictDBParser::insertLanguageItem(const JMdictItem &entry, const QString &lang)
+{
+	LanguageQueries &queries = languageQueries[lang];
+
+	// Insert the glosses of every sense (search table)
+	QStringList allGlosses;
+	int idx = 0;
+	foreach (const JMdictSenseItem &sense, entry.senses) {
+		// Do we have a replacement for the glosses?
+		const QStringList *replacement = jmfGlosses(lang, entry.id, idx++);
+		const QStringList glosses(replacement ? *replacement : sense.gloss.value(lang));
+		if (glosses.isEmpty()) {
+			allGlosses << QString();
+			continue;
+		}
+		allGlosses << glosses.join("\n");
+		qint64 docid = queries.nextDocid++;
+		BIND(queries.insertGlossText, docid);
+		BIND(queries.insertGlossText, glosses.join(", "));
+		EXEC(queries.insertGlossText);
+		BIND(queries.insertGloss, entry.id);
+		BIND(queries.insertGloss, docid);
+		EXEC(queries.insertGloss);
+	}
+
+	// Insert all glosses of the entry (load table)
+	QString all(allGlosses.join("\n\n"));
+	if (all.split("\n", QString::SkipEmptyParts).empty()) return true;
+	BIND(queries.insertGlosses, entry.id);
+	// Compressed once all entries are known, see compressLanguageGlosses()
+	BIND(queries.insertGlosses, all.toUtf8());
+	EXEC(queries.insertGlosses)
+	if (update) queries.updatedIds << entry.id;
+
+	BIND(queries.insertDisplayGlosses, entry.id);
+	BIND(queries.insertDisplayGlosses, displayGlosses(allGlosses));
+	EXEC(queries.insertDisplayGlosses);
+	return true;
+}
+
+bool JMdictDBParser::removeLanguageItem(int id, const QString &lang)
+{
+	LanguageQueries &queries = languageQueries[lang];
+	BIND(queries.removeGlosses, id);
+	EXEC(queries.removeGlosses);
+	BIND(queries.removeDisplayGlosses, id);
+	EXEC(queries.removeDisplayGlosses);
+	// gloss has no index on id, so its rows are removed at once when
+	// finalizing
+	BIND(queries.insertStaleEntry, id);
+	EXEC(queries.insertStaleEntry);
+	return true;
+}
+
+bool JMdictDBParser::onItemParsed(const JMdictItem &entry)
+{
+	// Unchanged entries need not be written again
+	if (update) {
+		seenIds << entry.id;
+		QHash<int, quint64>::const_iterator it(oldHashes.constFind(entry.id));
+		if (it != oldHashes.constEnd() && it.value() == entryHash(entry)) return true;
+		++changedCount;
+	}
+	batch << entry;
+	if (batch.size() >= ITEMS_BATCH_SIZE) {
+		foreach (JMdictDBWriter *writer, writers) writer->queue.push(batch);
+		batch.clear();
+	}
+	return true;
+}
+
+void JMdictDBParser::startWriters()
+{
+	writers << new JMdictDBWriter(this, "main");
+	foreach (const QString &lang, languages) writers << new JMdictDBWriter(this, lang);
+	foreach (JMdictDBWriter *writer, writers) writer->start();
+}
+
+bool JMdictDBParser::finishWriters()
+{
+	bool success = true;
+	if (update) {
+		foreach (int id, oldHashes.keys()) if (!seenIds.contains(id)) removedIds << id;
+		// Hash order changes between runs
+		std::sort(removedIds.begin(), removedIds.end());
+		qDebug("%d entries added or changed, %d removed", changedCount, removedIds.size());
+	}
+	foreach (JMdictDBWriter *writer, writers) {
+		if (!batch.isEmpty()) writer->queue.push(batch);
+		writer->queue.close();
+	}
+	batch.clear();
+	foreach (JMdictDBWriter *writer, writers) {
+		writer->wait();
+		success &= writer->success();
+		delete writer;
+	}
+	writers.clear();
+	return success;
+}
+
+/// Prints how long the phase of handle that just ended took, and starts
+/// timing the next one
+static void phaseDone(QElapsedTimer &timer, const QString &handle, const char *phase)
+{
+	qDebug("%s: %s took %lld ms", handle.toLatin1().data(), phase, timer.restart());
+}
+
+bool JMdictDBParser::writeDatabase(const QString &handle, ItemsQueue<JMdictItem> &queue)
+{
+	bool isMain = handle == "main";
+	bool success = true;
+	QElapsedTimer timer;
+	timer.start();
+	QList<JMdictItem> items;
+	// The queue is discarded after an error, so the parser never blocks
+	while (success && queue.pop(items)) {
+		foreach (const JMdictItem &entry, items) {
+			if (update && oldHashes.contains(entry.id) && !(isMain ? removeMainItem(entry.id) : removeLanguageItem(entry.id, handle))) {
+				success = false;
+				break;
+			}
+			if (!(isMain ? insertMainItem(entry) : insertLanguageItem(entry, handle))) {
+				success = false;
+				break;
+			}
+		}
+	}
+	if (!success) return false;
+	// removedIds is set before the queue is closed
+	foreach (int id, removedIds) ASSERT((isMain ? removeMainItem(id) : removeLanguageItem(id, handle)));
+	phaseDone(timer, handle, "writing entries");
+	return isMain ? finalizeMain() : finalizeLanguage(handle);
+}
+
+bool JMdictDBParser::finalizeMain()
+{
+	QElapsedTimer timer;
+	timer.start();
+	if (update) {
+		SQLite::Query query(&connections["main"]);
+		// The tables below have no index on their entry, so the rows of
+		// the removed entries are deleted in one pass
+		EXEC_STMT(query, "delete from facets where id in (select id from temp.staleEntries)");
+		EXEC_STMT(query, "delete from kanjiBigrams where docid in (select docid from temp.staleKanji)");
+		EXEC_STMT(query, "delete from kanaBigrams where docid in (select docid from temp.staleKana)");
+		EXEC_STMT(query, "delete from jlpt");
+		phaseDone(timer, "main", "removing stale rows");
+	}
+	ASSERT(flushMainStagingTables());
+	phaseDone(timer, "main", "loading text tables");
+	fillMainInfoTable();
+	insertJLPTLevels();
+	computeRelevance();
+	// Existing rows already use the bits of the updated database
+	if (!update) sortEntities();
+	populateEntitiesTable();
+	ASSERT(finalizeSensesTable());
+	ASSERT(createKanjiWordsTable());
+	phaseDone(timer, "main", "senses, facets and relevance");
+	if (!update) createMainIndexes();
+	clearMainQueries();
+	phaseDone(timer, "main", "indexing");
+	ASSERT(finalizeMainDatabase());
+	phaseDone(timer, "main", "analyzing and vacuuming");
+	return true;
+}
+
+bool JMdictDBParser::finalizeLanguage(const QString &lang)
+{
+	QElapsedTimer timer;
+	timer.start();
+	if (update) {
+		SQLite::Query query(&connections[lang]);
+		ASSERT(query.prepare("delete from gloss where id in (select id from temp.staleEntries) and docid < ?"));
+		BIND(query, languageQueries[lang].firstNewDocid);
+		EXEC(query);
+		phaseDone(timer, lang, "removing stale rows");
+	}
+	ASSERT(flushLanguageStagingTables(lang));
+	phaseDone(timer, lang, "loading text tables");
+	fillLanguageInfoTable(lang);
+	ASSERT(compressLanguageGlosses(lang));
+	phaseDone(timer, lang, "compressing glosses");
+	createLanguageIndexes(lang);
+	clearLanguageQueries(lang);
+	ASSERT(closeDatabase(lang));
+	phaseDone(timer, lang, "analyzing and vacuuming");
 	return true;
 }
 
@@ -219,16 +608,90 @@ bool JMdictDBParser::insertJLPTLevels()
 	return true;
 }
 
+bool JMdictDBParser::computeRelevance()
+{
+	SQLite::Query query(&connections["main"]);
+	// Results are sorted by JLPT level first, then frequency. Merging
+	// both into one column lets results be sorted on a single key
+	EXEC_STMT(query, "update entries set relevance = coalesce((select level from jlpt where jlpt.id = entries.id), 0) * 65536 + coalesce(frequency, 0)");
+	return true;
+}
+
+/**
+ * Appends value to data as a varint.
+ */
+static void appendVarint(QByteArray &data, quint64 value)
+{
+	while (value >= 0x80) {
+		data += (char)((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	data += (char)value;
+}
+
+/**
+ * Stores, for each kanji, the JMDICT_KANJI_WORDS most relevant words
+ * using it, so the kanji details do not need to look for them among all
+ * the entries. Each word is written as its id followed by the first misc
+ * column of its first sense, as varints, so the words can be filtered
+ * according to the user settings. Words usually written in kana are left
+ * out. Decoded by Kanjidic2EntryFormatter::getQueryUsedInWordsSql().
+ */
+bool JMdictDBParser::createKanjiWordsTable()
+{
+	SQLite::Query query(&connections["main"]);
+	SQLite::Query insertQuery(&connections["main"]);
+	EXEC_STMT(query, "delete from kanjiWords");
+	quint64 ukMask = 0;
+	EXEC_STMT(query, "select bitShift from miscEntities where name = 'uk'");
+	if (query.next() && query.valueInt(0) < 64) ukMask = (quint64)1 << query.valueInt(0);
+	ASSERT(insertQuery.prepare("insert into kanjiWords values(?, ?)"));
+	EXEC_STMT(query, QString("select kanjiChar.kanji, entries.id, senses.misc0 from kanjiChar "
+		"join entries on entries.id = kanjiChar.id "
+		"join senses on senses.id = entries.id and senses.priority = 0 and senses.misc0 & %1 = 0 "
+		"where kanjiChar.priority = 0 "
+		"order by kanjiChar.kanji, entries.relevance desc, entries.id").arg(ukMask));
+	qint64 kanji = -1;
+	QByteArray words;
+	QSet<qint64> ids;
+	while (true) {
+		bool hasNext = query.next();
+		if (!words.isEmpty() && (!hasNext || query.valueInt64(0) != kanji)) {
+			BIND(insertQuery, kanji);
+			BIND(insertQuery, words);
+			EXEC(insertQuery);
+			words.clear();
+			ids.clear();
+		}
+		if (!hasNext) break;
+		kanji = query.valueInt64(0);
+		qint64 id = query.valueInt64(1);
+		// A word can use the same kanji several times
+		if (ids.size() >= JMDICT_KANJI_WORDS || ids.contains(id)) continue;
+		ids << id;
+		appendVarint(words, id);
+		appendVarint(words, query.valueInt64(2));
+	}
+	return true;
+}
+
 bool JMdictDBParser::openDatabase(QString databaseName, QString handle)
 {
 	QString dbFile = QDir(dstDir).absoluteFilePath(QString(databaseName));
 	QFile dst(dbFile);
 	SQLite::Connection &connection = connections[handle];
-	if (dst.exists() && !dst.remove()) {
+	if (update) {
+		if (!dst.exists()) {
+			qCritical("Error - cannot update missing database %s!", dbFile.toLocal8Bit().data());
+			return false;
+		}
+	}
+	else if (dst.exists() && !dst.remove()) {
 		qCritical("Error - cannot remove existing destination file!");
 		return false;
 	}
-	if (!connection.connect(dbFile, SQLite::Connection::JournalInFile)) {
+	// Updated databases must survive a failed update
+	if (!connection.connect(dbFile, update ? SQLite::Connection::JournalInFile : SQLite::Connection::BulkLoad)) {
 		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
 		return false;
 	}
@@ -241,6 +704,9 @@ bool JMdictDBParser::closeDatabase(QString handle)
 	SQLite::Connection &connection = connections[handle];
 	ASSERT(connection.exec("ANALYZE"));
 	ASSERT(connection.commit());
+	// Do not depend on the default page size of the SQLite we are linked
+	// against, VACUUM applies it when rebuilding the file
+	ASSERT(connection.exec("pragma page_size = 4096"));
 	ASSERT(connection.exec("VACUUM"));
 	QFile(connection.dbFileName()).setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther);
 	ASSERT(connection.close());
@@ -250,28 +716,65 @@ bool JMdictDBParser::closeDatabase(QString handle)
 bool JMdictDBParser::prepareMainQueries()
 {
 #define PREPQUERY(query, text) query.useWith(&connections["main"]); ASSERT(query.prepare(text))
-	PREPQUERY(insertEntryQuery, "insert into entries values(?, ?, ?)");
-	PREPQUERY(insertKanjiTextQuery, "insert into kanjiText values(?)");
+	PREPQUERY(insertEntryQuery, "insert into entries(id, frequency, kanjiCount) values(?, ?, ?)");
+	PREPQUERY(insertEntryHashQuery, "insert or replace into entryHashes values(?, ?)");
+	PREPQUERY(insertKanjiTextQuery, "insert into temp.kanjiStaging values(?, ?, ?)");
 	PREPQUERY(insertKanjiQuery, "insert into kanji values(?, ?, ?, ?)");
 	PREPQUERY(insertKanjiCharQuery, "insert into kanjiChar values(?, ?, ?)");
-	PREPQUERY(insertKanaTextQuery, "insert into kanaText values(?)");
+	PREPQUERY(insertKanjiBigramQuery, "insert into temp.kanjiBigramsStaging values(?, ?)");
+	PREPQUERY(insertKanaBigramQuery, "insert into temp.kanaBigramsStaging values(?, ?)");
+	PREPQUERY(insertKanaTextQuery, "insert into temp.kanaStaging values(?, ?, ?, ?)");
 	PREPQUERY(insertKanaQuery, "insert into kana values(?, ?, ?, ?, ?, ?)");
 	PREPQUERY(insertSenseQuery, "insert into sensesTMP values(?, ?, ?, ?, ?, ?, ?, ?)");
 	PREPQUERY(insertJLPTQuery, "insert or ignore into jlpt values(?, ?)");
+	PREPQUERY(insertDisplayRowQuery, "insert into displayRows values(?, ?, ?)");
 #undef PREPQUERY
+	if (update) {
+		// Stale docids and text rows are found through kanji and kana, so
+		// they are removed first
+		static const char *removeStatements[] = {
+			"insert or ignore into temp.staleEntries values(?1)",
+			"insert or ignore into temp.staleKanji select docid from kanji where id = ?1",
+			"insert or ignore into temp.staleKana select docid from kana where id = ?1",
+			"delete from kanjiText where rowid in (select docid from kanji where id = ?1)",
+			"delete from kanjiReverseText where rowid in (select docid from kanji where id = ?1)",
+			"delete from kanaText where rowid in (select docid from kana where id = ?1)",
+			"delete from kanaReverseText where rowid in (select docid from kana where id = ?1)",
+			"delete from kanaFuzzyText where rowid in (select docid from kana where id = ?1)",
+			"delete from kanji where id = ?1",
+			"delete from kana where id = ?1",
+			"delete from kanjiChar where id = ?1",
+			"delete from senses where id = ?1",
+			"delete from displayRows where id = ?1",
+			"delete from entries where id = ?1",
+			"delete from entryHashes where id = ?1",
+			0
+		};
+		for (int i = 0; removeStatements[i]; i++) {
+			SQLite::Query *query = new SQLite::Query(&connections["main"]);
+			removeMainQueries << query;
+			ASSERT(query->prepare(removeStatements[i]));
+		}
+	}
 	return true;
 }
 
 bool JMdictDBParser::clearMainQueries()
 {
 	insertEntryQuery.clear();
+	insertEntryHashQuery.clear();
+	qDeleteAll(removeMainQueries);
+	removeMainQueries.clear();
 	insertKanjiTextQuery.clear();
 	insertKanjiQuery.clear();
 	insertKanjiCharQuery.clear();
+	insertKanjiBigramQuery.clear();
+	insertKanaBigramQuery.clear();
 	insertKanaTextQuery.clear();
 	insertKanaQuery.clear();
 	insertSenseQuery.clear();
 	insertJLPTQuery.clear();
+	insertDisplayRowQuery.clear();
 	return true;
 }
 
@@ -283,33 +786,156 @@ bool JMdictDBParser::createMainDatabase()
 bool JMdictDBParser::createMainTables()
 {
 	SQLite::Query query(&connections["main"]);
-	EXEC_STMT(query, "create table info(version INT, JMdictVersion TEXT)");
+	EXEC_STMT(query, "create table info(version INT, JMdictVersion TEXT, inputsChecksum TEXT)");
 	EXEC_STMT(query, "create table posEntities(bitShift INTEGER PRIMARY KEY, name TEXT, description TEXT)");
 	EXEC_STMT(query, "create table miscEntities(bitShift INTEGER PRIMARY KEY, name TEXT, description TEXT)");
 	EXEC_STMT(query, "create table fieldEntities(bitShift INTEGER PRIMARY KEY, name TEXT, description TEXT)");
 	EXEC_STMT(query, "create table dialectEntities(bitShift INTEGER PRIMARY KEY, name TEXT, description TEXT)");
-	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, frequency SMALLINT, kanjiCount TINYINT)");
+	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, frequency SMALLINT, kanjiCount TINYINT, relevance INTEGER)");
 	EXEC_STMT(query, "create table kanji(id INTEGER SECONDARY KEY REFERENCES entries, priority TINYINT, docid INTEGER PRIMARY KEY, frequency TINYINT)");
-	EXEC_STMT(query, "create virtual table kanjiText using fts4(reading)");
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "kanjiText", SQLite::FTS::Simple, SQLite::FTS::Readings));
 	EXEC_STMT(query, "create table kana(id INTEGER SECONDARY KEY REFERENCES entries, priority TINYINT, docid INTEGER PRIMARY KEY, nokanji BOOLEAN, frequency TINYINT, restrictedTo TEXT)");
-	EXEC_STMT(query, "create virtual table kanaText using fts4(reading, TOKENIZE katakana)");
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "kanaText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
+	// Reversed readings, sharing the docids of the tables above so suffix
+	// searches can be run as prefix searches
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "kanjiReverseText", SQLite::FTS::Simple, SQLite::FTS::Readings));
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "kanaReverseText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
+	// Fuzzy keys of the readings, see TextTools::fuzzyKana(). Also sharing
+	// the docids of kana, so misspelled readings can be looked up
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "kanaFuzzyText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
 	// Temporary table until we figure out how many pos, misc,... columns we need
 	EXEC_STMT(query, "create table sensesTMP(id INTEGER SECONDARY KEY REFERENCES entries, priority TINYINT, pos TEXT, misc TEXT, dial TEXT, field TEXT, restrictedToKanji TEXT, restrictedToKana TEXT)");
 	EXEC_STMT(query, "create table kanjiChar(kanji INTEGER, id INTEGER SECONDARY KEY REFERENCES entries, priority INT)");
 	EXEC_STMT(query, "create table jlpt(id INTEGER PRIMARY KEY, level TINYINT)");
+	// Most relevant words using each kanji, see createKanjiWordsTable()
+	EXEC_STMT(query, "create table kanjiWords(kanji INTEGER PRIMARY KEY, words BLOB)");
+	// Writings and readings of entries ordered by priority and separated
+	// by newlines, to build results rows without joining the text tables
+	EXEC_STMT(query, "create table displayRows(id INTEGER PRIMARY KEY, writings TEXT, readings TEXT)");
+	// Entries having at least one sense with a given entity, clustered by
+	// facet and value so each facet value is a sorted range of ids. See
+	// JMdictFacet
+	EXEC_STMT(query, "create table facets(facet TINYINT, value SMALLINT, id INTEGER, PRIMARY KEY(facet, value, id)) WITHOUT ROWID");
+	// Bigrams of the readings, see TextTools::bigrams(). Used to find the
+	// candidates of searches starting with a wildcard, which cannot use
+	// the FTS indexes
+	EXEC_STMT(query, "create table kanjiBigrams(bigram INTEGER, docid INTEGER)");
+	EXEC_STMT(query, "create table kanaBigrams(bigram INTEGER, docid INTEGER)");
+	// Content hashes of the entries, see entryHash(). Lets the next
+	// version of JMdict only rewrite the entries that changed
+	EXEC_STMT(query, "create table entryHashes(id INTEGER PRIMARY KEY, hash INTEGER)");
+	return createMainStagingTables();
+}
+
+/**
+ * Readings and bigrams are first written to plain temporary tables, and
+ * loaded into their tables in one statement each once all entries are
+ * known. This avoids maintaining the FTS indexes row by row, and inserts
+ * bigrams in the order of their index.
+ */
+bool JMdictDBParser::createMainStagingTables()
+{
+	SQLite::Query query(&connections["main"]);
+	EXEC_STMT(query, "create temp table kanjiStaging(docid INTEGER PRIMARY KEY, reading TEXT, reversed TEXT)");
+	EXEC_STMT(query, "create temp table kanaStaging(docid INTEGER PRIMARY KEY, reading TEXT, reversed TEXT, fuzzy TEXT)");
+	EXEC_STMT(query, "create temp table kanjiBigramsStaging(bigram INTEGER, docid INTEGER)");
+	EXEC_STMT(query, "create temp table kanaBigramsStaging(bigram INTEGER, docid INTEGER)");
+	// When updating, new docids come after those of the existing rows
+	EXEC_STMT(query, "select coalesce(max(docid), 0) + 1 from kanji");
+	ASSERT(query.next());
+	nextKanjiDocid = query.valueInt64(0);
+	EXEC_STMT(query, "select coalesce(max(docid), 0) + 1 from kana");
+	ASSERT(query.next());
+	nextKanaDocid = query.valueInt64(0);
+	return true;
+}
+
+bool JMdictDBParser::flushMainStagingTables()
+{
+	SQLite::Query query(&connections["main"]);
+	EXEC_STMT(query, "insert into kanjiText(rowid, reading) select docid, reading from temp.kanjiStaging");
+	EXEC_STMT(query, "insert into kanjiReverseText(rowid, reading) select docid, reversed from temp.kanjiStaging");
+	EXEC_STMT(query, "insert into kanaText(rowid, reading) select docid, reading from temp.kanaStaging");
+	EXEC_STMT(query, "insert into kanaReverseText(rowid, reading) select docid, reversed from temp.kanaStaging");
+	EXEC_STMT(query, "insert into kanaFuzzyText(rowid, reading) select docid, fuzzy from temp.kanaStaging");
+	EXEC_STMT(query, "insert into kanjiBigrams select bigram, docid from temp.kanjiBigramsStaging order by bigram, docid");
+	EXEC_STMT(query, "insert into kanaBigrams select bigram, docid from temp.kanaBigramsStaging order by bigram, docid");
+	// Merge the index segments written by the inserts above
+	EXEC_STMT(query, "insert into kanjiText(kanjiText) values('optimize')");
+	EXEC_STMT(query, "insert into kanjiReverseText(kanjiReverseText) values('optimize')");
+	EXEC_STMT(query, "insert into kanaText(kanaText) values('optimize')");
+	EXEC_STMT(query, "insert into kanaReverseText(kanaReverseText) values('optimize')");
+	EXEC_STMT(query, "insert into kanaFuzzyText(kanaFuzzyText) values('optimize')");
+	EXEC_STMT(query, "drop table temp.kanjiStaging");
+	EXEC_STMT(query, "drop table temp.kanaStaging");
+	EXEC_STMT(query, "drop table temp.kanjiBigramsStaging");
+	EXEC_STMT(query, "drop table temp.kanaBigramsStaging");
 	return true;
 }
 
+/**
+ * Checks the database can be updated, and loads what the parser needs to
+ * only write changed entries. The bit shifts of entities must not change,
+ * so they are loaded before parsing and new entities come after them.
+ */
+bool JMdictDBParser::prepareMainUpdate()
+{
+	SQLite::Query query(&connections["main"]);
+	EXEC_STMT(query, "select version from info");
+	if (!query.next() || query.valueInt(0) != JMDICTDB_REVISION) {
+		qCritical("Error - the database to update has a different revision, please rebuild it");
+		return false;
+	}
+	EXEC_STMT(query, "select count(*) from sqlite_master where name = 'entryHashes'");
+	if (!query.next() || query.valueInt(0) == 0) {
+		qCritical("Error - the database to update has no entry hashes, please rebuild it");
+		return false;
+	}
+	if (!query.exec("select inputsChecksum from info")) {
+		qCritical("Error - the database to update has no inputs checksum, please rebuild it");
+		return false;
+	}
+	if (SQLite::FTS::databaseVersion(connections["main"], "main") != ftsVersion) {
+		qCritical("Error - the database to update has a different full-text index version, please rebuild it");
+		return false;
+	}
+
+	EXEC_STMT(query, "select id, hash from entryHashes");
+	while (query.next()) oldHashes[query.valueInt(0)] = query.valueUInt64(1);
+
+#define LOAD_ENTITIES(table, bitFields, count) \
+	EXEC_STMT(query, "select bitShift, name from " table); \
+	while (query.next()) { \
+		bitFields[query.valueString(1)] = query.valueInt(0); \
+		count = qMax(count, query.valueInt(0) + 1); \
+	}
+	LOAD_ENTITIES("posEntities", posBitFields, posBitFieldsCount);
+	LOAD_ENTITIES("miscEntities", miscBitFields, miscBitFieldsCount);
+	LOAD_ENTITIES("fieldEntities", fieldBitFields, fieldBitFieldsCount);
+	LOAD_ENTITIES("dialectEntities", dialBitFields, dialectBitFieldsCount);
+#undef LOAD_ENTITIES
+
+	EXEC_STMT(query, "create table sensesTMP(id INTEGER SECONDARY KEY REFERENCES entries, priority TINYINT, pos TEXT, misc TEXT, dial TEXT, field TEXT, restrictedToKanji TEXT, restrictedToKana TEXT)");
+	EXEC_STMT(query, "create temp table staleEntries(id INTEGER PRIMARY KEY)");
+	EXEC_STMT(query, "create temp table staleKanji(docid INTEGER PRIMARY KEY)");
+	EXEC_STMT(query, "create temp table staleKana(docid INTEGER PRIMARY KEY)");
+	return createMainStagingTables();
+}
+
 bool JMdictDBParser::createMainIndexes()
 {
 	SQLite::Query query(&connections["main"]);
 	EXEC_STMT(query, "create index idx_entries_frequency on entries(frequency)");
-	EXEC_STMT(query, "create index idx_kanji on kanji(id)");
-	EXEC_STMT(query, "create index idx_kana on kana(id)");
-	EXEC_STMT(query, "create index idx_senses on senses(id)");
+	EXEC_STMT(query, "create index idx_entries_relevance on entries(relevance)");
+	// Covering indexes, so the readings of an entry are found in
+	// priority order without visiting the tables
+	EXEC_STMT(query, "create index idx_kanji on kanji(id, priority, docid, frequency)");
+	EXEC_STMT(query, "create index idx_kana on kana(id, priority, docid, nokanji, frequency, restrictedTo)");
 	EXEC_STMT(query, "create index idx_kanjichar on kanjiChar(kanji)");
 	EXEC_STMT(query, "create index idx_kanjichar_id on kanjiChar(id)");
 	EXEC_STMT(query, "create index idx_jlpt on jlpt(level)");
+	EXEC_STMT(query, "create index idx_kanjiBigrams on kanjiBigrams(bigram, docid)");
+	EXEC_STMT(query, "create index idx_kanaBigrams on kanaBigrams(bigram, docid)");
 	return true;
 }
 
@@ -323,9 +949,9 @@ static QString entityString(const int count, const QString &entity, const QStrin
 	return l.join(", ");
 }
 
-static QVector<quint64> entityInsert(const QString &entities, const QHash<QString, quint16> &entityBitFields)
+static QVector<quint64> entityInsert(const QString &entities, const QHash<QString, quint16> &entityBitFields, int count)
 {
-	QVector<quint64> columns((entityBitFields.size() / 64) + 1, 0);
+	QVector<quint64> columns((count / 64) + 1, 0);
 
 	foreach (const QString &entity, entities.split(',', QString::SkipEmptyParts)) {
 		const int idx = entityBitFields[entity] / 64;
@@ -338,29 +964,43 @@ static QVector<quint64> entityInsert(const QString &entities, const QHash<QStrin
 	return columns;
 }
 
+static bool insertFacets(SQLite::Query &query, JMdictFacet facet, const QString &entities, const QHash<QString, quint16> &entityBitFields, qint64 id)
+{
+	foreach (const QString &entity, entities.split(',', QString::SkipEmptyParts)) {
+		BIND(query, (qint32)facet);
+		BIND(query, (qint32)entityBitFields[entity]);
+		BIND(query, id);
+		EXEC(query);
+	}
+	return true;
+}
+
 bool JMdictDBParser::finalizeSensesTable()
 {
 	SQLite::Query query(&connections["main"]);
 	SQLite::Query query2(&connections["main"]);
+	SQLite::Query facetsQuery(&connections["main"]);
 	int posCount, miscCount, dialCount, fieldCount;
 	QString posStr, miscStr, dialStr, fieldStr;
 
 	// First figure out how many 64-bit integer columns we need to encode the entities
-	posCount = posBitFields.size();
-	miscCount = miscBitFields.size();
-	dialCount = dialBitFields.size();
-	fieldCount = fieldBitFields.size();
+	posCount = posBitFieldsCount;
+	miscCount = miscBitFieldsCount;
+	dialCount = dialectBitFieldsCount;
+	fieldCount = fieldBitFieldsCount;
 
 	posStr = entityString(posCount, "pos", " INT");
 	miscStr = entityString(miscCount, "misc", " INT");
 	dialStr = entityString(dialCount, "dial", " INT");
 	fieldStr = entityString(fieldCount, "field", " INT");
 
-	// Create final senses table
-	EXEC_STMT(query, QString("create table senses(id INTEGER SECONDARY KEY REFERENCES entries, priority TINYINT, %1, %2, %3, %4, restrictedToKanji TEXT, restrictedToKana TEXT)").arg(posStr).arg(miscStr).arg(dialStr).arg(fieldStr));
+	// Create final senses table. Senses are clustered by entry, in the
+	// order they are loaded
+	if (!update) EXEC_STMT(query, QString("create table senses(id INTEGER REFERENCES entries, priority TINYINT, %1, %2, %3, %4, restrictedToKanji TEXT, restrictedToKana TEXT, PRIMARY KEY(id, priority)) WITHOUT ROWID").arg(posStr).arg(miscStr).arg(dialStr).arg(fieldStr));
 
-	// Copy data from temporary table into final one
-	query2.prepare(QString("insert into senses(rowid, id, priority, %1, %2, %3, %4, restrictedToKanji, restrictedToKana) values(?, ?, ?, %5%6%7%8?, ?)")
+	// Copy data from temporary table into final one. When updating, this
+	// fails if new entities need more columns than the database has
+	ASSERT(query2.prepare(QString("insert into senses(id, priority, %1, %2, %3, %4, restrictedToKanji, restrictedToKana) values(?, ?, %5%6%7%8?, ?)")
 		.arg(entityString(posCount, "pos"))
 		.arg(entityString(miscCount, "misc"))
 		.arg(entityString(dialCount, "dial"))
@@ -368,19 +1008,23 @@ bool JMdictDBParser::finalizeSensesTable()
 		.arg(QString("?, ").repeated((posCount / 64) + 1))
 		.arg(QString("?, ").repeated((miscCount / 64) + 1))
 		.arg(QString("?, ").repeated((dialCount / 64) + 1))
-		.arg(QString("?, ").repeated((fieldCount / 64) + 1)));
-	EXEC_STMT(query, "select rowid, * from sensesTMP");
+		.arg(QString("?, ").repeated((fieldCount / 64) + 1))));
+	facetsQuery.prepare("insert or ignore into facets values(?, ?, ?)");
+	EXEC_STMT(query, "select rowid, * from sensesTMP order by id, priority");
 	while (query.next()) {
-		BIND(query2, query.valueInt64(0));
+		ASSERT(insertFacets(facetsQuery, JMdictPosFacet, query.valueString(3), posBitFields, query.valueInt64(1)));
+		ASSERT(insertFacets(facetsQuery, JMdictMiscFacet, query.valueString(4), miscBitFields, query.valueInt64(1)));
+		ASSERT(insertFacets(facetsQuery, JMdictDialectFacet, query.valueString(5), dialBitFields, query.valueInt64(1)));
+		ASSERT(insertFacets(facetsQuery, JMdictFieldFacet, query.valueString(6), fieldBitFields, query.valueInt64(1)));
 		BIND(query2, query.valueInt64(1));
 		BIND(query2, query.valueInt(2));
-		foreach (quint64 mask, entityInsert(query.valueString(3), posBitFields))
+		foreach (quint64 mask, entityInsert(query.valueString(3), posBitFields, posCount))
 			BIND(query2, mask);
-		foreach (quint64 mask, entityInsert(query.valueString(4), miscBitFields))
+		foreach (quint64 mask, entityInsert(query.valueString(4), miscBitFields, miscCount))
 			BIND(query2, mask);
-		foreach (quint64 mask, entityInsert(query.valueString(5), dialBitFields))
+		foreach (quint64 mask, entityInsert(query.valueString(5), dialBitFields, dialCount))
 			BIND(query2, mask);
-		foreach (quint64 mask, entityInsert(query.valueString(6), fieldBitFields))
+		foreach (quint64 mask, entityInsert(query.valueString(6), fieldBitFields, fieldCount))
 			BIND(query2, mask);
 		BIND(query2, query.valueString(7));
 		BIND(query2, query.valueString(8));
@@ -401,22 +1045,32 @@ bool JMdictDBParser::finalizeMainDatabase()
 bool JMdictDBParser::prepareLanguagesQueries()
 {
 	foreach (const QString &lang, languages) {
+		LanguageQueries &queries = languageQueries[lang];
 #define PREPQUERY(query, text) query.useWith(&connections[lang]); ASSERT(query.prepare(text))
-		PREPQUERY(insertGlossTextQueries[lang], "insert into glossText values(?)");
-		PREPQUERY(insertGlossQueries[lang], "insert into gloss values(?, ?)");
-		PREPQUERY(insertGlossesQueries[lang], "insert into glosses values(?, ?)");
+		PREPQUERY(queries.insertGlossText, "insert into temp.glossTextStaging values(?, ?)");
+		PREPQUERY(queries.insertGloss, "insert into gloss values(?, ?)");
+		PREPQUERY(queries.insertGlosses, "insert into glosses values(?, ?)");
+		PREPQUERY(queries.insertDisplayGlosses, "insert into displayRows values(?, ?)");
+		if (update) {
+			PREPQUERY(queries.removeGlosses, "delete from glosses where id = ?");
+			PREPQUERY(queries.removeDisplayGlosses, "delete from displayRows where id = ?");
+			PREPQUERY(queries.insertStaleEntry, "insert or ignore into temp.staleEntries values(?)");
+		}
 #undef PREPQUERY
 	}
 	return true;
 }
 
-bool JMdictDBParser::clearLanguagesQueries()
+bool JMdictDBParser::clearLanguageQueries(const QString &lang)
 {
-	foreach (const QString &lang, languages) {
-		insertGlossTextQueries[lang].clear();
-		insertGlossQueries[lang].clear();
-		insertGlossesQueries[lang].clear();
-	}
+	LanguageQueries &queries = languageQueries[lang];
+	queries.insertGlossText.clear();
+	queries.insertGloss.clear();
+	queries.insertGlosses.clear();
+	queries.insertDisplayGlosses.clear();
+	queries.removeGlosses.clear();
+	queries.removeDisplayGlosses.clear();
+	queries.insertStaleEntry.clear();
 	return true;
 }
 
@@ -435,83 +1089,225 @@ bool JMdictDBParser::createLanguagesTables()
 {
 	foreach (const QString &lang, languages) {
 		SQLite::Query query(&connections[lang]);
-		EXEC_STMT(query, "create table info(version INT, JMdictVersion TEXT)");
+		EXEC_STMT(query, "create table info(version INT, JMdictVersion TEXT, glossesDict BLOB)");
 		EXEC_STMT(query, "create table gloss(id INTEGER SECONDARY KEY, docid INTEGER PRIMARY KEY)");
-		EXEC_STMT(query, "create virtual table glossText using fts4(reading)");
+		EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "glossText"));
+		// Vocabulary of glossText, which remains available after its
+		// content is deleted. Lets wildcard searches match terms instead
+		// of uncompressing every glosses blob
+		EXEC_STMT(query, SQLite::FTS::createTermsTableStatement(ftsVersion, "glossTerms", "glossText"));
 		EXEC_STMT(query, "create table glosses(id INTEGER PRIMARY KEY, glosses BLOB)");
+		// Glosses of the first senses in the same format as glosses, but
+		// uncompressed
+		EXEC_STMT(query, "create table displayRows(id INTEGER PRIMARY KEY, glosses TEXT)");
 	}
-	return true;
+	return createLanguagesStagingTables();
 }
 
-bool JMdictDBParser::createLanguagesIndexes()
+bool JMdictDBParser::prepareLanguagesUpdate()
 {
 	foreach (const QString &lang, languages) {
 		SQLite::Query query(&connections[lang]);
-		EXEC_STMT(query, "DELETE FROM glossText_content");
+		EXEC_STMT(query, "select version from info");
+		if (!query.next() || query.valueInt(0) != JMDICTDB_REVISION) {
+			qCritical("Error - the %s database to update has a different revision, please rebuild it", lang.toLatin1().data());
+			return false;
+		}
+		EXEC_STMT(query, "create temp table staleEntries(id INTEGER PRIMARY KEY)");
 	}
-	return true;
+	return createLanguagesStagingTables();
 }
 
-bool JMdictDBParser::finalizeLanguagesDatabases()
+/// See createMainStagingTables()
+bool JMdictDBParser::createLanguagesStagingTables()
 {
 	foreach (const QString &lang, languages) {
-		bool closed = closeDatabase(lang);
-		if(!closed) {
-			return false;
-		}
+		SQLite::Query query(&connections[lang]);
+		EXEC_STMT(query, "create temp table glossTextStaging(docid INTEGER PRIMARY KEY, reading TEXT)");
+		// The docsize rows of glossText remain after its content is
+		// deleted, so they give the docids that have ever been used
+		EXEC_STMT(query, QString("select coalesce(max(%1), 0) + 1 from glossText_docsize").arg(SQLite::FTS::docsizeIdColumn(ftsVersion)));
+		ASSERT(query.next());
+		LanguageQueries &queries = languageQueries[lang];
+		queries.firstNewDocid = query.valueInt64(0);
+		queries.nextDocid = queries.firstNewDocid;
 	}
 	return true;
 }
 
+bool JMdictDBParser::flushLanguageStagingTables(const QString &lang)
+{
+	SQLite::Query query(&connections[lang]);
+	EXEC_STMT(query, "insert into glossText(rowid, reading) select docid, reading from temp.glossTextStaging");
+	EXEC_STMT(query, "insert into glossText(glossText) values('optimize')");
+	EXEC_STMT(query, "drop table temp.glossTextStaging");
+	return true;
+}
+
+bool JMdictDBParser::createLanguageIndexes(const QString &lang)
+{
+	SQLite::Query query(&connections[lang]);
+	EXEC_STMT(query, "DELETE FROM glossText_content");
+	return true;
+}
+
 bool JMdictDBParser::fillMainInfoTable()
 {
 	SQLite::Query query(&connections["main"]);
-	query.prepare("insert into info values(?, ?)");
+	if (update) {
+		query.prepare("update info set JMdictVersion = ?, inputsChecksum = ?");
+		query.bindValue(dictVersion());
+		query.bindValue(inputsChecksum);
+		ASSERT(query.exec());
+		// The pack is written again once the update is complete
+		EXEC_STMT(query, "drop table if exists pack");
+		return true;
+	}
+	query.prepare("insert into info values(?, ?, ?)");
 	query.bindValue(JMDICTDB_REVISION);
 	query.bindValue(dictVersion());
+	query.bindValue(inputsChecksum);
 	ASSERT(query.exec());
 	return true;
 }
 
-bool JMdictDBParser::fillLanguagesInfoTable()
+bool JMdictDBParser::fillLanguageInfoTable(const QString &lang)
 {
-	SQLite::Query query;
-	foreach (const QString &lang, languages) {
-		query.useWith(&connections[lang]);
-		query.prepare("insert into info values(?, ?)");
-		query.bindValue(JMDICTDB_REVISION);
+	SQLite::Query query(&connections[lang]);
+	if (update) {
+		query.prepare("update info set JMdictVersion = ?");
 		query.bindValue(dictVersion());
 		ASSERT(query.exec());
+		return true;
+	}
+	query.prepare("insert into info values(?, ?, null)");
+	query.bindValue(JMDICTDB_REVISION);
+	query.bindValue(dictVersion());
+	ASSERT(query.exec());
+	return true;
+}
+
+/**
+ * Trains a zstd dictionary on all the glosses of lang, stores it in
+ * the info table and compresses every glosses blob with it. Per-entry
+ * blobs are too small to compress well on their own. When updating, only
+ * the new blobs are compressed, with the dictionary already stored.
+ */
+bool JMdictDBParser::compressLanguageGlosses(const QString &lang)
+{
+	SQLite::Query query(&connections[lang]);
+	SQLite::Query query2(&connections[lang]);
+
+	// Keep everything in memory, updating the table while iterating
+	// over it is undefined
+	QList<qint64> ids;
+	QList<QByteArray> samples;
+	QByteArray dict;
+	if (update) {
+		EXEC_STMT(query, "select glossesDict from info");
+		ASSERT(query.next());
+		dict = query.valueBlob(0);
+		ASSERT(query.prepare("select glosses from glosses where id = ?"));
+		foreach (qint64 id, languageQueries[lang].updatedIds) {
+			BIND(query, id);
+			EXEC(query);
+			ASSERT(query.next());
+			ids << id;
+			samples << query.valueBlob(0);
+		}
+	}
+	else {
+		EXEC_STMT(query, "select id, glosses from glosses");
+		while (query.next()) {
+			ids << query.valueInt64(0);
+			samples << query.valueBlob(1);
+		}
+		dict = SQLite::CompressionDictionary::train(samples);
+	}
+	query.clear();
+	SQLite::CompressionDictionary compressor;
+	if (!compressor.setDictionary(dict)) {
+		qCritical("Cannot create compression dictionary for language %s", lang.toLatin1().data());
+		return false;
+	}
+
+	if (!update) {
+		ASSERT(query2.prepare("update info set glossesDict = ?"));
+		BIND(query2, dict);
+		EXEC(query2);
+	}
+
+	ASSERT(query2.prepare("update glosses set glosses = ? where id = ?"));
+	for (int i = 0; i < ids.size(); i++) {
+		QByteArray compressed(compressor.compress(samples[i]));
+		ASSERT(!compressed.isNull());
+		BIND(query2, compressed);
+		BIND(query2, ids[i]);
+		EXEC(query2);
 	}
 	return true;
 }
 
+/**
+ * Bits are given to the entities in the order entries use them in, so an
+ * entity appearing earlier in a new JMdict would shift the others. Assign
+ * them in the order of the DTD instead, which new entities are appended to.
+ */
+static void sortEntityBitFields(QHash<QString, quint16> &bitFields, const QStringList &declaredEntities)
+{
+	QStringList undeclared(bitFields.keys());
+	quint16 bit = 0;
+	foreach (const QString &name, declaredEntities) {
+		if (!bitFields.contains(name)) continue;
+		bitFields[name] = bit++;
+		undeclared.removeOne(name);
+	}
+	std::sort(undeclared.begin(), undeclared.end());
+	foreach (const QString &name, undeclared) bitFields[name] = bit++;
+}
+
+void JMdictDBParser::sortEntities()
+{
+	sortEntityBitFields(posBitFields, declaredEntities);
+	sortEntityBitFields(miscBitFields, declaredEntities);
+	sortEntityBitFields(fieldBitFields, declaredEntities);
+	sortEntityBitFields(dialBitFields, declaredEntities);
+}
+
+/// Returns the names of bitFields ordered by bit
+static QStringList entitiesByBit(const QHash<QString, quint16> &bitFields)
+{
+	QMap<quint16, QString> sorted;
+	foreach (const QString &name, bitFields.keys()) sorted[bitFields[name]] = name;
+	return sorted.values();
+}
+
 bool JMdictDBParser::populateEntitiesTable()
 {
 	SQLite::Query entitiesQuery(&connections["main"]);
-	entitiesQuery.prepare("insert into posEntities values(?, ?, ?)");
-	foreach (const QString &name, posBitFields.keys()) {
+	entitiesQuery.prepare("insert or replace into posEntities values(?, ?, ?)");
+	foreach (const QString &name, entitiesByBit(posBitFields)) {
 		entitiesQuery.bindValue(posBitFields[name]);
 		entitiesQuery.bindValue(name);
 		entitiesQuery.bindValue(entities[name]);
 		ASSERT(entitiesQuery.exec());
 	}
-	entitiesQuery.prepare("insert into miscEntities values(?, ?, ?)");
-	foreach (const QString &name, miscBitFields.keys()) {
+	entitiesQuery.prepare("insert or replace into miscEntities values(?, ?, ?)");
+	foreach (const QString &name, entitiesByBit(miscBitFields)) {
 		entitiesQuery.bindValue(miscBitFields[name]);
 		entitiesQuery.bindValue(name);
 		entitiesQuery.bindValue(entities[name]);
 		ASSERT(entitiesQuery.exec());
 	}
-	entitiesQuery.prepare("insert into fieldEntities values(?, ?, ?)");
-	foreach (const QString &name, fieldBitFields.keys()) {
+	entitiesQuery.prepare("insert or replace into fieldEntities values(?, ?, ?)");
+	foreach (const QString &name, entitiesByBit(fieldBitFields)) {
 		entitiesQuery.bindValue(fieldBitFields[name]);
 		entitiesQuery.bindValue(name);
 		entitiesQuery.bindValue(entities[name]);
 		ASSERT(entitiesQuery.exec());
 	}
-	entitiesQuery.prepare("insert into dialectEntities values(?, ?, ?)");
-	foreach (const QString &name, dialBitFields.keys()) {
+	entitiesQuery.prepare("insert or replace into dialectEntities values(?, ?, ?)");
+	foreach (const QString &name, entitiesByBit(dialBitFields)) {
 		entitiesQuery.bindValue(dialBitFields[name]);
 		entitiesQuery.bindValue(name);
 		entitiesQuery.bindValue(entities[name]);
@@ -556,48 +1352,635 @@ bool JMdictDBParser::parseJMFs(const QStringList &supportedLanguages)
 	return true;
 }
 
+/**
+ * Applies the JMF files and JLPT levels of srcDir to the databases of
+ * dstDir, without parsing JMdict again. The JMF files are streamed one
+ * entry at a time, and only the entries they list are rewritten: their
+ * glosses are uncompressed, the replaced senses changed, and the search
+ * rows inserted again with new docids as when updating.
+ *
+ * Glosses replaced by a JMF line that has since been removed are not
+ * restored, this needs the databases to be rebuilt or updated.
+ */
+bool JMdictDBParser::applyOverlays()
+{
+	QElapsedTimer timer;
+	timer.start();
+	SQLite::Query query(&connections["main"]);
+	EXEC_STMT(query, "delete from jlpt");
+	ASSERT(insertJLPTLevels());
+	ASSERT(computeRelevance());
+	ASSERT(createKanjiWordsTable());
+	// The databases no longer match their inputs, nor their pack until it
+	// is written again
+	EXEC_STMT(query, "update info set inputsChecksum = null");
+	EXEC_STMT(query, "drop table if exists pack");
+	query.clear();
+	phaseDone(timer, "main", "JLPT levels");
+
+	QDir dir(QDir(srcDir).absoluteFilePath("src/core/jmdict"));
+	foreach (const QString &lang, languages) {
+		QString fName(dir.absoluteFilePath(QString("%1.jmf").arg(lang)));
+		if (QFile(fName).exists()) {
+			ASSERT(applyJMFOverlay(fName, lang));
+			phaseDone(timer, lang, "JMF glosses");
+		}
+		else clearLanguageQueries(lang);
+		ASSERT(closeDatabase(lang));
+	}
+	clearMainQueries();
+	return closeDatabase("main");
+}
+
+bool JMdictDBParser::applyJMFOverlay(const QString &fName, const QString &lang)
+{
+	QFile file(fName);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) return false;
+
+	SQLite::Query query(&connections[lang]);
+	EXEC_STMT(query, "select glossesDict from info");
+	ASSERT(query.next());
+	SQLite::CompressionDictionary compressor;
+	if (!compressor.setDictionary(query.valueBlob(0))) {
+		qCritical("Cannot load compression dictionary for language %s", lang.toLatin1().data());
+		return false;
+	}
+	query.clear();
+
+	// JMF files list the lines of an entry together, so only one entry
+	// needs to be kept in memory
+	QTextStream in(&file);
+	QString line(in.readLine());
+	int currentId = 0;
+	QMap<int, QStringList> replacements;
+	while (!line.isNull()) {
+		int pos = line.indexOf(' ');
+		int pos2 = line.indexOf(' ', pos + 1);
+		int eid(line.left(pos).toInt());
+		int pri(line.mid(pos + 1, pos2 - (pos + 1)).toInt());
+		if (eid != currentId) {
+			if (currentId) ASSERT(applyJMFEntry(lang, currentId, replacements, compressor));
+			currentId = eid;
+			replacements.clear();
+		}
+		replacements[pri] << line.mid(pos2 + 1);
+		line = in.readLine();
+	}
+	if (currentId) ASSERT(applyJMFEntry(lang, currentId, replacements, compressor));
+
+	ASSERT(query.prepare("delete from gloss where id in (select id from temp.staleEntries) and docid < ?"));
+	BIND(query, languageQueries[lang].firstNewDocid);
+	EXEC(query);
+	ASSERT(flushLanguageStagingTables(lang));
+	createLanguageIndexes(lang);
+	clearLanguageQueries(lang);
+	return true;
+}
+
+bool JMdictDBParser::applyJMFEntry(const QString &lang, int id, const QMap<int, QStringList> &replacements, SQLite::CompressionDictionary &compressor)
+{
+	LanguageQueries &queries = languageQueries[lang];
+	SQLite::Query query(&connections[lang]);
+
+	// Glosses of every sense, empty if a sense has none in lang
+	QStringList allGlosses;
+	ASSERT(query.prepare("select glosses from glosses where id = ?"));
+	BIND(query, id);
+	EXEC(query);
+	if (query.next()) {
+		QByteArray glosses(compressor.uncompress(query.valueBlob(0)));
+		ASSERT(!glosses.isNull());
+		allGlosses = QString::fromUtf8(glosses).split("\n\n");
+	}
+	else {
+		SQLite::Query mainQuery(&connections["main"]);
+		ASSERT(mainQuery.prepare("select count(*) from senses where id = ?"));
+		BIND(mainQuery, id);
+		EXEC(mainQuery);
+		ASSERT(mainQuery.next());
+		for (int i = mainQuery.valueInt(0); i > 0; i--) allGlosses << QString();
+	}
+	if (allGlosses.isEmpty()) {
+		qDebug("Entry %d of %s.jmf is not in the database, skipping", id, lang.toLatin1().data());
+		return true;
+	}
+	QMap<int, QStringList>::const_iterator it;
+	for (it = replacements.constBegin(); it != replacements.constEnd(); ++it) {
+		if (it.key() < allGlosses.size()) allGlosses[it.key()] = it.value().join("\n");
+		else qDebug("Sense %d of entry %d in %s.jmf does not exist, skipping", it.key(), id, lang.toLatin1().data());
+	}
+
+	ASSERT(removeLanguageItem(id, lang));
+	foreach (const QString &glosses, allGlosses) {
+		if (glosses.isEmpty()) continue;
+		qint64 docid = queries.nextDocid++;
+		BIND(queries.insertGlossText, docid);
+		// Stored joined by newlines, searched joined by commas
+		BIND(queries.insertGlossText, glosses.split("\n").join(", "));
+		EXEC(queries.insertGlossText);
+		BIND(queries.insertGloss, id);
+		BIND(queries.insertGloss, docid);
+		EXEC(queries.insertGloss);
+	}
+	QByteArray compressed(compressor.compress(allGlosses.join("\n\n").toUtf8()));
+	ASSERT(!compressed.isNull());
+	BIND(queries.insertGlosses, id);
+	BIND(queries.insertGlosses, compressed);
+	EXEC(queries.insertGlosses);
+	BIND(queries.insertDisplayGlosses, id);
+	BIND(queries.insertDisplayGlosses, displayGlosses(allGlosses));
+	EXEC(queries.insertDisplayGlosses);
+	return true;
+}
+
+/// Query reading the rows of a table with entries ids in their first
+/// column, sorted by id, along with the entries
+struct PackCursor
+{
+	SQLite::Query query;
+	bool hasRow;
+
+	PackCursor(SQLite::Connection *connection) : query(connection), hasRow(false) {}
+	bool exec(const QString &sql) { if (!query.exec(sql)) return false; hasRow = query.next(); return true; }
+	bool at(quint32 id) const { return hasRow && query.valueUInt(0) == id; }
+	void next() { hasRow = query.next(); }
+};
+
+static void writePackString(QDataStream &stream, const QString &str)
+{
+	QByteArray utf8(str.toUtf8());
+	stream << (quint16)utf8.size();
+	stream.writeRawData(utf8.constData(), utf8.size());
+}
+
+static void writePackIndices(QDataStream &stream, const QVector<int> &indices)
+{
+	stream << (quint8)indices.size();
+	foreach (int idx, indices) stream << (quint8)idx;
+}
+
+/**
+ * Writes jmdict.pack from the complete jmdict.db, see JMdictPack.h for
+ * its format. Records are written in id order, so the output only
+ * depends on the database. The checksum of the pack is then recorded in
+ * jmdict.db.
+ */
+static bool writePack(const QString &dstDir)
+{
+	QElapsedTimer timer;
+	timer.start();
+	QString dbFile(QDir(dstDir).absoluteFilePath("jmdict.db"));
+	SQLite::Connection connection;
+	if (!connection.connect(dbFile, SQLite::Connection::ReadOnly)) {
+		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+		return false;
+	}
+
+	// The number of columns of each kind of sense properties
+	static const char *kinds[4] = { "pos", "misc", "dial", "field" };
+	quint8 words[4] = { 0, 0, 0, 0 };
+	QStringList senseColumns;
+	SQLite::Query query(&connection);
+	EXEC_STMT(query, "pragma table_info(senses)");
+	while (query.next()) {
+		QString column(query.valueString(1));
+		for (int i = 0; i < 4; i++) {
+			QString kind(kinds[i]);
+			if (column.startsWith(kind) && column.size() > kind.size() && column[kind.size()].isDigit()) ++words[i];
+		}
+	}
+	for (int i = 0; i < 4; i++) for (int j = 0; j < words[i]; j++) senseColumns << QString("%1%2").arg(kinds[i]).arg(j);
+
+	// Records of the most relevant entries are written first, so loading
+	// common words touches only a few contiguous pages of the pack
+	QHash<quint32, int> ranks;
+	{
+		SQLite::Query orderQuery(&connection);
+		EXEC_STMT(orderQuery, "select id from entries order by relevance desc, id");
+		while (orderQuery.next()) ranks.insert(orderQuery.valueUInt(0), ranks.size());
+	}
+
+	PackCursor entries(&connection), kanji(&connection), kana(&connection), senses(&connection);
+	ASSERT(entries.exec("select entries.id, jlpt.level from entries left join jlpt on jlpt.id = entries.id order by entries.id"));
+	ASSERT(kanji.exec("select id, reading, frequency from kanji join kanjiText on kanji.docid == kanjiText.rowid order by id, priority"));
+	ASSERT(kana.exec("select id, reading, nokanji, frequency, restrictedTo from kana join kanaText on kana.docid == kanaText.rowid order by id, priority"));
+	ASSERT(senses.exec(QString("select id, %1, restrictedToKanji, restrictedToKana from senses order by id, priority").arg(senseColumns.join(", "))));
+
+	// Records are written after the header and index, which come last
+	// once the offsets are known
+	QFile file(QDir(dstDir).absoluteFilePath("jmdict.pack"));
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qCritical("Cannot write %s", file.fileName().toUtf8().constData());
+		return false;
+	}
+	SQLite::Query countQuery(&connection);
+	EXEC_STMT(countQuery, "select count(*) from entries");
+	ASSERT(countQuery.next());
+	quint32 count = countQuery.valueUInt(0);
+	countQuery.clear();
+	ASSERT(file.seek(JMDICTPACK_HEADER_SIZE + count * 8));
+
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+	QVector<QPair<quint32, quint32> > index;
+	index.reserve(count);
+	// Records by relevance rank
+	QVector<QByteArray> records(count);
+	for (; entries.hasRow; entries.next()) {
+		quint32 id = entries.query.valueUInt(0);
+		ASSERT((ranks.contains(id) && ranks[id] < (int)count));
+		QByteArray &record = records[ranks[id]];
+		QDataStream rs(&record, QIODevice::WriteOnly);
+		rs.setByteOrder(QDataStream::LittleEndian);
+		// Counts are written once known
+		rs << (quint16)0 << (quint16)0 << (quint16)0 << (quint8)entries.query.valueUInt(1) << (quint8)0;
+		quint16 kanjiCount = 0, kanaCount = 0, sensesCount = 0;
+		for (; kanji.at(id); kanji.next(), ++kanjiCount) {
+			rs << (quint32)kanji.query.valueUInt(2);
+			writePackString(rs, kanji.query.valueString(1));
+		}
+		for (; kana.at(id); kana.next(), ++kanaCount) {
+			rs << (quint32)kana.query.valueUInt(3) << (quint8)kana.query.valueBool(2);
+			writePackIndices(rs, kana.query.valueIntList(4));
+			writePackString(rs, kana.query.valueString(1));
+		}
+		for (; senses.at(id); senses.next(), ++sensesCount) {
+			for (int i = 0; i < senseColumns.size(); i++) rs << senses.query.valueUInt64(i + 1);
+			writePackIndices(rs, senses.query.valueIntList(senseColumns.size() + 1));
+			writePackIndices(rs, senses.query.valueIntList(senseColumns.size() + 2));
+		}
+		qToLittleEndian(kanjiCount, record.data());
+		qToLittleEndian(kanaCount, record.data() + 2);
+		qToLittleEndian(sensesCount, record.data() + 4);
+		// Offsets are known once all records are
+		index << QPair<quint32, quint32>(id, ranks[id]);
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	QVector<quint32> offsets(count);
+	for (int i = 0; i < records.size(); i++) {
+		offsets[i] = file.pos();
+		stream.writeRawData(records[i].constData(), records[i].size());
+		hash.addData(records[i]);
+	}
+	records.clear();
+	QByteArray indexData;
+	{
+		QDataStream is(&indexData, QIODevice::WriteOnly);
+		is.setByteOrder(QDataStream::LittleEndian);
+		for (int i = 0; i < index.size(); i++) is << index[i].first << offsets[index[i].second];
+	}
+	hash.addData(indexData);
+	quint64 checksum = qFromLittleEndian<quint64>((const uchar *)hash.result().constData());
+	entries.query.clear();
+	kanji.query.clear();
+	kana.query.clear();
+	senses.query.clear();
+	query.clear();
+	ASSERT(connection.close());
+	ASSERT((index.size() == (int)count));
+
+	ASSERT(file.seek(0));
+	stream.writeRawData(JMDICTPACK_MAGIC, 4);
+	stream << (quint32)JMDICTPACK_VERSION << (quint32)JMDICTDB_REVISION << count << checksum;
+	for (int i = 0; i < 4; i++) stream << words[i];
+	stream << (quint32)0;
+	stream.writeRawData(indexData.constData(), indexData.size());
+	ASSERT((stream.status() == QDataStream::Ok));
+	file.close();
+
+	// Only once the pack is complete
+	ASSERT(connection.connect(dbFile));
+	query.useWith(&connection);
+	EXEC_STMT(query, "create table if not exists pack(checksum INTEGER)");
+	EXEC_STMT(query, "delete from pack");
+	query.prepare("insert into pack values(?)");
+	query.bindValue((qint64)checksum);
+	ASSERT(query.exec());
+	query.clear();
+	ASSERT(connection.close());
+	phaseDone(timer, "main", "writing pack");
+	return true;
+}
+
+/// Non-zero components of the random signatures of the words
+#define MEANING_SIGNATURE_SIZE 6
+/// Number of entries per list clustered to compute the centroids
+#define MEANING_TRAINING_SAMPLES 64
+#define MEANING_KMEANS_ITERATIONS 8
+
+/// Adds the sparse random signature of the word of hash to v
+static void addSignature(float *v, quint32 hash, float weight)
+{
+	quint32 state = hash;
+	for (int i = 0; i < MEANING_SIGNATURE_SIZE; i++) {
+		state = state * 1664525U + 1013904223U;
+		v[(state >> 16) % JMDICTVECTORS_DIMENSIONS] += (state & 0x80000000U) ? weight : -weight;
+	}
+}
+
+static int nearestCentroid(const qint8 *vector, const qint8 *centroids, int count)
+{
+	int ret = 0;
+	qint32 best = JMdictMeaningVectors::dot(vector, centroids);
+	for (int i = 1; i < count; i++) {
+		qint32 d = JMdictMeaningVectors::dot(vector, centroids + i * JMDICTVECTORS_DIMENSIONS);
+		if (d > best) {
+			best = d;
+			ret = i;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Writes jmdict-<lang>.vec from the complete jmdict-<lang>.db, see
+ * JMdictMeaningVectors.h for its format and how vectors are computed.
+ * The output only depends on the database.
+ */
+static bool writeMeaningVectors(const QString &lang, const QString &dstDir)
+{
+	QElapsedTimer timer;
+	timer.start();
+	QString dbFile(QDir(dstDir).absoluteFilePath(QString("jmdict-%1.db").arg(lang)));
+	SQLite::Connection connection;
+	if (!connection.connect(dbFile, SQLite::Connection::ReadOnly)) {
+		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+		return false;
+	}
+	SQLite::Query query(&connection);
+	EXEC_STMT(query, "select glossesDict from info");
+	ASSERT(query.next());
+	SQLite::CompressionDictionary dictionary;
+	ASSERT(dictionary.setDictionary(query.valueBlob(0)));
+
+	// Words of every sense of the entries, and number of senses using
+	// each word
+	QHash<QString, int> wordIds;
+	QVector<int> frequencies;
+	QVector<quint32> ids;
+	QVector<QVector<QVector<int> > > senses;
+	int sensesCount = 0;
+	EXEC_STMT(query, "select id, glosses from glosses order by id");
+	while (query.next()) {
+		QByteArray glosses(dictionary.uncompress(query.valueBlob(1)));
+		ASSERT(!glosses.isNull());
+		QVector<QVector<int> > entrySenses;
+		foreach (const QString &sense, QString::fromUtf8(glosses).split("\n\n")) {
+			QVector<int> words;
+			foreach (const QString &word, JMdictMeaningVectors::words(sense)) {
+				QHash<QString, int>::const_iterator it(wordIds.constFind(word));
+				int wordId = it == wordIds.constEnd() ? wordIds.size() : it.value();
+				if (it == wordIds.constEnd()) {
+					wordIds.insert(word, wordId);
+					frequencies << 0;
+				}
+				if (words.contains(wordId)) continue;
+				words << wordId;
+				++frequencies[wordId];
+			}
+			// Empty senses are kept, the weight of a sense depends on its position
+			if (!words.isEmpty()) ++sensesCount;
+			entrySenses << words;
+		}
+		ids << query.valueUInt(0);
+		senses << entrySenses;
+	}
+	query.clear();
+	ASSERT(connection.close());
+
+	const int dims = JMDICTVECTORS_DIMENSIONS;
+	const int wordsCount = wordIds.size();
+	QVector<quint32> hashes(wordsCount);
+	for (QHash<QString, int>::const_iterator it = wordIds.constBegin(); it != wordIds.constEnd(); ++it)
+		hashes[it.value()] = JMdictMeaningVectors::wordHash(it.key());
+	wordIds.clear();
+	QVector<float> weights(wordsCount);
+	for (int w = 0; w < wordsCount; w++) weights[w] = std::log((float)sensesCount / frequencies[w]);
+
+	// Words are described by the signatures of the words of their senses,
+	// including their own
+	QVector<float> contexts(wordsCount * dims, 0);
+	QVector<float> senseSum(dims);
+	foreach (const QVector<QVector<int> > &entrySenses, senses) {
+		foreach (const QVector<int> &words, entrySenses) {
+			senseSum.fill(0);
+			foreach (int w, words) addSignature(senseSum.data(), hashes[w], weights[w]);
+			foreach (int w, words) for (int d = 0; d < dims; d++) contexts[w * dims + d] += senseSum[d];
+		}
+	}
+	QByteArray wordVectors(wordsCount * dims, 0);
+	for (int w = 0; w < wordsCount; w++)
+		JMdictMeaningVectors::quantize(contexts.mid(w * dims, dims), reinterpret_cast<qint8 *>(wordVectors.data()) + w * dims);
+	contexts.clear();
+
+	// Entries, whose first senses weigh more
+	QVector<quint32> entryIds;
+	QByteArray entryVectors;
+	QVector<float> v(dims);
+	qint8 quantized[JMDICTVECTORS_DIMENSIONS];
+	for (int e = 0; e < ids.size(); e++) {
+		v.fill(0);
+		for (int s = 0; s < senses[e].size(); s++) {
+			foreach (int w, senses[e][s]) {
+				float weight = weights[w] / (s + 1);
+				const qint8 *wordVector = reinterpret_cast<const qint8 *>(wordVectors.constData()) + w * dims;
+				for (int d = 0; d < dims; d++) v[d] += weight * wordVector[d];
+			}
+		}
+		if (!JMdictMeaningVectors::quantize(v, quantized)) continue;
+		entryIds << ids[e];
+		entryVectors.append(reinterpret_cast<const char *>(quantized), dims);
+	}
+	senses.clear();
+	const int entriesCount = entryIds.size();
+	ASSERT(entriesCount > 0);
+	const qint8 *vectors = reinterpret_cast<const qint8 *>(entryVectors.constData());
+
+	// Centroids of the lists, by k-means of a sample of the entries
+	const int listsCount = qBound(1, (int)std::sqrt((double)entriesCount), 1024);
+	QVector<int> samples;
+	int stride = qMax(1, entriesCount / (listsCount * MEANING_TRAINING_SAMPLES));
+	for (int i = 0; i < entriesCount; i += stride) samples << i;
+	QByteArray centroidsData(listsCount * dims, 0);
+	qint8 *centroids = reinterpret_cast<qint8 *>(centroidsData.data());
+	for (int c = 0; c < listsCount; c++) memcpy(centroids + c * dims, vectors + samples[c * samples.size() / listsCount] * dims, dims);
+	for (int iteration = 0; iteration < MEANING_KMEANS_ITERATIONS; iteration++) {
+		QVector<float> sums(listsCount * dims, 0);
+		QVector<int> sizes(listsCount, 0);
+		foreach (int i, samples) {
+			int c = nearestCentroid(vectors + i * dims, centroids, listsCount);
+			++sizes[c];
+			for (int d = 0; d < dims; d++) sums[c * dims + d] += vectors[i * dims + d];
+		}
+		// Empty lists keep their centroid
+		for (int c = 0; c < listsCount; c++)
+			if (sizes[c] > 0) JMdictMeaningVectors::quantize(sums.mid(c * dims, dims), centroids + c * dims);
+	}
+
+	// Entries by list, then by id
+	QVector<QPair<int, int> > order(entriesCount);
+	for (int i = 0; i < entriesCount; i++) order[i] = qMakePair(nearestCentroid(vectors + i * dims, centroids, listsCount), i);
+	std::sort(order.begin(), order.end());
+	QVector<quint32> listStarts(listsCount + 1, entriesCount);
+	for (int i = entriesCount - 1; i >= 0; i--) listStarts[order[i].first] = i;
+	for (int c = listsCount - 1; c >= 0; c--) listStarts[c] = qMin(listStarts[c], listStarts[c + 1]);
+
+	// Words by hash. The few words with the same hash as another one are
+	// dropped
+	QVector<QPair<quint32, int> > words;
+	for (int w = 0; w < wordsCount; w++) words << qMakePair(hashes[w], w);
+	std::sort(words.begin(), words.end());
+	QVector<QPair<quint32, int> > uniqueWords;
+	for (int i = 0; i < words.size(); i++) {
+		if (i > 0 && words[i].first == words[i - 1].first) continue;
+		if (i + 1 < words.size() && words[i].first == words[i + 1].first) continue;
+		uniqueWords << words[i];
+	}
+
+	QFile file(QDir(dstDir).absoluteFilePath(QString("jmdict-%1.vec").arg(lang)));
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qCritical("Cannot write %s", file.fileName().toUtf8().constData());
+		return false;
+	}
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+	stream.writeRawData(JMDICTVECTORS_MAGIC, 4);
+	stream << (quint32)JMDICTVECTORS_VERSION << (quint32)JMDICTDB_REVISION << (quint16)dims << (quint16)listsCount;
+	stream << (quint32)uniqueWords.size() << (quint32)entriesCount << (quint64)QFileInfo(dbFile).size();
+	for (int i = 0; i < uniqueWords.size(); i++) stream << uniqueWords[i].first;
+	for (int i = 0; i < uniqueWords.size(); i++) stream << (quint8)qBound(0, qRound(weights[uniqueWords[i].second] * 16), 255);
+	for (int i = 0; i < uniqueWords.size(); i++) stream.writeRawData(wordVectors.constData() + uniqueWords[i].second * dims, dims);
+	stream.writeRawData(centroidsData.constData(), centroidsData.size());
+	foreach (quint32 start, listStarts) stream << start;
+	for (int i = 0; i < entriesCount; i++) stream << entryIds[order[i].second];
+	for (int i = 0; i < entriesCount; i++) stream.writeRawData(entryVectors.constData() + order[i].second * dims, dims);
+	ASSERT((stream.status() == QDataStream::Ok));
+	file.close();
+	QFile(file.fileName()).setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther);
+	phaseDone(timer, lang, "computing meaning vectors");
+	return true;
+}
+
+/// Writes the files derived from the complete databases of dstDir
+static bool writeSidecars(const QStringList &languages, const QString &dstDir)
+{
+	ASSERT(writePack(dstDir));
+	foreach (const QString &lang, languages) ASSERT(writeMeaningVectors(lang, dstDir));
+	return true;
+}
+
 void printUsage(char *argv[])
 {
-	qCritical("Usage: %s [-l<lang>] JMdict_file source_dir dest_dir\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)", argv[0]);
+	qCritical("Usage: %s [-l<lang>] [-u] [--fts5] JMdict_file source_dir dest_dir\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)\nJMdict_file can be gzipped\n-u updates the databases of dest_dir, built from a previous JMdict with the same languages, instead of creating them\n--fts5 builds the full-text indexes with FTS5 instead of FTS4\n-o only applies the JMF files and JLPT levels of source_dir to the databases of dest_dir, and takes no JMdict_file\n--stats prints statistics about the databases of dest_dir instead of building them, and takes no JMdict_file. It exits with status 2 if some values are over their threshold\n-t<name>=<max>,... sets the thresholds of --stats", argv[0]);
 }
 
-bool buildDB(const QStringList &languages, const QString &JMdictFile, const QString &srcDir, const QString &dstDir)
+/// Number of items of a comma-separated list column
+#define LIST_SIZE(column) QString("(length(%1) - length(replace(%1, ',', '')) + 1)").arg(column)
+
+/**
+ * Prints the distributions of per-entry rows and sizes of the databases of
+ * dstDir. FTS token counts are approximated by the number of words of the
+ * indexed texts. Returns 2 if some values are over their threshold.
+ */
+static int printStatistics(const QStringList &languages, const QString &dstDir, const QString &thresholds)
 {
-	JMdictDBParser parser(languages, srcDir, dstDir);
+	BuilderStatistics stats;
+	if (!stats.setThresholds(thresholds)) return 1;
+	SQLite::Connection connection;
+	if (!connection.connect(QDir(dstDir).absoluteFilePath("jmdict.db"), SQLite::Connection::ReadOnly)) {
+		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+		return 1;
+	}
+	bool ok = stats.distribution(connection, "kanji per entry", "select id, count(*) from kanji group by id", 30)
+		&& stats.distribution(connection, "kana per entry", "select id, count(*) from kana group by id", 30)
+		&& stats.distribution(connection, "senses per entry", "select id, count(*) from senses group by id", 60)
+		&& stats.distribution(connection, "kana restrictedTo size", QString("select id, max(%1) from kana where restrictedTo is not null group by id").arg(LIST_SIZE("restrictedTo")), 20)
+		&& stats.distribution(connection, "sense restrictedToKanji size", QString("select id, max(%1) from senses where restrictedToKanji is not null group by id").arg(LIST_SIZE("restrictedToKanji")), 20)
+		&& stats.distribution(connection, "sense restrictedToKana size", QString("select id, max(%1) from senses where restrictedToKana is not null group by id").arg(LIST_SIZE("restrictedToKana")), 20)
+		&& stats.distribution(connection, "display row bytes", "select id, length(cast(writings as blob)) + length(cast(readings as blob)) from displayRows", 1024)
+		&& stats.distribution(connection, "kanji reading words", "select kanji.id, sum(length(reading) - length(replace(reading, ' ', '')) + 1) from kanji join kanjiText on kanji.docid = kanjiText.rowid group by kanji.id", 40);
+	connection.close();
 
-	parser.parseJMFs(languages);
-	parser.createMainDatabase();
-	parser.createMainTables();
-	parser.prepareMainQueries();
+	foreach (const QString &lang, languages) {
+		if (!ok) break;
+		if (!connection.connect(QDir(dstDir).absoluteFilePath(QString("jmdict-%1.db").arg(lang)), SQLite::Connection::ReadOnly)) {
+			qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+			return 1;
+		}
+		ok = stats.distribution(connection, lang + " glosses blob bytes", "select id, length(glosses) from glosses", 16384)
+			// Glosses of a sense are indexed separated by ", "
+			&& stats.distribution(connection, lang + " glosses per sense", "select gloss.id, max((length(reading) - length(replace(reading, ', ', ''))) / 2 + 1) from gloss join glossText on gloss.docid = glossText.rowid group by gloss.id", 100)
+			&& stats.distribution(connection, lang + " gloss words per entry", "select gloss.id, sum(length(reading) - length(replace(reading, ' ', '')) + 1) from gloss join glossText on gloss.docid = glossText.rowid group by gloss.id", 2000);
+		connection.close();
+	}
+	if (!ok) return 1;
+	return stats.outliers() > 0 ? 2 : 0;
+}
+
+bool applyOverlays(const QStringList &languages, const QString &srcDir, const QString &dstDir)
+{
+	JMdictDBParser parser(languages, srcDir, dstDir, true);
+	ASSERT(parser.createMainDatabase());
+	ASSERT(parser.prepareMainUpdate());
+	ASSERT(parser.prepareMainQueries());
+	ASSERT(parser.createLanguagesDatabases());
+	ASSERT(parser.prepareLanguagesUpdate());
+	ASSERT(parser.prepareLanguagesQueries());
+	ASSERT(parser.applyOverlays());
+	// The pack and vectors must match the new databases
+	return writeSidecars(languages, dstDir);
+}
 
-	parser.createLanguagesDatabases();
-	parser.createLanguagesTables();
-	parser.prepareLanguagesQueries();
+bool buildDB(const QStringList &languages, const QString &JMdictFile, const QString &srcDir, const QString &dstDir, bool update, SQLite::FTS::Version ftsVersion)
+{
+	JMdictDBParser parser(languages, srcDir, dstDir, update);
+	parser.ftsVersion = ftsVersion;
+
+	QDir jmdictDir(QDir(srcDir).absoluteFilePath("src/core/jmdict"));
+	QStringList inputs, dbs;
+	inputs << JMdictFile;
+	foreach (const QString &fName, jmdictDir.entryList(QStringList() << "*.jmf" << "jlpt-n*.csv", QDir::Files, QDir::Name))
+		inputs << jmdictDir.absoluteFilePath(fName);
+	foreach (const QString &lang, languages) dbs << QString("jmdict-%1.db").arg(lang);
+	parser.inputsChecksum = inputsChecksum(JMDICTDB_REVISION, inputs, languages, ftsVersion);
+	if (!parser.inputsChecksum.isNull() && parser.inputsChecksum == previousInputsChecksum(dstDir, "jmdict.db", dbs)) {
+		qDebug("Inputs unchanged, keeping the existing databases");
+		return true;
+	}
 
+	QElapsedTimer timer;
+	timer.start();
+	parser.parseJMFs(languages);
+	ASSERT(parser.createMainDatabase());
+	if (update) ASSERT(parser.prepareMainUpdate())
+	else ASSERT(parser.createMainTables());
+	ASSERT(parser.prepareMainQueries());
+
+	ASSERT(parser.createLanguagesDatabases());
+	if (update) ASSERT(parser.prepareLanguagesUpdate())
+	else ASSERT(parser.createLanguagesTables());
+	ASSERT(parser.prepareLanguagesQueries());
+	phaseDone(timer, "parser", "preparing databases");
+
+	// JMdict can be given gzipped, as it is distributed. Opened before the
+	// writers are started, which would otherwise never be joined
 	QFile file(JMdictFile);
-	ASSERT(file.open(QFile::ReadOnly | QFile::Text));
-	QXmlStreamReader reader(&file);
+	GzipDevice device(&file);
+	ASSERT(device.open(QIODevice::ReadOnly));
+	// Entries are written and the databases finalized by the writers
+	// while parsing goes on
+	parser.startWriters();
+	QXmlStreamReader reader(&device);
 	if (!parser.parse(reader)) {
 		qFatal("Error while parsing JMdict");
 		return 1;
 	}
+	device.close();
 	file.close();
+	phaseDone(timer, "parser", "parsing");
 
-	parser.fillMainInfoTable();
-	parser.fillLanguagesInfoTable();
-	parser.insertJLPTLevels();
-	parser.populateEntitiesTable();
-	parser.finalizeSensesTable();
-	parser.createMainIndexes();
-	parser.createLanguagesIndexes();
-
-	parser.clearMainQueries();
-	parser.finalizeMainDatabase();
-
-	parser.clearLanguagesQueries();
-	parser.finalizeLanguagesDatabases();
-
-	return true;
+	ASSERT(parser.finishWriters());
+	return writeSidecars(languages, dstDir);
 }
 
 int main(int argc, char *argv[])
@@ -605,13 +1988,31 @@ int main(int argc, char *argv[])
 	QCoreApplication app(argc, argv);
 	sqlite3ext_init();
 
-	if (argc < 4) {
+	if (argc < 3) {
 		printUsage(argv); return 1;
 	}
 	QStringList languages;
+	bool update = false;
+	bool overlay = false;
+	bool stats = false;
+	SQLite::FTS::Version ftsVersion = SQLite::FTS::FTS4;
+	QString thresholds;
 	int argCpt = 1;
 	while (argCpt < argc && argv[argCpt][0] == '-') {
 		QString param(argv[argCpt]);
+		if (param == "-u" || param == "-o" || param == "--stats" || param == "--fts5") {
+			if (param == "-u") update = true;
+			else if (param == "-o") overlay = true;
+			else if (param == "--fts5") ftsVersion = SQLite::FTS::FTS5;
+			else stats = true;
+			++argCpt;
+			continue;
+		}
+		if (param.startsWith("-t")) {
+			thresholds = param.mid(2);
+			++argCpt;
+			continue;
+		}
 		if (!param.startsWith("-l")) {
 			printUsage(argv);
 			return 1;
@@ -622,18 +2023,22 @@ int main(int argc, char *argv[])
 		};
 		++argCpt;
 	}
-	if (argCpt > argc - 3) {
+	// Overlays and statistics do not take a JMdict file
+	int skip = overlay || stats ? 1 : 0;
+	if (argCpt > argc - 3 + skip) {
 		printUsage(argv);
 		return -1;
 	}
 
-	QString JMdictFile(argv[argCpt]);
-	QString srcDir(argv[argCpt + 1]);
-	QString dstDir(argv[argCpt + 2]);
+	QString JMdictFile(skip ? QString() : QString(argv[argCpt]));
+	QString srcDir(argv[argCpt + 1 - skip]);
+	QString dstDir(argv[argCpt + 2 - skip]);
 
 	// English is used as a backup if nothing else is available
 	languages << "en";
 	languages.removeDuplicates();
 
-	return (!buildDB(languages, JMdictFile, srcDir, dstDir));
+	if (stats) return printStatistics(languages, dstDir, thresholds);
+	if (overlay) return (!applyOverlays(languages, srcDir, dstDir));
+	return (!buildDB(languages, JMdictFile, srcDir, dstDir, update, ftsVersion));
 }
@@ -0,0 +1,196 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/jmdict/JMdictDeinflector.h"
+
+#include <QVector>
+
+/// Upper bound on the number of candidates, for pathological inputs
+#define MAX_DEINFLECT_CANDIDATES 128
+
+#define I JMdictDeinflector::Ichidan
+#define G JMdictDeinflector::Godan
+#define K JMdictDeinflector::Kuru
+#define S JMdictDeinflector::Suru
+#define A JMdictDeinflector::AdjectiveI
+#define T JMdictDeinflector::TeForm
+#define M JMdictDeinflector::MasuStem
+#define ANY JMdictDeinflector::AnyType
+
+/**
+ * Replaces the from suffix by the to suffix, for words of one of the in
+ * types. The result is of the out types.
+ */
+static const struct {
+	const char *from;
+	const char *to;
+	int in;
+	int out;
+} rulesData[] = {
+	// Past and te forms
+	{ "た", "る", ANY, I }, { "て", "る", ANY, I },
+	{ "いた", "く", ANY, G }, { "いて", "く", ANY, G },
+	{ "いだ", "ぐ", ANY, G }, { "いで", "ぐ", ANY, G },
+	{ "した", "す", ANY, G }, { "して", "す", ANY, G },
+	{ "った", "う", ANY, G }, { "って", "う", ANY, G },
+	{ "った", "つ", ANY, G }, { "って", "つ", ANY, G },
+	{ "った", "る", ANY, G }, { "って", "る", ANY, G },
+	{ "んだ", "ぬ", ANY, G }, { "んで", "ぬ", ANY, G },
+	{ "んだ", "ぶ", ANY, G }, { "んで", "ぶ", ANY, G },
+	{ "んだ", "む", ANY, G }, { "んで", "む", ANY, G },
+	{ "行った", "行く", ANY, G }, { "行って", "行く", ANY, G },
+	{ "いった", "いく", ANY, G }, { "いって", "いく", ANY, G },
+	{ "した", "する", ANY, S }, { "して", "する", ANY, S },
+	{ "きた", "くる", ANY, K }, { "きて", "くる", ANY, K },
+	{ "来た", "来る", ANY, K }, { "来て", "来る", ANY, K },
+	{ "かった", "い", ANY, A }, { "くて", "い", ANY, A },
+	{ "く", "い", ANY, A },
+	// Continuous forms
+	{ "ている", "て", I, T }, { "でいる", "で", I, T },
+	{ "てる", "て", I, T }, { "でる", "で", I, T },
+	// Negative forms, that inflect like adjectives
+	{ "ない", "る", A, I },
+	{ "かない", "く", A, G }, { "がない", "ぐ", A, G },
+	{ "さない", "す", A, G }, { "たない", "つ", A, G },
+	{ "なない", "ぬ", A, G }, { "ばない", "ぶ", A, G },
+	{ "まない", "む", A, G }, { "らない", "る", A, G },
+	{ "わない", "う", A, G },
+	{ "しない", "する", A, S },
+	{ "こない", "くる", A, K }, { "来ない", "来る", A, K },
+	{ "くない", "い", A, A },
+	// Polite and desiderative forms, built on the masu stem
+	{ "ます", "", ANY, M }, { "ました", "", ANY, M },
+	{ "ません", "", ANY, M }, { "ませんでした", "", ANY, M },
+	{ "ましょう", "", ANY, M }, { "まして", "", ANY, M },
+	{ "たい", "", A, M },
+	{ "", "る", M, I },
+	{ "き", "く", M, G }, { "ぎ", "ぐ", M, G },
+	{ "し", "す", M, G }, { "ち", "つ", M, G },
+	{ "に", "ぬ", M, G }, { "び", "ぶ", M, G },
+	{ "み", "む", M, G }, { "り", "る", M, G },
+	{ "い", "う", M, G },
+	{ "し", "する", M, S },
+	{ "き", "くる", M, K }, { "来", "来る", M, K },
+	// Potential and passive forms
+	{ "られる", "る", I, I | G },
+	{ "ける", "く", I, G }, { "げる", "ぐ", I, G },
+	{ "せる", "す", I, G }, { "てる", "つ", I, G },
+	{ "ねる", "ぬ", I, G }, { "べる", "ぶ", I, G },
+	{ "める", "む", I, G }, { "れる", "る", I, G },
+	{ "える", "う", I, G },
+	{ "かれる", "く", I, G }, { "がれる", "ぐ", I, G },
+	{ "される", "す", I, G }, { "たれる", "つ", I, G },
+	{ "ばれる", "ぶ", I, G }, { "まれる", "む", I, G },
+	{ "われる", "う", I, G },
+	{ "される", "する", I, S },
+	{ "こられる", "くる", I, K },
+	// Causative forms
+	{ "させる", "る", I, I }, { "させる", "する", I, S },
+	{ "かせる", "く", I, G }, { "がせる", "ぐ", I, G },
+	{ "させる", "す", I, G }, { "たせる", "つ", I, G },
+	{ "ばせる", "ぶ", I, G }, { "ませる", "む", I, G },
+	{ "らせる", "る", I, G }, { "わせる", "う", I, G },
+	// Conditional forms
+	{ "れば", "る", ANY, I | G | K | S },
+	{ "えば", "う", ANY, G }, { "けば", "く", ANY, G },
+	{ "げば", "ぐ", ANY, G }, { "せば", "す", ANY, G },
+	{ "てば", "つ", ANY, G }, { "ねば", "ぬ", ANY, G },
+	{ "べば", "ぶ", ANY, G }, { "めば", "む", ANY, G },
+	{ "ければ", "い", ANY, A },
+	// Volitional forms
+	{ "よう", "る", ANY, I },
+	{ "おう", "う", ANY, G }, { "こう", "く", ANY, G },
+	{ "ごう", "ぐ", ANY, G }, { "そう", "す", ANY, G },
+	{ "とう", "つ", ANY, G }, { "のう", "ぬ", ANY, G },
+	{ "ぼう", "ぶ", ANY, G }, { "もう", "む", ANY, G },
+	{ "ろう", "る", ANY, G },
+	{ "しよう", "する", ANY, S }, { "こよう", "くる", ANY, K },
+	// Suru verbs come from nouns
+	{ "する", "", S, JMdictDeinflector::SuruNoun },
+};
+
+#undef I
+#undef G
+#undef K
+#undef S
+#undef A
+#undef T
+#undef M
+#undef ANY
+
+class DeinflectRule
+{
+public:
+	QString from;
+	QString to;
+	int in;
+	int out;
+};
+
+/// Rules with their suffixes converted once and for all
+static const QVector<DeinflectRule> &rules()
+{
+	static QVector<DeinflectRule> ret;
+	if (ret.isEmpty()) {
+		for (unsigned int i = 0; i < sizeof(rulesData) / sizeof(rulesData[0]); i++) {
+			DeinflectRule rule;
+			rule.from = QString::fromUtf8(rulesData[i].from);
+			rule.to = QString::fromUtf8(rulesData[i].to);
+			rule.in = rulesData[i].in;
+			rule.out = rulesData[i].out;
+			ret << rule;
+		}
+	}
+	return ret;
+}
+
+QList<JMdictDeinflector::Candidate> JMdictDeinflector::deinflect(const QString &word)
+{
+	const QVector<DeinflectRule> &allRules = rules();
+	QList<Candidate> ret;
+	ret << Candidate(word, AnyType);
+	// Candidates are appended while iterating, so that they get
+	// deinflected in turn
+	for (int i = 0; i < ret.size() && ret.size() < MAX_DEINFLECT_CANDIDATES; i++) {
+		const QString current(ret[i].word);
+		const int types = ret[i].types;
+		foreach (const DeinflectRule &rule, allRules) {
+			if (!(types & rule.in)) continue;
+			// Always leave something before the replaced suffix
+			if (current.size() <= rule.from.size() || !current.endsWith(rule.from)) continue;
+			QString candidate(current.left(current.size() - rule.from.size()) + rule.to);
+			int j;
+			for (j = 0; j < ret.size(); j++) if (ret[j].word == candidate) break;
+			if (j < ret.size()) ret[j].types |= rule.out;
+			else ret << Candidate(candidate, rule.out);
+		}
+	}
+	ret.removeFirst();
+	return ret;
+}
+
+QStringList JMdictDeinflector::posEntities(int types)
+{
+	QStringList ret;
+	if (types & Ichidan) ret << "v1" << "v1-s";
+	if (types & Godan) ret << "v5aru" << "v5b" << "v5g" << "v5k" << "v5k-s" << "v5m" << "v5n" << "v5r" << "v5r-i" << "v5s" << "v5t" << "v5u" << "v5u-s" << "v5uru";
+	if (types & Kuru) ret << "vk";
+	if (types & Suru) ret << "vs-i" << "vs-s";
+	if (types & AdjectiveI) ret << "adj-i" << "adj-ix";
+	if (types & SuruNoun) ret << "vs";
+	return ret;
+}
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_JMDICT_DEINFLECTOR_H
+#define __CORE_JMDICT_DEINFLECTOR_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Rule-driven deinflector that turns conjugated verbs and adjectives
+ * (e.g. 食べました, 行かなかった) into the dictionary forms they may come
+ * from.
+ *
+ * Each rule replaces an inflected suffix by the suffix of a less inflected
+ * form, and is only applied to words of the types it accepts. Rules are
+ * applied repeatedly so that chained inflections are undone one after
+ * the other.
+ */
+class JMdictDeinflector
+{
+public:
+	typedef enum {
+		Ichidan = 1 << 0,
+		Godan = 1 << 1,
+		Kuru = 1 << 2,
+		Suru = 1 << 3,
+		AdjectiveI = 1 << 4,
+		/// Intermediate forms that are not dictionary forms
+		TeForm = 1 << 5,
+		MasuStem = 1 << 6,
+		/// Nouns that take suru, e.g. 勉強 for 勉強する
+		SuruNoun = 1 << 7,
+		AnyType = Ichidan | Godan | Kuru | Suru | AdjectiveI | TeForm
+	} WordType;
+
+	class Candidate
+	{
+	public:
+		QString word;
+		/// WordType flags the word may be of
+		int types;
+
+		Candidate(const QString &w, int t) : word(w), types(t) {}
+	};
+
+	/**
+	 * Returns all the words that word may be an inflection of, without
+	 * word itself. Candidates are not checked against the dictionary.
+	 */
+	static QList<Candidate> deinflect(const QString &word);
+
+	/**
+	 * Returns the JMdict part of speech entities that dictionary words of
+	 * the given types can have. Intermediate types have none.
+	 */
+	static QStringList posEntities(int types);
+};
+
+#endif
@@ -43,7 +43,61 @@ Gloss::Gloss(const QString &lang, const QString &gloss) : _lang(lang), _gloss(gl
 {
 }
 
-Sense::Sense(const QSet<QString> &partOfSpeech, const QSet<QString> &misc, const QSet<QString> &dialect, const QSet<QString> &field) : _partOfSpeech(partOfSpeech), _misc(misc), _dialect(dialect), _field(field)
+bool SenseProperties::isEmpty() const
+{
+	for (int i = 0; i < maxWords; i++) if (_bits[i]) return false;
+	return true;
+}
+
+bool SenseProperties::contains(const QMap<QString, QPair<QString, quint16>> &map, const QString &name) const
+{
+	QMap<QString, QPair<QString, quint16>>::const_iterator it(map.find(name));
+	return it != map.end() && test(it->second);
+}
+
+void SenseProperties::insert(const QMap<QString, QPair<QString, quint16>> &map, const QString &name)
+{
+	QMap<QString, QPair<QString, quint16>>::const_iterator it(map.find(name));
+	if (it != map.end()) set(it->second);
+}
+
+QStringList SenseProperties::names(const QVector<QString> &shift) const
+{
+	QStringList ret;
+	for (int i = 0; i < maxWords; i++) {
+		int cpt = 0;
+		quint64 bitsSet = _bits[i];
+		while (bitsSet != 0) {
+			if ((bitsSet & 1) && cpt + i * 64 < shift.size())
+				ret << shift[cpt + i * 64];
+			bitsSet >>= 1;
+			cpt++;
+		}
+	}
+	return ret;
+}
+
+SenseProperties SenseProperties::operator&(const SenseProperties &other) const
+{
+	SenseProperties ret;
+	for (int i = 0; i < maxWords; i++) ret._bits[i] = _bits[i] & other._bits[i];
+	return ret;
+}
+
+SenseProperties SenseProperties::operator-(const SenseProperties &other) const
+{
+	SenseProperties ret;
+	for (int i = 0; i < maxWords; i++) ret._bits[i] = _bits[i] & ~other._bits[i];
+	return ret;
+}
+
+bool SenseProperties::operator==(const SenseProperties &other) const
+{
+	for (int i = 0; i < maxWords; i++) if (_bits[i] != other._bits[i]) return false;
+	return true;
+}
+
+Sense::Sense(const SenseProperties &partOfSpeech, const SenseProperties &misc, const SenseProperties &dialect, const SenseProperties &field) : _partOfSpeech(partOfSpeech), _misc(misc), _dialect(dialect), _field(field)
 {
 }
 
@@ -126,10 +180,25 @@ QStringList JMdictEntry::meanings() const
 	return res;
 }
 
+int JMdictEntry::memoryFootprint() const
+{
+	int ret = Entry::memoryFootprint() + sizeof(JMdictEntry) - sizeof(Entry);
+	foreach (const KanjiReading &kanji, kanjis)
+		ret += sizeof(KanjiReading) + 16 + footprint(kanji.getReading()) + kanji.getKanaReadings().size() * sizeof(qint32);
+	foreach (const KanaReading &kana, kanas)
+		ret += sizeof(KanaReading) + 16 + footprint(kana.getReading()) + kana.getKanjiReadings().size() * sizeof(qint32);
+	foreach (const Sense &sense, senses) {
+		ret += sizeof(Sense) + 16 + footprint(sense.getInfos()) + (sense.stagK().size() + sense.stagR().size()) * sizeof(qint32);
+		foreach (const Gloss &gloss, sense.getGlosses())
+			ret += sizeof(Gloss) + 16 + footprint(gloss.lang()) + footprint(gloss.gloss());
+	}
+	return ret;
+}
+
 QList<const Sense *> JMdictEntry::getSenses() const
 {
 	QList<const Sense *> res;
-	QSet<QString> filter(JMdictEntrySearcher::miscFilterEntities() - JMdictEntrySearcher::explicitlyRequestedMiscs());
+	SenseProperties filter(JMdictEntrySearcher::miscFilter() - JMdictEntrySearcher::explicitlyRequestedMiscs());
 	foreach (const Sense &sense, getAllSenses()) {
 		if ((sense.misc() & filter).isEmpty())
 			res << &sense;
@@ -139,5 +208,5 @@ QList<const Sense *> JMdictEntry::getSenses() const
 
 bool JMdictEntry::writtenInKana() const
 {
-	return (!senses.isEmpty() && senses[0].misc().contains("uk"));
+	return (!senses.isEmpty() && senses[0].misc().contains(JMdictPlugin::miscMap(), "uk"));
 }
@@ -21,12 +21,21 @@
 #include <QList>
 #include <QStringList>
 #include <QMap>
+#include <QPair>
 #include <QSet>
+#include <QVector>
+#include <QCoreApplication>
 
 #include "core/EntriesCache.h"
 
 #define JMDICTENTRY_GLOBALID 1
-#define JMDICTDB_REVISION 4
+#define JMDICTDB_REVISION 14
+/// Number of words stored for each kanji in the kanjiWords table
+#define JMDICT_KANJI_WORDS 100
+
+/// Facets of the facets table of the JMdict database. Values are the bit
+/// shifts of the corresponding entities.
+enum JMdictFacet { JMdictPosFacet = 0, JMdictMiscFacet, JMdictDialectFacet, JMdictFieldFacet };
 
 class KanaReading;
 
@@ -80,6 +89,44 @@ public:
 	const QString &gloss() const { return _gloss; }
 };
 
+/**
+ * Set of properties of one kind (part of speech, misc, ...) of a sense,
+ * stored as the bitmask found in the database: bit n is set if the sense
+ * has the property of bitshift n of the corresponding entities map.
+ * Names are only looked up when the properties are displayed.
+ */
+class SenseProperties
+{
+public:
+	/// Number of 64 bits words, i.e. database columns, that can be stored
+	static const int maxWords = 4;
+
+private:
+	quint64 _bits[maxWords];
+
+public:
+	SenseProperties() { for (int i = 0; i < maxWords; i++) _bits[i] = 0; }
+
+	quint64 word(int i) const { return i < maxWords ? _bits[i] : 0; }
+	void setWord(int i, quint64 bits) { if (i < maxWords) _bits[i] = bits; }
+	bool test(int shift) const { return shift >= 0 && shift < maxWords * 64 && (_bits[shift / 64] & (1ULL << (shift % 64))); }
+	void set(int shift) { if (shift >= 0 && shift < maxWords * 64) _bits[shift / 64] |= 1ULL << (shift % 64); }
+	bool isEmpty() const;
+
+	/// Returns true if the property called name in map is set
+	bool contains(const QMap<QString, QPair<QString, quint16>> &map, const QString &name) const;
+	/// Sets the property called name in map, if it exists
+	void insert(const QMap<QString, QPair<QString, quint16>> &map, const QString &name);
+	/// Returns the names of the set properties, being given the shift
+	/// vector of their kind
+	QStringList names(const QVector<QString> &shift) const;
+
+	SenseProperties operator&(const SenseProperties &other) const;
+	SenseProperties operator-(const SenseProperties &other) const;
+	bool operator==(const SenseProperties &other) const;
+	bool operator!=(const SenseProperties &other) const { return !(*this == other); }
+};
+
 class Sense
 {
 private:
@@ -87,20 +134,20 @@ private:
 	QStringList infos;
 	QList<qint32> _stagK;
 	QList<qint32> _stagR;
-	QSet<QString> _partOfSpeech;
-	QSet<QString> _misc;
-	QSet<QString> _dialect;
-	QSet<QString> _field;
+	SenseProperties _partOfSpeech;
+	SenseProperties _misc;
+	SenseProperties _dialect;
+	SenseProperties _field;
 
 public:
-	Sense(const QSet<QString> &partOfSpeech, const QSet<QString> &misc, const QSet<QString> &dialect, const QSet<QString> &field);
+	Sense(const SenseProperties &partOfSpeech, const SenseProperties &misc, const SenseProperties &dialect, const SenseProperties &field);
 	const QList<Gloss> &getGlosses() const { return glosses; }
 	const QStringList &getInfos() const { return infos; }
 
-	const QSet<QString> &partOfSpeech() const { return _partOfSpeech; }
-	const QSet<QString> &misc() const { return _misc; }
-	const QSet<QString> &dialect() const { return _dialect; }
-	const QSet<QString> &field() const { return _field; }
+	const SenseProperties &partOfSpeech() const { return _partOfSpeech; }
+	const SenseProperties &misc() const { return _misc; }
+	const SenseProperties &dialect() const { return _dialect; }
+	const SenseProperties &field() const { return _field; }
 	const QList<qint32> &stagK() const { return _stagK; }
 	void addStagK(qint32 index) { _stagK << index; }
 	const QList<qint32> &stagR() const { return _stagR; }
@@ -113,7 +160,7 @@ public:
 
 class JMdictEntry : public Entry
 {
-	Q_OBJECT
+	Q_DECLARE_TR_FUNCTIONS(JMdictEntry)
 private:
 	QList<KanjiReading> kanjis;
 	QList<KanaReading> kanas;
@@ -151,6 +198,7 @@ public:
 	virtual QStringList writings() const;
 	virtual QStringList readings() const;
 	virtual QStringList meanings() const;
+	virtual int memoryFootprint() const;
 	
 	/**
 	 * Returns true if the most significant meaning of this entry is usually written in kana.
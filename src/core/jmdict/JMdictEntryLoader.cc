@@ -16,23 +16,27 @@
  */
 
 #include "core/Lang.h"
+#include "core/Database.h"
+#include "core/EntrySummary.h"
 #include "core/jmdict/JMdictEntryLoader.h"
 #include "core/jmdict/JMdictPlugin.h"
+#include "core/PackReader.h"
+
+#include <QHash>
 
 JMdictEntryLoader::JMdictEntryLoader() : EntryLoader(), validEntryQuery(&connection), kanjiQuery(&connection), kanaQuery(&connection), sensesQuery(&connection), jlptQuery(&connection)
 {
 	const QMap<QString, QString> &allDBs = JMdictPlugin::instance()->attachedDBs();
-	foreach (const QString &lang, allDBs.keys()) {
-		QString dbAlias(lang.isEmpty() ? "jmdict" : "jmdict_" + lang);
-		if (!connection.attach(allDBs[lang], dbAlias)) {
-			qFatal("JMdictEntryLoader cannot attach JMdict databases!");
-		}
+	QMap<QString, QString> aliases;
+	foreach (const QString &lang, allDBs.keys()) aliases[lang.isEmpty() ? "jmdict" : "jmdict_" + lang] = allDBs[lang];
+	if (!Database::openDictionaryConnection(connection, aliases)) {
+		qFatal("JMdictEntryLoader cannot attach JMdict databases!");
 	}
 
 	// Prepare queries so that we just have to bind and execute them
 	validEntryQuery.prepare("select id from jmdict.entries where jmdict.entries.id = ?");
-	kanjiQuery.prepare("select reading, frequency from jmdict.kanji join jmdict.kanjiText on kanji.docid == kanjiText.docid where id=? order by priority");
-	kanaQuery.prepare("select reading, nokanji, frequency, restrictedTo from jmdict.kana join jmdict.kanaText on kana.docid == kanaText.docid where id=? order by priority");
+	kanjiQuery.prepare("select reading, frequency from jmdict.kanji join jmdict.kanjiText on kanji.docid == kanjiText.rowid where id=? order by priority");
+	kanaQuery.prepare("select reading, nokanji, frequency, restrictedTo from jmdict.kana join jmdict.kanaText on kana.docid == kanaText.rowid where id=? order by priority");
 	sensesQuery.prepare("select " + JMdictPlugin::dbColumns(JMdictPlugin::posMap(), "pos") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::miscMap(), "misc") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::dialMap(), "dial") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::fieldMap(), "field") + ", restrictedToKanji, restrictedToKana from jmdict.senses where id=? order by priority asc");
 	jlptQuery.prepare("select jlpt.level from jmdict.jlpt where jlpt.id=?");
 
@@ -42,11 +46,143 @@ JMdictEntryLoader::JMdictEntryLoader() : EntryLoader(), validEntryQuery(&connect
 		QString sqlString(QString("select glosses from jmdict_%1.glosses where id=?").arg(lang));
 		query.useWith(&connection);
 		query.prepare(sqlString);
+
+		SQLite::Query dictQuery(&connection);
+		SQLite::CompressionDictionary *dict = new SQLite::CompressionDictionary();
+		if (!dictQuery.exec(QString("select glossesDict from jmdict_%1.info").arg(lang)) || !dictQuery.next() || !dict->setDictionary(dictQuery.valueBlob(0)))
+			qWarning("JMdictEntryLoader cannot load glosses dictionary for language %s", lang.toLatin1().data());
+		glossDicts[lang] = dict;
 	}
+
+	QString dbFile(allDBs[""]);
+	QString packFile(dbFile.endsWith(".db") ? dbFile.left(dbFile.size() - 3) + ".pack" : dbFile + ".pack");
+	// Databases built without a pack have no pack table
+	SQLite::Query packQuery(&connection);
+	if (packQuery.exec("select checksum from jmdict.pack") && packQuery.next()) pack.open(packFile, (quint64)packQuery.valueInt64(0));
 }
 
 JMdictEntryLoader::~JMdictEntryLoader()
 {
+	qDeleteAll(glossDicts);
+}
+
+void JMdictEntryLoader::addKanji(JMdictEntry *entry, const SQLite::Query &query, int col)
+{
+	entry->kanjis << KanjiReading(query.valueString(col), 0, query.valueUInt(col + 1));
+}
+
+void JMdictEntryLoader::addKana(JMdictEntry *entry, const SQLite::Query &query, int col)
+{
+	KanaReading kana(query.valueString(col), 0, query.valueUInt(col + 2));
+	// Get kana readings
+	if (query.valueBool(col + 1) == false) {
+		QVector<int> restrictedTo(query.valueIntList(col + 3));
+		if (restrictedTo.isEmpty()) for (int i = 0; i < entry->getKanjiReadings().size(); i++) {
+			kana.addKanjiReading(i);
+		}
+		else for (int i = 0; i < restrictedTo.size(); i++) {
+			kana.addKanjiReading(restrictedTo[i]);
+		}
+	}
+	entry->addKanaReading(kana);
+}
+
+void JMdictEntryLoader::addSense(JMdictEntry *entry, const SQLite::Query &query, int col)
+{
+	int pos = col;
+	SenseProperties posProps, miscProps, dialProps, fieldProps;
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::posMap()); i++)
+		posProps.setWord(i, query.valueUInt64(pos++));
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::miscMap()); i++)
+		miscProps.setWord(i, query.valueUInt64(pos++));
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::dialMap()); i++)
+		dialProps.setWord(i, query.valueUInt64(pos++));
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::fieldMap()); i++)
+		fieldProps.setWord(i, query.valueUInt64(pos++));
+
+	Sense sense(posProps, miscProps, dialProps, fieldProps);
+	// Get restricted readings/writing
+	foreach (int idx, query.valueIntList(pos++)) sense.addStagK(idx);
+	foreach (int idx, query.valueIntList(pos++)) sense.addStagR(idx);
+
+	entry->senses << sense;
+}
+
+void JMdictEntryLoader::addSenseMisc(JMdictEntry *entry, const SQLite::Query &query, int col)
+{
+	SenseProperties miscProps;
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::miscMap()); i++)
+		miscProps.setWord(i, query.valueUInt64(col++));
+	entry->senses << Sense(SenseProperties(), miscProps, SenseProperties(), SenseProperties());
+}
+
+void JMdictEntryLoader::addGlosses(JMdictEntry *entry, const QString &lang, const SQLite::Query &query, int col)
+{
+	addGlosses(entry, lang, QString::fromUtf8(glossDicts[lang]->uncompress(query.valueBlobRaw(col))));
+}
+
+void JMdictEntryLoader::addGlosses(JMdictEntry *entry, const QString &lang, const QString &text)
+{
+	QStringList glosses(text.split("\n\n"));
+	for (int i = 0; i < glosses.size() && i < entry->senses.size(); i++) {
+		// Skip empty glosses
+		if (glosses[i].isEmpty()) continue;
+		// Do not load english if a preferred language is already loaded and the corresponding option is set
+		if (!Lang::alwaysShowEnglish() && lang == "en" && entry->senses[i].getGlosses().size() > 0) continue;
+		entry->senses[i].addGloss(Gloss(lang, glosses[i]));
+	}
+}
+
+bool JMdictEntryLoader::addPacked(JMdictEntry *entry)
+{
+	const uchar *end;
+	const uchar *record = pack.record(entry->id(), end);
+	if (!record) return false;
+	PackReader reader(record, end);
+	quint16 kanjiCount = reader.read<quint16>();
+	quint16 kanaCount = reader.read<quint16>();
+	quint16 sensesCount = reader.read<quint16>();
+	quint8 jlpt = reader.read<quint8>();
+	reader.read<quint8>();
+
+	for (int i = 0; i < kanjiCount && reader.ok(); i++) {
+		quint32 frequency = reader.read<quint32>();
+		entry->kanjis << KanjiReading(reader.readString(), 0, frequency);
+	}
+	for (int i = 0; i < kanaCount && reader.ok(); i++) {
+		quint32 frequency = reader.read<quint32>();
+		bool noKanji = reader.read<quint8>();
+		QVector<int> restrictedTo(reader.readIndices());
+		KanaReading kana(reader.readString(), 0, frequency);
+		// Same as addKana()
+		if (!noKanji) {
+			if (restrictedTo.isEmpty()) for (int j = 0; j < entry->getKanjiReadings().size(); j++) kana.addKanjiReading(j);
+			else foreach (int idx, restrictedTo) kana.addKanjiReading(idx);
+		}
+		entry->addKanaReading(kana);
+	}
+	for (int i = 0; i < sensesCount && reader.ok(); i++) {
+		SenseProperties props[4];
+		for (int kind = 0; kind < 4; kind++)
+			for (int w = 0; w < pack.words((JMdictPack::Words)kind); w++) props[kind].setWord(w, reader.read<quint64>());
+		Sense sense(props[JMdictPack::Pos], props[JMdictPack::Misc], props[JMdictPack::Dial], props[JMdictPack::Field]);
+		foreach (int idx, reader.readIndices()) sense.addStagK(idx);
+		foreach (int idx, reader.readIndices()) sense.addStagR(idx);
+		entry->senses << sense;
+	}
+	if (!reader.ok()) qWarning("Truncated record for entry %d in the JMdict pack", entry->id());
+	if (jlpt) entry->_jlpt = jlpt;
+	return true;
+}
+
+void JMdictEntryLoader::addGlosses(const QHash<EntryId, JMdictEntry *> &byId, const QString &in)
+{
+	SQLite::Query query(&connection);
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
+		if (!glossQueries.contains(lang)) continue;
+		query.exec(QString("select id, glosses from jmdict_%1.glosses where id in (%2)").arg(lang).arg(in));
+		while (query.next()) addGlosses(byId[query.valueUInt(0)], lang, query, 1);
+	}
 }
 
 Entry *JMdictEntryLoader::loadEntry(EntryId id)
@@ -55,6 +191,19 @@ Entry *JMdictEntryLoader::loadEntry(EntryId id)
 
 	loadMiscData(entry);
 
+	if (pack.isOpen()) {
+		if (!addPacked(entry)) return entry;
+		foreach (const QString &lang, Lang::preferredDictLanguages()) {
+			if (!glossQueries.contains(lang)) continue;
+			SQLite::Query &glossQuery = glossQueries[lang];
+			glossQuery.bindValue(entry->id());
+			glossQuery.exec();
+			if (glossQuery.next()) addGlosses(entry, lang, glossQuery, 0);
+			glossQuery.reset();
+		}
+		return entry;
+	}
+
 	validEntryQuery.bindValue(entry->id());
 	validEntryQuery.exec();
 	if (!validEntryQuery.next()) {
@@ -67,79 +216,27 @@ Entry *JMdictEntryLoader::loadEntry(EntryId id)
 	// Kanji readings
 	kanjiQuery.bindValue(entry->id());
 	kanjiQuery.exec();
-	while(kanjiQuery.next()) {
-		entry->kanjis << KanjiReading(kanjiQuery.valueString(0), 0, kanjiQuery.valueUInt(1));
-	}
+	while(kanjiQuery.next()) addKanji(entry, kanjiQuery, 0);
 	kanjiQuery.reset();
 
 	// Kana readings
 	kanaQuery.bindValue(entry->id());
 	kanaQuery.exec();
-	while(kanaQuery.next())
-	{
-		KanaReading kana(kanaQuery.valueString(0), 0, kanaQuery.valueUInt(2));
-		// Get kana readings
-		if (kanaQuery.valueBool(1) == false) {
-			QStringList restrictedTo(kanaQuery.valueString(3).split(',', QString::SkipEmptyParts));
-			if (restrictedTo.isEmpty()) for (int i = 0; i < entry->getKanjiReadings().size(); i++) {
-				kana.addKanjiReading(i);
-			}
-			else for (int i = 0; i < restrictedTo.size(); i++) {
-				kana.addKanjiReading(restrictedTo[i].toInt());
-			}
-		}
-		entry->addKanaReading(kana);
-	}
+	while(kanaQuery.next()) addKana(entry, kanaQuery, 0);
 	kanaQuery.reset();
 
 	// Senses
 	sensesQuery.bindValue(entry->id());
 	sensesQuery.exec();
-	const QMap<QString, QString> allDBs = JMdictPlugin::instance()->attachedDBs();
-	while(sensesQuery.next()) {
-		int pos = 0;
-		QVector<quint64> columns;
-		for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::posMap()); i++)
-			columns << sensesQuery.valueUInt64(pos++);
-		QSet<QString> posStr = JMdictPlugin::shiftsToSet(JMdictPlugin::posShift(), columns);
-		columns.clear();
-		for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::miscMap()); i++)
-			columns << sensesQuery.valueUInt64(pos++);
-		QSet<QString> miscStr = JMdictPlugin::shiftsToSet(JMdictPlugin::miscShift(), columns);
-		columns.clear();
-		for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::dialMap()); i++)
-			columns << sensesQuery.valueUInt64(pos++);
-		QSet<QString> dialStr = JMdictPlugin::shiftsToSet(JMdictPlugin::dialShift(), columns);
-		columns.clear();
-		for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::fieldMap()); i++)
-			columns << sensesQuery.valueUInt64(pos++);
-		QSet<QString> fieldStr = JMdictPlugin::shiftsToSet(JMdictPlugin::fieldShift(), columns);
-
-		Sense sense(posStr, miscStr, dialStr, fieldStr);
-		// Get restricted readings/writing
-		QStringList restrictedTo(sensesQuery.valueString(pos++).split(',', QString::SkipEmptyParts));
-		foreach (const QString &idx, restrictedTo) sense.addStagK(idx.toInt());
-		restrictedTo = sensesQuery.valueString(pos++).split(',', QString::SkipEmptyParts);
-		foreach (const QString &idx, restrictedTo) sense.addStagR(idx.toInt());
-
-		entry->senses << sense;
-	}
+	while(sensesQuery.next()) addSense(entry, sensesQuery, 0);
 	sensesQuery.reset();
+
 	foreach (const QString &lang, Lang::preferredDictLanguages()) {
-		if (!allDBs.contains(lang)) continue;
+		if (!glossQueries.contains(lang)) continue;
 		SQLite::Query &glossQuery = glossQueries[lang];
 		glossQuery.bindValue(entry->id());
 		glossQuery.exec();
-		if (glossQuery.next()) {
-			QStringList glosses(QString::fromUtf8(qUncompress(glossQuery.valueBlob(0))).split("\n\n"));
-			for (int i = 0; i < glosses.size(); i++) {
-				// Skip empty glosses
-				if (glosses[i].isEmpty()) continue;
-				// Do not load english if a preferred language is already loaded and the corresponding option is set
-				if (!Lang::alwaysShowEnglish() && lang == "en" && entry->senses[i].getGlosses().size() > 0) continue;
-				entry->senses[i].addGloss(Gloss(lang, glosses[i]));
-			}
-		}
+		if (glossQuery.next()) addGlosses(entry, lang, glossQuery, 0);
 		glossQuery.reset();
 	}
 
@@ -152,3 +249,105 @@ Entry *JMdictEntryLoader::loadEntry(EntryId id)
 	jlptQuery.reset();
 	return entry;
 }
+
+QVector<Entry *> JMdictEntryLoader::loadEntries(const QVector<EntryId> &ids)
+{
+	QVector<Entry *> ret;
+	QHash<EntryId, JMdictEntry *> byId;
+	ret.reserve(ids.size());
+	foreach (EntryId id, ids) {
+		JMdictEntry *entry = new JMdictEntry(id);
+		ret << entry;
+		byId[id] = entry;
+	}
+	if (ids.isEmpty()) return ret;
+
+	loadMiscData(ret);
+
+	if (pack.isOpen()) {
+		QVector<EntryId> validIds;
+		foreach (JMdictEntry *entry, byId) if (addPacked(entry)) validIds << entry->id();
+		if (!validIds.isEmpty()) addGlosses(byId, idList(validIds));
+		return ret;
+	}
+
+	// Only load the data of entries that exist, the others are returned
+	// empty as loadEntry() does
+	SQLite::Query query(&connection);
+	QVector<EntryId> validIds;
+	query.exec(QString("select id from jmdict.entries where id in (%1)").arg(idList(ids)));
+	while (query.next()) validIds << query.valueUInt(0);
+	if (validIds.isEmpty()) return ret;
+	QString in(idList(validIds));
+
+	// Rows are grouped per entry by sorting on the id first. Kanji
+	// readings must be loaded before kana readings, which may refer to
+	// all of them.
+	query.exec(QString("select id, reading, frequency from jmdict.kanji join jmdict.kanjiText on kanji.docid == kanjiText.rowid where id in (%1) order by id, priority").arg(in));
+	while (query.next()) addKanji(byId[query.valueUInt(0)], query, 1);
+
+	query.exec(QString("select id, reading, nokanji, frequency, restrictedTo from jmdict.kana join jmdict.kanaText on kana.docid == kanaText.rowid where id in (%1) order by id, priority").arg(in));
+	while (query.next()) addKana(byId[query.valueUInt(0)], query, 1);
+
+	query.exec(QString("select id, ") + JMdictPlugin::dbColumns(JMdictPlugin::posMap(), "pos") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::miscMap(), "misc") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::dialMap(), "dial") + ", " + JMdictPlugin::dbColumns(JMdictPlugin::fieldMap(), "field") + QString(", restrictedToKanji, restrictedToKana from jmdict.senses where id in (%1) order by id, priority asc").arg(in));
+	while (query.next()) addSense(byId[query.valueUInt(0)], query, 1);
+
+	addGlosses(byId, in);
+
+	query.exec(QString("select id, level from jmdict.jlpt where id in (%1)").arg(in));
+	while (query.next()) byId[query.valueUInt(0)]->_jlpt = query.valueInt(1);
+
+	return ret;
+}
+
+QVector<EntrySummary> JMdictEntryLoader::loadSummaries(const QVector<EntryId> &ids)
+{
+	// Summaries are built from partial entries that only have their
+	// readings and the glosses of their first senses, taken from the
+	// display rows tables. Senses only get their misc properties, which are
+	// needed to filter them and to know whether the entry is written in
+	// kana. User data is loaded separately since summaries only need to
+	// know whether there is some.
+	QVector<JMdictEntry *> entries;
+	QHash<EntryId, JMdictEntry *> byId;
+	entries.reserve(ids.size());
+	foreach (EntryId id, ids) {
+		JMdictEntry *entry = new JMdictEntry(id);
+		entries << entry;
+		byId[id] = entry;
+	}
+
+	SQLite::Query query(&connection);
+	QVector<EntryId> validIds;
+	if (!ids.isEmpty()) {
+		query.exec(QString("select id, writings, readings from jmdict.displayRows where id in (%1)").arg(idList(ids)));
+		while (query.next()) {
+			JMdictEntry *entry = byId[query.valueUInt(0)];
+			validIds << entry->id();
+			foreach (const QString &writing, query.valueString(1).split('\n', QString::SkipEmptyParts))
+				entry->kanjis << KanjiReading(writing, 0, 0);
+			foreach (const QString &reading, query.valueString(2).split('\n', QString::SkipEmptyParts))
+				entry->addKanaReading(KanaReading(reading, 0, 0));
+		}
+	}
+	if (!validIds.isEmpty()) {
+		QString in(idList(validIds));
+		query.exec(QString("select id, ") + JMdictPlugin::dbColumns(JMdictPlugin::miscMap(), "misc") + QString(" from jmdict.senses where id in (%1) order by id, priority asc").arg(in));
+		while (query.next()) addSenseMisc(byId[query.valueUInt(0)], query, 1);
+
+		foreach (const QString &lang, Lang::preferredDictLanguages()) {
+			if (!glossQueries.contains(lang)) continue;
+			query.exec(QString("select id, glosses from jmdict_%1.displayRows where id in (%2)").arg(lang).arg(in));
+			while (query.next()) addGlosses(byId[query.valueUInt(0)], lang, query.valueString(1));
+		}
+	}
+
+	QVector<EntrySummary> ret;
+	ret.reserve(entries.size());
+	foreach (JMdictEntry *entry, entries) {
+		ret << EntrySummary(*entry);
+		delete entry;
+	}
+	loadMiscData(ret);
+	return ret;
+}
@@ -20,6 +20,8 @@
 
 #include "core/EntryLoader.h"
 #include "core/jmdict/JMdictEntry.h"
+#include "core/jmdict/JMdictPack.h"
+#include "sqlite/Compression.h"
 
 class JMdictEntryLoader : public EntryLoader
 {
@@ -28,12 +30,34 @@ private:
 protected:
 	SQLite::Query validEntryQuery, kanjiQuery, kanaQuery, sensesQuery, jlptQuery;
 	QMap<QString, SQLite::Query> glossQueries;
+	/// Dictionaries used to decompress the glosses of each language
+	QMap<QString, SQLite::CompressionDictionary *> glossDicts;
+	/// Readings, senses and JLPT level are decoded from the pack if there
+	/// is one
+	JMdictPack pack;
+
+	/// Add the data of the result row of query starting at column col to entry
+	void addKanji(JMdictEntry *entry, const SQLite::Query &query, int col);
+	void addKana(JMdictEntry *entry, const SQLite::Query &query, int col);
+	void addSense(JMdictEntry *entry, const SQLite::Query &query, int col);
+	/// Adds a sense with only its misc properties
+	void addSenseMisc(JMdictEntry *entry, const SQLite::Query &query, int col);
+	void addGlosses(JMdictEntry *entry, const QString &lang, const SQLite::Query &query, int col);
+	/// Adds glosses given in the format of the glosses table, uncompressed
+	static void addGlosses(JMdictEntry *entry, const QString &lang, const QString &text);
+	/// Adds the readings, senses and JLPT level of entry from the pack.
+	/// Returns false if entry is not in the pack.
+	bool addPacked(JMdictEntry *entry);
+	/// Adds the glosses of entries from the languages databases
+	void addGlosses(const QHash<EntryId, JMdictEntry *> &byId, const QString &in);
 
 public:
 	JMdictEntryLoader();
 	virtual ~JMdictEntryLoader();
 
 	virtual Entry *loadEntry(EntryId id);
+	virtual QVector<Entry *> loadEntries(const QVector<EntryId> &ids);
+	virtual QVector<EntrySummary> loadSummaries(const QVector<EntryId> &ids);
 };
 
 #endif
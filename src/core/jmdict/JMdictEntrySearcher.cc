@@ -16,14 +16,24 @@
  */
 
 #include "core/TextTools.h"
+#include "core/Database.h"
 #include "core/jmdict/JMdictEntrySearcher.h"
 #include "core/jmdict/JMdictEntry.h"
 #include "core/jmdict/JMdictPlugin.h"
+#include "core/jmdict/JMdictDeinflector.h"
+#include "core/jmdict/JMdictMeaningVectors.h"
+#include "core/EntrySearcherManager.h"
 #include "sqlite/SQLite.h"
 
+#include <QtDebug>
+#include <QThread>
+#include <QCoreApplication>
+
 PreferenceItem<QString> JMdictEntrySearcher::miscPropertiesFilter("jmdict", "miscPropertiesFilter", "arch,obs");
-QSet<QString> JMdictEntrySearcher::_miscFilterMask;
-QSet<QString> JMdictEntrySearcher::_explicitlyRequestedMiscs;
+QMutex JMdictEntrySearcher::_miscFilterMutex;
+SenseProperties JMdictEntrySearcher::_miscFilterMask;
+QVector<quint64> JMdictEntrySearcher::_miscFilterMaskWords(1, 0);
+SenseProperties JMdictEntrySearcher::_explicitlyRequestedMiscs;
 
 JMdictEntrySearcher::JMdictEntrySearcher() : EntrySearcher(JMDICTENTRY_GLOBALID)
 {
@@ -44,9 +54,10 @@ JMdictEntrySearcher::JMdictEntrySearcher() : EntrySearcher(JMDICTENTRY_GLOBALID)
 	QueryBuilder::Join::addTablePriority("jmdict.jlpt", 8);
 
 	QueryBuilder::Order::orderingWay["freq"] = QueryBuilder::Order::DESC;
+	QueryBuilder::Order::orderingWay["relevance"] = QueryBuilder::Order::DESC;
 
 	// Register text search commands
-	validCommands << "romaji" << "mean" << "kana" << "kanji" << "jmdict" << "haskanji" << "jlpt" << "withstudiedkanjis" << "hascomponent" << "withkanaonly";
+	validCommands << "romaji" << "mean" << "kana" << "fuzzykana" << "kanji" << "words" << "deinflect" << "jmdict" << "haskanji" << "jlpt" << "withstudiedkanjis" << "hascomponent" << "withkanaonly";
 	// Also register commands that are sense properties
 	validCommands << "pos" << "misc" << "dial" << "field";
 
@@ -80,35 +91,236 @@ SearchCommand JMdictEntrySearcher::commandFromWord(const QString &word) const
 	//return SearchCommand::invalid();
 }
 
+/// Maximum number of bigrams whose docids are intersected for a word
+#define MAX_SEARCH_BIGRAMS 4
+
+/**
+ * Returns a condition restricting the readings of table to the ones that
+ * contain all the bigrams of the literal parts of w, or an empty string if
+ * w has no bigram.
+ */
+static QString buildBigramsCondition(const QString &w, const QString &table)
+{
+	// Not static: QRegExp keeps the state of its last match
+	const QRegExp regExpChars("[\\?\\*]");
+	QList<quint32> bigrams;
+	foreach (const QString &part, w.split(regExpChars, QString::SkipEmptyParts))
+		foreach (quint32 bigram, TextTools::bigrams(part))
+			if (!bigrams.contains(bigram)) bigrams << bigram;
+	if (bigrams.isEmpty()) return QString();
+
+	QStringList selects;
+	for (int i = 0; i < bigrams.size() && i < MAX_SEARCH_BIGRAMS; i++)
+		selects << QString("select docid from jmdict.%1Bigrams where bigram = %2").arg(table).arg(bigrams[i]);
+	return QString("jmdict.%1.docid in (%2)").arg(table).arg(selects.join(" intersect "));
+}
+
+/**
+ * Returns whether the wildcard word w can be matched against the terms of
+ * the gloss FTS index, i.e. whether all its other characters are part of
+ * a single token.
+ */
+static bool isGlossTermPattern(const QString &w)
+{
+	foreach (const QChar &c, w)
+		if (c != '?' && c != '*' && !c.isLetterOrNumber()) return false;
+	return true;
+}
+
+/// Number of index terms a wildcard gloss word can expand to. Larger
+/// expansions make too large FTS expressions and use the regexp search
+#define MAX_GLOSS_TERMS 1000
+
+/**
+ * Returns whether the terms of the gloss index of lang matching termRegExp
+ * can be looked up using a single FTS expression.
+ */
+static bool glossTermsWithinLimit(const QString &lang, const QString &termRegExp, SQLite::FTS::Version ftsVersion)
+{
+	SQLite::Query query(Database::connection());
+	if (!query.prepare(QString("select count(*) from (select 1 from jmdict_%1.glossTerms where %2 and term REGEXP ? limit %3)").arg(lang).arg(SQLite::FTS::termsCondition(ftsVersion)).arg(MAX_GLOSS_TERMS + 1))) return false;
+	query.bindValue(termRegExp);
+	if (!query.exec() || !query.next()) {
+		qWarning() << "Error counting gloss terms:" << query.lastError().message();
+		return false;
+	}
+	return query.valueInt(0) <= MAX_GLOSS_TERMS;
+}
+
+/**
+ * Returns conditions restricting the left column to entries having at
+ * least one sense with each of the given entity values, using the facets
+ * table.
+ */
+static QStringList buildFacetConditions(JMdictFacet facet, const QSet<quint16> &values)
+{
+	QStringList ret;
+	foreach (quint16 value, values)
+		ret << QString("{{leftcolumn}} in (select id from jmdict.facets where facet = %1 and value = %2)").arg(facet).arg(value);
+	return ret;
+}
+
+static QSet<quint16> maskShifts(quint64 mask)
+{
+	QSet<quint16> ret;
+	for (quint16 i = 0; i < 64; i++)
+		if (mask & (1ULL << i)) ret << i;
+	return ret;
+}
+
+/**
+ * Returns a condition restricting the left column to the entries that
+ * have one of the given words as kanji or kana reading.
+ */
+static QString buildWordsCondition(const QStringList &words)
+{
+	QStringList phrases;
+	foreach (const QString &w, words) phrases << "\"" + QString(w).remove('"').replace('\'', "''") + "\"";
+	return QString("{{leftcolumn}} IN (SELECT id FROM jmdict.kanji JOIN jmdict.kanjiText ON jmdict.kanji.docid = jmdict.kanjiText.rowid WHERE jmdict.kanjiText.reading MATCH '%1' "
+		"UNION SELECT id FROM jmdict.kana JOIN jmdict.kanaText ON jmdict.kana.docid = jmdict.kanaText.rowid WHERE jmdict.kanaText.reading MATCH '%1')").arg(phrases.join(" OR "));
+}
+
+/**
+ * Returns a condition restricting the left column to the entries that
+ * word may be an inflection of, or an empty string if there is none.
+ * Candidates are first checked against the readings of segmenter, and
+ * grouped by type so that each group needs a single lookup.
+ */
+static QString buildDeinflectCondition(const QString &word, JMdictSegmenter &segmenter)
+{
+	QMap<int, QStringList> byTypes;
+	if (segmenter.contains(word)) byTypes[0] << word;
+	foreach (const JMdictDeinflector::Candidate &candidate, JMdictDeinflector::deinflect(word)) {
+		if (JMdictDeinflector::posEntities(candidate.types).isEmpty()) continue;
+		if (segmenter.contains(candidate.word)) byTypes[candidate.types] << candidate.word;
+	}
+
+	QueryBuilder::Where where("OR");
+	bool found = false;
+	for (QMap<int, QStringList>::const_iterator it = byTypes.constBegin(); it != byTypes.constEnd(); ++it) {
+		QString condition(buildWordsCondition(it.value()));
+		// The word itself is not required to have a particular part of speech
+		if (it.key() != 0) {
+			QStringList values;
+			foreach (const QString &pos, JMdictDeinflector::posEntities(it.key())) {
+				QMap<QString, QPair<QString, quint16> >::const_iterator posIt = JMdictPlugin::posMap().find(pos);
+				if (posIt != JMdictPlugin::posMap().constEnd()) values << QString::number(posIt->second);
+			}
+			if (values.isEmpty()) continue;
+			condition = QString("(%1 AND {{leftcolumn}} in (select id from jmdict.facets where facet = %2 and value in (%3)))").arg(condition).arg(JMdictPosFacet).arg(values.join(", "));
+		}
+		where.addWhere(condition);
+		found = true;
+	}
+	return found ? where.toString() : QString();
+}
+
+/**
+ * Returns a condition restricting the left column to the entries having a
+ * reading with the same fuzzy key as one of words, see
+ * TextTools::fuzzyKana(). Its candidates are few enough for the matchRank
+ * of the statement, returned into rank, to compute their edit distance to
+ * the searched words.
+ */
+static QString buildFuzzyKanaCondition(const QStringList &words, QString &rank)
+{
+	static const QString fuzzyMatch("{{leftcolumn}} IN (SELECT id FROM jmdict.kana JOIN jmdict.kanaFuzzyText ON jmdict.kana.docid = jmdict.kanaFuzzyText.rowid WHERE jmdict.kanaFuzzyText.reading MATCH '%1')");
+	// Closest readings first, since the matchRank is sorted descending
+	static const QString distance("(SELECT -min(editdistance(fuzzyText.reading, '%1')) FROM jmdict.kana AS fuzzyKana JOIN jmdict.kanaText AS fuzzyText ON fuzzyKana.docid = fuzzyText.rowid WHERE fuzzyKana.id = {{leftcolumn}})");
+
+	QStringList conds;
+	QStringList distances;
+	foreach (const QString &w, words) {
+		conds << fuzzyMatch.arg(SQLite::FTS::phrase(TextTools::fuzzyKana(w)));
+		distances << distance.arg(w);
+	}
+	rank = distances.join(" + ");
+	return conds.join(" AND ");
+}
+
+/// Number of entries a :similar-meaning search returns per language
+#define SIMILAR_MEANING_RESULTS 100
+
+/**
+ * Returns a condition restricting the left column to the entries whose
+ * meanings are the closest to text, in the searched languages that have
+ * meaning vectors, or an empty string if there is none. The matchRank of
+ * the statement, returned into rank, is their similarity in percents.
+ */
+static QString buildSimilarMeaningCondition(const QString &text, QString &rank)
+{
+	QMap<quint32, float> similarities;
+	foreach (const QString &lang, JMdictPlugin::instance()->searchedLanguages()) {
+		const JMdictMeaningVectors *vectors(JMdictPlugin::instance()->meaningVectors(lang));
+		if (!vectors) continue;
+		foreach (const JMdictMeaningVectors::Match &match, vectors->search(text, SIMILAR_MEANING_RESULTS))
+			if (!similarities.contains(match.first) || similarities[match.first] < match.second) similarities[match.first] = match.second;
+	}
+	if (similarities.isEmpty()) return QString();
+
+	QStringList ids;
+	QStringList cases;
+	for (QMap<quint32, float>::const_iterator it = similarities.constBegin(); it != similarities.constEnd(); ++it) {
+		ids << QString::number(it.key());
+		cases << QString("WHEN %1 THEN %2").arg(it.key()).arg(qRound(it.value() * 100));
+	}
+	rank = QString("(CASE {{leftcolumn}} %1 ELSE 0 END)").arg(cases.join(" "));
+	return QString("{{leftcolumn}} IN (%1)").arg(ids.join(", "));
+}
+
 static QString buildTextSearchCondition(const QStringList &words, const QString &table)
 {
-	static QRegExp regExpChars = QRegExp("[\\?\\*]");
-	static QString ftsMatch("jmdict%3.%2Text.reading MATCH '%1'");
-	static QString regexpMatch("jmdict%3.%2Text.reading REGEXP '%1'");
-	static QString glossRegexpMatch("{{leftcolumn}} in (select id from jmdict_%2.glosses where FTSUNCOMPRESS(glosses) REGEXP '%1')");
-	static QString globalMatch("{{leftcolumn}} IN (SELECT id FROM jmdict%3.%2 JOIN jmdict%3.%2Text ON jmdict%3.%2.docid = jmdict%3.%2Text.docid WHERE %1)");
+	// Not static: QRegExp keeps the state of its last match
+	QRegExp regExpChars("[\\?\\*]");
+	static const QString ftsMatch("jmdict%3.%2Text.reading MATCH '%1'");
+	static const QString regexpMatch("jmdict%3.%2Text.reading REGEXP '%1'");
+	static const QString glossTermsMatch("{{leftcolumn}} in (select id from jmdict_%2.gloss join jmdict_%2.glossText on gloss.docid = glossText.rowid where glossText.reading MATCH (select group_concat('\"' || term || '\"', ' OR ') from jmdict_%2.glossTerms where %3 and term REGEXP '%1'))");
+	static const QString glossRegexpMatch("{{leftcolumn}} in (select id from jmdict_%2.glosses where FTSUNCOMPRESS(glosses, 'jmdict_%2') REGEXP '%1')");
+	static const QString suffixMatch("jmdict.%2.docid IN (SELECT rowid FROM jmdict.%2ReverseText WHERE reading MATCH '%1')");
+	static const QString globalMatch("{{leftcolumn}} IN (SELECT id FROM jmdict%3.%2 JOIN jmdict%3.%2Text ON jmdict%3.%2.docid = jmdict%3.%2Text.rowid WHERE %1)");
 
 	QStringList globalMatches;
-	QStringList langs(JMdictPlugin::instance()->attachedDBs().keys());
-	langs.removeAll("");
+	// Gloss searches are the only ones needing the language databases
+	if (table == "gloss" && !JMdictPlugin::instance()->attachLanguageDatabases()) return QString();
+	QStringList langs(JMdictPlugin::instance()->searchedLanguages());
 	foreach (const QString &lang, langs) {
+		// Readings are in the main database, glosses in the language one
+		SQLite::FTS::Version ftsVersion(Database::ftsVersion(table == "gloss" ? "jmdict_" + lang : "jmdict"));
 		QStringList fts;
 		QStringList conds;
 		QStringList condsGloss;
 		foreach (const QString &w, words) {
-			if (w.contains(regExpChars)) {
+			// Suffix searches become prefix searches on the reversed readings
+			if (table != "gloss" && w.size() > 1 && w[0] == '*' && !w.mid(1).contains(regExpChars)) {
+				conds << suffixMatch.arg(SQLite::FTS::prefixPhrase(ftsVersion, TextTools::reversed(w.mid(1)))).arg(table);
+			} else if (w.contains(regExpChars)) {
 				// First check if we can optimize by using the FTS index (i.e. the first character is not a wildcard)
 				int wildcardIdx = 0;
 				while (!regExpChars.exactMatch(w[wildcardIdx])) wildcardIdx++;
-				if (wildcardIdx != 0) fts << "\"" + w.mid(0, wildcardIdx) + "*\"";
+				if (wildcardIdx != 0) fts << SQLite::FTS::prefixPhrase(ftsVersion, w.mid(0, wildcardIdx));
 				// If the wildcard we found is the last character and a star, there is no need for a regexp search
 				if (wildcardIdx == w.size() - 1 && w.size() > 1 && w[wildcardIdx] == '*') continue;
+				// Without FTS, narrow the readings to match using the bigrams index
+				if (wildcardIdx == 0 && table != "gloss") {
+					QString bigrams(buildBigramsCondition(w, table));
+					if (!bigrams.isEmpty()) conds << bigrams;
+				}
 				// Otherwise insert the regular expression search
 				QString regExp(TextTools::escapeForRegexp(w));
 				if (table != "gloss")
 					conds << regexpMatch.arg(regExp);
-				else
-					condsGloss << glossRegexpMatch.arg(regExp).arg(lang);
+				else {
+					// Wildcard words match whole terms, so look them up
+					// in the vocabulary of the index unless they match
+					// too many of them
+					QString termRegExp(w);
+					termRegExp.replace('?', "\\w").replace('*', "\\w*");
+					termRegExp = "^" + termRegExp + "$";
+					if (isGlossTermPattern(w) && glossTermsWithinLimit(lang, termRegExp, ftsVersion))
+						condsGloss << glossTermsMatch.arg(termRegExp).arg(lang).arg(SQLite::FTS::termsCondition(ftsVersion));
+					else
+						condsGloss << glossRegexpMatch.arg(regExp).arg(lang);
+				}
 			} else fts << "\"" + w + "\"";
 		}
 		if (!fts.isEmpty()) conds.insert(0, ftsMatch.arg(fts.join(" ")));
@@ -126,8 +338,12 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 	// Then process remaining commands
 	QStringList kanjiReadingsMatch;
 	QStringList kanaReadingsMatch;
+	QStringList fuzzyKanaMatch;
+	QStringList similarMeaningSearch;
 	QStringList transReadingsMatch;
 	QStringList romajiSearch;
+	QStringList wordsSearch;
+	QStringList deinflectConditions;
 	QStringList hasKanjiSearch;
 	QStringList hasComponentSearch;
 	quint64 miscFilter(0), dialectFilter(0), fieldFilter(0);
@@ -137,7 +353,7 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 	// First build the global list of all commands
 	foreach(const SearchCommand &command, commands) allCommands << command.command();
 
-	_explicitlyRequestedMiscs.clear();
+	SenseProperties explicitlyRequestedMiscs;
 
 	foreach(const SearchCommand &command, commands) {
 		const QString &commandLabel = command.command();
@@ -155,6 +371,45 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 			}
 			commands.removeOne(command);
 		}
+		else if (commandLabel == "fuzzykana") {
+			// Only plain kana can be normalized
+			bool valid = !command.args().isEmpty();
+			foreach (const QString &arg, command.args())
+				if (!TextTools::isKana(arg) || TextTools::fuzzyKana(arg).isEmpty()) valid = false;
+			if (!valid) continue;
+			fuzzyKanaMatch += command.args();
+			commands.removeOne(command);
+		}
+		else if (commandLabel == "similar-meaning") {
+			// Only available for the languages whose vectors were built
+			if (command.args().isEmpty()) continue;
+			bool hasVectors = false;
+			foreach (const QString &lang, JMdictPlugin::instance()->searchedLanguages())
+				if (JMdictPlugin::instance()->meaningVectors(lang)) hasVectors = true;
+			if (!hasVectors) continue;
+			similarMeaningSearch << command.args().join(" ");
+			commands.removeOne(command);
+		}
+		else if (commandLabel == "words") {
+			// Look up every word of the arguments in one go
+			QStringList words;
+			foreach (const QString &arg, command.args()) words += _segmenter.segment(arg);
+			if (words.isEmpty()) continue;
+			foreach (const QString &w, words) if (!wordsSearch.contains(w)) wordsSearch << w;
+			commands.removeOne(command);
+		}
+		else if (commandLabel == "deinflect") {
+			if (command.args().isEmpty()) continue;
+			QStringList conditions;
+			foreach (const QString &arg, command.args()) {
+				QString condition(buildDeinflectCondition(arg, _segmenter));
+				if (condition.isEmpty()) break;
+				conditions << condition;
+			}
+			if (conditions.size() != command.args().size()) continue;
+			deinflectConditions += conditions;
+			commands.removeOne(command);
+		}
 		else if (command.command() == "romaji") {
 			foreach(const QString &arg, command.args()) romajiSearch << arg;
 			commands.removeOne(command);
@@ -284,7 +539,7 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 				auto it = JMdictPlugin::miscMap().find(arg);
 				if (it != JMdictPlugin::miscMap().end()) {
 					miscFilter |= 1ULL << it->second;
-					_explicitlyRequestedMiscs << arg;
+					explicitlyRequestedMiscs.set(it->second);
 				} else {
 					allArgsProcessed = false;
 				}
@@ -331,17 +586,33 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 			statement.addWhere(where);
 		}
 	}
+	if (!wordsSearch.isEmpty()) statement.addWhere(buildWordsCondition(wordsSearch));
+	foreach (const QString &condition, deinflectConditions) statement.addWhere(condition);
 	if (!kanjiReadingsMatch.isEmpty()) statement.addWhere(buildTextSearchCondition(kanjiReadingsMatch, "kanji"));
 	if (!kanaReadingsMatch.isEmpty()) statement.addWhere(buildTextSearchCondition(kanaReadingsMatch, "kana"));
+	if (!fuzzyKanaMatch.isEmpty()) {
+		QString rank;
+		statement.addWhere(buildFuzzyKanaCondition(fuzzyKanaMatch, rank));
+		if (statement.matchRank().isEmpty()) statement.setMatchRank(rank);
+	}
 	if (!transReadingsMatch.isEmpty()) statement.addWhere(buildTextSearchCondition(transReadingsMatch, "gloss"));
+	foreach (const QString &text, similarMeaningSearch) {
+		QString rank;
+		QString condition(buildSimilarMeaningCondition(text, rank));
+		// No word of text is known, so nothing can match
+		if (condition.isEmpty()) condition = "0";
+		statement.addWhere(condition);
+		if (statement.matchRank().isEmpty()) statement.setMatchRank(rank);
+	}
 
 	// Add where statements for sense filters
 	// Cancel misc filters that have explicitly been required
-	quint64 filteredMisc = 0;
-	for (const auto &misc : miscFilterEntities() - _explicitlyRequestedMiscs) {
-		auto it = JMdictPlugin::miscMap().find(misc);
-		if (it != JMdictPlugin::miscMap().end())
-			filteredMisc |= 1ULL << it->second;
+	quint64 filteredMisc = (JMdictEntrySearcher::miscFilter() - explicitlyRequestedMiscs).word(0);
+	// The senses displayed follow the searches of the user, not the
+	// queries built in the background
+	if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+		QMutexLocker lock(&_miscFilterMutex);
+		_explicitlyRequestedMiscs = explicitlyRequestedMiscs;
 	}
 
 	bool mustJoinSenses = filteredMisc | !posFilter.isEmpty() | miscFilter | dialectFilter | fieldFilter;
@@ -356,6 +627,15 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 				statement.addWhere(QString("jmdict.senses.pos%1 & %2 == %2").arg(i).arg(masks[i]));
 		}
 
+		// The facets give the entries that may match, the senses check
+		// below still ensures all the properties are on the same sense
+		QStringList facets;
+		facets += buildFacetConditions(JMdictPosFacet, posFilter);
+		facets += buildFacetConditions(JMdictMiscFacet, maskShifts(miscFilter));
+		facets += buildFacetConditions(JMdictDialectFacet, maskShifts(dialectFilter));
+		facets += buildFacetConditions(JMdictFieldFacet, maskShifts(fieldFilter));
+		foreach (const QString &facet, facets) statement.addWhere(facet);
+
 		if (miscFilter) statement.addWhere(QString("jmdict.senses.misc0 & %2 == %2").arg(miscFilter));
 		if (dialectFilter) statement.addWhere(QString("jmdict.senses.dial0 & %2 == %2").arg(dialectFilter));
 		if (fieldFilter) statement.addWhere(QString("jmdict.senses.field0 & %2 == %2").arg(fieldFilter));
@@ -404,8 +684,19 @@ void JMdictEntrySearcher::buildStatement(QList<SearchCommand> &commands, QueryBu
 
 void JMdictEntrySearcher::updateMiscFilterMask()
 {
-	_miscFilterMask.clear();
-	foreach (const QString &str, miscPropertiesFilter.value().split(',')) if (JMdictPlugin::miscMap().contains(str)) _miscFilterMask << str;
+	SenseProperties mask;
+	foreach (const QString &str, miscPropertiesFilter.value().split(',')) mask.insert(JMdictPlugin::miscMap(), str);
+	QVector<quint64> words;
+	for (std::size_t i = 0; i < JMdictPlugin::numColumns(JMdictPlugin::miscMap()); i++)
+		words.append(mask.word(i));
+	if (words.isEmpty()) words.append(0);
+	{
+		QMutexLocker lock(&_miscFilterMutex);
+		_miscFilterMask = mask;
+		_miscFilterMaskWords = words;
+	}
+	// Queries built with the previous mask are not valid anymore
+	EntrySearcherManager::instance().clearQueryCache();
 }
 
 QueryBuilder::Column JMdictEntrySearcher::canSort(const QString &sort, const QueryBuilder::Statement &statement)
@@ -425,17 +716,6 @@ QueryBuilder::Column JMdictEntrySearcher::canSort(const QString &sort, const Que
 	}
 	else if (sort == "freq") return QueryBuilder::Column("jmdict.entries", "frequency");
 	else if (sort == "jlpt") return QueryBuilder::Column("jmdict.jlpt", "level");
+	else if (sort == "relevance") return QueryBuilder::Column("jmdict.entries", "relevance");
 	return res;
-}
-
-QVector<quint64> JMdictEntrySearcher::miscFilterMask() {
-	QVector<quint64> ret;
-
-	quint64 miscMask = 0;
-	for (const QString &misc : JMdictEntrySearcher::miscFilterEntities()) {
-		miscMask |= (1 << JMdictPlugin::miscMap()[misc].second);
-	}
-
-	ret.append(miscMask);
-	return ret;
 }
\ No newline at end of file
@@ -25,24 +25,41 @@
 
 #include "core/EntrySearcher.h"
 #include "core/Preferences.h"
+#include "core/jmdict/JMdictEntry.h"
+#include "core/jmdict/JMdictSegmenter.h"
 
 #include <QObject>
+#include <QMutex>
 
+/**
+ * Builds the JMdict part of search queries. Statements can be built from
+ * several threads at once: everything a build depends on is either local
+ * to it or a snapshot taken at its beginning.
+ */
 class JMdictEntrySearcher : public QObject, public EntrySearcher
 {
 	Q_OBJECT
 private:
-	static QSet<QString> _miscFilterMask;
-	static QSet<QString> _explicitlyRequestedMiscs;
+	/// Protects the misc filters, which are read by the threads building
+	/// queries and displaying entries
+	static QMutex _miscFilterMutex;
+	static SenseProperties _miscFilterMask;
+	/// Words of _miscFilterMask, as given to the formatters
+	static QVector<quint64> _miscFilterMaskWords;
+	/// Misc properties requested by the latest search of the GUI thread,
+	/// which senses are displayed even if filtered
+	static SenseProperties _explicitlyRequestedMiscs;
+	/// Used by the words command to split pasted sentences
+	JMdictSegmenter _segmenter;
 
 protected slots:
 	void updateMiscFilterMask();
 
 public:
-	static QSet<QString> miscFilterEntities() { return _miscFilterMask; }
-	static QVector<quint64> miscFilterMask();
+	static SenseProperties miscFilter() { QMutexLocker lock(&_miscFilterMutex); return _miscFilterMask; }
+	static QVector<quint64> miscFilterMask() { QMutexLocker lock(&_miscFilterMutex); return _miscFilterMaskWords; }
 
-	static QSet<QString> explicitlyRequestedMiscs() { return _explicitlyRequestedMiscs; }
+	static SenseProperties explicitlyRequestedMiscs() { QMutexLocker lock(&_miscFilterMutex); return _explicitlyRequestedMiscs; }
 
 	JMdictEntrySearcher();
 	virtual ~JMdictEntrySearcher() {}
@@ -53,6 +70,7 @@ public:
 
 	virtual void buildStatement(QList<SearchCommand> &commands, QueryBuilder::Statement &statement);
 	virtual QueryBuilder::Column canSort(const QString &sort, const QueryBuilder::Statement &statement);
+	virtual QString resultsStamp() const { return miscPropertiesFilter.value(); }
 
 	static PreferenceItem<QString> miscPropertiesFilter;
 };
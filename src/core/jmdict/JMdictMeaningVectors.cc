@@ -0,0 +1,201 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/jmdict/JMdictMeaningVectors.h"
+#include "core/jmdict/JMdictEntry.h"
+
+#include <QFileInfo>
+#include <QtEndian>
+#include <QtDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+JMdictMeaningVectors::JMdictMeaningVectors() : _data(0), _size(0), _wordsCount(0), _entriesCount(0), _listsCount(0), _hashes(0), _weights(0), _wordVectors(0), _centroids(0), _lists(0), _ids(0), _entryVectors(0)
+{
+}
+
+bool JMdictMeaningVectors::open(const QString &vectorsFile, const QString &dbFile)
+{
+	close();
+	_file.setFileName(vectorsFile);
+	if (!_file.exists() || !_file.open(QIODevice::ReadOnly)) return false;
+	_size = _file.size();
+	const uchar *data = _size >= JMDICTVECTORS_HEADER_SIZE ? _file.map(0, _size) : 0;
+	if (!data) {
+		_file.close();
+		return false;
+	}
+
+	const qint64 dims = JMDICTVECTORS_DIMENSIONS;
+	quint16 lists = qFromLittleEndian<quint16>(data + 14);
+	quint32 words = qFromLittleEndian<quint32>(data + 16);
+	quint32 entries = qFromLittleEndian<quint32>(data + 20);
+	qint64 expectedSize = JMDICTVECTORS_HEADER_SIZE + words * (5 + dims) + lists * dims + (lists + 1) * 4 + entries * (4 + dims);
+	if (memcmp(data, JMDICTVECTORS_MAGIC, 4) || qFromLittleEndian<quint32>(data + 4) != JMDICTVECTORS_VERSION
+	    || qFromLittleEndian<quint32>(data + 8) != JMDICTDB_REVISION || qFromLittleEndian<quint16>(data + 12) != dims
+	    || qFromLittleEndian<quint64>(data + 24) != (quint64)QFileInfo(dbFile).size() || expectedSize != _size) {
+		qWarning("%s does not match %s, ignoring it", vectorsFile.toUtf8().constData(), dbFile.toUtf8().constData());
+		_file.unmap(const_cast<uchar *>(data));
+		_file.close();
+		return false;
+	}
+	_data = data;
+	_wordsCount = words;
+	_entriesCount = entries;
+	_listsCount = lists;
+	const uchar *pos = data + JMDICTVECTORS_HEADER_SIZE;
+	_hashes = pos;
+	pos += words * 4;
+	_weights = pos;
+	pos += words;
+	_wordVectors = reinterpret_cast<const qint8 *>(pos);
+	pos += words * dims;
+	_centroids = reinterpret_cast<const qint8 *>(pos);
+	pos += lists * dims;
+	_lists = pos;
+	pos += (lists + 1) * 4;
+	_ids = pos;
+	pos += entries * 4;
+	_entryVectors = reinterpret_cast<const qint8 *>(pos);
+	return true;
+}
+
+void JMdictMeaningVectors::close()
+{
+	if (_data) _file.unmap(const_cast<uchar *>(_data));
+	_data = 0;
+	_wordsCount = _entriesCount = _listsCount = 0;
+	if (_file.isOpen()) _file.close();
+}
+
+QStringList JMdictMeaningVectors::words(const QString &text)
+{
+	QStringList ret;
+	QString word;
+	foreach (const QChar &c, text.toLower()) {
+		if (c.isLetterOrNumber() || c.isMark()) {
+			word += c;
+			continue;
+		}
+		// Single letters carry no meaning
+		if (word.size() > 1) ret << word;
+		word.clear();
+	}
+	if (word.size() > 1) ret << word;
+	return ret;
+}
+
+quint32 JMdictMeaningVectors::wordHash(const QString &word)
+{
+	// FNV-1a
+	quint32 ret = 2166136261U;
+	foreach (char c, word.toUtf8()) {
+		ret ^= (uchar)c;
+		ret *= 16777619U;
+	}
+	return ret;
+}
+
+qint32 JMdictMeaningVectors::dot(const qint8 *a, const qint8 *b)
+{
+#ifdef __SSE2__
+	__m128i sum = _mm_setzero_si128();
+	for (int i = 0; i < JMDICTVECTORS_DIMENSIONS; i += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+		// Sign-extend the bytes to 16 bits, then multiply and add pairs
+		__m128i aLow = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+		__m128i aHigh = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+		__m128i bLow = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+		__m128i bHigh = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(aLow, bLow));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(aHigh, bHigh));
+	}
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+	return _mm_cvtsi128_si32(sum);
+#else
+	qint32 ret = 0;
+	for (int i = 0; i < JMDICTVECTORS_DIMENSIONS; i++) ret += a[i] * b[i];
+	return ret;
+#endif
+}
+
+bool JMdictMeaningVectors::quantize(const QVector<float> &v, qint8 *out)
+{
+	float norm = 0;
+	foreach (float f, v) norm += f * f;
+	norm = std::sqrt(norm);
+	if (norm == 0) return false;
+	for (int i = 0; i < v.size(); i++) out[i] = (qint8)qBound(-127, (int)qRound(v[i] / norm * 127), 127);
+	return true;
+}
+
+bool JMdictMeaningVectors::vector(const QString &text, qint8 *vector) const
+{
+	if (!_data) return false;
+	QVector<float> sum(JMDICTVECTORS_DIMENSIONS, 0);
+	bool found = false;
+	foreach (const QString &word, words(text)) {
+		quint32 hash = wordHash(word);
+		quint32 low = 0, high = _wordsCount;
+		while (low < high) {
+			quint32 mid = low + (high - low) / 2;
+			if (qFromLittleEndian<quint32>(_hashes + mid * 4) < hash) low = mid + 1;
+			else high = mid;
+		}
+		if (low == _wordsCount || qFromLittleEndian<quint32>(_hashes + low * 4) != hash) continue;
+		const qint8 *wordVector = _wordVectors + low * JMDICTVECTORS_DIMENSIONS;
+		float weight = _weights[low] / 16.0f;
+		for (int i = 0; i < JMDICTVECTORS_DIMENSIONS; i++) sum[i] += weight * wordVector[i];
+		found = true;
+	}
+	return found && quantize(sum, vector);
+}
+
+QList<JMdictMeaningVectors::Match> JMdictMeaningVectors::search(const QString &text, int count, int probes) const
+{
+	QList<Match> ret;
+	qint8 query[JMDICTVECTORS_DIMENSIONS];
+	if (count <= 0 || !vector(text, query)) return ret;
+
+	// Closest lists first
+	QVector<QPair<qint32, int> > lists(_listsCount);
+	for (int i = 0; i < _listsCount; i++) lists[i] = qMakePair(-dot(query, _centroids + i * JMDICTVECTORS_DIMENSIONS), i);
+	probes = qMin(probes, (int)_listsCount);
+	std::partial_sort(lists.begin(), lists.begin() + probes, lists.end());
+
+	QVector<QPair<qint32, quint32> > candidates;
+	for (int p = 0; p < probes; p++) {
+		int list = lists[p].second;
+		quint32 first = qFromLittleEndian<quint32>(_lists + list * 4);
+		quint32 last = qMin(qFromLittleEndian<quint32>(_lists + (list + 1) * 4), _entriesCount);
+		for (quint32 i = first; i < last; i++)
+			candidates << qMakePair(-dot(query, _entryVectors + i * JMDICTVECTORS_DIMENSIONS), i);
+	}
+	count = qMin(count, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+	for (int i = 0; i < count; i++)
+		ret << Match(qFromLittleEndian<quint32>(_ids + candidates[i].second * 4), -candidates[i].first / (127.0f * 127.0f));
+	return ret;
+}
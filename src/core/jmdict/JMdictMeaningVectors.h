@@ -0,0 +1,125 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_JMDICT_MEANING_VECTORS_H
+#define __CORE_JMDICT_MEANING_VECTORS_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QPair>
+
+/**
+ * The meaning vectors of a language are a read-only file written by
+ * build_jmdict_db next to jmdict-<lang>.db, used to find the entries whose
+ * meanings are close to a query even if they share no word with it.
+ *
+ * Word vectors are computed by random indexing of the glosses: every word
+ * gets a sparse random signature, and the vector of a word is the sum of
+ * the signatures of the words it shares senses with, weighted by their
+ * inverse sense frequency. Words used in the same senses, e.g. synonyms,
+ * thus get close vectors. The vector of an entry is the weighted sum of
+ * the vectors of the words of its senses, the first senses weighing more.
+ * Vectors are normalized and quantized to JMDICTVECTORS_DIMENSIONS signed
+ * bytes.
+ *
+ * Entries are grouped into lists around the centroids of a k-means
+ * clustering (an inverted file index), so a search only scans the lists of
+ * the centroids closest to the query.
+ *
+ * All numbers are little-endian and nothing is aligned. The file starts
+ * with a header of JMDICTVECTORS_HEADER_SIZE bytes:
+ *   char[4] magic, u32 format version, u32 JMDICTDB_REVISION,
+ *   u16 dimensions, u16 number of lists, u32 number of words,
+ *   u32 number of entries, u64 size of the jmdict-<lang>.db it was
+ *   written from.
+ * It is followed by:
+ *   u32[words] hashes of the words (see wordHash()), sorted,
+ *   u8[words] weights of the words, 16 times their inverse frequency,
+ *   i8[words][dimensions] vectors of the words,
+ *   i8[lists][dimensions] centroids of the lists,
+ *   u32[lists + 1] index of the first entry of each list,
+ *   u32[entries] ids of the entries, sorted by list,
+ *   i8[entries][dimensions] vectors of the entries.
+ */
+#define JMDICTVECTORS_MAGIC "TJMV"
+#define JMDICTVECTORS_VERSION 1
+#define JMDICTVECTORS_HEADER_SIZE 32
+#define JMDICTVECTORS_DIMENSIONS 64
+
+/**
+ * Memory-mapped meaning vectors of a language. Searches only read the
+ * mapped file, so they can run from several threads at once.
+ */
+class JMdictMeaningVectors
+{
+private:
+	QFile _file;
+	const uchar *_data;
+	qint64 _size;
+	quint32 _wordsCount;
+	quint32 _entriesCount;
+	quint16 _listsCount;
+	const uchar *_hashes;
+	const uchar *_weights;
+	const qint8 *_wordVectors;
+	const qint8 *_centroids;
+	const uchar *_lists;
+	const uchar *_ids;
+	const qint8 *_entryVectors;
+
+	JMdictMeaningVectors(const JMdictMeaningVectors &);
+	JMdictMeaningVectors &operator=(const JMdictMeaningVectors &);
+
+public:
+	typedef QPair<quint32, float> Match;
+
+	JMdictMeaningVectors();
+	~JMdictMeaningVectors() { close(); }
+
+	/**
+	 * Maps vectorsFile, which must have been written from dbFile. Returns
+	 * false if the file does not exist or does not match dbFile.
+	 */
+	bool open(const QString &vectorsFile, const QString &dbFile);
+	void close();
+	bool isOpen() const { return _data != 0; }
+
+	/**
+	 * Computes the vector of text into vector. Returns false if none of
+	 * its words is known.
+	 */
+	bool vector(const QString &text, qint8 *vector) const;
+	/**
+	 * Returns the ids of at most count entries closest to text and their
+	 * cosine similarity, the closest first. Only the lists of the probes
+	 * centroids closest to text are scanned.
+	 */
+	QList<Match> search(const QString &text, int count, int probes = 16) const;
+
+	/// Words of text, as they are indexed
+	static QStringList words(const QString &text);
+	static quint32 wordHash(const QString &word);
+	/// Scalar product of two vectors of JMDICTVECTORS_DIMENSIONS bytes
+	static qint32 dot(const qint8 *a, const qint8 *b);
+	/// Normalizes v and writes it into out
+	static bool quantize(const QVector<float> &v, qint8 *out);
+};
+
+#endif
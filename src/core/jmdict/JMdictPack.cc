@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/jmdict/JMdictPack.h"
+#include "core/jmdict/JMdictEntry.h"
+
+#include <QtEndian>
+#include <QtDebug>
+
+#include <cstring>
+
+bool JMdictPack::open(const QString &packFile, quint64 checksum)
+{
+	close();
+	_file.setFileName(packFile);
+	if (!_file.exists() || !_file.open(QIODevice::ReadOnly)) return false;
+	_size = _file.size();
+	const uchar *data = _size >= JMDICTPACK_HEADER_SIZE ? _file.map(0, _size) : 0;
+	if (!data) {
+		_file.close();
+		return false;
+	}
+
+	quint32 count = qFromLittleEndian<quint32>(data + 12);
+	if (memcmp(data, JMDICTPACK_MAGIC, 4) || qFromLittleEndian<quint32>(data + 4) != JMDICTPACK_VERSION
+	    || qFromLittleEndian<quint32>(data + 8) != JMDICTDB_REVISION || qFromLittleEndian<quint64>(data + 16) != checksum
+	    || JMDICTPACK_HEADER_SIZE + (qint64)count * 8 > _size) {
+		qWarning("%s does not match its database, ignoring it", packFile.toUtf8().constData());
+		_file.unmap(const_cast<uchar *>(data));
+		_file.close();
+		return false;
+	}
+	_data = data;
+	_count = count;
+	for (int i = 0; i < 4; i++) _words[i] = data[24 + i];
+	return true;
+}
+
+void JMdictPack::close()
+{
+	if (_data) _file.unmap(const_cast<uchar *>(_data));
+	_data = 0;
+	_count = 0;
+	if (_file.isOpen()) _file.close();
+}
+
+const uchar *JMdictPack::record(quint32 id, const uchar *&end) const
+{
+	if (!_data) return 0;
+	const uchar *index = _data + JMDICTPACK_HEADER_SIZE;
+	quint32 low = 0, high = _count;
+	while (low < high) {
+		quint32 mid = low + (high - low) / 2;
+		quint32 midId = qFromLittleEndian<quint32>(index + mid * 8);
+		if (midId < id) low = mid + 1;
+		else if (midId > id) high = mid;
+		else {
+			quint32 offset = qFromLittleEndian<quint32>(index + mid * 8 + 4);
+			if (offset >= _size) return 0;
+			end = _data + _size;
+			return _data + offset;
+		}
+	}
+	return 0;
+}
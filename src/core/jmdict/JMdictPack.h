@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_JMDICT_PACK_H
+#define __CORE_JMDICT_PACK_H
+
+#include <QFile>
+#include <QString>
+
+/**
+ * The JMdict pack is a read-only file written by build_jmdict_db next to
+ * jmdict.db, holding the readings, senses properties and JLPT level of
+ * every entry so they can be decoded straight from memory instead of
+ * being looked up in several tables. Glosses stay in the language
+ * databases, and searches are still done with SQLite.
+ *
+ * All numbers are little-endian and nothing is aligned. The file starts
+ * with a header of JMDICTPACK_HEADER_SIZE bytes:
+ *   char[4] magic, u32 format version, u32 JMDICTDB_REVISION,
+ *   u32 number of entries, u64 checksum of the index and records,
+ *   u8 number of pos, misc, dial and field words of the senses, u32 0.
+ * The checksum is also recorded in the pack table of the jmdict.db the
+ * pack was written from, so a pack that does not match its database is
+ * ignored.
+ * It is followed by the index of entries, sorted by id:
+ *   (u32 id, u32 offset of the record in the file) for each entry.
+ * Then come the entry records, the most relevant entries first:
+ *   u16 kanji count, u16 kana count, u16 senses count, u8 JLPT level, u8 0,
+ *   kanji: u32 frequency, u16 size, UTF-8 reading,
+ *   kana: u32 frequency, u8 nokanji, u8 n, u8[n] restricted to kanji,
+ *         u16 size, UTF-8 reading,
+ *   senses: u64[] pos, misc, dial and field words, u8 n, u8[n] restricted
+ *           to kanji, u8 n, u8[n] restricted to kana.
+ */
+#define JMDICTPACK_MAGIC "TJPK"
+#define JMDICTPACK_VERSION 2
+#define JMDICTPACK_HEADER_SIZE 32
+
+/**
+ * Memory-mapped JMdict pack.
+ */
+class JMdictPack
+{
+private:
+	QFile _file;
+	const uchar *_data;
+	qint64 _size;
+	quint32 _count;
+	quint8 _words[4];
+
+	JMdictPack(const JMdictPack &);
+	JMdictPack &operator=(const JMdictPack &);
+
+public:
+	typedef enum { Pos = 0, Misc = 1, Dial = 2, Field = 3 } Words;
+
+	JMdictPack() : _data(0), _size(0), _count(0) {}
+	~JMdictPack() { close(); }
+
+	/**
+	 * Maps packFile, which must have been written from the database whose
+	 * pack table holds checksum. Returns false if the pack does not exist
+	 * or does not match checksum, in which case entries must be loaded
+	 * from the database.
+	 */
+	bool open(const QString &packFile, quint64 checksum);
+	void close();
+	bool isOpen() const { return _data != 0; }
+
+	/// Number of 64 bits words of the given kind of sense properties
+	int words(Words kind) const { return _words[kind]; }
+
+	/**
+	 * Returns the record of entry id and sets end to the end of the file,
+	 * or 0 if the entry is not in the pack.
+	 */
+	const uchar *record(quint32 id, const uchar *&end) const;
+};
+
+#endif
@@ -25,23 +25,39 @@ JMdictParser::JMdictParser(const QStringList &langs) : languages(langs), gotVers
 {
 }
 
-static uint getFreqScore(const QString &code)
+static uint getFreqScore(const QStringRef &code)
 {
-	if (code == "news1") return 50;
-	else if (code == "news2") return 10;
-	else if (code == "ichi1") return 50;
-	else if (code == "ichi2") return 10;
-	else if (code == "spec1") return 50;
-	else if (code == "spec2") return 10;
-	else if (code == "gai1") return 50;
-	else if (code == "gai2") return 10;
-	else if (code.mid(0, 2) == "nf") return 51 - code.mid(2,4).toInt();
+	if (code == QLatin1String("news1")) return 50;
+	else if (code == QLatin1String("news2")) return 10;
+	else if (code == QLatin1String("ichi1")) return 50;
+	else if (code == QLatin1String("ichi2")) return 10;
+	else if (code == QLatin1String("spec1")) return 50;
+	else if (code == QLatin1String("spec2")) return 10;
+	else if (code == QLatin1String("gai1")) return 50;
+	else if (code == QLatin1String("gai2")) return 10;
+	else if (code.startsWith(QLatin1String("nf"))) return 51 - code.mid(2, 4).toInt();
 	else {
 		qDebug() << "Unknown frequency code" << code;
 		return 0;
 	}
 }
 
+const QString &JMdictParser::entityName(const QStringRef &value) const
+{
+	static const QString unknownEntity;
+	// Wrap the reader's buffer for the lookup instead of copying it. The
+	// returned name is shared with the sense that stores it.
+	QHash<QString, QString>::const_iterator it = reversedEntities.constFind(QString::fromRawData(value.unicode(), value.size()));
+	if (it == reversedEntities.constEnd()) return unknownEntity;
+	return it.value();
+}
+
+static void registerEntity(QHash<QString, quint16> &bitFields, int &bitFieldsCount, const QString &key)
+{
+	// If not met yet, calculate the bit field for this entity
+	if (bitFields.constFind(key) == bitFields.constEnd()) bitFields.insert(key, bitFieldsCount++);
+}
+
 bool JMdictParser::parse(QXmlStreamReader &reader)
 {
 	DOCUMENT_BEGIN(reader)
@@ -51,6 +67,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 				const QString nString = decl.name().toString();
 				entities[nString] = vString;
 				reversedEntities[vString] = nString;
+				declaredEntities << nString;
 			}
 		}
 		TAG(JMdict)
@@ -59,7 +76,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 			TAG_BEGIN(entry)
 				TAG(ent_seq)
 					CHARACTERS
-					entry.id = TEXT.toInt();
+					entry.id = TEXTREF.toInt();
 					DONE
 				ENDTAG
 				TAG_PRE(k_ele)
@@ -72,7 +89,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 						DONE
 					ENDTAG
 					TAG(ke_pri)
-						kWriting.frequency = getFreqScore(TEXT);
+						kWriting.frequency = getFreqScore(TEXTREF);
 						entry.frequency += kWriting.frequency;
 					ENDTAG
 				ENDTAG
@@ -86,7 +103,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 						DONE
 					ENDTAG
 					TAG(re_pri)
-						kReading.frequency = getFreqScore(TEXT);
+						kReading.frequency = getFreqScore(TEXTREF);
 						entry.frequency += kReading.frequency;
 					ENDTAG
 					TAG_PRE(re_nokanji)
@@ -95,7 +112,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 					ENDTAG
 					TAG(re_restr)
 						CHARACTERS
-						QString writing(TEXT);
+						const QStringRef writing(TEXTREF);
 						// Find the index of the writing that matches the given parameter
 						int idx = 0;
 						foreach (const JMdictKanjiWritingItem &kWriting, entry.kanji) {
@@ -130,36 +147,28 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 						DONE
 					ENDTAG
 					TAG(pos)
-						QString key(reversedEntities[TEXT]);
+						const QString &key = entityName(TEXTREF);
 						sense.pos << key;
-						// If not met yet, calculate the bit field for this entity
-						if (!posBitFields.contains(key))
-							posBitFields[key] = posBitFieldsCount++;
+						registerEntity(posBitFields, posBitFieldsCount, key);
 					ENDTAG
 					TAG(field)
-						QString key(reversedEntities[TEXT]);
+						const QString &key = entityName(TEXTREF);
 						sense.field << key;
-						// If not met yet, calculate the bit field for this entity
-						if (!fieldBitFields.contains(key))
-							fieldBitFields[key] = fieldBitFieldsCount++;
+						registerEntity(fieldBitFields, fieldBitFieldsCount, key);
 					ENDTAG
 					TAG(misc)
-						QString key(reversedEntities[TEXT]);
+						const QString &key = entityName(TEXTREF);
 						sense.misc << key;
-						// If not met yet, calculate the bit field for this entity
-						if (!miscBitFields.contains(key))
-							miscBitFields[key] = miscBitFieldsCount++;
+						registerEntity(miscBitFields, miscBitFieldsCount, key);
 					ENDTAG
 					TAG(dial)
-						QString key(reversedEntities[TEXT]);
+						const QString &key = entityName(TEXTREF);
 						sense.dialect << key;
-						// If not met yet, calculate the bit field for this entity
-						if (!dialBitFields.contains(key))
-							 dialBitFields[key] = dialectBitFieldsCount++;
+						registerEntity(dialBitFields, dialectBitFieldsCount, key);
 					ENDTAG
 					TAG(stagk)
 						CHARACTERS
-						QString writing(TEXT);
+						const QStringRef writing(TEXTREF);
 						// Find the index of the writing that matches the given parameter
 						int idx = 0;
 						foreach (const JMdictKanjiWritingItem &kWriting, entry.kanji) {
@@ -174,7 +183,7 @@ bool JMdictParser::parse(QXmlStreamReader &reader)
 					ENDTAG
 					TAG(stagr)
 						CHARACTERS
-						QString reading(TEXT);
+						const QStringRef reading(TEXTREF);
 						// Find the index of the writing that matches the given parameter
 						int idx = 0;
 						foreach (const JMdictKanaReadingItem &kReading, entry.kana) {
@@ -88,6 +88,12 @@ protected:
 	bool gotVersion;
 	QString _dictVersion;
 
+	/**
+	 * Returns the name of the entity whose value is value, or an
+	 * empty string if no such entity has been declared.
+	 */
+	const QString &entityName(const QStringRef &value) const;
+
 public:
 	QHash<QString, quint16> posBitFields;
 	int posBitFieldsCount;
@@ -100,6 +106,8 @@ public:
 
 	QHash<QString, QString> entities;
 	QHash<QString, QString> reversedEntities;
+	/// Entity names, in the order the DTD declares them
+	QStringList declaredEntities;
 
 	JMdictParser(const QStringList &langs);
 	virtual ~JMdictParser() {}
@@ -20,15 +20,23 @@
 #include "core/Paths.h"
 #include "core/Lang.h"
 #include "core/Database.h"
+#include "core/StartupTrace.h"
 #include "core/EntrySearcherManager.h"
+#include "core/DictionaryWarmer.h"
 #include "core/jmdict/JMdictPlugin.h"
 #include "core/jmdict/JMdictEntry.h"
 #include "core/jmdict/JMdictEntrySearcher.h"
 #include "core/jmdict/JMdictEntryLoader.h"
+#include "core/jmdict/JMdictMeaningVectors.h"
 
 #include <QtDebug>
 #include <QFile>
 #include <QDir>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QCoreApplication>
 
 #define dictFileConfigString "jmdict/database"
 #define dictFileConfigDefault "jmdict.db"
@@ -44,6 +52,42 @@ QVector<QString> JMdictPlugin::_dialShift;
 QMap<QString, QPair<QString, quint16>> JMdictPlugin::_fieldMap;
 QVector<QString> JMdictPlugin::_fieldShift;
 
+/// Released once the entities tables have been preloaded
+static QSemaphore _entitiesPreloaded;
+static bool _entitiesPreloading = false;
+
+class JMdictEntitiesLoader : public QRunnable
+{
+private:
+	QString _dbFile;
+
+public:
+	JMdictEntitiesLoader(const QString &dbFile) : _dbFile(dbFile) {}
+
+	virtual void run()
+	{
+		{
+			StartupPhase phase("JMdict entities");
+			SQLite::Connection connection;
+			if (connection.connect(":memory:") && connection.attach(_dbFile, "jmdict", SQLite::Connection::ReadOnly)) {
+				SQLite::Query query(&connection);
+				JMdictPlugin::queryAllEntities(&query);
+			} else qWarning("Cannot preload JMdict entities: %s", connection.lastError().message().toLatin1().data());
+		}
+		_entitiesPreloaded.release();
+	}
+};
+
+void JMdictPlugin::preloadEntities()
+{
+	if (_entitiesPreloading) return;
+	QString dbFile(lookForFile("jmdict.db"));
+	// onRegister() will complain
+	if (dbFile.isEmpty()) return;
+	_entitiesPreloading = true;
+	QThreadPool::globalInstance()->start(new JMdictEntitiesLoader(dbFile));
+}
+
 JMdictPlugin::JMdictPlugin() : Plugin("JMdict")
 {
 	_instance = this;
@@ -82,30 +126,87 @@ bool JMdictPlugin::attachAllDatabases()
 
 	_attachedDBs[""] = dbFile;
 
-	// Then look for language databases
+	// Then look for language databases. They are only attached once a
+	// search needs them, see attachLanguageDatabases()
+	_languagesAttached = false;
 	foreach (const QString &lang, Lang::preferredDictLanguages()) {
 		dbFile = lookForFile(QString("jmdict-%1.db").arg(lang));
 		if (dbFile.isEmpty()) continue;
-		if (!Database::attachDictionaryDB(dbFile, QString("jmdict_%1").arg(lang), JMDICTDB_REVISION)) continue;
 		_attachedDBs[lang] = dbFile;
+		// Semantic searches are only available if the vectors were built
+		QString vectorsFile(lookForFile(QString("jmdict-%1.vec").arg(lang)));
+		if (vectorsFile.isEmpty()) continue;
+		JMdictMeaningVectors *vectors = new JMdictMeaningVectors();
+		if (vectors->open(vectorsFile, dbFile)) _meaningVectors[lang] = vectors;
+		else delete vectors;
 	}
 	if (_attachedDBs.size() == 1) {
 		qFatal("JMdict plugin fatal error: no language database present!");
 		return false;
 	}
 
+	// Trees read by every search, that are worth having in the page cache
+	// before the first one
+	dbFile = _attachedDBs[""];
+	// The language databases are built along with the main one, so they
+	// use the same FTS version
+	SQLite::FTS::Version ftsVersion(Database::ftsVersion("jmdict"));
+	QString segmentsKey(SQLite::FTS::segmentsKeyColumn(ftsVersion));
+	DictionaryWarmer::addTarget(dbFile, SQLite::FTS::segmentsTable(ftsVersion, "kanaText"), segmentsKey, "substr(block, -1)");
+	DictionaryWarmer::addTarget(dbFile, SQLite::FTS::segmentsTable(ftsVersion, "kanjiText"), segmentsKey, "substr(block, -1)");
+	DictionaryWarmer::addTarget(dbFile, "entries", "id", "frequency");
+	DictionaryWarmer::addTarget(dbFile, "kana", "id", "docid", "idx_kana");
+	DictionaryWarmer::addTarget(dbFile, "kanji", "id", "docid", "idx_kanji");
+	DictionaryWarmer::addTarget(dbFile, "senses", "id", "priority");
+	foreach (const QString &lang, _attachedDBs.keys()) {
+		if (lang.isEmpty()) continue;
+		DictionaryWarmer::addTarget(_attachedDBs[lang], SQLite::FTS::segmentsTable(ftsVersion, "glossText"), segmentsKey, "substr(block, -1)");
+		DictionaryWarmer::addTarget(_attachedDBs[lang], "gloss", "docid", "id");
+		DictionaryWarmer::addTarget(_attachedDBs[lang], "glosses", "id", "substr(glosses, -1)");
+	}
+
 	return true;
 }
 
+bool JMdictPlugin::attachLanguageDatabases()
+{
+	if (_languagesAttached) return true;
+	if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+		qWarning("JMdict plugin warning: language databases can only be attached from the GUI thread");
+		return false;
+	}
+	_languagesAttached = true;
+	foreach (const QString &lang, _attachedDBs.keys()) {
+		if (lang.isEmpty()) continue;
+		if (!Database::attachDictionaryDB(_attachedDBs[lang], QString("jmdict_%1").arg(lang), JMDICTDB_REVISION)) {
+			qWarning("JMdict plugin warning: cannot attach database for language %s", lang.toUtf8().constData());
+			_attachedDBs.remove(lang);
+		}
+	}
+	return true;
+}
+
+QStringList JMdictPlugin::searchedLanguages() const
+{
+	QStringList ret;
+	foreach (const QString &lang, Lang::preferredDictLanguages())
+		if (_attachedDBs.contains(lang)) ret << lang;
+	return ret;
+}
+
 void JMdictPlugin::detachAllDatabases()
 {
 	QString dbAlias;
 	foreach (const QString &lang, _attachedDBs.keys()) {
+		DictionaryWarmer::removeTargets(_attachedDBs[lang]);
+		if (!lang.isEmpty() && !_languagesAttached) continue;
 		dbAlias = lang.isEmpty() ? "jmdict" : "jmdict_" + lang;
 		if (!Database::detachDictionaryDB(dbAlias))
 			qWarning("JMdict plugin warning: Cannot detach database %s", dbAlias.toUtf8().constData());
 	}
 	_attachedDBs.clear();
+	qDeleteAll(_meaningVectors);
+	_meaningVectors.clear();
 }
 
 void JMdictPlugin::queryEntities(SQLite::Query *query, const QString &entity, QMap<QString, QPair<QString, quint16>> *map, QVector<QString> *shift)
@@ -120,6 +221,28 @@ void JMdictPlugin::queryEntities(SQLite::Query *query, const QString &entity, QM
 		Q_ASSERT(shift->size() == bitShift);
 		shift->append(name);
 	}
+	if (numColumns(*map) > (std::size_t)SenseProperties::maxWords)
+		qWarning("JMdict plugin warning: too many %s entities, some of them will be ignored", entity.toLatin1().constData());
+}
+
+void JMdictPlugin::queryAllEntities(SQLite::Query *query)
+{
+	queryEntities(query, "pos", &_posMap, &_posShift);
+	queryEntities(query, "misc", &_miscMap, &_miscShift);
+	queryEntities(query, "dialect", &_dialMap, &_dialShift );
+	queryEntities(query, "field", &_fieldMap, &_fieldShift);
+}
+
+void JMdictPlugin::clearEntities()
+{
+	_posMap.clear();
+	_posShift.clear();
+	_miscMap.clear();
+	_miscShift.clear();
+	_dialMap.clear();
+	_dialShift.clear();
+	_fieldMap.clear();
+	_fieldShift.clear();
 }
 
 bool JMdictPlugin::onRegister()
@@ -134,19 +257,22 @@ bool JMdictPlugin::onRegister()
 	if (query.next()) _dictVersion = query.valueString(0);
 	query.clear();
 
-	// Populate the entities tables
-	queryEntities(&query, "pos", &_posMap, &_posShift);
-	queryEntities(&query, "misc", &_miscMap, &_miscShift);
-	queryEntities(&query, "dialect", &_dialMap, &_dialShift );
-	queryEntities(&query, "field", &_fieldMap, &_fieldShift);
+	// Populate the entities tables, unless they have been preloaded
+	if (_entitiesPreloading) {
+		_entitiesPreloaded.acquire();
+		_entitiesPreloading = false;
+	}
+	if (_posMap.isEmpty() || _miscMap.isEmpty()) {
+		clearEntities();
+		queryAllEntities(&query);
+	}
 
 	// Register our entry searcher
 	searcher = new JMdictEntrySearcher();
 	EntrySearcherManager::instance().addInstance(searcher);
 
 	// Register our entry loader
-	loader = new JMdictEntryLoader();
-	if (!EntriesCache::instance().addLoader(JMDICTENTRY_GLOBALID, loader)) return false;
+	if (!EntriesCache::instance().addLoader(JMDICTENTRY_GLOBALID, &createEntryLoader<JMdictEntryLoader>)) return false;
 
 	return true;
 }
@@ -155,21 +281,13 @@ bool JMdictPlugin::onUnregister()
 {
 	// Remove the entry loader
 	EntriesCache::instance().removeLoader(JMDICTENTRY_GLOBALID);
-	delete loader;
 
 	// Remove our entry searcher and delete it
 	EntrySearcherManager::instance().removeInstance(searcher);
 	delete searcher;
 
 	// Clear all entities tables
-	_posMap.clear();
-	_posShift.clear();
-	_miscMap.clear();
-	_miscShift.clear();
-	_dialMap.clear();
-	_dialShift.clear();
-	_fieldMap.clear();
-	_fieldShift.clear();
+	clearEntities();
 
 	// Detach our databases
 	detachAllDatabases();
@@ -177,22 +295,6 @@ bool JMdictPlugin::onUnregister()
 	return true;
 }
 
-QSet<QString> JMdictPlugin::shiftsToSet(const QVector<QString>& shift, const QVector<quint64>& bits) {
-	QSet<QString> ret;
-
-	for (int i = 0; i < bits.size(); i++) {
-		int cpt = 0;
-		quint64 bits_set = bits[i];
-		while (bits_set != 0) {
-			if (bits_set & 1)
-				ret << shift[cpt + (i * 64)];
-			bits_set >>= 1;
-			cpt++;
-		}
-	}
-	return ret;
-}
-
 std::size_t JMdictPlugin::numColumns(const QMap<QString, QPair<QString, quint16>> &map) {
 	return (map.size() + 63) / 64;
 }
@@ -23,19 +23,24 @@
 #include <QVector>
 #include <QPair>
 #include <QMap>
+#include <QStringList>
 
 class JMdictEntrySearcher;
-class JMdictEntryLoader;
+class JMdictMeaningVectors;
 
 class JMdictPlugin : public Plugin
 {
 private:
 	static JMdictPlugin *_instance;
 	QString _dictVersion;
+	/// Database files, by language. The main database has no language.
 	QMap<QString, QString> _attachedDBs;
+	/// Whether the language databases are attached to the shared connections
+	bool _languagesAttached;
+	/// Meaning vectors of the languages that have them
+	QMap<QString, JMdictMeaningVectors *> _meaningVectors;
 
 	JMdictEntrySearcher *searcher;
-	JMdictEntryLoader *loader;
 
 	static QMap<QString, QPair<QString, quint16>> _posMap;
 	static QVector<QString> _posShift;
@@ -47,6 +52,9 @@ private:
 	static QVector<QString> _fieldShift;
 
 	static void queryEntities(SQLite::Query *query, const QString &entity, QMap<QString, QPair<QString, quint16>> *map, QVector<QString> *shift);
+	static void queryAllEntities(SQLite::Query *query);
+	static void clearEntities();
+	friend class JMdictEntitiesLoader;
 
 	bool attachAllDatabases();
 	void detachAllDatabases();
@@ -55,11 +63,38 @@ public:
 	JMdictPlugin();
 	virtual ~JMdictPlugin();
 	static JMdictPlugin *instance() { return _instance; }
+	/**
+	 * Starts loading the entities tables in the background, from a
+	 * connection of their own, so it can be done while the database
+	 * and the other plugins are being initialized. onRegister() waits
+	 * for them.
+	 */
+	static void preloadEntities();
 	virtual bool onRegister();
 	virtual bool onUnregister();
 	const QString &dictVersion() const { return _dictVersion; }
 	virtual QString pluginInfo() const;
+	/**
+	 * Returns the database files of the plugin, by language. Loaders attach
+	 * them to their own connection; the language databases are only attached
+	 * to the shared connections after attachLanguageDatabases().
+	 */
 	const QMap<QString, QString> &attachedDBs() const { return _attachedDBs; }
+	/// Returns the meaning vectors of lang, or 0 if it has none
+	const JMdictMeaningVectors *meaningVectors(const QString &lang) const { return _meaningVectors.value(lang); }
+	/**
+	 * Attaches the language databases to the shared connections, if not
+	 * done yet. Must be called from the GUI thread before building a
+	 * query that uses their tables. Returns false if they are not attached.
+	 */
+	bool attachLanguageDatabases();
+	/**
+	 * Languages of the attached databases whose glosses are displayed, in
+	 * order of preference. Searches only look for glosses in these, since
+	 * the preferred languages may have changed since the databases were
+	 * looked for.
+	 */
+	QStringList searchedLanguages() const;
 
 	// Maps the short string to long description and bitshift
 	static const QMap<QString, QPair<QString, quint16>> &posMap() { return _posMap; }
@@ -71,8 +106,6 @@ public:
 	static const QMap<QString, QPair<QString, quint16>> &fieldMap() { return _fieldMap; }
 	static const QVector<QString> &fieldShift() { return _fieldShift; }
 
-	static QSet<QString> shiftsToSet(const QVector<QString>& shift, const QVector<quint64>& bits);
-
 	// Helpers for building queries
 	static std::size_t numColumns(const QMap<QString, QPair<QString, quint16>> &map);
 	static QString dbColumns(const QMap<QString, QPair<QString, quint16>> &map, const QString &column_name);
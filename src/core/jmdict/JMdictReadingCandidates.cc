@@ -0,0 +1,119 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/jmdict/JMdictReadingCandidates.h"
+#include "core/jmdict/JMdictPlugin.h"
+#include "core/jmdict/JMdictEntry.h"
+#include "core/kanjidic2/Kanjidic2Entry.h"
+#include "core/Database.h"
+
+#include <QtDebug>
+
+#define QUERY(Q) if (!query.exec(Q)) return false
+#define STRINGIFY_(X) #X
+#define STRINGIFY(X) STRINGIFY_(X)
+#define JMDICT STRINGIFY(JMDICTENTRY_GLOBALID)
+#define KANJI STRINGIFY(KANJIDIC2ENTRY_GLOBALID)
+
+/// Number of studied kanji of the vocabulary entry ID
+#define STUDIED_KANJI(ID) "(SELECT count(*) FROM jmdict.kanjiChar k JOIN training tk ON tk.type = " KANJI " AND tk.id = k.kanji WHERE k.id = " ID " AND k.priority = 0)"
+
+bool JMdictReadingCandidates::createTables(SQLite::Query &query)
+{
+	QUERY("CREATE TABLE IF NOT EXISTS jmdictReadingCandidates(id INTEGER PRIMARY KEY, kanjiCount INT NOT NULL, nbStudiedKanji INT NOT NULL)");
+	QUERY("CREATE TABLE IF NOT EXISTS jmdictReadingChanges(type INT NOT NULL, id INTEGER NOT NULL, PRIMARY KEY(type, id))");
+	// Dictionary version the candidates have been computed with
+	QUERY("CREATE TABLE IF NOT EXISTS jmdictReadingInfo(dictVersion TEXT)");
+	// Only additions and removals matter, which INSERT OR REPLACE reports as
+	// an insertion
+	QUERY("CREATE TRIGGER IF NOT EXISTS jmdictReadingChanges_added AFTER INSERT ON training "
+		"WHEN NEW.type IN (" JMDICT ", " KANJI ") BEGIN "
+		"INSERT OR IGNORE INTO jmdictReadingChanges VALUES(NEW.type, NEW.id); END");
+	QUERY("CREATE TRIGGER IF NOT EXISTS jmdictReadingChanges_removed AFTER DELETE ON training "
+		"WHEN OLD.type IN (" JMDICT ", " KANJI ") BEGIN "
+		"INSERT OR IGNORE INTO jmdictReadingChanges VALUES(OLD.type, OLD.id); END");
+	return true;
+}
+
+/// Inserts the candidates among the studied vocabulary entries matching WHERE
+static bool insertCandidates(SQLite::Query &query, const QString &where)
+{
+	QUERY(QString("INSERT INTO jmdictReadingCandidates SELECT e.id, e.kanjiCount, " STUDIED_KANJI("e.id") " "
+		"FROM training t JOIN jmdict.entries e ON e.id = t.id JOIN jmdict.senses s ON s.id = e.id AND s.priority = 0 "
+		"WHERE t.type = " JMDICT " AND e.kanjiCount > 0 AND (s.misc0 & %1) = 0%2")
+		.arg(1 << JMdictPlugin::miscMap()["uk"].second).arg(where));
+	return true;
+}
+
+bool JMdictReadingCandidates::rebuild(SQLite::Query &query, const QString &dictVersion)
+{
+	QUERY("DELETE FROM jmdictReadingCandidates");
+	QUERY("DELETE FROM jmdictReadingChanges");
+	if (!insertCandidates(query, "")) return false;
+	QUERY("DELETE FROM jmdictReadingInfo");
+	if (!query.prepare("INSERT INTO jmdictReadingInfo VALUES(?)")) return false;
+	query.bindValue(dictVersion);
+	return query.exec();
+}
+
+bool JMdictReadingCandidates::applyChanges(SQLite::Query &query)
+{
+	// Vocabulary entries are recomputed, which also takes care of their kanji
+	QUERY("DELETE FROM jmdictReadingCandidates WHERE id IN (SELECT id FROM jmdictReadingChanges WHERE type = " JMDICT ")");
+	if (!insertCandidates(query, " AND t.id IN (SELECT id FROM jmdictReadingChanges WHERE type = " JMDICT ")")) return false;
+	// Then the entries using the changed kanji
+	QUERY("UPDATE jmdictReadingCandidates SET nbStudiedKanji = " STUDIED_KANJI("jmdictReadingCandidates.id") " "
+		"WHERE id IN (SELECT k.id FROM jmdict.kanjiChar k WHERE k.priority = 0 AND k.kanji IN (SELECT id FROM jmdictReadingChanges WHERE type = " KANJI "))");
+	QUERY("DELETE FROM jmdictReadingChanges");
+	return true;
+}
+
+bool JMdictReadingCandidates::update(SQLite::Connection *connection)
+{
+	if (!JMdictPlugin::instance()) return false;
+	// Pending study list changes must have reached the changes table
+	DatabaseWriter::flush();
+
+	SQLite::Transaction transaction(connection);
+	if (!transaction.isActive()) return false;
+	SQLite::Query query(connection);
+	if (!createTables(query)) goto failed;
+
+	{
+		const QString &dictVersion(JMdictPlugin::instance()->dictVersion());
+		if (!query.exec("SELECT dictVersion FROM jmdictReadingInfo")) goto failed;
+		bool upToDate(query.next() && query.valueString(0) == dictVersion);
+		if (!(upToDate ? applyChanges(query) : rebuild(query, dictVersion))) goto failed;
+	}
+	return transaction.commit();
+
+failed:
+	qCritical() << "Cannot update reading candidates:" << query.lastError().message();
+	return false;
+}
+
+QString JMdictReadingCandidates::selectStatement(const QString &columns)
+{
+	return QString("SELECT %1 FROM jmdictReadingCandidates c JOIN training ON training.type = " JMDICT " AND training.id = c.id WHERE c.nbStudiedKanji = c.kanjiCount").arg(columns);
+}
+
+#undef STUDIED_KANJI
+#undef KANJI
+#undef JMDICT
+#undef STRINGIFY
+#undef STRINGIFY_
+#undef QUERY
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_JMDICT_READINGCANDIDATES_H
+#define __CORE_JMDICT_READINGCANDIDATES_H
+
+#include "sqlite/Query.h"
+
+#include <QString>
+
+/**
+ * Studied vocabulary entries eligible for reading practice, that is the
+ * entries which are not usually written using kana only and for which all
+ * the kanji are studied too.
+ *
+ * Finding them requires joining the whole study list with the dictionary,
+ * so the result is kept in the jmdictReadingCandidates table of the user
+ * database along with the number of studied kanji of each entry. Triggers
+ * record the entries and kanji added to or removed from the study list,
+ * and update() only recomputes the candidates they affect. The table is
+ * rebuilt when the dictionary changes.
+ */
+class JMdictReadingCandidates
+{
+private:
+	static bool createTables(SQLite::Query &query);
+	static bool rebuild(SQLite::Query &query, const QString &dictVersion);
+	static bool applyChanges(SQLite::Query &query);
+
+public:
+	/**
+	 * Brings the candidates table up to date with the study list. Must
+	 * be called before selecting candidates.
+	 */
+	static bool update(SQLite::Connection *connection);
+	/**
+	 * Returns a statement selecting columns from the candidates (table
+	 * alias c) and their training data (alias training). Constraints on
+	 * the training data can be appended with " and ...".
+	 */
+	static QString selectStatement(const QString &columns);
+};
+
+#endif
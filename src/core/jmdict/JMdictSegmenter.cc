@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TextTools.h"
+#include "core/Database.h"
+#include "core/jmdict/JMdictSegmenter.h"
+#include "sqlite/Query.h"
+
+#include <QElapsedTimer>
+#include <QtDebug>
+
+JMdictSegmenter::JMdictSegmenter() : _maxLength(0), _loaded(0)
+{
+}
+
+quint64 JMdictSegmenter::readingKey(const QString &reading)
+{
+	// Kana readings are matched regardless of their script
+	QString key(TextTools::hiragana2Katakana(reading));
+	return (quint64(qHash(key, 0)) << 32) | qHash(key, 0x9e3779b9);
+}
+
+void JMdictSegmenter::load()
+{
+	QMutexLocker lock(&_loadMutex);
+	// Loaded by another thread while we were waiting
+	if (_loaded.loadAcquire()) return;
+	SQLite::Query query(Database::threadConnection());
+	if (!query.exec("select reading from jmdict.kanjiText union all select reading from jmdict.kanaText")) {
+		qWarning("Cannot load JMdict readings for segmentation");
+		// Do not try again
+		_loaded.storeRelease(1);
+		return;
+	}
+	while (query.next()) {
+		QString reading(query.valueString(0));
+		_readings << readingKey(reading);
+		_maxLength = qMax(_maxLength, reading.size());
+	}
+	// Only published once complete, since readers do not lock
+	_loaded.storeRelease(1);
+}
+
+bool JMdictSegmenter::contains(const QString &reading)
+{
+	if (!_loaded.loadAcquire()) load();
+	return _readings.contains(readingKey(reading));
+}
+
+QStringList JMdictSegmenter::segment(const QString &text, int maxWords, int budget)
+{
+	if (!_loaded.loadAcquire()) load();
+
+	QElapsedTimer timer;
+	timer.start();
+	QStringList ret;
+	int pos = 0;
+	while (pos < text.size()) {
+		if (maxWords && ret.size() >= maxWords) break;
+		if (budget && timer.elapsed() >= budget) break;
+		int len = qMin(_maxLength, text.size() - pos);
+		for (; len > 0; len--)
+			if (_readings.contains(readingKey(text.mid(pos, len)))) break;
+		if (len == 0) {
+			pos++;
+			continue;
+		}
+		QString word(text.mid(pos, len));
+		if (!ret.contains(word)) ret << word;
+		pos += len;
+	}
+	return ret;
+}
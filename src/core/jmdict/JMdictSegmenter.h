@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_JMDICT_SEGMENTER_H
+#define __CORE_JMDICT_SEGMENTER_H
+
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QAtomicInt>
+#include <QMutex>
+
+/**
+ * Splits Japanese text into the JMdict words it contains, using a
+ * longest-match lookup over all the kanji and kana readings of the
+ * dictionary.
+ *
+ * Readings are loaded from the jmdict database the first time they are
+ * needed. Only a 64 bits hash of each reading is kept in memory, which is
+ * enough to tell whether a substring is a reading since the words found
+ * are then looked up in the database anyway.
+ *
+ * The readings are loaded from the connection of the first thread that
+ * needs them. Once loaded they are only read, so a segmenter can be used
+ * from several threads at once.
+ */
+class JMdictSegmenter
+{
+private:
+	QSet<quint64> _readings;
+	int _maxLength;
+	QAtomicInt _loaded;
+	QMutex _loadMutex;
+
+	static quint64 readingKey(const QString &reading);
+	void load();
+
+public:
+	JMdictSegmenter();
+
+	/**
+	 * Returns the words found in text, in order of appearance and without
+	 * duplicates. At each position the longest reading is taken, and
+	 * characters that start no reading are skipped.
+	 *
+	 * If maxWords is not 0, stops after that many words. If budget is not
+	 * 0, stops after that many milliseconds, so that large texts cannot
+	 * take forever; this does not include the loading of the readings.
+	 */
+	QStringList segment(const QString &text, int maxWords = 0, int budget = 0);
+	/// Returns true if reading is (very likely) a kanji or kana reading
+	bool contains(const QString &reading);
+};
+
+#endif
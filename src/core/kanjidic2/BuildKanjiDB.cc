@@ -17,15 +17,31 @@
 
 #include "sqlite/Connection.h"
 #include "sqlite/Query.h"
+#include "sqlite/FTS.h"
 #include "core/Database.h"
 #include "core/TextTools.h"
+#include "core/GzipDevice.h"
+#include "core/BuilderStatistics.h"
+#include "core/BuilderInputs.h"
+#include "core/ItemsQueue.h"
 #include "core/kanjidic2/Kanjidic2Parser.h"
 #include "core/kanjidic2/KanjiVGParser.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
+#include "core/kanjidic2/KanjiStrokePath.h"
+#include "core/kanjidic2/KanjiStrokeFeatures.h"
 
 #include <QStringList>
 #include <QByteArray>
 #include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QBuffer>
+#include <QThread>
+#include <QDataStream>
+#include <QVector>
+#include <QHash>
+
+#include <algorithm>
 
 #include <QtDebug>
 
@@ -36,19 +52,17 @@
 #define EXEC_STMT(query, stmt)  { if (!query.exec(stmt)) { qCritical("%s", query.lastError().message().toUtf8().data()); return false; } }
 #define ASSERT(cond) { if (!cond) { qCritical("%s: assert condition failed, line %d", __FILE__, __LINE__); return false; } }
 
-QMap<quint32, quint8> knownRadicals;
-QSet<QPair<uint, quint8> > insertedRadicals;
 QString srcDir, dstDir;
 
 SQLite::Query insertOrIgnoreEntryQuery;
 SQLite::Query insertRadicalQuery;
 
 SQLite::Query addRadicalQuery;
-SQLite::Query insertRootComponentQuery;
 
 SQLite::Query insertEntryQuery;
 SQLite::Query insertReadingQuery;
 SQLite::Query insertReadingTextQuery;
+SQLite::Query insertReadingReverseTextQuery;
 SQLite::Query insertNanoriQuery;
 SQLite::Query insertNanoriTextQuery;
 SQLite::Query insertSkipCodeQuery;
@@ -58,9 +72,15 @@ SQLite::Query updateJLPTLevelsQuery;
 SQLite::Query insertStrokeGroupQuery;
 SQLite::Query updatePathsString;
 
-QMap<QString, SQLite::Query> insertMeaningQueries;
-QMap<QString, SQLite::Query> insertMeaningTextQueries;
+/// Number of kanji the parser hands to the language writers at once
+#define ITEMS_BATCH_SIZE 256
+/// Number of batches that can wait for a writer before the parser blocks
+#define MAX_QUEUED_BATCHES 16
 
+/**
+ * Writes the main database from the parsing thread, and hands the parsed
+ * kanji to the writers of the language databases.
+ */
 class Kanjidic2DBParser : public Kanjidic2Parser
 {
 public:
@@ -69,8 +89,13 @@ public:
 	virtual bool onDTD(const QString &dtd);
 	bool updateJLPTLevel(const QString &fName, int level);
 	bool updateJLPTLevels();
+	/// Pushes the last batch and closes the queues of the writers
+	void closeQueues();
+
+	QList<ItemsQueue<Kanjidic2Item> *> queues;
 
 private:
+	QList<Kanjidic2Item> batch;
 };
 
 bool Kanjidic2DBParser::onItemParsed(Kanjidic2Item &kanji)
@@ -91,6 +116,10 @@ bool Kanjidic2DBParser::onItemParsed(Kanjidic2Item &kanji)
 			// TODO factorize identical readings! Record the row id into a hash table
 			BIND(insertReadingTextQuery, reading);
 			EXEC(insertReadingTextQuery);
+			// Suffix searches are prefix searches on the reversed readings
+			BIND(insertReadingReverseTextQuery, insertReadingTextQuery.lastInsertId());
+			BIND(insertReadingReverseTextQuery, TextTools::reversed(reading));
+			EXEC(insertReadingReverseTextQuery);
 			BIND(insertReadingQuery, insertReadingTextQuery.lastInsertId());
 			BIND(insertReadingQuery, kanji.id);
 			// TODO reading type should be a tinyInt, not a string!
@@ -99,23 +128,6 @@ bool Kanjidic2DBParser::onItemParsed(Kanjidic2Item &kanji)
 		}
 	}
 
-	// Meanings - output the first language that we can satisfy
-	foreach (const QString &lang, kanji.meanings.keys()) {
-		if (languages.contains(lang)) {
-			foreach (const QString &meaning, kanji.meanings[lang]) {
-				SQLite::Query &mQuery = insertMeaningQueries[lang];
-				SQLite::Query &mtQuery = insertMeaningTextQueries[lang];
-				// TODO factorize identical meanings! Record the row id into a hash table
-				BIND(mtQuery, meaning);
-				EXEC(mtQuery);
-				BIND(mQuery, mtQuery.lastInsertId());
-				BIND(mQuery, kanji.id);
-				BIND(mQuery, qCompress(meaning.toUtf8(), 9));
-				EXEC(mQuery);
-			}
-		}
-	}
-
 	// Nanori
 	foreach (const QString &n, kanji.nanori) {
 		// TODO factorize identical nanoris! Record the row id into a hash table
@@ -162,11 +174,26 @@ bool Kanjidic2DBParser::onItemParsed(Kanjidic2Item &kanji)
 		BIND(insertRadicalQuery, kanji.id);
 		BIND(insertRadicalQuery, rad.second);
 		EXEC(insertRadicalQuery);
-		insertedRadicals << QPair<uint, quint8>(kanji.id, rad.first);
+	}
+
+	// Meanings are written by the language writers
+	batch << kanji;
+	if (batch.size() >= ITEMS_BATCH_SIZE) {
+		foreach (ItemsQueue<Kanjidic2Item> *queue, queues) queue->push(batch);
+		batch.clear();
 	}
 	return true;
 }
 
+void Kanjidic2DBParser::closeQueues()
+{
+	foreach (ItemsQueue<Kanjidic2Item> *queue, queues) {
+		if (!batch.isEmpty()) queue->push(batch);
+		queue->close();
+	}
+	batch.clear();
+}
+
 /* Extract dictionary reference descriptions from DTD. */
 bool Kanjidic2DBParser::onDTD(const QString &dtd)
 {
@@ -269,57 +296,28 @@ bool KanjiVGDBParser::onItemParsed(KanjiVGItem &kanji)
 		QByteArray pathsIndexes;
 		foreach (quint8 index, group.pathsIndexes) pathsIndexes.append(index);
 		BIND(insertStrokeGroupQuery, pathsIndexes);
+		AUTO_BIND(insertStrokeGroupQuery, group.radicalType, KanjiVGGroupItem::NONE);
 		EXEC(insertStrokeGroupQuery);
 	}
 
-	// Insert strokes
-	QStringList paths;
+	// Insert strokes, compiled so the program does not need to parse them
+	QList<QByteArray> paths;
 	foreach (const KanjiVGStrokeItem &stroke, kanji.strokes) {
-		paths << stroke.path;
+		paths << KanjiStrokePath::compile(stroke.path);
 	}
-	QByteArray compressedPaths(paths.join("|").toLatin1());
 	if (!paths.isEmpty()) {
 		BIND(updatePathsString, paths.size());
-		BIND(updatePathsString, qCompress(compressedPaths, 9));
+		BIND(updatePathsString, qCompress(KanjiStrokePath::pack(paths), 9));
 		BIND(updatePathsString, kanji.id);
 		EXEC(updatePathsString);
 	}
-	// Insert radicals
-	//foreach (const KanjiVGGroupItem &group, kanji.groups) if (group.radicalType != KanjiVGGroupItem::NONE) {
-	foreach (const KanjiVGGroupItem &group, kanji.groups)
-	{
-		if (knownRadicals.contains(group.element) || knownRadicals.contains(group.original)) {
-			quint8 radCode;
-			if (knownRadicals.contains(group.element)) radCode = knownRadicals[group.element];
-			else if (group.original && knownRadicals.contains(group.original)) {
-				radCode = knownRadicals[group.original];
-			} else {
-				qDebug("Radical (%s,%s) for kanji %s not in the radicals list",
-					   TextTools::unicodeToSingleChar(group.element).toUtf8().constData(),
-					   TextTools::unicodeToSingleChar(group.original).toUtf8().constData(),
-					   TextTools::unicodeToSingleChar(kanji.id).toUtf8().constData());
-				continue;
-			}
-			// Do not insert radicals already inserted from kanjidic2
-			QPair<uint, quint8> rad(kanji.id, radCode);
-			if (insertedRadicals.contains(rad)) continue;
-			BIND(insertRadicalQuery, radCode);
-			BIND(insertRadicalQuery, kanji.id);
-			if (group.radicalType != 0) {
-				BIND(insertRadicalQuery, group.radicalType);
-			} else {
-				BINDNULL(insertRadicalQuery);
-			}
-			EXEC(insertRadicalQuery);
-			insertedRadicals << rad;
-		}
-	}
-
 	parsedKanji << kanji.id;
 
 	return true;
 }
 
+class KanjiDBWriter;
+
 class KanjiDB {
 public:
 	KanjiDB(const QStringList &lngs, QString kanjidic2File_, QString kanjivgFile_, QString sourceDirectory, QString destinationDirectory) {
@@ -329,60 +327,191 @@ public:
 		srcDir = sourceDirectory;
 		dstDir = destinationDirectory;
 		kdicParser = new Kanjidic2DBParser(languages);
+		ftsVersion = SQLite::FTS::FTS4;
 	}
+	~KanjiDB() { delete kdicParser; }
+	/// Stored in the info table, see inputsChecksum()
+	QString inputsChecksum;
+	/// Version of the FTS tables to create
+	SQLite::FTS::Version ftsVersion;
+
 	bool prepareQueries();
 	bool clearQueries();
 	bool createRadicalsTable(const QString &fName);
 	bool createRootComponentsTable();
+	bool insertStrokeGroupsRadicals();
+	bool createSelectorPostingsTable();
 	bool createTables();
+	bool computeRelevance();
 	bool createIndexes();
-	bool finalize();
+	bool createPackedTable();
+	/// Computes the handwriting recognition features from the paths
+	bool createStrokeFeaturesTable();
+	/// Computes the kanji the most similar to each kanji
+	bool createSimilarKanjiTable();
+	/// Completes and closes the main database
+	bool finalizeMain();
 	bool openDatabase(QString databaseName, QString handle);
-	bool closeDatabase(QString handle);
+	bool closeDatabase(SQLite::Connection &connection);
 	bool parse();
 	bool fillMainInfoTable();
-	bool fillLanguagesInfoTable();
-
-	bool updateTranslations(const QStringList &supportedLanguages);
-	bool updateTranslation(const QString &fName, const QString &lang);
+	bool fillLanguageInfoTable(SQLite::Connection &connection);
+
+	/// Starts one writer thread per language database
+	void startWriters();
+	/// Language writers finalize their database once the queues are
+	/// closed, this waits for them
+	bool waitWriters();
+	/// Run by the writer of lang. Writers do not access the connections
+	/// map, the main thread keeps using it
+	bool writeLanguageDatabase(const QString &lang, SQLite::Connection &connection, ItemsQueue<Kanjidic2Item> &queue);
+	static bool insertMeanings(SQLite::Query &mQuery, SQLite::Query &mtQuery, uint kanji, const QStringList &meanings);
+	/// Copies the KanjiVG data of the previous database rather than
+	/// parsing the same release again
+	bool importPreviousKanjiVG();
+	/// Removes the previous database, once the new one is complete
+	bool removePreviousDatabase();
+
+	/// Loads the replacement meanings of the JMF files
+	bool parseJMFs(const QStringList &supportedLanguages);
+	bool parseJMF(const QString &fName, const QString &lang);
+
+	Kanjidic2DBParser *parser() { return kdicParser; }
 
 private:
 	QStringList languages;
 	QString kanjidic2File;
 	QString kanjivgFile;
 	KanjiVGDBParser kvgParser;
+	QString kanjiVGVersion;
+	/// SHA-1 of the KanjiVG file, as given
+	QString kanjiVGChecksum;
 	Kanjidic2DBParser* kdicParser;
 	QMap<QString, SQLite::Connection> connections;
+	QList<KanjiDBWriter *> writers;
+	/// Meanings given by the JMF files, which replace those of kanjidic2
+	QMap<QString, QMap<uint, QStringList> > jmf;
+};
+
+class KanjiDBWriter : public QThread
+{
+private:
+	KanjiDB *_db;
+	QString _lang;
+	SQLite::Connection *_connection;
+	bool _success;
+
+protected:
+	virtual void run()
+	{
+		_success = _db->writeLanguageDatabase(_lang, *_connection, queue);
+		// Errors can occur before the queue is emptied
+		if (!_success) queue.discard();
+	}
+
+public:
+	ItemsQueue<Kanjidic2Item> queue;
+
+	KanjiDBWriter(KanjiDB *db, const QString &lang, SQLite::Connection *connection) : _db(db), _lang(lang), _connection(connection), _success(false), queue(MAX_QUEUED_BATCHES) {}
+	bool success() const { return _success; }
 };
 
+void KanjiDB::startWriters()
+{
+	foreach (const QString &lang, languages) writers << new KanjiDBWriter(this, lang, &connections[lang]);
+	foreach (KanjiDBWriter *writer, writers) {
+		kdicParser->queues << &writer->queue;
+		writer->start();
+	}
+}
+
+bool KanjiDB::waitWriters()
+{
+	bool success = true;
+	foreach (KanjiDBWriter *writer, writers) {
+		writer->wait();
+		success &= writer->success();
+		delete writer;
+	}
+	writers.clear();
+	kdicParser->queues.clear();
+	return success;
+}
+
+bool KanjiDB::insertMeanings(SQLite::Query &mQuery, SQLite::Query &mtQuery, uint kanji, const QStringList &meanings)
+{
+	foreach (const QString &meaning, meanings) {
+		// TODO factorize identical meanings! Record the row id into a hash table
+		BIND(mtQuery, meaning);
+		EXEC(mtQuery);
+		BIND(mQuery, mtQuery.lastInsertId());
+		BIND(mQuery, kanji);
+		BIND(mQuery, qCompress(meaning.toUtf8(), 9));
+		EXEC(mQuery);
+	}
+	return true;
+}
+
+bool KanjiDB::writeLanguageDatabase(const QString &lang, SQLite::Connection &connection, ItemsQueue<Kanjidic2Item> &queue)
+{
+	QElapsedTimer timer;
+	timer.start();
+	SQLite::Query mQuery(&connection);
+	SQLite::Query mtQuery(&connection);
+	ASSERT(mQuery.prepare("insert into meaning values(?, ?, ?)"));
+	ASSERT(mtQuery.prepare("insert into meaningText values(?)"));
+
+	QMap<uint, QStringList> replacements(jmf.value(lang));
+	bool success = true;
+	QList<Kanjidic2Item> items;
+	// The queue is discarded after an error, so the parser never blocks
+	while (success && queue.pop(items)) {
+		foreach (const Kanjidic2Item &kanji, items) {
+			// The JMF files replace the meanings of kanjidic2
+			if (replacements.contains(kanji.id)) success = insertMeanings(mQuery, mtQuery, kanji.id, replacements.take(kanji.id));
+			else success = insertMeanings(mQuery, mtQuery, kanji.id, kanji.meanings.value(lang));
+			if (!success) break;
+		}
+	}
+	if (!success) return false;
+	// Kanji kanjidic2 does not know about
+	foreach (uint kanji, replacements.keys()) ASSERT(insertMeanings(mQuery, mtQuery, kanji, replacements[kanji]));
+	mQuery.clear();
+	mtQuery.clear();
+	qDebug("%s: writing meanings took %lld ms", lang.toLatin1().data(), timer.restart());
+
+	SQLite::Query query(&connection);
+	EXEC_STMT(query, "create index idx_meaning_entry on meaning(entry)");
+	EXEC_STMT(query, "DELETE FROM meaningText_content");
+	query.clear();
+	// The KanjiVG version is known once the queues are closed
+	ASSERT(fillLanguageInfoTable(connection));
+	ASSERT(closeDatabase(connection));
+	qDebug("%s: finalizing took %lld ms", lang.toLatin1().data(), timer.restart());
+	return true;
+}
+
 bool KanjiDB::prepareQueries()
 {
 #define PREPQUERY(query, text) query.useWith(&connections["main"]); query.prepare(text)
 	PREPQUERY(insertRadicalQuery, "insert into radicals values(?, ?, ?)");
-	PREPQUERY(insertOrIgnoreEntryQuery, "insert or ignore into entries values(?, ?, ?, ?, ?, ?, ?, null)");
+	PREPQUERY(insertOrIgnoreEntryQuery, "insert or ignore into entries values(?, ?, ?, ?, ?, ?, ?, null, null)");
 	PREPQUERY(addRadicalQuery, "insert into radicalsList values(?, ?)");
-	PREPQUERY(insertRootComponentQuery, "insert into rootComponents values(?)");
 
-	PREPQUERY(insertEntryQuery, "insert into entries values(?, ?, ?, ?, ?, ?, ?, null)");
+	PREPQUERY(insertEntryQuery, "insert into entries values(?, ?, ?, ?, ?, ?, ?, null, null)");
 	PREPQUERY(insertReadingQuery, "insert into reading values(?, ?, ?)");
 	PREPQUERY(insertReadingTextQuery, "insert into readingText values(?)");
+	PREPQUERY(insertReadingReverseTextQuery, "insert into readingReverseText(rowid, reading) values(?, ?)");
 	PREPQUERY(insertNanoriQuery, "insert into nanori values(?, ?)");
 	PREPQUERY(insertNanoriTextQuery, "insert into nanoriText values(?)");
 	PREPQUERY(insertSkipCodeQuery, "insert into skip values(?, ?, ?, ?)");
 	PREPQUERY(insertFourCornerQuery, "insert into fourCorner values(?, ?, ?, ?, ?, ?)");
 	PREPQUERY(updateJLPTLevelsQuery, "update entries set jlpt = ? where id = ?");
 
-	PREPQUERY(insertStrokeGroupQuery, "insert into strokeGroups values(?, ?, ?, ?, ?)");
+	PREPQUERY(insertStrokeGroupQuery, "insert into strokeGroups values(?, ?, ?, ?, ?, ?)");
 	PREPQUERY(updatePathsString, "update entries set strokeCount = ?, paths = ? where id = ?");
 
 #undef PREPQUERY
-
-	foreach (const QString &lang, languages) {
-#define PREPQUERY(query, text) query.useWith(&connections[lang]); query.prepare(text)
-		PREPQUERY(insertMeaningQueries[lang], "insert into meaning values(?, ?, ?)");
-		PREPQUERY(insertMeaningTextQueries[lang], "insert into meaningText values(?)");
-#undef PREPQUERY
-	}
 	return true;
 }
 
@@ -392,11 +521,11 @@ bool KanjiDB::clearQueries()
 	insertOrIgnoreEntryQuery.clear();
 
 	addRadicalQuery.clear();
-	insertRootComponentQuery.clear();
 
 	insertEntryQuery.clear();
 	insertReadingQuery.clear();
 	insertReadingTextQuery.clear();
+	insertReadingReverseTextQuery.clear();
 	insertNanoriQuery.clear();
 	insertNanoriTextQuery.clear();
 	insertSkipCodeQuery.clear();
@@ -406,11 +535,6 @@ bool KanjiDB::clearQueries()
 	insertStrokeGroupQuery.clear();
 	updatePathsString.clear();
 
-	foreach (const QString &lang, languages) {
-		insertMeaningQueries[lang].clear();
-		insertMeaningTextQueries[lang].clear();
-	}
-
 	return true;
 }
 
@@ -419,11 +543,15 @@ bool KanjiDB::openDatabase(QString databaseName, QString handle)
 	QString dbFile = QDir(dstDir).absoluteFilePath(databaseName);
 	QFile dst(dbFile);
 	SQLite::Connection &connection = connections[handle];
+	// The previous main database is kept until the new one is built, so
+	// its KanjiVG data can be reused
+	QString previousFile(dbFile + ".previous");
+	if (handle == "main" && dst.exists() && (!QFile(previousFile).exists() || QFile::remove(previousFile))) QFile::rename(dbFile, previousFile);
 	if (dst.exists() && !dst.remove()) {
 		qCritical("Error - cannot remove existing destination file!");
 		return false;
 	}
-	if (!connection.connect(dbFile, SQLite::Connection::JournalInFile)) {
+	if (!connection.connect(dbFile, SQLite::Connection::BulkLoad)) {
 		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
 		return false;
 	}
@@ -431,11 +559,13 @@ bool KanjiDB::openDatabase(QString databaseName, QString handle)
 	return true;
 }
 
-bool KanjiDB::closeDatabase(QString handle)
+bool KanjiDB::closeDatabase(SQLite::Connection &connection)
 {
-	SQLite::Connection &connection = connections[handle];
 	connection.exec("analyze");
 	ASSERT(connection.commit());
+	// Do not depend on the default page size of the SQLite we are linked
+	// against, VACUUM applies it when rebuilding the file
+	ASSERT(connection.exec("pragma page_size = 4096"));
 	ASSERT(connection.exec("VACUUM"));
 	QFile(connection.dbFileName()).setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther);
 	ASSERT(connection.close());
@@ -445,15 +575,168 @@ bool KanjiDB::closeDatabase(QString handle)
 bool KanjiDB::createRootComponentsTable()
 {
 	SQLite::Query query(&connections["main"]);
-	if (!query.exec("select distinct ks.element from strokeGroups as ks join entries as e on ks.element = e.id where ks.element not in (select distinct kanji from strokeGroups where element != kanji) "
+	EXEC_STMT(query, "insert into rootComponents select distinct ks.element from strokeGroups as ks join entries as e on ks.element = e.id where ks.element not in (select distinct kanji from strokeGroups where element != kanji) "
 	        // We are not counting components that are only components of themselves (whatever that means)
-	        "and ks.kanji != ks.element "
-	        "order by strokeCount")) {
-		return false;
+	        "and ks.kanji != ks.element");
+	return true;
+}
+
+/**
+ * Inserts the radicals of the kanji found in their KanjiVG groups, unless
+ * kanjidic2 already gave them. A group is a radical if its element, or else
+ * its original element, is in the radicals list. The first group of a kanji
+ * giving a radical sets its type.
+ */
+bool KanjiDB::insertStrokeGroupsRadicals()
+{
+	SQLite::Query query(&connections["main"]);
+	EXEC_STMT(query, "create index idx_radicals on radicals(kanji)");
+	EXEC_STMT(query, "create temp table strokeGroupsRadicals(number INTEGER, kanji INTEGER, type TINYINT)");
+	// Bare columns take the values of the row min() picks
+	EXEC_STMT(query, "insert into temp.strokeGroupsRadicals select number, kanji, type from "
+		"(select coalesce((select max(number) from radicalsList as rl where rl.kanji = g.element), (select max(number) from radicalsList as rl where rl.kanji = g.original)) as number, "
+		"g.kanji as kanji, g.radicalType as type, min(g.rowid) from strokeGroups as g group by g.kanji, number) "
+		"where number is not null");
+	EXEC_STMT(query, "insert into radicals select number, kanji, type from temp.strokeGroupsRadicals as sr "
+		"where not exists (select 1 from radicals as r where r.kanji = sr.kanji and r.number = sr.number) order by kanji, number");
+	EXEC_STMT(query, "drop table temp.strokeGroupsRadicals");
+	return true;
+}
+
+/**
+ * Encodes an increasing list of kanji as the differences between
+ * successive kanji, written as varints. Decoded by
+ * KanjiComponentIndex::decodePostings().
+ */
+static QByteArray encodePostings(const QList<uint> &kanji)
+{
+	QByteArray ret;
+	uint prev = 0;
+	foreach (uint k, kanji) {
+		uint delta = k - prev;
+		prev = k;
+		while (delta >= 0x80) {
+			ret += (char)((delta & 0x7f) | 0x80);
+			delta >>= 7;
+		}
+		ret += (char)delta;
 	}
+	return ret;
+}
+
+/**
+ * Writes the radical and component to kanji posting lists the kanji
+ * selectors intersect in memory. Types are those of
+ * KanjiComponentIndex::PostingType.
+ */
+bool KanjiDB::createSelectorPostingsTable()
+{
+	SQLite::Query query(&connections["main"]);
+	SQLite::Query insertQuery(&connections["main"]);
+	ASSERT(insertQuery.prepare("insert into selectorPostings values(?, ?, ?)"));
+	EXEC_STMT(query, "select 0, number, kanji from radicals where type is not null "
+		"union select 1, element, kanji from strokeGroups where element is not null "
+		"union select 2, original, kanji from strokeGroups where original is not null "
+		"order by 1, 2, 3");
+	int type = -1;
+	uint key = 0;
+	QList<uint> kanji;
+	while (true) {
+		bool hasNext = query.next();
+		if (!kanji.isEmpty() && (!hasNext || query.valueInt(0) != type || query.valueUInt(1) != key)) {
+			BIND(insertQuery, type);
+			BIND(insertQuery, key);
+			BIND(insertQuery, encodePostings(kanji));
+			EXEC(insertQuery);
+			kanji.clear();
+		}
+		if (!hasNext) break;
+		type = query.valueInt(0);
+		key = query.valueUInt(1);
+		kanji << query.valueUInt(2);
+	}
+	return true;
+}
+
+/// Number of similar kanji kept for each kanji
+#define SIMILAR_KANJI 12
+/// Similarity score, in percents, under which kanji are not similar
+#define SIMILAR_MIN_SCORE 25
+
+/**
+ * The signature of a kanji is the set of its components at all levels of
+ * its stroke groups, each weighted by the number of strokes it covers.
+ * Two kanji are as similar as the weighted Jaccard index of their
+ * signatures, lowered by their difference of stroke count. Only kanji
+ * sharing a component need to be compared, which the postings of the
+ * components give.
+ */
+bool KanjiDB::createSimilarKanjiTable()
+{
+	SQLite::Query query(&connections["main"]);
+	SQLite::Query insertQuery(&connections["main"]);
+	ASSERT(insertQuery.prepare("insert into similarKanji values(?, ?, ?)"));
+
+	QVector<uint> kanji;
+	QVector<int> strokes;
+	QHash<uint, int> index;
+	// Only kanji, not kana or the radicals forms, as the kanji command does
+	EXEC_STMT(query, "select id, strokeCount from entries where id > 12799 and strokeCount not null and id in (select kanji from strokeGroups) order by id");
+	while (query.next()) {
+		index[query.valueUInt(0)] = kanji.size();
+		kanji << query.valueUInt(0);
+		strokes << query.valueInt(1);
+	}
+
+	QVector<QHash<uint, int> > signatures(kanji.size());
+	EXEC_STMT(query, "select kanji, element, original, length(pathsRefs) from strokeGroups where kanji > 12799");
 	while (query.next()) {
-		BIND(insertRootComponentQuery, query.valueUInt(0));
-		EXEC(insertRootComponentQuery);
+		uint k = query.valueUInt(0);
+		int idx = index.value(k, -1);
+		if (idx == -1) continue;
+		int weight = query.valueInt(3);
+		for (int col = 1; col <= 2; col++) {
+			uint component = query.valueUInt(col);
+			if (component && component != k) signatures[idx][component] += weight;
+		}
+	}
+
+	// Kanji and weight of each component
+	QHash<uint, QVector<QPair<int, int> > > postings;
+	QVector<int> totals(kanji.size(), 0);
+	for (int i = 0; i < kanji.size(); i++) {
+		for (QHash<uint, int>::const_iterator it = signatures[i].constBegin(); it != signatures[i].constEnd(); ++it) {
+			postings[it.key()] << QPair<int, int>(i, it.value());
+			totals[i] += it.value();
+		}
+	}
+
+	QVector<int> common(kanji.size(), 0);
+	QVector<int> touched;
+	for (int i = 0; i < kanji.size(); i++) {
+		touched.clear();
+		for (QHash<uint, int>::const_iterator it = signatures[i].constBegin(); it != signatures[i].constEnd(); ++it) {
+			foreach (const QPair<int, int> &posting, postings[it.key()]) {
+				if (posting.first == i) continue;
+				if (!common[posting.first]) touched << posting.first;
+				common[posting.first] += qMin(it.value(), posting.second);
+			}
+		}
+		QList<QPair<int, int> > scores;
+		foreach (int j, touched) {
+			double jaccard = (double)common[j] / (totals[i] + totals[j] - common[j]);
+			int score = qRound(100.0 * jaccard / (1.0 + qAbs(strokes[i] - strokes[j]) / 4.0));
+			common[j] = 0;
+			// Negated so the most similar, then the lowest code points, come first
+			if (score >= SIMILAR_MIN_SCORE) scores << QPair<int, int>(-score, j);
+		}
+		std::sort(scores.begin(), scores.end());
+		for (int n = 0; n < scores.size() && n < SIMILAR_KANJI; n++) {
+			BIND(insertQuery, kanji[i]);
+			BIND(insertQuery, kanji[scores[n].second]);
+			BIND(insertQuery, -scores[n].first);
+			EXEC(insertQuery);
+		}
 	}
 	return true;
 }
@@ -472,7 +755,6 @@ bool KanjiDB::createRadicalsTable(const QString &fName)
 		QString kChr(QString::fromUtf8(line));
 		for (int pos = 0; pos < kChr.size(); ) {
 			int code = TextTools::singleCharToUnicode(kChr, pos);
-			knownRadicals[code] = cpt;
 			BIND(addRadicalQuery, code);
 			BIND(addRadicalQuery, cpt);
 			EXEC(addRadicalQuery);
@@ -485,34 +767,57 @@ bool KanjiDB::createRadicalsTable(const QString &fName)
 bool KanjiDB::createTables()
 {
 	SQLite::Query query(&connections["main"]);
-	EXEC_STMT(query, "create table info(version INT, kanjidic2Version TEXT, kanjiVGVersion TEXT)");
-	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, grade TINYINT, strokeCount TINYINT, frequency SMALLINT, jlpt TINYINT, heisig SMALLINT, dictionaries TEXT, paths BLOB)");
+	EXEC_STMT(query, "create table info(version INT, kanjidic2Version TEXT, kanjiVGVersion TEXT, kanjiVGChecksum TEXT, inputsChecksum TEXT)");
+	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, grade TINYINT, strokeCount TINYINT, frequency SMALLINT, jlpt TINYINT, heisig SMALLINT, dictionaries TEXT, paths BLOB, relevance INTEGER)");
 	EXEC_STMT(query, "create table reading(docid INTEGER PRIMARY KEY, entry INTEGER SECONDARY KEY REFERENCES entries, type TEXT)");
-	EXEC_STMT(query, "create virtual table readingText using fts4(reading, TOKENIZE katakana)");
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "readingText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "readingReverseText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
 	EXEC_STMT(query, "create table nanori(docid INTEGER PRIMARY KEY, entry INTEGER SECONDARY KEY REFERENCES entries)");
-	EXEC_STMT(query, "create virtual table nanoriText using fts4(reading, TOKENIZE katakana)");
-	EXEC_STMT(query, "create table strokeGroups(kanji INTEGER, element INTEGER, original INTEGER, isRoot BOOLEAN, pathsRefs BLOB)");
+	EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "nanoriText", SQLite::FTS::Katakana, SQLite::FTS::Readings));
+	// radicalType is only used by the builder, when importing the KanjiVG
+	// data of the previous database
+	EXEC_STMT(query, "create table strokeGroups(kanji INTEGER, element INTEGER, original INTEGER, isRoot BOOLEAN, pathsRefs BLOB, radicalType TINYINT)");
 	EXEC_STMT(query, "create table rootComponents(kanji INTEGER PRIMARY KEY)");
 	EXEC_STMT(query, "create table skip(entry INTEGER, type TINYINT, c1 TINYINT, c2 TINYINT)");
 	EXEC_STMT(query, "create table fourCorner(entry INTEGER, topLeft TINYINT, topRight TINYINT, botLeft TINYINT, botRight TINYINT, extra TINYINT)");
 	EXEC_STMT(query, "create table radicalsList(kanji INTEGER REFERENCES entries, number SHORTINT)");
 	EXEC_STMT(query, "create table radicals(number INTEGER REFERENCES radicalsList, kanji INTEGER REFERENCES entries, type TINYINT)");
+	EXEC_STMT(query, "create table selectorPostings(type TINYINT, key INTEGER, kanji BLOB, PRIMARY KEY(type, key)) WITHOUT ROWID");
+	EXEC_STMT(query, "create table packed(id INTEGER PRIMARY KEY, data BLOB)");
+	EXEC_STMT(query, "create table strokeFeatures(kanji INTEGER PRIMARY KEY, strokeCount TINYINT, features BLOB)");
+	EXEC_STMT(query, "create table similarKanji(kanji INTEGER, similar INTEGER, score TINYINT, PRIMARY KEY(kanji, similar)) WITHOUT ROWID");
 
 	foreach (const QString &lang, languages) {
 		query.useWith(&connections[lang]);
 		EXEC_STMT(query, "create table info(version INT, kanjidic2Version TEXT, kanjiVGVersion TEXT)");
 		EXEC_STMT(query, "create table meaning(docid INTEGER PRIMARY KEY, entry INTEGER SECONDARY KEY REFERENCES entries, meanings BLOB)");
-		EXEC_STMT(query, "create virtual table meaningText using fts4(reading)");
+		EXEC_STMT(query, SQLite::FTS::createTableStatement(ftsVersion, "meaningText"));
+		// Vocabulary of meaningText, which remains available after its
+		// content is deleted so wildcard searches need not uncompress
+		// every meanings blob
+		EXEC_STMT(query, SQLite::FTS::createTermsTableStatement(ftsVersion, "meaningTerms", "meaningText"));
 	}
 
 	return true;
 }
 
+bool KanjiDB::computeRelevance()
+{
+	SQLite::Query query(&connections["main"]);
+	// Keeps the order given by the frequency then JLPT sort keys, on a
+	// single column
+	EXEC_STMT(query, "update entries set relevance = coalesce(frequency, 0) * 16 + coalesce(jlpt, 0)");
+	return true;
+}
+
 bool KanjiDB::createIndexes()
 {
 	SQLite::Query query(&connections["main"]);
 	EXEC_STMT(query, "create index idx_entries_frequency on entries(frequency)");
 	EXEC_STMT(query, "create index idx_jlpt on entries(jlpt)");
+	EXEC_STMT(query, "create index idx_entries_relevance on entries(relevance)");
+	EXEC_STMT(query, "create index idx_grade on entries(grade)");
+	EXEC_STMT(query, "create index idx_strokeCount on entries(strokeCount)");
 	EXEC_STMT(query, "create index idx_reading_entry on reading(entry)");
 	EXEC_STMT(query, "create index idx_nanori_entry on nanori(entry)");
 	EXEC_STMT(query, "create index idx_strokeGroups_kanji on strokeGroups(kanji)");
@@ -521,104 +826,244 @@ bool KanjiDB::createIndexes()
 	EXEC_STMT(query, "create index idx_skip on skip(entry)");
 	EXEC_STMT(query, "create index idx_skip_type on skip(type, c1, c2)");
 	EXEC_STMT(query, "create index idx_fourCorner on fourCorner(entry)");
+	// Partial codes are searched with the leading wildcards expanded, see
+	// Kanjidic2EntrySearcher
+	EXEC_STMT(query, "create index idx_fourCorner_code on fourCorner(topLeft, topRight, botLeft, botRight, extra)");
 	EXEC_STMT(query, "create index idx_radicalsList_number on radicalsList(number)");
-	EXEC_STMT(query, "create index idx_radicals on radicals(kanji)");
 
-	foreach (const QString &lang, languages) {
-		query.useWith(&connections[lang]);
-		EXEC_STMT(query, "create index idx_meaning_entry on meaning(entry)");
-	}
+	return true;
+}
+
+static void writePackString(QDataStream &stream, const QString &str)
+{
+	QByteArray utf8(str.toUtf8());
+	stream << (quint16)utf8.size();
+	stream.writeRawData(utf8.constData(), utf8.size());
+}
+
+/// Writes the integer of column col of query, or -1 if it is null
+static void writePackNullable(QDataStream &stream, const SQLite::Query &query, int col)
+{
+	stream << (qint16)(query.valueIsNull(col) ? -1 : query.valueInt(col));
+}
 
+/**
+ * Writes all the static data of each character into the packed table, in
+ * the layout described in Kanjidic2EntryLoader.h, so that the loader reads
+ * a single row instead of running a query per kind of data. Runs once the
+ * indexes exist, as it looks each character up in every table.
+ */
+bool KanjiDB::createPackedTable()
+{
+	SQLite::Connection &connection = connections["main"];
+	SQLite::Query idsQuery(&connection), kanjiQuery(&connection), variationsQuery(&connection), readingsQuery(&connection),
+		nanoriQuery(&connection), radicalsQuery(&connection), skipQuery(&connection), fourCornerQuery(&connection),
+		componentsQuery(&connection), insertQuery(&connection);
+	ASSERT(kanjiQuery.prepare("select grade, strokeCount, frequency, jlpt, heisig, dictionaries from entries where id = ?"));
+	ASSERT(variationsQuery.prepare("select distinct original from strokeGroups where element = ? and original not null"));
+	ASSERT(readingsQuery.prepare("select type, readingText.reading from reading join readingText on reading.docid = readingText.rowid where entry = ? order by type"));
+	ASSERT(nanoriQuery.prepare("select nanoriText.reading from nanori join nanoriText on nanori.docid = nanoriText.rowid where entry = ?"));
+	ASSERT(radicalsQuery.prepare("select rl.number, rl.kanji from radicals as r join radicalsList as rl on r.number = rl.number where r.kanji = ? and r.type is not null order by rl.number, rl.rowid"));
+	ASSERT(skipQuery.prepare("select type, c1, c2 from skip where entry = ? limit 1"));
+	ASSERT(fourCornerQuery.prepare("select topLeft, topRight, botLeft, botRight, extra from fourCorner where entry = ? limit 1"));
+	ASSERT(componentsQuery.prepare("select element, original, isRoot, pathsRefs from strokeGroups where kanji = ? order by rowid"));
+	ASSERT(insertQuery.prepare("insert into packed values(?, ?)"));
+
+	// Every character that can be loaded, including the components and
+	// variations that are not in kanjidic2
+	EXEC_STMT(idsQuery, "select id from entries union select kanji from strokeGroups union select element from strokeGroups union select kanji from radicals order by 1");
+	while (idsQuery.next()) {
+		uint id = idsQuery.valueUInt(0);
+		if (!id) continue;
+		QByteArray record;
+		QDataStream stream(&record, QIODevice::WriteOnly);
+		stream.setByteOrder(QDataStream::LittleEndian);
+
+		BIND(kanjiQuery, id);
+		EXEC(kanjiQuery);
+		bool inDB = kanjiQuery.next();
+		stream << (quint8)inDB;
+		if (inDB) {
+			for (int col = 0; col < 5; col++) writePackNullable(stream, kanjiQuery, col);
+			writePackString(stream, kanjiQuery.valueString(5));
+		}
+		kanjiQuery.reset();
+
+		QList<uint> variations;
+		BIND(variationsQuery, id);
+		EXEC(variationsQuery);
+		while (variationsQuery.next()) variations << variationsQuery.valueUInt(0);
+		variationsQuery.reset();
+		stream << (quint16)variations.size();
+		foreach (uint variation, variations) stream << (quint32)variation;
+
+		QList<QPair<QString, QString> > readings;
+		BIND(readingsQuery, id);
+		EXEC(readingsQuery);
+		while (readingsQuery.next()) readings << QPair<QString, QString>(readingsQuery.valueString(0), readingsQuery.valueString(1));
+		readingsQuery.reset();
+		stream << (quint16)readings.size();
+		for (int i = 0; i < readings.size(); i++) {
+			writePackString(stream, readings[i].first);
+			writePackString(stream, readings[i].second);
+		}
+
+		QStringList nanoris;
+		BIND(nanoriQuery, id);
+		EXEC(nanoriQuery);
+		while (nanoriQuery.next()) nanoris << nanoriQuery.valueString(0);
+		nanoriQuery.reset();
+		stream << (quint16)nanoris.size();
+		foreach (const QString &nanori, nanoris) writePackString(stream, nanori);
+
+		// Only the first character of each radical number, which is the
+		// one that represents it the best
+		QList<QPair<uint, quint8> > radicals;
+		BIND(radicalsQuery, id);
+		EXEC(radicalsQuery);
+		int curNbr = -1;
+		while (radicalsQuery.next()) {
+			quint8 nbr = radicalsQuery.valueUInt(0);
+			if (curNbr == nbr) continue;
+			curNbr = nbr;
+			radicals << QPair<uint, quint8>(radicalsQuery.valueUInt(1), nbr);
+		}
+		radicalsQuery.reset();
+		stream << (quint16)radicals.size();
+		for (int i = 0; i < radicals.size(); i++) stream << (quint32)radicals[i].first << radicals[i].second;
+
+		BIND(skipQuery, id);
+		EXEC(skipQuery);
+		bool hasSkip = skipQuery.next();
+		stream << (quint8)hasSkip;
+		if (hasSkip) for (int col = 0; col < 3; col++) stream << (quint8)skipQuery.valueInt(col);
+		skipQuery.reset();
+
+		BIND(fourCornerQuery, id);
+		EXEC(fourCornerQuery);
+		bool hasFourCorner = fourCornerQuery.next();
+		stream << (quint8)hasFourCorner;
+		if (hasFourCorner) for (int col = 0; col < 5; col++) stream << (quint8)fourCornerQuery.valueInt(col);
+		fourCornerQuery.reset();
+
+		QByteArray components;
+		QDataStream cstream(&components, QIODevice::WriteOnly);
+		cstream.setByteOrder(QDataStream::LittleEndian);
+		quint16 componentsCount = 0;
+		BIND(componentsQuery, id);
+		EXEC(componentsQuery);
+		while (componentsQuery.next()) {
+			QByteArray pathsRefs(componentsQuery.valueBlob(3));
+			cstream << (quint32)componentsQuery.valueUInt(0) << (quint32)componentsQuery.valueUInt(1) << (quint8)componentsQuery.valueBool(2) << (quint8)pathsRefs.size();
+			cstream.writeRawData(pathsRefs.constData(), pathsRefs.size());
+			componentsCount++;
+		}
+		componentsQuery.reset();
+		stream << componentsCount;
+		stream.writeRawData(components.constData(), components.size());
+
+		ASSERT((stream.status() == QDataStream::Ok));
+		BIND(insertQuery, id);
+		BIND(insertQuery, record);
+		EXEC(insertQuery);
+	}
 	return true;
 }
 
-bool KanjiDB::finalize()
+bool KanjiDB::createStrokeFeaturesTable()
 {
-	SQLite::Query query;
-	foreach (const QString &lang, languages) {
-		query.useWith(&connections[lang]);
-		EXEC_STMT(query, "DELETE FROM meaningText_content");
+	SQLite::Query query(&connections["main"]);
+	SQLite::Query insertQuery(&connections["main"]);
+	ASSERT(insertQuery.prepare("insert into strokeFeatures values(?, ?, ?)"));
+	// Paths are also set when importing the previous KanjiVG data, which
+	// is why the features are computed from them rather than when parsing
+	EXEC_STMT(query, "select id, paths from entries where paths is not null");
+	while (query.next()) {
+		QList<QVector<QPointF> > strokes;
+		foreach (const QByteArray &stroke, KanjiStrokePath::unpack(qUncompress(query.valueBlob(1)))) {
+			QVector<QPointF> polyline(KanjiStrokeFeatures::flatten(stroke));
+			if (!polyline.isEmpty()) strokes << polyline;
+		}
+		QByteArray features(KanjiStrokeFeatures::compute(strokes));
+		if (features.isEmpty()) continue;
+		BIND(insertQuery, query.valueUInt(0));
+		BIND(insertQuery, features.size() / KanjiStrokeFeatures::STROKE_FEATURE_SIZE);
+		BIND(insertQuery, features);
+		EXEC(insertQuery);
 	}
+	return true;
+}
 
+bool KanjiDB::finalizeMain()
+{
+	QElapsedTimer timer;
+	timer.start();
+	ASSERT(createRootComponentsTable());
+	ASSERT(insertStrokeGroupsRadicals());
+	ASSERT(createSelectorPostingsTable());
+	ASSERT(createSimilarKanjiTable());
+	ASSERT(fillMainInfoTable());
+	ASSERT(kdicParser->updateJLPTLevels());
+	ASSERT(computeRelevance());
+	qDebug("main: roots, radicals and relevance took %lld ms", timer.restart());
+	ASSERT(createIndexes());
+	ASSERT(createPackedTable());
+	ASSERT(createStrokeFeaturesTable());
+	ASSERT(clearQueries());
+	ASSERT(closeDatabase(connections["main"]));
+	qDebug("main: indexing, analyzing and vacuuming took %lld ms", timer.restart());
 	return true;
 }
 
 bool KanjiDB::fillMainInfoTable()
 {
 	SQLite::Query query(&connections["main"]);
-	query.prepare("insert into info values(?, ?, ?)");
+	query.prepare("insert into info values(?, ?, ?, ?, ?)");
 	query.bindValue(KANJIDIC2DB_REVISION);
 	query.bindValue(kdicParser->dateOfCreation());
-	query.bindValue(kvgParser.version());
+	query.bindValue(kanjiVGVersion);
+	query.bindValue(kanjiVGChecksum);
+	query.bindValue(inputsChecksum);
 	ASSERT(query.exec());
 	return true;
 }
 
-bool KanjiDB::fillLanguagesInfoTable()
+bool KanjiDB::fillLanguageInfoTable(SQLite::Connection &connection)
 {
-	SQLite::Query query;
-	foreach (const QString &lang, languages) {
-		query.useWith(&connections[lang]);
-		query.prepare("insert into info values(?, ?, ?)");
-		query.bindValue(KANJIDIC2DB_REVISION);
-		query.bindValue(kdicParser->dateOfCreation());
-		query.bindValue(kvgParser.version());
-		ASSERT(query.exec());
-	}
+	SQLite::Query query(&connection);
+	query.prepare("insert into info values(?, ?, ?)");
+	query.bindValue(KANJIDIC2DB_REVISION);
+	query.bindValue(kdicParser->dateOfCreation());
+	query.bindValue(kanjiVGVersion);
+	ASSERT(query.exec());
 	return true;
 }
 
-bool KanjiDB::updateTranslations(const QStringList &supportedLanguages)
+bool KanjiDB::parseJMFs(const QStringList &supportedLanguages)
 {
 	QDir dir(QDir(srcDir).absoluteFilePath("src/core/kanjidic2"));
 
 	foreach (QString fName, dir.entryList(QStringList() << "*.jmf")) {
 		QString lang(fName.split('.')[0]);
 		if (supportedLanguages.contains(lang))
-			updateTranslation(dir.absoluteFilePath(fName), lang);
+			ASSERT(parseJMF(dir.absoluteFilePath(fName), lang));
 	}
 
 	return true;
 }
 
-bool KanjiDB::updateTranslation(const QString &fName, const QString &lang)
+bool KanjiDB::parseJMF(const QString &fName, const QString &lang)
 {
 	QFile file(fName);
 	if (!file.open(QFile::ReadOnly | QFile::Text)) {
 		return false;
 	}
-
-	SQLite::Query deleteMeaningQuery(&connections[lang]);
-	SQLite::Query deleteMeaningTextQuery(&connections[lang]);
-	deleteMeaningTextQuery.prepare("delete from meaningText where docid in (select docid from meaning where entry = ?)");
-	deleteMeaningQuery.prepare("delete from meaning where entry = ?");
-	SQLite::Query &mQuery = insertMeaningQueries[lang];
-	SQLite::Query &mtQuery = insertMeaningTextQueries[lang];
 	QTextStream in(&file);
-
-	int lastKanji = 0;
 	QString line(in.readLine());
 	while (!line.isNull()) {
 		int pos = line.indexOf(' ');
-		int kanji(TextTools::singleCharToUnicode(line.left(pos)));
-		QString meaning(line.mid(pos + 1));
-
-		if (lastKanji != kanji) {
-			BIND(deleteMeaningTextQuery, kanji);
-			EXEC(deleteMeaningTextQuery);
-			BIND(deleteMeaningQuery, kanji);
-			EXEC(deleteMeaningQuery);
-			lastKanji = kanji;
-		}
-
-		// TODO factorize identical meanings! Record the row id into a hash table
-		BIND(mtQuery, meaning);
-		EXEC(mtQuery);
-		BIND(mQuery, mtQuery.lastInsertId());
-		BIND(mQuery, kanji);
-		BIND(mQuery, qCompress(meaning.toUtf8(), 9));
-		EXEC(mQuery);
-
+		uint kanji(TextTools::singleCharToUnicode(line.left(pos)));
+		jmf[lang][kanji] << line.mid(pos + 1);
 		line = in.readLine();
 	}
 	return true;
@@ -626,43 +1071,152 @@ bool KanjiDB::updateTranslation(const QString &fName, const QString &lang)
 
 bool KanjiDB::parse()
 {
-	// Parse and insert kanjidic2
+	// Parse and insert kanjidic2. Both files can be gzipped.
 	QFile file(kanjidic2File);
-	ASSERT(file.open(QFile::ReadOnly | QFile::Text));
-	QXmlStreamReader reader(&file);
+	GzipDevice device(&file);
+	ASSERT(device.open(QIODevice::ReadOnly));
+	QXmlStreamReader reader(&device);
 	if (!kdicParser->parse(reader)) {
 		qDebug() << "Error during kanjidic2 parsing:" << connections["main"].lastError().message();
 		return 1;
 	}
+	device.close();
 	file.close();
 
 	ASSERT(createRadicalsTable(QDir(srcDir).absoluteFilePath("src/core/kanjidic2/radicals.txt")));
 
-	// Parse and insert KanjiVG data
+	// Parse and insert KanjiVG data, unless the previous database was
+	// built from the same file
 	file.setFileName(kanjivgFile);
-	ASSERT(file.open(QFile::ReadOnly | QFile::Text));
-	reader.setDevice(&file);
-	if (!kvgParser.parse(reader)) {
-		qDebug() << "Error during KanjiVG parsing" << connections["main"].lastError().message();
-		return 1;
-	}
+	ASSERT(file.open(QFile::ReadOnly));
+	QByteArray kanjivgData(file.readAll());
 	file.close();
+	kanjiVGChecksum = QCryptographicHash::hash(kanjivgData, QCryptographicHash::Sha1).toHex();
+	if (!importPreviousKanjiVG()) {
+		QBuffer buffer(&kanjivgData);
+		GzipDevice kanjivgDevice(&buffer);
+		ASSERT(kanjivgDevice.open(QIODevice::ReadOnly));
+		QByteArray xml(kanjivgDevice.readAll());
+		kanjivgDevice.close();
+		kanjivgData.clear();
+		if (!kvgParser.parse(xml)) {
+			qDebug() << "Error during KanjiVG parsing" << connections["main"].lastError().message();
+			return 1;
+		}
+		kanjiVGVersion = kvgParser.version();
+	}
+	return true;
+}
 
-	ASSERT(createRootComponentsTable());
-	ASSERT(fillMainInfoTable());
-	ASSERT(fillLanguagesInfoTable());
-	ASSERT(kdicParser->updateJLPTLevels());
+bool KanjiDB::importPreviousKanjiVG()
+{
+	QString previousFile(QDir(dstDir).absoluteFilePath("kanjidic2.db.previous"));
+	if (!QFile(previousFile).exists()) return false;
+	{
+		SQLite::Connection previous;
+		if (!previous.connect(previousFile, SQLite::Connection::ReadOnly)) return false;
+		SQLite::Query query(&previous);
+		// Fails on databases that predate the checksum
+		if (!query.exec("select version, kanjiVGVersion, kanjiVGChecksum from info") || !query.next()) return false;
+		if (query.valueInt(0) != KANJIDIC2DB_REVISION || query.valueString(2) != kanjiVGChecksum) return false;
+		kanjiVGVersion = query.valueString(1);
+	}
+	qDebug("KanjiVG file unchanged, importing it from the previous database");
+
+	SQLite::Connection &connection = connections["main"];
+	SQLite::Query query(&connection);
+	// Databases cannot be attached within a transaction
+	ASSERT(connection.commit());
+	ASSERT(connection.attach(previousFile, "previous", SQLite::Connection::ReadOnly));
+	ASSERT(connection.transaction());
+	// Kanji only known from KanjiVG get a dummy entry, as when parsing
+	EXEC_STMT(query, "insert or ignore into entries(id) select kanji from previous.strokeGroups union select id from previous.entries where paths is not null");
+	EXEC_STMT(query, "update entries set strokeCount = (select strokeCount from previous.entries as p where p.id = entries.id), paths = (select paths from previous.entries as p where p.id = entries.id) where id in (select id from previous.entries where paths is not null)");
+	// Radicals also depend on kanjidic2, they are computed again from
+	// the groups by insertStrokeGroupsRadicals()
+	EXEC_STMT(query, "insert into strokeGroups select * from previous.strokeGroups order by rowid");
+	query.clear();
+
+	ASSERT(connection.commit());
+	ASSERT(connection.detach("previous"));
+	ASSERT(connection.transaction());
 	return true;
 }
 
+bool KanjiDB::removePreviousDatabase()
+{
+	QString previousFile(QDir(dstDir).absoluteFilePath("kanjidic2.db.previous"));
+	return !QFile(previousFile).exists() || QFile::remove(previousFile);
+}
+
 void printUsage(char *argv[])
 {
-	qCritical("Usage: %s [-l<lang>] kanjidic2.xml_file kanjivg_xml_file source_dir dest_dir\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)", argv[0]);
+	qCritical("Usage: %s [-l<lang>] [--fts5] kanjidic2.xml_file kanjivg_xml_file source_dir dest_dir\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)\nThe XML files can be gzipped\n--fts5 builds the full-text indexes with FTS5 instead of FTS4\n--stats prints statistics about the databases of dest_dir instead of building them, and takes no XML files. It exits with status 2 if some values are over their threshold\n-t<name>=<max>,... sets the thresholds of --stats", argv[0]);
+}
+
+/**
+ * Prints the distributions of per-kanji rows and sizes of the databases of
+ * dstDir. Returns 2 if some values are over their threshold.
+ */
+static int printStatistics(const QStringList &languages, const QString &dstDir, const QString &thresholds)
+{
+	BuilderStatistics stats;
+	if (!stats.setThresholds(thresholds)) return 1;
+	SQLite::Connection connection;
+	if (!connection.connect(QDir(dstDir).absoluteFilePath("kanjidic2.db"), SQLite::Connection::ReadOnly)) {
+		qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+		return 1;
+	}
+	bool ok = stats.distribution(connection, "readings per kanji", "select entry, count(*) from reading group by entry", 60)
+		&& stats.distribution(connection, "nanori per kanji", "select entry, count(*) from nanori group by entry", 60)
+		&& stats.distribution(connection, "stroke groups per kanji", "select kanji, count(*) from strokeGroups group by kanji", 60)
+		&& stats.distribution(connection, "radicals per kanji", "select kanji, count(*) from radicals group by kanji", 20)
+		&& stats.distribution(connection, "paths blob bytes", "select id, length(paths) from entries where paths is not null", 16384)
+		&& stats.distribution(connection, "component postings bytes", "select key, length(kanji) from selectorPostings", 16384)
+		&& stats.distribution(connection, "packed record bytes", "select id, length(data) from packed", 4096)
+		&& stats.distribution(connection, "stroke features bytes", "select kanji, length(features) from strokeFeatures", 1024)
+		&& stats.distribution(connection, "similar kanji per kanji", "select kanji, count(*) from similarKanji group by kanji", SIMILAR_KANJI);
+	connection.close();
+
+	foreach (const QString &lang, languages) {
+		if (!ok) break;
+		if (!connection.connect(QDir(dstDir).absoluteFilePath(QString("kanjidic2-%1.db").arg(lang)), SQLite::Connection::ReadOnly)) {
+			qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+			return 1;
+		}
+		ok = stats.distribution(connection, lang + " meanings per kanji", "select entry, count(*) from meaning group by entry", 60)
+			&& stats.distribution(connection, lang + " meanings blob bytes", "select entry, sum(length(meanings)) from meaning group by entry", 4096);
+		connection.close();
+	}
+	if (!ok) return 1;
+	return stats.outliers() > 0 ? 2 : 0;
 }
 
-bool buildDB(const QStringList &languages, const QString &kanjidic2File, const QString &kanjivgFile, const QString &srcDir, const QString &dstDir)
+/// Prints how long the phase that just ended took, and starts timing the
+/// next one
+static void phaseDone(QElapsedTimer &timer, const char *phase)
+{
+	qDebug("%s took %lld ms", phase, timer.restart());
+}
+
+bool buildDB(const QStringList &languages, const QString &kanjidic2File, const QString &kanjivgFile, const QString &srcDir, const QString &dstDir, SQLite::FTS::Version ftsVersion)
 {
 	KanjiDB kanjiDB(languages, kanjidic2File, kanjivgFile, srcDir, dstDir);
+	kanjiDB.ftsVersion = ftsVersion;
+	QElapsedTimer timer;
+	timer.start();
+
+	QDir kanjidic2Dir(QDir(srcDir).absoluteFilePath("src/core/kanjidic2"));
+	QStringList inputs, dbs;
+	inputs << kanjidic2File << kanjivgFile;
+	foreach (const QString &fName, kanjidic2Dir.entryList(QStringList() << "*.jmf" << "jlpt-n*.csv" << "radicals.txt", QDir::Files, QDir::Name))
+		inputs << kanjidic2Dir.absoluteFilePath(fName);
+	foreach (const QString &lang, languages) dbs << QString("kanjidic2-%1.db").arg(lang);
+	kanjiDB.inputsChecksum = inputsChecksum(KANJIDIC2DB_REVISION, inputs, languages, ftsVersion);
+	if (!kanjiDB.inputsChecksum.isNull() && kanjiDB.inputsChecksum == previousInputsChecksum(dstDir, "kanjidic2.db", dbs)) {
+		qDebug("Inputs unchanged, keeping the existing databases");
+		return true;
+	}
 
 	ASSERT(kanjiDB.openDatabase("kanjidic2.db", "main"));
 	foreach (const QString &lang, languages) {
@@ -670,30 +1224,51 @@ bool buildDB(const QStringList &languages, const QString &kanjidic2File, const Q
 	}
 	ASSERT(kanjiDB.createTables());
 	ASSERT(kanjiDB.prepareQueries());
-	ASSERT(kanjiDB.parse());
-	ASSERT(kanjiDB.updateTranslations(languages));
-	ASSERT(kanjiDB.createIndexes());
-	ASSERT(kanjiDB.clearQueries());
-	ASSERT(kanjiDB.finalize());
-	ASSERT(kanjiDB.closeDatabase("main"));
-	foreach (const QString &lang, languages) {
-		ASSERT(kanjiDB.closeDatabase(lang));
-	}
-	return true;
+	ASSERT(kanjiDB.parseJMFs(languages));
+	kanjiDB.startWriters();
+	phaseDone(timer, "preparing databases");
+	bool success = kanjiDB.parse();
+	// The language writers finalize their database while the main one
+	// is completed
+	kanjiDB.parser()->closeQueues();
+	phaseDone(timer, "parsing");
+	success = success && kanjiDB.finalizeMain();
+	success &= kanjiDB.waitWriters();
+	phaseDone(timer, "finalizing");
+	if (!success) return false;
+	return kanjiDB.removePreviousDatabase();
 }
 
 int main(int argc, char *argv[])
 {
 	QCoreApplication app(argc, argv);
 
-	if (argc < 5) {
+	if (argc < 3) {
 		printUsage(argv);
 		return 1;
 	}
 	QStringList languages;
+	bool stats = false;
+	SQLite::FTS::Version ftsVersion = SQLite::FTS::FTS4;
+	QString thresholds;
 	int argCpt = 1;
 	while (argCpt < argc && argv[argCpt][0] == '-') {
 		QString param(argv[argCpt]);
+		if (param == "--stats") {
+			stats = true;
+			++argCpt;
+			continue;
+		}
+		if (param == "--fts5") {
+			ftsVersion = SQLite::FTS::FTS5;
+			++argCpt;
+			continue;
+		}
+		if (param.startsWith("-t")) {
+			thresholds = param.mid(2);
+			++argCpt;
+			continue;
+		}
 		if (!param.startsWith("-l")) {
 			printUsage(argv);
 			return 1;
@@ -704,19 +1279,23 @@ int main(int argc, char *argv[])
 		};
 		++argCpt;
 	}
-	if (argCpt > argc - 4) {
+	// Statistics do not take the XML files
+	int skip = stats ? 2 : 0;
+	if (argCpt > argc - 4 + skip) {
 		printUsage(argv);
 		return -1;
 	}
 
-	QString kanjidic2File(argv[argCpt]);
-	QString kanjivgFile(argv[argCpt + 1]);
-	QString srcDir(argv[argCpt + 2]);
-	QString dstDir(argv[argCpt + 3]);
+	QString kanjidic2File(skip ? QString() : QString(argv[argCpt]));
+	QString kanjivgFile(skip ? QString() : QString(argv[argCpt + 1]));
+	QString srcDir(argv[argCpt + 2 - skip]);
+	QString dstDir(argv[argCpt + 3 - skip]);
 
 	// English is used as a backup if nothing else is available
 	languages << "en";
 	languages.removeDuplicates();
 
-	return !buildDB(languages, kanjidic2File, kanjivgFile, srcDir, dstDir);
+	if (stats) return printStatistics(languages, dstDir, thresholds);
+
+	return !buildDB(languages, kanjidic2File, kanjivgFile, srcDir, dstDir, ftsVersion);
 }
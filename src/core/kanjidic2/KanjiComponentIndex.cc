@@ -0,0 +1,170 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/kanjidic2/KanjiComponentIndex.h"
+
+#include "sqlite/Query.h"
+#include "core/Database.h"
+
+#include <algorithm>
+
+bool KanjiSet::isEmpty() const
+{
+	foreach (quint64 word, _words) if (word) return false;
+	return true;
+}
+
+bool KanjiSet::intersects(const KanjiSet &other) const
+{
+	int size = qMin(_words.size(), other._words.size());
+	for (int i = 0; i < size; i++) if (_words[i] & other._words[i]) return true;
+	return false;
+}
+
+KanjiSet &KanjiSet::operator&=(const KanjiSet &other)
+{
+	for (int i = 0; i < _words.size(); i++) _words[i] &= i < other._words.size() ? other._words[i] : 0;
+	return *this;
+}
+
+KanjiSet &KanjiSet::operator|=(const KanjiSet &other)
+{
+	if (_words.size() < other._words.size()) _words.resize(other._words.size());
+	for (int i = 0; i < other._words.size(); i++) _words[i] |= other._words[i];
+	return *this;
+}
+
+QList<int> KanjiSet::ranks() const
+{
+	QList<int> ret;
+	for (int i = 0; i < _words.size(); i++) {
+		quint64 word = _words[i];
+		for (int bit = 0; word; bit++, word >>= 1) if (word & 1) ret << i * 64 + bit;
+	}
+	return ret;
+}
+
+QList<uint> KanjiComponentIndex::decodePostings(const QByteArray &blob)
+{
+	QList<uint> ret;
+	uint kanji = 0, delta = 0;
+	int shift = 0;
+	foreach (char c, blob) {
+		delta |= (uint)(c & 0x7f) << shift;
+		if (c & 0x80) shift += 7;
+		else {
+			kanji += delta;
+			ret << kanji;
+			delta = 0;
+			shift = 0;
+		}
+	}
+	return ret;
+}
+
+KanjiComponentIndex::KanjiComponentIndex()
+{
+	// The searcher may need the index from another thread
+	SQLite::Query query(Database::threadConnection());
+	query.exec("select id, strokeCount from kanjidic2.entries order by strokeCount, frequency, id");
+	while (query.next()) {
+		uint kanji = query.valueUInt(0);
+		_rank[kanji] = _kanji.size();
+		_kanji << kanji;
+		_strokeCount[kanji] = query.valueUInt(1);
+	}
+
+	query.exec("select type, key, kanji from kanjidic2.selectorPostings");
+	while (query.next()) {
+		int type = query.valueInt(0);
+		if (type < Radical || type > Original) continue;
+		KanjiSet set(_kanji.size());
+		foreach (uint kanji, decodePostings(query.valueBlob(2))) {
+			int r = rank(kanji);
+			if (r != -1) set.insert(r);
+		}
+		_postings[type][query.valueUInt(1)] = set;
+	}
+
+	query.exec("select rl.kanji, rl.number from kanjidic2.radicalsList as rl join kanjidic2.entries as e on rl.kanji = e.id order by e.strokeCount, rl.number, rl.rowid");
+	while (query.next()) _radicalChars << QPair<uint, quint8>(query.valueUInt(0), query.valueUInt(1));
+
+	// Elements that are not kanji entries come first, as sorting them
+	// by their missing stroke count used to do
+	QList<QPair<int, uint> > elements;
+	foreach (uint element, _postings[Element].keys()) elements << QPair<int, uint>(rank(element), element);
+	std::sort(elements.begin(), elements.end());
+	for (int i = 0; i < elements.size(); i++) _elements << elements[i].second;
+
+	query.exec("select kanji from kanjidic2.rootComponents as rc join kanjidic2.entries as e on rc.kanji = e.id order by strokeCount");
+	while (query.next()) _rootComponents << query.valueUInt(0);
+}
+
+const KanjiComponentIndex &KanjiComponentIndex::instance()
+{
+	static KanjiComponentIndex _instance;
+	return _instance;
+}
+
+KanjiSet KanjiComponentIndex::posting(PostingType type, uint key) const
+{
+	return _postings[type].value(key, KanjiSet(_kanji.size()));
+}
+
+KanjiSet KanjiComponentIndex::withRadicals(const QSet<uint> &radicals) const
+{
+	if (radicals.isEmpty()) return KanjiSet(_kanji.size());
+	QSet<uint>::const_iterator it = radicals.constBegin();
+	KanjiSet ret(posting(Radical, *it));
+	for (++it; it != radicals.constEnd(); ++it) ret &= posting(Radical, *it);
+	return ret;
+}
+
+KanjiSet KanjiComponentIndex::withComponents(const QSet<uint> &components) const
+{
+	if (components.isEmpty()) return KanjiSet(_kanji.size());
+	KanjiSet ret;
+	bool first = true;
+	foreach (uint component, components) {
+		KanjiSet set(posting(Element, component));
+		set |= posting(Original, component);
+		if (first) ret = set;
+		else ret &= set;
+		first = false;
+	}
+	return ret;
+}
+
+QList<uint> KanjiComponentIndex::radicalComplements(const KanjiSet &candidates) const
+{
+	QList<uint> ret;
+	bool all = candidates.isEmpty();
+	typedef QPair<uint, quint8> RadicalChar;
+	foreach (const RadicalChar &rad, _radicalChars) {
+		if (all || _postings[Radical].value(rad.second).intersects(candidates)) ret << rad.first;
+	}
+	return ret;
+}
+
+QList<uint> KanjiComponentIndex::componentComplements(const KanjiSet &candidates) const
+{
+	QList<uint> ret;
+	foreach (uint element, _elements) {
+		if (_postings[Element][element].intersects(candidates)) ret << element;
+	}
+	return ret;
+}
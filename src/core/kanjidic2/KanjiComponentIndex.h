@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_KANJI_COMPONENT_INDEX_H
+#define __CORE_KANJI_COMPONENT_INDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QSet>
+
+/**
+ * Set of kanji, as a bitset over their rank in the kanji display order
+ * (stroke count, then frequency).
+ */
+class KanjiSet {
+private:
+	QVector<quint64> _words;
+
+public:
+	KanjiSet(int size = 0) : _words((size + 63) / 64, 0) {}
+	void insert(int rank) { _words[rank >> 6] |= Q_UINT64_C(1) << (rank & 63); }
+	bool contains(int rank) const { return rank >= 0 && (rank >> 6) < _words.size() && (_words[rank >> 6] & (Q_UINT64_C(1) << (rank & 63))); }
+	bool isEmpty() const;
+	bool intersects(const KanjiSet &other) const;
+	KanjiSet &operator&=(const KanjiSet &other);
+	KanjiSet &operator|=(const KanjiSet &other);
+	/// The ranks of the set, in increasing order
+	QList<int> ranks() const;
+};
+
+/**
+ * Provides a singleton giving the kanji that contain a given radical or
+ * component. It is loaded once from the posting lists of the kanjidic2
+ * database, so the kanji selectors can intersect kanji sets and find the
+ * remaining complements without querying the database on each click.
+ */
+class KanjiComponentIndex {
+public:
+	/// Posting lists types, as stored in the selectorPostings table
+	typedef enum { Radical = 0, Element = 1, Original = 2 } PostingType;
+
+private:
+	/// Kanji by display rank
+	QVector<uint> _kanji;
+	QHash<uint, int> _rank;
+	QHash<uint, quint8> _strokeCount;
+	QHash<uint, KanjiSet> _postings[3];
+	/// Characters of the radicals list, in display order
+	QList<QPair<uint, quint8> > _radicalChars;
+	/// Elements of the stroke groups, in display order
+	QList<uint> _elements;
+	QList<uint> _rootComponents;
+
+	KanjiComponentIndex();
+	KanjiSet posting(PostingType type, uint key) const;
+
+public:
+	static const KanjiComponentIndex &instance();
+
+	/// Decodes a posting list blob into the increasing list of kanji it
+	/// holds. Blobs store the differences between successive kanji as
+	/// varints, see build_kanji_db.
+	static QList<uint> decodePostings(const QByteArray &blob);
+
+	/// Returns -1 for characters that are not kanji entries
+	int rank(uint kanji) const { return _rank.value(kanji, -1); }
+	uint kanji(int rank) const { return _kanji[rank]; }
+	/// Returns 0 for characters that are not kanji entries
+	quint8 strokeCount(uint kanji) const { return _strokeCount.value(kanji, 0); }
+
+	/// Kanji having all the given radicals
+	KanjiSet withRadicals(const QSet<uint> &radicals) const;
+	/// Kanji having all the given components, as element or original
+	KanjiSet withComponents(const QSet<uint> &components) const;
+	/// Radical characters (not numbers) present in at least one of the
+	/// candidates, or all of them if candidates is empty
+	QList<uint> radicalComplements(const KanjiSet &candidates) const;
+	/// Elements present in at least one of the candidates
+	QList<uint> componentComplements(const KanjiSet &candidates) const;
+	const QList<uint> &rootComponents() const { return _rootComponents; }
+};
+
+#endif
@@ -19,12 +19,15 @@
 
 #include "sqlite/Query.h"
 #include "core/Database.h"
+#include "core/StartupTrace.h"
 #include <QVariant>
+#include <QThreadPool>
+#include <QRunnable>
 
 KanjiRadicals::KanjiRadicals()
 {
 	// Get all the radical information!
-	SQLite::Query query(Database::connection());
+	SQLite::Query query(Database::threadConnection());
 	query.exec("select kanji, number from kanjidic2.radicalsList order by rowid");
 	while (query.next()) {
 		uint kanji = query.valueUInt(0);
@@ -37,6 +40,23 @@ KanjiRadicals::KanjiRadicals()
 
 const KanjiRadicals &KanjiRadicals::instance()
 {
+	// Initialization of local statics is thread-safe, callers wait for
+	// the table to be loaded if another thread is doing it
 	static KanjiRadicals _instance;
 	return _instance;
 }
+
+class KanjiRadicalsLoader : public QRunnable
+{
+public:
+	virtual void run()
+	{
+		StartupPhase phase("Kanji radicals");
+		KanjiRadicals::instance();
+	}
+};
+
+void KanjiRadicals::preload()
+{
+	QThreadPool::globalInstance()->start(new KanjiRadicalsLoader());
+}
@@ -34,7 +34,10 @@ private:
 	KanjiRadicals();
 
 public:
+	/// Thread-safe, the table is loaded on first call
 	static const KanjiRadicals &instance();
+	/// Loads the table in the background so instance() does not have to
+	static void preload();
 	quint8 kanji2Rad(uint kanji) const { return kanji2rad[kanji]; }
 	const QList<uint> rad2Kanji(quint8 rad) const { return rad2kanji[rad]; }
 };
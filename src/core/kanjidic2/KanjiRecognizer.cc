@@ -0,0 +1,145 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/kanjidic2/KanjiRecognizer.h"
+
+#include "sqlite/Query.h"
+#include "core/Database.h"
+
+#include <QVarLengthArray>
+#include <QPair>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace KanjiStrokeFeatures;
+
+/// Candidates may have that many strokes less than the input
+#define MISSING_STROKES 1
+/// Candidates may have that many strokes more than the input, which
+/// happens when strokes are joined while writing quickly
+#define EXTRA_STROKES 2
+/// Cost of leaving a stroke of the input or of the candidate unmatched,
+/// about the distance between two strokes of similar shape but at
+/// different places
+#define UNMATCHED_STROKE_COST 640
+
+KanjiRecognizer::KanjiRecognizer()
+{
+	SQLite::Query query(Database::threadConnection());
+	query.exec("select kanji, strokeCount, features from kanjidic2.strokeFeatures order by strokeCount, kanji");
+	while (query.next()) {
+		QByteArray features(query.valueBlob(2));
+		Candidate candidate;
+		candidate.kanji = query.valueUInt(0);
+		candidate.strokeCount = query.valueInt(1);
+		candidate.offset = _features.size();
+		if (candidate.strokeCount <= 0 || features.size() != candidate.strokeCount * STROKE_FEATURE_SIZE) {
+			qWarning("Invalid stroke features for kanji %u", candidate.kanji);
+			continue;
+		}
+		_features.resize(_features.size() + features.size());
+		memcpy(_features.data() + candidate.offset, features.constData(), features.size());
+		while (_firstWithStrokes.size() <= candidate.strokeCount) _firstWithStrokes << _candidates.size();
+		_candidates << candidate;
+	}
+	_firstWithStrokes << _candidates.size();
+}
+
+const KanjiRecognizer &KanjiRecognizer::instance()
+{
+	static KanjiRecognizer _instance;
+	return _instance;
+}
+
+static inline int strokeDistance(const quint8 *a, const quint8 *b)
+{
+#ifdef __SSE2__
+	// A stroke fits in a register, whose two halves get their sum of
+	// absolute differences computed at once
+	Q_STATIC_ASSERT(STROKE_FEATURE_SIZE == 16);
+	__m128i sad = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+	return _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+#else
+	int ret = 0;
+	for (int i = 0; i < STROKE_FEATURE_SIZE; i++) ret += qAbs((int)a[i] - (int)b[i]);
+	return ret;
+#endif
+}
+
+/**
+ * Matches the strokes of the input to those of the candidate in order,
+ * each unmatched stroke costing UNMATCHED_STROKE_COST. Returns INT_MAX as
+ * soon as the distance is known to be at least worst.
+ */
+int KanjiRecognizer::distance(const quint8 *input, int inputStrokes, const Candidate &candidate, int worst) const
+{
+	const quint8 *features = _features.constData() + candidate.offset;
+	int m = candidate.strokeCount;
+	QVarLengthArray<int, 128> rows(2 * (m + 1));
+	int *prev = rows.data(), *cur = rows.data() + m + 1;
+	for (int j = 0; j <= m; j++) prev[j] = j * UNMATCHED_STROKE_COST;
+	for (int i = 1; i <= inputStrokes; i++) {
+		const quint8 *stroke = input + (i - 1) * STROKE_FEATURE_SIZE;
+		cur[0] = i * UNMATCHED_STROKE_COST;
+		int rowMin = cur[0];
+		for (int j = 1; j <= m; j++) {
+			int d = prev[j - 1] + strokeDistance(stroke, features + (j - 1) * STROKE_FEATURE_SIZE);
+			d = qMin(d, prev[j] + UNMATCHED_STROKE_COST);
+			d = qMin(d, cur[j - 1] + UNMATCHED_STROKE_COST);
+			cur[j] = d;
+			rowMin = qMin(rowMin, d);
+		}
+		// Costs only grow from one row to the next
+		if (rowMin >= worst) return INT_MAX;
+		std::swap(prev, cur);
+	}
+	return prev[m];
+}
+
+QList<uint> KanjiRecognizer::recognize(const QList<QVector<QPointF> > &strokes, int maxResults) const
+{
+	QList<uint> ret;
+	QByteArray input(compute(strokes));
+	int inputStrokes = input.size() / STROKE_FEATURE_SIZE;
+	if (!inputStrokes || maxResults <= 0) return ret;
+	const quint8 *inputData = reinterpret_cast<const quint8 *>(input.constData());
+
+	int maxStrokes = _firstWithStrokes.size() - 2;
+	int from = _firstWithStrokes[qBound(0, inputStrokes - MISSING_STROKES, maxStrokes + 1)];
+	int to = _firstWithStrokes[qBound(0, inputStrokes + EXTRA_STROKES + 1, maxStrokes + 1)];
+
+	// Best results so far, by increasing distance
+	QVector<QPair<int, uint> > best;
+	best.reserve(maxResults + 1);
+	for (int i = from; i < to; i++) {
+		const Candidate &candidate = _candidates[i];
+		int worst = best.size() < maxResults ? INT_MAX : best.last().first;
+		int d = distance(inputData, inputStrokes, candidate, worst);
+		if (d >= worst) continue;
+		QPair<int, uint> result(d, candidate.kanji);
+		best.insert(std::upper_bound(best.begin(), best.end(), result), result);
+		if (best.size() > maxResults) best.removeLast();
+	}
+	for (int i = 0; i < best.size(); i++) ret << best[i].second;
+	return ret;
+}
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_KANJIDIC2_KANJIRECOGNIZER_H
+#define __CORE_KANJIDIC2_KANJIRECOGNIZER_H
+
+#include "core/kanjidic2/KanjiStrokeFeatures.h"
+
+#include <QVector>
+#include <QList>
+#include <QPointF>
+
+/**
+ * Provides a singleton recognizing handwritten characters from their
+ * strokes. The stroke features of all the characters of the kanjidic2
+ * database are loaded once and kept in a single array, stored by stroke
+ * count so that only the characters having about as many strokes as the
+ * input need to be compared to it.
+ *
+ * Characters are compared with an elastic matching of their strokes in
+ * order, which tolerates a missing or extra stroke. The distance between
+ * two strokes is the sum of the absolute differences of their features,
+ * a loop over fixed-size byte arrays that the compiler vectorizes.
+ */
+class KanjiRecognizer {
+private:
+	struct Candidate {
+		uint kanji;
+		/// Offset of the features of the kanji in _features
+		int offset;
+		int strokeCount;
+	};
+	QVector<quint8> _features;
+	/// Candidates, by increasing stroke count
+	QVector<Candidate> _candidates;
+	/// Index in _candidates of the first candidate with a given stroke
+	/// count, with a last element past the end
+	QVector<int> _firstWithStrokes;
+
+	KanjiRecognizer();
+	int distance(const quint8 *input, int inputStrokes, const Candidate &candidate, int worst) const;
+
+public:
+	static const KanjiRecognizer &instance();
+
+	bool isEmpty() const { return _candidates.isEmpty(); }
+	/**
+	 * Returns the at most maxResults characters the closest to the given
+	 * strokes, the closest first. Strokes are polylines in any coordinates
+	 * system, as long as it is the same for all of them.
+	 */
+	QList<uint> recognize(const QList<QVector<QPointF> > &strokes, int maxResults = 50) const;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/kanjidic2/KanjiStrokeFeatures.h"
+#include "core/kanjidic2/KanjiStrokePath.h"
+
+#include <QLineF>
+#include <QRectF>
+
+namespace KanjiStrokeFeatures {
+
+/// Number of segments cubic curves are flattened into
+#define CUBIC_SEGMENTS 8
+
+QVector<QPointF> flatten(const QByteArray &stroke)
+{
+	QVector<QPointF> ret;
+	int pos = 0;
+	KanjiStrokePath::Command command;
+	QPointF points[3];
+	QPointF cur;
+	while (KanjiStrokePath::read(stroke, pos, command, points)) {
+		switch (command) {
+		case KanjiStrokePath::MoveTo:
+		case KanjiStrokePath::LineTo:
+			cur = points[0];
+			ret << cur;
+			break;
+		case KanjiStrokePath::CubicTo:
+			for (int i = 1; i <= CUBIC_SEGMENTS; i++) {
+				qreal t = (qreal)i / CUBIC_SEGMENTS, u = 1.0 - t;
+				ret << cur * (u * u * u) + points[0] * (3 * u * u * t) + points[1] * (3 * u * t * t) + points[2] * (t * t * t);
+			}
+			cur = points[2];
+			break;
+		case KanjiStrokePath::Close:
+			break;
+		}
+	}
+	if (pos != stroke.size()) ret.clear();
+	return ret;
+}
+
+static quint8 toFeature(qreal v)
+{
+	return (quint8)qBound(0, qRound(v), 255);
+}
+
+/// Writes the points of polyline evenly spaced along its length
+static void resample(const QVector<QPointF> &polyline, const QPointF &origin, qreal scale, quint8 *out)
+{
+	QVector<qreal> distances(polyline.size());
+	distances[0] = 0.0;
+	for (int i = 1; i < polyline.size(); i++) distances[i] = distances[i - 1] + QLineF(polyline[i - 1], polyline[i]).length();
+	qreal length = distances.last();
+
+	int seg = 1;
+	for (int p = 0; p < STROKE_FEATURE_POINTS; p++) {
+		qreal target = length * p / (STROKE_FEATURE_POINTS - 1);
+		while (seg < polyline.size() - 1 && distances[seg] < target) seg++;
+		QPointF point(polyline[0]);
+		if (polyline.size() > 1) {
+			qreal segLength = distances[seg] - distances[seg - 1];
+			qreal t = segLength > 0.0 ? qBound(0.0, (target - distances[seg - 1]) / segLength, 1.0) : 0.0;
+			point = polyline[seg - 1] + (polyline[seg] - polyline[seg - 1]) * t;
+		}
+		point = (point - origin) * scale;
+		out[p * 2] = toFeature(point.x());
+		out[p * 2 + 1] = toFeature(point.y());
+	}
+}
+
+QByteArray compute(const QList<QVector<QPointF> > &strokes)
+{
+	QRectF bounds;
+	bool first = true;
+	foreach (const QVector<QPointF> &stroke, strokes) {
+		foreach (const QPointF &point, stroke) {
+			if (first) bounds = QRectF(point, point);
+			else {
+				bounds.setLeft(qMin(bounds.left(), point.x()));
+				bounds.setRight(qMax(bounds.right(), point.x()));
+				bounds.setTop(qMin(bounds.top(), point.y()));
+				bounds.setBottom(qMax(bounds.bottom(), point.y()));
+			}
+			first = false;
+		}
+	}
+	if (first) return QByteArray();
+
+	// Keep the aspect ratio so that e.g. 一 and 口 stay apart, and center
+	// the strokes in the square
+	qreal size = qMax(bounds.width(), bounds.height());
+	qreal scale = size > 0.0 ? 255.0 / size : 1.0;
+	QPointF origin(bounds.center() - QPointF(size, size) / 2.0);
+	if (size <= 0.0) origin = bounds.center() - QPointF(127.5, 127.5);
+
+	QByteArray ret;
+	foreach (const QVector<QPointF> &stroke, strokes) {
+		if (stroke.isEmpty()) continue;
+		int pos = ret.size();
+		ret.resize(pos + STROKE_FEATURE_SIZE);
+		resample(stroke, origin, scale, reinterpret_cast<quint8 *>(ret.data() + pos));
+	}
+	return ret;
+}
+
+}
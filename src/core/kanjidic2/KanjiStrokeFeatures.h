@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_KANJIDIC2_KANJISTROKEFEATURES_H
+#define __CORE_KANJIDIC2_KANJISTROKEFEATURES_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPointF>
+#include <QVector>
+
+/**
+ * Stroke features are the representation of the strokes of a character
+ * used by handwriting recognition. The strokes are normalized as a whole
+ * into a 256x256 square, keeping their aspect ratio, and each of them is
+ * resampled into STROKE_FEATURE_POINTS points evenly spaced along its
+ * length. A stroke is thus STROKE_FEATURE_SIZE bytes, the x and y
+ * coordinates of its points in order, and the features of a character the
+ * concatenation of the features of its strokes.
+ *
+ * The features of the kanji are computed by build_kanji_db from their
+ * compiled stroke paths, and those of the input from the drawn strokes,
+ * so both are normalized the same way.
+ */
+namespace KanjiStrokeFeatures {
+	enum { STROKE_FEATURE_POINTS = 8, STROKE_FEATURE_SIZE = STROKE_FEATURE_POINTS * 2 };
+
+	/**
+	 * Flattens a compiled stroke path (see KanjiStrokePath) into a
+	 * polyline. Returns an empty polyline if the stream is corrupted.
+	 */
+	QVector<QPointF> flatten(const QByteArray &stroke);
+
+	/**
+	 * Returns the features of the given strokes, or an empty array if
+	 * there are no strokes. Strokes without points are skipped.
+	 */
+	QByteArray compute(const QList<QVector<QPointF> > &strokes);
+}
+
+#endif
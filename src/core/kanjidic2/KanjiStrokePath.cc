@@ -0,0 +1,219 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/kanjidic2/KanjiStrokePath.h"
+
+#include <QRegExp>
+#include <QStringList>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace KanjiStrokePath {
+
+static int nbPoints(Command command)
+{
+	switch (command) {
+	case MoveTo:
+	case LineTo:
+		return 1;
+	case CubicTo:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+static void writePoint(QByteArray &stream, const QPointF &point)
+{
+	float coords[2] = { (float)point.x(), (float)point.y() };
+	for (int i = 0; i < 2; i++) {
+		quint32 v;
+		memcpy(&v, &coords[i], sizeof(v));
+		v = qToLittleEndian(v);
+		stream.append(reinterpret_cast<const char *>(&v), sizeof(v));
+	}
+}
+
+static void writeCommand(QByteArray &stream, Command command, const QPointF &p1 = QPointF(), const QPointF &p2 = QPointF(), const QPointF &p3 = QPointF())
+{
+	stream.append((char)command);
+	int nb = nbPoints(command);
+	if (nb > 0) writePoint(stream, p1);
+	if (nb > 1) {
+		writePoint(stream, p2);
+		writePoint(stream, p3);
+	}
+}
+
+QByteArray compile(const QString &path)
+{
+	enum SVGPathCommand { None = 0, Movepath, movepath, Closepath, Lineto, lineto, Curveto, curveto, sCurveto, scurveto };
+	QByteArray ret;
+
+	// Process the string - add spaces between unseparated tokens
+	QString svgPath(path);
+	int idx;
+	while ((idx = svgPath.indexOf(QRegExp("[a-zA-Z]\\d|\\d[a-zA-Z]|\\w-"))) != -1) svgPath.insert(idx + 1, ' ');
+
+	QStringList tokens = svgPath.split(QRegExp(" +|,"), QString::SkipEmptyParts);
+
+	SVGPathCommand curAction = None;
+	QPointF cur;
+	QPointF subpathStart;
+	QPointF lastControl;
+	QPointF p1, p2, dest;
+	for (int tokenPos = 0; tokenPos < tokens.count(); tokenPos++) {
+		// Check if a new action is available
+		bool gotCommand = true;
+		do {
+			const QString &token = tokens[tokenPos];
+			if (token == "M") curAction = Movepath;
+			else if (token == "m") curAction = movepath;
+			else if (token == "L") curAction = Lineto;
+			else if (token == "l") curAction = lineto;
+			else if (token == "C") curAction = Curveto;
+			else if (token == "c") curAction = curveto;
+			else if (token == "S") curAction = sCurveto;
+			else if (token == "s") curAction = scurveto;
+			else if (token == "z" || token == "Z") curAction = Closepath;
+			else gotCommand = false;
+			if (gotCommand) { tokenPos++; if (tokenPos >= tokens.count()) break; }
+		} while (gotCommand);
+
+		int needed = 0;
+		switch (curAction) {
+		case Movepath: case movepath: case Lineto: case lineto: needed = 2; break;
+		case Curveto: case curveto: needed = 6; break;
+		case sCurveto: case scurveto: needed = 4; break;
+		default: break;
+		}
+		if (tokenPos + needed > tokens.count()) {
+			qWarning("Truncated kanji drawing path!");
+			return QByteArray();
+		}
+		QVector<float> v;
+		for (int i = 0; i < needed; i++) v << tokens[tokenPos + i].toFloat();
+
+		switch (curAction) {
+		case None:
+			qWarning("Invalid kanji drawing path!");
+			return QByteArray();
+		case Movepath:
+		case movepath:
+			dest = QPointF(v[0], v[1]);
+			if (curAction == movepath) dest += cur;
+			writeCommand(ret, MoveTo, dest);
+			cur = subpathStart = lastControl = dest;
+			tokenPos += 1;
+			break;
+		case Lineto:
+		case lineto:
+			dest = QPointF(v[0], v[1]);
+			if (curAction == lineto) dest += cur;
+			writeCommand(ret, LineTo, dest);
+			cur = lastControl = dest;
+			tokenPos += 1;
+			break;
+		case Curveto:
+		case curveto:
+			p1 = QPointF(v[0], v[1]);
+			p2 = QPointF(v[2], v[3]);
+			dest = QPointF(v[4], v[5]);
+			if (curAction == curveto) {
+				p1 += cur;
+				p2 += cur;
+				dest += cur;
+			}
+			writeCommand(ret, CubicTo, p1, p2, dest);
+			cur = dest;
+			lastControl = p2;
+			tokenPos += 5;
+			break;
+		case sCurveto:
+		case scurveto:
+			p1 = cur * 2 - lastControl;
+			p2 = QPointF(v[0], v[1]);
+			dest = QPointF(v[2], v[3]);
+			if (curAction == scurveto) {
+				p2 += cur;
+				dest += cur;
+			}
+			writeCommand(ret, CubicTo, p1, p2, dest);
+			cur = dest;
+			lastControl = p2;
+			tokenPos += 3;
+			break;
+		case Closepath:
+			writeCommand(ret, Close);
+			// Closing a subpath moves back to its start
+			cur = lastControl = subpathStart;
+			break;
+		}
+	}
+	return ret;
+}
+
+bool read(const QByteArray &stream, int &pos, Command &command, QPointF points[3])
+{
+	if (pos >= stream.size()) return false;
+	quint8 c = (quint8)stream[pos];
+	if (c > Close) return false;
+	command = (Command)c;
+	int nb = nbPoints(command);
+	if (pos + 1 + nb * 8 > stream.size()) return false;
+	const char *data = stream.constData() + pos + 1;
+	for (int i = 0; i < nb; i++) {
+		float coords[2];
+		for (int j = 0; j < 2; j++) {
+			quint32 v = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(data));
+			memcpy(&coords[j], &v, sizeof(v));
+			data += sizeof(v);
+		}
+		points[i] = QPointF(coords[0], coords[1]);
+	}
+	pos += 1 + nb * 8;
+	return true;
+}
+
+QByteArray pack(const QList<QByteArray> &strokes)
+{
+	QByteArray ret;
+	foreach (const QByteArray &stroke, strokes) {
+		quint16 size = qToLittleEndian((quint16)stroke.size());
+		ret.append(reinterpret_cast<const char *>(&size), sizeof(size));
+		ret.append(stroke);
+	}
+	return ret;
+}
+
+QList<QByteArray> unpack(const QByteArray &packed)
+{
+	QList<QByteArray> ret;
+	int pos = 0;
+	while (pos + 2 <= packed.size()) {
+		int size = qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(packed.constData() + pos));
+		pos += 2;
+		if (pos + size > packed.size()) break;
+		ret << packed.mid(pos, size);
+		pos += size;
+	}
+	return ret;
+}
+
+}
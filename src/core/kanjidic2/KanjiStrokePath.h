@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CORE_KANJIDIC2_KANJISTROKEPATH_H
+#define __CORE_KANJIDIC2_KANJISTROKEPATH_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPointF>
+#include <QString>
+
+/**
+ * Kanji stroke paths are stored in the database as compiled streams of
+ * drawing commands, so they can be drawn without parsing their SVG
+ * representation every time.
+ *
+ * A stream is a sequence of commands, each one being a command byte
+ * followed by the absolute coordinates of its points as little-endian
+ * 32 bits floats: one point for MoveTo and LineTo, three (both control
+ * points, then destination) for CubicTo and none for Close.
+ */
+namespace KanjiStrokePath {
+	typedef enum { MoveTo = 0, LineTo, CubicTo, Close } Command;
+
+	/**
+	 * Compiles an SVG path into a stream of commands. Relative and smooth
+	 * commands are turned into their absolute equivalent. Returns an empty
+	 * stream if svgPath is invalid.
+	 */
+	QByteArray compile(const QString &svgPath);
+
+	/**
+	 * Reads the command at position pos of stream into command and points,
+	 * and moves pos to the next command. Returns false at the end of the
+	 * stream or if it is corrupted.
+	 */
+	bool read(const QByteArray &stream, int &pos, Command &command, QPointF points[3]);
+
+	/// Packs the streams of all the strokes of a kanji into a single blob
+	QByteArray pack(const QList<QByteArray> &strokes);
+	/// Reverse of pack()
+	QList<QByteArray> unpack(const QByteArray &packed);
+}
+
+#endif
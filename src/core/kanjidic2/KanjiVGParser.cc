@@ -16,6 +16,9 @@
  */
 
 #include <QtDebug>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QVector>
 
 #include "core/TextTools.h"
 #include "core/kanjidic2/KanjiVGParser.h"
@@ -104,6 +107,45 @@ bool KanjiVGParser::parse_strokegr(QXmlStreamReader &reader, KanjiVGItem &kanji,
 	return true;
 }
 
+bool KanjiVGParser::parseKanji(QXmlStreamReader &reader, KanjiVGItem &kanji)
+{
+	quint8 strokeCounter(0);
+	int id(ATTR(ATTR_ID).mid(QString("kvg:kanji_").size()).toInt(0, 16));
+	bool shallInsert(TextTools::isJapaneseChar(TextTools::unicodeToSingleChar(id)));
+	kanji.id = id;
+	TAG_BEGIN(TAG_KANJI)
+		if (shallInsert) {
+			TAG_PRE(TAG_GROUP)
+				int element(TextTools::singleCharToUnicode(ATTR(ATTR_ELEMENT)));
+				int original(TextTools::singleCharToUnicode(ATTR(ATTR_ORIGINAL)));
+				QStack<KanjiVGGroupItem *> gStack;
+
+				kanji.groups << KanjiVGGroupItem();
+				KanjiVGGroupItem *group = &kanji.groups.last();
+				group->element = element;
+				group->original = original;
+				if (HAS_ATTR(ATTR_RADICAL)) {
+					QString rad(ATTR(ATTR_RADICAL));
+					if (rad == "general") group->radicalType = KanjiVGGroupItem::GENERAL;
+					else if (rad == "tradit") group->radicalType = KanjiVGGroupItem::TRADIT;
+					else if (rad == "nelson") group->radicalType = KanjiVGGroupItem::NELSON;
+					else qDebug("Unknown radical type: %s", rad.toLatin1().constData());
+				}
+				if (!parse_strokegr(reader, kanji, gStack, strokeCounter)) return false;
+			DONE
+			TAG_PRE(TAG_PATH)
+				QString path(ATTR(ATTR_D));
+				kanji.strokes << KanjiVGStrokeItem();
+				KanjiVGStrokeItem &stroke = kanji.strokes.last();
+				stroke.path = path;
+				++strokeCounter;
+			TAG_BEGIN(TAG_PATH)
+			ENDTAG
+		}
+	TAG_POST
+	return true;
+}
+
 bool KanjiVGParser::parse(QXmlStreamReader &reader)
 {
 	reader.setNamespaceProcessing(false);
@@ -111,40 +153,7 @@ bool KanjiVGParser::parse(QXmlStreamReader &reader)
 		TAG(TAG_KANJIVG)
 			TAG_PRE(TAG_KANJI)
 				KanjiVGItem kanji;
-				quint8 strokeCounter(0);
-				int id(ATTR(ATTR_ID).mid(QString("kvg:kanji_").size()).toInt(0, 16));
-				bool shallInsert(TextTools::isJapaneseChar(TextTools::unicodeToSingleChar(id)));
-				kanji.id = id;
-			TAG_BEGIN(TAG_KANJI)
-				if (shallInsert) {
-					TAG_PRE(TAG_GROUP)
-						int element(TextTools::singleCharToUnicode(ATTR(ATTR_ELEMENT)));
-						int original(TextTools::singleCharToUnicode(ATTR(ATTR_ORIGINAL)));
-						QStack<KanjiVGGroupItem *> gStack;
-
-						kanji.groups << KanjiVGGroupItem();
-						KanjiVGGroupItem *group = &kanji.groups.last();
-						group->element = element;
-						group->original = original;
-						if (HAS_ATTR(ATTR_RADICAL)) {
-							QString rad(ATTR(ATTR_RADICAL));
-							if (rad == "general") group->radicalType = KanjiVGGroupItem::GENERAL;
-							else if (rad == "tradit") group->radicalType = KanjiVGGroupItem::TRADIT;
-							else if (rad == "nelson") group->radicalType = KanjiVGGroupItem::NELSON;
-							else qDebug("Unknown radical type: %s", rad.toLatin1().constData());
-						}
-						if (!parse_strokegr(reader, kanji, gStack, strokeCounter)) return false;
-					DONE
-					TAG_PRE(TAG_PATH)
-						QString path(ATTR(ATTR_D));
-						kanji.strokes << KanjiVGStrokeItem();
-						KanjiVGStrokeItem &stroke = kanji.strokes.last();
-						stroke.path = path;
-						++strokeCounter;
-					TAG_BEGIN(TAG_PATH)
-					ENDTAG
-				}
-			TAG_POST
+				if (!parseKanji(reader, kanji)) return false;
 				onItemParsed(kanji);
 			DONE
 		ENDTAG
@@ -156,3 +165,71 @@ bool KanjiVGParser::parse(QXmlStreamReader &reader)
 		DONE
 	DOCUMENT_END
 }
+
+/**
+ * Parses every n-th kanji element of a KanjiVG file, starting from the
+ * first-th one.
+ */
+class KanjiVGChunksParser : public QRunnable
+{
+private:
+	const QByteArray &_data;
+	const QList<QPair<int, int> > &_chunks;
+	QVector<KanjiVGItem> &_items;
+	QVector<bool> &_success;
+	int _first, _n;
+
+public:
+	KanjiVGChunksParser(const QByteArray &data, const QList<QPair<int, int> > &chunks, QVector<KanjiVGItem> &items, QVector<bool> &success, int first, int n) : _data(data), _chunks(chunks), _items(items), _success(success), _first(first), _n(n) {}
+	virtual void run();
+};
+
+void KanjiVGChunksParser::run()
+{
+	for (int i = _first; i < _chunks.size(); i += _n) {
+		QXmlStreamReader reader(_data.mid(_chunks[i].first, _chunks[i].second));
+		reader.setNamespaceProcessing(false);
+		while (!reader.atEnd() && reader.readNext() != QXmlStreamReader::StartElement);
+		_success[i] = reader.tokenType() == QXmlStreamReader::StartElement && KanjiVGParser::parseKanji(reader, _items[i]);
+	}
+}
+
+bool KanjiVGParser::parse(const QByteArray &data)
+{
+	static const QByteArray kanjiBegin("<kanji ");
+	static const QByteArray kanjiEnd("</kanji>");
+
+	// The version is in a comment before the first kanji
+	int pos = data.indexOf(kanjiBegin);
+	if (pos == -1) return false;
+	if (versionRegExp.indexIn(QString::fromUtf8(data.left(pos))) != -1) {
+		_version = versionRegExp.capturedTexts()[1];
+		gotVersion = true;
+	}
+
+	// Kanji elements are not nested, so they can be parsed on their own
+	QList<QPair<int, int> > chunks;
+	while (pos != -1) {
+		int end = data.indexOf(kanjiEnd, pos);
+		if (end == -1) return false;
+		end += kanjiEnd.size();
+		chunks << QPair<int, int>(pos, end - pos);
+		pos = data.indexOf(kanjiBegin, end);
+	}
+
+	QVector<KanjiVGItem> items(chunks.size());
+	QVector<bool> success(chunks.size(), false);
+	QThreadPool pool;
+	int n = pool.maxThreadCount();
+	for (int i = 0; i < n; i++) pool.start(new KanjiVGChunksParser(data, chunks, items, success, i, n));
+	pool.waitForDone();
+
+	for (int i = 0; i < items.size(); i++) {
+		if (!success[i]) {
+			qDebug("Parser error in kanji at offset %d", chunks[i].first);
+			return false;
+		}
+		onItemParsed(items[i]);
+	}
+	return true;
+}
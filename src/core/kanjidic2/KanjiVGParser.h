@@ -60,12 +60,21 @@ private:
 	
 	QString _version;
 	bool gotVersion;
-	bool parse_strokegr(QXmlStreamReader& reader, KanjiVGItem& kanji, QStack< KanjiVGGroupItem* > gStack, quint8& strokeCounter);
+	// Do not use any member, so kanji can be parsed from several threads
+	static bool parse_strokegr(QXmlStreamReader& reader, KanjiVGItem& kanji, QStack< KanjiVGGroupItem* > gStack, quint8& strokeCounter);
 	
 public:
 	KanjiVGParser() : gotVersion(false) {}
 	virtual ~KanjiVGParser() {}
 	bool parse(QXmlStreamReader &reader);
+	/**
+	 * Parses a whole KanjiVG file. The file is split at kanji elements,
+	 * which are parsed on all available cores, and onItemParsed() is
+	 * then called for every kanji in the order of the file.
+	 */
+	bool parse(const QByteArray &data);
+	/// Parses a kanji element, the start of which has just been read
+	static bool parseKanji(QXmlStreamReader &reader, KanjiVGItem &kanji);
 	const QString &version() const { return _version; }
 	
 	// This method can be overloaded by subclasses in order to implement
@@ -39,7 +39,7 @@ unsigned int KanjiComponent::unicode(bool simplified) const {
 	return TextTools::singleCharToUnicode(repr(simplified));
 }
 
-KanjiStroke::KanjiStroke(const QChar& type, const QString& path) : _type(type), _path(path)
+KanjiStroke::KanjiStroke(const QChar& type, const QByteArray& path) : _type(type), _path(path)
 {
 }
 
@@ -47,19 +47,25 @@ KanjiStroke::~KanjiStroke()
 {
 }
 
-Kanjidic2Entry::Kanjidic2Entry(const QString& kanji, bool inDB, int grade, int strokeCount, qint32 kanjiFrequency, int jlpt, int heisig, const QString &dictionaries) : Entry(KANJIDIC2ENTRY_GLOBALID, TextTools::singleCharToUnicode(kanji)), _inDB(inDB), _kanji(kanji), _grade(grade), _strokeCount(strokeCount), _jlpt(jlpt), _heisig(heisig), _dictionaries(dictionaries)
+Kanjidic2Entry::Kanjidic2Entry(const QString& kanji, bool inDB, int grade, int strokeCount, qint32 kanjiFrequency, int jlpt, int heisig, const QString &dictionaries) : Entry(KANJIDIC2ENTRY_GLOBALID, TextTools::singleCharToUnicode(kanji)), _inDB(inDB), _kanji(kanji), _grade(grade), _strokeCount(strokeCount), _jlpt(jlpt), _heisig(heisig), _graph(KanjiGraph::empty()), _dictionaries(dictionaries)
 {
 	_frequency = kanjiFrequency;
 }
 
-KanjiComponent *Kanjidic2Entry::addComponent(const QString& element, const QString& original, bool isRoot)
+const ConstKanjiGraphPointer &KanjiGraph::empty()
+{
+	static const ConstKanjiGraphPointer emptyGraph(new KanjiGraph());
+	return emptyGraph;
+}
+
+KanjiComponent *KanjiGraph::addComponent(const QString& element, const QString& original, bool isRoot)
 {
 	_components << KanjiComponent(element, original);
 	if (isRoot) _rootComponents << &_components.last();
 	return &_components.last();
 }
 
-KanjiStroke *Kanjidic2Entry::addStroke(const QChar &type, const QString &path)
+KanjiStroke *KanjiGraph::addStroke(const QChar &type, const QByteArray &path)
 {
 	_strokes << KanjiStroke(type, path);
 	return &_strokes.last();
@@ -71,7 +77,7 @@ KanjiStroke *Kanjidic2Entry::addStroke(const QChar &type, const QString &path)
  */
 const QList<const KanjiComponent *> &Kanjidic2Entry::rootComponents() const
 {
-	return _rootComponents;
+	return _graph->rootComponents();
 	/*
 	// Build a strokes coverage map associating each stroke to a "root" component
 	QMap<const KanjiStroke *, const KanjiComponent *> strokesCoverage;
@@ -95,6 +101,18 @@ const QList<const KanjiComponent *> &Kanjidic2Entry::rootComponents() const
 	return ret;*/
 }
 
+int Kanjidic2Entry::memoryFootprint() const
+{
+	int ret = Entry::memoryFootprint() + sizeof(Kanjidic2Entry) - sizeof(Entry);
+	ret += footprint(_kanji) + footprint(_skip) + footprint(_fourCorner) + footprint(_dictionaries) + footprint(_nanoris);
+	foreach (const KanjiReading &reading, _readings)
+		ret += sizeof(KanjiReading) + 16 + footprint(reading.type()) + footprint(reading.reading());
+	foreach (const KanjiMeaning &meaning, _meanings)
+		ret += sizeof(KanjiMeaning) + 16 + footprint(meaning.lang()) + footprint(meaning.meaning());
+	ret += _variationOf.size() * (sizeof(quint32) + 8) + _radicals.size() * (sizeof(QPair<uint, quint8>) + 8);
+	return ret;
+}
+
 QStringList Kanjidic2Entry::writings() const
 {
 	QStringList res;
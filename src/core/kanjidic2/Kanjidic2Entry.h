@@ -22,9 +22,11 @@
 #include "core/TextTools.h"
 
 #include <QStack>
+#include <QByteArray>
+#include <QCoreApplication>
 
 #define KANJIDIC2ENTRY_GLOBALID 2
-#define KANJIDIC2DB_REVISION 5
+#define KANJIDIC2DB_REVISION 12
 
 class KanjiStroke;
 
@@ -40,7 +42,7 @@ public:
 	virtual ~KanjiComponent();
 	
 	const QList<const KanjiStroke *> &strokes() const { return _strokes; }
-	void addStroke(KanjiStroke *stroke) { _strokes << stroke; }
+	void addStroke(const KanjiStroke *stroke) { _strokes << stroke; }
 	const QString &element() const { return _element; }
 	const QString &original() const { return _original; }
 
@@ -60,19 +62,51 @@ class KanjiStroke
 {
 private:
 	QChar _type;
-	QString _path;
+	QByteArray _path;
 
 public:
-	KanjiStroke(const QChar &type, const QString &path);
+	KanjiStroke(const QChar &type, const QByteArray &path);
 	virtual ~KanjiStroke();
 
 	const QChar &type() const { return _type; }
-	const QString &path() const { return _path; }
+	/// Compiled path of the stroke, see KanjiStrokePath
+	const QByteArray &path() const { return _path; }
 };
 
+/**
+ * Strokes and components of a kanji. They never change once loaded, so a
+ * single instance is shared by all the instances of the entry of a kanji,
+ * and is kept by the Kanjidic2EntryLoader after the entry is deleted.
+ */
+class KanjiGraph
+{
+private:
+	QList<KanjiStroke> _strokes;
+	QList<KanjiComponent> _components;
+	QList<const KanjiComponent *> _rootComponents;
+
+	// Components point to our strokes
+	KanjiGraph(const KanjiGraph &);
+	KanjiGraph &operator=(const KanjiGraph &);
+
+public:
+	KanjiGraph() {}
+
+	const QList<KanjiStroke> &strokes() const { return _strokes; }
+	const QList<KanjiComponent> &components() const { return _components; }
+	const QList<const KanjiComponent *> &rootComponents() const { return _rootComponents; }
+
+	KanjiStroke *addStroke(const QChar &type, const QByteArray &path);
+	KanjiComponent *addComponent(const QString &element, const QString &original, bool isRoot = false);
+
+	/// Shared graph of kanjis without strokes
+	static const QSharedPointer<const KanjiGraph> &empty();
+};
+typedef QSharedPointer<const KanjiGraph> ConstKanjiGraphPointer;
+
 class Kanjidic2Entry : public Entry
 {
-	Q_OBJECT
+	Q_DECLARE_TR_FUNCTIONS(Kanjidic2Entry)
 public:
 	class KanjiReading {
 	private:
@@ -113,26 +147,17 @@ private:
 	QString _fourCorner;
 
 	/**
-	 * Contains the components of the kanji, in their order of appearance.
-	 * A kanji always contains at least one component, which is its root.
+	 * Contains the strokes and components of the kanji, in their order
+	 * of appearance. A kanji always contains at least one component,
+	 * which is its root.
 	 */
-	QList<KanjiComponent> _components;
-	QList<const KanjiComponent *> _rootComponents;
+	ConstKanjiGraphPointer _graph;
 	QList<QPair<uint, quint8> > _radicals;
 	QString _dictionaries;
 
-	/**
-	 * Contains the strokes of the kanji, in their order of appearance.
-	 */
-	QList<KanjiStroke> _strokes;
-
 	// No copy, ever!
 	Kanjidic2Entry operator=(const Kanjidic2Entry &);
 
-protected:
-	KanjiComponent *addComponent(const QString &element, const QString &original, bool isRoot = false);
-	KanjiStroke *addStroke(const QChar &type, const QString &path);
-
 protected:
 	Kanjidic2Entry(const QString &kanji, bool inDB, int grade = -1, int strokeCount = -1, qint32 kanjiFrequency = -1, int jlpt = -1, int heisig = -1, const QString &dictionaries = "");
 
@@ -152,9 +177,10 @@ public:
 	const QStringList &nanoris() const { return _nanoris; }
 	const QList<quint32> &variationOf() const { return _variationOf; }
 
-	const QList<KanjiComponent> &components() const { return _components; }
+	const ConstKanjiGraphPointer &graph() const { return _graph; }
+	const QList<KanjiComponent> &components() const { return _graph->components(); }
 	const QList<QPair<uint, quint8> > &radicals() const { return _radicals; }
-	const QList<KanjiStroke> &strokes() const { return _strokes; }
+	const QList<KanjiStroke> &strokes() const { return _graph->strokes(); }
 	const QString &dictionaries() const { return _dictionaries; }
 	/**
 	 * Returns the root components, i.e. the minimum set of components that are sufficient
@@ -186,6 +212,8 @@ public:
 	virtual QStringList readings() const;
 	virtual QStringList meanings() const;
 	virtual QString name() const { return kanji(); }
+	/// The graph is not counted since it is shared and cached separately
+	virtual int memoryFootprint() const;
 
 	QStringList onyomiReadings() const;
 	QStringList kunyomiReadings() const;
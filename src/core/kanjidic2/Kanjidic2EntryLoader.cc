@@ -16,29 +16,33 @@
  */
 
 #include "core/Lang.h"
+#include "core/Database.h"
 #include "core/kanjidic2/Kanjidic2EntryLoader.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
 #include "core/kanjidic2/Kanjidic2Plugin.h"
+#include "core/kanjidic2/KanjiStrokePath.h"
+#include "core/PackReader.h"
 
-Kanjidic2EntryLoader::Kanjidic2EntryLoader() : EntryLoader(), kanjiQuery(&connection), variationsQuery(&connection), readingsQuery(&connection), nanoriQuery(&connection), componentsQuery(&connection), radicalsQuery(&connection), skipQuery(&connection), fourCornerQuery(&connection)
+#include "core/EntrySummary.h"
+
+#include <QMutexLocker>
+#include <QSet>
+
+QMutex Kanjidic2EntryLoader::_graphsMutex;
+QCache<EntryId, ConstKanjiGraphPointer> Kanjidic2EntryLoader::_graphs(20000);
+
+Kanjidic2EntryLoader::Kanjidic2EntryLoader() : EntryLoader(), packedQuery(&connection), pathsQuery(&connection)
 {
 	const QMap<QString, QString> &allDBs = Kanjidic2Plugin::instance()->attachedDBs();
-	foreach (const QString &lang, allDBs.keys()) {
-		QString dbAlias(lang.isEmpty() ? "kanjidic2" : "kanjidic2_" + lang);
-		if (!connection.attach(allDBs[lang], dbAlias)) {
-			qFatal("Kanjidic2EntrySearcher cannot attach Kanjidic2 databases!");
-		}
+	QMap<QString, QString> aliases;
+	foreach (const QString &lang, allDBs.keys()) aliases[lang.isEmpty() ? "kanjidic2" : "kanjidic2_" + lang] = allDBs[lang];
+	if (!Database::openDictionaryConnection(connection, aliases)) {
+		qFatal("Kanjidic2EntrySearcher cannot attach Kanjidic2 databases!");
 	}
 
 	// Prepare loading queries for faster execution
-	kanjiQuery.prepare("select grade, strokeCount, frequency, jlpt, heisig, dictionaries, paths from kanjidic2.entries where id = ?");
-	variationsQuery.prepare("select distinct original from strokeGroups where element = ? and original not null");
-	readingsQuery.prepare("select type, reading from kanjidic2.reading join kanjidic2.readingText on kanjidic2.reading.docid = kanjidic2.readingText.docid where entry = ? order by type");
-	nanoriQuery.prepare("select reading from kanjidic2.nanori join kanjidic2.nanoriText on kanjidic2.nanori.docid = kanjidic2.nanoriText.docid where entry = ?");
-	componentsQuery.prepare("select element, original, isRoot, pathsRefs from strokeGroups where kanji = ? order by rowid");
-	radicalsQuery.prepare("select rl.number, rl.kanji from kanjidic2.radicals as r join kanjidic2.radicalsList as rl on r.number = rl.number where r.kanji = ? and r.type is not null order by rl.number, rl.rowid");
-	skipQuery.prepare("select type, c1, c2 from skip where entry = ? limit 1");
-	fourCornerQuery.prepare("select topLeft, topRight, botLeft, botRight, extra from fourCorner where entry = ? limit 1");
+	packedQuery.prepare("select data from kanjidic2.packed where id = ?");
+	pathsQuery.prepare("select paths from kanjidic2.entries where id = ?");
 
 	foreach (const QString &lang, allDBs.keys()) {
 		if (lang.isEmpty()) continue;
@@ -52,17 +56,16 @@ Kanjidic2EntryLoader::Kanjidic2EntryLoader() : EntryLoader(), kanjiQuery(&connec
 QList<Kanjidic2Entry::KanjiMeaning> Kanjidic2EntryLoader::getMeanings(int id)
 {
 	QList<Kanjidic2Entry::KanjiMeaning> ret;
-	const QMap<QString, QString> &allDBs = Kanjidic2Plugin::instance()->attachedDBs();
 	bool nonEnglishLoaded = false;
 	foreach (const QString &lang, Lang::preferredDictLanguages()) {
 		// Do not load english if a preferred language is already loaded and the corresponding option is set
 		if (!Lang::alwaysShowEnglish() && nonEnglishLoaded && lang == "en" && ret.size() > 0) continue;
-		if (!allDBs.contains(lang)) continue;
+		if (!meaningsQueries.contains(lang)) continue;
 		SQLite::Query &meaningsQuery = meaningsQueries[lang];
 		meaningsQuery.bindValue(id);
 		meaningsQuery.exec();
 		while(meaningsQuery.next()) {
-			ret << Kanjidic2Entry::KanjiMeaning(lang, QString::fromUtf8(qUncompress(meaningsQuery.valueBlob(0))));
+			ret << Kanjidic2Entry::KanjiMeaning(lang, QString::fromUtf8(qUncompress(meaningsQuery.valueBlobRaw(0))));
 		}
 		meaningsQuery.reset();
 		if (lang != "en" && !ret.isEmpty()) nonEnglishLoaded = true;
@@ -70,8 +73,8 @@ QList<Kanjidic2Entry::KanjiMeaning> Kanjidic2EntryLoader::getMeanings(int id)
 	// Here we probably have a kana or roman character that we can build up
 	if (ret.isEmpty()) {
 		QString character(TextTools::unicodeToSingleChar(id));
-		TextTools::KanaInfo kInfo(TextTools::kanaInfo(QChar(id)));
-		QString reading(kInfo.reading);
+		const TextTools::KanaInfo &kInfo(TextTools::kanaInfo(QChar(id)));
+		QString reading(QString::fromLatin1(kInfo.reading));
 		QString info(reading.isEmpty() || kInfo.size == TextTools::KanaInfo::Normal ? "" : " (small)");
 		if (reading.isEmpty()) reading = character;
 
@@ -82,54 +85,114 @@ QList<Kanjidic2Entry::KanjiMeaning> Kanjidic2EntryLoader::getMeanings(int id)
 	return ret;
 }
 
-Entry *Kanjidic2EntryLoader::loadEntry(EntryId id)
+ConstKanjiGraphPointer Kanjidic2EntryLoader::getGraph(EntryId id, PackReader &components)
+{
+	{
+		QMutexLocker lock(&_graphsMutex);
+		ConstKanjiGraphPointer *graph = _graphs.object(id);
+		if (graph) return *graph;
+	}
+
+	// Another loader may load the same graph by the meantime, in which case
+	// the last one loaded replaces the other in the cache
+	ConstKanjiGraphPointer graph(loadGraph(id, components));
+	QMutexLocker lock(&_graphsMutex);
+	_graphs.insert(id, new ConstKanjiGraphPointer(graph), graph->strokes().size() + 1);
+	return graph;
+}
+
+ConstKanjiGraphPointer Kanjidic2EntryLoader::loadGraph(EntryId id, PackReader &components)
+{
+	QList<QByteArray> paths;
+	pathsQuery.bindValue(id);
+	pathsQuery.exec();
+	if (pathsQuery.next()) {
+		QByteArray pathsBA(pathsQuery.valueBlob(0));
+		if (!pathsBA.isEmpty()) paths = KanjiStrokePath::unpack(qUncompress(pathsBA));
+	}
+	pathsQuery.reset();
+
+	KanjiGraph *graph = new KanjiGraph();
+	// Insert the strokes
+	foreach (const QByteArray &path, paths) graph->addStroke(0, path);
+
+	// Add the components
+	quint16 count = components.read<quint16>();
+	for (int i = 0; i < count && components.ok(); i++) {
+		QString element(TextTools::unicodeToSingleChar(components.read<quint32>()));
+		QString original(TextTools::unicodeToSingleChar(components.read<quint32>()));
+		bool isRoot = components.read<quint8>();
+		KanjiComponent *comp(graph->addComponent(element, original, isRoot));
+		// Add references to the strokes belonging to this component
+		QByteArray pathsRefs(components.readBytes());
+		for (int j = 0; j < pathsRefs.size(); j++) {
+			quint8 idx(static_cast<quint8>(pathsRefs[j]));
+			if (idx < graph->strokes().size()) comp->addStroke(&graph->strokes()[idx]);
+		}
+	}
+	return ConstKanjiGraphPointer(graph);
+}
+
+Kanjidic2Entry *Kanjidic2EntryLoader::readRecord(EntryId id, const QByteArray &record, PackReader &reader)
 {
 	QString character = TextTools::unicodeToSingleChar(id);
 
-	kanjiQuery.bindValue(id);
-	kanjiQuery.exec();
 	Kanjidic2Entry *entry;
-	QStringList paths;
 	// We have no information about this kanji! This is probably an unknown radical
-	if (!kanjiQuery.next()) {
+	if (record.isEmpty() || !reader.read<quint8>()) {
 		entry = new Kanjidic2Entry(character, false);
 	} else {
 		// Else load the kanji
-		int grade = kanjiQuery.valueIsNull(0) ? -1 : kanjiQuery.valueInt(0);
-		int strokeCount = kanjiQuery.valueIsNull(1) ? -1 :kanjiQuery.valueInt(1);
-		qint32 frequency = kanjiQuery.valueIsNull(2) ? -1 : kanjiQuery.valueInt(2);
-		int jlpt = kanjiQuery.valueIsNull(3) ? -1 : kanjiQuery.valueInt(3);
-		int heisig = kanjiQuery.valueIsNull(4) ? -1 : kanjiQuery.valueInt(4);
-		const QString &dictionaries = kanjiQuery.valueString(5);
-		// Get the strokes paths for later processing
-		QByteArray pathsBA(kanjiQuery.valueBlob(6));
-		if (!pathsBA.isEmpty()) paths = QString(qUncompress(pathsBA)).split('|');
+		int grade = reader.read<qint16>();
+		int strokeCount = reader.read<qint16>();
+		qint32 frequency = reader.read<qint16>();
+		int jlpt = reader.read<qint16>();
+		int heisig = reader.read<qint16>();
+		QString dictionaries(reader.readString());
 
 		entry = new Kanjidic2Entry(character, true, grade, strokeCount, frequency, jlpt, heisig, dictionaries);
 	}
-	kanjiQuery.reset();
-	
-	loadMiscData(entry);
-	
-	// Find the kanjis this one is a variation of
-	variationsQuery.bindValue(id);
-	variationsQuery.exec();
-	while (variationsQuery.next()) {
-		entry->_variationOf << variationsQuery.valueInt(0);
-	}
-	variationsQuery.reset();
-
-	// Now load readings, meanings and nanoris
-	// Readings
-	readingsQuery.bindValue(id);
-	readingsQuery.exec();
-	while (readingsQuery.next()) {
-		entry->_readings << Kanjidic2Entry::KanjiReading(readingsQuery.valueString(0), readingsQuery.valueString(1));
+
+	if (!record.isEmpty()) {
+		// The kanjis this one is a variation of
+		quint16 count = reader.read<quint16>();
+		for (int i = 0; i < count && reader.ok(); i++) entry->_variationOf << reader.read<quint32>();
+		// Readings
+		count = reader.read<quint16>();
+		for (int i = 0; i < count && reader.ok(); i++) {
+			QString type(reader.readString());
+			entry->_readings << Kanjidic2Entry::KanjiReading(type, reader.readString());
+		}
+		// Nanori
+		count = reader.read<quint16>();
+		for (int i = 0; i < count && reader.ok(); i++) entry->_nanoris << reader.readString();
+		// Radicals
+		count = reader.read<quint16>();
+		for (int i = 0; i < count && reader.ok(); i++) {
+			uint kanji = reader.read<quint32>();
+			entry->_radicals << QPair<uint, quint8>(kanji, reader.read<quint8>());
+		}
+		// Skip code
+		if (reader.read<quint8>()) {
+			int type = reader.read<quint8>();
+			int c1 = reader.read<quint8>();
+			int c2 = reader.read<quint8>();
+			entry->_skip = QString("%1-%2-%3").arg(type).arg(c1).arg(c2);
+		}
+		// Four corner code
+		if (reader.read<quint8>()) {
+			quint8 fc[5];
+			for (int i = 0; i < 5; i++) fc[i] = reader.read<quint8>();
+			entry->_fourCorner = QString("%1%2%3%4.%5").arg(fc[0]).arg(fc[1]).arg(fc[2]).arg(fc[3]).arg(fc[4]);
+		}
+		if (!reader.ok()) qWarning("Truncated packed record for kanji %d", id);
 	}
-	readingsQuery.reset();
+	return entry;
+}
 
-	// Meanings
-	entry->_meanings = getMeanings(id);
+void Kanjidic2EntryLoader::setMeanings(Kanjidic2Entry *entry, const QList<Kanjidic2Entry::KanjiMeaning> &meanings)
+{
+	entry->_meanings = meanings.isEmpty() ? getMeanings(entry->id()) : meanings;
 	// If this kanji has no meaning, but is derived from a kanji that does, then the meanings are inherited
 	if (entry->_meanings.isEmpty()) {
 		// Look for every variation until we find one that has meanings
@@ -140,65 +203,98 @@ Entry *Kanjidic2EntryLoader::loadEntry(EntryId id)
 			}
 		}
 	}
+}
 
-	// Nanori
-	nanoriQuery.bindValue(id);
-	nanoriQuery.exec();
-	while(nanoriQuery.next()) {
-		entry->_nanoris << nanoriQuery.valueString(0);
-	}
-	nanoriQuery.reset();
+QHash<EntryId, QByteArray> Kanjidic2EntryLoader::getRecords(const QVector<EntryId> &ids)
+{
+	QHash<EntryId, QByteArray> ret;
+	SQLite::Query query(&connection);
+	query.exec(QString("select id, data from kanjidic2.packed where id in (%1)").arg(idList(ids)));
+	while (query.next()) ret[query.valueUInt(0)] = query.valueBlob(1);
+	return ret;
+}
 
-	// Insert the strokes
-	foreach (const QString &path, paths) entry->addStroke(0, path);
-
-	// Load components
-	componentsQuery.bindValue(id);
-	componentsQuery.exec();
-	while(componentsQuery.next()) {
-		QString element(TextTools::unicodeToSingleChar(componentsQuery.valueUInt(0)));
-		QString original(TextTools::unicodeToSingleChar(componentsQuery.valueUInt(1)));;
-		
-		KanjiComponent *comp(entry->addComponent(element, original, componentsQuery.valueBool(2)));
-		// Add references to the strokes belonging to this component
-		QByteArray pathsRefs(componentsQuery.valueBlob(3));
-		for (int i = 0; i < pathsRefs.size(); i++) {
-			quint8 idx(static_cast<quint8>(pathsRefs[i]));
-			comp->addStroke(&entry->_strokes[idx]);
+QHash<EntryId, QList<Kanjidic2Entry::KanjiMeaning> > Kanjidic2EntryLoader::getMeanings(const QVector<EntryId> &ids)
+{
+	// Same rules as getMeanings(int), applied to every entry
+	QHash<EntryId, QList<Kanjidic2Entry::KanjiMeaning> > ret;
+	QSet<EntryId> nonEnglishLoaded;
+	SQLite::Query query(&connection);
+	QString in(idList(ids));
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
+		if (!meaningsQueries.contains(lang)) continue;
+		query.exec(QString("select entry, meanings from kanjidic2_%1.meaning where entry in (%2)").arg(lang).arg(in));
+		while (query.next()) {
+			EntryId id = query.valueUInt(0);
+			if (!Lang::alwaysShowEnglish() && lang == "en" && nonEnglishLoaded.contains(id)) continue;
+			ret[id] << Kanjidic2Entry::KanjiMeaning(lang, QString::fromUtf8(qUncompress(query.valueBlobRaw(1))));
 		}
+		if (lang != "en") foreach (EntryId id, ret.keys()) nonEnglishLoaded << id;
 	}
-	componentsQuery.reset();
-	
-	// Load radicals
-	radicalsQuery.bindValue(id);
-	radicalsQuery.exec();
-	// We take the first radical character corresponding to the number,
-	// as it is the one that represents the radical the best
-	int curNbr = -1;
-	while (radicalsQuery.next()) {
-		quint8 nbr = radicalsQuery.valueUInt(0);
-		uint kanji = radicalsQuery.valueUInt(1);
-		if (curNbr == nbr) continue;
-		curNbr = nbr;
-		entry->_radicals << QPair<uint, quint8>(kanji, nbr);
-	}
-	radicalsQuery.reset();
+	return ret;
+}
 
-	// Load skip code
-	skipQuery.bindValue(id);
-	skipQuery.exec();
-	if (skipQuery.next()) {
-		entry->_skip = QString("%1-%2-%3").arg(skipQuery.valueInt(0)).arg(skipQuery.valueInt(1)).arg(skipQuery.valueInt(2));
+Entry *Kanjidic2EntryLoader::loadEntry(EntryId id)
+{
+	packedQuery.bindValue(id);
+	packedQuery.exec();
+	QByteArray record;
+	if (packedQuery.next()) record = packedQuery.valueBlobRaw(0);
+	const uchar *data = reinterpret_cast<const uchar *>(record.constData());
+	PackReader reader(data, data + record.size());
+	Kanjidic2Entry *entry = readRecord(id, record, reader);
+
+	// Strokes and components, which is the end of the record. The record
+	// points into SQLite's memory until the query is reset.
+	entry->_graph = getGraph(id, reader);
+	packedQuery.reset();
+
+	loadMiscData(entry);
+
+	// Meanings
+	setMeanings(entry, getMeanings(id));
+
+	return entry;
+}
+
+QVector<Entry *> Kanjidic2EntryLoader::loadEntries(const QVector<EntryId> &ids)
+{
+	QVector<Entry *> ret;
+	if (ids.isEmpty()) return ret;
+	ret.reserve(ids.size());
+	QHash<EntryId, QByteArray> records(getRecords(ids));
+	QHash<EntryId, QList<Kanjidic2Entry::KanjiMeaning> > meanings(getMeanings(ids));
+	foreach (EntryId id, ids) {
+		const QByteArray record(records.value(id));
+		const uchar *data = reinterpret_cast<const uchar *>(record.constData());
+		PackReader reader(data, data + record.size());
+		Kanjidic2Entry *entry = readRecord(id, record, reader);
+		entry->_graph = getGraph(id, reader);
+		setMeanings(entry, meanings.value(id));
+		ret << entry;
 	}
-	skipQuery.reset();
+	loadMiscData(ret);
+	return ret;
+}
 
-	// Load four corner code
-	fourCornerQuery.bindValue(id);
-	fourCornerQuery.exec();
-	if (fourCornerQuery.next()) {
-		entry->_fourCorner = QString("%1%2%3%4.%5").arg(fourCornerQuery.valueInt(0)).arg(fourCornerQuery.valueInt(1)).arg(fourCornerQuery.valueInt(2)).arg(fourCornerQuery.valueInt(3)).arg(fourCornerQuery.valueInt(4));
+QVector<EntrySummary> Kanjidic2EntryLoader::loadSummaries(const QVector<EntryId> &ids)
+{
+	// Summaries only need the readings and meanings, so the graphs of the
+	// entries are neither loaded nor parsed
+	QVector<EntrySummary> ret;
+	if (ids.isEmpty()) return ret;
+	ret.reserve(ids.size());
+	QHash<EntryId, QByteArray> records(getRecords(ids));
+	QHash<EntryId, QList<Kanjidic2Entry::KanjiMeaning> > meanings(getMeanings(ids));
+	foreach (EntryId id, ids) {
+		const QByteArray record(records.value(id));
+		const uchar *data = reinterpret_cast<const uchar *>(record.constData());
+		PackReader reader(data, data + record.size());
+		Kanjidic2Entry *entry = readRecord(id, record, reader);
+		setMeanings(entry, meanings.value(id));
+		ret << EntrySummary(*entry);
+		delete entry;
 	}
-	fourCornerQuery.reset();
-	
-	return entry;
+	loadMiscData(ret);
+	return ret;
 }
@@ -21,20 +21,75 @@
 #include "core/EntryLoader.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
 
+#include <QCache>
+#include <QMutex>
+#include <QHash>
+
+class PackReader;
+
+/**
+ * Loads kanji entries from the packed table of kanjidic2.db, which holds
+ * all the static data of each character in a single row so that it takes
+ * one lookup. Its records are made of, in order and little-endian:
+ *
+ * - quint8 whether the character is in kanjidic2, and if so the qint16
+ *   grade, stroke count, frequency, JLPT level and Heisig number (-1 if
+ *   unknown) and the string of dictionaries,
+ * - quint16 number of variations, each a quint32 character,
+ * - quint16 number of readings, each a type string and a reading string,
+ * - quint16 number of nanori strings,
+ * - quint16 number of radicals, each a quint32 character and a quint8
+ *   radical number,
+ * - quint8 whether there is a SKIP code, and if so its 3 quint8 parts,
+ * - quint8 whether there is a four corner code, and if so its 5 quint8
+ *   parts,
+ * - quint16 number of components, each a quint32 element, a quint32
+ *   original, a quint8 isRoot and the indexes of its strokes as bytes
+ *   preceded by their quint8 count.
+ *
+ * Strings are UTF-8 preceded by their quint16 size. The stroke paths are
+ * only needed when the graph is not cached and stay in the entries table,
+ * while meanings are in the language databases.
+ */
 class Kanjidic2EntryLoader : public EntryLoader
 {
 private:
-	SQLite::Query kanjiQuery, variationsQuery, readingsQuery, nanoriQuery,
-		componentsQuery, radicalsQuery, skipQuery, fourCornerQuery;
+	SQLite::Query packedQuery, pathsQuery;
 	QMap<QString, SQLite::Query> meaningsQueries;
 
+	/**
+	 * Graphs of the kanjis loaded recently, shared by all the loaders so
+	 * that entries loaded again do not need to load and parse them again.
+	 * The cost of a graph is its number of strokes.
+	 */
+	static QMutex _graphsMutex;
+	static QCache<EntryId, ConstKanjiGraphPointer> _graphs;
+
 protected:
 	QList<Kanjidic2Entry::KanjiMeaning> getMeanings(int id);
+	/// Meanings of several kanjis, loaded with one query per language
+	QHash<EntryId, QList<Kanjidic2Entry::KanjiMeaning> > getMeanings(const QVector<EntryId> &ids);
+	/// Sets the meanings of entry, falling back to the ones of its
+	/// variations if meanings is empty
+	void setMeanings(Kanjidic2Entry *entry, const QList<Kanjidic2Entry::KanjiMeaning> &meanings);
+	/// Packed records of several kanjis, loaded with a single query
+	QHash<EntryId, QByteArray> getRecords(const QVector<EntryId> &ids);
+	/**
+	 * Creates the entry for kanji id from its packed record, which may be
+	 * empty. reader is left positioned on the components of the record.
+	 */
+	Kanjidic2Entry *readRecord(EntryId id, const QByteArray &record, PackReader &reader);
+	/// Returns the graph of kanji id, from the shared cache if possible.
+	/// components must be positioned on the components of the record.
+	ConstKanjiGraphPointer getGraph(EntryId id, PackReader &components);
+	ConstKanjiGraphPointer loadGraph(EntryId id, PackReader &components);
 public:
 	Kanjidic2EntryLoader();
 	virtual ~Kanjidic2EntryLoader() {}
 
 	virtual Entry *loadEntry(EntryId id);
+	virtual QVector<Entry *> loadEntries(const QVector<EntryId> &ids);
+	virtual QVector<EntrySummary> loadSummaries(const QVector<EntryId> &ids);
 };
 
 #endif
@@ -16,9 +16,12 @@
  */
 
 #include "core/TextTools.h"
+#include "core/Database.h"
 #include "core/kanjidic2/Kanjidic2Plugin.h"
 #include "core/kanjidic2/Kanjidic2EntrySearcher.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
+#include "core/kanjidic2/KanjiRadicals.h"
+#include "core/kanjidic2/KanjiComponentIndex.h"
 #include "sqlite/SQLite.h"
 
 #include <QtDebug>
@@ -32,8 +35,51 @@ Kanjidic2EntrySearcher::Kanjidic2EntrySearcher() : EntrySearcher(KANJIDIC2ENTRY_
 	QueryBuilder::Join::addTablePriority("kanjidic2.strokes", 20);
 
 	QueryBuilder::Order::orderingWay["freq"] = QueryBuilder::Order::DESC;
+	QueryBuilder::Order::orderingWay["relevance"] = QueryBuilder::Order::DESC;
 
-	validCommands << "kanji" << "romaji" << "kana" << "mean" << "jlpt" << "grade" << "stroke" << "radical" << "component" << "unicode" << "skip" << "fourcorner" << "kanjidic";
+	validCommands << "kanji" << "romaji" << "kana" << "mean" << "jlpt" << "grade" << "stroke" << "radical" << "component" << "unicode" << "skip" << "fourcorner" << "similar" << "kanjidic";
+}
+
+/// More probes than that are slower than the skip-scan SQLite does itself
+#define MAX_CODE_PROBES 100
+
+/// Column of a code, with the range of its values if it is known
+struct CodeColumn {
+	const char *name;
+	int min;
+	int max;
+};
+
+/**
+ * Adds the conditions matching a code made of several columns of table,
+ * which are in the order of a composite index of the table. Values of -1
+ * are wildcards. Wildcards before the last given value are turned into
+ * the list of values their column can take, so that the index is used
+ * with a few probes even when the leading parts of the code are not known.
+ */
+static void addCodeConditions(QueryBuilder::Statement &statement, const QString &table, const CodeColumn columns[], const int values[], int count)
+{
+	int last = count - 1;
+	while (last >= 0 && values[last] == -1) last--;
+	int probes = 1;
+	for (int i = 0; i <= last; i++) {
+		QString column(QString("%1.%2").arg(table).arg(columns[i].name));
+		if (values[i] != -1) {
+			statement.addWhere(QString("%1 = %2").arg(column).arg(values[i]));
+			continue;
+		}
+		// Later columns can only be used if this one is expanded
+		int domain = columns[i].max - columns[i].min + 1;
+		if (domain <= 0 || probes * domain > MAX_CODE_PROBES) {
+			for (int j = i + 1; j <= last; j++)
+				if (values[j] != -1) statement.addWhere(QString("%1.%2 = %3").arg(table).arg(columns[j].name).arg(values[j]));
+			return;
+		}
+		probes *= domain;
+		QStringList all;
+		for (int v = columns[i].min; v <= columns[i].max; v++) all << QString::number(v);
+		statement.addWhere(QString("%1 in (%2)").arg(column).arg(all.join(", ")));
+	}
 }
 
 SearchCommand Kanjidic2EntrySearcher::commandFromWord(const QString &word) const
@@ -59,34 +105,61 @@ SearchCommand Kanjidic2EntrySearcher::commandFromWord(const QString &word) const
 	return SearchCommand::invalid();
 }
 
+/**
+ * Returns whether the wildcard word w can be matched against the terms of
+ * the meaning FTS index, i.e. whether all its other characters are part of
+ * a single token.
+ */
+static bool isMeaningTermPattern(const QString &w)
+{
+	foreach (const QChar &c, w)
+		if (c != '?' && c != '*' && !c.isLetterOrNumber()) return false;
+	return true;
+}
+
 static QString buildTextSearchCondition(const QStringList &words, const QString &table)
 {
-	static QRegExp regExpChars = QRegExp("[\\?\\*]");
-	static QString ftsMatch("kanjidic2%3.%2Text.reading MATCH '%1'");
-	static QString regexpMatch("kanjidic2%3.%2Text.reading REGEXP '%1'");
-	static QString glossRegexpMatch("{{leftcolumn}} in (select entry from kanjidic2_%2.meaning where FTSUNCOMPRESS(meanings) REGEXP '%1')");
-	static QString globalMatch("{{leftcolumn}} IN (SELECT entry FROM kanjidic2%3.%2 JOIN kanjidic2%3.%2Text ON kanjidic2%3.%2.docid = kanjidic2%3.%2Text.docid WHERE %1)");
+	// Not static: QRegExp keeps the state of its last match
+	QRegExp regExpChars("[\\?\\*]");
+	static const QString ftsMatch("kanjidic2%3.%2Text.reading MATCH '%1'");
+	static const QString regexpMatch("kanjidic2%3.%2Text.reading REGEXP '%1'");
+	static const QString suffixMatch("kanjidic2.%2.docid IN (SELECT rowid FROM kanjidic2.%2ReverseText WHERE reading MATCH '%1')");
+	static const QString glossTermsMatch("{{leftcolumn}} in (select entry from kanjidic2_%2.meaning join kanjidic2_%2.meaningText on meaning.docid = meaningText.rowid where meaningText.reading MATCH (select group_concat('\"' || term || '\"', ' OR ') from kanjidic2_%2.meaningTerms where %3 and term REGEXP '%1'))");
+	static const QString glossRegexpMatch("{{leftcolumn}} in (select entry from kanjidic2_%2.meaning where FTSUNCOMPRESS(meanings) REGEXP '%1')");
+	static const QString globalMatch("{{leftcolumn}} IN (SELECT entry FROM kanjidic2%3.%2 JOIN kanjidic2%3.%2Text ON kanjidic2%3.%2.docid = kanjidic2%3.%2Text.rowid WHERE %1)");
 
 	QStringList globalMatches;
-	QStringList langs(Kanjidic2Plugin::instance()->attachedDBs().keys());
-	langs.removeAll("");
+	// Meaning searches are the only ones needing the language databases
+	if (table == "meaning" && !Kanjidic2Plugin::instance()->attachLanguageDatabases()) return QString();
+	QStringList langs(Kanjidic2Plugin::instance()->searchedLanguages());
 	foreach (const QString &lang, langs) {
+		// Readings are in the main database, meanings in the language one
+		SQLite::FTS::Version ftsVersion(Database::ftsVersion(table == "meaning" ? "kanjidic2_" + lang : "kanjidic2"));
 		QStringList fts;
 		QStringList conds;
 		QStringList condsGloss;
 		foreach (const QString &w, words) {
-			if (w.contains(regExpChars)) {
+			// Suffix searches become prefix searches on the reversed readings
+			if (table == "reading" && w.size() > 1 && w[0] == '*' && !w.mid(1).contains(regExpChars)) {
+				conds << suffixMatch.arg(SQLite::FTS::prefixPhrase(ftsVersion, TextTools::reversed(w.mid(1)))).arg(table);
+			} else if (w.contains(regExpChars)) {
 				// First check if we can optimize by using the FTS index (i.e. the first character is not a wildcard)
 				int wildcardIdx = 0;
 				while (!regExpChars.exactMatch(w[wildcardIdx])) wildcardIdx++;
-				if (wildcardIdx != 0) fts << "\"" + w.mid(0, wildcardIdx) + "*\"";
+				if (wildcardIdx != 0) fts << SQLite::FTS::prefixPhrase(ftsVersion, w.mid(0, wildcardIdx));
 				// If the wildcard we found is the last character and a star, there is no need for a regexp search
 				if (wildcardIdx == w.size() - 1 && w.size() > 1 && w[wildcardIdx] == '*') continue;
 				// Otherwise insert the regular expression search
 				QString regExp(TextTools::escapeForRegexp(w));
 				if (table != "meaning")
 					conds << regexpMatch.arg(regExp);
-				else
+				else if (isMeaningTermPattern(w)) {
+					// Wildcard words match whole terms, so look them up
+					// in the vocabulary of the index
+					QString termRegExp(w);
+					termRegExp.replace('?', "\\w").replace('*', "\\w*");
+					condsGloss << glossTermsMatch.arg("^" + termRegExp + "$").arg(lang).arg(SQLite::FTS::termsCondition(ftsVersion));
+				} else
 					condsGloss << glossRegexpMatch.arg(regExp).arg(lang);
 			} else fts << "\"" + w + "\"";
 		}
@@ -152,6 +225,7 @@ void Kanjidic2EntrySearcher::buildStatement(QList<SearchCommand> &commands, Quer
 					if (level < 1 || level > 10) continue;
 					levelsList << QString::number(level);
 				}
+				if (levelsList.isEmpty()) continue;
 				statement.addWhere(QString("kanjidic2.entries.grade in (%1)").arg(levelsList.join(", ")));
 			}
 		}
@@ -213,9 +287,10 @@ void Kanjidic2EntrySearcher::buildStatement(QList<SearchCommand> &commands, Quer
 			int c2 = codeParts[2].toInt(&ok); if (!ok && codeParts[2] != "?") continue;
 			if (t || c1 || c2) {
 				statement.addJoin(QueryBuilder::Join(QueryBuilder::Column("kanjidic2.skip", "entry")));
-				if (t) statement.addWhere(QString("kanjidic2.skip.type = %1").arg(t));
-				if (c1) statement.addWhere(QString("kanjidic2.skip.c1 = %1").arg(c1));
-				if (c2) statement.addWhere(QString("kanjidic2.skip.c2 = %1").arg(c2));
+				// Matches idx_skip_type; SKIP types go from 1 to 4
+				static const CodeColumn columns[] = { { "type", 1, 4 }, { "c1", 0, -1 }, { "c2", 0, -1 } };
+				int values[] = { t ? t : -1, c1 ? c1 : -1, c2 ? c2 : -1 };
+				addCodeConditions(statement, "kanjidic2.skip", columns, values, 3);
 			}
 		}
 		else if (command.command() == "fourcorner") {
@@ -232,12 +307,18 @@ void Kanjidic2EntrySearcher::buildStatement(QList<SearchCommand> &commands, Quer
 			extra = value[5].isDigit() ? value[5].toLatin1() - '0' : -1;
 			if (topLeft != -1 || topRight != -1 || botLeft != -1 || botRight != -1 || extra != -1) {
 				statement.addJoin(QueryBuilder::Join(QueryBuilder::Column("kanjidic2.fourCorner", "entry")));
-				if (topLeft != -1) statement.addWhere(QString("kanjidic2.fourCorner.topLeft = %1").arg(topLeft));
-				if (topRight != -1) statement.addWhere(QString("kanjidic2.fourCorner.topRight = %1").arg(topRight));
-				if (botLeft != -1) statement.addWhere(QString("kanjidic2.fourCorner.botLeft = %1").arg(botLeft));
-				if (botRight != -1) statement.addWhere(QString("kanjidic2.fourCorner.botRight = %1").arg(botRight));
-				if (extra != -1) statement.addWhere(QString("kanjidic2.fourCorner.extra = %1").arg(extra));
-			}	
+				// Matches idx_fourCorner_code; every part is a digit
+				static const CodeColumn columns[] = { { "topLeft", 0, 9 }, { "topRight", 0, 9 }, { "botLeft", 0, 9 }, { "botRight", 0, 9 }, { "extra", 0, 9 } };
+				int values[] = { topLeft, topRight, botLeft, botRight, extra };
+				addCodeConditions(statement, "kanjidic2.fourCorner", columns, values, 5);
+			}
+		}
+		else if (command.command() == "similar") {
+			if (command.args().size() != 1) continue;
+			const QString &arg = command.args()[0];
+			if (arg.size() != 1 || !TextTools::isKanjiChar(arg)) continue;
+			// Similar kanji are computed by build_kanji_db
+			statement.addWhere(QString("kanjidic2.entries.id in (select similar from kanjidic2.similarKanji where kanji = %1)").arg(TextTools::singleCharToUnicode(arg)));
 		}
 		// Filter command
 		else if (command.command() == "kanjidic") ;
@@ -261,15 +342,23 @@ void Kanjidic2EntrySearcher::buildStatement(QList<SearchCommand> &commands, Quer
 	if (!transSearch.isEmpty()) statement.addWhere(buildTextSearchCondition(transSearch, "meaning"));
 
 	if (!radicalSearch.isEmpty()) {
-		statement.addWhere(QString("kanjidic2.entries.id IN("
-			"select r1.kanji from kanjidic2.radicals as r1 "
-			"join kanjidic2.entries as e on r1.kanji = e.id "
-			"where r1.number in ("
-				"select distinct number from radicalsList "
-				"where kanji in (%1)) "
-			"and r1.type is not null "
-			"group by r1.kanji "
-			"having uniquecount(r1.number) >= %2)").arg(radicalSearch.join(", ")).arg(radicalSearch.size()));
+		// Resolved in memory with the radical postings the kanji selectors
+		// also use, so the database only gets the matching ids
+		const KanjiComponentIndex &index = KanjiComponentIndex::instance();
+		QSet<uint> numbers;
+		foreach (const QString &radical, radicalSearch) {
+			quint8 number = KanjiRadicals::instance().kanji2Rad(radical.toUInt());
+			// Not a radical, nothing can match
+			if (!number) {
+				numbers.clear();
+				break;
+			}
+			numbers << number;
+		}
+		QStringList ids;
+		if (!numbers.isEmpty()) foreach (int rank, index.withRadicals(numbers).ranks()) ids << QString::number(index.kanji(rank));
+		if (ids.isEmpty()) statement.addWhere(QString("0"));
+		else statement.addWhere(QString("kanjidic2.entries.id in (%1)").arg(ids.join(", ")));
 	}
 	
 	if (!componentSearch.isEmpty()) {
@@ -309,5 +398,6 @@ QueryBuilder::Column Kanjidic2EntrySearcher::canSort(const QString &sort, const
 	// TODO replace with frequency, once the sort order is changed
 	else if (sort == "freq") return QueryBuilder::Column("kanjidic2.entries", "jlpt");
 	else if (sort == "jlpt") return QueryBuilder::Column("kanjidic2.entries", "frequency");
+	else if (sort == "relevance") return QueryBuilder::Column("kanjidic2.entries", "relevance");
 	return res;
 }
@@ -44,7 +44,7 @@ bool Kanjidic2Parser::parse(QXmlStreamReader &reader)
 						else if (rad_type == "nelson_c") rad.second = Kanjidic2Item::NELSON;
 					TAG_BEGIN(rad_value)
 					CHARACTERS
-						rad.first = TEXT.toUInt();
+						rad.first = TEXTREF.toUInt();
 						kanji.radicals << rad;
 					DONE
 					ENDTAG
@@ -52,25 +52,25 @@ bool Kanjidic2Parser::parse(QXmlStreamReader &reader)
 				TAG(misc)
 					TAG(grade)
 					CHARACTERS
-						kanji.grade = TEXT.toUInt();
+						kanji.grade = TEXTREF.toUInt();
 					DONE
 					ENDTAG
 					TAG(stroke_count)
 					CHARACTERS
-						kanji.stroke_count = TEXT.toUInt();
+						kanji.stroke_count = TEXTREF.toUInt();
 					DONE
 					ENDTAG
 					TAG_PRE(freq)
 						uint curFreq;
 					TAG_BEGIN(freq)
 					CHARACTERS
-						curFreq = TEXT.toUInt();
+						curFreq = TEXTREF.toUInt();
 						kanji.freq = curFreq;
 					DONE
 					ENDTAG
 					TAG(jlpt)
 					CHARACTERS
-						kanji.jlpt = TEXT.toUInt();
+						kanji.jlpt = TEXTREF.toUInt();
 					DONE
 					ENDTAG
 				ENDTAG
@@ -79,10 +79,10 @@ bool Kanjidic2Parser::parse(QXmlStreamReader &reader)
 						QString dr_type(ATTR("dr_type"));
 					TAG_BEGIN(dic_ref)
 					CHARACTERS
-						if (dr_type == "heisig") kanji.heisig = TEXT.toUInt();
+						if (dr_type == QLatin1String("heisig")) kanji.heisig = TEXTREF.toUInt();
 						kanji.dictionaries += dr_type;
 						kanji.dictionaries += '\t';
-						kanji.dictionaries += TEXT;
+						kanji.dictionaries += TEXTREF;
 						kanji.dictionaries += '\n';
 					DONE
 					ENDTAG
@@ -91,17 +91,19 @@ bool Kanjidic2Parser::parse(QXmlStreamReader &reader)
 					TAG(rmgroup)
 						TAG_PRE(reading)
 							QString r_type(ATTR("r_type"));
+							QStringList *readings = _validReadings.contains(r_type) ? &kanji.readings[r_type] : 0;
 						TAG_BEGIN(reading)
 						CHARACTERS
-							if (_validReadings.contains(r_type)) kanji.readings[r_type] << TEXT;
+							if (readings) *readings << TEXT;
 						DONE
 						ENDTAG
 						TAG_PRE(meaning)
 							QString lang;
 							if (HAS_ATTR("m_lang")) lang = ATTR("m_lang");
 							else lang = "en";
+							QStringList *meanings = languages.contains(lang) ? &kanji.meanings[lang] : 0;
 						TAG_BEGIN(meaning)
-							if (languages.contains(lang)) kanji.meanings[lang] << TEXT;
+							if (meanings) *meanings << TEXT;
 						CHARACTERS
 						DONE
 						ENDTAG
@@ -118,8 +120,8 @@ bool Kanjidic2Parser::parse(QXmlStreamReader &reader)
 						QString skip_misclass(ATTR("skip_misclass"));
 					TAG_BEGIN(q_code)
 					CHARACTERS
-						if (qc_type == "skip" && skip_misclass.isEmpty()) kanji.skip = TEXT;
-						else if (qc_type == "four_corner") kanji.fourCorner = TEXT;
+						if (qc_type == QLatin1String("skip") && skip_misclass.isEmpty()) kanji.skip = TEXT;
+						else if (qc_type == QLatin1String("four_corner")) kanji.fourCorner = TEXT;
 					DONE
 					ENDTAG
 				ENDTAG
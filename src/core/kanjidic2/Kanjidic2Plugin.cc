@@ -28,6 +28,8 @@
 #include <QtDebug>
 #include <QFile>
 #include <QDir>
+#include <QThread>
+#include <QCoreApplication>
 
 #define dictFileConfigString "kanjidic/database"
 #define dictFileConfigDefault "kanjidic2.db"
@@ -72,11 +74,12 @@ bool Kanjidic2Plugin::attachAllDatabases()
 
 	_attachedDBs[""] = dbFile;
 
-	// Then look for language databases
+	// Then look for language databases. They are only attached once a
+	// search needs them, see attachLanguageDatabases()
+	_languagesAttached = false;
 	foreach (const QString &lang, Lang::preferredDictLanguages()) {
 		dbFile = lookForFile(QString("kanjidic2-%1.db").arg(lang));
 		if (dbFile.isEmpty()) continue;
-		if (!Database::attachDictionaryDB(dbFile, QString("kanjidic2_%1").arg(lang), KANJIDIC2DB_REVISION)) continue;
 		_attachedDBs[lang] = dbFile;
 	}
 	if (_attachedDBs.size() == 1) {
@@ -87,10 +90,37 @@ bool Kanjidic2Plugin::attachAllDatabases()
 	return true;
 }
 
+bool Kanjidic2Plugin::attachLanguageDatabases()
+{
+	if (_languagesAttached) return true;
+	if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+		qWarning("kanjidic2 plugin warning: language databases can only be attached from the GUI thread");
+		return false;
+	}
+	_languagesAttached = true;
+	foreach (const QString &lang, _attachedDBs.keys()) {
+		if (lang.isEmpty()) continue;
+		if (!Database::attachDictionaryDB(_attachedDBs[lang], QString("kanjidic2_%1").arg(lang), KANJIDIC2DB_REVISION)) {
+			qWarning("kanjidic2 plugin warning: cannot attach database for language %s", lang.toUtf8().constData());
+			_attachedDBs.remove(lang);
+		}
+	}
+	return true;
+}
+
+QStringList Kanjidic2Plugin::searchedLanguages() const
+{
+	QStringList ret;
+	foreach (const QString &lang, Lang::preferredDictLanguages())
+		if (_attachedDBs.contains(lang)) ret << lang;
+	return ret;
+}
+
 void Kanjidic2Plugin::detachAllDatabases()
 {
 	QString dbAlias;
 	foreach (const QString &lang, _attachedDBs.keys()) {
+		if (!lang.isEmpty() && !_languagesAttached) continue;
 		dbAlias = lang.isEmpty() ? "kanjidic2" : "kanjidic2_" + lang;
 		if (!Database::detachDictionaryDB(dbAlias))
 			qWarning("kanjidic2 plugin warning: Cannot detach database %s", dbAlias.toUtf8().constData());
@@ -117,8 +147,7 @@ bool Kanjidic2Plugin::onRegister()
 	EntrySearcherManager::instance().addInstance(searcher);
 
 	// Register our entry loader
-	loader = new Kanjidic2EntryLoader();
-	if (!EntriesCache::instance().addLoader(KANJIDIC2ENTRY_GLOBALID, loader)) return false;
+	if (!EntriesCache::instance().addLoader(KANJIDIC2ENTRY_GLOBALID, &createEntryLoader<Kanjidic2EntryLoader>)) return false;
 
 	return true;
 }
@@ -127,7 +156,6 @@ bool Kanjidic2Plugin::onUnregister()
 {
 	// Remove the entry loader
 	EntriesCache::instance().removeLoader(KANJIDIC2ENTRY_GLOBALID);
-	delete loader;
 
 	// Unregister the entry searcher
 	EntrySearcherManager::instance().removeInstance(searcher);
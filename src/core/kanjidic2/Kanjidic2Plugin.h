@@ -31,10 +31,12 @@ private:
 	QString _dbFile;
 	QString _kanjidic2Version;
 	QString _kanjiVGVersion;
+	/// Database files, by language. The main database has no language.
 	QMap<QString, QString> _attachedDBs;
+	/// Whether the language databases are attached to the shared connections
+	bool _languagesAttached;
 
 	Kanjidic2EntrySearcher *searcher;
-	Kanjidic2EntryLoader *loader;
 
 	bool attachAllDatabases();
 	void detachAllDatabases();
@@ -46,7 +48,25 @@ public:
 	const QString &kanjidic2Version() const { return _kanjidic2Version; }
 	const QString &kanjiVGVersion() const { return _kanjiVGVersion; }
 	virtual QString pluginInfo() const;
+	/**
+	 * Returns the database files of the plugin, by language. Loaders attach
+	 * them to their own connection; the language databases are only attached
+	 * to the shared connections after attachLanguageDatabases().
+	 */
 	const QMap<QString, QString> &attachedDBs() const { return _attachedDBs; }
+	/**
+	 * Attaches the language databases to the shared connections, if not
+	 * done yet. Must be called from the GUI thread before building a
+	 * query that uses their tables. Returns false if they are not attached.
+	 */
+	bool attachLanguageDatabases();
+	/**
+	 * Languages of the attached databases whose meanings are displayed, in
+	 * order of preference. Searches only look for meanings in these, since
+	 * the preferred languages may have changed since the databases were
+	 * looked for.
+	 */
+	QStringList searchedLanguages() const;
 	
 	virtual bool onRegister();
 	virtual bool onUnregister();
@@ -17,14 +17,18 @@
 
 #include "sqlite/Connection.h"
 #include "sqlite/Query.h"
+#include "sqlite/SQLite.h"
 #include "core/Database.h"
 #include "core/TextTools.h"
+#include "core/BuilderStatistics.h"
 #include "core/tatoeba/TatoebaEntry.h"
 
 #include <QString>
 #include <QRegExp>
 #include <QFile>
-#include <QHash>
+#include <QSet>
+#include <QDir>
+#include <QElapsedTimer>
 
 #include <QtDebug>
 
@@ -33,6 +37,8 @@ static SQLite::Connection jmdictConnection;
 // Queries that insert a sentence into the right database
 static QMap<QString, SQLite::Query> insertSentenceQuery;
 static SQLite::Query insertWordToSentenceQuery;
+static SQLite::Query insertLinkQuery;
+static SQLite::Query linkedSentencesQuery;
 
 static SQLite::Query jmdictLookupWRQuery;
 static SQLite::Query jmdictLookupWQuery;
@@ -52,30 +58,35 @@ static QMap<QString, QString> languagesCodes;
 // Sentence id
 typedef unsigned int sid;
 
-// A sentence and the language it is written in
-typedef QMap<QString, QString> LangSentence;
-// All the sentences we need to record
-// The Japanese sentence id is used as a reference here.
-static QHash<sid, LangSentence > sentencesToRecord;
-
-// Links foreign sentences to their japanese translation id.
-static QHash<sid, sid> links;
+// Japanese sentences that contain at least one known word. Only their ids
+// are kept in memory, the links and sentences are streamed to the databases.
+static QSet<sid> japaneseSentences;
 
 #define TATOEBA_DB_DEBUG
 
+static void phaseDone(QElapsedTimer &timer, const char *phase)
+{
+	qDebug("%s done in %lld ms", phase, timer.restart());
+}
+
 static bool createTables(SQLite::Connection &connection, const QString &lang)
 {
 	SQLite::Query query(&connection);
 	EXEC_STMT(query, "create table info(version INT)");
 	EXEC_STMT(query, QString("insert into info values(%1)").arg(TATOEBADB_REVISION));
-	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, sentence BLOB)");
-	if (lang == "jpn") EXEC_STMT(query, "create table words(jmdictId INTEGER, sentenceId INTEGER SECONDARY KEY REFERENCES sentences, position tinyInt)");
+	EXEC_STMT(query, "create table entries(id INTEGER PRIMARY KEY, sentence TEXT)");
+	if (lang == "jpn") {
+		// Inverted index of the sentences using a JMdict entry, so
+		// that they can be listed with a single index lookup
+		EXEC_STMT(query, "create table words(jmdictId INTEGER, sentenceId INTEGER, position TINYINT, PRIMARY KEY(jmdictId, sentenceId, position)) WITHOUT ROWID");
+		// Translations of the Japanese sentences, used while linking
+		EXEC_STMT(query, "create temp table links(fid INTEGER, jid INTEGER, PRIMARY KEY(fid, jid)) WITHOUT ROWID");
+	}
 	return true;
 }
 
-// Parse the indices file and extract japanese sentences for which we have a matching word.
-// The sentence id is recorded into sentencesToRecord, with an empty list of sentences to be
-// filled by parse_links and parse_sentences
+// First pass: parse the indices file and extract japanese sentences for which we have a matching word.
+// The word to sentence associations are written to the database right away.
 static bool parseIndices(const QString &sfile)
 {
 	QRegExp lineRegExp("(\\d+)\t(-?\\d+)\t(.*)\n");
@@ -127,26 +138,25 @@ static bool parseIndices(const QString &sfile)
 			}
 
 			SQLite::Query &jmdictLookupQuery = reading.isEmpty() ? jmdictLookupWQuery : writing.isEmpty() ? jmdictLookupRQuery : jmdictLookupWRQuery;
-			if (!writing.isEmpty()) jmdictLookupQuery.bindValue(writing);
-			if (!reading.isEmpty()) jmdictLookupQuery.bindValue(reading);
+			if (!writing.isEmpty()) BIND(jmdictLookupQuery, writing);
+			if (!reading.isEmpty()) BIND(jmdictLookupQuery, reading);
 
-			jmdictLookupQuery.exec();
+			EXEC(jmdictLookupQuery);
 			// Word not found in DB, never mind...
 			if (!jmdictLookupQuery.next()) {
 				//qDebug("Cannot find word %s in database", writing.toUtf8().data());
+				jmdictLookupQuery.reset();
 				continue;
 			}
 
-			// We must record that sentence in the DB, just store an empty index for now
-			sentencesToRecord.insert(jid, LangSentence());
-			// Link the sentence to itself
-			links[jid] = jid;
+			// We must record that sentence in the DB
+			japaneseSentences << jid;
 
 			// Insert the association between word and sentence
-			insertWordToSentenceQuery.bindValue(jmdictLookupQuery.valueUInt(0));
-			insertWordToSentenceQuery.bindValue(jid);
-			insertWordToSentenceQuery.bindValue(wordPos);
-			insertWordToSentenceQuery.exec();
+			BIND(insertWordToSentenceQuery, jmdictLookupQuery.valueUInt(0));
+			BIND(insertWordToSentenceQuery, jid);
+			BIND(insertWordToSentenceQuery, wordPos);
+			EXEC(insertWordToSentenceQuery);
 
 			jmdictLookupQuery.reset();
 		}
@@ -155,6 +165,7 @@ static bool parseIndices(const QString &sfile)
 	return true;
 }
 
+// Still in the first pass, record the translations of the sentences we keep.
 static bool parseLinks(const QString &sfile)
 {
 	QRegExp lineRegExp("(\\d+)\t(\\d+)\n");
@@ -165,13 +176,18 @@ static bool parseLinks(const QString &sfile)
 		if (line.isEmpty()) break;
 		if (!lineRegExp.exactMatch(line)) continue;
 		sid jid = lineRegExp.cap(2).toInt();
-		if (!sentencesToRecord.contains(jid)) continue;
+		if (!japaneseSentences.contains(jid)) continue;
 		sid fid = lineRegExp.cap(1).toInt();
-		links[fid] = jid;
+		BIND(insertLinkQuery, fid);
+		BIND(insertLinkQuery, jid);
+		EXEC(insertLinkQuery);
 	}
 	return true;
 }
 
+// Second pass: stream the sentences and write those we need as they come.
+// Sentences are listed by id, so the oldest translation of a sentence is
+// the one kept.
 static bool parseSentences(const QString &sfile)
 {
 	QRegExp lineRegExp("(\\d+)\t(...)\t(.*)\n");
@@ -181,36 +197,59 @@ static bool parseSentences(const QString &sfile)
 		QString line = QString::fromUtf8(f.readLine());
 		if (line.isEmpty()) break;
 		if (!lineRegExp.exactMatch(line)) continue;
-		sid fid = lineRegExp.cap(1).toInt();
-		if (!links.contains(fid)) continue;
 		QString lang(lineRegExp.cap(2));
 		if (!languages.contains(lang)) continue;
-		sid jid = links[fid];
+		sid fid = lineRegExp.cap(1).toInt();
 		QString sentence(lineRegExp.cap(3));
-		if (!sentencesToRecord[jid].contains(lang))
-			sentencesToRecord[jid].insert(lang, sentence);
+		SQLite::Query &q = insertSentenceQuery[lang];
+		if (lang == "jpn") {
+			if (!japaneseSentences.contains(fid)) continue;
+			BIND(q, fid);
+			BIND(q, sentence);
+			EXEC(q);
+			continue;
+		}
+		BIND(linkedSentencesQuery, fid);
+		EXEC(linkedSentencesQuery);
+		while (linkedSentencesQuery.next()) {
+			BIND(q, linkedSentencesQuery.valueUInt(0));
+			BIND(q, sentence);
+			EXEC(q);
+		}
+		linkedSentencesQuery.reset();
 	}
 	return true;
 }
 
-static bool recordSentences()
+static void printUsage(char *argv[])
 {
-	foreach (sid id, sentencesToRecord.keys()) {
-		const LangSentence &sentences = sentencesToRecord[id];
-		foreach (const QString &lang, sentences.keys()) {
-			SQLite::Query &q = insertSentenceQuery[lang];
-			ASSERT(q.bindValue(id));
-			ASSERT(q.bindValue(sentences[lang]));
-			ASSERT(q.exec());
-		}
-	}
-
-	return true;
+	qCritical("Usage: %s [-l<lang>] source_dir dest_dir\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)\njmdict.db is looked for in dest_dir\n--stats prints statistics about the databases of dest_dir instead of building them. It exits with status 2 if some values are over their threshold\n-t<name>=<max>,... sets the thresholds of --stats", argv[0]);
 }
 
-static void printUsage(char *argv[])
+/**
+ * Prints the distributions of the sentences and words of the databases of
+ * dstDir. Returns 2 if some values are over their threshold.
+ */
+static int printStatistics(const QString &dstDir, const QString &thresholds)
 {
-	qCritical("Usage: %s [-l<lang>] source_dir dest_file\nWhere <lang> is a two-letters language code (en, fr, de, es or ru)", argv[0]);
+	BuilderStatistics stats;
+	if (!stats.setThresholds(thresholds)) return 1;
+	bool ok = true;
+	foreach (const QString &lang, languages) {
+		SQLite::Connection connection;
+		QString dbFile(lang == "jpn" ? QString("tatoeba.db") : QString("tatoeba-%1.db").arg(languagesCodes[lang]));
+		if (!connection.connect(QDir(dstDir).absoluteFilePath(dbFile), SQLite::Connection::ReadOnly)) {
+			qCritical("Cannot open database: %s", connection.lastError().message().toLatin1().data());
+			return 1;
+		}
+		QString prefix(languagesCodes[lang] + " ");
+		ok = stats.distribution(connection, prefix + "sentence bytes", "select id, length(cast(sentence as blob)) from entries", 1024);
+		if (ok && lang == "jpn") ok = stats.distribution(connection, "words per sentence", "select sentenceId, count(*) from words group by sentenceId", 100)
+			&& stats.distribution(connection, "sentences per word", "select jmdictId, count(*) from words group by jmdictId", 50000);
+		connection.close();
+		if (!ok) return 1;
+	}
+	return stats.outliers() > 0 ? 2 : 0;
 }
 
 int main(int argc, char *argv[])
@@ -223,12 +262,17 @@ int main(int argc, char *argv[])
 	languagesCodes["rus"] = "ru";
 
 	QCoreApplication app(argc, argv);
+	sqlite3ext_init();
 	
 	if (argc < 3) { printUsage(argv); return 1; }
 
+	bool stats = false;
+	QString thresholds;
 	int argCpt = 1;
 	while (argCpt < argc && argv[argCpt][0] == '-') {
 		QString param(argv[argCpt]);
+		if (param == "--stats") { stats = true; ++argCpt; continue; }
+		if (param.startsWith("-t")) { thresholds = param.mid(2); ++argCpt; continue; }
 		if (!param.startsWith("-l")) { printUsage(argv); return 1; }
 		QStringList langs(param.mid(2).split(',', QString::SkipEmptyParts));
 		QStringList allowedLangs(languagesCodes.values());
@@ -247,6 +291,7 @@ int main(int argc, char *argv[])
 	QString dstDir(argv[argCpt + 1]);
 	
 	languages << "jpn";
+	if (stats) return printStatistics(dstDir, thresholds);
 	// Create databases and prepare queries for every language
 	foreach (const QString &lang, languages) {
 		QString dbFile = QDir(dstDir).absoluteFilePath(lang == "jpn" ? QString("tatoeba.db") : QString("tatoeba-%1.db").arg(languagesCodes[lang]));
@@ -256,51 +301,72 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 		SQLite::Connection &curConnection = connection[lang];
-		if (!curConnection.connect(dbFile, SQLite::Connection::JournalInFile)) {
+		if (!curConnection.connect(dbFile, SQLite::Connection::BulkLoad)) {
 			qFatal("Cannot open database: %s", curConnection.lastError().message().toLatin1().data());
 			return 1;
 		}
+		// The links table can be large, keep it on disk
+		if (lang == "jpn") ASSERT(curConnection.exec("pragma temp_store = FILE"));
 		ASSERT(curConnection.transaction());
 		ASSERT(createTables(curConnection, lang));
-		// Prepare the queries
-		#define PREPQUERY(query, text) query.useWith(&curConnection); query.prepare(text)
-		PREPQUERY(insertSentenceQuery[lang], "insert into entries values(?, ?)");
-		if (lang == "jpn") PREPQUERY(insertWordToSentenceQuery, "insert into words values(?, ?, ?)");
+		// Prepare the queries. Several translations of the same
+		// sentence may come, the first one is kept
+		#define PREPQUERY(query, text) query.useWith(&curConnection); ASSERT(query.prepare(text))
+		PREPQUERY(insertSentenceQuery[lang], "insert or ignore into entries values(?, ?)");
+		if (lang == "jpn") {
+			PREPQUERY(insertWordToSentenceQuery, "insert or ignore into words values(?, ?, ?)");
+			PREPQUERY(insertLinkQuery, "insert or ignore into temp.links values(?, ?)");
+			PREPQUERY(linkedSentencesQuery, "select jid from temp.links where fid = ?");
+		}
 		#undef PREPQUERY
 	}
 			
-	// Connection to the JMdict database
-	if (!jmdictConnection.connect(QDir(srcDir).absoluteFilePath("jmdict.db"))) {
+	// Connection to the JMdict database, built in the same directory
+	if (!jmdictConnection.connect(QDir(dstDir).absoluteFilePath("jmdict.db"), SQLite::Connection::ReadOnly)) {
 		qFatal("Cannot connect to JMdict database: %s", jmdictConnection.lastError().message().toLatin1().data());
 		return 1;
 	}
 	
 
-	#define PREPQUERY(query, text) query.useWith(&jmdictConnection); query.prepare(text)
-	PREPQUERY(jmdictLookupWRQuery, "select entries.id from entries join kanji on kanji.id = entries.id join kanjiText on kanjiText.docid == kanji.docid join kana on kana.id == entries.id join kanaText on kanaText.docid == kana.docid where kanjiText.reading match ? and kanaText.reading match ?");
-	PREPQUERY(jmdictLookupWQuery, "select entries.id from entries join kanji on kanji.id = entries.id join kanjiText on kanjiText.docid == kanji.docid where kanjiText.reading match ?");
-	PREPQUERY(jmdictLookupRQuery, "select entries.id from entries join kana on kana.id == entries.id join kanaText on kanaText.docid == kana.docid where kanaText.reading match ?");
+	#define PREPQUERY(query, text) query.useWith(&jmdictConnection); ASSERT(query.prepare(text))
+	PREPQUERY(jmdictLookupWRQuery, "select entries.id from entries join kanji on kanji.id = entries.id join kanjiText on kanjiText.rowid == kanji.docid join kana on kana.id == entries.id join kanaText on kanaText.rowid == kana.docid where kanjiText.reading match ? and kanaText.reading match ?");
+	PREPQUERY(jmdictLookupWQuery, "select entries.id from entries join kanji on kanji.id = entries.id join kanjiText on kanjiText.rowid == kanji.docid where kanjiText.reading match ?");
+	PREPQUERY(jmdictLookupRQuery, "select entries.id from entries join kana on kana.id == entries.id join kanaText on kanaText.rowid == kana.docid where kanaText.reading match ?");
 	#undef PREPQUERY
 
 	// Parse the files
+	QElapsedTimer timer;
+	timer.start();
 	ASSERT(parseIndices(QDir(srcDir).absoluteFilePath("3rdparty/tatoeba/jpn_indices.csv")));
+	jmdictLookupWRQuery.clear();
+	jmdictLookupWQuery.clear();
+	jmdictLookupRQuery.clear();
+	ASSERT(jmdictConnection.close());
+	phaseDone(timer, "Indices");
 	ASSERT(parseLinks(QDir(srcDir).absoluteFilePath("3rdparty/tatoeba/links.csv")));
+	phaseDone(timer, "Links");
 	ASSERT(parseSentences(QDir(srcDir).absoluteFilePath("3rdparty/tatoeba/sentences.csv")));
-	ASSERT(recordSentences());
+	phaseDone(timer, "Sentences");
 	
 	foreach (const QString &lang, languages) {
 		SQLite::Connection &curConnection = connection[lang];
+		// Clear queries
+		insertSentenceQuery[lang].clear();
+		if (lang == "jpn") {
+			insertWordToSentenceQuery.clear();
+			insertLinkQuery.clear();
+			linkedSentencesQuery.clear();
+			ASSERT(curConnection.exec("drop table temp.links"));
+		}
 		// Analyze for hopefully better performance
 		curConnection.exec("analyze");
 		// Commit everything
 		ASSERT(curConnection.commit());
-		// Clear queries, close the database and set the file to read-only
-		insertSentenceQuery[lang].clear();
-		if (lang == "jpn") insertWordToSentenceQuery.clear();
+		// Close the database and set the file to read-only
 		QFile(curConnection.dbFileName()).setPermissions(QFile::ReadOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther);
 		ASSERT(curConnection.close());
 	}
+	phaseDone(timer, "Finalizing");
 
 	return 0;
 }
-
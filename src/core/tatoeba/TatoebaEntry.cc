@@ -20,3 +20,26 @@
 TatoebaEntry::TatoebaEntry(int id) : Entry(TATOEBAENTRY_GLOBALID, id)
 {
 }
+
+QStringList TatoebaEntry::writings() const
+{
+	return QStringList(_sentence);
+}
+
+QStringList TatoebaEntry::readings() const
+{
+	return QStringList();
+}
+
+QStringList TatoebaEntry::meanings() const
+{
+	return _translations.values();
+}
+
+int TatoebaEntry::memoryFootprint() const
+{
+	int ret = Entry::memoryFootprint() + sizeof(TatoebaEntry) - sizeof(Entry) + footprint(_sentence);
+	foreach (const QString &lang, _translations.keys())
+		ret += 16 + footprint(lang) + footprint(_translations[lang]);
+	return ret;
+}
@@ -20,17 +20,35 @@
 
 #include "core/EntriesCache.h"
 
+#include <QMap>
+#include <QCoreApplication>
+
 #define TATOEBAENTRY_GLOBALID 3
-#define TATOEBADB_REVISION 1
+#define TATOEBADB_REVISION 2
 
+/**
+ * A Japanese example sentence and its translations.
+ */
 class TatoebaEntry : public Entry
 {
-	Q_OBJECT
+	Q_DECLARE_TR_FUNCTIONS(TatoebaEntry)
+private:
+	QString _sentence;
+	/// Translations of the sentence, indexed by language
+	QMap<QString, QString> _translations;
 
 public:
 	TatoebaEntry(int id);
 
-	friend class TatoebaEntrySearcher;
+	const QString &sentence() const { return _sentence; }
+	const QMap<QString, QString> &translations() const { return _translations; }
+
+	virtual QStringList writings() const;
+	virtual QStringList readings() const;
+	virtual QStringList meanings() const;
+	virtual int memoryFootprint() const;
+
+	friend class TatoebaEntryLoader;
 };
 
 typedef QSharedPointer<TatoebaEntry> TatoebaEntryPointer;
@@ -16,11 +16,30 @@
  */
 
 #include "core/tatoeba/TatoebaEntryLoader.h"
-#include "core/jmdict/JMdictPlugin.h"
+#include "core/tatoeba/TatoebaPlugin.h"
+#include "core/Lang.h"
+#include "core/Database.h"
+#include "core/EntrySummary.h"
 
-TatoebaEntryLoader::TatoebaEntryLoader() : EntryLoader(), sentencesQuery(&connection)
+#include <QHash>
+
+TatoebaEntryLoader::TatoebaEntryLoader() : EntryLoader(), sentenceQuery(&connection)
 {
-	// Prepare queries
+	const QMap<QString, QString> &allDBs = TatoebaPlugin::instance()->attachedDBs();
+	QMap<QString, QString> aliases;
+	foreach (const QString &lang, allDBs.keys()) aliases[lang.isEmpty() ? "tatoeba" : "tatoeba_" + lang] = allDBs[lang];
+	if (!Database::openDictionaryConnection(connection, aliases)) {
+		qFatal("TatoebaEntryLoader cannot attach Tatoeba databases!");
+	}
+
+	// Prepare queries so that we just have to bind and execute them
+	sentenceQuery.prepare("select sentence from tatoeba.entries where id = ?");
+	foreach (const QString &lang, allDBs.keys()) {
+		if (lang.isEmpty()) continue;
+		SQLite::Query &query = translationQueries[lang];
+		query.useWith(&connection);
+		query.prepare(QString("select sentence from tatoeba_%1.entries where id = ?").arg(lang));
+	}
 }
 
 TatoebaEntryLoader::~TatoebaEntryLoader()
@@ -29,5 +48,71 @@ TatoebaEntryLoader::~TatoebaEntryLoader()
 
 Entry *TatoebaEntryLoader::loadEntry(EntryId id)
 {
-	return 0;
+	TatoebaEntry *entry = new TatoebaEntry(id);
+
+	loadMiscData(entry);
+
+	sentenceQuery.bindValue(entry->id());
+	sentenceQuery.exec();
+	if (!sentenceQuery.next()) {
+		sentenceQuery.reset();
+		return entry;
+	}
+	entry->_sentence = sentenceQuery.valueString(0);
+	sentenceQuery.reset();
+
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
+		if (!translationQueries.contains(lang)) continue;
+		SQLite::Query &query = translationQueries[lang];
+		query.bindValue(entry->id());
+		query.exec();
+		if (query.next()) entry->_translations[lang] = query.valueString(0);
+		query.reset();
+	}
+	return entry;
+}
+
+QVector<TatoebaEntry *> TatoebaEntryLoader::loadSentences(const QVector<EntryId> &ids)
+{
+	QVector<TatoebaEntry *> ret;
+	QHash<EntryId, TatoebaEntry *> byId;
+	ret.reserve(ids.size());
+	foreach (EntryId id, ids) {
+		TatoebaEntry *entry = new TatoebaEntry(id);
+		ret << entry;
+		byId[id] = entry;
+	}
+	if (ids.isEmpty()) return ret;
+
+	SQLite::Query query(&connection);
+	QString in(idList(ids));
+	query.exec(QString("select id, sentence from tatoeba.entries where id in (%1)").arg(in));
+	while (query.next()) byId[query.valueUInt(0)]->_sentence = query.valueString(1);
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
+		if (!translationQueries.contains(lang)) continue;
+		query.exec(QString("select id, sentence from tatoeba_%1.entries where id in (%2)").arg(lang).arg(in));
+		while (query.next()) byId[query.valueUInt(0)]->_translations[lang] = query.valueString(1);
+	}
+	return ret;
+}
+
+QVector<Entry *> TatoebaEntryLoader::loadEntries(const QVector<EntryId> &ids)
+{
+	QVector<Entry *> ret;
+	ret.reserve(ids.size());
+	foreach (TatoebaEntry *entry, loadSentences(ids)) ret << entry;
+	loadMiscData(ret);
+	return ret;
+}
+
+QVector<EntrySummary> TatoebaEntryLoader::loadSummaries(const QVector<EntryId> &ids)
+{
+	QVector<EntrySummary> ret;
+	ret.reserve(ids.size());
+	foreach (TatoebaEntry *entry, loadSentences(ids)) {
+		ret << EntrySummary(*entry);
+		delete entry;
+	}
+	loadMiscData(ret);
+	return ret;
 }
@@ -21,17 +21,27 @@
 #include "core/EntryLoader.h"
 #include "core/tatoeba/TatoebaEntry.h"
 
+#include <QMap>
+
 class TatoebaEntryLoader : public EntryLoader
 {
-private:
-
 protected:
-	SQLite::Query sentencesQuery;
+	SQLite::Query sentenceQuery;
+	QMap<QString, SQLite::Query> translationQueries;
+
+	/// Loads the sentences and translations of ids, running each query
+	/// only once
+	QVector<TatoebaEntry *> loadSentences(const QVector<EntryId> &ids);
+
 public:
 	TatoebaEntryLoader();
 	virtual ~TatoebaEntryLoader();
 
 	virtual Entry *loadEntry(EntryId id);
+	virtual QVector<Entry *> loadEntries(const QVector<EntryId> &ids);
+	/// Summaries hold all the text of a sentence, so they are built by
+	/// loading the sentences without their user data
+	virtual QVector<EntrySummary> loadSummaries(const QVector<EntryId> &ids);
 };
 
 #endif
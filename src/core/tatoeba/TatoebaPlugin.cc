@@ -37,30 +37,31 @@ TatoebaPlugin::~TatoebaPlugin()
 
 bool TatoebaPlugin::onRegister()
 {
-	// Look for and attach our database files
+	// Look for and attach our database files. Example sentences are
+	// optional, so a missing database only disables the plugin.
 	QString dbFile(lookForFile("tatoeba.db"));
 	if (dbFile.isEmpty()) {
-		qFatal("Tatoeba plugin fatal error: cannot find main database file!");
+		qWarning("Tatoeba plugin: cannot find main database file, example sentences disabled");
 		return false;
 	}
 	if (!Database::attachDictionaryDB(dbFile, "tatoeba", TATOEBADB_REVISION)) {
-		qFatal("Tatoeba plugin fatal error: failed to attach main database %s!", dbFile.toLatin1().constData());
+		qWarning("Tatoeba plugin: failed to attach main database %s!", dbFile.toLatin1().constData());
 		return false;
 	}
-	foreach (const QString &lang, supportedLanguages()) {
+	_attachedDBs[""] = dbFile;
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
 		dbFile = lookForFile(QString("tatoeba-%1.db").arg(lang));
 		if (!dbFile.isEmpty()) {
 			if (!Database::attachDictionaryDB(dbFile, "tatoeba_" + lang, TATOEBADB_REVISION)) {
-				qWarning("Tatoeba plugin fatal error: failed to attach database %s!", dbFile.toLatin1().constData());
+				qWarning("Tatoeba plugin: failed to attach database %s!", dbFile.toLatin1().constData());
 				continue;
 			}
-			_dbLanguages << lang;
+			_attachedDBs[lang] = dbFile;
 		}
 	}
 
 	// Instanciate and register entry loader
-	loader = new TatoebaEntryLoader();
-	if (!EntriesCache::instance().addLoader(TATOEBAENTRY_GLOBALID, loader)) return false;
+	if (!EntriesCache::instance().addLoader(TATOEBAENTRY_GLOBALID, &createEntryLoader<TatoebaEntryLoader>)) return false;
 
 	return true;
 }
@@ -71,10 +72,10 @@ bool TatoebaPlugin::onUnregister()
 	EntriesCache::instance().removeLoader(TATOEBAENTRY_GLOBALID);
 
 	// Remove database files
-	foreach (const QString &lang, _dbLanguages) {
-		Database::detachDictionaryDB(QString("tatoeba_%1").arg(lang));
+	foreach (const QString &lang, _attachedDBs.keys()) {
+		Database::detachDictionaryDB(lang.isEmpty() ? QString("tatoeba") : QString("tatoeba_%1").arg(lang));
 	}
-	Database::detachDictionaryDB("tatoeba");
+	_attachedDBs.clear();
 
 	return true;
 }
@@ -21,17 +21,14 @@
 #include "core/Plugin.h"
 
 #include <QString>
-#include <QStringList>
-
-class TatoebaEntryLoader;
+#include <QMap>
 
 class TatoebaPlugin : public Plugin
 {
 private:
 	static TatoebaPlugin *_instance;
-	QStringList _dbLanguages;
-
-	TatoebaEntryLoader *loader;
+	/// Attached database files, indexed by language ("" for the main one)
+	QMap<QString, QString> _attachedDBs;
 
 public:
 	static TatoebaPlugin *instance() { return _instance; }
@@ -42,6 +39,8 @@ public:
 	virtual bool onRegister();
 	virtual bool onUnregister();
 	virtual QString pluginInfo() const;
+
+	const QMap<QString, QString> &attachedDBs() const { return _attachedDBs; }
 };
 
 #endif
@@ -19,7 +19,6 @@
 #include "gui/BatchHandler.h"
 
 #include <QProgressDialog>
-#include <QMessageBox>
 
 void BatchHandler::applyOnEntries(const BatchHandler &handler, const QList<EntryPointer> &entries, QWidget *parent)
 {
@@ -29,26 +28,20 @@ void BatchHandler::applyOnEntries(const BatchHandler &handler, const QList<Entry
 	progressDialog.setWindowModality(Qt::WindowModal);
 
 	int i = 0;
-	if (!Database::connection()->transaction()) {
-		QMessageBox::warning(0, tr("Cannot start transaction"), QString(tr("Error while trying to start database transaction.")));
-		return;
-	}
-	bool completed = true;
+	// Changes are recorded by the entries into the journal of the database
+	// writer, which writes the whole batch in a single transaction once
+	// done. Entries that have been processed before the batch is aborted
+	// keep their changes, in memory and in the database. Views are only
+	// notified once all the entries have been processed.
+	DatabaseWriter::beginBatch();
+	EntryChanges::begin();
 	foreach (const EntryPointer &entry, entries) {
-		if (progressDialog.wasCanceled()) {
-			completed = false;
-			break;
-		}
+		if (progressDialog.wasCanceled()) break;
 		progressDialog.setValue(i++);
 		if (!entry) continue;
 		handler.apply(entry);
 	}
-	if (!completed) {
-		Database::connection()->rollback();
-	}
-	else if (!Database::connection()->commit()) {
-		Database::connection()->rollback();
-		QMessageBox::warning(0, tr("Cannot commit transaction"), QString(tr("Error while trying to commit database transaction.")));
-		return;
-	}
+	EntryChanges::end();
+	DatabaseWriter::endBatch();
+	DatabaseWriter::flush();
 }
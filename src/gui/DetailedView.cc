@@ -18,11 +18,14 @@
 #include "tagaini_config.h"
 #include "core/TextTools.h"
 #include "core/Database.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
 #include "gui/EntryFormatter.h"
 #include "gui/TemplateFiller.h"
 #include "gui/DetailedView.h"
 // TODO Would be nice to get rid of this one...
 #include "gui/MainWindow.h"
+#include "gui/EntriesMimeData.h"
 // TODO and this one too
 #include "gui/TagsFilterWidget.h"
 // TODO and this one too!
@@ -45,6 +48,10 @@
 #include <QDrag>
 #include <QUrl>
 #include <QUrlQuery>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutexLocker>
 
 DetailedViewFonts *DetailedViewFonts::_instance = 0;
 PreferenceItem<QString> DetailedViewFonts::textFont("mainWindow/detailedView", "textFont", "");
@@ -60,6 +67,9 @@ TagsLinkHandler DetailedView::_tagsLinkHandler;
 ListLinkHandler DetailedView::_listLinkHandler;
 QSet<QObject *> DetailedView::_eventFilters;
 QSet<DetailedView *> DetailedView::_instances;
+/// Cost of the cached contents, in kilobytes of HTML
+#define DETAILED_VIEW_CONTENTS_CACHE_SIZE 4096
+QCache<QString, DetailedViewContent> DetailedView::_contents(DETAILED_VIEW_CONTENTS_CACHE_SIZE);
 
 void DetailedView::registerEventFilter(QObject *obj)
 {
@@ -73,7 +83,7 @@ void DetailedView::removeEventFilter(QObject *obj)
 	_eventFilters.remove(obj);
 }
 
-DetailedView::DetailedView(QWidget *parent) : QTextBrowser(parent), _kanjiClickable(true), _historyEnabled(true), _dragEntryRef(0, 0), _dragStarted(false), _history(historySize.value()), _entryView(0), _jobsRunner(this)
+DetailedView::DetailedView(QWidget *parent) : QTextBrowser(parent), _kanjiClickable(true), _historyEnabled(true), _dragEntryRef(0, 0), _dragStarted(false), _resourcesBytes(0), _history(historySize.value()), _entryView(0), _jobsRunner(this)
 {
 	// Add the default handlers if not already done (first instanciation)
 	if (!DetailedViewLinkManager::getHandler(_entryHandler.scheme())) DetailedViewLinkManager::registerHandler(&_entryHandler);
@@ -82,6 +92,7 @@ DetailedView::DetailedView(QWidget *parent) : QTextBrowser(parent), _kanjiClicka
 	// Is the fonts manager instance already running?
 	if (!DetailedViewFonts::_instance) DetailedViewFonts::_instance = new DetailedViewFonts();
 	connect(DetailedViewFonts::_instance, SIGNAL(fontsHaveChanged()), this, SLOT(redisplay()));
+	connect(&EntryChanges::instance(), SIGNAL(entryChanged(Entry *)), this, SLOT(onEntryChanged(Entry *)));
 
 	// Add the registered event filters
 	foreach (QObject *obj, _eventFilters) viewport()->installEventFilter(obj);
@@ -96,7 +107,8 @@ DetailedView::DetailedView(QWidget *parent) : QTextBrowser(parent), _kanjiClicka
 	setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
 	setOpenLinks(false);
 	setMouseTracking(true);
-	connect(&_entryView, SIGNAL(entryChanged(Entry*)), this, SLOT(redisplay()));
+	connect(&_entryView, SIGNAL(entryChanged(Entry*)), this, SLOT(refresh()));
+	connect(&_generator, SIGNAL(generated(DetailedViewContent)), this, SLOT(onContentGenerated(DetailedViewContent)));
 
 	_historyPrevAction = new QAction(QIcon(":/images/icons/go-previous.png"), tr("Previous entry"), this);
 	_historyPrevAction->setShortcuts(QKeySequence::Back);
@@ -122,55 +134,106 @@ DetailedView::~DetailedView()
 
 void DetailedView::_display(const EntryPointer &entry, bool update)
 {
-	clear();
-	_entryView.setEntry(entry);
 	if (_historyEnabled) {
 		_historyPrevAction->setEnabled(_history.hasPrevious());
 		_historyNextAction->setEnabled(_history.hasNext());
 	}
 	const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
-	TemplateFiller filler;
-	
-	if (!formatter) qWarning("%s %d: %s", __FILE__, __LINE__, "No formatter found for entry!");
-	else {
-		// Apply the default font
-		setFont(DetailedViewFonts::font(DetailedViewFonts::DefaultText));
-		QString css(formatter->CSS());
-		// Add the font style CSS
-		css += QString("\n%1 {\n%2}\n").arg(".furigana").arg(DetailedViewFonts::CSS(DetailedViewFonts::KanaHeader));
-		css += QString("\n%1 {\n%2}\n").arg(".mainwriting").arg(DetailedViewFonts::CSS(DetailedViewFonts::KanjiHeader));
-		css += QString("\n%1 {\n%2}\n").arg(".kanji").arg(DetailedViewFonts::CSS(DetailedViewFonts::Kanji));
-		css += QString("\n%1 {\n%2}\n").arg(".kana").arg(DetailedViewFonts::CSS(DetailedViewFonts::Kana));
-		// Fill the HTML template with the immediate information
-		QString html(filler.fill(formatter->htmlTemplate(), formatter, entry));
+	if (!formatter) {
+		clear();
+		_entryView.setEntry(entry);
+		qWarning("%s %d: %s", __FILE__, __LINE__, "No formatter found for entry!");
+		return;
+	}
+	QString css(formatter->CSS());
+	// Add the font style CSS
+	css += QString("\n%1 {\n%2}\n").arg(".furigana").arg(DetailedViewFonts::CSS(DetailedViewFonts::KanaHeader));
+	css += QString("\n%1 {\n%2}\n").arg(".mainwriting").arg(DetailedViewFonts::CSS(DetailedViewFonts::KanjiHeader));
+	css += QString("\n%1 {\n%2}\n").arg(".kanji").arg(DetailedViewFonts::CSS(DetailedViewFonts::Kanji));
+	css += QString("\n%1 {\n%2}\n").arg(".kana").arg(DetailedViewFonts::CSS(DetailedViewFonts::Kana));
+	// Entries displayed again, e.g. from the history, reuse their contents
+	const DetailedViewContent *cached = _contents.object(contentsKey(entry, css));
+	if (cached) {
+		_generator.cancel();
+		DetailedViewContent content(*cached);
+		content.entry = entry;
+		onContentGenerated(content);
+		return;
+	}
+	// Filling the template may run queries, so do it in the background
+	// and display the result in onContentGenerated()
+	_generator.generate(entry, formatter, css);
+}
+
+static PerfHistogram fillTime("Detailed view template filling");
+static PerfHistogram displayTime("Detailed view display");
+
+QString DetailedView::contentsKey(const ConstEntryPointer &entry, const QString &css)
+{
+	return QString("%1:%2:%3:%4:%5").arg(entry->type()).arg(entry->id()).arg(entry->version()).arg(qHash(css)).arg(EntryFormatter::allDisplaySettingsKeys());
+}
+
+void DetailedView::onContentGenerated(const DetailedViewContent &content)
+{
+	PerfTimer timer(displayTime);
+	TRACE_SCOPE("Detailed view display");
+	// clear() may drop the last reference to the entry being displayed
+	EntryPointer entry(content.entry);
+	const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
+	clear();
+	_entryView.setEntry(entry);
+	// Apply the default font
+	setFont(DetailedViewFonts::font(DetailedViewFonts::DefaultText));
+	const FilledTemplate &filled = content.filled;
+	const QString key(contentsKey(entry, content.css));
+	if (!_contents.contains(key)) {
+		// Do not keep the entry alive with its contents
+		DetailedViewContent *cached = new DetailedViewContent(content);
+		cached->entry.clear();
+		_contents.insert(key, cached, qMax(1, filled.html.size() / 1024));
+	}
 #ifdef DEBUG_DETAILED_VIEW
-		qDebug() << css;
-		qDebug() << html;
+	qDebug() << content.css;
+	qDebug() << filled.html;
 #endif
-		document()->setDefaultStyleSheet(css);
-		document()->setHtml(html);
-		// Now find the jobs that need to be run from the document
-		QRegExp funcMatch("\\$\\!\\$(\\w+)");
-		QTextCursor pos(document()), matchPos;
-		while (!(matchPos = document()->find(funcMatch, pos)).isNull()) {
-			funcMatch.exactMatch(matchPos.selectedText());
-			QString jobClass(funcMatch.cap(1));
-			// Remove the matched text and update the current position
-			matchPos.removeSelectedText();
-			pos = matchPos;
-			// Get the list of jobs to run by invoking the jobs method
-			QList<DetailedViewJob *> jobs;
-			QMetaObject::invokeMethod(const_cast<EntryFormatter *>(formatter), QString("job" + jobClass).toLatin1().constData(), Qt::DirectConnection, Q_RETURN_ARG(QList<DetailedViewJob *>, jobs), Q_ARG(ConstEntryPointer, entry), Q_ARG(QTextCursor, matchPos));
-			// Add the jobs added by the keyword to the list of jobs to run
-			foreach (DetailedViewJob *job, jobs) {
-				addBackgroundJob(job);
-			}
+	document()->setDefaultStyleSheet(content.css);
+	document()->setHtml(filled.html);
+	_skeleton = filled.skeleton;
+	_sectionsContents = filled.sections;
+	// Remember where the updatable sections are and remove their markers
+	QRegExp sectionMatch("\\$\\[\\$(\\w+)\\$");
+	QTextCursor pos(document()), matchPos;
+	while (!(matchPos = document()->find(sectionMatch, pos)).isNull()) {
+		sectionMatch.exactMatch(matchPos.selectedText());
+		QString section(sectionMatch.cap(1));
+		matchPos.removeSelectedText();
+		QTextCursor endPos(document()->find(CompiledTemplate::sectionEnd(), matchPos));
+		if (endPos.isNull()) break;
+		endPos.removeSelectedText();
+		_sections[section] = qMakePair(matchPos, endPos);
+		pos = endPos;
+	}
+	// Now find the jobs that need to be run from the document
+	QRegExp funcMatch("\\$\\!\\$(\\w+)");
+	pos = QTextCursor(document());
+	while (!(matchPos = document()->find(funcMatch, pos)).isNull()) {
+		funcMatch.exactMatch(matchPos.selectedText());
+		QString jobClass(funcMatch.cap(1));
+		// Remove the matched text and update the current position
+		matchPos.removeSelectedText();
+		pos = matchPos;
+		// Get the list of jobs to run by invoking the jobs method
+		QList<DetailedViewJob *> jobs;
+		QMetaObject::invokeMethod(const_cast<EntryFormatter *>(formatter), QString("job" + jobClass).toLatin1().constData(), Qt::DirectConnection, Q_RETURN_ARG(QList<DetailedViewJob *>, jobs), Q_ARG(ConstEntryPointer, entry), Q_ARG(QTextCursor, matchPos));
+		// Add the jobs added by the keyword to the list of jobs to run
+		foreach (DetailedViewJob *job, jobs) {
+			addBackgroundJob(job);
 		}
-		// Start running background jobs
-		_jobsRunner.runAllJobs();
-		
-		emit entryDisplayed(entry);
 	}
+	// Start running background jobs
+	_jobsRunner.runAllJobs();
+
+	emit entryDisplayed(entry);
 }
 
 void DetailedView::setSmoothScrolling(bool value)
@@ -185,7 +248,9 @@ void DetailedView::setSmoothScrolling(bool value)
 
 void DetailedView::display(const EntryPointer &entry)
 {
-	if (entry == _entryView.entry()) return;
+	// Any history entry being loaded is superseded by this one
+	_historyEntry = EntryRef();
+	if (entry == (_generator.isGenerating() ? _generator.entry() : _entryView.entry())) return;
 	if (_historyEnabled) {
 		_history.add(EntryRef(entry));
 	}
@@ -194,24 +259,66 @@ void DetailedView::display(const EntryPointer &entry)
 
 void DetailedView::redisplay()
 {
-	if (_entryView.entry()) {
-		// We need this pointer because display starts by clearing
-		// the entryView - which means the current entry reference
-		// counter could potentially reach zero and the entry be
-		// deleted.
-		EntryPointer tentry(_entryView.entry());
-		_display(tentry, true);
+	// An entry being generated is displayed next, so generate it again
+	// instead
+	EntryPointer tentry(_generator.isGenerating() ? _generator.entry() : _entryView.entry());
+	if (tentry) _display(tentry, true);
+}
+
+void DetailedView::refresh()
+{
+	EntryPointer entry(_entryView.entry());
+	if (!entry) return;
+	// Whatever is being generated will replace the current entry, but may
+	// have been filled before the change
+	if (_generator.isGenerating()) {
+		if (_generator.entry() == entry) redisplay();
+		return;
 	}
+	// Avoid a complete layout, which also loses the scroll position, if
+	// only the user data of the entry changed
+	if (!updateSections(entry)) redisplay();
 }
 
-void DetailedView::clear()
+bool DetailedView::updateSections(const EntryPointer &entry)
 {
-	foreach (const ConstEntryPointer &entry, _watchedEntries) {
-		disconnect(entry.data(), SIGNAL(entryChanged(Entry *)), this, SLOT(redisplay()));
+	const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
+	if (!formatter || _skeleton.isEmpty()) return false;
+	FilledTemplate filled;
+	formatter->compiledTemplate().fill(formatter, entry, formatter->updatableSections(), filled);
+	if (filled.skeleton != _skeleton) return false;
+
+	QTextCursor cursor(document());
+	cursor.beginEditBlock();
+	for (QMap<QString, QString>::const_iterator it = filled.sections.constBegin(); it != filled.sections.constEnd(); ++it) {
+		if (_sectionsContents.value(it.key()) == it.value()) continue;
+		if (!_sections.contains(it.key())) {
+			cursor.endEditBlock();
+			return false;
+		}
+		QPair<QTextCursor, QTextCursor> &section = _sections[it.key()];
+		int start = section.first.position();
+		cursor.setPosition(start);
+		cursor.setPosition(section.second.position(), QTextCursor::KeepAnchor);
+		if (it.value().isEmpty()) cursor.removeSelectedText();
+		else cursor.insertHtml(it.value());
+		section.first.setPosition(start);
+		section.second.setPosition(cursor.position());
 	}
+	cursor.endEditBlock();
+	_sectionsContents = filled.sections;
+	return true;
+}
+
+void DetailedView::clear()
+{
 	_watchedEntries.clear();
+	_skeleton.clear();
+	_sectionsContents.clear();
+	_sections.clear();
 
 	_jobsRunner.abortAllJobs();
+	_generator.cancel();
 
 	QTextBrowser::clear();
 	_entryView.setEntry(EntryPointer());
@@ -223,14 +330,27 @@ void DetailedView::clear()
 		i.next();
 		i.setValue(dir.filePath(i.value()));
 	}
+	QMap<QString, QString> images;
 	foreach (const QString &imageFile, fileNames) {
 		QStringList split = imageFile.split("/");
-		QString url = "flag:" + split[split.size() - 1].left(2);
-		document()->addResource(QTextDocument::ImageResource, QUrl(url), QPixmap(imageFile));
+		images["flag:" + split[split.size() - 1].left(2)] = imageFile;
+	}
+	images["tagicon"] = ":/images/icons/tags.png";
+	images["listicon"] = ":/images/icons/list.png";
+	images["moreicon"] = ":/images/icons/zoom-in.png";
+	_resourcesBytes = 0;
+	for (QMap<QString, QString>::const_iterator it = images.constBegin(); it != images.constEnd(); ++it) {
+		QPixmap pixmap(it.value());
+		document()->addResource(QTextDocument::ImageResource, QUrl(it.key()), pixmap);
+		_resourcesBytes += (qint64)pixmap.width() * pixmap.height() * pixmap.depth() / 8;
 	}
-	document()->addResource(QTextDocument::ImageResource, QUrl("tagicon"), QPixmap(":/images/icons/tags.png"));
-	document()->addResource(QTextDocument::ImageResource, QUrl("listicon"), QPixmap(":/images/icons/list.png"));
-	document()->addResource(QTextDocument::ImageResource, QUrl("moreicon"), QPixmap(":/images/icons/zoom-in.png"));
+}
+
+qint64 DetailedView::documentsMemory()
+{
+	qint64 ret = 0;
+	foreach (DetailedView *view, _instances) ret += view->_resourcesBytes + view->document()->characterCount() * (qint64)sizeof(QChar);
+	return ret;
 }
 
 void DetailedView::setKanjiClickable(bool clickable)
@@ -250,7 +370,7 @@ void DetailedView::previous()
 	EntryRef prev;
 	bool ok = _history.previous(prev);
 	if (!ok) return;
-	_display(prev.get());
+	displayFromHistory(prev);
 }
 
 void DetailedView::next()
@@ -258,7 +378,26 @@ void DetailedView::next()
 	EntryRef next;
 	bool ok = _history.next(next);
 	if (!ok) return;
-	_display(next.get());
+	displayFromHistory(next);
+}
+
+void DetailedView::displayFromHistory(const EntryRef &ref)
+{
+	if (ref.isLoaded()) {
+		_historyEntry = EntryRef();
+		_display(ref.get());
+		return;
+	}
+	// Only the last entry we moved to must be displayed
+	if (_historyEntry != ref) ref.getAsync(this, SLOT(onHistoryEntryLoaded(EntryRef, EntryPointer)));
+	_historyEntry = ref;
+}
+
+void DetailedView::onHistoryEntryLoaded(const EntryRef &ref, EntryPointer entry)
+{
+	if (ref != _historyEntry) return;
+	_historyEntry = EntryRef();
+	_display(entry);
 }
 
 void DetailedView::addBackgroundJob(DetailedViewJob *job)
@@ -269,7 +408,17 @@ void DetailedView::addBackgroundJob(DetailedViewJob *job)
 void DetailedView::addWatchEntry(const ConstEntryPointer &entry)
 {
 	_watchedEntries << entry;
-	connect(entry.data(), SIGNAL(entryChanged(Entry *)), this, SLOT(redisplay()));
+}
+
+void DetailedView::onEntryChanged(Entry *entry)
+{
+	// The contents of any entry may show the changed one
+	_contents.clear();
+	foreach (const ConstEntryPointer &watched, _watchedEntries) {
+		if (watched.data() != entry) continue;
+		redisplay();
+		return;
+	}
 }
 
 void DetailedView::populateToolBar(QToolBar *toolBar)
@@ -301,12 +450,7 @@ void DetailedView::mouseMoveEvent(QMouseEvent *e)
 		if ((e->pos() - _dragStartPos).manhattanLength() >= QApplication::startDragDistance()) {
 			_dragStarted = false;
 			QDrag *drag = new QDrag(this);
-			QMimeData *data = new QMimeData();
-			QByteArray encodedData;
-			QDataStream stream(&encodedData, QIODevice::WriteOnly);
-			stream << _dragEntryRef;
-			data->setData("tagainijisho/entry", encodedData);
-			drag->setMimeData(data);
+			drag->setMimeData(new EntriesMimeData(_dragEntryRef));
 			drag->exec(Qt::CopyAction, Qt::CopyAction);
 		}
 		e->accept();
@@ -321,11 +465,141 @@ void DetailedView::mouseReleaseEvent(QMouseEvent *e)
 	QTextBrowser::mouseReleaseEvent(e);
 }
 
-DetailedViewJobRunner::DetailedViewJobRunner(DetailedView * view, QObject *parent) : QObject(parent), _view(view), _currentJob(0), _ignoreJobs(false)
+/// Number of threads generating the contents of the detailed views
+#define DETAILED_VIEW_GENERATION_THREADS 2
+
+/// State shared between a generator and its jobs
+struct DetailedViewGeneration
+{
+	QMutex mutex;
+	/// Incremented every time a generation is started or cancelled
+	int ticket;
+	/// Null once the generator is destroyed
+	DetailedViewGenerator *generator;
+	/// Ticket of the generation result is for, -1 if none
+	int resultTicket;
+	DetailedViewContent result;
+
+	DetailedViewGeneration(DetailedViewGenerator *gen) : ticket(0), generator(gen), resultTicket(-1) {}
+};
+
+/**
+ * Threads shared by all the detailed views. They never expire, since the
+ * entries cache and the database keep a loader and a connection per thread.
+ */
+static QThreadPool *generationPool()
+{
+	static QThreadPool *pool = 0;
+	if (!pool) {
+		pool = new QThreadPool(QCoreApplication::instance());
+		pool->setMaxThreadCount(DETAILED_VIEW_GENERATION_THREADS);
+		pool->setExpiryTimeout(-1);
+	}
+	return pool;
+}
+
+class DetailedViewGenerationJob : public QRunnable
+{
+private:
+	QSharedPointer<DetailedViewGeneration> _generation;
+	int _ticket;
+	EntryPointer _entry;
+	const EntryFormatter *_formatter;
+	QString _css;
+
+	bool isCanceled() const
+	{
+		QMutexLocker lock(&_generation->mutex);
+		return _generation->ticket != _ticket || !_generation->generator;
+	}
+
+public:
+	DetailedViewGenerationJob(const QSharedPointer<DetailedViewGeneration> &generation, int ticket, const EntryPointer &entry, const EntryFormatter *formatter, const QString &css) : _generation(generation), _ticket(ticket), _entry(entry), _formatter(formatter), _css(css) {}
+
+	virtual void run()
+	{
+		// Superseded before we could even start
+		if (isCanceled()) return;
+
+		DetailedViewContent content;
+		content.entry = _entry;
+		content.css = _css;
+		{
+			PerfTimer timer(fillTime);
+			TRACE_SCOPE("Detailed view format");
+			_formatter->compiledTemplate().fill(_formatter, _entry, _formatter->updatableSections(), content.filled);
+		}
+
+		QMutexLocker lock(&_generation->mutex);
+		if (_generation->ticket != _ticket || !_generation->generator) return;
+		_generation->resultTicket = _ticket;
+		_generation->result = content;
+		QMetaObject::invokeMethod(_generation->generator, "onGenerated", Qt::QueuedConnection);
+	}
+};
+
+DetailedViewGenerator::DetailedViewGenerator(QObject *parent) : QObject(parent), _generation(new DetailedViewGeneration(this))
+{
+}
+
+DetailedViewGenerator::~DetailedViewGenerator()
+{
+	// Running jobs will drop their results
+	QMutexLocker lock(&_generation->mutex);
+	_generation->generator = 0;
+	++_generation->ticket;
+}
+
+void DetailedViewGenerator::generate(const EntryPointer &entry, const EntryFormatter *formatter, const QString &css)
+{
+	cancel();
+	_entry = entry;
+	// Notes and lists can only be read from the GUI thread
+	formatter->prepareFill(entry);
+	int ticket;
+	{
+		QMutexLocker lock(&_generation->mutex);
+		ticket = _generation->ticket;
+	}
+	generationPool()->start(new DetailedViewGenerationJob(_generation, ticket, entry, formatter, css));
+}
+
+void DetailedViewGenerator::cancel()
+{
+	_entry.clear();
+	QMutexLocker lock(&_generation->mutex);
+	++_generation->ticket;
+	_generation->resultTicket = -1;
+	_generation->result = DetailedViewContent();
+}
+
+void DetailedViewGenerator::onGenerated()
 {
-	_dbThread = new DatabaseThread();
+	DetailedViewContent content;
+	{
+		QMutexLocker lock(&_generation->mutex);
+		// Cancelled after the result was posted
+		if (_generation->resultTicket != _generation->ticket) return;
+		content = _generation->result;
+		_generation->resultTicket = -1;
+		_generation->result = DetailedViewContent();
+	}
+	_entry.clear();
+	emit generated(content);
+}
+
+/// Number of detailed view jobs that can run at the same time
+#define DETAILED_VIEW_CONCURRENT_JOBS 3
+/// Time during which the results of a job are reused, in milliseconds
+#define DETAILED_VIEW_JOB_RESULTS_TTL 30000
+
+DetailedViewJobQuery::DetailedViewJobQuery(DetailedViewJobRunner *runner) : QObject(runner), _runner(runner), _ignoreResults(false)
+{
+	_dbThread = DatabaseThreadPool::instance().acquire();
 
 	_aQuery = new ASyncEntryLoader(_dbThread);
+	// The user is waiting for these results
+	_aQuery->setPriority(ASyncQuery::Interactive);
 
 	connect(_aQuery, SIGNAL(firstResult()), this, SLOT(onFirstResult()));
 	connect(_aQuery, SIGNAL(result(EntryPointer)),
@@ -336,122 +610,232 @@ DetailedViewJobRunner::DetailedViewJobRunner(DetailedView * view, QObject *paren
 	this, SLOT(onError(const QString &)));
 }
 
-DetailedViewJobRunner::~DetailedViewJobRunner()
+DetailedViewJobQuery::~DetailedViewJobQuery()
 {
-	abortAllJobs();
+	abort();
 	delete _aQuery;
-	delete _dbThread;
+	DatabaseThreadPool::instance().release(_dbThread);
 }
 
-void DetailedViewJobRunner::addJob(DetailedViewJob *job)
+bool DetailedViewJobQuery::start(const QString &sql, const QList<DetailedViewJob *> &jobs)
+{
+	_sql = sql;
+	_jobs = jobs;
+	if (!_aQuery->exec(_sql)) {
+		qWarning("%s %d: %s", __FILE__, __LINE__, "Unable to start background job");
+		dropJobs();
+		_sql.clear();
+		return false;
+	}
+	return true;
+}
+
+void DetailedViewJobQuery::adopt(DetailedViewJob *job)
 {
 	_jobs << job;
+	if (_results.isEmpty()) return;
+	job->firstResult();
+	foreach (const EntryPointer &entry, _results) _runner->jobResult(job, entry);
 }
 
-void DetailedViewJobRunner::runNextJob()
+void DetailedViewJobQuery::dropJobs()
 {
-	// Delete the current job, if any
-	if (_currentJob) delete _currentJob;
-	// No more job to run?
-	if (_jobs.isEmpty()) {
-		_currentJob = 0;
-		return;
-	}
-	_currentJob = _jobs.dequeue();
-	// Since we are only using the Query from here, it should always be available!
-	if (_currentJob->sql().isEmpty()) runNextJob();
-	else {
-		if (!_aQuery->exec(_currentJob->sql()))
-			qWarning("%s %d: %s", __FILE__, __LINE__, "Unable to start background job");
-	}
+	foreach (DetailedViewJob *job, _jobs) delete job;
+	_jobs.clear();
 }
 
-void DetailedViewJobRunner::runAllJobs()
+void DetailedViewJobQuery::abort()
 {
-	// Are jobs already running?
-	if (_currentJob) return;
-	runNextJob();
-}
-
-void DetailedViewJobRunner::abortCurrentJob()
-{
-	// Do we have a job running?
-	if (_currentJob) {
-		// Then stop its execution
-		_aQuery->abort();
-		// Flush events that may have been posted by the DB thread
-		_ignoreJobs = true;
-		QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents | QEventLoop::ExcludeSocketNotifiers);
-		_ignoreJobs = false;
-
-		// This would be a more elegant solution than processEvents,
-		// but unfortunately is not acceptable.
-		// Shared pointers are held in the message queue - if only pointer to
-		// and entry is in the queue, the entry is deleted and the QObject
-		// destructor attempts to lock the events queue which results in a
-		// dead lock. Setting the entries cache size to zero clearly exposes
-		// this problem.
-//		QCoreApplication::removePostedEvents(this);
-		// Delete the job
-		delete _currentJob;
-		_currentJob = 0;
-	}
+	if (!isRunning()) return;
+	_aQuery->abort();
+	// Flush events that may have been posted by the DB thread
+	_ignoreResults = true;
+	QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents | QEventLoop::ExcludeSocketNotifiers);
+	_ignoreResults = false;
+
+	// This would be a more elegant solution than processEvents,
+	// but unfortunately is not acceptable.
+	// Shared pointers are held in the message queue - if only pointer to
+	// and entry is in the queue, the entry is deleted and the QObject
+	// destructor attempts to lock the events queue which results in a
+	// dead lock. Setting the entries cache size to zero clearly exposes
+	// this problem.
+//	QCoreApplication::removePostedEvents(this);
+	dropJobs();
+	_results.clear();
+	_sql.clear();
 }
 
-void DetailedViewJobRunner::abortAllJobs()
+void DetailedViewJobQuery::finish()
 {
-	// Clean the jobs queue
-	foreach (DetailedViewJob *job, _jobs) delete job;
-	_jobs.clear();
-	// And abort the running job
-	abortCurrentJob();
+	dropJobs();
+	_results.clear();
+	_sql.clear();
 }
 
-void DetailedViewJobRunner::onFirstResult()
+void DetailedViewJobQuery::onFirstResult()
 {
 	// If we are just flushing the job results queue, don't lose time here
-	if (_ignoreJobs) return;
+	if (_ignoreResults) return;
 
-	Q_ASSERT(_currentJob != 0);
-	_currentJob->firstResult();
+	foreach (DetailedViewJob *job, _jobs) job->firstResult();
 }
 
-void DetailedViewJobRunner::onResult(EntryPointer entry)
+void DetailedViewJobQuery::onResult(EntryPointer entry)
 {
 	// If we are just flushing the job results queue, don't lose time here
-	if (_ignoreJobs) return;
+	if (_ignoreResults) return;
 
-	Q_ASSERT(_currentJob != 0);
-	_currentJob->result(entry);
-	_view->addWatchEntry(entry);
-	// Workaround for the fact QTextEdit does not seem to like when we change the
-	// displayed text document so often - without this scheduled repaint graphical
-	// glitches tend to appear on the first time a given entry is displayed.
-	_view->viewport()->update();
+	_results << entry;
+	foreach (DetailedViewJob *job, _jobs) _runner->jobResult(job, entry);
 }
 
-void DetailedViewJobRunner::onCompleted()
+void DetailedViewJobQuery::onCompleted()
 {
 	// If we are just flushing the job results queue, don't lose time here
-	if (_ignoreJobs) return;
+	if (_ignoreResults) return;
+
+	foreach (DetailedViewJob *job, _jobs) job->completed();
+	QString sql(_sql);
+	QList<EntryPointer> results(_results);
+	finish();
+	_runner->queryCompleted(sql, results);
+}
+
+void DetailedViewJobQuery::onAborted()
+{
+	if (_ignoreResults) return;
+
+	finish();
+	_runner->startQueries();
+}
+
+void DetailedViewJobQuery::onError(const QString &error)
+{
+	qDebug() << "An error occured while processing job" << _sql << ":" << error;
+	abort();
+	_runner->startQueries();
+}
+
+QCache<QString, DetailedViewJobRunner::JobResults> DetailedViewJobRunner::_results(100);
 
-	Q_ASSERT(_currentJob != 0);
-	_currentJob->completed();
+DetailedViewJobRunner::DetailedViewJobRunner(DetailedView * view, QObject *parent) : QObject(parent), _view(view), _starting(false)
+{
+	for (int i = 0; i < DETAILED_VIEW_CONCURRENT_JOBS; i++) _queries << new DetailedViewJobQuery(this);
+}
 
-	runNextJob();
+DetailedViewJobRunner::~DetailedViewJobRunner()
+{
+	abortAllJobs();
+	// Aborting a query flushes events, so don't let the others be used meanwhile
+	QList<DetailedViewJobQuery *> queries(_queries);
+	_queries.clear();
+	foreach (DetailedViewJobQuery *query, queries) delete query;
 }
 
-void DetailedViewJobRunner::onAborted()
+void DetailedViewJobRunner::addJob(DetailedViewJob *job)
 {
-	Q_ASSERT(_currentJob != 0);
-	runNextJob();
+	// Jobs without a query have nothing to run
+	if (job->sql().isEmpty()) {
+		delete job;
+		return;
+	}
+	if (!_pendingJobs.contains(job->sql())) _pendingSql << job->sql();
+	_pendingJobs[job->sql()] << job;
+}
+
+void DetailedViewJobRunner::runAllJobs()
+{
+	qint64 now = QDateTime::currentMSecsSinceEpoch();
+	foreach (const QString &sql, _pendingSql) {
+		// Jobs with recent results get them right away
+		JobResults *results = _results.object(sql);
+		if (results && now - results->time > DETAILED_VIEW_JOB_RESULTS_TTL) {
+			_results.remove(sql);
+			results = 0;
+		}
+		if (results) {
+			QList<EntryPointer> entries(EntriesCache::getMany(results->entries));
+			entries.removeAll(EntryPointer());
+			foreach (DetailedViewJob *job, _pendingJobs.take(sql)) {
+				if (!entries.isEmpty()) job->firstResult();
+				foreach (const EntryPointer &entry, entries) jobResult(job, entry);
+				job->completed();
+				delete job;
+			}
+			_pendingSql.removeOne(sql);
+			continue;
+		}
+		// Jobs which query is already running join it
+		foreach (DetailedViewJobQuery *query, _queries) {
+			if (query->sql() != sql) continue;
+			foreach (DetailedViewJob *job, _pendingJobs.take(sql)) query->adopt(job);
+			_pendingSql.removeOne(sql);
+			break;
+		}
+	}
+	startQueries();
+}
+
+DetailedViewJobQuery *DetailedViewJobRunner::availableQuery()
+{
+	foreach (DetailedViewJobQuery *query, _queries) {
+		if (!query->isRunning()) return query;
+	}
+	// Stale queries give their thread to the jobs being waited for
+	foreach (DetailedViewJobQuery *query, _queries) {
+		if (query->isOrphan()) {
+			query->abort();
+			return query;
+		}
+	}
+	return 0;
+}
+
+void DetailedViewJobRunner::startQueries()
+{
+	// Aborting a query flushes events, which can finish other queries
+	if (_starting) return;
+	_starting = true;
+	while (!_pendingSql.isEmpty()) {
+		DetailedViewJobQuery *query = availableQuery();
+		if (!query) break;
+		QString sql(_pendingSql.takeFirst());
+		query->start(sql, _pendingJobs.take(sql));
+	}
+	_starting = false;
+}
+
+void DetailedViewJobRunner::abortAllJobs()
+{
+	// Clean the jobs queue
+	foreach (const QList<DetailedViewJob *> &jobs, _pendingJobs) {
+		foreach (DetailedViewJob *job, jobs) delete job;
+	}
+	_pendingJobs.clear();
+	_pendingSql.clear();
+	// Running queries are left to complete, so their results can be reused
+	// if the user comes back to the same entry
+	foreach (DetailedViewJobQuery *query, _queries) query->dropJobs();
+}
+
+void DetailedViewJobRunner::jobResult(DetailedViewJob *job, const EntryPointer &entry)
+{
+	job->result(entry);
+	_view->addWatchEntry(entry);
+	// Workaround for the fact QTextEdit does not seem to like when we change the
+	// displayed text document so often - without this scheduled repaint graphical
+	// glitches tend to appear on the first time a given entry is displayed.
+	_view->viewport()->update();
 }
 
-void DetailedViewJobRunner::onError(const QString &error)
+void DetailedViewJobRunner::queryCompleted(const QString &sql, const QList<EntryPointer> &results)
 {
-	qDebug() << "An error occured while processing job" << _currentJob->sql() << ":" << error;
-	abortCurrentJob();
-	runNextJob();
+	JobResults *cached = new JobResults();
+	foreach (const EntryPointer &entry, results) cached->entries << EntryRef(entry);
+	cached->time = QDateTime::currentMSecsSinceEpoch();
+	_results.insert(sql, cached);
+	startQueries();
 }
 
 DetailedViewJob::DetailedViewJob(const QString &sql, const QTextCursor &cursor) : _sql(sql), _cursor(cursor)
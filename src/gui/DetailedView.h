@@ -23,6 +23,7 @@
 #include "gui/SingleEntryView.h"
 #include "gui/AbstractHistory.h"
 #include "gui/ScrollBarSmoothScroller.h"
+#include "gui/TemplateFiller.h"
 
 #include <QTextBrowser>
 #include <QTextCursor>
@@ -30,10 +31,13 @@
 #include <QMap>
 #include <QPair>
 #include <QMouseEvent>
-#include <QQueue>
+#include <QHash>
+#include <QCache>
 #include <QSet>
+#include <QSharedPointer>
 
 class DetailedView;
+class EntryFormatter;
 
 /**
  * An asynchronous database job to be performed by the dedicated thread of this
@@ -63,25 +67,84 @@ public:
 	virtual void completed() { }
 };
 
-class DetailedViewJobRunner : public QObject
+class DetailedViewJobRunner;
+
+/**
+ * A query run for the jobs of a DetailedViewJobRunner on its own database
+ * thread. All the jobs sharing the same SQL are served by the same query.
+ *
+ * A query which jobs have been dropped keeps running to fill the results
+ * cache of the runner, until its thread is needed by another query.
+ */
+class DetailedViewJobQuery : public QObject
 {
 	Q_OBJECT
-protected:
-	DetailedView *_view;
+private:
+	DetailedViewJobRunner *_runner;
 	DatabaseThread *_dbThread;
 	ASyncEntryLoader *_aQuery;
 
-	QQueue<DetailedViewJob *> _jobs;
-	DetailedViewJob *_currentJob;
-	bool _ignoreJobs;
+	QString _sql;
+	QList<DetailedViewJob *> _jobs;
+	QList<EntryPointer> _results;
+	bool _ignoreResults;
+
+	void finish();
 
-protected slots:
+private slots:
 	void onFirstResult();
 	void onResult(EntryPointer entry);
 	void onCompleted();
 	void onAborted();
 	void onError(const QString &error);
-	void runNextJob();
+
+public:
+	DetailedViewJobQuery(DetailedViewJobRunner *runner);
+	virtual ~DetailedViewJobQuery();
+
+	const QString &sql() const { return _sql; }
+	bool isRunning() const { return !_sql.isEmpty(); }
+	/// True if the query is running for no job
+	bool isOrphan() const { return isRunning() && _jobs.isEmpty(); }
+
+	bool start(const QString &sql, const QList<DetailedViewJob *> &jobs);
+	/// Adds job to the running query, giving it the results obtained so far
+	void adopt(DetailedViewJob *job);
+	/// Drops the jobs of the query, which keeps running
+	void dropJobs();
+	/// Stops the query and drops its jobs
+	void abort();
+};
+
+/**
+ * Runs the jobs of a detailed view, several of them at the same time on
+ * different database threads. Jobs with the same SQL are run only once
+ * and their results are kept for a while, so browsing entries quickly does
+ * not run the same queries again and again.
+ */
+class DetailedViewJobRunner : public QObject
+{
+	Q_OBJECT
+private:
+	/// Entries found by a job, and when they were
+	struct JobResults {
+		QList<EntryRef> entries;
+		qint64 time;
+	};
+	/// Results of the latest jobs, indexed by their SQL
+	static QCache<QString, JobResults> _results;
+
+protected:
+	DetailedView *_view;
+	QList<DetailedViewJobQuery *> _queries;
+
+	/// SQL of the jobs waiting for a query, in their order of submission
+	QList<QString> _pendingSql;
+	QHash<QString, QList<DetailedViewJob *> > _pendingJobs;
+	bool _starting;
+
+	/// Returns a query that can be started, aborting an orphan one if needed
+	DetailedViewJobQuery *availableQuery();
 
 public:
 	DetailedViewJobRunner(DetailedView *view, QObject *parent = 0);
@@ -89,8 +152,65 @@ public:
 
 	void addJob(DetailedViewJob *job);
 	void runAllJobs();
-	void abortCurrentJob();
 	void abortAllJobs();
+	/// Forgets the results of the latest jobs
+	static void clearResults() { _results.clear(); }
+
+	/// Gives entry to job
+	void jobResult(DetailedViewJob *job, const EntryPointer &entry);
+	/// Starts queries for the pending jobs, as long as threads are available
+	void startQueries();
+	/// Keeps the results of a completed query and starts the next ones
+	void queryCompleted(const QString &sql, const QList<EntryPointer> &results);
+};
+
+/**
+ * Contents generated for an entry to display: its filled template and the
+ * style sheet to display it with.
+ */
+struct DetailedViewContent
+{
+	EntryPointer entry;
+	QString css;
+	FilledTemplate filled;
+};
+
+struct DetailedViewGeneration;
+
+/**
+ * Fills the templates of the entries to display in a detailed view on a
+ * worker thread, since formatters load other entries and run queries while
+ * doing so. Only the latest requested entry is delivered: requesting another
+ * one cancels the generation in progress.
+ */
+class DetailedViewGenerator : public QObject
+{
+	Q_OBJECT
+private:
+	/// Shared with the jobs, which may outlive us
+	QSharedPointer<DetailedViewGeneration> _generation;
+	EntryPointer _entry;
+
+private slots:
+	void onGenerated();
+
+public:
+	DetailedViewGenerator(QObject *parent = 0);
+	virtual ~DetailedViewGenerator();
+
+	/// Starts generating the contents of entry, cancelling any generation
+	/// in progress
+	void generate(const EntryPointer &entry, const EntryFormatter *formatter, const QString &css);
+	/// Drops the generation in progress, if any
+	void cancel();
+	bool isGenerating() const { return !_entry.isNull(); }
+	/// Entry being generated, if any
+	const EntryPointer &entry() const { return _entry; }
+
+signals:
+	/// Emitted from the GUI thread once the contents of the latest
+	/// requested entry are ready
+	void generated(const DetailedViewContent &content);
 };
 
 class DetailedViewFonts : public QObject
@@ -222,11 +342,42 @@ private:
 	EntryRef _dragEntryRef;
 	QPoint _dragStartPos;
 	bool _dragStarted;
+	/// Memory used by the images added to the document
+	qint64 _resourcesBytes;
+	/// History entry being loaded, to be displayed once available
+	EntryRef _historyEntry;
+	/// Template of the displayed entry without its updatable sections,
+	/// see FilledTemplate
+	QString _skeleton;
+	/// Content of the updatable sections of the displayed entry
+	QMap<QString, QString> _sectionsContents;
+	/// Start and end of the updatable sections in the document
+	QMap<QString, QPair<QTextCursor, QTextCursor> > _sections;
+	/// Contents generated for the latest displayed entries, by contentsKey()
+	static QCache<QString, DetailedViewContent> _contents;
+
+	/**
+	 * Identifies the contents generated for entry with the given style
+	 * sheet: they can be reused as long as the entry, the display
+	 * settings of the formatters and the fonts did not change.
+	 */
+	static QString contentsKey(const ConstEntryPointer &entry, const QString &css);
+
+	/**
+	 * Replaces the updatable sections of the displayed entry that
+	 * changed. Returns false if the rest of the entry changed too, in
+	 * which case it must be displayed again.
+	 */
+	bool updateSections(const EntryPointer &entry);
+
+	/// Displays ref now if it is loaded, as soon as it is otherwise
+	void displayFromHistory(const EntryRef &ref);
 
 protected:
 	AbstractHistory<EntryRef, QList<EntryRef> > _history;
 	SingleEntryView _entryView;
 	DetailedViewJobRunner _jobsRunner;
+	DetailedViewGenerator _generator;
 	QList<ConstEntryPointer> _watchedEntries;
 	QAction *_historyPrevAction;
 	QAction *_historyNextAction;
@@ -250,6 +401,8 @@ public:
 
 	void addBackgroundJob(DetailedViewJob *job);
 	static const QSet<DetailedView *> &instances() { return _instances; }
+	/// Approximate memory used by the documents of all the instances, in bytes
+	static qint64 documentsMemory();
 
 	/**
 	 * Fake a click event on the provided URL.
@@ -271,10 +424,18 @@ protected slots:
 	void previous();
 	/// Display next item in history, if any.
 	void next();
+	void onHistoryEntryLoaded(const EntryRef &ref, EntryPointer entry);
+	/// Redraws the entry if entry is one of the watched entries
+	void onEntryChanged(Entry *entry);
+	/// Displays the contents generated for the entry to display
+	void onContentGenerated(const DetailedViewContent &content);
 	/**
 	 * Display an entry without updating history.
 	 * If update is true, then the entry is redisplayed
 	 * regardless of whether it is the same as before.
+	 *
+	 * The contents of the entry are generated in the background, and
+	 * the entry currently displayed remains until they are ready.
 	 */
 	virtual void _display(const EntryPointer &entry, bool update = false);
 
@@ -283,6 +444,9 @@ public slots:
 	void display(const EntryPointer& entry);
 	/// Redraw the current entry, if any.
 	void redisplay();
+	/// Update the current entry in place if only its updatable sections
+	/// changed, otherwise redraw it.
+	void refresh();
 	/// Clear the display (keep history)
 	void clear();
 
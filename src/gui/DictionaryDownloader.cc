@@ -0,0 +1,198 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tagaini_config.h"
+#include "core/Paths.h"
+#include "gui/DictionaryDownloader.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QUrl>
+#include <QtDebug>
+
+QThread *DictionaryDownloader::_thread = 0;
+
+DictionaryDownloader::DictionaryDownloader() : QObject(), _http(0), _checkedReply(false)
+{
+}
+
+DictionaryDownloader::~DictionaryDownloader()
+{
+}
+
+void DictionaryDownloader::startDownload()
+{
+	if (_thread) {
+		if (_thread->isRunning()) return;
+		delete _thread;
+	}
+	_thread = new QThread();
+	// The downloader has no parent so it can be moved to the thread, and
+	// is deleted by it once it is done
+	DictionaryDownloader *downloader = new DictionaryDownloader();
+	downloader->moveToThread(_thread);
+	connect(_thread, SIGNAL(started()), downloader, SLOT(begin()));
+	connect(downloader, SIGNAL(done()), _thread, SLOT(quit()));
+	connect(_thread, SIGNAL(finished()), downloader, SLOT(deleteLater()));
+	_thread->start(QThread::LowestPriority);
+}
+
+void DictionaryDownloader::stopDownload()
+{
+	if (!_thread) return;
+	// Replies still running are aborted when the downloader is deleted,
+	// and the partial file is kept to be resumed next time
+	_thread->quit();
+	_thread->wait();
+	delete _thread;
+	_thread = 0;
+}
+
+void DictionaryDownloader::begin()
+{
+	// Created here so that it belongs to the downloader's thread
+	_http = new QNetworkAccessManager(this);
+	QNetworkRequest request(QUrl(QString("http://www.tagaini.net/updates/dictionaries.php?version=%1").arg(VERSION)));
+	request.setHeader(QNetworkRequest::UserAgentHeader, QString("Tagaini Jisho %1 (%2)").arg(VERSION).arg(PLATFORM));
+	request.setPriority(QNetworkRequest::LowPriority);
+	QNetworkReply *reply = _http->get(request);
+	connect(reply, SIGNAL(finished()), this, SLOT(manifestFinished()));
+}
+
+void DictionaryDownloader::manifestFinished()
+{
+	QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+	reply->deleteLater();
+	if (reply->error() != QNetworkReply::NoError) {
+		qWarning("Cannot fetch the dictionaries manifest: %s", reply->errorString().toLocal8Bit().constData());
+		emit done();
+		return;
+	}
+	parseManifest(reply->readAll());
+	downloadNext();
+}
+
+void DictionaryDownloader::parseManifest(const QByteArray &manifest)
+{
+	QDir profile(userProfile());
+	foreach (const QByteArray &line, manifest.split('\n')) {
+		QList<QByteArray> fields(line.simplified().split(' '));
+		if (fields.size() != 5) continue;
+		File file;
+		file.name = QString::fromUtf8(fields[0]);
+		file.stamp = QString::fromUtf8(fields[1]);
+		bool ok;
+		file.size = fields[2].toLongLong(&ok);
+		file.sha1 = QByteArray::fromHex(fields[3]);
+		file.url = QString::fromUtf8(fields[4]);
+		// Only plain file names of the user profile can be written
+		if (!ok || file.sha1.size() != 20 || file.name.contains('/') || file.name.contains('\\') || file.name.startsWith('.') || file.stamp.contains('.') || file.stamp.contains('/')) {
+			qWarning("Invalid line in the dictionaries manifest: %s", line.constData());
+			continue;
+		}
+		if (installedFileStamp(file.name) == file.stamp) continue;
+		if (profile.exists(QString("%1.%2.pending").arg(file.name).arg(file.stamp))) continue;
+		_queue << file;
+	}
+}
+
+void DictionaryDownloader::downloadNext()
+{
+	if (_queue.isEmpty()) {
+		emit done();
+		return;
+	}
+	const File &file = _queue.first();
+	_part.setFileName(QDir(userProfile()).filePath(QString("%1.%2.part").arg(file.name).arg(file.stamp)));
+	if (!_part.open(QIODevice::ReadWrite | QIODevice::Append)) {
+		qWarning("Cannot write %s", _part.fileName().toLocal8Bit().constData());
+		_queue.removeFirst();
+		downloadNext();
+		return;
+	}
+	QNetworkRequest request((QUrl(file.url)));
+	request.setHeader(QNetworkRequest::UserAgentHeader, QString("Tagaini Jisho %1 (%2)").arg(VERSION).arg(PLATFORM));
+	request.setPriority(QNetworkRequest::LowPriority);
+	// Resume the download of a previous run
+	if (_part.size() > 0) request.setRawHeader("Range", QString("bytes=%1-").arg(_part.size()).toLatin1());
+	_checkedReply = false;
+	QNetworkReply *reply = _http->get(request);
+	connect(reply, SIGNAL(readyRead()), this, SLOT(readyRead()));
+	connect(reply, SIGNAL(finished()), this, SLOT(fileFinished()));
+}
+
+void DictionaryDownloader::readyRead()
+{
+	QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+	int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	// Error pages must not end up in the file
+	if (status >= 300) {
+		reply->readAll();
+		return;
+	}
+	if (!_checkedReply) {
+		_checkedReply = true;
+		// The server sends the whole file if it does not support ranges
+		if (status != 206) _part.resize(0);
+	}
+	_part.write(reply->readAll());
+}
+
+void DictionaryDownloader::fileFinished()
+{
+	QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+	reply->deleteLater();
+	File file(_queue.takeFirst());
+	// The previous run may already have downloaded the whole file
+	bool complete = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 416;
+	if (reply->error() == QNetworkReply::NoError || complete) {
+		_part.close();
+		verify(file);
+	} else {
+		qWarning("Cannot download %s: %s", file.name.toLocal8Bit().constData(), reply->errorString().toLocal8Bit().constData());
+		_part.close();
+	}
+	downloadNext();
+}
+
+bool DictionaryDownloader::verify(const File &file)
+{
+	bool valid = _part.size() == file.size;
+	if (valid && _part.open(QIODevice::ReadOnly)) {
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		while (!_part.atEnd()) hash.addData(_part.read(1 << 20));
+		_part.close();
+		valid = hash.result() == file.sha1;
+	}
+	if (!valid) {
+		qWarning("Downloaded %s is corrupted, discarding it", file.name.toLocal8Bit().constData());
+		_part.remove();
+		return false;
+	}
+	QDir profile(userProfile());
+	// Only install the latest version of a file
+	foreach (const QString &older, profile.entryList(QStringList(file.name + ".*.pending"), QDir::Files)) profile.remove(older);
+	QString pending(QString("%1.%2.pending").arg(file.name).arg(file.stamp));
+	if (!_part.rename(profile.filePath(pending))) {
+		qWarning("Cannot rename %s", _part.fileName().toLocal8Bit().constData());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_DICTIONARY_DOWNLOADER_H
+#define __GUI_DICTIONARY_DOWNLOADER_H
+
+#include <QObject>
+#include <QThread>
+#include <QFile>
+#include <QList>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/**
+ * Downloads the updated dictionaries published on the web site into the
+ * user profile, from a thread of its own with a low priority so that
+ * neither the GUI nor the searches have to wait for the network or the
+ * checksums.
+ *
+ * The list of current files is given by a manifest with one line per
+ * file:
+ *
+ *   <file> <stamp> <size> <sha1> <url>
+ *
+ * Each file that is not installed yet is downloaded as
+ * <file>.<stamp>.part, resuming an interrupted download if possible, and
+ * renamed to <file>.<stamp>.pending once its size and checksum have been
+ * verified. The program only switches to it at its next start, through
+ * installPendingFiles(), so the dictionaries are never replaced while
+ * they are open.
+ */
+class DictionaryDownloader : public QObject
+{
+	Q_OBJECT
+private:
+	struct File {
+		QString name;
+		QString stamp;
+		qint64 size;
+		QByteArray sha1;
+		QString url;
+	};
+
+	static QThread *_thread;
+
+	QNetworkAccessManager *_http;
+	QList<File> _queue;
+	QFile _part;
+	/// Whether the status of the current reply has been checked yet
+	bool _checkedReply;
+
+	DictionaryDownloader();
+	virtual ~DictionaryDownloader();
+
+	/// Parses the manifest and queues the files that need to be downloaded
+	void parseManifest(const QByteArray &manifest);
+	/// Checks the downloaded file and makes it pending for installation
+	bool verify(const File &file);
+	void downloadNext();
+
+private slots:
+	void begin();
+	void manifestFinished();
+	void readyRead();
+	void fileFinished();
+
+signals:
+	void done();
+
+public:
+	/**
+	 * Starts fetching the manifest and the updated dictionaries, unless
+	 * this is already in progress. Must be called from the GUI thread.
+	 */
+	static void startDownload();
+	/// Aborts the downloads and waits for the thread to terminate
+	static void stopDownload();
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/EntriesExporter.h"
+#include "gui/EntryFormatter.h"
+#include "core/Database.h"
+#include "sqlite/Query.h"
+
+#include <QProgressDialog>
+#include <QCoreApplication>
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QStringList>
+#include <QHash>
+
+/// Number of entries loaded and formatted together
+#define EXPORT_CHUNK_SIZE 200
+/// How often, in ms, the GUI thread checks for cancel while waiting for a chunk
+#define EXPORT_CANCEL_CHECK_INTERVAL 50
+
+/**
+ * The formatted chunks of an export, written in order by the GUI thread.
+ */
+struct ExportPipeline {
+	QMutex mutex;
+	QWaitCondition formatted;
+	QVector<QByteArray> chunks;
+	QVector<bool> done;
+
+	void setChunk(int index, const QByteArray &chunk)
+	{
+		QMutexLocker lock(&mutex);
+		chunks[index] = chunk;
+		done[index] = true;
+		formatted.wakeAll();
+	}
+	/**
+	 * Waits at most timeout ms for chunk index to be formatted and takes
+	 * it into chunk. Returns false if it is not formatted yet.
+	 */
+	bool takeChunk(int index, QByteArray &chunk, unsigned long timeout)
+	{
+		QMutexLocker lock(&mutex);
+		if (!done[index]) formatted.wait(&mutex, timeout);
+		if (!done[index]) return false;
+		chunk = chunks[index];
+		chunks[index] = QByteArray();
+		return true;
+	}
+};
+
+/**
+ * Loads and formats one chunk of an export.
+ */
+class ExportChunkJob : public QRunnable
+{
+private:
+	const EntriesExporter *_exporter;
+	ExportPipeline *_pipeline;
+	int _index;
+	QList<EntryRef> _refs;
+
+public:
+	ExportChunkJob(const EntriesExporter *exporter, ExportPipeline *pipeline, int index, const QList<EntryRef> &refs) : _exporter(exporter), _pipeline(pipeline), _index(index), _refs(refs) {}
+
+	virtual void run()
+	{
+		_pipeline->setChunk(_index, _exporter->exportChunk(_refs));
+	}
+};
+
+EntriesExporter::EntriesExporter(QWidget *parent) : QObject(parent), _canceled(false)
+{
+}
+
+QByteArray EntriesExporter::exportChunk(const QList<EntryRef> &refs) const
+{
+	QList<EntryPointer> entries(EntriesCache::getMany(refs));
+	entries.removeAll(EntryPointer());
+	return formatEntries(entries);
+}
+
+bool EntriesExporter::exportEntries(const QList<EntryRef> &entries, QIODevice *out)
+{
+	_canceled = false;
+	int nbChunks = (entries.size() + EXPORT_CHUNK_SIZE - 1) / EXPORT_CHUNK_SIZE;
+
+	QProgressDialog progressDialog(tr("Exporting entries..."), tr("Abort"), 0, nbChunks, qobject_cast<QWidget *>(parent()));
+	progressDialog.setMinimumDuration(50);
+	progressDialog.setWindowTitle(tr("Exporting..."));
+	progressDialog.setWindowModality(Qt::WindowModal);
+	progressDialog.show();
+
+	// The chunks are exported from the connections of the pool threads, which
+	// do not see the writes still waiting in the writer thread
+	DatabaseWriter::flush();
+	prepareExport(entries);
+	if (out->write(header()) == -1) return false;
+
+	// The pool is declared last so its threads are done before the
+	// pipeline is destroyed
+	ExportPipeline pipeline;
+	pipeline.chunks.resize(nbChunks);
+	pipeline.done.fill(false, nbChunks);
+	QThreadPool pool;
+	// Only keep a few chunks ahead of the one being written
+	int ahead = qMax(2, QThread::idealThreadCount() * 2);
+	int submitted = 0;
+	for (int i = 0; i < nbChunks; i++) {
+		for (; submitted < nbChunks && submitted <= i + ahead; submitted++)
+			pool.start(new ExportChunkJob(this, &pipeline, submitted, entries.mid(submitted * EXPORT_CHUNK_SIZE, EXPORT_CHUNK_SIZE)));
+		// Keep the dialog responsive while the chunk is being formatted
+		QByteArray chunk;
+		while (!pipeline.takeChunk(i, chunk, EXPORT_CANCEL_CHECK_INTERVAL)) {
+			QCoreApplication::processEvents();
+			if (progressDialog.wasCanceled()) break;
+		}
+		if (progressDialog.wasCanceled()) {
+			_canceled = true;
+			pool.clear();
+			return false;
+		}
+		if (out->write(chunk) == -1) {
+			pool.clear();
+			return false;
+		}
+		progressDialog.setValue(i);
+	}
+
+	return out->write(footer()) != -1;
+}
+
+QString TSVEntriesExporter::formatLine(const QString &writing, const QString &readings, const QString &meanings, const QString &jlpt, const QString &tags)
+{
+	return QString("%1\t%2\t%3\t%4\t%5\n").arg(writing).arg(readings).arg(meanings).arg(jlpt).arg(tags);
+}
+
+QString TSVEntriesExporter::formatEntry(const EntryPointer &entry)
+{
+	QStringList writings = entry->writings();
+	QString writing;
+	if (writings.size() > 0) writing = writings[0];
+	QStringList tags;
+	foreach (const Tag &tag, entry->tags()) tags << tag.name();
+	tags.sort();
+	return formatLine(writing, entry->readings().join(", "), entry->meanings().join(", "), QString(), tags.join(", "));
+}
+
+void TSVEntriesExporter::prepareExport(const QList<EntryRef> &entries)
+{
+	// Formatters may need the GUI thread to build their statement
+	_statements.clear();
+	foreach (const EntryRef &ref, entries) {
+		if (_statements.contains(ref.type())) continue;
+		const EntryFormatter *formatter = EntryFormatter::getFormatter(ref.type());
+		_statements[ref.type()] = formatter ? formatter->exportStatement() : QString();
+	}
+}
+
+QByteArray TSVEntriesExporter::exportChunk(const QList<EntryRef> &refs) const
+{
+	QMap<int, QStringList> idsByType;
+	foreach (const EntryRef &ref, refs) idsByType[ref.type()] << QString::number(ref.id());
+
+	QHash<EntryRef, QString> lines;
+	QList<EntryRef> toLoad;
+	SQLite::Query query(Database::threadConnection());
+	foreach (int type, idsByType.keys()) {
+		const QString ids(idsByType[type].join(", "));
+		const QString statement(_statements.value(type));
+		if (statement.isEmpty()) {
+			foreach (const QString &id, idsByType[type]) toLoad << EntryRef(type, id.toUInt());
+			continue;
+		}
+		QHash<EntryId, QString> tags;
+		if (query.exec(QString("select id, group_concat(tag, ', ') from (select id, tag from taggedEntries join tags on tags.docid = taggedEntries.tagId where type = %1 and id in (%2) order by tag) group by id").arg(type).arg(ids)))
+			while (query.next()) tags[query.valueUInt(0)] = query.valueString(1);
+		if (!query.exec(QString(statement).replace("{{ids}}", ids))) {
+			qWarning("Cannot export entries of type %d from the database", type);
+			continue;
+		}
+		while (query.next()) {
+			EntryId id = query.valueUInt(0);
+			QString jlpt(query.valueIsNull(4) ? QString() : QString("N%1").arg(query.valueInt(4)));
+			lines[EntryRef(type, id)] = formatLine(query.valueString(1), query.valueString(2), query.valueString(3), jlpt, tags.value(id));
+		}
+	}
+	if (!toLoad.isEmpty()) {
+		foreach (const EntryPointer &entry, EntriesCache::getMany(toLoad))
+			if (entry) lines[EntryRef(entry)] = formatEntry(entry);
+	}
+
+	// Keep the order of the exported entries
+	QString ret;
+	foreach (const EntryRef &ref, refs) ret += lines.value(ref);
+	return ret.toUtf8();
+}
+
+QByteArray TSVEntriesExporter::formatEntries(const QList<EntryPointer> &entries) const
+{
+	QString ret;
+	foreach (const EntryPointer &entry, entries) ret += formatEntry(entry);
+	return ret.toUtf8();
+}
+
+static QString escapeQuotes(const QString &str)
+{
+	QString ret(str);
+	return ret.replace('"', "&quot;");
+}
+
+bool JsEntriesExporter::setTemplate(const QString &tmpl)
+{
+	int pos = tmpl.indexOf("__DATA__");
+	if (pos == -1) return false;
+	_header = (tmpl.left(pos) + "var entries = Array();\n").toUtf8();
+	_footer = tmpl.mid(pos + QString("__DATA__").size()).toUtf8();
+	return true;
+}
+
+QByteArray JsEntriesExporter::formatEntries(const QList<EntryPointer> &entries) const
+{
+	QString ret;
+	foreach (const EntryPointer &entry, entries) {
+		QStringList readings = entry->readings();
+		QStringList meanings = entry->meanings();
+		QString mainRepr(escapeQuotes(entry->mainRepr()));
+		readings.removeAll(mainRepr);
+		QString reading;
+		QString meaning;
+		if (readings.size() > 0) reading = escapeQuotes(readings.join(", "));
+		if (meanings.size() == 1) meaning = escapeQuotes(meanings[0]);
+		else {
+			int cpt = 1;
+			foreach (const QString &str, meanings)
+				meaning += QString(" (%1) %2").arg(cpt++).arg(escapeQuotes(str));
+		}
+		// Entries are pushed since each chunk does not know how many
+		// entries the previous ones contain
+		ret += QString("entries.push([\"%1\", \"%2\", \"%3\"]);\n").arg(mainRepr).arg(reading).arg(meaning);
+	}
+	return ret.toUtf8();
+}
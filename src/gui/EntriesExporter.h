@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_ENTRIES_EXPORTER_H
+#define __GUI_ENTRIES_EXPORTER_H
+
+#include "core/Entry.h"
+#include "core/EntriesCache.h"
+
+#include <QWidget>
+#include <QIODevice>
+#include <QByteArray>
+#include <QMap>
+
+/**
+ * Exports entries to a file. Entries are loaded and formatted by chunks on
+ * a thread pool, and the chunks are written in order as soon as they are
+ * ready so the whole export is never held in memory.
+ *
+ * Subclasses define the format of the file.
+ */
+class EntriesExporter : public QObject
+{
+	Q_OBJECT
+private:
+	bool _canceled;
+
+protected:
+	/**
+	 * Called from the GUI thread with all the exported entries before
+	 * their chunks are exported.
+	 */
+	virtual void prepareExport(const QList<EntryRef> &entries) { Q_UNUSED(entries); }
+
+public:
+	EntriesExporter(QWidget *parent = 0);
+	virtual ~EntriesExporter() {}
+
+	/// Written before the entries
+	virtual QByteArray header() const { return QByteArray(); }
+	/**
+	 * Exports a chunk of entries. Called from the threads of the pool.
+	 *
+	 * The default version loads the entries and formats them with
+	 * formatEntries().
+	 */
+	virtual QByteArray exportChunk(const QList<EntryRef> &refs) const;
+	/**
+	 * Formats a chunk of entries. Called from the threads of the pool, so
+	 * only what is safe to use outside of the GUI thread can be used.
+	 */
+	virtual QByteArray formatEntries(const QList<EntryPointer> &entries) const = 0;
+	/// Written after the entries
+	virtual QByteArray footer() const { return QByteArray(); }
+
+	/**
+	 * Exports entries to out. Returns false if out could not be written or
+	 * the export has been aborted by the user.
+	 */
+	bool exportEntries(const QList<EntryRef> &entries, QIODevice *out);
+	/// True if the last export has been aborted by the user
+	bool wasCanceled() const { return _canceled; }
+};
+
+/**
+ * Exports entries as a tab-separated file of their writing, readings,
+ * meanings, JLPT level and tags.
+ *
+ * Entries which formatter provides an export statement are exported
+ * straight from the databases, without being loaded.
+ */
+class TSVEntriesExporter : public EntriesExporter
+{
+	Q_OBJECT
+private:
+	/// Statements of EntryFormatter::exportStatement(), by entry type
+	QMap<int, QString> _statements;
+
+	static QString formatLine(const QString &writing, const QString &readings, const QString &meanings, const QString &jlpt, const QString &tags);
+	static QString formatEntry(const EntryPointer &entry);
+
+protected:
+	virtual void prepareExport(const QList<EntryRef> &entries);
+
+public:
+	TSVEntriesExporter(QWidget *parent = 0) : EntriesExporter(parent) {}
+
+	virtual QByteArray exportChunk(const QList<EntryRef> &refs) const;
+	virtual QByteArray formatEntries(const QList<EntryPointer> &entries) const;
+};
+
+/**
+ * Exports entries into an HTML flashcards file, by replacing the __DATA__
+ * placeholder of export_template.html with the entries data.
+ */
+class JsEntriesExporter : public EntriesExporter
+{
+	Q_OBJECT
+private:
+	QByteArray _header;
+	QByteArray _footer;
+
+public:
+	JsEntriesExporter(QWidget *parent = 0) : EntriesExporter(parent) {}
+
+	/// Returns false if tmpl has no __DATA__ placeholder
+	bool setTemplate(const QString &tmpl);
+
+	virtual QByteArray header() const { return _header; }
+	virtual QByteArray formatEntries(const QList<EntryPointer> &entries) const;
+	virtual QByteArray footer() const { return _footer; }
+};
+
+#endif
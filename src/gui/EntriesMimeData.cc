@@ -0,0 +1,137 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/EntriesMimeData.h"
+
+#include <QStringList>
+
+#include <algorithm>
+
+const QString EntriesMimeData::format("tagainijisho/entry");
+
+EntriesMimeData::EntriesMimeData(const EntryRefList &refs) : QMimeData(), _refs(refs)
+{
+	if (!refs.isEmpty()) _ranges << qMakePair(0, refs.size() - 1);
+}
+
+EntriesMimeData::EntriesMimeData(const EntryRefList &refs, const QModelIndexList &indexes) : QMimeData(), _refs(refs)
+{
+	QVector<int> rows;
+	rows.reserve(indexes.size());
+	foreach (const QModelIndex &index, indexes)
+		if (index.isValid() && index.row() < refs.size()) rows << index.row();
+	std::sort(rows.begin(), rows.end());
+	foreach (int row, rows) {
+		if (!_ranges.isEmpty() && row <= _ranges.last().second + 1) {
+			_ranges.last().second = qMax(_ranges.last().second, row);
+		}
+		else _ranges << qMakePair(row, row);
+	}
+}
+
+EntriesMimeData::EntriesMimeData(const EntryRef &ref) : QMimeData()
+{
+	_refs << ref;
+	_ranges << qMakePair(0, 0);
+}
+
+bool EntriesMimeData::hasFormat(const QString &mimeType) const
+{
+	if (mimeType == format) return !_ranges.isEmpty();
+	return QMimeData::hasFormat(mimeType);
+}
+
+QStringList EntriesMimeData::formats() const
+{
+	QStringList ret(QMimeData::formats());
+	if (!_ranges.isEmpty()) ret.prepend(format);
+	return ret;
+}
+
+QVariant EntriesMimeData::retrieveData(const QString &mimeType, QVariant::Type type) const
+{
+	if (mimeType != format || _ranges.isEmpty()) return QMimeData::retrieveData(mimeType, type);
+	return encode(entries());
+}
+
+QList<EntryRef> EntriesMimeData::entries() const
+{
+	QList<EntryRef> ret;
+	for (int i = 0; i < _ranges.size(); i++)
+		ret += _refs.mid(_ranges[i].first, _ranges[i].second - _ranges[i].first + 1);
+	return ret;
+}
+
+static void writeVarint(QByteArray &out, quint64 value)
+{
+	while (value >= 0x80) {
+		out += (char)((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+static bool readVarint(const QByteArray &in, int &pos, quint64 &value)
+{
+	value = 0;
+	for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+		quint8 byte = in[pos++];
+		value |= (quint64)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+QByteArray EntriesMimeData::encode(const QList<EntryRef> &refs)
+{
+	QByteArray ret;
+	for (int first = 0; first < refs.size(); ) {
+		int end = first + 1;
+		while (end < refs.size() && refs[end].type() == refs[first].type()) ++end;
+		ret += (char)refs[first].type();
+		writeVarint(ret, end - first);
+		// Ids are zigzag-encoded so that decreasing ids stay short too
+		qint64 previous = 0;
+		for (int i = first; i < end; i++) {
+			qint64 delta = (qint64)refs[i].id() - previous;
+			writeVarint(ret, (quint64)((delta << 1) ^ (delta >> 63)));
+			previous = refs[i].id();
+		}
+		first = end;
+	}
+	return ret;
+}
+
+QList<EntryRef> EntriesMimeData::decode(const QByteArray &data)
+{
+	QList<EntryRef> ret;
+	int pos = 0;
+	while (pos < data.size()) {
+		EntryType type = (quint8)data[pos++];
+		quint64 count;
+		// Every id takes at least one byte
+		if (!readVarint(data, pos, count) || count > (quint64)(data.size() - pos)) return QList<EntryRef>();
+		qint64 id = 0;
+		for (quint64 i = 0; i < count; i++) {
+			quint64 zigzag;
+			if (!readVarint(data, pos, zigzag)) return QList<EntryRef>();
+			id += (qint64)(zigzag >> 1) ^ -(qint64)(zigzag & 1);
+			ret << EntryRef(type, (EntryId)id);
+		}
+	}
+	return ret;
+}
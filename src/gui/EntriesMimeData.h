@@ -0,0 +1,73 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_ENTRIESMIMEDATA_H
+#define __GUI_ENTRIESMIMEDATA_H
+
+#include "core/EntryRefList.h"
+
+#include <QMimeData>
+#include <QModelIndexList>
+#include <QVector>
+#include <QPair>
+
+/**
+ * Mime data of dragged entries, under the tagainijisho/entry format.
+ *
+ * Dragging all the results of a large search must start at once, and is
+ * often cancelled, so the references are only encoded when the drop target
+ * asks for them. Until then, only the dragged rows of the source list are
+ * kept, as ranges.
+ *
+ * The encoding is a sequence of runs of references of the same type: the
+ * type as a byte, the number of references and the differences between
+ * their consecutive ids, all as variable-length integers.
+ */
+class EntriesMimeData : public QMimeData
+{
+	Q_OBJECT
+private:
+	EntryRefList _refs;
+	/// First and last dragged rows of _refs
+	QVector<QPair<int, int> > _ranges;
+
+protected:
+	virtual QVariant retrieveData(const QString &mimeType, QVariant::Type type) const;
+
+public:
+	static const QString format;
+
+	/// Drags all the references of refs
+	EntriesMimeData(const EntryRefList &refs);
+	/// Drags the rows of refs given by indexes
+	EntriesMimeData(const EntryRefList &refs, const QModelIndexList &indexes);
+	/// Drags a single entry
+	EntriesMimeData(const EntryRef &ref);
+
+	virtual bool hasFormat(const QString &mimeType) const;
+	virtual QStringList formats() const;
+
+	/// Returns the dragged references, in the order of their rows
+	QList<EntryRef> entries() const;
+
+	static QByteArray encode(const QList<EntryRef> &refs);
+	/// Returns the references encoded in data, or an empty list if it is
+	/// not valid
+	static QList<EntryRef> decode(const QByteArray &data);
+};
+
+#endif
@@ -15,6 +15,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "core/EntriesCache.h"
 #include "gui/EntriesPrinter.h"
 
 #include "gui/EntryFormatter.h"
@@ -22,6 +23,12 @@
 
 #include <QPrintPreviewDialog>
 #include <QProgressDialog>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QMap>
 
 EntriesPrinter::EntriesPrinter(QWidget* parent) : QObject(parent)
 {
@@ -29,6 +36,167 @@ EntriesPrinter::EntriesPrinter(QWidget* parent) : QObject(parent)
 
 #define PRINT_MINIMAL_SPACING 10.0
 
+/// Number of entries loaded at once when preparing a print job
+#define PRINT_PREFETCH_SIZE 50
+/// Number of entries being formatted ahead of the one being laid out
+#define PRINT_PIPELINE_AHEAD (PRINT_PREFETCH_SIZE * 2)
+
+/**
+ * Loads the entries of indexes from position from at once, and keeps them
+ * alive until the next call.
+ */
+static void prefetchEntries(const QModelIndexList &indexes, int from, QList<EntryPointer> &prefetched)
+{
+	QList<EntryRef> refs;
+	for (int i = from; i < indexes.size() && i < from + PRINT_PREFETCH_SIZE; i++) {
+		EntryRef ref(indexes[i].data(Entry::EntryRefRole).value<EntryRef>());
+		if (ref.isValid()) refs << ref;
+	}
+	prefetched = EntriesCache::getMany(refs);
+}
+
+/// Number of entry heights kept between print jobs
+#define PRINT_HEIGHTS_CACHE_SIZE 10000
+
+QCache<QString, qreal> EntriesPrinter::_heights(PRINT_HEIGHTS_CACHE_SIZE);
+
+/**
+ * An entry of a print job, formatted into a picture that fits the page.
+ */
+struct PrintedEntry {
+	QPicture picture;
+	qreal height;
+	/// False if the entry could not be formatted or does not fit on a page
+	bool valid;
+	/// False if only the height of the entry is known
+	bool formatted;
+	bool done;
+
+	PrintedEntry() : height(0.0), valid(false), formatted(false), done(false) {}
+};
+
+/**
+ * Formats entry, or label if entry is null, into result. Only uses what
+ * is safe to use outside of the GUI thread, provided the formatter of entry
+ * has prepared it.
+ */
+static void formatEntry(const ConstEntryPointer &entry, const QString &label, const QRectF &pageRect, const QFont &baseFont, PrintedEntry &result)
+{
+	result.formatted = true;
+	QRectF usedSpace;
+	QPainter picPainter(&result.picture);
+	// An entry, print it
+	if (entry) {
+		const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
+		if (!formatter) return;
+		formatter->draw(entry, picPainter, pageRect, usedSpace, baseFont);
+		if (!pageRect.contains(usedSpace)) {
+			qDebug() << "Warning: entry does not fit on whole page, giving up this one...";
+			return;
+		}
+	}
+	// Not an entry, print the text role
+	else {
+		picPainter.save();
+		QFont font;
+		font.setPointSize(font.pointSize() + 10);
+		font.setItalic(true);
+		picPainter.setFont(font);
+		picPainter.drawText(pageRect, Qt::TextWordWrap | Qt::TextExpandTabs, label);
+		usedSpace = picPainter.boundingRect(pageRect, Qt::TextWordWrap | Qt::TextExpandTabs, label);
+		picPainter.drawLine(usedSpace.bottomLeft(), QPointF(pageRect.right(), usedSpace.bottomRight().y()));
+		usedSpace.moveBottom(usedSpace.bottom() + 3);
+		picPainter.restore();
+	}
+	picPainter.end();
+	result.picture.setBoundingRect(usedSpace.toRect());
+	result.height = result.picture.height();
+	result.valid = true;
+}
+
+/**
+ * Returns the key identifying the layout of entry, or label if entry is
+ * null, on a page of the given size.
+ */
+static QString layoutKey(const ConstEntryPointer &entry, const QString &label, const QRectF &pageRect, const QFont &baseFont)
+{
+	QString ret(QString("%1:%2:%3:").arg(baseFont.key()).arg(pageRect.width()).arg(pageRect.height()));
+	if (!entry) return ret + "label:" + label;
+	const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
+	ret += QString("%1:%2:%3:").arg(entry->type()).arg(entry->id()).arg(entry->version());
+	if (formatter) ret += formatter->drawSettingsKey();
+	return ret;
+}
+
+/**
+ * The entries of a print job, formatted by the threads of a pool and
+ * laid out in order by the GUI thread.
+ */
+struct PrintPipeline {
+	QMutex mutex;
+	QWaitCondition formatted;
+	QVector<PrintedEntry> entries;
+
+	/// Sets the result of entry index and wakes up the layout
+	void setResult(int index, const PrintedEntry &result)
+	{
+		QMutexLocker lock(&mutex);
+		entries[index] = result;
+		entries[index].done = true;
+		formatted.wakeAll();
+	}
+	/// Waits for entry index to be formatted and takes its result
+	PrintedEntry takeResult(int index)
+	{
+		QMutexLocker lock(&mutex);
+		while (!entries[index].done) formatted.wait(&mutex);
+		PrintedEntry ret(entries[index]);
+		entries[index] = PrintedEntry();
+		return ret;
+	}
+};
+
+/**
+ * Formats one entry of a print job. The job keeps a reference to the entry
+ * so it is not dropped from the cache meanwhile.
+ */
+class FormatEntryJob : public QRunnable
+{
+private:
+	PrintPipeline *_pipeline;
+	int _index;
+	ConstEntryPointer _entry;
+	QString _label;
+	QRectF _pageRect;
+	QFont _baseFont;
+
+public:
+	FormatEntryJob(PrintPipeline *pipeline, int index, const ConstEntryPointer &entry, const QString &label, const QRectF &pageRect, const QFont &baseFont) : _pipeline(pipeline), _index(index), _entry(entry), _label(label), _pageRect(pageRect), _baseFont(baseFont) {}
+
+	virtual void run()
+	{
+		PrintedEntry result;
+		formatEntry(_entry, _label, _pageRect, _baseFont, result);
+		_pipeline->setResult(_index, result);
+	}
+};
+
+/**
+ * Formats entry index of the pipeline, on the pool if its formatter can
+ * prepare it.
+ */
+static void submitEntry(PrintPipeline &pipeline, QThreadPool &pool, int index, const ConstEntryPointer &entry, const QString &label, const QRectF &pageRect, const QFont &baseFont)
+{
+	const EntryFormatter *formatter(entry ? EntryFormatter::getFormatter(entry) : 0);
+	// Entries that cannot be prepared are formatted right away
+	if (formatter && !formatter->prepareDraw(entry)) {
+		PrintedEntry result;
+		formatEntry(entry, label, pageRect, baseFont, result);
+		pipeline.setResult(index, result);
+	}
+	else pool.start(new FormatEntryJob(&pipeline, index, entry, label, pageRect, baseFont));
+}
+
 void EntriesPrinter::printPageOfEntries(const QList<QPicture> &entries, QPainter *painter, qreal height)
 {
 	// First adjust the distance between entries
@@ -69,67 +237,144 @@ void EntriesPrinter::prepareAndPrintJob(QPrinter* printer)
 	progressDialog.setWindowModality(Qt::WindowModal);
 	progressDialog.show();
 
-	// Print entries page by page
-	int pageNbr = 1;
-	QList<QPicture> waitingEntries;
 	QPainter painter(printer);
 	QRectF pageRect = painter.window();
-	QRectF remainingSpace = pageRect;
-	for (int i = 0; i < _entries.size(); i++) {
-		if (progressDialog.wasCanceled()) return;
-		QRectF usedSpace;
-		QPicture tPicture;
-		QPainter picPainter(&tPicture);
-		ConstEntryPointer entry(_entries[i].data(Entry::EntryRole).value<EntryPointer>());
-		// An entry, print it
-		if (entry) {
-			const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
-			if (!formatter) continue;
-			formatter->draw(entry, picPainter, pageRect, usedSpace, _baseFont);
-			if (!pageRect.contains(usedSpace)) {
-				qDebug() << "Warning: entry does not fit on whole page, giving up this one...";
-				continue;
-			}
+	QList<EntryPointer> prefetched;
+	// Entries are formatted ahead by the pool while pages are laid out.
+	// The pool is declared last so its threads are done before the
+	// pipeline is destroyed.
+	PrintPipeline pipeline;
+	pipeline.entries.resize(_entries.size());
+	QThreadPool pool;
+
+	// First lay the entries out on pages. Only the entries which height is
+	// unknown are formatted, and their pictures kept if their page is to
+	// be printed. Pages which entries have all been formatted are printed
+	// right away if the previous ones already are.
+	QVector<int> entriesPages(_entries.size(), 0);
+	QVector<QString> keys(_entries.size());
+	QMap<int, QPicture> pictures;
+	QList<int> pageEntries;
+	bool pageFormatted = true;
+	int printedUpTo = fromPage == -1 ? 0 : fromPage - 1;
+	int printedPages = 0;
+	qreal remainingHeight = pageRect.height();
+	int pageNbr = 1;
+	int lastEntry = _entries.size();
+	int submitted = 0;
+	for (int i = 0; i <= _entries.size(); i++) {
+		if (progressDialog.wasCanceled()) {
+			pool.clear();
+			return;
 		}
-		// Not an entry, print the text role
-		else {
-			QString label(_entries[i].data(Qt::DisplayRole).toString());
-			picPainter.save();
-			QFont font;
-			font.setPointSize(font.pointSize() + 10);
-			font.setItalic(true);
-			picPainter.setFont(font);
-			picPainter.drawText(pageRect, Qt::TextWordWrap | Qt::TextExpandTabs, label);
-			usedSpace = picPainter.boundingRect(pageRect, Qt::TextWordWrap | Qt::TextExpandTabs, label);
-			picPainter.drawLine(usedSpace.bottomLeft(), QPointF(pageRect.right(), usedSpace.bottomRight().y()));
-			usedSpace.moveBottom(usedSpace.bottom() + 3);
-			picPainter.restore();
+		PrintedEntry printed;
+		if (i < _entries.size()) {
+			// Keep the pool busy with the next entries
+			for (; submitted < _entries.size() && submitted <= i + PRINT_PIPELINE_AHEAD; submitted++) {
+				if (submitted % PRINT_PREFETCH_SIZE == 0) prefetchEntries(_entries, submitted, prefetched);
+				ConstEntryPointer entry(_entries[submitted].data(Entry::EntryRole).value<EntryPointer>());
+				QString label;
+				if (!entry) label = _entries[submitted].data(Qt::DisplayRole).toString();
+				keys[submitted] = layoutKey(entry, label, pageRect, _baseFont);
+				qreal *height = _heights.object(keys[submitted]);
+				if (height) {
+					PrintedEntry result;
+					result.height = *height;
+					result.valid = *height >= 0;
+					pipeline.setResult(submitted, result);
+				}
+				else submitEntry(pipeline, pool, submitted, entry, label, pageRect, _baseFont);
+			}
+
+			printed = pipeline.takeResult(i);
+			if (printed.formatted) _heights.insert(keys[i], new qreal(printed.valid ? printed.height : -1.0));
+			if (!printed.valid) continue;
 		}
-		picPainter.end();
-		tPicture.setBoundingRect(usedSpace.toRect());
 		// Do we need a new page here?
-		if (remainingSpace.height() < usedSpace.height()) {
-			// Print the current page
-			if (fromPage == -1 || (pageNbr >= fromPage && pageNbr <= toPage)) {
-				// If not on the first page, get a new page
-				if (pageNbr > 1 && pageNbr > fromPage) printer->newPage();
+		if (i == _entries.size() || remainingHeight < printed.height) {
+			// Print the current page if it is the next one and is ready
+			if (pageNbr == printedUpTo + 1 && pageFormatted) {
+				if (printedPages++) printer->newPage();
+				QList<QPicture> waitingEntries;
+				foreach (int entryIndex, pageEntries) waitingEntries << pictures.take(entryIndex);
 				printPageOfEntries(waitingEntries, &painter, pageRect.height());
+				printedUpTo = pageNbr;
 			}
-			remainingSpace = pageRect;
-			waitingEntries.clear();
+			if (i == _entries.size()) break;
+			remainingHeight = pageRect.height();
+			pageEntries.clear();
+			pageFormatted = true;
 			++pageNbr;
 			// Optimize if we already reached the last page
-			if (fromPage != -1 && pageNbr > toPage) return;
+			if (fromPage != -1 && pageNbr > toPage) {
+				lastEntry = i;
+				break;
+			}
 		}
-		waitingEntries << tPicture;
+		entriesPages[i] = pageNbr;
+		pageEntries << i;
+		if (!printed.formatted) pageFormatted = false;
+		else if (fromPage == -1 || pageNbr >= fromPage) pictures[i] = printed.picture;
 		// Update remaining space, taking care to keep some white between entries
-		remainingSpace.setTop(remainingSpace.top() + usedSpace.height() + PRINT_MINIMAL_SPACING);
+		remainingHeight -= printed.height + PRINT_MINIMAL_SPACING;
 
 		progressDialog.setValue(i);
 	}
+	pool.clear();
+	pool.waitForDone();
 
-	if (fromPage == -1 || (pageNbr >= fromPage && pageNbr <= toPage)) {
-		if (pageNbr > 1 && pageNbr > fromPage) printer->newPage();
+	// Then format the remaining entries of the pages left to print, and
+	// print them as soon as they are complete
+	QModelIndexList missingIndexes;
+	QList<int> missing;
+	for (int i = 0; i < lastEntry; i++) {
+		if (entriesPages[i] <= printedUpTo || pictures.contains(i)) continue;
+		missingIndexes << _entries[i];
+		missing << i;
+	}
+	pipeline.entries.fill(PrintedEntry());
+	progressDialog.setLabelText(tr("Printing pages..."));
+	progressDialog.setRange(0, missing.size());
+	QList<QPicture> waitingEntries;
+	int currentPage = 0;
+	int nextMissing = 0;
+	submitted = 0;
+	for (int i = 0; i < lastEntry; i++) {
+		if (entriesPages[i] <= printedUpTo) continue;
+		if (progressDialog.wasCanceled()) {
+			pool.clear();
+			return;
+		}
+		if (entriesPages[i] != currentPage) {
+			if (currentPage) {
+				if (printedPages++) printer->newPage();
+				printPageOfEntries(waitingEntries, &painter, pageRect.height());
+				waitingEntries.clear();
+			}
+			currentPage = entriesPages[i];
+		}
+		if (pictures.contains(i)) {
+			waitingEntries << pictures.take(i);
+			continue;
+		}
+		// Keep the pool busy with the next missing entries
+		for (; submitted < missing.size() && submitted <= nextMissing + PRINT_PIPELINE_AHEAD; submitted++) {
+			if (submitted % PRINT_PREFETCH_SIZE == 0) prefetchEntries(missingIndexes, submitted, prefetched);
+			const QModelIndex &index(missingIndexes[submitted]);
+			ConstEntryPointer entry(index.data(Entry::EntryRole).value<EntryPointer>());
+			QString label;
+			if (!entry) label = index.data(Qt::DisplayRole).toString();
+			submitEntry(pipeline, pool, missing[submitted], entry, label, pageRect, _baseFont);
+		}
+		PrintedEntry printed(pipeline.takeResult(i));
+		if (printed.valid) {
+			waitingEntries << printed.picture;
+			_heights.insert(keys[i], new qreal(printed.height));
+		}
+		progressDialog.setValue(++nextMissing);
+	}
+	if (currentPage) {
+		if (printedPages) printer->newPage();
 		printPageOfEntries(waitingEntries, &painter, pageRect.height());
 	}
 }
@@ -26,6 +26,7 @@
 #include <QFont>
 #include <QPrinter>
 #include <QPicture>
+#include <QCache>
 
 /**
  * Pretty-prints entries, either in regular of booklet form.
@@ -36,6 +37,12 @@ class EntriesPrinter : public QObject
 private:
 	QFont _baseFont; 
 	QModelIndexList _entries;
+	/**
+	 * Heights of the entries formatted by previous jobs, indexed by their
+	 * layout key, so pages can be laid out without formatting their
+	 * entries. A negative height means the entry cannot be printed.
+	 */
+	static QCache<QString, qreal> _heights;
 
 	/**
 	 * Prints all the given entries (pre-printed into QPictures) on one page. The
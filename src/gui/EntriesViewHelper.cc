@@ -18,11 +18,13 @@
 #include "core/Paths.h"
 #include <algorithm>
 #include <core/Database.h>
+#include "core/EntriesCache.h"
 #include "gui/EntriesViewHelper.h"
 #include "gui/EntryMenu.h"
 #include "gui/EditEntryNotesDialog.h"
 #include "gui/TagsDialogs.h"
 #include "gui/EntriesPrinter.h"
+#include "gui/EntriesExporter.h"
 #include "gui/BatchHandler.h"
 
 #include <QAction>
@@ -102,16 +104,22 @@ QList<EntryPointer> EntriesViewHelper::selectedEntries() const
 	progressDialog.setWindowModality(Qt::WindowModal);
 
 	QList<EntryPointer> selectedEntries;
-	int i = 0;
 	int completed = true;
-	foreach(const QModelIndex &index, selection) {
+	// Load the entries by chunks, which is much faster than one by one
+	const int chunkSize = 100;
+	for (int i = 0; i < selection.size(); i += chunkSize) {
 		if (progressDialog.wasCanceled()) {
 			completed = false;
 			break;
 		}
-		progressDialog.setValue(i++);
-		EntryPointer entry(index.data(Entry::EntryRole).value<EntryPointer>());
-		if (entry) selectedEntries << entry;
+		progressDialog.setValue(i);
+		QList<EntryRef> refs;
+		for (int j = i; j < selection.size() && j < i + chunkSize; j++) {
+			EntryRef ref(selection[j].data(Entry::EntryRefRole).value<EntryRef>());
+			if (ref.isValid()) refs << ref;
+		}
+		foreach (const EntryPointer &entry, EntriesCache::getMany(refs))
+			if (entry) selectedEntries << entry;
 	}
 	if (!completed) return QList<EntryPointer>();
 	else return selectedEntries;
@@ -375,6 +383,20 @@ void EntriesViewHelper::printBookletPreview()
 	EntriesPrinter(client()).printBookletPreview(getEntriesToProcess(printer.printRange() & QPrinter::Selection), &printer);
 }
 
+/**
+ * Returns the references of the entries of indexes. Lists are skipped.
+ */
+static QList<EntryRef> entryRefs(const QModelIndexList &indexes)
+{
+	QList<EntryRef> ret;
+	foreach (const QModelIndex &idx, indexes) {
+		EntryRef ref(idx.data(Entry::EntryRefRole).value<EntryRef>());
+		// We cannot "export" lists due to the file purpose
+		if (ref.isValid()) ret << ref;
+	}
+	return ret;
+}
+
 void EntriesViewHelper::tabExport()
 {
 	QString exportFile = QFileDialog::getSaveFileName(0, tr("Export to tab-separated file..."), "export.tsv");
@@ -385,43 +407,15 @@ void EntriesViewHelper::tabExport()
 		return;
 	}
 
-	QModelIndexList entries(getEntriesToProcess());
-
-	// Dummy entry to notify Anki that tab is our delimiter
-	//outFile.write("\t\t\n");
-	foreach (const QModelIndex &idx, entries) {
-		ConstEntryPointer entry(idx.data(Entry::EntryRole).value<EntryPointer>());
-		// We cannot "export" lists due to the file purpose
-		if (!entry) continue;
-		QStringList writings = entry->writings();
-		QStringList readings = entry->readings();
-		QStringList meanings = entry->meanings();
-		QString writing;
-		QString reading;
-		QString meaning;
-		if (writings.size() > 0) writing = writings[0];
-		if (readings.size() > 0) reading = readings[0];
-		if (meanings.size() == 1) meaning += " " + meanings[0];
-		else {
-			int cpt = 1;
-			foreach (const QString &str, meanings)
-				meaning += QString(" (%1) %2").arg(cpt++).arg(str);
-		}
-		if (outFile.write(QString("%1\t%2\t%3\n").arg(writing).arg(readings.join(", ")).arg(meanings.join(", ")).toUtf8()) == -1) {
-			QMessageBox::warning(0, tr("Error writing file"), QString(tr("Error while writing file %1.")).arg(exportFile));
-			return;
-		}
+	TSVEntriesExporter exporter(client());
+	if (!exporter.exportEntries(entryRefs(getEntriesToProcess()), &outFile) && !exporter.wasCanceled()) {
+		QMessageBox::warning(0, tr("Error writing file"), QString(tr("Error while writing file %1.")).arg(exportFile));
+		return;
 	}
 
 	outFile.close();
 }
 
-static QString escapeQuotes(const QString &str)
-{
-	QString ret(str);
-	return ret.replace('"', "&quot;");
-}
-
 void EntriesViewHelper::jsExport()
 {
 	QString exportFile = QFileDialog::getSaveFileName(0, tr("Export to HTML flashcard file..."), "flashcard.html");
@@ -432,46 +426,18 @@ void EntriesViewHelper::jsExport()
 		return;
 	}
 
-	QModelIndexList entries(getEntriesToProcess());
-	QList<ConstEntryPointer> realEntries;
-
-	foreach (const QModelIndex &idx, entries) {
-		ConstEntryPointer entry(idx.data(Entry::EntryRole).value<EntryPointer>());
-		// We cannot "export" lists due to the file purpose
-		if (!entry) continue;
-		realEntries << entry;
-	}
-
 	QFile tmplFile(lookForFile("export_template.html"));
-	if (!tmplFile.open(QIODevice::ReadOnly)) {
+	JsEntriesExporter exporter(client());
+	if (!tmplFile.open(QIODevice::ReadOnly) || !exporter.setTemplate(QString::fromUtf8(tmplFile.readAll()))) {
 		QMessageBox::warning(0, tr("Cannot open template file"), QString(tr("Unable to open template file!")).arg(exportFile));
 		return;
 	}
 
-	QString tmpl(QString::fromUtf8(tmplFile.readAll()));
-
-	int idx = 0;
-	QString data(QString("var entries = Array();\nfor (var i = 0; i < %1; i++) entries[i] = Array();\n").arg(realEntries.size()).toUtf8());
-	foreach (const ConstEntryPointer &entry, realEntries) {
-		QStringList readings = entry->readings();
-		QStringList meanings = entry->meanings();
-		QString mainRepr(escapeQuotes(entry->mainRepr()));
-		readings.removeAll(mainRepr);
-		QString reading;
-		QString meaning;
-		if (readings.size() > 0) reading = escapeQuotes(readings.join(", "));
-		if (meanings.size() == 1) meaning = escapeQuotes(meanings[0]);
-		else {
-			int cpt = 1;
-			foreach (const QString &str, meanings)
-				meaning += QString(" (%1) %2").arg(cpt++).arg(escapeQuotes(str));
-		}
-		data += QString("entries[%1][0]=\"%2\";\nentries[%1][1]=\"%3\";\nentries[%1][2]=\"%4\";\n").arg(idx++).arg(mainRepr).arg(reading).arg(meaning);
+	if (!exporter.exportEntries(entryRefs(getEntriesToProcess()), &outFile) && !exporter.wasCanceled()) {
+		QMessageBox::warning(0, tr("Error writing file"), QString(tr("Error while writing file %1.")).arg(exportFile));
+		return;
 	}
 
-	tmpl.replace("__DATA__", data);
-	outFile.write(tmpl.toUtf8());
-
 	outFile.close();
 }
 
@@ -16,11 +16,13 @@
  */
 
 #include "gui/EntryDelegate.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
 
 #include <QPainter>
 #include <QApplication>
 
-EntryDelegateLayout::EntryDelegateLayout(QObject* parent, EntryDelegateLayout::DisplayMode displayMode, const QString& textFont, const QString& kanjiFont, const QString& kanaFont) : QObject(parent), _displayMode(displayMode)
+EntryDelegateLayout::EntryDelegateLayout(QObject* parent, EntryDelegateLayout::DisplayMode displayMode, const QString& textFont, const QString& kanjiFont, const QString& kanaFont) : QObject(parent), _displayMode(displayMode), _generation(0)
 {
 	if (!textFont.isEmpty())
 		_font[DefaultText].fromString(textFont);
@@ -33,12 +35,14 @@ EntryDelegateLayout::EntryDelegateLayout(QObject* parent, EntryDelegateLayout::D
 void EntryDelegateLayout::setFont(FontRole role, const QFont &font)
 {
 	_font[role] = font;
+	++_generation;
 	emit layoutHasChanged();
 }
 
 void EntryDelegateLayout::setDisplayMode(DisplayMode mode)
 {
 	_displayMode = mode;
+	++_generation;
 	emit layoutHasChanged();
 }
 
@@ -49,7 +53,7 @@ void EntryDelegateLayout::updateConfig(const QVariant &value)
 	setProperty(from->name().toLatin1().constData(), value);
 }
 
-EntryDelegate::EntryDelegate(EntryDelegateLayout* dLayout, QObject* parent) : QStyledItemDelegate(parent), layout(dLayout), _hiddenIcons(0)
+EntryDelegate::EntryDelegate(EntryDelegateLayout* dLayout, QObject* parent) : QStyledItemDelegate(parent), layout(dLayout), _hiddenIcons(0), _uniformHeight(false), _rowLayouts(500), _rowHeight(-1), _layoutGeneration(dLayout->generation())
 {
 	_tagsIcon.load(":/images/icons/tags.png");
 	_tagsIcon = _tagsIcon.scaledToHeight(15);
@@ -62,42 +66,66 @@ EntryDelegate::EntryDelegate(EntryDelegateLayout* dLayout, QObject* parent) : QS
 QSize EntryDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
 {
 	int maxHeight = -1;
-	if (index.isValid()) {
+	if (!_uniformHeight && index.isValid()) {
 		QVariant sizeHint(index.model()->data(index, Qt::SizeHintRole));
 		if (!sizeHint.isNull() && sizeHint.type() == QVariant::Size) maxHeight = sizeHint.toSize().height();
 	}
-	if (maxHeight < 0) {
-		if (layout->displayMode() == EntryDelegateLayout::OneLine) maxHeight = qMax(QFontMetrics(layout->kanjiFont()).height(), qMax(QFontMetrics(layout->kanaFont()).height(), QFontMetrics(layout->textFont()).height()));
-		else maxHeight = qMax(QFontMetrics(layout->kanjiFont()).height(), QFontMetrics(layout->kanaFont()).height()) + QFontMetrics(layout->textFont()).height();
-	}
+	if (maxHeight < 0) maxHeight = rowHeight();
 	// This margin is added by the paint method
 	maxHeight += 4;
 	return QSize(300, maxHeight);
 }
 
-void EntryDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+int EntryDelegate::rowHeight() const
 {
-	EntryPointer entry = index.data(Entry::EntryRole).value<EntryPointer>();
-	if (!entry) { QStyledItemDelegate::paint(painter, option, index); return; }
-	const bool enabled = option.state & QStyle::State_Enabled;
+	checkLayout();
+	if (_rowHeight < 0) {
+		if (layout->displayMode() == EntryDelegateLayout::OneLine) _rowHeight = qMax(QFontMetrics(layout->kanjiFont()).height(), qMax(QFontMetrics(layout->kanaFont()).height(), QFontMetrics(layout->textFont()).height()));
+		else _rowHeight = qMax(QFontMetrics(layout->kanjiFont()).height(), QFontMetrics(layout->kanaFont()).height()) + QFontMetrics(layout->textFont()).height();
+	}
+	return _rowHeight;
+}
 
-	QRect wholeAreaRect = option.rect.adjusted(2, 2, -2, 2);
+void EntryDelegate::paintPlaceholder(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
 	painter->save();
-
-	// Draw the background
 	QStyleOptionViewItem opt = option;
 	initStyleOption(&opt, index);
 	QStyle *style = QApplication::style();
 	style->drawPrimitive(QStyle::PE_PanelItemViewItem, &opt, painter);
+	painter->setFont(layout->textFont());
+	painter->setPen(option.palette.color(QPalette::Disabled, QPalette::Text));
+	painter->drawText(option.rect.adjusted(2, 2, -2, -2), Qt::AlignLeft | Qt::AlignVCenter, QString::fromUtf8("…"));
+	painter->restore();
+}
 
-	QRect mainBbox;
-	painter->setFont(layout->kanjiFont());
-	int mainDescent = painter->fontMetrics().descent();
-	QString mainRepr(entry->mainRepr());
-	QStringList writings(entry->writings());
-	QStringList readings(entry->readings());
-	mainBbox = painter->boundingRect(wholeAreaRect, Qt::AlignTop | Qt::AlignLeft, mainRepr);
-	style->drawItemText(painter, mainBbox, Qt::AlignBaseline, QApplication::palette(), enabled, mainRepr);
+void EntryDelegate::checkLayout() const
+{
+	if (_layoutGeneration == layout->generation()) return;
+	_rowLayouts.clear();
+	_rowHeight = -1;
+	_layoutGeneration = layout->generation();
+}
+
+const EntryDelegate::RowLayout *EntryDelegate::rowLayout(const EntrySummary &entry, const QRect &area) const
+{
+	checkLayout();
+	RowLayout *row = _rowLayouts.object(entry.ref());
+	if (row && row->version == entry.version() && row->size == area.size()) return row;
+
+	row = new RowLayout;
+	row->version = entry.version();
+	row->size = area.size();
+	QRect wholeAreaRect(QPoint(0, 0), area.size());
+	QFontMetrics kanjiMetrics(layout->kanjiFont()), kanaMetrics(layout->kanaFont()), textMetrics(layout->textFont());
+
+	int mainDescent = kanjiMetrics.descent();
+	QString mainRepr(entry.mainRepr());
+	QStringList writings(entry.writings());
+	QStringList readings(entry.readings());
+	QRect mainBbox = kanjiMetrics.boundingRect(wholeAreaRect, Qt::AlignTop | Qt::AlignLeft, mainRepr);
+	row->mainRepr.setText(mainRepr);
+	row->mainPos = mainBbox.topLeft();
 
 	// Used for alternate writings and readings
 	QString s = "  ";
@@ -113,52 +141,107 @@ void EntryDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
 			s += "(" + readings.join(", ") + ")";
 		}
 	}
-	painter->setFont(layout->kanaFont());
-	int readDescent = painter->fontMetrics().descent();
-	s = QFontMetrics(layout->kanaFont()).elidedText(s, Qt::ElideRight, wholeAreaRect.width() - mainBbox.width());
+	int readDescent = kanaMetrics.descent();
+	s = kanaMetrics.elidedText(s, Qt::ElideRight, wholeAreaRect.width() - mainBbox.width());
 	QRect readRect(wholeAreaRect);
 	readRect.setLeft(mainBbox.right());
 	readRect.setBottom(mainBbox.bottom() - mainDescent + readDescent);
-	QRect readBbox = painter->boundingRect(readRect, Qt::AlignLeft | Qt::AlignBottom, s);
-	style->drawItemText(painter, readBbox, Qt::AlignBaseline, QApplication::palette(), enabled, s);
+	QRect readBbox = kanaMetrics.boundingRect(readRect, Qt::AlignLeft | Qt::AlignBottom, s);
+	row->readings.setText(s);
+	row->readingsPos = readBbox.topLeft();
 
 	s.clear();
-	if (entry->meanings().size() == 1) {
-		s = entry->meanings()[0];
+	if (entry.meanings().size() == 1) {
+		s = entry.meanings()[0];
 		if (!s.isEmpty()) s[0] = s[0].toUpper();
 	}
-	else for (int i = 0; i < entry->meanings().size(); i++) {
-		s += QString("(%1) %2 ").arg(i + 1).arg(entry->meanings()[i]);
+	else for (int i = 0; i < entry.meanings().size(); i++) {
+		s += QString("(%1) %2 ").arg(i + 1).arg(entry.meanings()[i]);
 	}
-	painter->setFont(layout->textFont());
-	int defDescent = painter->fontMetrics().descent();
+	int defDescent = textMetrics.descent();
 	QRect defRect(wholeAreaRect);
 	QRect defBbox;
 	if (layout->displayMode() == EntryDelegateLayout::OneLine) {
 		defRect.setLeft(readBbox.right());
 		defRect.setBottom(mainBbox.bottom() - mainDescent + defDescent);
-		defBbox = painter->boundingRect(defRect, Qt::AlignLeft | Qt::AlignBottom, s);
-		s = QFontMetrics(layout->textFont()).elidedText(s, Qt::ElideRight, wholeAreaRect.width() - (mainBbox.width() + readBbox.width()));
+		defBbox = textMetrics.boundingRect(defRect, Qt::AlignLeft | Qt::AlignBottom, s);
+		s = textMetrics.elidedText(s, Qt::ElideRight, wholeAreaRect.width() - (mainBbox.width() + readBbox.width()));
 	} else {
 		defRect.setBottom(defRect.bottom() - defDescent);
-		defBbox = painter->boundingRect(defRect, Qt::AlignLeft | Qt::AlignBottom, s);
-		s = QFontMetrics(layout->textFont()).elidedText(s, Qt::ElideRight, wholeAreaRect.width());
+		defBbox = textMetrics.boundingRect(defRect, Qt::AlignLeft | Qt::AlignBottom, s);
+		s = textMetrics.elidedText(s, Qt::ElideRight, wholeAreaRect.width());
+	}
+	row->meanings.setText(s);
+	// The meanings are aligned on the bottom of their box
+	row->meaningsPos = QPoint(defBbox.left(), defBbox.bottom() + 1 - textMetrics.height());
+
+	row->mainRepr.setTextFormat(Qt::PlainText);
+	row->readings.setTextFormat(Qt::PlainText);
+	row->meanings.setTextFormat(Qt::PlainText);
+	row->mainRepr.prepare(QTransform(), layout->kanjiFont());
+	row->readings.prepare(QTransform(), layout->kanaFont());
+	row->meanings.prepare(QTransform(), layout->textFont());
+	_rowLayouts.insert(entry.ref(), row);
+	return row;
+}
+
+static PerfHistogram paintTime("Entry delegate paint");
+
+void EntryDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	PerfTimer timer(paintTime);
+	TRACE_SCOPE("Entry delegate paint");
+	// Models that load summaries in the background tell us whether the
+	// summary is already there, otherwise we build it from the entry
+	EntrySummary entry;
+	QVariant summary(index.data(Entry::SummaryRole));
+	if (summary.isValid()) {
+		entry = summary.value<EntrySummary>();
+		if (entry.isNull() && index.data(Entry::EntryRefRole).value<EntryRef>().isValid()) {
+			paintPlaceholder(painter, option, index);
+			return;
+		}
+	}
+	else {
+		EntryPointer e(index.data(Entry::EntryRole).value<EntryPointer>());
+		if (e) entry = EntrySummary(*e);
 	}
-	style->drawItemText(painter, defBbox, Qt::AlignLeft | Qt::AlignBottom, QApplication::palette(), enabled, s);
+	if (entry.isNull()) { QStyledItemDelegate::paint(painter, option, index); return; }
+	const bool enabled = option.state & QStyle::State_Enabled;
+
+	QRect wholeAreaRect = option.rect.adjusted(2, 2, -2, 2);
+	painter->save();
+
+	// Draw the background
+	QStyleOptionViewItem opt = option;
+	initStyleOption(&opt, index);
+	QStyle *style = QApplication::style();
+	style->drawPrimitive(QStyle::PE_PanelItemViewItem, &opt, painter);
+
+	// Text has been laid out the last time this row was painted with the
+	// same size, only draw it
+	const RowLayout *row(rowLayout(entry, wholeAreaRect));
+	if (!enabled) painter->setPen(option.palette.color(QPalette::Disabled, QPalette::Text));
+	painter->setFont(layout->kanjiFont());
+	painter->drawStaticText(wholeAreaRect.topLeft() + row->mainPos, row->mainRepr);
+	painter->setFont(layout->kanaFont());
+	painter->drawStaticText(wholeAreaRect.topLeft() + row->readingsPos, row->readings);
+	painter->setFont(layout->textFont());
+	painter->drawStaticText(wholeAreaRect.topLeft() + row->meaningsPos, row->meanings);
 
 	// Now display property icons if the entry has any.
 	int iconPos = wholeAreaRect.right() - 5;
-	if (!entry->notes().isEmpty() && !isHidden(NOTES_ICON)) {
+	if (entry.hasNotes() && !isHidden(NOTES_ICON)) {
 		iconPos -= _notesIcon.width() + 5;
 		QRect rect = QRect(iconPos, wholeAreaRect.top(), _notesIcon.width(), _notesIcon.height());
 		style->drawItemPixmap(painter, rect, 0, _notesIcon);
 	}
-	if (!entry->tags().isEmpty() && !isHidden(TAGS_ICON)) {
+	if (entry.hasTags() && !isHidden(TAGS_ICON)) {
 		iconPos -= _tagsIcon.width() + 5;
 		QRect rect = QRect(iconPos, wholeAreaRect.top(), _tagsIcon.width(), _tagsIcon.height());
 		style->drawItemPixmap(painter, rect, 0, _tagsIcon);
 	}
-	if (!entry->lists().isEmpty() && !isHidden(LISTS_ICON)) {
+	if (entry.hasLists() && !isHidden(LISTS_ICON)) {
 		iconPos -= _listsIcon.width() + 5;
 		QRect rect = QRect(iconPos, wholeAreaRect.top(), _listsIcon.width(), _listsIcon.height());
 		style->drawItemPixmap(painter, rect, 0, _listsIcon);
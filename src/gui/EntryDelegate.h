@@ -19,7 +19,10 @@
 #define __GUI_ENTRYDELEGATE_H
 
 #include "core/EntriesCache.h"
+#include "core/EntrySummary.h"
 #include <QStyledItemDelegate>
+#include <QStaticText>
+#include <QCache>
 
 class EntryDelegateLayout : public QObject
 {
@@ -31,6 +34,8 @@ public:
 private:
 	QFont _font[MAX_FONTS];
 	DisplayMode _displayMode;
+	/// Incremented every time the fonts or display mode change
+	quint32 _generation;
 
 	void _fontsChanged();
 	QFont _defaultFont(FontRole role) const;
@@ -42,6 +47,9 @@ public:
 	const QFont &kanaFont() const { return _font[Kana]; }
 	const QFont &kanjiFont() const { return _font[Kanji]; }
 	DisplayMode displayMode() const { return _displayMode; }
+	/// Allows delegates to know whether what they computed from this
+	/// layout is still valid
+	quint32 generation() const { return _generation; }
 
 	void setFont(FontRole role, const QFont &font);
 	void setDisplayMode(DisplayMode mode);
@@ -74,6 +82,31 @@ protected:
 	 * Used to prevent displaying some icons in views where they are implicit, e.g. list views
 	 */
 	quint8 _hiddenIcons;
+	bool _uniformHeight;
+
+	/// Drawn in place of entries that are being loaded in the background
+	void paintPlaceholder(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+	/**
+	 * Text of a row laid out for a given size of its area. Positions are
+	 * relative to the top-left corner of the area.
+	 */
+	struct RowLayout {
+		quint32 version;
+		QSize size;
+		QStaticText mainRepr, readings, meanings;
+		QPoint mainPos, readingsPos, meaningsPos;
+	};
+	/// Layouts of the last rows painted, so repaints only need to draw them
+	mutable QCache<EntryRef, RowLayout> _rowLayouts;
+	/// Height of rows which model does not give one, -1 if not computed yet
+	mutable int _rowHeight;
+	/// Generation of the layout the caches above have been computed with
+	mutable quint32 _layoutGeneration;
+	/// Clears the caches if the layout changed since they were filled
+	void checkLayout() const;
+	/// Returns the layout of the row of entry drawn in area
+	const RowLayout *rowLayout(const EntrySummary &entry, const QRect &area) const;
 
 public:
 	EntryDelegate(EntryDelegateLayout *dLayout, QObject *parent = 0);
@@ -84,6 +117,17 @@ public:
 	static const quint8 NOTES_ICON = 2;
 	static const quint8 LISTS_ICON = 3;
 
+	/**
+	 * In uniform height mode, all rows have the height of entries given by
+	 * the layout and the model is never asked for the size of a row. Meant
+	 * for views with uniform item sizes, which would otherwise need to
+	 * query every row to lay out their scroll bar.
+	 */
+	void setUniformHeight(bool uniform) { _uniformHeight = uniform; }
+	bool uniformHeight() const { return _uniformHeight; }
+	/// Height of the rows of entries with the current layout, without margins
+	int rowHeight() const;
+
 	bool isHidden(quint8 icon) const { return _hiddenIcons & icon; }
 	void setHidden(quint8 icon, bool hide) { _hiddenIcons = (hide ? _hiddenIcons | icon : _hiddenIcons & ~icon); }
 };
@@ -17,11 +17,14 @@
 
 #include "core/Paths.h"
 #include "core/TextTools.h"
+#include "core/EntryListCache.h"
 #include "gui/EntryListModel.h"
 #include "gui/EntryFormatter.h"
 #include "gui/DetailedView.h"
 
 #include <QFile>
+#include <QThread>
+#include <QApplication>
 #include <QUrl>
 #include <QUrlQuery>
 
@@ -32,9 +35,9 @@ QMap<int, EntryFormatter *> EntryFormatter::_formatters;
 static const int entryTextProperties = Qt::AlignJustify | Qt::TextWordWrap;
 static QFont printFont = QFont("", 14);
 
-QColor EntryFormatter::scoreColor(const Entry &entry)
+QColor EntryFormatter::scoreColor(int entryScore)
 {
-	int sc = entry.score() * 5;
+	int sc = entryScore * 5;
 	static const float r = 0.3;
 	QColor base(QPalette().color(QPalette::Base));
 	QColor score(QColor(sc > 0xff ? sc < 0x1ff ? 0xff - (sc - 0x100) : 0x00 : 0xff,
@@ -102,10 +105,18 @@ bool EntryFormatter::removeFormatter(const int entryType)
 	return true;
 }
 
+QString EntryFormatter::allDisplaySettingsKeys()
+{
+	QStringList keys;
+	keys << QString::number(shortDescShowJLPT.value());
+	foreach (const EntryFormatter *formatter, _formatters) keys << formatter->displaySettingsKey();
+	return keys.join(":");
+}
+
 void EntryFormatter::drawInfo(const ConstEntryPointer &entry, QPainter &painter, QRectF &rectangle, const QFont &textFont) const
 {
 	// Draw notes
-	if (!entry->notes().isEmpty()) {
+	if (entry->hasNotes()) {
 		QFont italic(textFont);
 		italic.setItalic(true);
 		painter.setFont(italic);
@@ -118,6 +129,29 @@ void EntryFormatter::drawInfo(const ConstEntryPointer &entry, QPainter &painter,
 	}
 }
 
+void EntryFormatter::prepareFill(const ConstEntryPointer &entry) const
+{
+	// Notes are loaded on demand from the main connection
+	if (entry->hasNotes()) entry->notes();
+	for (QMap<quint64, quint64>::const_iterator it = entry->lists().constBegin(); it != entry->lists().constEnd(); ++it)
+		if (it.value() != 0) listLabel(it.value());
+}
+
+QString EntryFormatter::listLabel(quint64 listId) const
+{
+	QMutexLocker lock(&_listLabelsMutex);
+	// Lists may have been renamed since the label was prepared
+	if (QThread::currentThread() == qApp->thread()) _listLabels[listId] = EntryListCache::get(listId)->label();
+	return _listLabels.value(listId);
+}
+
+bool EntryFormatter::prepareDraw(const ConstEntryPointer &entry) const
+{
+	// Notes are loaded on demand from the main connection
+	if (entry->hasNotes()) entry->notes();
+	return true;
+}
+
 void EntryFormatter::draw(const ConstEntryPointer& entry, QPainter& painter, const QRectF& rectangle, QRectF& usedSpace, const QFont& textFont) const
 {
 	painter.save();
@@ -147,6 +181,23 @@ QString EntryFormatter::formatString(const QString &str, formatType type) const
 	}
 }
 
+const CompiledTemplate &EntryFormatter::compiledTemplate(const QStringList &parts) const
+{
+	QString key(parts.join(","));
+	// Inserting does not move the other templates, so the reference we
+	// return remains valid after the lock is released
+	QMutexLocker lock(&_compiledTemplatesMutex);
+	QMap<QString, CompiledTemplate>::const_iterator it(_compiledTemplates.constFind(key));
+	if (it != _compiledTemplates.constEnd()) return *it;
+	QString tmpl(parts.isEmpty() ? _html : TemplateFiller().extract(_html, parts));
+	return *_compiledTemplates.insert(key, CompiledTemplate(tmpl, metaObject()));
+}
+
+QStringList EntryFormatter::updatableSections() const
+{
+	return QStringList() << "Tags" << "Lists" << "Notes" << "TrainingData";
+}
+
 QString EntryFormatter::autoFormat(const QString &str) const
 {
 	QString ret;
@@ -223,13 +274,12 @@ QString EntryFormatter::formatHead(const ConstEntryPointer &entry) const
 QString EntryFormatter::formatLists(const ConstEntryPointer &entry) const
 {
 	if (!entry->lists().isEmpty()) {
-		EntryListModel listModel;
 		QStringList ret;
 		ret << "<img src=\"listicon\"/>   ";
-		foreach (quint64 rowid, entry->lists()) {
-			QModelIndex idx(listModel.index(rowid));
-			if (!idx.isValid()) continue;
-			QString label(listModel.data(idx.parent(), Qt::DisplayRole).toString());
+		// The loader tells which list each item belongs to, no need to resolve their position
+		for (QMap<quint64, quint64>::const_iterator it = entry->lists().constBegin(); it != entry->lists().constEnd(); ++it) {
+			quint64 rowid = it.key();
+			QString label(it.value() == 0 ? QString() : listLabel(it.value()));
 			if (label.isEmpty()) label = tr("Root list");
 			QUrl url("list://");
 			QUrlQuery query;
@@ -263,7 +313,7 @@ QString EntryFormatter::formatTags(const ConstEntryPointer &entry) const
 
 QString EntryFormatter::formatNotes(const ConstEntryPointer &entry) const
 {
-	if (!entry->notes().isEmpty()) {
+	if (entry->hasNotes()) {
 		/*QString ret("<div class=\"title\">" + tr("Notes:") + "</div>");
 		foreach(const Entry::Note &note, entry->notes()) {
 			ret += QString("<p>%1</p>").arg(autoFormat(note.note()));
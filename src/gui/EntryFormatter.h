@@ -20,9 +20,11 @@
 #include "core/EntriesCache.h"
 #include "core/Preferences.h"
 #include "gui/DetailedView.h"
+#include "gui/TemplateFiller.h"
 
 #include <QPainter>
 #include <QMap>
+#include <QMutex>
 
 class DetailedView;
 
@@ -31,6 +33,15 @@ class EntryFormatter : public QObject
 	Q_OBJECT
 private:
 	static QMap<int, EntryFormatter *> _formatters;
+	/// Compiled templates, by the comma-separated parts they have been
+	/// extracted with
+	mutable QMap<QString, CompiledTemplate> _compiledTemplates;
+	/// Templates can be filled from other threads than the GUI one
+	mutable QMutex _compiledTemplatesMutex;
+	/// Labels of the lists entries belong to, by list id, resolved by
+	/// prepareFill() for the templates filled from other threads
+	mutable QMap<quint64, QString> _listLabels;
+	mutable QMutex _listLabelsMutex;
 
 protected:
 	QString _css;
@@ -50,9 +61,35 @@ protected:
 public:
 	const QString &CSS() const { return _css; }
 	const QString &htmlTemplate() const { return _html; }
+	/**
+	 * Returns the HTML template compiled for this formatter, restricted
+	 * to the given parts if not empty (see TemplateFiller::extract()).
+	 * Templates are compiled on first use and kept afterwards.
+	 */
+	const CompiledTemplate &compiledTemplate(const QStringList &parts = QStringList()) const;
+	/**
+	 * Returns the names of the placeholders of the template which output
+	 * depends on the user data of the entry. The detailed view replaces
+	 * them in place when the entry changes, instead of displaying it
+	 * again.
+	 */
+	virtual QStringList updatableSections() const;
+	/**
+	 * Called from the GUI thread before the template is filled for entry
+	 * from another thread, so everything requiring the main database
+	 * connection or the lists cache can be loaded beforehand.
+	 *
+	 * The default version loads the notes of the entry and the labels of
+	 * its lists.
+	 */
+	virtual void prepareFill(const ConstEntryPointer &entry) const;
+	/// Label of list listId, which must have been prepared by prepareFill()
+	/// if called from another thread than the GUI one
+	QString listLabel(quint64 listId) const;
 	
 	/// Returns the color associated to the score of this entry
-	static QColor scoreColor(const Entry &entry);
+	static QColor scoreColor(const Entry &entry) { return scoreColor(entry.score()); }
+	static QColor scoreColor(int entryScore);
 	static QString colorTriplet(const QColor &color);
 	QString autoFormat(const QString &str) const;
 
@@ -80,6 +117,41 @@ public:
 	 * The default version just paints the short version.
 	 */
 	virtual void draw(const ConstEntryPointer &entry, QPainter &painter, const QRectF &rectangle, QRectF &usedSpace, const QFont &textFont = QFont()) const;
+	/**
+	 * Called from the GUI thread before entry is drawn from another thread,
+	 * so everything requiring the database connection can be loaded
+	 * beforehand. Returns false if entry can only be drawn from the GUI
+	 * thread.
+	 *
+	 * The default version loads the notes of the entry.
+	 */
+	virtual bool prepareDraw(const ConstEntryPointer &entry) const;
+	/**
+	 * Returns a string identifying the settings draw() depends on, so
+	 * the layouts of printed entries can be cached.
+	 *
+	 * The default version returns an empty string.
+	 */
+	virtual QString drawSettingsKey() const { return QString(); }
+	/**
+	 * Returns a string identifying the settings the detailed view of
+	 * entries depends on, so their contents can be cached.
+	 *
+	 * The default version returns an empty string.
+	 */
+	virtual QString displaySettingsKey() const { return QString(); }
+	/**
+	 * Returns a statement selecting the id, writing, readings,
+	 * meanings and JLPT level of the entries which ids replace the
+	 * {{ids}} placeholder, so exports do not need to load the entries.
+	 * Only the first maxSenses senses are selected, or all of them if
+	 * maxSenses is 0. Called from the GUI thread; the statement must be
+	 * usable from any thread connection.
+	 *
+	 * The default version returns an empty string, meaning that the
+	 * entries have to be loaded to be exported.
+	 */
+	virtual QString exportStatement(int maxSenses = 0) const { Q_UNUSED(maxSenses); return QString(); }
 
 	static PreferenceItem<bool> shortDescShowJLPT;
 
@@ -106,6 +178,12 @@ public:
 	 * formatter registered for this type of entry.
 	 */
 	static bool removeFormatter(const int entryType);
+	/**
+	 * Returns the display settings keys of all the registered formatters,
+	 * since the detailed view of an entry also contains the short
+	 * descriptions of entries of other types.
+	 */
+	static QString allDisplaySettingsKeys();
 	static const EntryFormatter *getFormatter(const int entryType) { return _formatters[entryType]; }
 	static const EntryFormatter *getFormatter(const ConstEntryPointer &entry) { return _formatters[entry->type()]; }
 };
@@ -17,8 +17,10 @@
 
 #include "core/Database.h"
 #include "core/EntryListCache.h"
+#include "core/EntryLoader.h"
 #include "gui/EntryListModel.h"
 #include "gui/EntryFormatter.h"
+#include "gui/EntriesMimeData.h"
 
 #include <QFont>
 #include <QFontMetrics>
@@ -26,7 +28,15 @@
 #include <QPalette>
 
 #define LISTFORINDEX(index) (*EntryListCache::get(index.isValid() ? index.internalId() : 0))
-#define INDEXDATA(index) LISTFORINDEX(index)[index.row()]
+#define INDEXDATA(index) indexNode(index)->value()
+
+EntryListModel::EntryListModel(QObject *parent) : QAbstractItemModel(parent), _rowsList(0), _rowsChanges(0), _rowsFirst(0), _cursorList(0)
+{
+	connect(&EntryChanges::instance(), SIGNAL(entryChanged(Entry *)),
+		this, SLOT(onEntryChanged(Entry *)));
+	connect(&EntryChanges::instance(), SIGNAL(entriesChanged(QList<Entry *>)),
+		this, SLOT(onEntriesChanged(QList<Entry *>)));
+}
 
 QModelIndex EntryListModel::index(int row, int column, const QModelIndex &parent) const
 {
@@ -63,9 +73,21 @@ QModelIndex EntryListModel::index(quint64 rowid) const
 quint64 EntryListModel::rowIdFromIndex(const QModelIndex &index) const
 {
 	if (!index.isValid()) return 0;
+	return indexNode(index)->rowId();
+}
 
-	EntryList *list = EntryListCache::get(index.internalId());
-	return EntryListCache::getRowIdFromIndex(QPair<const EntryList *, quint32>(list, index.row()));
+const EntryList::TreeType::Node *EntryListModel::indexNode(const QModelIndex &index) const
+{
+	const EntryList *list = &LISTFORINDEX(index);
+	if (_cursorList != list) {
+		_cursor = list->iterator(index.row());
+		_cursorList = list;
+	}
+	else _cursor.seek(index.row());
+	const EntryList::TreeType::Node *node = _cursor.node();
+	// Same behavior as EntryList::operator[]
+	if (!node) qFatal("Error: accessing RBTree out of bounds");
+	return node;
 }
 
 QModelIndex EntryListModel::parent(const QModelIndex &idx) const
@@ -84,6 +106,15 @@ QModelIndex EntryListModel::parent(const QModelIndex &idx) const
 	}
 }
 
+void EntryListModel::reset()
+{
+	beginResetModel();
+	_rowsList = 0;
+	_rows.clear();
+	_cursorList = 0;
+	endResetModel();
+}
+
 int EntryListModel::rowCount(const QModelIndex &index) const
 {
 	// Asking for size of root?
@@ -96,28 +127,133 @@ int EntryListModel::rowCount(const QModelIndex &index) const
 	}
 }
 
+EntryListModel::CachedRow &EntryListModel::cachedRow(const QModelIndex &index) const
+{
+	const EntryList *list = &LISTFORINDEX(index);
+	int row = index.row();
+	if (list != _rowsList || list->changes() != _rowsChanges || row < _rowsFirst || row >= _rowsFirst + _rows.size()) {
+		// Views display the rows that follow the first one they ask for, so
+		// only keep a few before it
+		int size = list->size();
+		_rowsFirst = qMax(0, qMin(row - ROWS_CACHE_SIZE / 4, size - ROWS_CACHE_SIZE));
+		int last = qMin(size, _rowsFirst + ROWS_CACHE_SIZE);
+		_rows.clear();
+		_rows.reserve(last - _rowsFirst);
+		for (EntryList::Iterator it = list->iterator(_rowsFirst); it.isValid() && it.index() < last; ++it) {
+			CachedRow cRow;
+			cRow.data = it.value();
+			cRow.rowId = it.node()->rowId();
+			_rows << cRow;
+		}
+		_rowsList = list;
+		_rowsChanges = list->changes();
+		// Request all the entries that are not loaded yet at once
+		for (int i = 0; i < _rows.size(); i++) {
+			if (!_rows[i].data.isList()) displayedEntry(_rows[i]);
+		}
+	}
+	// Same behavior as EntryList::operator[]
+	if (row < _rowsFirst || row >= _rowsFirst + _rows.size()) qFatal("Error: accessing RBTree out of bounds");
+	return _rows[row - _rowsFirst];
+}
+
+EntryPointer EntryListModel::displayedEntry(CachedRow &row) const
+{
+	if (row.entry) return row.entry;
+	EntryRef ref(row.data.entryRef());
+	if (ref.isLoaded()) row.entry = ref.get();
+	if (row.entry) {
+		if (!_displayed.contains(ref, row.rowId)) _displayed.insert(ref, row.rowId);
+		return row.entry;
+	}
+	// Do not block the views on loading, refresh the row once the entry
+	// is there instead
+	if (!_loading.contains(ref)) ref.getAsync(const_cast<EntryListModel *>(this), SLOT(onEntryLoaded(EntryRef, EntryPointer)));
+	if (!_loading.contains(ref, row.rowId)) _loading.insert(ref, row.rowId);
+	return EntryPointer();
+}
+
+void EntryListModel::onEntryChanged(Entry *entry)
+{
+	// Already updated by onEntriesChanged()
+	if (EntryChanges::notifying()) return;
+	EntryRef ref(entry->type(), entry->id());
+	foreach (quint64 rowId, _displayed.values(ref)) {
+		QModelIndex idx(index(rowId));
+		// Forget rows that do not display the entry anymore
+		if (!idx.isValid() || INDEXDATA(idx).entryRef() != ref) {
+			_displayed.remove(ref, rowId);
+			continue;
+		}
+		emit dataChanged(idx, idx);
+	}
+}
+
+void EntryListModel::onEntriesChanged(const QList<Entry *> &changed)
+{
+	// First and last changed rows of each list, by list id
+	QHash<quintptr, QPair<int, int> > ranges;
+	foreach (Entry *entry, changed) {
+		EntryRef ref(entry->type(), entry->id());
+		foreach (quint64 rowId, _displayed.values(ref)) {
+			QModelIndex idx(index(rowId));
+			if (!idx.isValid() || INDEXDATA(idx).entryRef() != ref) {
+				_displayed.remove(ref, rowId);
+				continue;
+			}
+			QHash<quintptr, QPair<int, int> >::iterator it(ranges.find(idx.internalId()));
+			if (it == ranges.end()) ranges.insert(idx.internalId(), qMakePair(idx.row(), idx.row()));
+			else {
+				it->first = qMin(it->first, idx.row());
+				it->second = qMax(it->second, idx.row());
+			}
+		}
+	}
+	for (QHash<quintptr, QPair<int, int> >::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+		emit dataChanged(createIndex(it->first, 0, it.key()), createIndex(it->second, 0, it.key()));
+}
+
+void EntryListModel::onEntryLoaded(const EntryRef &ref, EntryPointer entry)
+{
+	QList<quint64> rowIds(_loading.values(ref));
+	_loading.remove(ref);
+	// Nothing will change for entries that cannot be loaded
+	if (!entry) return;
+	foreach (quint64 rowId, rowIds) {
+		QModelIndex idx(index(rowId));
+		if (idx.isValid()) emit dataChanged(idx, idx);
+	}
+}
+
 QVariant EntryListModel::data(const QModelIndex &index, int role) const
 {
 	if (!index.isValid() || index.column() != 0) return QVariant();
 
-	const EntryListData &cEntry = INDEXDATA(index);
+	CachedRow &cRow = cachedRow(index);
+	const EntryListData &cEntry = cRow.data;
 
 	switch (role) {
 		case Qt::DisplayRole:
 		case Qt::EditRole:
 		{
 			if (cEntry.isList()) return EntryListCache::get(cEntry.id)->label();
-			EntryPointer entry(cEntry.entryRef().get());
+			EntryPointer entry(displayedEntry(cRow));
 			if (!entry) return QVariant();
 			else return entry->shortVersion(Entry::TinyVersion);
 		}
 		case Qt::BackgroundRole:
 		{
 			if (cEntry.isList()) return QPalette().button();
-			EntryPointer entry(cEntry.entryRef().get());
+			EntryPointer entry(displayedEntry(cRow));
 			if (!entry || !entry->trained()) return QVariant();
 			else return EntryFormatter::scoreColor(*entry);
 		}
+		case Qt::ToolTipRole:
+		{
+			if (!cEntry.isList()) return QVariant();
+			EntryListStatistics stats(EntryListCache::statistics(cEntry.id));
+			return tr("%1 items, %2 studied, %3 known, %4 due").arg(stats.items).arg(stats.studied).arg(stats.known).arg(stats.due);
+		}
 		case Qt::FontRole:
 		{
 			if (cEntry.isList()) {
@@ -139,7 +275,7 @@ QVariant EntryListModel::data(const QModelIndex &index, int role) const
 		case Entry::EntryRole:
 		{
 			if (cEntry.isList()) return QVariant();
-			EntryPointer entry(cEntry.entryRef().get());
+			EntryPointer entry(cRow.entry ? cRow.entry : cEntry.entryRef().get());
 			if (!entry) return QVariant();
 			else return QVariant::fromValue(entry);
 		}
@@ -171,7 +307,9 @@ bool EntryListModel::setData(const QModelIndex &index, const QVariant &value, in
 		const EntryListData &cEntry = INDEXDATA(index);
 		if (cEntry.isList()) {
 			EntryList &list = *EntryListCache::get(cEntry.id);
-			if (list.setLabel(value.toString())) return true;
+			EntryListTransaction transaction;
+			transaction.touch(list.listId());
+			if (transaction.isActive() && list.setLabel(value.toString()) && transaction.commit()) return true;
 		}
 	}
 	return false;
@@ -189,60 +327,74 @@ bool EntryListModel::insertRows(int row, int count, const QModelIndex & parent)
 		parentList = EntryListCache::get(cEntry.id);
 	}
 	beginInsertRows(parent, row, row + count - 1);
-	if (!EntryListCache::connection()->transaction()) goto failure_1;
+	EntryListTransaction transaction;
+	if (!transaction.isActive()) return false;
+	transaction.touch(parentList->listId());
+	QVector<EntryListData> items;
 	for (int i = 0; i < count; i++)
 	{
 		EntryList *newList = EntryListCache::newList();
 		EntryListData data = { 0, newList->listId() };
-		parentList->insert(data, row + i);
+		items << data;
 	}
-	if (!EntryListCache::connection()->commit()) goto failure_2;
+	if (!parentList->insertRange(row, items)) return false;
+	if (!transaction.commit()) return false;
 	EntryListCache::clearOwnerCache();
 	endInsertRows();
 	return true;
+}
 
-failure_2:
-	EntryListCache::connection()->rollback();
-failure_1:
-	return false;
+quint64 EntryListModel::listIdFromIndex(const QModelIndex &index) const
+{
+	if (!index.isValid()) return 0;
+	const EntryListData &cEntry = INDEXDATA(index);
+	Q_ASSERT(cEntry.isList());
+	return cEntry.id;
+}
+
+bool EntryListModel::importList(QIODevice *device, const QModelIndex &parent)
+{
+	EntryList *list = EntryListCache::get(listIdFromIndex(parent));
+	int row = list->size();
+	bool ok = list->importFrom(device, row);
+	// The number of imported items is only known once they are inserted
+	if (ok && (int)list->size() > row) {
+		beginInsertRows(parent, row, list->size() - 1);
+		endInsertRows();
+	}
+	return ok;
 }
 
 bool EntryListModel::removeRows(int row, int count, const QModelIndex &parent)
 {
 	beginRemoveRows(parent, row, row + count - 1);
-	if (!EntryListCache::connection()->transaction()) goto failure_1;
-	{
-		// The list from which we are actually removing
-		EntryList *list = EntryListCache::get(parent.isValid() ? INDEXDATA(parent).id : 0); 
-		while (count--) {
-			if (!list->remove(row)) goto failure_2;
-		}
-	}
-	if (!EntryListCache::connection()->commit()) goto failure_2;
+	EntryListTransaction transaction;
+	if (!transaction.isActive()) return false;
+	// The list from which we are actually removing
+	EntryList *list = EntryListCache::get(parent.isValid() ? INDEXDATA(parent).id : 0); 
+	transaction.touch(list->listId());
+	// Write the nodes touched by rebalancing only once
+	if (!list->tree()->beginBatch()) return false;
+	bool removed = true;
+	while (removed && count--) removed = list->remove(row);
+	if (!list->tree()->endBatch(removed)) return false;
+	if (!transaction.commit()) return false;
 	EntryListCache::clearOwnerCache();
 	endRemoveRows();
 	return true;
-
-failure_2:
-	EntryListCache::connection()->rollback();
-failure_1:
-	return false;
 }
 
 QStringList EntryListModel::mimeTypes() const
 {
 	QStringList ret;
-	ret << "tagainijisho/entry";
+	ret << EntriesMimeData::format;
 	ret << "tagainijisho/listitem";
 	return ret;
 }
 
 QMimeData *EntryListModel::mimeData(const QModelIndexList &indexes) const
 {
-	QMimeData *mimeData = new QMimeData();
-
-	QByteArray entriesEncodedData;
-	QDataStream entriesStream(&entriesEncodedData, QIODevice::WriteOnly);
+	EntryRefList entries;
 	QByteArray itemsEncodedData;
 	QDataStream itemsStream(&itemsEncodedData, QIODevice::WriteOnly);
 	
@@ -253,11 +405,12 @@ QMimeData *EntryListModel::mimeData(const QModelIndexList &indexes) const
 			
 			// If the item is an entry, add it
 			const EntryListData &cEntry = INDEXDATA(index);
-			if (!cEntry.isList()) entriesStream << cEntry.entryRef();
+			if (!cEntry.isList()) entries << cEntry.entryRef();
 			// TODO in case of a list, add all the items the list contains
 		}
 	}
-	if (!entriesEncodedData.isEmpty()) mimeData->setData("tagainijisho/entry", entriesEncodedData);
+	// The entries are only encoded if the drop target is not a list
+	QMimeData *mimeData = new EntriesMimeData(entries);
 	if (!itemsEncodedData.isEmpty()) mimeData->setData("tagainijisho/listitem", itemsEncodedData);
 
 	return mimeData;
@@ -272,6 +425,16 @@ struct ListItemRef : public ListItemPos {
 	EntryList *list;
 	EntryList::TreeType::Node *node;
 };
+/// Ends the batches started on the lists involved in a drop, returns false if one of them failed
+static bool endBatches(const QSet<EntryList *> &lists, bool success)
+{
+	bool ret = success;
+	foreach (EntryList *list, lists) {
+		if (!list->tree()->endBatch(success)) ret = false;
+	}
+	return ret;
+}
+
 bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column, const QModelIndex &_parent)
 {
 	if (action == Qt::IgnoreAction) return true;
@@ -286,7 +449,8 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 
 	// If we have list items, we must move the items instead of inserting them
 	if (data->hasFormat("tagainijisho/listitem")) {
-		if (!EntryListCache::connection()->transaction()) goto failure_1;
+		EntryListTransaction transaction;
+		if (!transaction.isActive()) return false;
 		emit layoutAboutToBeChanged();
 		int origRow = row;
 		QModelIndexList pIdxs(persistentIndexList());
@@ -300,7 +464,7 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 			ds >> iRef.listId;
 			ds >> iRef.row;
 			iRef.list = EntryListCache::get(iRef.listId);
-			iRef.node = iRef.list->getNode(iRef.row);
+			iRef.node = 0;
 			iRefs << iRef;
 
 			// Decrease the destination index if we are removing an item in the destination
@@ -309,11 +473,36 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 		}
 
 
-		// Remove all nodes from their source list
-		foreach (const struct ListItemRef &iRef, iRefs) {
+		// Batch the changes of all the involved lists so that each node
+		// is only written once
+		QSet<EntryList *> batched;
+		batched << &list;
+		foreach (const struct ListItemRef &iRef, iRefs) batched << iRef.list;
+		foreach (EntryList *bList, batched) {
+			transaction.touch(bList->listId());
+			bList->tree()->beginBatch();
+		}
+		// Nodes are not evicted from memory while a batch is open, so we can keep them
+		for (int i = 0; i < iRefs.size(); i++) iRefs[i].node = iRefs[i].list->getNode(iRefs[i].row);
+
+		// Items that follow each other in the same list, which is what dragging a
+		// selection usually gives, can be moved as a whole subtree
+		bool contiguous = !iRefs.isEmpty();
+		for (int i = 1; contiguous && i < iRefs.size(); i++)
+			contiguous = iRefs[i].list == iRefs[0].list && iRefs[i].row == iRefs[0].row + i;
+		if (contiguous) {
+			if (!iRefs[0].list->moveRange(iRefs[0].row, iRefs.size(), list, row)) {
+				qWarning("Error moving nodes between lists, aborting.");
+				endBatches(batched, false);
+				goto failure;
+			}
+		}
+		// Otherwise remove all nodes from their source list
+		else foreach (const struct ListItemRef &iRef, iRefs) {
 			if (!iRef.list->removeNode(iRef.node)) {
 				qWarning("Error removing node from list, aborting.");
-				goto failure_2;
+				endBatches(batched, false);
+				goto failure;
 			}
 		}
 
@@ -322,13 +511,15 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 			ListItemPos pos = { idx.internalId(), idx.row() };
 			updatedPIndexes[idx] = pos;
 		}
-		// Insert all the nodes into the destination list and prepare persistent indexes for update
+		// Insert all the nodes into the destination list if they have not been moved
+		// already, and prepare persistent indexes for update
 		for (int i = 0; i < iRefs.size(); i++) {
 			struct ListItemRef &iRef = iRefs[i];
 			if (!iRef.node) continue;
-			if (!list.insertNode(iRef.node, row + i)) {
+			if (!contiguous && !list.insertNode(iRef.node, row + i)) {
 				qWarning("Error inserting node into list, aborting");
-				goto failure_2;
+				endBatches(batched, false);
+				goto failure;
 			}
 
 
@@ -352,6 +543,7 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 				if (idx.internalId() == list.listId() && idx.row() >= origRow) updatedPIndexes[idx].row++;
 			}
 		}
+		if (!endBatches(batched, true)) goto failure;
 		// Update the persistent indexes that need to be
 		foreach (const QModelIndex &idx, updatedPIndexes.keys()) {
 			const ListItemPos &pos = updatedPIndexes[idx];
@@ -359,60 +551,70 @@ bool EntryListModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 				changePersistentIndex(idx, indexFromList(pos.listId, pos.row));
 			}
 		}
-		if (!EntryListCache::connection()->commit()) goto failure_2;
+		if (!transaction.commit()) goto failure;
 		EntryListCache::clearOwnerCache();
+		// Nodes may be evicted once the views start querying the new layout
+		QList<QPair<EntryRef, quint64> > moved;
+		foreach (const struct ListItemRef &iRef, iRefs) {
+			if (iRef.node) moved << QPair<EntryRef, quint64>(iRef.node->value().entryRef(), iRef.node->rowId());
+		}
 		emit layoutChanged();
-		for (int i = 0; i < iRefs.size(); i++)
+		for (int i = 0; i < moved.size(); i++)
 		{
-			struct ListItemRef &iRef = iRefs[i];
-			if (!iRef.node) continue;
-			EntryRef entry(iRef.node->value().entryRef());
-			if (entry.isLoaded())
-				entry.get()->emitChanged();
+			const EntryRef &entry = moved[i].first;
+			if (!entry.isLoaded()) continue;
+			EntryPointer e(entry.get());
+			// The item keeps its rowid but may have changed list, which emits the change
+			if (e->lists().value(moved[i].second, (quint64)-1) != list.listId()) e->addToList(moved[i].second, list.listId());
+			else e->emitChanged();
 		}
 	}
 
 	// No list data, we probably dropped from the results view or something -
 	// add the entries to the list
-	else if (data->hasFormat("tagainijisho/entry")) {
-		QByteArray ba = data->data("tagainijisho/entry");
-		QDataStream ds(&ba, QIODevice::ReadOnly);
-		QList<EntryRef> entries;
-
-		while (!ds.atEnd()) {
-			EntryRef entryRef;
-			ds >> entryRef;
-			entries << entryRef;
-		}
+	else if (data->hasFormat(EntriesMimeData::format)) {
+		QList<EntryRef> entries(EntriesMimeData::decode(data->data(EntriesMimeData::format)));
+		if (entries.isEmpty()) return false;
 
 		beginInsertRows(_parent, row, row + entries.size() - 1);
-		if (!EntryListCache::connection()->transaction()) goto failure_1;
-		// Insert rows must be done on what the view thinks is the parent
-		int cpt = 0;
+		EntryListTransaction transaction;
+		if (!transaction.isActive()) return false;
+		transaction.touch(list.listId());
+		if (!list.tree()->beginBatch()) goto failure;
+		// Insert all the entries as a single subtree
+		QVector<EntryListData> items;
+		items.reserve(entries.size());
 		foreach (const EntryRef &entry, entries) {
 			EntryListData eData;
 			eData.type = entry.type();
 			eData.id = entry.id();
-			if (!list.insert(eData, row + cpt)) {
-				qWarning("Error inserting list item, aborting.");
-				goto failure_2;
-			}
+			items << eData;
+		}
+		// Insert rows must be done on what the view thinks is the parent
+		if (!list.insertRange(row, items)) {
+			qWarning("Error inserting list items, aborting.");
+			list.tree()->endBatch(false);
+			goto failure;
+		}
+		int cpt = 0;
+		foreach (const EntryRef &entry, entries) {
+			EntryLoader::markUserData(entry.type(), entry.id());
 
 			// Add the list to the entry if it is loaded
 			if (entry.isLoaded()) {
-				entry.get()->addToList(EntryListCache::getRowIdFromIndex(QPair<const EntryList *, quint32>(&list, row + cpt)));
+				entry.get()->addToList(EntryListCache::getRowIdFromIndex(QPair<const EntryList *, quint32>(&list, row + cpt)), list.listId());
 			}
 			cpt++;
 		}
-		if (!EntryListCache::connection()->commit()) goto failure_2;
+		if (!list.tree()->endBatch()) goto failure;
+		if (!transaction.commit()) goto failure;
 		EntryListCache::clearOwnerCache();
 		endInsertRows();
 	}
 
 	return true;
 
-failure_2:
-	EntryListCache::connection()->rollback();
-failure_1:
+	// Leaving the scope of the transaction rolls it back
+failure:
 	return false;
 }
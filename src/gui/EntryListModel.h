@@ -20,20 +20,65 @@
 
 
 #include "sqlite/Query.h"
+#include "core/EntriesCache.h"
+#include "core/EntryListDB.h"
 
 #include <QAbstractItemModel>
 #include <QMimeData>
+#include <QMultiHash>
+#include <QVector>
 class EntryListModel : public QAbstractItemModel
 {
 	Q_OBJECT
+private:
+	/// Entries being loaded for display, and the rowids showing them
+	mutable QMultiHash<EntryRef, quint64> _loading;
+	/// Rowids that have displayed each loaded entry, so their rows can be
+	/// updated when it changes. May contain rows that were moved since.
+	mutable QMultiHash<EntryRef, quint64> _displayed;
+	/// Row of a list as needed by data()
+	struct CachedRow {
+		EntryListData data;
+		quint64 rowId;
+		/// Null until the entry is loaded
+		EntryPointer entry;
+	};
+	/// Rows around the last one displayed, fetched in a single walk of
+	/// their list. Valid as long as the list stays unchanged.
+	mutable const EntryList *_rowsList;
+	mutable quint32 _rowsChanges;
+	mutable int _rowsFirst;
+	mutable QVector<CachedRow> _rows;
+	static const int ROWS_CACHE_SIZE = 64;
+	/// Returns the cached row of index, fetching the rows around it if needed
+	CachedRow &cachedRow(const QModelIndex &index) const;
+	/// Returns the entry of row if it is loaded, otherwise requests it
+	/// and returns null
+	EntryPointer displayedEntry(CachedRow &row) const;
+	/// Views mostly query consecutive rows, so list nodes are reached by
+	/// stepping from the last one returned whenever possible
+	mutable const EntryList *_cursorList;
+	mutable EntryList::Iterator _cursor;
+	/// Returns the list node corresponding to index
+	const EntryList::TreeType::Node *indexNode(const QModelIndex &index) const;
+
+private slots:
+	void onEntryLoaded(const EntryRef &ref, EntryPointer entry);
+	void onEntryChanged(Entry *entry);
+	/// Updates the rows of a batch of changed entries, in one range per list
+	void onEntriesChanged(const QList<Entry *> &changed);
+
 public:
-	EntryListModel(QObject *parent = 0) : QAbstractItemModel(parent) {}
+	EntryListModel(QObject *parent = 0);
 	virtual ~EntryListModel() {}
 
 	virtual QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const;
 	QModelIndex indexFromList(quint64 listId, quint64 position) const;
 	QModelIndex index(quint64 rowid) const;
 	quint64 rowIdFromIndex(const QModelIndex &index) const;
+	/// Returns the id of the list shown by index, which must be a list,
+	/// or 0 for the root list
+	quint64 listIdFromIndex(const QModelIndex &index) const;
 	virtual QModelIndex parent(const QModelIndex &index) const;
 	virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
 	virtual int columnCount(const QModelIndex &parent = QModelIndex()) const { return 1; }
@@ -47,6 +92,14 @@ public:
 	virtual QMimeData *mimeData(const QModelIndexList &indexes) const;
 	virtual Qt::DropActions supportedDropActions() const { return Qt::CopyAction | Qt::MoveAction; }
 	virtual bool dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column, const QModelIndex &parent);
+
+	/// Imports a list written by EntryList::exportTo() from device at the
+	/// end of the list shown by parent
+	bool importList(QIODevice *device, const QModelIndex &parent = QModelIndex());
+
+	/// Must be called when the lists may have been replaced, e.g. after the
+	/// profile has been switched
+	void reset();
 };
 
 #endif
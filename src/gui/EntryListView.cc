@@ -24,6 +24,8 @@
 
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QFile>
 #include <QToolBar>
 #include <QDrag>
 
@@ -33,13 +35,17 @@ PreferenceItem<QString> EntryListView::kanaFontSetting("mainWindow/lists", "kana
 PreferenceItem<QString> EntryListView::kanjiFontSetting("mainWindow/lists", "kanjiFont", QFont("Helvetica", 15).toString());
 PreferenceItem<int> EntryListView::displayModeSetting("mainWindow/lists", "displayMode", EntryDelegateLayout::OneLine);
 
-EntryListView::EntryListView(QWidget *parent, EntryDelegateLayout* delegateLayout, bool viewOnly) : QTreeView(parent), _helper(this, delegateLayout, true, viewOnly), _newListAction(QIcon(":/images/icons/document-new.png"), tr("New list..."), 0), _rightClickNewListAction(_newListAction.icon(), _newListAction.text(), 0), _deleteSelectionAction(QIcon(":/images/icons/delete.png"), tr("Delete"), 0), _renameListAction(QIcon(), tr("Rename list..."), 0), _goUpAction(QIcon(":/images/icons/go-up.png"), tr("Go up"), 0)
+EntryListView::EntryListView(QWidget *parent, EntryDelegateLayout* delegateLayout, bool viewOnly) : QTreeView(parent), _helper(this, delegateLayout, true, viewOnly), _newListAction(QIcon(":/images/icons/document-new.png"), tr("New list..."), 0), _rightClickNewListAction(_newListAction.icon(), _newListAction.text(), 0), _deleteSelectionAction(QIcon(":/images/icons/delete.png"), tr("Delete"), 0), _renameListAction(QIcon(), tr("Rename list..."), 0), _goUpAction(QIcon(":/images/icons/go-up.png"), tr("Go up"), 0), _exportListAction(QIcon(), tr("Export list..."), 0), _importListAction(QIcon(), tr("Import list..."), 0)
 {
 	setHeaderHidden(true);
 	setEditTriggers(QAbstractItemView::NoEditTriggers);
 	EntryDelegate *delegate = new EntryDelegate(helper()->delegateLayout(), this);
 	delegate->setHidden(EntryDelegate::LISTS_ICON, true);
+	// Lists rows get the height of entries, so large lists do not need
+	// the size of each of their rows to be computed
+	delegate->setUniformHeight(true);
 	setItemDelegate(delegate);
+	setUniformRowHeights(true);
 
 	// Add actions to the context menu
 	QMenu *contextMenu = helper()->contextMenu();
@@ -48,7 +54,9 @@ EntryListView::EntryListView(QWidget *parent, EntryDelegateLayout* delegateLayou
 		contextMenu->addAction(&_rightClickNewListAction);
 		contextMenu->addAction(&_renameListAction);
 		contextMenu->addAction(&_deleteSelectionAction);
+		contextMenu->addAction(&_importListAction);
 	}
+	contextMenu->addAction(&_exportListAction);
 	connect(&_newListAction, SIGNAL(triggered()), this, SLOT(newList()));
 	connect(&_rightClickNewListAction, SIGNAL(triggered()), this, SLOT(rightClickNewList()));
 	_deleteSelectionAction.setEnabled(false);
@@ -56,6 +64,8 @@ EntryListView::EntryListView(QWidget *parent, EntryDelegateLayout* delegateLayou
 	_goUpAction.setEnabled(false);
 	connect(&_renameListAction, SIGNAL(triggered()), this, SLOT(editSelectedList()));
 	connect(&_goUpAction, SIGNAL(triggered()), this, SLOT(goUp()));
+	connect(&_exportListAction, SIGNAL(triggered()), this, SLOT(exportSelectedList()));
+	connect(&_importListAction, SIGNAL(triggered()), this, SLOT(importIntoSelectedList()));
 	connect(this, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(setRootIndex(QModelIndex)));
 
 	// If no delegate has been given, consider this view is ruled by the default settings
@@ -98,6 +108,8 @@ void EntryListView::selectionChanged(const QItemSelection &selected, const QItem
 	QModelIndexList selection(selected.indexes());
 	_rightClickNewListAction.setEnabled(selection.size() <= 1 && (selection.size() == 0 || !selection[0].data(Entry::EntryRole).isValid()));
 	_renameListAction.setEnabled(selection.size() == 1 && !selection[0].data(Entry::EntryRole).isValid());
+	_exportListAction.setEnabled(_rightClickNewListAction.isEnabled());
+	_importListAction.setEnabled(_rightClickNewListAction.isEnabled());
 	
 	_deleteSelectionAction.setEnabled(!selected.isEmpty());
 	emit selectionHasChanged(selected, deselected);
@@ -175,17 +187,16 @@ void EntryListView::deleteSelectedItems()
 	}
 
 	// TODO progress bar
-	if (!EntryListCache::connection()->transaction()) goto failure_1;
-	foreach (const QPersistentModelIndex &index, perList) {
-		if (!deleteEntries(index)) goto failure_2;
+	{
+		EntryListTransaction transaction;
+		if (!transaction.isActive()) goto failure;
+		foreach (const QPersistentModelIndex &index, perList) {
+			if (!deleteEntries(index)) goto failure;
+		}
+		if (transaction.commit()) return;
 	}
-	if (!EntryListCache::connection()->commit()) goto failure_2;
 
-	return;
-
-failure_2:
-	EntryListCache::connection()->rollback();
-failure_1:
+failure:
 	QMessageBox::information(this, tr("Removal failed"), tr("A database error has occured while trying to remove the selected items:\n\n%1\n\n Some of them may be remaining.").arg(Database::lastError().message()));
 }
 
@@ -216,3 +227,46 @@ void EntryListView::editSelectedList()
 		if (!idx.data(Entry::EntryRole).isValid()) edit(idx);
 	}
 }
+
+QModelIndex EntryListView::selectedList(bool &ok) const
+{
+	QModelIndexList selection(selectionModel()->selectedIndexes());
+	ok = selection.size() <= 1 && (selection.size() == 0 || !selection[0].data(Entry::EntryRefRole).isValid());
+	return selection.isEmpty() ? rootIndex() : selection[0];
+}
+
+void EntryListView::exportSelectedList()
+{
+	EntryListModel *m(qobject_cast<EntryListModel *>(model()));
+	bool ok;
+	QModelIndex idx(selectedList(ok));
+	if (!m || !ok) return;
+	QString fileName(QFileDialog::getSaveFileName(this, tr("Export list"), QString(), tr("Lists (*.tlist)")));
+	if (fileName.isEmpty()) return;
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly)) {
+		QMessageBox::warning(this, tr("Export failed"), tr("Cannot write %1.").arg(fileName));
+		return;
+	}
+	if (!EntryListCache::get(m->listIdFromIndex(idx))->exportTo(&file)) {
+		QMessageBox::warning(this, tr("Export failed"), tr("An error occured while exporting the list."));
+	}
+}
+
+void EntryListView::importIntoSelectedList()
+{
+	EntryListModel *m(qobject_cast<EntryListModel *>(model()));
+	bool ok;
+	QModelIndex idx(selectedList(ok));
+	if (!m || !ok) return;
+	QString fileName(QFileDialog::getOpenFileName(this, tr("Import list"), QString(), tr("Lists (*.tlist)")));
+	if (fileName.isEmpty()) return;
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		QMessageBox::warning(this, tr("Import failed"), tr("Cannot read %1.").arg(fileName));
+		return;
+	}
+	if (!m->importList(&file, idx)) {
+		QMessageBox::warning(this, tr("Import failed"), tr("%1 is not a valid list file, or a database error occured while importing it. Nothing has been imported.").arg(fileName));
+	}
+}
@@ -35,7 +35,10 @@ class EntryListView : public QTreeView
 private:
 	ScrollBarSmoothScroller scroller;
 	EntriesViewHelper _helper;
-	QAction _newListAction, _rightClickNewListAction, _deleteSelectionAction, _renameListAction, _goUpAction;
+	QAction _newListAction, _rightClickNewListAction, _deleteSelectionAction, _renameListAction, _goUpAction, _exportListAction, _importListAction;
+	/// Returns the selected list, or the root of the view if nothing is
+	/// selected. Sets ok to false if the selection is not a single list
+	QModelIndex selectedList(bool &ok) const;
 	/**
 	 * Recursively delete the given index and all indexes below it.
 	 */
@@ -72,6 +75,11 @@ public slots:
 	void newList(QModelIndex parent = QModelIndex());
 	void editSelectedList();
 	void deleteSelectedItems();
+	/// Exports the selected list, or the displayed one, to a file
+	void exportSelectedList();
+	/// Imports a file exported by exportSelectedList() at the end of the
+	/// selected list, or of the displayed one
+	void importIntoSelectedList();
 	void goUp();
 	void setRootIndex(const QModelIndex &idx);
 	
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/FacetCounter.h"
+#include "core/EntrySearcherManager.h"
+
+FacetCounter::FacetCounter(QObject *parent) : QObject(parent), _dbThread(DatabaseThreadPool::instance().acquire()), _query(_dbThread), _currentCount(-1)
+{
+	// Counts are only a hint and must never delay actual searches
+	_query.setPriority(ASyncQuery::Background);
+	connect(&_query, SIGNAL(result(QList<QVariant>)), this, SLOT(onResult(QList<QVariant>)));
+	connect(&_query, SIGNAL(completed()), this, SLOT(onCompleted()));
+	connect(&_query, SIGNAL(error(QString)), this, SLOT(onError()));
+}
+
+FacetCounter::~FacetCounter()
+{
+	_query.abort();
+	DatabaseThreadPool::instance().release(_dbThread);
+}
+
+void FacetCounter::count(const QString &search)
+{
+	if (_counts.contains(search)) {
+		emit counted(search, _counts[search]);
+		return;
+	}
+	if (search == _current || _pending.contains(search)) return;
+	_pending << search;
+	if (_current.isEmpty()) runNext();
+}
+
+void FacetCounter::runNext()
+{
+	_current.clear();
+	while (!_pending.isEmpty()) {
+		QString search(_pending.takeFirst());
+		QString statement(EntrySearcherManager::instance().buildCountStatement(search));
+		if (statement.isEmpty()) continue;
+		_current = search;
+		_currentCount = -1;
+		_query.exec(statement);
+		return;
+	}
+}
+
+void FacetCounter::onResult(const QList<QVariant> &result)
+{
+	if (!result.isEmpty()) _currentCount = result[0].toInt();
+}
+
+void FacetCounter::onCompleted()
+{
+	if (_currentCount != -1) {
+		if (_counts.size() >= maxCounts) _counts.clear();
+		_counts[_current] = _currentCount;
+		emit counted(_current, _currentCount);
+	}
+	runNext();
+}
+
+void FacetCounter::onError()
+{
+	runNext();
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_FACETCOUNTER_H
+#define __GUI_FACETCOUNTER_H
+
+#include "core/ASyncQuery.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+
+/**
+ * Counts the results of searches in the background, so filter widgets can
+ * show how many results each of their options would give. Searches are
+ * counted one after the other on a background priority query, and counts
+ * are remembered so that options whose search did not change are not
+ * counted again.
+ */
+class FacetCounter : public QObject
+{
+	Q_OBJECT
+private:
+	DatabaseThread *_dbThread;
+	ASyncQuery _query;
+	/// Searches waiting to be counted
+	QStringList _pending;
+	/// Search being counted, if any
+	QString _current;
+	int _currentCount;
+	QHash<QString, int> _counts;
+
+	void runNext();
+
+protected slots:
+	void onResult(const QList<QVariant> &result);
+	void onCompleted();
+	void onError();
+
+public:
+	FacetCounter(QObject *parent = 0);
+	virtual ~FacetCounter();
+
+	/// Maximum number of counts remembered
+	static const int maxCounts = 1024;
+
+	/**
+	 * Requests the results of search to be counted. counted() is emitted
+	 * right away if the count is already known.
+	 */
+	void count(const QString &search);
+	/// Forgets the searches waiting to be counted
+	void clearPending() { _pending.clear(); }
+
+signals:
+	void counted(const QString &search, int count);
+};
+
+#endif
@@ -42,6 +42,51 @@ JLPTFilterWidget::JLPTFilterWidget(QWidget *parent) : SearchFilterWidget(parent)
 	hLayout->addWidget(JLPTN3CheckBox);
 	hLayout->addWidget(JLPTN2CheckBox);
 	hLayout->addWidget(JLPTN1CheckBox);
+
+	connect(&_counter, SIGNAL(counted(QString, int)), this, SLOT(onLevelCounted(QString, int)));
+}
+
+QCheckBox *JLPTFilterWidget::levelCheckBox(int level) const
+{
+	switch (level) {
+	case 5: return JLPTN5CheckBox;
+	case 4: return JLPTN4CheckBox;
+	case 3: return JLPTN3CheckBox;
+	case 2: return JLPTN2CheckBox;
+	case 1: return JLPTN1CheckBox;
+	default: return 0;
+	}
+}
+
+QString JLPTFilterWidget::levelSearch(int level) const
+{
+	return QString("%1 :jlpt=%2").arg(_otherCommands).arg(level).trimmed();
+}
+
+void JLPTFilterWidget::countLevels()
+{
+	for (int level = 5; level >= 1; level--) _counter.count(levelSearch(level));
+}
+
+void JLPTFilterWidget::searchUpdated(const QString &otherCommands)
+{
+	_otherCommands = otherCommands;
+	_counter.clearPending();
+	// Only count when the counts can be seen
+	if (isVisible()) countLevels();
+}
+
+void JLPTFilterWidget::showEvent(QShowEvent *event)
+{
+	SearchFilterWidget::showEvent(event);
+	countLevels();
+}
+
+void JLPTFilterWidget::onLevelCounted(const QString &search, int count)
+{
+	for (int level = 5; level >= 1; level--) {
+		if (search == levelSearch(level)) levelCheckBox(level)->setText(tr("N%1 (%2)").arg(level).arg(count));
+	}
 }
 
 QString JLPTFilterWidget::currentCommand() const
@@ -19,6 +19,7 @@
 #define __GUI_JLPTHFILTERWIDGET_H
 
 #include "gui/SearchFilterWidget.h"
+#include "gui/FacetCounter.h"
 
 #include <QCheckBox>
 
@@ -27,15 +28,27 @@ class JLPTFilterWidget : public SearchFilterWidget {
 private:
 	QCheckBox *JLPTN5CheckBox, *JLPTN4CheckBox,
 		*JLPTN3CheckBox, *JLPTN2CheckBox, *JLPTN1CheckBox;
+	FacetCounter _counter;
+	QString _otherCommands;
+
+	QCheckBox *levelCheckBox(int level) const;
+	/// Search giving the results the given level would have
+	QString levelSearch(int level) const;
+	void countLevels();
 
 protected:
 	virtual void _reset();
+	virtual void showEvent(QShowEvent *event);
+
+protected slots:
+	void onLevelCounted(const QString &search, int count);
 
 public:
 	JLPTFilterWidget(QWidget *parent = 0);
 	virtual QString name() const { return "jlptoptions"; }
 	virtual QString currentTitle() const;
 	virtual QString currentCommand() const;
+	virtual void searchUpdated(const QString &otherCommands);
 
 	/**
 	 * Returns the list of currently checked levels. The returned
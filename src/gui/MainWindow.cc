@@ -22,7 +22,9 @@
 #include "core/Database.h"
 #include "core/Plugin.h"
 #include "core/EntrySearcherManager.h"
+#include "core/Tracer.h"
 #include "gui/UpdateChecker.h"
+#include "gui/DictionaryDownloader.h"
 #include "gui/SavedSearchesOrganizer.h"
 #include "gui/TrainSettings.h"
 #include "gui/PreferencesWindow.h"
@@ -52,6 +54,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QDesktopWidget>
+#include <QRegExp>
 
 /// State version of the main window - should be increated every time the docks or statusbars change
 #define MAINWINDOW_STATE_VERSION 0
@@ -63,6 +66,7 @@ UpdateChecker *_betaUpdateChecker = 0;
 PreferenceItem<QString> MainWindow::applicationFont("mainWindow", "defaultFont", "");
 PreferenceItem<bool> MainWindow::autoCheckUpdates("mainWindow", "autoCheckUpdates", true);
 PreferenceItem<bool> MainWindow::autoCheckBetaUpdates("mainWindow", "autoCheckBetaUpdates", false);
+PreferenceItem<bool> MainWindow::autoUpdateDictionaries("mainWindow", "autoUpdateDictionaries", false);
 PreferenceItem<int> MainWindow::updateCheckInterval("mainWindow", "updateCheckInterval", 3);
 
 PreferenceItem<QByteArray> MainWindow::windowGeometry("mainWindow", "geometry", "");
@@ -91,7 +95,7 @@ DockTitleBar::DockTitleBar(QWidget *widget, QDockWidget *parent) : QWidget(paren
 	hLayout->setContentsMargins(left, 0, right, 0);
 }
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), _clipboardEnabled(false)
+MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), _pendingSetId(0), _clipboardEnabled(false), _debugMenu(0)
 {
 	_instance = this;
 
@@ -106,6 +110,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), _clipboardEnabled
 	// Strangely this is not done properly by Qt designer...
 	connect(_setsMenu, SIGNAL(aboutToShow()), this, SLOT(populateSavedSearchesMenu()));
 
+	// Profiles menu
+	_profilesMenu = new QMenu(tr("&Profile"), this);
+	_fileMenu->insertMenu(actionPreferences, _profilesMenu);
+	connect(_profilesMenu, SIGNAL(aboutToShow()), this, SLOT(populateProfilesMenu()));
+
+	setupDebugMenu();
+
 	// Reset search action
 	_searchWidget->resetSearchAction()->setShortcut(QKeySequence("Ctrl+R"));
 	_searchMenu->addAction(_searchWidget->resetSearchAction());
@@ -133,7 +144,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), _clipboardEnabled
 
 	// And perform our startup checks
 	donationReminderCheck();
-	updateCheck();
+	// Leave the network alone until the window is displayed and the first
+	// searches are done
+	QTimer::singleShot(10000, this, SLOT(updateCheck()));
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
@@ -155,6 +168,8 @@ void MainWindow::setupSearchWidget()
 	_searchDockWidget->setTitleBarWidget(dBar);
 
 	connect(searchWidget()->resultsView(), SIGNAL(entrySelected(EntryPointer)), detailedView(), SLOT(display(EntryPointer)));
+	connect(searchWidget()->resultsList(), SIGNAL(queryEnded()), this, SLOT(onSearchQueryEnded()));
+	connect(searchWidget()->resultsList(), SIGNAL(totalResultsKnown(int)), this, SLOT(onSearchQueryEnded()));
 
 	// Focus on the text input on startup
 	actionFocus_text_search->trigger();
@@ -187,6 +202,38 @@ void MainWindow::setupListWidget()
 	_searchMenu->addAction(action);
 }
 
+void MainWindow::setupDebugMenu()
+{
+	// Only for those who started tracing using --trace
+	if (!Tracer::enabled()) return;
+
+	_debugMenu = new QMenu(tr("&Debug"), this);
+	menuBar()->insertMenu(_helpMenu->menuAction(), _debugMenu);
+	QAction *action = _debugMenu->addAction(tr("Record trace"));
+	action->setCheckable(true);
+	action->setChecked(true);
+	connect(action, SIGNAL(toggled(bool)), this, SLOT(enableTracing(bool)));
+	_debugMenu->addAction(tr("Clear trace"), this, SLOT(clearTrace()));
+	_debugMenu->addAction(tr("Export trace..."), this, SLOT(exportTrace()));
+}
+
+void MainWindow::enableTracing(bool enable)
+{
+	Tracer::setEnabled(enable);
+}
+
+void MainWindow::clearTrace()
+{
+	Tracer::clear();
+}
+
+void MainWindow::exportTrace()
+{
+	QString file(QFileDialog::getSaveFileName(this, tr("Export trace"), "trace.json", tr("Chrome trace files (*.json)")));
+	if (file.isEmpty()) return;
+	if (!Tracer::exportTrace(file)) QMessageBox::warning(this, tr("Cannot export trace"), tr("Unable to write the trace into %1.").arg(file));
+}
+
 void MainWindow::setupClipboardSearchShortcut()
 {
 	// Auto-clipboard search action
@@ -203,6 +250,7 @@ void MainWindow::updateCheck()
 		if (!dt.isValid() || dt.addDays(updateCheckInterval.value()) <= QDateTime::currentDateTime()) {
 			_updateChecker->checkForUpdates();
 			if (autoCheckBetaUpdates.value()) _betaUpdateChecker->checkForUpdates();
+			if (autoUpdateDictionaries.value()) DictionaryDownloader::startDownload();
 			lastUpdateCheck.set(QDateTime::currentDateTime());
 		}
 	}
@@ -259,6 +307,52 @@ void MainWindow::importUserData()
 	if (ret == QMessageBox::Yes) close();
 }
 
+void MainWindow::populateProfilesMenu()
+{
+	_profilesMenu->clear();
+	foreach (const QString &profile, Database::profiles()) {
+		QAction *action = _profilesMenu->addAction(profile.isEmpty() ? tr("Default") : profile, this, SLOT(onProfileSelected()));
+		action->setData(profile);
+		action->setCheckable(true);
+		action->setChecked(profile == Database::currentProfile());
+	}
+	_profilesMenu->addSeparator();
+	_profilesMenu->addAction(tr("New profile..."), this, SLOT(newProfile()));
+}
+
+void MainWindow::onProfileSelected()
+{
+	QAction *action = qobject_cast<QAction *>(sender());
+	if (!action) return;
+	switchToProfile(action->data().toString());
+}
+
+void MainWindow::newProfile()
+{
+	bool ok;
+	QString name(QInputDialog::getText(this, tr("New profile"), tr("Please enter a name for this profile:"), QLineEdit::Normal, QString(), &ok).trimmed());
+	if (!ok || name.isEmpty()) return;
+	// The name is used as a file name
+	if (!Database::isValidProfileName(name)) {
+		QMessageBox::warning(this, tr("Invalid profile name"), tr("Profile names can only contain letters, digits, spaces, dashes and underscores."));
+		return;
+	}
+	switchToProfile(name);
+}
+
+void MainWindow::switchToProfile(const QString &profile)
+{
+	QStringList errors;
+	if (!Database::switchProfile(profile, errors)) {
+		QMessageBox::warning(this, tr("Cannot switch profile"), errors.join("<p>"));
+		return;
+	}
+	// Lists and search results come from the user database
+	_listModel.reset();
+	_searchWidget->clearSnapshots();
+	_searchWidget->resetSearchAction()->trigger();
+}
+
 void MainWindow::preferences()
 {
 	PreferencesWindow *prefsWindow = new PreferencesWindow(this);
@@ -397,6 +491,7 @@ void MainWindow::populateMenu(QMenu *menu, int parentId)
 		else {
 			QAction *action = menu->addAction(query.valueString(0), this, SLOT(onSavedSearchSelected()));
 			action->setProperty("T_state", query.valueBlob(1));
+			action->setProperty("T_rowid", query.valueInt(2));
 			if (!parentId) _rootActions << action;
 		}
 	}
@@ -444,11 +539,16 @@ void MainWindow::newSavedSearch()
 	QDataStream ds(&curState, QIODevice::WriteOnly);
 	ds << QVariant(searchWidget()->searchBuilder()->getState());
 	SQLite::Query query(Database::connection());
-	query.prepare(QString("INSERT INTO sets VALUES(NULL, %2, ifnull((SELECT max(position) + 1 FROM sets WHERE parent %1), 0), ?, ?)").arg(!parentId ? "is null" : QString("= %1").arg(parentId)).arg(!parentId ? "null" : QString::number(parentId)));
+	query.prepare(QString("INSERT INTO sets(rowid, parent, position, label, state) VALUES(NULL, %2, ifnull((SELECT max(position) + 1 FROM sets WHERE parent %1), 0), ?, ?)").arg(!parentId ? "is null" : QString("= %1").arg(parentId)).arg(!parentId ? "null" : QString::number(parentId)));
 	query.bindValue(setName);
 	query.bindValue(curState);
 	// TODO error handling
-	query.exec();
+	if (!query.exec()) return;
+	int setId((int)query.lastInsertId());
+	if (!storeSavedSearchResults(setId)) {
+		_pendingSetId = setId;
+		_pendingSetCommands = searchWidget()->lastCommands();
+	}
 }
 
 void MainWindow::newSavedSearchesFolder()
@@ -463,7 +563,7 @@ void MainWindow::newSavedSearchesFolder()
 	if (!ok) return;
 
 	SQLite::Query query(Database::connection());
-	query.prepare(QString("INSERT INTO sets VALUES(NULL, %2, ifnull((SELECT max(position) + 1 FROM sets WHERE parent %1), 0), ?, null)").arg(!parentId ? "is null" : QString("= %1").arg(parentId)).arg(!parentId ? "null" : QString::number(parentId)));
+	query.prepare(QString("INSERT INTO sets(rowid, parent, position, label, state) VALUES(NULL, %2, ifnull((SELECT max(position) + 1 FROM sets WHERE parent %1), 0), ?, null)").arg(!parentId ? "is null" : QString("= %1").arg(parentId)).arg(!parentId ? "null" : QString::number(parentId)));
 	query.bindValue(setName);
 	// TODO error handling
 	query.exec();
@@ -478,10 +578,62 @@ void MainWindow::onSavedSearchSelected()
 	QDataStream ds(&bState, QIODevice::ReadOnly);
 	QMap<QString, QVariant> state(QVariant(ds).toMap());
 	searchWidget()->searchBuilder()->restoreState(state);
+
+	// Results stored with the search are reused as long as nothing they
+	// depend on changed, and only need to be sorted again
+	int setId(action->property("T_rowid").toInt());
+	QString commands(searchWidget()->searchBuilder()->commands().trimmed());
+	QString stamp(EntrySearcherManager::instance().resultsStamp());
+	bool known = false;
+	SQLite::Query query(Database::connection());
+	query.prepare("SELECT results, resultsStamp FROM sets WHERE rowid = ?");
+	query.bindValue(setId);
+	if (!stamp.isEmpty() && query.exec() && query.next() && !query.valueIsNull(0) && query.valueString(1) == stamp) {
+		EntryRefList results(EntryRefList::fromByteArray(query.valueBlob(0)));
+		known = !results.isEmpty();
+		if (known) searchWidget()->setKnownResults(commands, results);
+	}
+	query.clear();
+
+	_pendingSetId = 0;
 	searchWidget()->searchBuilder()->runSearch();
+	// Set only now so results of the previous search are not stored. The
+	// search is not run again if it is already displayed, in which case
+	// its results can be stored right away
+	if (!known && !(searchWidget()->lastCommands() == commands && storeSavedSearchResults(setId))) {
+		_pendingSetId = setId;
+		_pendingSetCommands = commands;
+	}
 	if (_searchDockWidget->isHidden()) _searchDockWidget->setHidden(false);
 }
 
+bool MainWindow::storeSavedSearchResults(int setId)
+{
+	ResultsList *results = searchWidget()->resultsList();
+	if (!results->isComplete() || results->results().isEmpty() || results->nbResults() > SearchWidget::maxRefinedResults) return false;
+	// The results are those of the data as of when the search was run
+	QString stamp(searchWidget()->lastStamp());
+	if (stamp.isEmpty()) return false;
+
+	SQLite::Query query(Database::connection());
+	query.prepare("UPDATE sets SET results = ?, resultsStamp = ? WHERE rowid = ?");
+	query.bindValue(results->results().toByteArray());
+	query.bindValue(stamp);
+	query.bindValue(setId);
+	return query.exec();
+}
+
+void MainWindow::onSearchQueryEnded()
+{
+	if (!_pendingSetId) return;
+	// Another search has been started since
+	if (searchWidget()->lastCommands() != _pendingSetCommands) {
+		_pendingSetId = 0;
+		return;
+	}
+	if (storeSavedSearchResults(_pendingSetId)) _pendingSetId = 0;
+}
+
 void MainWindow::organizeSavedSearches()
 {
 	SavedSearchesOrganizer organizer;
@@ -568,6 +720,15 @@ void MainWindow::onClipboardChanged(QClipboard::Mode mode)
 	tfw->setText(cText2);
 }
 
+void MainWindow::searchFor(const QString &text)
+{
+	TextFilterWidget *tfw = qobject_cast<TextFilterWidget *>(searchWidget()->getSearchFilter("searchtext"));
+	if (tfw && !text.isEmpty()) tfw->setText(text);
+	if (isMinimized()) showNormal();
+	raise();
+	activateWindow();
+}
+
 void MainWindow::fitToScreen(QWidget *widget)
 {
 	QRect screenRect = QApplication::desktop()->availableGeometry(widget);
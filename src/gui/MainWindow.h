@@ -64,16 +64,29 @@ private:
 	// Used by sets
 	QList<QAction *> _rootActions;
 	QList<QMenu *> _rootMenus;
+	/// Saved search whose results are to be stored once complete
+	int _pendingSetId;
+	QString _pendingSetCommands;
+
+	/// Stores the current results along with saved search setId, if they are complete
+	bool storeSavedSearchResults(int setId);
 	
 	QTimer _updateTimer;
 	
 	bool _clipboardEnabled;
 	
 	EntryListModel _listModel;
+
+	QMenu *_profilesMenu;
+	/// Only created when tracing, see setupDebugMenu()
+	QMenu *_debugMenu;
+	/// Switches to profile and refreshes the views showing user data
+	void switchToProfile(const QString &profile);
 	
 	void setupSearchWidget();
 	void setupClipboardSearchShortcut();
 	void setupListWidget();
+	void setupDebugMenu();
 
 private slots:
 	void populateMenu(QMenu *menu, int parentId);
@@ -115,11 +128,24 @@ protected slots:
 	void newSavedSearch();
 	void newSavedSearchesFolder();
 	void onSavedSearchSelected();
+	void onSearchQueryEnded();
+
+	void populateProfilesMenu();
+	void onProfileSelected();
+	void newProfile();
 
 	void trainSettings();
 
+	void enableTracing(bool enable);
+	void clearTrace();
+	void exportTrace();
+
 	void openUrl(const QUrl &url);
 
+public slots:
+	/// Searches text and brings the window to the front
+	void searchFor(const QString &text);
+
 public:
 	MainWindow(QWidget *parent = 0);
 	~MainWindow();
@@ -133,6 +159,8 @@ public:
 	static PreferenceItem<QString> applicationFont;
 	static PreferenceItem<bool> autoCheckUpdates;
 	static PreferenceItem<bool> autoCheckBetaUpdates;
+	/// Also download the updated dictionaries, installed at the next start
+	static PreferenceItem<bool> autoUpdateDictionaries;
 	static PreferenceItem<int> updateCheckInterval;
 	static PreferenceItem<QDateTime> lastUpdateCheck;
 	// Keep track of when the user started the program for the first time
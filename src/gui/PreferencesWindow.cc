@@ -19,6 +19,8 @@
 #include "core/Lang.h"
 #include "core/EntrySearcherManager.h"
 #include "core/RelativeDate.h"
+#include "core/PerfCounters.h"
+#include "core/MemoryUsage.h"
 #include "gui/UpdateChecker.h"
 #include "gui/DetailedView.h"
 #include "gui/PreferencesWindow.h"
@@ -34,6 +36,8 @@
 #include <QRadioButton>
 #include <QMessageBox>
 #include <QFile>
+#include <QPlainTextEdit>
+#include <QFileDialog>
 
 QList<const QMetaObject *> PreferencesWindow::_pluginPanels;
 
@@ -61,6 +65,12 @@ PreferencesWindow::PreferencesWindow(QWidget *parent, Qt::WindowFlags f) : QDial
 		addCategory(category);
 	}
 
+	// Performance counters, for those who asked for them
+	if (PerfCounters::enabled() || PerfCounters::collect.value()) {
+		category = new PerformancePreferences(this);
+		addCategory(category);
+	}
+
 	// Data preferences
 	category = new DataPreferences(this);
 	addCategory(category);
@@ -189,6 +199,7 @@ void GeneralPreferences::refresh()
 
 	checkForUpdates->setChecked(MainWindow::autoCheckUpdates.value());
 	checkForBetaUpdates->setChecked(MainWindow::autoCheckBetaUpdates.value());
+	downloadDictionaryUpdates->setChecked(MainWindow::autoUpdateDictionaries.value());
 	checkInterval->setValue(MainWindow::updateCheckInterval.value());
 }
 
@@ -237,6 +248,7 @@ void GeneralPreferences::applySettings()
 	// Updates check
 	MainWindow::autoCheckUpdates.set(checkForUpdates->isChecked());
 	MainWindow::autoCheckBetaUpdates.set(checkForBetaUpdates->isChecked());
+	MainWindow::autoUpdateDictionaries.set(downloadDictionaryUpdates->isChecked());
 	MainWindow::updateCheckInterval.set(checkInterval->value());
 }
 
@@ -519,6 +531,66 @@ void DataPreferences::onWipeUserDataButtonPushed()
 	}
 }
 
+PerformancePreferences::PerformancePreferences(QWidget *parent) : PreferencesWindowCategory(tr("Performance"), parent)
+{
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	_collect = new QCheckBox(tr("Collect performance counters"), this);
+	layout->addWidget(_collect);
+	QHBoxLayout *limitLayout = new QHBoxLayout();
+	limitLayout->addWidget(new QLabel(tr("Trim caches when their memory usage exceeds:"), this));
+	_memoryLimit = new QSpinBox(this);
+	_memoryLimit->setRange(0, 65536);
+	_memoryLimit->setSuffix(tr(" MiB"));
+	_memoryLimit->setSpecialValueText(tr("Never"));
+	limitLayout->addWidget(_memoryLimit);
+	limitLayout->addStretch();
+	layout->addLayout(limitLayout);
+	_report = new QPlainTextEdit(this);
+	_report->setReadOnly(true);
+	_report->setLineWrapMode(QPlainTextEdit::NoWrap);
+	layout->addWidget(_report);
+
+	QHBoxLayout *buttons = new QHBoxLayout();
+	QPushButton *button = new QPushButton(tr("Refresh"), this);
+	connect(button, SIGNAL(clicked()), this, SLOT(refresh()));
+	buttons->addWidget(button);
+	button = new QPushButton(tr("Reset"), this);
+	connect(button, SIGNAL(clicked()), this, SLOT(onResetPushed()));
+	buttons->addWidget(button);
+	button = new QPushButton(tr("Save to file..."), this);
+	connect(button, SIGNAL(clicked()), this, SLOT(onSavePushed()));
+	buttons->addWidget(button);
+	buttons->addStretch();
+	layout->addLayout(buttons);
+}
+
+void PerformancePreferences::refresh()
+{
+	_collect->setChecked(PerfCounters::enabled());
+	_memoryLimit->setValue(MemoryUsage::softLimit.value());
+	_report->setPlainText(PerfCounters::report());
+}
+
+void PerformancePreferences::applySettings()
+{
+	PerfCounters::collect.setValue(_collect->isChecked());
+	PerfCounters::setEnabled(_collect->isChecked());
+	MemoryUsage::softLimit.setValue(_memoryLimit->value());
+}
+
+void PerformancePreferences::onResetPushed()
+{
+	PerfCounters::reset();
+	_report->setPlainText(PerfCounters::report());
+}
+
+void PerformancePreferences::onSavePushed()
+{
+	QString file(QFileDialog::getSaveFileName(this, tr("Save performance counters"), "perfcounters.txt", tr("Text files (*.txt)")));
+	if (file.isEmpty()) return;
+	if (!PerfCounters::dump(file)) QMessageBox::warning(this, tr("Cannot save performance counters"), tr("Unable to write the performance counters into %1.").arg(file));
+}
+
 PreferencesFontChooser::PreferencesFontChooser(const QString &whatFor, const QFont &defaultFont, QWidget *parent) : QWidget(parent), _defaultFont(defaultFont)
 {
 	QHBoxLayout *layout = new QHBoxLayout(this);
@@ -222,6 +222,31 @@ public:
 	DataPreferences(QWidget *parent = 0);
 };
 
+class QPlainTextEdit;
+/**
+ * Shows the performance counters. Only displayed if they are collected, or
+ * have been asked to be collected using the --perf-counters option.
+ */
+class PerformancePreferences : public PreferencesWindowCategory
+{
+	Q_OBJECT
+private:
+	QCheckBox *_collect;
+	QSpinBox *_memoryLimit;
+	QPlainTextEdit *_report;
+
+protected slots:
+	void onResetPushed();
+	void onSavePushed();
+
+public slots:
+	void applySettings();
+	void refresh();
+
+public:
+	PerformancePreferences(QWidget *parent = 0);
+};
+
 
 class QGridLayout;
 class PreferencesFontChooser : public QWidget
@@ -20,8 +20,9 @@
 #include "core/RelativeDate.h"
 #include "core/Entry.h"
 #include "core/EntriesCache.h"
+#include "core/TrainingTrace.h"
 #include "core/jmdict/JMdictEntry.h"
-#include "core/jmdict/JMdictPlugin.h"
+#include "core/jmdict/JMdictReadingCandidates.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
 #include "gui/TrainSettings.h"
 #include "gui/EntryFormatter.h"
@@ -35,7 +36,7 @@
 PreferenceItem<QByteArray> ReadingTrainer::windowGeometry("readingTrainWindow", "geometry", "");
 PreferenceItem<bool> ReadingTrainer::showMeaning("readingTrainWindow", "showMeaning", true);
 
-ReadingTrainer::ReadingTrainer(QWidget *parent) : QFrame(parent), _goodCount(0), _wrongCount(0), _totalCount(0), query(Database::connection())
+ReadingTrainer::ReadingTrainer(QWidget *parent) : QFrame(parent), _goodCount(0), _wrongCount(0), _totalCount(0)
 {
 	ui.setupUi(this);
 	setWindowTitle(tr("Reading practice"));
@@ -82,19 +83,22 @@ void ReadingTrainer::newSession()
 	QApplication::processEvents();
 
 	// Get the train settings and build the query string
-	QString queryString(QString("select k1.id from training cross join jmdict.kanjiChar as k1 on training.type = %1 and training.id = k1.kanji cross join training as t2 on t2.type = %2 and t2.id = k1.id cross join jmdict.entries on entries.id = t2.id cross join jmdict.senses on senses.id = k1.id and senses.priority = 0 where k1.priority = 0 and (senses.misc0 & %3) = 0").arg(KANJIDIC2ENTRY_GLOBALID).arg(JMDICTENTRY_GLOBALID).arg(1 << JMdictPlugin::miscMap()["uk"].second));
+	JMdictReadingCandidates::update(Database::connection());
+	QString queryString(JMdictReadingCandidates::selectStatement("c.id, training.score"));
+	bool due(TrainSettings::biasPref.value() == TrainSettings::BIAS_DUE);
+	if (due) queryString += QString(" and training.dueDate <= %1").arg(TrainSettings::dueDateLimit());
 	RelativeDate minDate(TrainSettings::minDatePref.value());
-	if (minDate.isSet()) queryString += QString(" and (t2.dateLastTrain < %1 OR t2.dateLastTrain is null)").arg(QDateTime(minDate.date()).toSecsSinceEpoch());
+	if (!due && minDate.isSet()) queryString += QString(" and (training.dateLastTrain < %1 OR training.dateLastTrain is null)").arg(QDateTime(minDate.date()).toSecsSinceEpoch());
 	RelativeDate maxDate(TrainSettings::maxDatePref.value());
-	if (maxDate.isSet()) queryString += QString(" and t2.dateLastTrain > %1").arg(QDateTime(maxDate.date()).toSecsSinceEpoch());
+	if (!due && maxDate.isSet()) queryString += QString(" and training.dateLastTrain > %1").arg(QDateTime(maxDate.date()).toSecsSinceEpoch());
 	int minScore(TrainSettings::minScorePref.value());
-	if (minScore != TrainSettings::MINSCORE_DEFAULT) queryString += QString(" and t2.score >= %1").arg(minScore);
+	if (minScore != TrainSettings::MINSCORE_DEFAULT) queryString += QString(" and training.score >= %1").arg(minScore);
 	int maxScore(TrainSettings::maxScorePref.value());
-	if (maxScore != TrainSettings::MAXSCORE_DEFAULT) queryString += QString(" and t2.score <= %1").arg(maxScore);
-	queryString += " group by k1.id having count(k1.kanji) = entries.kanjiCount ";
-	queryString += TrainSettings::buildOrderString("t2.score");
+	if (maxScore != TrainSettings::MAXSCORE_DEFAULT) queryString += QString(" and training.score <= %1").arg(maxScore);
+	if (due) queryString += " order by training.dueDate";
 
-	query.exec(queryString);
+	_prefetched.clear();
+	_entries.loadType(queryString, JMDICTENTRY_GLOBALID, TrainSettings::bias());
 	messageBox.hide();
 }
 
@@ -110,14 +114,24 @@ void ReadingTrainer::train()
 		ui.detailedView->detailedView()->display(entry);
 	}
 
-	if (query.next()) {
-		entry = JMdictEntryRef(query.valueInt(0)).get();
+	if (!_entries.atEnd()) {
+		EntryRef ref(_entries.next());
+		TrainingTrace::mark(TrainingTrace::Queried);
+		entry = _prefetched.take(ref);
+		if (!entry) entry = ref.get();
+		TrainingTrace::mark(TrainingTrace::Loaded);
+		foreach (const EntryRef &next, _entries.peek(PREFETCH_SIZE)) {
+			if (_prefetched.contains(next)) continue;
+			_prefetched[next] = EntryPointer();
+			next.getAsync(this, SLOT(onPrefetched(EntryRef, EntryPointer)));
+		}
 		ui.writingLabel->setText(entry->writings()[0]);
 		if (_showMeaning->isChecked()) {
 			ui.detailedView->detailedView()->setKanjiClickable(false);
 			onShowMeaningChecked(true);
 		}
 		ui.userInput->clear();
+		TrainingTrace::renderPending();
 	} else {
 		if (_totalCount == 0) QMessageBox::information(this, tr("No matching entries found"), tr("Unable to find any entry eligible for reading practice. Entries eligible for this training mode are studied vocabulary entries for which all kanji are also studied, and that match the train settings. Please add entries or modify the train settings accordingly if you want to practice this mode."));
 		else QMessageBox::information(this, tr("No more entries to train"), tr("There are no more entries to train for the current train settings."));
@@ -128,6 +142,7 @@ void ReadingTrainer::train()
 void ReadingTrainer::checkAnswer()
 {
 	bool correct(false);
+	TrainingTrace::answered('R');
 	QString answer(ui.userInput->text());
 	if (TextTools::isRomaji(answer))
 		answer = TextTools::romajiToKana(answer);
@@ -140,16 +155,20 @@ void ReadingTrainer::checkAnswer()
 	if (correct) {
 		ui.resultLabel->setText(tr("<font color=\"green\">Correct!</font>"));
 		entry->train(true);
+		TrainingTrace::mark(TrainingTrace::Written);
 		_goodCount++;
 	} else {
 		ui.resultLabel->setText(tr("<font color=\"red\">Error!</font>"));
 		entry->train(false);
+		TrainingTrace::mark(TrainingTrace::Written);
 		_wrongCount++;
 		ui.nextButton->setVisible(true);
 		ui.okButton->setVisible(false);
 		ui.userInput->setVisible(false);
 		ui.nextButton->setFocus();
 		ui.detailedView->detailedView()->display(entry);
+		// The next entry is only shown once the user has read the answer
+		TrainingTrace::renderPending();
 	}
 	ui.detailedView->detailedView()->setKanjiClickable(true);
 	_totalCount++;
@@ -169,10 +188,9 @@ void ReadingTrainer::onShowMeaningChecked(bool checked)
 		QTextDocument *document(ui.detailedView->detailedView()->document());
 		const EntryFormatter *formatter = EntryFormatter::getFormatter(entry);
 		QStringList parts;
-		TemplateFiller filler;
 		parts << "back";
 		document->setDefaultStyleSheet(formatter->CSS());
-		QString html(filler.fill(filler.extract(formatter->htmlTemplate(), parts), formatter, entry));
+		QString html(formatter->compiledTemplate(parts).fill(formatter, entry));
 		document->setHtml(html);
 	}
 }
@@ -181,3 +199,9 @@ void ReadingTrainer::updateStatusLabel()
 {
 	ui.statusLabel->setText(tr("Correct: %1, Wrong: %2, Total: %3").arg(_goodCount).arg(_wrongCount).arg(_totalCount));
 }
+
+void ReadingTrainer::onPrefetched(EntryRef ref, EntryPointer entry)
+{
+	// Dropped since it has been requested
+	if (_prefetched.contains(ref)) _prefetched[ref] = entry;
+}
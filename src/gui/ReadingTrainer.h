@@ -21,8 +21,9 @@
 #include "gui/ui_ReadingTrainer.h"
 
 #include <QFrame>
-#include "sqlite/Query.h"
+#include "core/TrainingSnapshot.h"
 #include <QCheckBox>
+#include <QHash>
 
 class ReadingTrainer : public QFrame
 {
@@ -33,7 +34,11 @@ private:
 	Ui::ReadingTrainer ui;
 	EntryPointer entry;
 	unsigned int _goodCount, _wrongCount, _totalCount;
-	SQLite::Query query;
+	TrainingSnapshot _entries;
+	/// Number of entries loaded in advance
+	static const int PREFETCH_SIZE = 3;
+	/// Next entries to train, loaded while the current one is answered
+	QHash<EntryRef, EntryPointer> _prefetched;
 	QCheckBox *_showMeaning;
 	QAction *_showMeaningAction;
 
@@ -50,6 +55,7 @@ public:
 protected slots:
 	void checkAnswer();
 	void onShowMeaningChecked(bool checked);
+	void onPrefetched(EntryRef ref, EntryPointer entry);
 
 public slots:
 	void train();
@@ -17,29 +17,54 @@
 
 #include "gui/ResultsList.h"
 #include "gui/EntryFormatter.h"
+#include "gui/EntriesMimeData.h"
 
 #include <QtDebug>
 #include <QDataStream>
 #include <QColor>
 
-ResultsList::ResultsList(QObject *parent) : QAbstractListModel(parent), entries(), displayedUntil(0), dbThread(), query(&dbThread)
+#include <algorithm>
+#include <limits>
+
+ResultsList::ResultsList(QObject *parent) : QAbstractListModel(parent), entries(), _flushInterval(minFlushInterval), displayedUntil(0), _complete(false), _lastQueryDuration(0), dbThread(DatabaseThreadPool::instance().acquire()), query(dbThread), _paged(false), _pagedSearch(false), _pageStart(0), _hasMorePages(false), _continuationStep(NoContinuation), countQuery(dbThread), _totalResults(-1), _missingFirst(-1), _missingLast(-1), _sortKey(QueryOrder)
 {
 	connect(&timer, SIGNAL(timeout()),
-		this, SLOT(updateViews()));
-	timer.setInterval(100);
+		this, SLOT(onFlushTimeout()));
+	connect(&EntryChanges::instance(), SIGNAL(entryChanged(Entry *)),
+		this, SLOT(onEntryChanged(Entry *)));
+	connect(&EntryChanges::instance(), SIGNAL(entriesChanged(QList<Entry *>)),
+		this, SLOT(onEntriesChanged(QList<Entry *>)));
+	timer.setSingleShot(true);
 	
 	// Results emitted by a query are added to us
-	connect(&query, SIGNAL(result(EntryRef)), this, SLOT(addResult(EntryRef)));
+	query.setBatched(true);
+	connect(&query, SIGNAL(results(QVector<EntryRef>)), this, SLOT(addResults(QVector<EntryRef>)));
 	connect(&query, SIGNAL(firstResult()), this, SLOT(startReceive()));
+	connect(&query, SIGNAL(completed()), this, SLOT(onQueryCompleted()));
 	connect(&query, SIGNAL(completed()), this, SLOT(endReceive()));
 	connect(&query, SIGNAL(aborted()), this, SLOT(endReceive()));
 	connect(&query, SIGNAL(error(QString)), this, SLOT(endReceive()));
+	connect(&query, SIGNAL(lastRow(QList<QVariant>)), this, SLOT(onLastRow(QList<QVariant>)));
+
+	// Counting all the results is slow for broad searches, and must not
+	// delay the fetching of pages
+	countQuery.setPriority(ASyncQuery::Background);
+	connect(&countQuery, SIGNAL(result(QList<QVariant>)), this, SLOT(onCountResult(QList<QVariant>)));
+	connect(&countQuery, SIGNAL(completed()), this, SLOT(onContinuationStepCompleted()));
+	connect(&countQuery, SIGNAL(error(QString)), this, SLOT(onContinuationError()));
+	// Temporary tables are per connection, but the database thread may be
+	// shared with other results lists
+	static int lastContinuationTable = 0;
+	_continuationTable = QString("results%1").arg(++lastContinuationTable);
+
+	connect(&_prefetcher, SIGNAL(loaded(int, QVector<EntrySummary>)), this, SLOT(onEntriesPrefetched(int, QVector<EntrySummary>)));
 }
 
 ResultsList::~ResultsList()
 {
 	abortSearch();
 	clear();
+	DatabaseThreadPool::instance().release(dbThread);
 }
 
 QVariant ResultsList::data(const QModelIndex &index, int role) const
@@ -48,19 +73,42 @@ QVariant ResultsList::data(const QModelIndex &index, int role) const
 
 	if (index.row() >= entries.size()) return QVariant();
 
-	if (role == Entry::EntryRefRole) return QVariant::fromValue(entries[index.row()]);
-	EntryPointer entry(entries[index.row()].get());
-//	EntryPointer entry(0);
+	EntryRef ref(entries[index.row()]);
+	if (role == Entry::EntryRefRole) return QVariant::fromValue(ref);
+	if (role == Entry::EntryRole) return QVariant::fromValue(ref.get());
+	if (role != Entry::LoadedEntryRole && role != Entry::SummaryRole && role != Qt::BackgroundRole && role != Qt::DisplayRole) return QVariant();
+
+	// Do not block the view on loading entries, only load their summaries
+	// in the background. Loaded entries are up-to-date, so their summary
+	// is refreshed from them if they changed since it was built.
+	EntryPointer entry;
+	if (ref.isLoaded()) entry = ref.get();
+	if (entry && _summaries[index.row()].version() != entry->version()) {
+		_summaries[index.row()] = EntrySummary(*entry);
+		if (!_rows.contains(ref, index.row())) _rows.insert(ref, index.row());
+	}
+	const EntrySummary &summary = _summaries[index.row()];
+	if (summary.isNull()) {
+		if (_missingFirst == -1) {
+			QTimer::singleShot(0, const_cast<ResultsList *>(this), SLOT(loadMissing()));
+			_missingFirst = _missingLast = index.row();
+		}
+		else {
+			_missingFirst = qMin(_missingFirst, index.row());
+			_missingLast = qMax(_missingLast, index.row());
+		}
+	}
 
 	switch (role) {
-	case Qt::BackgroundRole:
-		if (!entry.data() || !entry->trained()) return QVariant();
-		else return EntryFormatter::scoreColor(*entry);
-	case Entry::EntryRole:
+	case Entry::LoadedEntryRole:
 		return QVariant::fromValue(entry);
+	case Entry::SummaryRole:
+		return QVariant::fromValue(summary);
+	case Qt::BackgroundRole:
+		if (!summary.trained()) return QVariant();
+		else return EntryFormatter::scoreColor(summary.score());
 	case Qt::DisplayRole:
-		if (entry.data()) return entry->shortVersion();
-		else return "";
+		return summary.shortVersion();
 	default:
 		return QVariant();
 	}
@@ -76,13 +124,72 @@ QVariant ResultsList::headerData(int section, Qt::Orientation orientation, int r
 void ResultsList::addResult(EntryRef entry)
 {
 	entries << entry;
+	_summaries << EntrySummary();
+	if (!_queryOrder.isEmpty()) _queryOrder << _queryOrder.size();
+}
+
+void ResultsList::addResults(const QVector<EntryRef> &newEntries)
+{
+	entries.reserve(entries.size() + newEntries.size());
+	int first = entries.size();
+	foreach (const EntryRef &entry, newEntries) entries << entry;
+	_summaries.resize(entries.size());
+	while (!_queryOrder.isEmpty() && _queryOrder.size() < entries.size()) _queryOrder << _queryOrder.size();
+	// The first screen of results does not need to wait for the timer
+	if (displayedUntil == 0 && entries.size() >= pageSize) updateViews();
+	// Pages are small and about to be displayed, so load their entries
+	// together rather than one by one as the view asks for them
+	if (_pagedSearch) prefetch(first, entries.size() - 1);
+}
+
+void ResultsList::loadMissing()
+{
+	if (_missingFirst == -1) return;
+	prefetch(_missingFirst, _missingLast);
+	_missingFirst = _missingLast = -1;
+}
+
+void ResultsList::prefetch(int first, int last)
+{
+	first = qMax(first, 0);
+	last = qMin(last, entries.size() - 1);
+	// No need to reload the summaries we already have at the ends
+	while (first <= last && !_summaries[first].isNull()) first++;
+	while (last >= first && !_summaries[last].isNull()) last--;
+	if (first > last) return;
+	_prefetcher.prefetch(entries.mid(first, last - first + 1), first);
+}
+
+void ResultsList::onEntriesPrefetched(int first, const QVector<EntrySummary> &summaries)
+{
+	int last = first - 1;
+	for (int i = 0; i < summaries.size() && first + i < entries.size(); i++) {
+		// The list may have changed since the request
+		if (summaries[i].ref() != entries[first + i]) continue;
+		_summaries[first + i] = summaries[i];
+		last = first + i;
+	}
+	if (last >= first) emit dataChanged(createIndex(first, 0), createIndex(last, 0));
+}
+
+void ResultsList::onEntryChanged(Entry *entry)
+{
+	// Already updated by onEntriesChanged()
+	if (EntryChanges::notifying()) return;
+	foreach (int row, _rows.values(EntryRef(entry->type(), entry->id()))) {
+		QModelIndex itemIndex = createIndex(row, 0);
+		emit dataChanged(itemIndex, itemIndex);
+	}
 }
 
-void ResultsList::onEntryChanged(const EntryPointer &entry)
+void ResultsList::onEntriesChanged(const QList<Entry *> &changed)
 {
-	int idx = entries.indexOf(EntryRef(entry));
-	QModelIndex itemIndex = createIndex(idx, 0);
-	emit dataChanged(itemIndex, itemIndex);
+	int first = -1, last = -1;
+	foreach (Entry *entry, changed) foreach (int row, _rows.values(EntryRef(entry->type(), entry->id()))) {
+		if (first == -1 || row < first) first = row;
+		if (row > last) last = row;
+	}
+	if (first != -1) emit dataChanged(createIndex(first, 0), createIndex(last, 0));
 }
 
 void ResultsList::updateViews()
@@ -90,33 +197,132 @@ void ResultsList::updateViews()
 	// TODO Acquire mutex on entries to ensure consistency despite of
 	// multithreading?
 	if (displayedUntil < entries.size()) {
-		beginInsertRows(QModelIndex(), displayedUntil, entries.size());
+		beginInsertRows(QModelIndex(), displayedUntil, entries.size() - 1);
 		endInsertRows();
 		displayedUntil = entries.size();
 	}
 }
 
+void ResultsList::onQueryCompleted()
+{
+	if (_pagedSearch) {
+		// A page that is not full is the last one
+		_hasMorePages = entries.size() - _pageStart >= pageSize;
+		_complete = !_hasMorePages;
+	}
+	else _complete = true;
+
+	if (_complete && _totalResults == -1) {
+		countQuery.abort();
+		_continuationStep = NoContinuation;
+		_totalResults = entries.size();
+		emit totalResultsKnown(_totalResults);
+	}
+}
+
+void ResultsList::onLastRow(const QList<QVariant> &row)
+{
+	_lastRow = row;
+}
+
+void ResultsList::onContinuationStepCompleted()
+{
+	switch (_continuationStep) {
+	case DroppingContinuation:
+		_continuationStep = CreatingContinuation;
+		countQuery.exec(QString("CREATE TEMP TABLE %1 AS %2").arg(_continuationTable).arg(_continuationStatement));
+		break;
+	case CreatingContinuation:
+		_continuationStep = CountingContinuation;
+		countQuery.exec(QString("SELECT count(*) FROM temp.%1").arg(_continuationTable));
+		break;
+	case CountingContinuation:
+		_continuationStep = ContinuationReady;
+		break;
+	default:
+		break;
+	}
+}
+
+void ResultsList::onContinuationError()
+{
+	// Next pages will run the search again, but we still want the count
+	bool fallback = _continuationStep != NoContinuation;
+	_continuationStep = NoContinuation;
+	if (fallback && _totalResults == -1) countQuery.exec(_countStatement);
+}
+
+void ResultsList::onCountResult(const QList<QVariant> &result)
+{
+	if (result.isEmpty() || _totalResults != -1) return;
+	_totalResults = result[0].toInt();
+	emit totalResultsKnown(_totalResults);
+}
+
+bool ResultsList::canFetchMore(const QModelIndex &parent) const
+{
+	if (parent.isValid()) return false;
+	return _hasMorePages && !query.active();
+}
+
+void ResultsList::fetchMore(const QModelIndex &parent)
+{
+	if (!canFetchMore(parent)) return;
+	fetchPage();
+}
+
+void ResultsList::fetchPage()
+{
+	_hasMorePages = false;
+	_pageStart = entries.size();
+	if (_continuationStep == ContinuationReady)
+		query.exec(QString("SELECT * FROM temp.%1 WHERE rowid > %2 ORDER BY rowid LIMIT %3").arg(_continuationTable).arg(_pageStart).arg(pageSize));
+	else query.exec(_pagedQuery.buildKeysetSqlStatement(_lastRow));
+}
+
+void ResultsList::onFlushTimeout()
+{
+	updateViews();
+	_flushInterval = qMin(_flushInterval * 2, (int)maxFlushInterval);
+	timer.start(_flushInterval);
+}
+
 void ResultsList::startReceive()
 {
-	timer.start();
+	_flushInterval = minFlushInterval;
+	timer.start(_flushInterval);
 }
 
 void ResultsList::endReceive()
 {
 	timer.stop();
 	updateViews();
+	if (_queryTime.isValid()) {
+		_lastQueryDuration = _queryTime.elapsed();
+		_queryTime.invalidate();
+	}
 	emit queryEnded();	
 }
 
 void ResultsList::clear()
 {
+	_prefetcher.cancel();
+	_missingFirst = _missingLast = -1;
+	_complete = false;
+	_hasMorePages = false;
+	_lastRow.clear();
+	_totalResults = -1;
+	_sortKey = QueryOrder;
+	_queryOrder = QVector<int>();
 	if (entries.isEmpty()) return;
 
 	timer.stop();
 	beginRemoveRows(QModelIndex(), 0, entries.size() - 1);
 	// This is preferred to clear() because lists memory
 	// usage never shrinks
-	entries = QList<EntryRef>();
+	entries.clear();
+	_rows = QMultiHash<EntryRef, int>();
+	_summaries = QVector<EntrySummary>();
 	endRemoveRows();
 	displayedUntil = 0;
 }
@@ -130,20 +336,9 @@ Qt::ItemFlags ResultsList::flags(const QModelIndex &index) const
 }
 
 QMimeData *ResultsList::mimeData(const QModelIndexList &indexes) const
-{  
-	QMimeData *mimeData = new QMimeData();
-	QByteArray encodedData;
-
-	QDataStream stream(&encodedData, QIODevice::WriteOnly);
-
-	foreach (QModelIndex index, indexes) {
-		if (index.isValid()) {
-			stream << data(index, Entry::EntryRefRole).value<EntryRef>();
-		}
-	}
-
-	mimeData->setData("tagainijisho/entry", encodedData);
-	return mimeData;
+{
+	// Only the rows are kept until the references are dropped
+	return new EntriesMimeData(entries, indexes);
 }
 
 void ResultsList::search(const QueryBuilder &qBuilder)
@@ -155,13 +350,185 @@ void ResultsList::search(const QueryBuilder &qBuilder)
 	clear();
 	
 	// And start the query!
-	query.exec(qBuilder.buildSqlStatement());
+	_complete = false;
+	_queryTime.start();
+	QString firstPage;
+	if (_paged) {
+		_pagedQuery = qBuilder;
+		_pagedQuery.setLimit(QueryBuilder::Limit(pageSize));
+		firstPage = _pagedQuery.buildKeysetSqlStatement(QList<QVariant>());
+	}
+	// Fall back to fetching all the results if the query cannot be paged
+	_pagedSearch = !firstPage.isEmpty();
+	query.setRecordLastRow(_pagedSearch);
+	if (_pagedSearch) {
+		_pageStart = 0;
+		query.exec(firstPage);
+		// SQLite only keeps the first page while sorting it, so it comes
+		// quickly. Sort everything for the next pages in the background
+		QueryBuilder all(qBuilder);
+		all.setLimit(QueryBuilder::Limit());
+		_continuationStatement = all.buildKeysetSqlStatement(QList<QVariant>());
+		_countStatement = qBuilder.buildCountSqlStatement();
+		_continuationStep = DroppingContinuation;
+		countQuery.exec(QString("DROP TABLE IF EXISTS temp.%1").arg(_continuationTable));
+	}
+	else query.exec(qBuilder.buildSqlStatement());
 	emit queryStarted();
 }
 
+ResultsList::Snapshot ResultsList::snapshot() const
+{
+	Snapshot ret;
+	if (query.active()) return ret;
+	ret.valid = true;
+	ret.entries = entries;
+	ret.complete = _complete;
+	ret.pagedSearch = _pagedSearch;
+	ret.hasMorePages = _hasMorePages;
+	ret.pagedQuery = _pagedQuery;
+	ret.lastRow = _lastRow;
+	ret.totalResults = _totalResults;
+	ret.sortKey = _sortKey;
+	ret.queryOrder = _queryOrder;
+	return ret;
+}
+
+void ResultsList::restore(const Snapshot &snapshot)
+{
+	abortSearch();
+	clear();
+
+	emit queryStarted();
+	_pagedSearch = snapshot.pagedSearch;
+	_pagedQuery = snapshot.pagedQuery;
+	_lastRow = snapshot.lastRow;
+	// The continuation table belongs to the search that replaced this
+	// one, further pages use the last row instead
+	_continuationStep = NoContinuation;
+	_pageStart = snapshot.entries.size();
+	if (!snapshot.entries.isEmpty()) {
+		beginInsertRows(QModelIndex(), 0, snapshot.entries.size() - 1);
+		entries = snapshot.entries;
+		_summaries.resize(entries.size());
+		displayedUntil = entries.size();
+		endInsertRows();
+	}
+	_complete = snapshot.complete;
+	_hasMorePages = snapshot.hasMorePages;
+	_totalResults = snapshot.totalResults;
+	_sortKey = snapshot.sortKey;
+	_queryOrder = snapshot.queryOrder;
+	if (_totalResults != -1) emit totalResultsKnown(_totalResults);
+	emit queryEnded();
+}
+
+/// Sort key of a row, and its position in the results of the query
+struct ResultsSortItem
+{
+	int key;
+	int queryPos;
+	int row;
+
+	bool operator<(const ResultsSortItem &other) const {
+		return key < other.key || (key == other.key && queryPos < other.queryPos);
+	}
+};
+
+bool ResultsList::sortResults(SortKey key)
+{
+	if (!_complete || query.active()) return false;
+	_prefetcher.cancel();
+	int n = entries.size();
+
+	// Keys come from the summaries, load the missing ones all at once
+	QList<EntryRef> missing;
+	QVector<int> missingRows;
+	for (int i = 0; i < n; i++) if (_summaries[i].isNull()) {
+		missing << entries[i];
+		missingRows << i;
+	}
+	if (!missing.isEmpty()) {
+		QVector<EntrySummary> summaries(EntriesCache::getSummaries(missing));
+		for (int i = 0; i < summaries.size(); i++) _summaries[missingRows[i]] = summaries[i];
+	}
+
+	// Compute the keys once rather than on every comparison
+	QVector<ResultsSortItem> items(n);
+	for (int i = 0; i < n; i++) {
+		const EntrySummary *summary = &_summaries[i];
+		// Loaded entries are up-to-date, e.g. if they have just been
+		// trained. data() refreshes their summary when displaying them
+		EntrySummary fresh;
+		EntryRef ref(entries[i]);
+		if (ref.isLoaded()) {
+			EntryPointer entry(ref.get());
+			if (entry && summary->version() != entry->version()) {
+				fresh = EntrySummary(*entry);
+				summary = &fresh;
+			}
+		}
+		ResultsSortItem &item = items[i];
+		item.row = i;
+		item.queryPos = _queryOrder.isEmpty() ? i : _queryOrder[i];
+		switch (key) {
+		case StudiedFirst:
+			item.key = summary->trained() ? 0 : 1;
+			break;
+		case ScoreOrder:
+			// Studied entries with the lowest score first, as the query does
+			item.key = summary->trained() ? summary->score() : std::numeric_limits<int>::max();
+			break;
+		default:
+			item.key = 0;
+			break;
+		}
+	}
+	// The position in the query makes all the keys different
+	std::sort(items.begin(), items.end());
+
+	emit layoutAboutToBeChanged();
+	EntryRefList sorted;
+	sorted.reserve(n);
+	QVector<EntrySummary> summaries(n);
+	QVector<int> queryOrder(n);
+	QVector<int> newRows(n);
+	bool inQueryOrder = true;
+	for (int i = 0; i < n; i++) {
+		const ResultsSortItem &item = items[i];
+		sorted << entries[item.row];
+		summaries[i] = _summaries[item.row];
+		queryOrder[i] = item.queryPos;
+		newRows[item.row] = i;
+		if (item.queryPos != i) inQueryOrder = false;
+	}
+	entries = sorted;
+	_summaries = summaries;
+	_queryOrder = inQueryOrder ? QVector<int>() : queryOrder;
+
+	QMultiHash<EntryRef, int> rows;
+	for (QMultiHash<EntryRef, int>::const_iterator it = _rows.constBegin(); it != _rows.constEnd(); ++it)
+		rows.insert(it.key(), newRows[it.value()]);
+	_rows = rows;
+	_missingFirst = _missingLast = -1;
+
+	QModelIndexList from(persistentIndexList()), to;
+	foreach (const QModelIndex &index, from) {
+		if (index.row() < n) to << createIndex(newRows[index.row()], index.column());
+		else to << QModelIndex();
+	}
+	changePersistentIndexList(from, to);
+	_sortKey = key;
+	emit layoutChanged();
+	return true;
+}
+
 void ResultsList::abortSearch()
 {
 	query.abort();
+	countQuery.abort();
+	_continuationStep = NoContinuation;
+	_hasMorePages = false;
 	// Flush all the entries the results list may be receiving
 	QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents | QEventLoop::ExcludeSocketNotifiers);
 	emit queryEnded();
@@ -22,39 +22,187 @@
 #include "core/EntriesCache.h"
 #include "core/QueryBuilder.h"
 #include "core/ASyncEntryFinder.h"
+#include "core/EntriesPrefetcher.h"
+#include "core/EntrySummary.h"
+#include "core/EntryRefList.h"
 
 #include <QAbstractListModel>
 #include <QList>
+#include <QVector>
 #include <QTimer>
 #include <QMimeData>
+#include <QElapsedTimer>
+#include <QMultiHash>
 
 /**
  * An entity that fetches and store results emitted by a query in pages of
  * given size. It can also be used as a list model to display the results.
+ *
+ * In paged mode, only the first pageSize results are fetched when a search
+ * starts. Further pages are fetched using keyset pagination when the view
+ * reaches the end of the results (see fetchMore()), and the total number of
+ * results is computed by a separate background query.
+ *
+ * Displaying results does not require their entries to be loaded: only
+ * their summaries are, which are loaded in the background by a prefetcher
+ * and can be requested ahead of time using prefetch(). Full entries are
+ * used instead when they are already loaded, and only Entry::EntryRole
+ * loads them.
+ *
+ * Once all the results of a search have been fetched, they can be sorted
+ * again in memory using sortResults(), without running the query.
  */
 class ResultsList : public QAbstractListModel
 {
 	Q_OBJECT
+public:
+	/// Orders in which complete results can be sorted, see sortResults()
+	typedef enum { QueryOrder, StudiedFirst, ScoreOrder } SortKey;
+
 private:
-	QList<EntryRef> entries;
+	EntryRefList entries;
+	/// Rows of the loaded entries that have been displayed, to update
+	/// them when their entry changes. Other rows do not need it, their
+	/// summaries are loaded when they are displayed.
+	mutable QMultiHash<EntryRef, int> _rows;
+	/// Signals the received rows to the views, see onFlushTimeout()
 	QTimer timer;
+	int _flushInterval;
 	int displayedUntil;
+	/// Whether entries contains all the results of the last query
+	bool _complete;
+	QElapsedTimer _queryTime;
+	qint64 _lastQueryDuration;
 
-	DatabaseThread dbThread;
+	DatabaseThread *dbThread;
 	ASyncEntryFinder query;
 
+	bool _paged;
+	/// Whether the running search is actually paged
+	bool _pagedSearch;
+	/// Query of the current paged search, limited to one page
+	QueryBuilder _pagedQuery;
+	/// Columns of the last result, to start the next page after
+	QList<QVariant> _lastRow;
+	/// Number of results before the page being fetched
+	int _pageStart;
+	bool _hasMorePages;
+	/**
+	 * Steps of the continuation of a paged search: while the first page
+	 * is displayed, all the results are sorted in the background into a
+	 * temporary table, from which the next pages are then read without
+	 * running the search again. The table also gives the total number of
+	 * results.
+	 */
+	typedef enum { NoContinuation, DroppingContinuation, CreatingContinuation, CountingContinuation, ContinuationReady } ContinuationStep;
+	ContinuationStep _continuationStep;
+	/// Name of the temporary table holding the sorted results
+	QString _continuationTable;
+	/// Statement giving all the sorted results of the current search
+	QString _continuationStatement;
+	/// Statement counting the results, used if the continuation fails
+	QString _countStatement;
+	/// Also runs the steps of the continuation
+	ASyncQuery countQuery;
+	int _totalResults;
+
+	EntriesPrefetcher _prefetcher;
+	/// Summaries of the entries, null until they are loaded
+	mutable QVector<EntrySummary> _summaries;
+	/// Range of rows that have been displayed without being loaded
+	mutable int _missingFirst, _missingLast;
+
+	SortKey _sortKey;
+	/// Position in the results of the query of every row, empty if the
+	/// rows are in the order of the query
+	QVector<int> _queryOrder;
+
 	void startPreparedQuery();
+	void fetchPage();
 	
 protected slots:
 	void updateViews();
-	void onEntryChanged(const EntryPointer &entry);
+	/**
+	 * Signals the rows received since the last time, and waits twice as
+	 * long before the next time. Results that come quickly are displayed
+	 * almost at once, while the views are not laid out again and again
+	 * for searches that return many results.
+	 */
+	void onFlushTimeout();
+	void onEntryChanged(Entry *entry);
+	/// Updates the rows of a batch of changed entries in a single range
+	void onEntriesChanged(const QList<Entry *> &changed);
+	void onQueryCompleted();
+	void onLastRow(const QList<QVariant> &row);
+	void onCountResult(const QList<QVariant> &result);
+	void onContinuationStepCompleted();
+	void onContinuationError();
+	void loadMissing();
+	void onEntriesPrefetched(int first, const QVector<EntrySummary> &summaries);
 
 public:
+	static const int pageSize = 100;
+	/// First delay before signaling received rows, about one frame, in milliseconds
+	static const int minFlushInterval = 16;
+	static const int maxFlushInterval = 512;
+
+	/**
+	 * Results of a search, that can be displayed again without running
+	 * it. The pages that have not been fetched yet are fetched from the
+	 * last row of the snapshot.
+	 */
+	struct Snapshot
+	{
+		/// False if the search was still running
+		bool valid;
+		EntryRefList entries;
+		bool complete;
+		bool pagedSearch;
+		bool hasMorePages;
+		QueryBuilder pagedQuery;
+		QList<QVariant> lastRow;
+		int totalResults;
+		SortKey sortKey;
+		QVector<int> queryOrder;
+
+		Snapshot() : valid(false), complete(false), pagedSearch(false), hasMorePages(false), totalResults(-1), sortKey(QueryOrder) {}
+		/// Approximate memory used by the snapshot, in bytes
+		int cost() const { return entries.size() * sizeof(EntryId) + queryOrder.size() * sizeof(int); }
+	};
+
 	ResultsList(QObject *parent = 0);
 	~ResultsList();
 
 	int rowCount(const QModelIndex &parent = QModelIndex()) const { return nbResults(); }
 	int nbResults() const { return entries.size(); }
+	const EntryRefList &results() const { return entries; }
+	/// Returns true if the last query has run until its end, i.e.
+	/// results() contains all its results.
+	bool isComplete() const { return _complete; }
+	/// Time the last query took to run, in milliseconds
+	qint64 lastQueryDuration() const { return _lastQueryDuration; }
+	/// Total number of results of the last query, or -1 if not known yet.
+	/// Can be larger than nbResults() in paged mode.
+	int nbTotalResults() const { return _totalResults; }
+
+	/// Must not be changed while a query is running
+	void setPaged(bool paged) { _paged = paged; }
+	/// Snapshot of the current results, only valid if no query is running
+	Snapshot snapshot() const;
+	/// Displays the results of snapshot, aborting the running search
+	void restore(const Snapshot &snapshot);
+	/**
+	 * Sorts the results by key, results with the same key staying in the
+	 * order of the query. The keys are computed from the summaries of the
+	 * results, which are loaded first if needed. Returns false without
+	 * changing the order if the results are not complete, in which case
+	 * only the query can sort them.
+	 */
+	bool sortResults(SortKey key);
+	SortKey sortKey() const { return _sortKey; }
+	bool paged() const { return _paged; }
+	bool canFetchMore(const QModelIndex &parent) const;
+	void fetchMore(const QModelIndex &parent);
 	QVariant data(const QModelIndex &index, int role) const;
 	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
 
@@ -68,11 +216,15 @@ public slots:
 	void startReceive();
 	void endReceive();
 	void addResult(EntryRef entry);
+	void addResults(const QVector<EntryRef> &newEntries);
 	void clear();
+	/// Loads the summaries of rows [first, last] in the background
+	void prefetch(int first, int last);
 
 signals:
 	void queryStarted();
 	void queryEnded();
+	void totalResultsKnown(int nbResults);
 };
 
 #endif
@@ -17,6 +17,7 @@
 
 #include "gui/TagsDialogs.h"
 #include "gui/ResultsView.h"
+#include "gui/ResultsList.h"
 
 #include <QtDebug>
 
@@ -37,13 +38,16 @@ PreferenceItem<QString> ResultsView::kanaFontSetting("mainWindow/resultsView", "
 PreferenceItem<QString> ResultsView::kanjiFontSetting("mainWindow/resultsView", "kanjiFont", QFont("Helvetica", 15).toString());
 PreferenceItem<int> ResultsView::displayModeSetting("mainWindow/resultsView", "displayMode", EntryDelegateLayout::TwoLines);
 
-ResultsView::ResultsView(QWidget *parent, EntryDelegateLayout *delegateLayout, bool viewOnly) : QListView(parent), _helper(this, delegateLayout, false, viewOnly)
+ResultsView::ResultsView(QWidget *parent, EntryDelegateLayout *delegateLayout, bool viewOnly) : QListView(parent), _helper(this, delegateLayout, false, viewOnly), _lastFirstRow(0)
 {
 	setUniformItemSizes(true);
 	setAlternatingRowColors(true);
 
-	// Set the delegate
-	setItemDelegate(new EntryDelegate(helper()->delegateLayout(), this));
+	// Set the delegate. All rows are entries of the same height, so the
+	// view only needs to know one of them
+	EntryDelegate *delegate = new EntryDelegate(helper()->delegateLayout(), this);
+	delegate->setUniformHeight(true);
+	setItemDelegate(delegate);
 
 	// Add the select all action to the context menu
 	QMenu *contextMenu = helper()->contextMenu();
@@ -64,6 +68,44 @@ ResultsView::ResultsView(QWidget *parent, EntryDelegateLayout *delegateLayout, b
 	// Scrolling
 	setSmoothScrolling(smoothScrollingSetting.value());
 	connect(&smoothScrollingSetting, SIGNAL(valueChanged(QVariant)), &_helper, SLOT(updateConfig(QVariant)));
+	connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(prefetchAhead()));
+	connect(&_charm, SIGNAL(destinationChanged(int)), this, SLOT(prefetchAhead()));
+	_scrollTimer.start();
+}
+
+/// Never prefetch more rows than this ahead of the visible ones
+#define MAX_PREFETCH_AHEAD 200
+
+void ResultsView::prefetchAhead()
+{
+	ResultsList *list = qobject_cast<ResultsList *>(model());
+	if (!list) return;
+
+	QModelIndex firstIndex(indexAt(QPoint(0, 0)));
+	if (!firstIndex.isValid()) return;
+	QModelIndex lastIndex(indexAt(QPoint(0, viewport()->height() - 1)));
+	int first = firstIndex.row();
+	int last = lastIndex.isValid() ? lastIndex.row() : model()->rowCount() - 1;
+	int visible = last - first + 1;
+
+	// Rows scrolled per second, used to guess how far we will be in half a second
+	qint64 elapsed = _scrollTimer.restart();
+	int delta = first - _lastFirstRow;
+	_lastFirstRow = first;
+	int ahead = visible;
+	if (elapsed > 0) ahead += qAbs(delta) * 500 / elapsed;
+	// When smooth scrolling we already know where we are going, so make
+	// sure the rows shown there are loaded before we reach them
+	int rowHeight = visualRect(firstIndex).height();
+	if (smoothScrolling() && rowHeight > 0) {
+		int destDelta = (_charm.destination() - verticalScrollBar()->value()) / rowHeight;
+		if (destDelta != 0) delta = destDelta;
+		ahead = qMax(ahead, qAbs(destDelta) + visible);
+	}
+	ahead = qMin(ahead, MAX_PREFETCH_AHEAD);
+
+	if (delta < 0) list->prefetch(qMax(0, first - ahead), last);
+	else list->prefetch(first, last + ahead);
 }
 
 void ResultsView::setSmoothScrolling(bool value)
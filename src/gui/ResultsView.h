@@ -32,6 +32,7 @@
 #include <QStyledItemDelegate>
 #include <QTextCharFormat>
 #include <QPixmap>
+#include <QElapsedTimer>
 
 /**
  * A list view suitable for displaying entries that come as the result of a query.
@@ -43,6 +44,9 @@ protected:
 	EntriesViewHelper _helper;
 	QAction *selectAllAction;
 	SmoothScroller _charm;
+	/// Used to estimate the scrolling speed for prefetching
+	QElapsedTimer _scrollTimer;
+	int _lastFirstRow;
 	
 	void contextMenuEvent(QContextMenuEvent *event);
 	virtual void startDrag(Qt::DropActions supportedActions);
@@ -51,6 +55,13 @@ protected:
 	 */
 	void selectionChanged(const QItemSelection &selected, const QItemSelection &deselected);
 
+protected slots:
+	/**
+	 * Asks the model to load the entries of the rows that will soon
+	 * become visible, according to the scrolling direction and speed.
+	 */
+	void prefetchAhead();
+
 public:
 	ResultsView(QWidget* parent = 0, EntryDelegateLayout* delegateLayout = 0, bool viewOnly = false);
 	EntriesViewHelper *helper() { return &_helper; }
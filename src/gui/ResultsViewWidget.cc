@@ -28,12 +28,14 @@ void ResultsViewWidget::setModel(ResultsList *rList)
 		disconnect(_results, SIGNAL(rowsRemoved(QModelIndex, int, int)), this, SLOT(updateResultsCount()));
 		disconnect(_results, SIGNAL(queryEnded()), this, SLOT(onSearchFinished()));
 		disconnect(_results, SIGNAL(queryStarted()), this, SLOT(onSearchStarted()));
+		disconnect(_results, SIGNAL(totalResultsKnown(int)), this, SLOT(updateResultsCount()));
 	}
 	_results = rList;
 	if (_results) {
 		connect(_results, SIGNAL(queryStarted()), this, SLOT(onSearchStarted()));
 		connect(_results, SIGNAL(queryEnded()), this, SLOT(onSearchFinished()));
 		connect(_results, SIGNAL(rowsRemoved(QModelIndex, int, int)), this, SLOT(updateResultsCount()));
+		connect(_results, SIGNAL(totalResultsKnown(int)), this, SLOT(updateResultsCount()));
 	}
 	_resultsView->setModel(rList);
 }
@@ -52,6 +54,8 @@ void ResultsViewWidget::onSearchFinished()
 void ResultsViewWidget::updateResultsCount()
 {
 	int nbResults = _resultsView->model()->rowCount();
+	// Paged results lists only contain the pages fetched so far
+	if (_results) nbResults = qMax(nbResults, _results->nbTotalResults());
 	if (nbResults == 0) nbResultsLabel->clear();
 	else nbResultsLabel->setText(QString(tr("%1 Results")).arg(nbResults));
 }
@@ -22,23 +22,27 @@
 #include <QWheelEvent>
 #include <QApplication>
 
+/// Duration of a scroll, in milliseconds
+#define SCROLL_DURATION 200
+
 ScrollBarSmoothScroller::ScrollBarSmoothScroller(QObject *parent) : QObject(parent), _scrollee(0), _delta(0)
 {
-	_timer.setInterval(20);
-	_timer.setSingleShot(false);
-	connect(&_timer, SIGNAL(timeout()), this, SLOT(updateAnimationState()));
+	_animation.setDuration(SCROLL_DURATION);
+	_animation.setEasingCurve(QEasingCurve::OutCubic);
+	connect(&_animation, SIGNAL(valueChanged(QVariant)), this, SLOT(onAnimationValueChanged(QVariant)));
 }
 
 ScrollBarSmoothScroller::ScrollBarSmoothScroller(QScrollBar *bar, QObject *parent) : QObject(parent), _scrollee(0), _delta(0)
 {
-	_timer.setInterval(20);
-	_timer.setSingleShot(false);
-	connect(&_timer, SIGNAL(timeout()), this, SLOT(updateAnimationState()));
+	_animation.setDuration(SCROLL_DURATION);
+	_animation.setEasingCurve(QEasingCurve::OutCubic);
+	connect(&_animation, SIGNAL(valueChanged(QVariant)), this, SLOT(onAnimationValueChanged(QVariant)));
 	setScrollBar(bar);
 }
 
 void ScrollBarSmoothScroller::setScrollBar(QScrollBar *bar)
 {
+	_animation.stop();
 	if (_scrollee) {
 		disconnect(_scrollee, SIGNAL(actionTriggered(int)), this, SLOT(onScrollBarAction(int)));
 		_scrollee->removeEventFilter(this);
@@ -58,11 +62,11 @@ bool ScrollBarSmoothScroller::eventFilter(QObject *watched, QEvent *event)
 		_delta += wEvent->angleDelta().y();
 		int steps = _delta / 120;
 		_delta %= 120;
-		if (!_timer.isActive()) _destination = _scrollee->value();
+		if (!isScrolling()) _destination = _scrollee->value();
 		_destination -= steps * _scrollee->singleStep() * QApplication::wheelScrollLines();
 		if (_destination < _scrollee->minimum()) _destination = _scrollee->minimum();
 		else if (_destination > _scrollee->maximum()) _destination = _scrollee->maximum();
-		if (!_timer.isActive()) _timer.start();
+		scrollToDestination();
 		event->accept();
 		return true;
 	}
@@ -78,22 +82,39 @@ void ScrollBarSmoothScroller::onScrollBarAction(int action)
 		case QAbstractSlider::SliderPageStepSub:
 			_destination = _scrollee->sliderPosition();
 			_scrollee->setSliderPosition(_scrollee->value());
-			if (!_timer.isActive()) _timer.start();
+			scrollToDestination();
 			break;
 		default:
 			break;
 	}
 }
 
-void ScrollBarSmoothScroller::updateAnimationState()
+void ScrollBarSmoothScroller::scrollToDestination()
 {
 	int pos(_scrollee->value());
 	if (_destination == pos) {
-		_timer.stop();
+		_animation.stop();
+		return;
+	}
+	// Restart from the current position so that successive wheel events
+	// accumulate into a single continuous movement
+	_animation.stop();
+	_animation.setStartValue(pos);
+	_animation.setEndValue(_destination);
+	emit destinationChanged(_destination);
+	_animation.start();
+}
+
+void ScrollBarSmoothScroller::onAnimationValueChanged(const QVariant &value)
+{
+	if (!_scrollee) return;
+	// The user took over
+	if (_scrollee->isSliderDown()) {
+		_animation.stop();
 		return;
 	}
-	int factor = qMax(1, qAbs(_destination - pos) / 3);
-	if (_destination > pos) pos += factor;
-	else pos -= factor;
-	_scrollee->setValue(pos);
+	// The value is interpolated from the elapsed time, so frames that came
+	// late simply move further. Don't repaint if we did not move by a pixel.
+	int pos(value.toInt());
+	if (pos != _scrollee->value()) _scrollee->setValue(pos);
 }
@@ -5,31 +5,49 @@
 
 #include <QObject>
 #include <QScrollBar>
-#include <QTimer>
+#include <QVariantAnimation>
 #include <QEvent>
 
+/**
+ * Smoothly scrolls a scrollbar to the positions requested by wheel events
+ * and step actions. The scrollbar is moved by an animation, which is driven
+ * by the animation clock of Qt and thus ticks with the display refresh.
+ * The position is computed from the elapsed time, so when painting falls
+ * behind the intermediate frames are skipped instead of slowing the
+ * scrolling down.
+ */
 class ScrollBarSmoothScroller : public QObject
 {
 	Q_OBJECT
 private:
-	QTimer _timer;
+	QVariantAnimation _animation;
 	QScrollBar *_scrollee;
 	int _destination;
 	int _delta;
 
 private slots:
 	void onScrollBarAction(int action);
-	void updateAnimationState();
+	void onAnimationValueChanged(const QVariant &value);
 
 protected:
 	/// Used to process scroll events on the scrollbar
 	virtual bool eventFilter(QObject *watched, QEvent *event);
+	/// Starts animating the scrollbar towards _destination
+	void scrollToDestination();
 
 public:
 	ScrollBarSmoothScroller(QObject *parent = 0);
 	ScrollBarSmoothScroller(QScrollBar *bar, QObject *parent = 0);
 	void setScrollBar(QScrollBar *bar);
 	QScrollBar *scrollBar() const { return _scrollee; }
+	bool isScrolling() const { return _animation.state() == QAbstractAnimation::Running; }
+	/// Position the scrollbar will reach at the end of the current scroll
+	int destination() const { return _destination; }
+
+signals:
+	/// Emitted when a new scrolling destination is set, before the
+	/// scrollbar starts moving towards it
+	void destinationChanged(int destination);
 };
 
 #endif
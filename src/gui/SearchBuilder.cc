@@ -21,6 +21,9 @@
 
 SearchBuilder::SearchBuilder(QObject *parent) : QObject(parent)
 {
+	_coalesceTimer.setSingleShot(true);
+	_coalesceTimer.setInterval(0);
+	connect(&_coalesceTimer, SIGNAL(timeout()), this, SLOT(runSearch()));
 }
 
 void SearchBuilder::reset()
@@ -33,11 +36,11 @@ void SearchBuilder::reset()
 	runSearch();
 }
 
-QString SearchBuilder::commands() const
+QString SearchBuilder::commands(const QString &except) const
 {
 	QStringList cmds;
 	foreach (const SearchFilterWidget *filter, _filters.values()) {
-		if (filter->isEnabled()) {
+		if (filter->isEnabled() && filter->name() != except) {
 			QString command(filter->currentCommand().trimmed());
 			if (!command.isEmpty()) cmds << command;
 		}
@@ -47,13 +50,19 @@ QString SearchBuilder::commands() const
 
 void SearchBuilder::runSearch()
 {
+	_coalesceTimer.stop();
 	emit queryRequested(commands());
 }
 
+void SearchBuilder::onCommandUpdated()
+{
+	_coalesceTimer.start();
+}
+
 bool SearchBuilder::addSearchFilter(SearchFilterWidget *filter)
 {
 	if (_filters.contains(filter->name())) return false;
-	connect(filter, SIGNAL(commandUpdated()), this, SLOT(runSearch()));
+	connect(filter, SIGNAL(commandUpdated()), this, SLOT(onCommandUpdated()));
 	connect(filter, SIGNAL(enableFeature(QString)), this, SLOT(onFeatureEnabled(QString)));
 	connect(filter, SIGNAL(disableFeature(QString)), this, SLOT(onFeatureDisabled(QString)));
 	_filters[filter->name()] = filter;
@@ -66,7 +75,7 @@ void SearchBuilder::removeSearchFilter(const QString &name)
 		SearchFilterWidget *filter = _filters[name];
 		disconnect(filter, SIGNAL(disableFeature(QString)), this, SLOT(onFeatureDisabled(QString)));
 		disconnect(filter, SIGNAL(enableFeature(QString)), this, SLOT(onFeatureEnabled(QString)));
-		disconnect(filter, SIGNAL(commandUpdated()), this, SLOT(runSearch()));
+		disconnect(filter, SIGNAL(commandUpdated()), this, SLOT(onCommandUpdated()));
 		_filters.remove(name);
 	}
 }
@@ -22,6 +22,7 @@
 
 #include <QMap>
 #include <QString>
+#include <QTimer>
 
 /**
  * This class handles a set of SearchFilterWidgets
@@ -29,13 +30,20 @@
  * each time the state of one of them changes. This query
  * can then be connected to a ResultsList in order to be
  * executed.
+ *
+ * Filters changed during the same event loop iteration, e.g. when several
+ * of them are reset, only emit one query once they all have been changed.
  */
 class SearchBuilder : public QObject {
 	Q_OBJECT
 private:	
 	QMap<QString, SearchFilterWidget *> _filters;
+	/// Runs the search once the pending filter changes have been made
+	QTimer _coalesceTimer;
 	
 protected slots:
+	/// Called when the command of a filter changes
+	void onCommandUpdated();
 	void onFeatureEnabled(const QString &feature);
 	void onFeatureDisabled(const QString &feature);
 		
@@ -52,7 +60,8 @@ public:
 	void removeSearchFilter(const QString& name);
 	bool contains(const QString& name) { return _filters.contains(name); }
 	SearchFilterWidget *get(const QString &name) { return contains(name) ? _filters[name] : 0; }
-	QString commands() const;
+	/// Returns the commands of all enabled filters but the one named except
+	QString commands(const QString &except = QString()) const;
 	
 	QMap<QString, QVariant> getState() const;
 	void restoreState(const QMap<QString, QVariant> &state);
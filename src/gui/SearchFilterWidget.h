@@ -118,6 +118,16 @@ public:
 	 */
 	void setAutoUpdateQuery(bool status) { _autoUpdateQuery = status; }
 
+	/// Sets how long delayed updates wait before updating the query
+	void setUpdateDelay(int msec) { _timer.setInterval(msec); }
+
+	/**
+	 * Called every time a search is run, with the commands of all the
+	 * other filters. Widgets can use it to show how many results each of
+	 * their options would give. Does nothing by default.
+	 */
+	virtual void searchUpdated(const QString &otherCommands) { Q_UNUSED(otherCommands); }
+
 protected slots:
 	/**
 	 * This slot shall be called every time the state of the
@@ -29,8 +29,9 @@
 #include <QResizeEvent>
 
 PreferenceItem<int> SearchWidget::historySize("mainWindow/resultsView", "historySize", 100);
+PreferenceItem<int> SearchWidget::historySnapshotsSize("mainWindow/resultsView", "historySnapshotsSize", 4096);
 
-SearchWidget::SearchWidget(QWidget *parent) : QWidget(parent), _history(historySize.value())
+SearchWidget::SearchWidget(QWidget *parent) : QWidget(parent), _history(historySize.value()), _snapshots(historySnapshotsSize.value() * 1024)
 {
 	setupUi(this);
 	
@@ -48,7 +49,19 @@ SearchWidget::SearchWidget(QWidget *parent) : QWidget(parent), _history(historyS
 	
 	// Setup the results model and view
 	_results = new ResultsList(this);
+	_results->setPaged(true);
 	_resultsView->setModel(_results);
+	connect(_results, SIGNAL(queryEnded()), this, SLOT(onQueryEnded()));
+	connect(_results, SIGNAL(queryStarted()), this, SLOT(updateSortActions()));
+
+	// Complete results are sorted again without running the search
+	QMenu *sortMenu = resultsView()->helper()->contextMenu()->addMenu(tr("Sort by"));
+	_sortActions = new QActionGroup(sortMenu);
+	addSortAction(sortMenu, tr("Relevance"), ResultsList::QueryOrder);
+	addSortAction(sortMenu, tr("Studied entries first"), ResultsList::StudiedFirst);
+	addSortAction(sortMenu, tr("Score"), ResultsList::ScoreOrder);
+	connect(_sortActions, SIGNAL(triggered(QAction *)), this, SLOT(onSortActionTriggered(QAction *)));
+	updateSortActions();
 	
 	// Search builder
 	connect(&_searchBuilder, SIGNAL(queryRequested(QString)), this, SLOT(search(QString)));
@@ -80,6 +93,14 @@ SearchWidget::SearchWidget(QWidget *parent) : QWidget(parent), _history(historyS
 void SearchWidget::search(const QString &commands)
 {
 	QString localCommands(commands.trimmed());
+	// Nothing to do if the filters changed back to the displayed search
+	EntrySearcherManager &manager = EntrySearcherManager::instance();
+	if (!localCommands.isEmpty() && !_lastCommands.isEmpty() && manager.splitSearchString(localCommands) == manager.splitSearchString(_lastCommands)) {
+		_knownCommands.clear();
+		_knownResults.clear();
+		return;
+	}
+	saveSnapshot();
 	if (!(localCommands.isEmpty() || localCommands == ":jmdict" || localCommands == ":kanjidic")) {
 		_history.add(_searchBuilder.getState());
 		_search(localCommands);
@@ -91,40 +112,150 @@ void SearchWidget::search(const QString &commands)
 		_results->clear();
 		actionPreviousSearch->setEnabled(_history.hasPrevious());
 		actionNextSearch->setEnabled(_history.hasNext());
+		updateFilters();
 	}
 }
 
+void SearchWidget::updateFilters()
+{
+	foreach (SearchFilterWidget *filter, _searchFilterWidgets)
+		filter->searchUpdated(_searchBuilder.commands(filter->name()));
+}
+
 void SearchWidget::_search(const QString &commands)
 {
 	_queryBuilder.clear();
+	updateFilters();
 	
 	actionPreviousSearch->setEnabled(_history.hasPrevious());
 	actionNextSearch->setEnabled(_history.hasNext());
 
+	EntrySearcherManager &manager = EntrySearcherManager::instance();
+	EntryRefList knownResults;
+	if (!_knownCommands.isEmpty() && _knownCommands == commands) knownResults = _knownResults;
+	_knownCommands.clear();
+	_knownResults.clear();
+	// If the new search can only narrow the previous one, only look among
+	// its results instead of scanning the indexes again
+	bool refine = _results->isComplete() && _results->nbResults() <= maxRefinedResults && manager.isRefinement(_lastCommands, commands);
+	_lastCommands.clear();
+	_lastStamp.clear();
 	// If we cannot build a valid query, no need to continue
-	if (!EntrySearcherManager::instance().buildQuery(commands, _queryBuilder)) return;
+	if (!knownResults.isEmpty()) {
+		if (!manager.buildQuery(commands, _queryBuilder, knownResults)) return;
+	}
+	else if (refine) {
+		if (!manager.buildQuery(commands, _queryBuilder, _results->results())) return;
+	}
+	else if (!manager.buildQuery(commands, _queryBuilder)) return;
 
+	_lastCommands = commands;
+	_lastStamp = manager.resultsStamp();
 	_results->search(_queryBuilder);
 }
 
+void SearchWidget::setKnownResults(const QString &commands, const EntryRefList &results)
+{
+	_knownCommands = commands.trimmed();
+	_knownResults = results;
+}
+
+void SearchWidget::clearSnapshots()
+{
+	_snapshots.clear();
+	_lastStamp.clear();
+}
+
+void SearchWidget::onQueryEnded()
+{
+	// Fast searches can follow the user's typing closely, slow ones
+	// should not be restarted on every key stroke
+	int delay = qBound(150, (int)_results->lastQueryDuration(), 500);
+	foreach (SearchFilterWidget *filter, _searchFilterWidgets) filter->setUpdateDelay(delay);
+	updateSortActions();
+}
+
+void SearchWidget::addSortAction(QMenu *menu, const QString &label, ResultsList::SortKey key)
+{
+	QAction *action = menu->addAction(label);
+	action->setCheckable(true);
+	action->setData(key);
+	_sortActions->addAction(action);
+}
+
+void SearchWidget::updateSortActions()
+{
+	_sortActions->setEnabled(_results->isComplete() && _results->nbResults() > 1);
+	foreach (QAction *action, _sortActions->actions())
+		if (action->data().toInt() == _results->sortKey()) action->setChecked(true);
+}
+
+void SearchWidget::onSortActionTriggered(QAction *action)
+{
+	// The results may have been completed since the menu was shown
+	if (!_results->sortResults((ResultsList::SortKey)action->data().toInt())) updateSortActions();
+}
+
+void SearchWidget::saveSnapshot()
+{
+	if (_lastCommands.isEmpty()) return;
+	HistorySnapshot *snapshot = new HistorySnapshot;
+	snapshot->results = _results->snapshot();
+	if (!snapshot->results.valid) {
+		delete snapshot;
+		_snapshots.remove(_lastCommands);
+		return;
+	}
+	snapshot->query = _queryBuilder;
+	// The displayed results are those of the data when they were searched
+	snapshot->stamp = _lastStamp;
+	snapshot->scrollPosition = resultsView()->verticalScrollBar()->value();
+	// Too large snapshots are not inserted
+	_snapshots.insert(_lastCommands, snapshot, snapshot->results.cost() + 1);
+}
+
+void SearchWidget::goToHistoryItem(const QMap<QString, QVariant> &state)
+{
+	saveSnapshot();
+	_searchBuilder.restoreState(state);
+	QString commands(_searchBuilder.commands());
+	HistorySnapshot *cached = _snapshots.object(commands);
+	// Results may have changed since the snapshot, e.g. if an entry has
+	// been studied or tagged
+	if (!cached || cached->stamp.isEmpty() || cached->stamp != EntrySearcherManager::instance().resultsStamp()) {
+		_snapshots.remove(commands);
+		_search(commands);
+		return;
+	}
+	// Restoring processes pending events, which may replace the cached
+	// snapshot. The copy only shares the results
+	HistorySnapshot snapshot(*cached);
+	updateFilters();
+	actionPreviousSearch->setEnabled(_history.hasPrevious());
+	actionNextSearch->setEnabled(_history.hasNext());
+	_knownCommands.clear();
+	_knownResults.clear();
+	_queryBuilder = snapshot.query;
+	_lastCommands = commands;
+	_lastStamp = snapshot.stamp;
+	_results->restore(snapshot.results);
+	// Lay the rows out now so the scroll range includes them
+	resultsView()->doItemsLayout();
+	resultsView()->verticalScrollBar()->setValue(snapshot.scrollPosition);
+}
+
 void SearchWidget::goPrev()
 {
 	QMap<QString, QVariant> q;
 	bool ok = _history.previous(q);
-	if (ok) {
-		_searchBuilder.restoreState(q);
-		_search(_searchBuilder.commands());
-	}
+	if (ok) goToHistoryItem(q);
 }
 
 void SearchWidget::goNext()
 {
 	QMap<QString, QVariant> q;
 	bool ok = _history.next(q);
-	if (ok) {
-		_searchBuilder.restoreState(q);
-		_search(_searchBuilder.commands());
-	}
+	if (ok) goToHistoryItem(q);
 }
 
 void SearchWidget::resetSearch()
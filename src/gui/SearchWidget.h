@@ -29,6 +29,8 @@
 #include "gui/ui_SearchWidget.h"
 
 #include <QWidget>
+#include <QCache>
+#include <QActionGroup>
 
 /**
  * A widget that features all the necessary to search entries and display search results.
@@ -49,16 +51,52 @@ private:
 	SearchBuilder _searchBuilder;
 	ResultsList *_results;
 	QueryBuilder _queryBuilder;
+	/// Commands of the last search, to detect refinements
+	QString _lastCommands;
+	/// Results stamp taken when the last search was run
+	QString _lastStamp;
+	/// Superset of the results of the next search for _knownCommands
+	QString _knownCommands;
+	EntryRefList _knownResults;
+
+	/// Results of a search of the history, as they were last displayed
+	struct HistorySnapshot
+	{
+		ResultsList::Snapshot results;
+		QueryBuilder query;
+		/// See EntrySearcherManager::resultsStamp()
+		QString stamp;
+		int scrollPosition;
+	};
+	/// Snapshots of the searches of the history by commands, evicting
+	/// the least recently used ones over historySnapshotsSize
+	QCache<QString, HistorySnapshot> _snapshots;
+	/// Orders the results can be sorted in from the context menu
+	QActionGroup *_sortActions;
+
+	void addSortAction(QMenu *menu, const QString &label, ResultsList::SortKey key);
+
+	/// Saves the snapshot of the displayed results before they are replaced
+	void saveSnapshot();
+	/// Runs the search of a history item, or restores its snapshot
+	void goToHistoryItem(const QMap<QString, QVariant> &state);
 
 protected:
 	virtual bool eventFilter(QObject *obj, QEvent *event);
 
 	/// Run the search without touching the history.
 	void _search(const QString &commands);
+	/// Tells the filters a new search has been run
+	void updateFilters();
 
 protected slots:
 	/// Start a search with the given commands
 	void search(const QString &commands);
+	/// Adapts the filters input delay to the time searches take
+	void onQueryEnded();
+	/// Only complete results can be sorted
+	void updateSortActions();
+	void onSortActionTriggered(QAction *action);
 
 public:
 	SearchWidget(QWidget *parent = 0);
@@ -74,7 +112,29 @@ public:
 	SearchFilterWidget *getSearchFilter(const QString &name);
 	void removeSearchFilterWidget(const QString &name);
 
+	/**
+	 * Makes the next search for commands only look among results, which
+	 * must contain all of its results. Used to reopen saved searches
+	 * without scanning the indexes again.
+	 */
+	void setKnownResults(const QString &commands, const EntryRefList &results);
+	/// Forgets the results of the history, e.g. when the user database
+	/// is replaced
+	void clearSnapshots();
+	/// Commands of the last search that has been run
+	const QString &lastCommands() const { return _lastCommands; }
+	/// See EntrySearcherManager::resultsStamp(), as of when the last search
+	/// was run
+	const QString &lastStamp() const { return _lastStamp; }
+
 	static PreferenceItem<int> historySize;
+	/// Memory used by the results snapshots of the history, in KiB
+	static PreferenceItem<int> historySnapshotsSize;
+	/**
+	 * Maximum number of results of a search that can be refined in place:
+	 * beyond that, running the refined search from scratch is cheaper.
+	 */
+	static const int maxRefinedResults = 10000;
 
 public slots:
 	void resetSearch();
@@ -35,12 +35,16 @@ SingleEntryView::SingleEntryView(QObject *parent) : EntryMenu(parent), _entry(0)
 	connect(&setNotesAction, SIGNAL(triggered()), this, SLOT(setNotes()));
 	connect(this, SIGNAL(tagsHistorySelected(const QStringList &)),
 	this, SLOT(setTagsFromHistory(const QStringList &)));
+	connect(&EntryChanges::instance(), SIGNAL(entryChanged(Entry *)), this, SLOT(onEntryChanged(Entry *)));
+}
+
+void SingleEntryView::onEntryChanged(Entry *entry)
+{
+	if (entry == _entry.data()) emit entryChanged(entry);
 }
 
 void SingleEntryView::setEntry(const EntryPointer &entry)
 {
-	if (_entry) disconnect(_entry.data(), SIGNAL(entryChanged(Entry *)), this, SIGNAL(entryChanged(Entry *)));
-	if (entry) connect(entry.data(), SIGNAL(entryChanged(Entry *)), this, SIGNAL(entryChanged(Entry *)));
 	_entry = entry;
 	updateStatus(_entry);
 	emit entrySet(entry.data());
@@ -34,6 +34,9 @@ class SingleEntryView : public EntryMenu
 private:
 	EntryPointer _entry;
 
+private slots:
+	void onEntryChanged(Entry *entry);
+
 protected slots:
 	virtual void copyWriting();
 	virtual void copyReading();
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/Paths.h"
+#include "core/Database.h"
+#include "gui/SingleInstance.h"
+
+#include <QLocalSocket>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QtDebug>
+
+/// How long a second invocation waits for the running one, in milliseconds
+#define FORWARD_TIMEOUT 500
+
+SingleInstance::SingleInstance(QObject *parent) : QLocalServer(parent)
+{
+	connect(this, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+}
+
+SingleInstance::~SingleInstance()
+{
+}
+
+QString SingleInstance::serverName(const QString &profile)
+{
+	// Local sockets are per machine, so tell users, user profiles and
+	// profiles apart. Invalid profile names open the default profile, and
+	// valid ones cannot contain '/'
+	QString name(Database::isValidProfileName(profile) ? profile : QString());
+	QByteArray key(QDir(userProfile()).absolutePath().toUtf8() + '/' + name.toUtf8());
+	return QString("tagainijisho-%1").arg(QString(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex().left(16)));
+}
+
+bool SingleInstance::listen(const QString &profile)
+{
+	const QString name(serverName(profile));
+	setSocketOptions(QLocalServer::UserAccessOption);
+	if (QLocalServer::listen(name)) return true;
+	// A crashed instance may have left its socket behind. Only remove it
+	// if no running instance answers on it
+	if (serverError() == QAbstractSocket::AddressInUseError) {
+		QLocalSocket socket;
+		socket.connectToServer(name);
+		if (socket.waitForConnected(FORWARD_TIMEOUT)) {
+			socket.disconnectFromServer();
+			qWarning("Cannot listen for other instances: another instance is already listening");
+			return false;
+		}
+		QLocalServer::removeServer(name);
+		if (QLocalServer::listen(name)) return true;
+	}
+	qWarning("Cannot listen for other instances: %s", errorString().toLocal8Bit().constData());
+	return false;
+}
+
+bool SingleInstance::forward(const QString &search, const QString &profile)
+{
+	QLocalSocket socket;
+	socket.connectToServer(serverName(profile));
+	if (!socket.waitForConnected(FORWARD_TIMEOUT)) return false;
+	socket.write(search.simplified().toUtf8() + '\n');
+	if (!socket.waitForBytesWritten(FORWARD_TIMEOUT)) return false;
+	socket.disconnectFromServer();
+	return true;
+}
+
+void SingleInstance::onNewConnection()
+{
+	while (QLocalSocket *socket = nextPendingConnection()) {
+		connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+		connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+		// The line may already be there
+		if (socket->canReadLine()) emit searchRequested(QString::fromUtf8(socket->readLine()).trimmed());
+	}
+}
+
+void SingleInstance::onReadyRead()
+{
+	QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+	while (socket->canReadLine()) emit searchRequested(QString::fromUtf8(socket->readLine()).trimmed());
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_SINGLE_INSTANCE_H
+#define __GUI_SINGLE_INSTANCE_H
+
+#include <QLocalServer>
+#include <QString>
+
+class QLocalSocket;
+
+/**
+ * Lets a second invocation of the program with a search hand it over to
+ * the instance already running on the same user profile and profile, which
+ * answers it from its warm caches instead of going through the whole
+ * startup again.
+ *
+ * The running instance listens on a local socket named after the user
+ * profile and the name of its profile (see Database::currentProfile()); each
+ * request is a single line of UTF-8 text.
+ */
+class SingleInstance : public QLocalServer
+{
+	Q_OBJECT
+private:
+	static QString serverName(const QString &profile);
+
+private slots:
+	void onNewConnection();
+	void onReadyRead();
+
+signals:
+	void searchRequested(const QString &search);
+
+public:
+	SingleInstance(QObject *parent = 0);
+	virtual ~SingleInstance();
+
+	/// Starts accepting the searches of other invocations using profile
+	bool listen(const QString &profile);
+
+	/**
+	 * Sends search to the instance running on the same user profile and
+	 * profile. Returns false if there is none, in which case this
+	 * invocation should start normally.
+	 */
+	static bool forward(const QString &search, const QString &profile);
+};
+
+#endif
@@ -25,31 +25,50 @@
 #include <QScrollBar>
 #include <QWheelEvent>
 
-#define TIMER_DELAY 20
+/// Duration of a scroll, in milliseconds
+#define SCROLL_DURATION 200
 #define STEP_SIZE 120
 
-SmoothScroller::SmoothScroller(QObject *parent) : QObject(parent), _timer(), _user(0), _state(Stopped), _dest(0), _steps(0)
+SmoothScroller::SmoothScroller(QObject *parent) : QObject(parent), _user(0), _dest(0), _steps(0)
 {
+	// The animation is driven by the animation clock of Qt, which ticks
+	// with the display refresh
+	_animation.setDuration(SCROLL_DURATION);
+	_animation.setEasingCurve(QEasingCurve::OutCubic);
+	connect(&_animation, SIGNAL(valueChanged(QVariant)), this, SLOT(onAnimationValueChanged(QVariant)));
 }
 
 SmoothScroller::~SmoothScroller()
 {
 }
 
-void SmoothScroller::timerEvent(QTimerEvent *event)
+void SmoothScroller::scrollToDest()
 {
 	int sbValue(_user->verticalScrollBar()->value());
-	if (_dest == sbValue) {
-		_timer.stop();
-		event->accept();
+	_animation.stop();
+	if (_dest == sbValue) return;
+	// Restart from the current position so that successive wheel events
+	// accumulate into a single continuous movement
+	_animation.setStartValue(sbValue);
+	_animation.setEndValue(_dest);
+	emit destinationChanged(_dest);
+	_animation.start();
+}
+
+void SmoothScroller::onAnimationValueChanged(const QVariant &value)
+{
+	if (!_user) return;
+	QScrollBar *bar(_user->verticalScrollBar());
+	// The user took over
+	if (bar->isSliderDown()) {
+		_animation.stop();
 		return;
 	}
-	int move(qAbs((sbValue - _dest) / 3));
-	if (move == 0) move = 1;
-	if (_dest < sbValue) sbValue -= move;
-	else if (_dest > sbValue) sbValue += move;
-	_user->verticalScrollBar()->setValue(sbValue);
-	event->accept();
+	// The value is interpolated from the elapsed time, so if the view
+	// takes too long to repaint the next frame just moves further. Avoid
+	// useless repaints when we did not move by a pixel.
+	int sbValue(value.toInt());
+	if (sbValue != bar->value()) bar->setValue(sbValue);
 }
 
 void SmoothScroller::activateOn(QAbstractScrollArea *scrollArea)
@@ -67,6 +86,7 @@ void SmoothScroller::activateOn(QAbstractScrollArea *scrollArea)
 void SmoothScroller::deactivate()
 {
 	if (!_user) return;
+	_animation.stop();
 	disconnect(_user->verticalScrollBar(), SIGNAL(sliderReleased()), this, SLOT(scrollBarReleased()));
 	disconnect(_user->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(scrollBarValueChanged(int)));
 	_user->viewport()->removeEventFilter(this);
@@ -86,13 +106,13 @@ void SmoothScroller::scrollBarReleased()
 			else _dest = qMax(_dest - _dest % itemSize, _user->verticalScrollBar()->minimum());
 		}
 	}
-	if (_dest != oldDest && !_timer.isActive()) _timer.start(TIMER_DELAY, this);
+	if (_dest != oldDest && !isScrolling()) scrollToDest();
 }
 
 void SmoothScroller::scrollBarValueChanged(int value)
 {
 	if (_user->verticalScrollBar()->isSliderDown()) return;
-	if (!_timer.isActive()) _dest = value;
+	if (!isScrolling()) _dest = value;
 /*	if (!value) {
 		QListView *listView(qobject_cast<QListView *>(_user));
 		if (listView && !listView->model()->rowCount() ) _dest = 0;
@@ -128,6 +148,6 @@ bool SmoothScroller::eventFilter(QObject *src, QEvent *event)
 	_dest = _dest + scrollValue;
 	if (_dest < _user->verticalScrollBar()->minimum()) _dest = _user->verticalScrollBar()->minimum();
 	else if (_dest > _user->verticalScrollBar()->maximum()) _dest = _user->verticalScrollBar()->maximum();
-	if (!_timer.isActive() && _dest != _user->verticalScrollBar()->value()) _timer.start(TIMER_DELAY, this);
+	if (_dest != _animation.endValue().toInt() || !isScrolling()) scrollToDest();
 	return true;
 }
@@ -19,7 +19,7 @@
 #define __GUI_SMOOTHSCROLLER_H
 
 #include <QObject>
-#include <QBasicTimer>
+#include <QVariantAnimation>
 #include <QAbstractScrollArea>
 
 /**
@@ -32,16 +32,17 @@ class SmoothScroller : public QObject
 {
 	Q_OBJECT
 private:
-	QBasicTimer _timer;
+	QVariantAnimation _animation;
 	QAbstractScrollArea *_user;
-	enum { Stopped, Scrolling } _state;
 	int _dest, _steps;
 
-protected:
-	void timerEvent(QTimerEvent *event);
+	/// Starts animating the vertical scrollbar towards _dest
+	void scrollToDest();
+
 protected slots:
 	void scrollBarReleased();
 	void scrollBarValueChanged(int value);
+	void onAnimationValueChanged(const QVariant &value);
 
 public:
 	SmoothScroller(QObject *parent = 0);
@@ -49,6 +50,16 @@ public:
 	void activateOn(QAbstractScrollArea *scrollArea);
 	void deactivate();
 	bool eventFilter(QObject *src, QEvent *event);
+
+	bool isScrolling() const { return _animation.state() == QAbstractAnimation::Running; }
+	/// Position the scrollbar will reach at the end of the current scroll
+	int destination() const { return _dest; }
+
+signals:
+	/// Emitted when a new scrolling destination is set, before the
+	/// scrollbar starts moving towards it. Views can use it to load
+	/// the rows that will be shown there.
+	void destinationChanged(int destination);
 };
 
 #endif
@@ -17,9 +17,6 @@
 
 #include "StudyFilterWidget.h"
 
-#include "sqlite/Query.h"
-#include "core/Database.h"
-
 #include <QGridLayout>
 #include <QLabel>
 
@@ -70,17 +67,6 @@ StudyFilterWidget::StudyFilterWidget(QWidget *parent) : SearchFilterWidget(paren
 	studyBox->setVisible(false);
 	connect(studyBox, SIGNAL(toggled(bool)), this, SLOT(commandUpdate()));
 	{
-		QDate infDate, supDate;
-		SQLite::Query query(Database::connection());
-		query.exec("select min(dateAdded) from training");
-		if (query.next()) {
-			infDate = QDateTime::fromSecsSinceEpoch(query.valueUInt(0)).date();
-		}
-		query.exec("select max(dateAdded) from training");
-		if (query.next()) {
-			supDate = QDateTime::fromSecsSinceEpoch(query.valueUInt(0)).date();
-		}
-
 		_studyMinDate = new RelativeDateEdit(studyBox);
 		connect(_studyMinDate, SIGNAL(dateSelected(const RelativeDate &)), this, SLOT(commandUpdate()));
 		connect(_studyMinDate, SIGNAL(dateChanged(const RelativeDate &)), this, SLOT(delayedCommandUpdate()));
@@ -100,17 +86,6 @@ StudyFilterWidget::StudyFilterWidget(QWidget *parent) : SearchFilterWidget(paren
 	trainBox->setVisible(false);
 	connect(trainBox, SIGNAL(toggled(bool)), this, SLOT(commandUpdate()));
 	{
-		QDate infDate, supDate;
-		SQLite::Query query(Database::connection());
-		query.exec("select min(dateAdded) from training");
-		if (query.next()) {
-			infDate = QDateTime::fromSecsSinceEpoch(query.valueUInt(0)).date();
-		}
-		query.exec("select max(dateAdded) from training");
-		if (query.next()) {
-			supDate = QDateTime::fromSecsSinceEpoch(query.valueUInt(0)).date();
-		}
-
 		_trainMinDate = new RelativeDateEdit(trainBox);
 		connect(_trainMinDate, SIGNAL(dateSelected(const RelativeDate &)), this, SLOT(commandUpdate()));
 		connect(_trainMinDate, SIGNAL(dateChanged(const RelativeDate &)), this, SLOT(delayedCommandUpdate()));
@@ -16,6 +16,7 @@
  */
 
 #include "core/Entry.h"
+#include "gui/EntryFormatter.h"
 #include "gui/TemplateFiller.h"
 
 #include <QRegExp>
@@ -23,69 +24,135 @@
 
 #include <QtDebug>
 
-QString TemplateFiller::fill(const QString &tmpl, const EntryFormatter *formatter, const EntryPointer &entry)
+CompiledTemplate::CompiledTemplate(const QString &tmpl, const QMetaObject *metaObject)
 {
-	// For 'T' option
-	int tablePos = -1;
-	int colCpt = 0;
-
-	QString ret(tmpl);
+	// Placeholders positions, as the R option needs to know where the
+	// next one starts
 	QRegExp funcMatch("\\$\\$(\\w+)(?:\\[([^\\]]+)\\]){0,1}");
-	int pos = 0, matchPos;
-	while ((matchPos = funcMatch.indexIn(ret, pos)) != -1) {
-		QString whole = funcMatch.cap(0);
-		QString meth = funcMatch.cap(1);
-		QStringList options = funcMatch.cap(2).split(',', QString::SkipEmptyParts);
-		QString repl;
-		// Try to invoke the format method
-		QMetaObject::invokeMethod(const_cast<EntryFormatter *>(formatter), QString("format" + meth).toLatin1().constData(), Qt::DirectConnection, Q_RETURN_ARG(QString, repl), Q_ARG(ConstEntryPointer, entry));
-		// Process options
-		foreach (const QString &option, options) switch (option[0].toLatin1()) {
-			// If the result if empty, remove the block which tag is given
+	QList<int> matches, lengths;
+	QStringList methods, options;
+	int matchPos = 0;
+	while ((matchPos = funcMatch.indexIn(tmpl, matchPos)) != -1) {
+		matches << matchPos;
+		lengths << funcMatch.matchedLength();
+		methods << funcMatch.cap(1);
+		options << funcMatch.cap(2);
+		matchPos += funcMatch.matchedLength();
+	}
+
+	int pos = 0;
+	for (int i = 0; i < matches.size(); ++i) {
+		Segment segment;
+		int start = matches[i], end = matches[i] + lengths[i];
+		int next = i + 1 < matches.size() ? matches[i + 1] : tmpl.size();
+		int textEnd = start;
+		segment.placeholder = true;
+		segment.name = methods[i];
+		int idx = metaObject->indexOfMethod(QMetaObject::normalizedSignature(QString("format%1(ConstEntryPointer)").arg(methods[i]).toLatin1().constData()));
+		if (idx != -1) segment.method = metaObject->method(idx);
+		else qWarning("Unknown template method %s", methods[i].toLatin1().constData());
+
+		foreach (const QString &option, options[i].split(',', QString::SkipEmptyParts)) switch (option[0].toLatin1()) {
+			// If the result is empty, remove the block which tag is given
 			case 'R':
 			{
-				if (!repl.isEmpty()) break;
 				QString tag(option.mid(1));
-				// Extend the match position to the tag we want to remove
-				int nPos = ret.lastIndexOf("<" + tag, matchPos);
-				if (nPos == -1) break;
-				matchPos = nPos;
-				nPos = ret.indexOf("</" + tag, matchPos);
-				if (nPos != -1) nPos = ret.indexOf(">", nPos);
-				if (nPos == -1) break;
-				++nPos;
-				whole = ret.mid(matchPos, nPos - matchPos);
+				// The block must not run over other placeholders
+				int bStart = tmpl.lastIndexOf("<" + tag, start);
+				if (bStart < pos) break;
+				int bEnd = tmpl.indexOf("</" + tag, end);
+				if (bEnd != -1) bEnd = tmpl.indexOf(">", bEnd);
+				if (bEnd == -1 || bEnd >= next) break;
+				++bEnd;
+				segment.prefix = tmpl.mid(bStart, start - bStart);
+				segment.suffix = tmpl.mid(end, bEnd - end);
+				textEnd = bStart;
+				end = bEnd;
 				break;
 			}
 			// Output the result as a table cell according to the given number of columns
 			case 'T':
-			{
-				// Do not output cell for empty string
-				if (repl.isEmpty()) break;
-				int tPos = ret.lastIndexOf("<table", matchPos);
-				// Found matching table?
-				if (tPos != -1) {
-					int maxCols = option.mid(1).toInt();
-					QString t("<td>%1</td>");
-					if (tPos != tablePos || ++colCpt >= maxCols) colCpt = 0;
-					if (colCpt == 0) t = "<tr>" + t;
-					else if (colCpt == maxCols -1) t += "</tr>";
-					repl = t.arg(repl);
-				}
-				tablePos = tPos;
+				segment.columns = option.mid(1).toInt();
+				segment.table = tmpl.lastIndexOf("<table", start);
 				break;
-			}
 			default:
 				break;
 		}
-		ret.replace(matchPos, whole.size(), repl);
-		// If we did not output anything, remove ending newline of space
-		if (repl.isEmpty()) while (matchPos < ret.size() && (ret[matchPos] == '\n' || ret[matchPos] == ' ')) ret.remove(matchPos, 1);
-		pos = matchPos;
+		segment.text = tmpl.mid(pos, textEnd - pos);
+		_segments << segment;
+		pos = end;
+	}
+	Segment trailing;
+	trailing.text = tmpl.mid(pos);
+	_segments << trailing;
+}
+
+QString CompiledTemplate::fill(const EntryFormatter *formatter, const ConstEntryPointer &entry) const
+{
+	return _fill(formatter, entry, 0, 0);
+}
+
+void CompiledTemplate::fill(const EntryFormatter *formatter, const ConstEntryPointer &entry, const QStringList &sections, FilledTemplate &result) const
+{
+	result.skeleton.clear();
+	result.sections.clear();
+	result.html = _fill(formatter, entry, &sections, &result);
+}
+
+QString CompiledTemplate::_fill(const EntryFormatter *formatter, const ConstEntryPointer &entry, const QStringList *sections, FilledTemplate *result) const
+{
+	// For 'T' option
+	int tablePos = -1;
+	int colCpt = 0;
+	// If the previous placeholder did not output anything, remove the
+	// new lines and spaces following it
+	bool trim = false;
+
+	QString ret;
+	foreach (const Segment &segment, _segments) {
+		int textStart = 0;
+		if (trim) while (textStart < segment.text.size() && (segment.text[textStart] == '\n' || segment.text[textStart] == ' ')) ++textStart;
+		ret.append(segment.text.constData() + textStart, segment.text.size() - textStart);
+		if (result) result->skeleton.append(segment.text.constData() + textStart, segment.text.size() - textStart);
+		if (!segment.placeholder) break;
+
+		QString repl;
+		if (segment.method.isValid()) segment.method.invoke(const_cast<EntryFormatter *>(formatter), Qt::DirectConnection, Q_RETURN_ARG(QString, repl), Q_ARG(ConstEntryPointer, entry));
+		trim = repl.isEmpty();
+		bool section = sections && sections->contains(segment.name);
+		// Nothing to output, unless there is a section to mark
+		if (trim && (!section || !segment.prefix.isEmpty())) continue;
+
+		QString out;
+		if (!trim && segment.columns > 0 && segment.table != -1) {
+			int maxCols = segment.columns;
+			if (segment.table != tablePos || ++colCpt >= maxCols) colCpt = 0;
+			if (colCpt == 0) out += "<tr>";
+			out += "<td>" + repl + "</td>";
+			if (colCpt != 0 && colCpt == maxCols - 1) out += "</tr>";
+		}
+		else out = repl;
+		if (!trim && segment.columns > 0) tablePos = segment.table;
+
+		if (!trim) ret += segment.prefix;
+		if (section) {
+			ret += sectionStart(segment.name) + out + sectionEnd();
+			result->skeleton += segment.prefix + sectionStart(segment.name) + sectionEnd() + segment.suffix;
+			result->sections[segment.name] = out;
+		} else {
+			ret += out;
+			if (result) result->skeleton += segment.prefix + out + segment.suffix;
+		}
+		if (!trim) ret += segment.suffix;
 	}
 	return ret;
 }
 
+QString TemplateFiller::fill(const QString &tmpl, const EntryFormatter *formatter, const EntryPointer &entry)
+{
+	return CompiledTemplate(tmpl, formatter->metaObject()).fill(formatter, entry);
+}
+
 QString TemplateFiller::extract(const QString &tmpl, const QStringList &parts, bool includeRootText)
 {
 	QString ret;
@@ -18,9 +18,87 @@
 #ifndef GUI_TEMPLATEFILLER_H
 #define GUI_TEMPLATEFILLER_H
 
-#include "gui/EntryFormatter.h"
+#include "core/Entry.h"
 
 #include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <QMetaMethod>
+
+class EntryFormatter;
+
+/**
+ * Result of CompiledTemplate::fill() with sections.
+ */
+struct FilledTemplate
+{
+	/// The filled template, the content of each section being enclosed
+	/// between CompiledTemplate::sectionStart() and sectionEnd()
+	QString html;
+	/// Same as html, without the content of the sections. If it did not
+	/// change since the entry was displayed, only the sections changed.
+	QString skeleton;
+	/// Content of each section, by name
+	QMap<QString, QString> sections;
+};
+
+/**
+ * A template parsed once into literal text and the format methods to call
+ * in between, along with the effect of their options. Filling it for an
+ * entry is then a single pass over its segments, without looking up
+ * methods by name or searching the template again.
+ *
+ * Text produced by the format methods is output as-is and never parsed
+ * for placeholders.
+ */
+class CompiledTemplate
+{
+private:
+	struct Segment {
+		/// Literal text output before the placeholder
+		QString text;
+		/// Format method of the placeholder, invalid for the trailing text
+		/// or methods that do not exist
+		QMetaMethod method;
+		/// Name of the placeholder, without the format prefix
+		QString name;
+		/// True except for the trailing text of the template
+		bool placeholder;
+		/// Template text around the placeholder that is only output if the
+		/// method returned something (R option)
+		QString prefix, suffix;
+		/// Number of columns of the table the result is a cell of (T option),
+		/// or 0
+		int columns;
+		/// Identifies the table of the T option, -1 if it has none
+		int table;
+		Segment() : placeholder(false), columns(0), table(-1) {}
+	};
+	QVector<Segment> _segments;
+
+	QString _fill(const EntryFormatter *formatter, const ConstEntryPointer &entry, const QStringList *sections, FilledTemplate *result) const;
+
+public:
+	CompiledTemplate() {}
+	/**
+	 * Compiles tmpl, resolving its format methods in metaObject which
+	 * must be the one of the formatters used to fill it.
+	 */
+	CompiledTemplate(const QString &tmpl, const QMetaObject *metaObject);
+
+	QString fill(const EntryFormatter *formatter, const ConstEntryPointer &entry) const;
+	/**
+	 * Fills the template, marking the output of the placeholders named
+	 * in sections so it can be replaced later on without filling the
+	 * whole template again. Sections which block is removed by the R
+	 * option are not marked.
+	 */
+	void fill(const EntryFormatter *formatter, const ConstEntryPointer &entry, const QStringList &sections, FilledTemplate &result) const;
+
+	static QString sectionStart(const QString &name) { return "$[$" + name + "$"; }
+	static QString sectionEnd() { return "$]$"; }
+};
 
 class TemplateFiller
 {
@@ -29,6 +107,8 @@ public:
 	
 	/**
 	 * Fills in the template using the given formatter with the given entry.
+	 * Templates that are filled repeatedly should rather be compiled once,
+	 * see EntryFormatter::compiledTemplate().
 	 */
 	QString fill(const QString& tmpl, const EntryFormatter* formatter, const EntryPointer& entry);
 	/**
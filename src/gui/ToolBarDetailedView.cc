@@ -16,6 +16,7 @@
  */
 
 #include "gui/ToolBarDetailedView.h"
+#include "gui/EntriesMimeData.h"
 
 #include <QVBoxLayout>
 #include <QApplication>
@@ -51,12 +52,7 @@ void EntryDragButton::mouseMoveEvent(QMouseEvent *e)
 		if ((e->pos() - _dragPos).manhattanLength() >= QApplication::startDragDistance()) {
 			_dragStarted = false;
 			QDrag *drag = new QDrag(this);
-			QMimeData *data = new QMimeData();
-			QByteArray encodedData;
-			QDataStream stream(&encodedData, QIODevice::WriteOnly);
-			stream << EntryRef(_view->entry());
-			data->setData("tagainijisho/entry", encodedData);
-			drag->setMimeData(data);
+			drag->setMimeData(new EntriesMimeData(EntryRef(_view->entry())));
 			drag->exec(Qt::CopyAction, Qt::CopyAction);
 		}
 	}
@@ -15,6 +15,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "core/Entry.h"
 #include "gui/TrainSettings.h"
 
 PreferenceItem<QString> TrainSettings::minDatePref("training", "minDate", "yesterday");
@@ -68,6 +69,9 @@ void TrainSettings::updateBiasExplanation(int bias)
 		case BIAS_SCORE:
 			biasLabel->setText(tr("Entries with a low score are likely to appear first."));
 			break;
+		case BIAS_DUE:
+			biasLabel->setText(tr("Only entries due for review appear, the longest due first. %n entries are currently due.", 0, Entry::dueCount()));
+			break;
 		default:
 			biasLabel->setText("");
 			break;
@@ -87,22 +91,48 @@ void TrainSettings::checkMaxScoreValue(int newMinValue)
 
 QString TrainSettings::buildQueryString(int entryType)
 {
-	QString queryString(QString("select type, id from training where type = %1").arg(entryType));
+	QString queryString(QString("select type, id, score from training where type = %1").arg(entryType));
+	// With spaced repetition the due date replaces the train dates filters
+	bool due(biasPref.value() == BIAS_DUE);
+	if (due) queryString += QString(" and dueDate <= %1").arg(dueDateLimit());
 	RelativeDate minDate(minDatePref.value());
-	if (minDate.isSet()) queryString += QString(" and (dateLastTrain < %1 OR dateLastTrain is null)").arg(QDateTime(minDate.date()).toSecsSinceEpoch());
+	if (!due && minDate.isSet()) queryString += QString(" and (dateLastTrain < %1 OR dateLastTrain is null)").arg(QDateTime(minDate.date()).toSecsSinceEpoch());
 	RelativeDate maxDate(maxDatePref.value());
-	if (maxDate.isSet()) queryString += QString(" and dateLastTrain > %1").arg(QDateTime(maxDate.date()).toSecsSinceEpoch());
+	if (!due && maxDate.isSet()) queryString += QString(" and dateLastTrain > %1").arg(QDateTime(maxDate.date()).toSecsSinceEpoch());
 	int minScore(minScorePref.value());
 	if (minScore > minScorePref.defaultValue()) queryString += QString(" and score >= %1").arg(minScore);
 	int maxScore(maxScorePref.value());
 	if (maxScore < maxScorePref.defaultValue()) queryString += QString(" and score <= %1").arg(maxScore);
-	queryString += " " + buildOrderString("score");
+	// Range scan of idx_training_due
+	if (due) queryString += " order by dueDate";
 	return queryString;
 }
 
-QString TrainSettings::buildOrderString(const QString &scoreColumn)
+QString TrainSettings::buildQueryString(const QueryBuilder::Statement &statement)
+{
+	// Search statements always left join the training table
+	QueryBuilder::Statement stat(statement);
+	stat.addColumn(QueryBuilder::Column("training", "score"), 2);
+	if (biasPref.value() != BIAS_DUE) return stat.buildSqlStatement();
+	stat.addWhere(QueryBuilder::Where(QString("training.dueDate <= %1").arg(dueDateLimit())));
+	return stat.buildSqlStatement() + " ORDER BY training.dueDate";
+}
+
+qint64 TrainSettings::dueDateLimit()
+{
+	// Due dates are days, so this keeps query strings identical for the
+	// whole day and lets the plugins resume their current trainer
+	return QDateTime::currentSecsSinceEpoch() / 86400 * 86400;
+}
+
+TrainingSnapshot::Bias TrainSettings::bias()
 {
-	int bias(biasPref.value());
-	if (bias == TrainSettings::BIAS_SCORE) return QString("ORDER BY biased_random(%1) DESC").arg(scoreColumn);
-	else return "ORDER BY random()";
+	switch (biasPref.value()) {
+		case BIAS_SCORE:
+			return TrainingSnapshot::ScoreBias;
+		case BIAS_DUE:
+			return TrainingSnapshot::QueryOrder;
+		default:
+			return TrainingSnapshot::NoBias;
+	}
 }
@@ -18,6 +18,8 @@
 #ifndef TRAINSETTINGS_H
 #define TRAINSETTINGS_H
 
+#include "core/QueryBuilder.h"
+#include "core/TrainingSnapshot.h"
 #include "gui/ui_TrainSettings.h"
 
 class TrainSettings : public QDialog, private Ui::TrainSettings
@@ -30,7 +32,7 @@ public:
 	static PreferenceItem<int> maxScorePref;
 	static PreferenceItem<int> biasPref;
 
-	enum { BIAS_RANDOM = 0, BIAS_SCORE = 1 };
+	enum { BIAS_RANDOM = 0, BIAS_SCORE = 1, BIAS_DUE = 2 };
 	TrainSettings(QWidget *parent = 0);
 
 	static const QString MINDATE_DEFAULT;
@@ -39,8 +41,13 @@ public:
 	static const int MAXSCORE_DEFAULT = 100;
 	static const int BIAS_DEFAULT = BIAS_SCORE;
 
+	/// Returns the type, id and score of the studied entries to train
 	static QString buildQueryString(int entryType);
-	static QString buildOrderString(const QString &scoreColumn);
+	/// Same as above, for the entries matched by a search statement
+	static QString buildQueryString(const QueryBuilder::Statement &statement);
+	static TrainingSnapshot::Bias bias();
+	/// Entries due at or before this date are due for training
+	static qint64 dueDateLimit();
 
 private slots:
 	void updateBiasExplanation(int bias);
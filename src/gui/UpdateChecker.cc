@@ -37,12 +37,8 @@
 #define PLATFORM "Unknown"
 #endif
 
-UpdateChecker::UpdateChecker(const QString &versionURL, QObject *parent) : QObject(parent), _versionURL(versionURL)
+UpdateChecker::UpdateChecker(const QString &versionURL, QObject *parent) : QObject(parent), _versionURL(versionURL), _http(0)
 {
-	_http = new QNetworkAccessManager(this);
-
-	connect(_http, SIGNAL(finished(QNetworkReply *)),
-		this, SLOT(finished(QNetworkReply *)));
 }
 
 UpdateChecker::~UpdateChecker()
@@ -51,13 +47,21 @@ UpdateChecker::~UpdateChecker()
 
 void UpdateChecker::checkForUpdates(bool beta)
 {
+	if (!_http) {
+		_http = new QNetworkAccessManager(this);
+		connect(_http, SIGNAL(finished(QNetworkReply *)),
+			this, SLOT(finished(QNetworkReply *)));
+	}
 	QNetworkRequest request(QUrl("http://www.tagaini.net" + _versionURL));
 	request.setHeader(QNetworkRequest::UserAgentHeader, QString("Tagaini Jisho %1 (%2)").arg(VERSION).arg(PLATFORM));
+	request.setPriority(QNetworkRequest::LowPriority);
 	_http->get(request);
 }
 
 void UpdateChecker::finished(QNetworkReply *reply)
 {
+	reply->deleteLater();
+	if (reply->error() != QNetworkReply::NoError) return;
 	QString buffer(QString(reply->readAll()).trimmed());
 	// If the first character is not a digit, this means we got another page
 	if (!buffer[0].isDigit()) return;
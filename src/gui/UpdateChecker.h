@@ -22,6 +22,11 @@
 #include <QObject>
 #include <QBuffer>
 
+/**
+ * Fetches the latest version of the program from the web site. The
+ * network stack is only set up at the first check, which is made with
+ * a low priority, so that creating a checker costs nothing at startup.
+ */
 class UpdateChecker : public QObject
 {
 	Q_OBJECT
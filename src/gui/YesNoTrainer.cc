@@ -17,9 +17,11 @@
 
 #include "core/EntriesCache.h"
 #include "core/Database.h"
+#include "core/TrainingTrace.h"
 #include "gui/EntryFormatter.h"
 #include "gui/YesNoTrainer.h"
 #include "gui/TemplateFiller.h"
+#include "gui/TrainSettings.h"
 
 #include <QtDebug>
 #include <QVBoxLayout>
@@ -31,7 +33,7 @@
 
 PreferenceItem<QByteArray> YesNoTrainer::windowGeometry("trainWindow", "geometry", "");
 
-YesNoTrainer::YesNoTrainer(QWidget *parent) : QWidget(parent), _trainingMode(Japanese), currentEntry(0), _query(Database::connection())
+YesNoTrainer::YesNoTrainer(QWidget *parent) : QWidget(parent), _trainingMode(Japanese), currentEntry(0)
 {
 	frontParts << "front";
 	backParts << "back";
@@ -86,9 +88,10 @@ YesNoTrainer::~YesNoTrainer()
 
 void YesNoTrainer::setQuery(QString queryString)
 {
-	// Run the query
+	// Run the query once and train from its results
 	_queryString = queryString;
-	if (!_query.exec(queryString)) qDebug() << "Error executing query:" << _query.lastError().message();
+	_prefetched.clear();
+	_entries.load(queryString, TrainSettings::bias());
 }
 
 void YesNoTrainer::clear()
@@ -103,13 +106,45 @@ void YesNoTrainer::clear()
 
 void YesNoTrainer::_train()
 {
-	if (!_query.next()) hasResults(0);
+	if (_entries.atEnd()) hasResults(0);
 	else {
-		EntryPointer entry(EntryRef(_query.valueInt(0), _query.valueInt(1)).get());
+		EntryRef ref(_entries.next());
+		TrainingTrace::mark(TrainingTrace::Queried);
+		EntryPointer entry(_prefetched.value(ref).entry);
+		if (!entry) entry = ref.get();
+		TrainingTrace::mark(TrainingTrace::Loaded);
 		train(entry);
+		prefetch();
 	}
 }
 
+void YesNoTrainer::prefetch()
+{
+	foreach (const EntryRef &ref, _entries.peek(PREFETCH_SIZE)) {
+		if (_prefetched.contains(ref)) continue;
+		_prefetched[ref] = PrefetchedEntry();
+		ref.getAsync(this, SLOT(onPrefetched(EntryRef, EntryPointer)));
+	}
+}
+
+void YesNoTrainer::onPrefetched(EntryRef ref, EntryPointer entry)
+{
+	// Dropped since it has been requested
+	if (!_prefetched.contains(ref) || !entry) return;
+	const EntryFormatter *formatter(EntryFormatter::getFormatter(entry));
+	if (!formatter) return;
+	PrefetchedEntry &prefetched = _prefetched[ref];
+	prefetched.entry = entry;
+	prefetched.version = entry->version();
+	prefetched.html = frontHtml(formatter, entry);
+}
+
+QString YesNoTrainer::frontHtml(const EntryFormatter *formatter, const EntryPointer &entry) const
+{
+	const QStringList &parts = trainingMode() == Japanese ? frontParts : backParts;
+	return formatter->compiledTemplate(parts).fill(formatter, entry);
+}
+
 void YesNoTrainer::train()
 {
 	_goodCount = _wrongCount = _totalCount = 0;
@@ -145,11 +180,11 @@ void YesNoTrainer::train(const EntryPointer &entry)
 	css += QString("\n%1 {\n%2}\n").arg(".kana").arg(DetailedViewFonts::CSS(DetailedViewFonts::Kana));
 	document->setDefaultStyleSheet(css);
 	
-	const QStringList &parts = trainingMode() == Japanese ? frontParts : backParts;
-	
-	TemplateFiller filler;
-	QString html(filler.fill(filler.extract(formatter->htmlTemplate(), parts), formatter, entry));
-	document->setHtml(html);
+	// Use the HTML built in advance if the entry did not change since
+	PrefetchedEntry prefetched(_prefetched.take(EntryRef(entry)));
+	if (prefetched.entry == entry && prefetched.version == entry->version()) document->setHtml(prefetched.html);
+	else document->setHtml(frontHtml(formatter, entry));
+	TrainingTrace::renderPending();
 }
 
 void YesNoTrainer::showAnswer()
@@ -176,8 +211,10 @@ void YesNoTrainer::goodAnswer()
 	// Needed to avoid redrawing everything before clearing because of the updated() signal of the entry
 	// and to avoid a database error in case the detailed view is still fetching data (as we are going
 	// to acquire a write lock)
+	TrainingTrace::answered('Y');
 	_detailedView->detailedView()->clear();
 	currentEntry->train(true);
+	TrainingTrace::mark(TrainingTrace::Written);
 	_goodCount++; _totalCount++;
 	getNextEntry();
 }
@@ -185,8 +222,10 @@ void YesNoTrainer::goodAnswer()
 void YesNoTrainer::wrongAnswer()
 {
 	// Needed to avoid redrawing everything before clearing because of the updated() signal of the entry
+	TrainingTrace::answered('Y');
 	_detailedView->detailedView()->setEntry(EntryPointer());
 	currentEntry->train(false);
+	TrainingTrace::mark(TrainingTrace::Written);
 	_wrongCount++; _totalCount++;
 	getNextEntry();
 }
@@ -22,8 +22,11 @@
 
 #include <QFrame>
 #include <QPushButton>
-#include "sqlite/Query.h"
+#include "core/TrainingSnapshot.h"
 #include <QLabel>
+#include <QHash>
+
+class EntryFormatter;
 
 class YesNoTrainer : public QWidget {
 	Q_OBJECT
@@ -36,14 +39,34 @@ private:
 	TrainingMode _trainingMode;
 	unsigned int _goodCount, _wrongCount, _totalCount;
 
+	/// Entry loaded and formatted while the previous one is trained
+	struct PrefetchedEntry
+	{
+		EntryPointer entry;
+		/// Version of entry html was built for
+		quint32 version;
+		QString html;
+		PrefetchedEntry() : version(0) {}
+	};
+	/// Number of entries loaded in advance
+	static const int PREFETCH_SIZE = 3;
+	QHash<EntryRef, PrefetchedEntry> _prefetched;
+
 	void getNextEntry();
 	void _train();
+	/// Starts loading the next entries to train
+	void prefetch();
+	/// HTML of the front side of entry, as displayed before the answer is shown
+	QString frontHtml(const EntryFormatter *formatter, const EntryPointer &entry) const;
+
+private slots:
+	void onPrefetched(EntryRef ref, EntryPointer entry);
 
 protected:
 	// List of parts to display for front and back of the card
 	QStringList frontParts, backParts;
 	EntryPointer currentEntry;
-	SQLite::Query _query;
+	TrainingSnapshot _entries;
 	ToolBarDetailedView *_detailedView;
 
 	QPushButton *showAnswerButton;
@@ -59,7 +82,7 @@ public:
 
 	const QString &query() const { return _queryString; }
 	void setQuery(QString queryString);
-	virtual void setTrainingMode(TrainingMode mode) { _trainingMode = mode; }
+	virtual void setTrainingMode(TrainingMode mode) { _trainingMode = mode; _prefetched.clear(); }
 	TrainingMode trainingMode() const { return _trainingMode; }
 	DetailedView *detailedView() { return _detailedView->detailedView(); }
 	bool answerShown() const { return !showAnswerButton->isEnabled(); }
@@ -0,0 +1,203 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TextTools.h"
+#include "core/Database.h"
+#include "core/EntrySummary.h"
+#include "core/jmdict/JMdictEntry.h"
+#include "gui/MainWindow.h"
+#include "gui/jmdict/ClipboardLookup.h"
+#include "sqlite/Query.h"
+
+#include <QApplication>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <QCursor>
+#include <QRegExp>
+#include <QMap>
+#include <QtDebug>
+
+PreferenceItem<bool> ClipboardLookup::enabled("jmdict", "clipboardLookup", false);
+
+/// Maximum number of entries shown for a single word
+#define ENTRIES_PER_WORD 2
+
+class ClipboardLookupJob : public QRunnable
+{
+private:
+	ClipboardLookup *_lookup;
+	int _generation;
+	QString _text;
+
+	bool stale() const { return _lookup->_generation.loadAcquire() != _generation; }
+	QList<EntryRef> findEntries(const QStringList &words) const;
+	static QString format(const QVector<EntrySummary> &summaries);
+
+public:
+	ClipboardLookupJob(ClipboardLookup *lookup, int generation, const QString &text) : _lookup(lookup), _generation(generation), _text(text) {}
+
+	void run();
+};
+
+QList<EntryRef> ClipboardLookupJob::findEntries(const QStringList &words) const
+{
+	QElapsedTimer timer;
+	timer.start();
+	// Readings are matched regardless of their script, like the segmenter does
+	QStringList keys;
+	QStringList phrases;
+	foreach (const QString &w, words) {
+		keys << TextTools::hiragana2Katakana(w);
+		phrases << "\"" + QString(w).remove('"').replace('\'', "''") + "\"";
+	}
+	// All the words are looked up at once, and the readings that only
+	// contain them are discarded afterwards
+	SQLite::Query query(Database::threadConnection());
+	if (!query.exec(QString("SELECT jmdict.kanjiText.reading, jmdict.kanji.id FROM jmdict.kanji JOIN jmdict.kanjiText ON jmdict.kanji.docid = jmdict.kanjiText.rowid WHERE jmdict.kanjiText.reading MATCH '%1' "
+		"UNION SELECT jmdict.kanaText.reading, jmdict.kana.id FROM jmdict.kana JOIN jmdict.kanaText ON jmdict.kana.docid = jmdict.kanaText.rowid WHERE jmdict.kanaText.reading MATCH '%1'").arg(phrases.join(" OR ")))) {
+		qWarning("Clipboard lookup failed: %s", query.lastError().message().toUtf8().constData());
+		return QList<EntryRef>();
+	}
+	QMap<int, QList<EntryRef> > byWord;
+	while (query.next()) {
+		if (timer.elapsed() >= ClipboardLookup::lookupBudget || stale()) break;
+		int index = keys.indexOf(TextTools::hiragana2Katakana(query.valueString(0)));
+		if (index < 0) continue;
+		QList<EntryRef> &refs = byWord[index];
+		EntryRef ref(JMDICTENTRY_GLOBALID, query.valueUInt(1));
+		if (refs.size() < ENTRIES_PER_WORD && !refs.contains(ref)) refs << ref;
+	}
+	// Entries are shown in the order of their words in the text
+	QList<EntryRef> ret;
+	foreach (const QList<EntryRef> &refs, byWord) ret += refs;
+	return ret;
+}
+
+QString ClipboardLookupJob::format(const QVector<EntrySummary> &summaries)
+{
+	QString ret("<table>");
+	foreach (const EntrySummary &summary, summaries) {
+		if (summary.isNull()) continue;
+		QString reading(summary.readings().isEmpty() || summary.writings().isEmpty() ? QString() : summary.readings()[0]);
+		ret += QString("<tr><td><a href=\"%1\">%1</a></td><td>%2</td><td>%3</td></tr>")
+			.arg(summary.mainRepr().toHtmlEscaped())
+			.arg(reading.toHtmlEscaped())
+			.arg(QStringList(summary.meanings().mid(0, 3)).join("; ").toHtmlEscaped());
+	}
+	ret += "</table>";
+	return ret;
+}
+
+void ClipboardLookupJob::run()
+{
+	if (stale()) return;
+	QStringList words(_lookup->_segmenter.segment(_text, ClipboardLookup::maxWords, ClipboardLookup::segmentBudget));
+	if (stale()) return;
+	QList<EntryRef> refs;
+	if (!words.isEmpty()) refs = findEntries(words);
+	if (stale()) return;
+	QString html;
+	if (!refs.isEmpty()) html = format(EntriesCache::getSummaries(refs));
+	// The lookup waits for its jobs before being destroyed
+	QMetaObject::invokeMethod(_lookup, "showResults", Qt::QueuedConnection, Q_ARG(int, _generation), Q_ARG(QString, html));
+}
+
+ClipboardLookup::ClipboardLookup(QObject *parent) : QObject(parent), _pendingMode(QClipboard::Clipboard), _enabled(false)
+{
+	_debounce.setSingleShot(true);
+	_debounce.setInterval(debounceDelay);
+	connect(&_debounce, SIGNAL(timeout()), this, SLOT(lookUp()));
+	_hideTimer.setSingleShot(true);
+	_hideTimer.setInterval(displayTime);
+
+	_pool.setMaxThreadCount(1);
+
+	// A tooltip window does not take the focus from the program being read
+	_popup = new QLabel(0, Qt::ToolTip);
+	_popup->setTextFormat(Qt::RichText);
+	_popup->setFrameStyle(QFrame::Box | QFrame::Plain);
+	_popup->setMargin(4);
+	connect(_popup, SIGNAL(linkActivated(const QString &)), this, SLOT(onLinkActivated(const QString &)));
+	connect(&_hideTimer, SIGNAL(timeout()), _popup, SLOT(hide()));
+
+	setEnabled(enabled.value());
+}
+
+ClipboardLookup::~ClipboardLookup()
+{
+	_generation.ref();
+	_pool.waitForDone();
+	delete _popup;
+}
+
+void ClipboardLookup::setEnabled(bool enable)
+{
+	enabled.set(enable);
+	if (enable == _enabled) return;
+	_enabled = enable;
+	QClipboard *clipboard = QApplication::clipboard();
+	if (enable) connect(clipboard, SIGNAL(changed(QClipboard::Mode)), this, SLOT(onClipboardChanged(QClipboard::Mode)));
+	else {
+		disconnect(clipboard, SIGNAL(changed(QClipboard::Mode)), this, SLOT(onClipboardChanged(QClipboard::Mode)));
+		_debounce.stop();
+		_generation.ref();
+		_popup->hide();
+		_lastText.clear();
+	}
+}
+
+void ClipboardLookup::onClipboardChanged(QClipboard::Mode mode)
+{
+	if (mode == QClipboard::FindBuffer) return;
+	// Only look up what comes from other programs
+	if (QApplication::activeWindow()) return;
+	_pendingMode = mode;
+	_debounce.start();
+}
+
+void ClipboardLookup::lookUp()
+{
+	QString text(QApplication::clipboard()->text(_pendingMode).left(maxTextLength));
+	text.remove(QRegExp("\\s"));
+	if (text == _lastText) return;
+	_lastText = text;
+	bool japanese = false;
+	for (int i = 0; i < text.size() && !japanese; i++) japanese = TextTools::isJapaneseChar(text, i);
+	if (!japanese) return;
+	_pool.start(new ClipboardLookupJob(this, _generation.fetchAndAddOrdered(1) + 1, text));
+}
+
+void ClipboardLookup::showResults(int generation, const QString &html)
+{
+	if (generation != _generation.loadAcquire() || !_enabled) return;
+	if (html.isEmpty()) {
+		_popup->hide();
+		return;
+	}
+	_popup->setText(html);
+	_popup->adjustSize();
+	_popup->move(QCursor::pos() + QPoint(16, 16));
+	MainWindow::fitToScreen(_popup);
+	_popup->show();
+	_hideTimer.start();
+}
+
+void ClipboardLookup::onLinkActivated(const QString &link)
+{
+	_popup->hide();
+	MainWindow::instance()->searchFor(link);
+}
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_JMDICT_CLIPBOARD_LOOKUP_H
+#define __GUI_JMDICT_CLIPBOARD_LOOKUP_H
+
+#include "core/Preferences.h"
+#include "core/jmdict/JMdictSegmenter.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QClipboard>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QLabel>
+
+/**
+ * Looks up the Japanese text copied or selected in other programs and
+ * shows the words it contains in a small popup next to the cursor,
+ * without taking the focus away from the program being read.
+ *
+ * Lookups go through stages that each have a budget, so that pasting a
+ * whole page never stalls the GUI:
+ * - changes of the clipboard are debounced;
+ * - the GUI thread only keeps the beginning of the text;
+ * - the text is segmented and its words looked up in a single query from
+ *   a thread of its own, within a time budget and up to a number of words;
+ * - stale lookups are dropped as soon as the clipboard changes again.
+ */
+class ClipboardLookup : public QObject
+{
+	Q_OBJECT
+private:
+	QTimer _debounce;
+	QTimer _hideTimer;
+	QClipboard::Mode _pendingMode;
+	QString _lastText;
+	/// Runs the lookups one at a time, so they can share the segmenter
+	QThreadPool _pool;
+	JMdictSegmenter _segmenter;
+	/// Incremented by every new lookup so the older ones can give up
+	QAtomicInt _generation;
+	QLabel *_popup;
+	bool _enabled;
+
+private slots:
+	void onClipboardChanged(QClipboard::Mode mode);
+	void lookUp();
+	/// Called by the lookup thread with the formatted results
+	void showResults(int generation, const QString &html);
+	void onLinkActivated(const QString &link);
+
+public:
+	ClipboardLookup(QObject *parent = 0);
+	virtual ~ClipboardLookup();
+
+	bool isEnabled() const { return _enabled; }
+
+	static PreferenceItem<bool> enabled;
+	/// Delay between a change of the clipboard and its lookup, in milliseconds
+	static const int debounceDelay = 250;
+	/// Number of characters of the text looked up
+	static const int maxTextLength = 200;
+	/// Maximum number of words shown
+	static const int maxWords = 12;
+	/// Time the segmentation and the lookup of the words may take, in milliseconds
+	static const int segmentBudget = 30;
+	static const int lookupBudget = 100;
+	/// Time the popup stays displayed, in milliseconds
+	static const int displayTime = 15000;
+
+public slots:
+	void setEnabled(bool enable);
+
+friend class ClipboardLookupJob;
+};
+
+#endif
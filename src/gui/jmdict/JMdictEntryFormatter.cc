@@ -18,6 +18,7 @@
 #include "core/Paths.h"
 #include "core/Lang.h"
 #include "core/TextTools.h"
+#include "core/Database.h"
 #include "core/jmdict/JMdictEntry.h"
 #include "core/jmdict/JMdictPlugin.h"
 #include "core/jmdict/JMdictEntrySearcher.h"
@@ -26,6 +27,8 @@
 
 // For getting the kanjidic id
 #include "core/kanjidic2/Kanjidic2Entry.h"
+// Example sentences
+#include "core/tatoeba/TatoebaEntry.h"
 
 #include <QPainter>
 #include <QTextBlock>
@@ -44,6 +47,7 @@ PreferenceItem<int> JMdictEntryFormatter::maxHomophonesToDisplay("jmdict", "maxH
 PreferenceItem<bool> JMdictEntryFormatter::displayStudiedHomophonesOnly("jmdict", "displayStudiedHomophonesOnly", false);
 PreferenceItem<int> JMdictEntryFormatter::maxHomographsToDisplay("jmdict", "maxHomographsToDisplay", 5);
 PreferenceItem<bool> JMdictEntryFormatter::displayStudiedHomographsOnly("jmdict", "displayStudiedHomographsOnly", false);
+PreferenceItem<int> JMdictEntryFormatter::maxExamplesToDisplay("jmdict", "maxExamplesToDisplay", 3);
 
 PreferenceItem<int> JMdictEntryFormatter::headerPrintSize("jmdict", "headerPrintSize", 20);
 PreferenceItem<bool> JMdictEntryFormatter::printKanjis("jmdict", "printKanjis", true);
@@ -64,14 +68,14 @@ QString JMdictEntryFormatter::getVerbBuddySql(const QString &matchPattern, quint
 		"join jmdict.kanji on jmdict.kanji.id = jmdict.entries.id "
 		"join jmdict.senses on jmdict.senses.id = jmdict.entries.id "
 		"where jmdict.kanji.docid in "
-			"(select docid from jmdict.kanjiText "
-			"where jmdict.kanjiText.reading match '\"%1*\"') "
+			"(select rowid from jmdict.kanjiText "
+			"where jmdict.kanjiText.reading match '%1') "
 		"and jmdict.kanji.priority = 0 "
 		"and jmdict.senses.pos0 & %2 == %2 "
 		"and jmdict.senses.misc0 & %4 == 0 "
 		"and jmdict.entries.id != %3");
 
-        return queryFindVerbBuddySql.arg(matchPattern)
+        return queryFindVerbBuddySql.arg(SQLite::FTS::prefixPhrase(Database::ftsVersion("jmdict"), matchPattern))
             .arg(pos)
             .arg(id)
             .arg(JMdictEntrySearcher::miscFilterMask()[0]);
@@ -85,7 +89,7 @@ QString JMdictEntryFormatter::getHomophonesSql(const QString &reading, int id, i
 		"join jmdict.senses on jmdict.senses.id = jmdict.entries.id "
 		"left join jmdict.jlpt on jmdict.entries.id = jmdict.jlpt.id "
 		"where jmdict.kana.docid in "
-			"(select docid from jmdict.kanaText "
+			"(select rowid from jmdict.kanaText "
 			"where jmdict.kanaText.reading match '\"%1\"') "
 		"and jmdict.kana.priority = 0 "
 		"and jmdict.senses.misc0 & %5 == 0 "
@@ -108,7 +112,7 @@ QString JMdictEntryFormatter::getHomographsSql(const QString &writing, int id, i
 		"join jmdict.senses on jmdict.senses.id = jmdict.entries.id "
 		"left join jmdict.jlpt on jmdict.entries.id = jmdict.jlpt.id "
 		"where jmdict.kanji.docid in "
-			"(select docid from jmdict.kanjiText "
+			"(select rowid from jmdict.kanjiText "
 			"where jmdict.kanjiText.reading match '\"%1\"') "
 		"and jmdict.kanji.priority = 0 "
 		"and jmdict.senses.misc0 & %5 == 0 "
@@ -123,6 +127,16 @@ QString JMdictEntryFormatter::getHomographsSql(const QString &writing, int id, i
             .arg(JMdictEntrySearcher::miscFilterMask()[0]);
 }
 
+QString JMdictEntryFormatter::getExamplesSql(int id, int maxToDisplay)
+{
+	// The words table is keyed by JMdict id, so this is a single index lookup
+	const QString queryFindExamplesSql("select distinct " QUOTEMACRO(TATOEBAENTRY_GLOBALID) ", tatoeba.words.sentenceId from tatoeba.words "
+		"where tatoeba.words.jmdictId = %1 "
+		"limit %2");
+
+	return queryFindExamplesSql.arg(id).arg(maxToDisplay);
+}
+
 JMdictEntryFormatter::JMdictEntryFormatter(QObject* parent) : EntryFormatter("detailed_jmdict.css", "detailed_jmdict.html", parent)
 {
 	_exampleSentencesServices["Tatoeba"] = tatoebaTemplate;
@@ -181,14 +195,10 @@ void JMdictEntryFormatter::drawCustom(const ConstEntryPointer& _entry, QPainter&
 	// Now print definitions.
 	foreach (const Sense *sense, entry->getSenses()) {
 		QStringList posList;
-		for (const auto &pos : sense->partOfSpeech())
-			posList << pos;
-		for (const auto &misc : sense->misc())
-			posList << misc;
-		for (const auto &dial : sense->dialect())
-			posList << dial;
-		for (const auto &field : sense->field())
-			posList << field;
+		posList << sense->partOfSpeech().names(JMdictPlugin::posShift());
+		posList << sense->misc().names(JMdictPlugin::miscShift());
+		posList << sense->dialect().names(JMdictPlugin::dialShift());
+		posList << sense->field().names(JMdictPlugin::fieldShift());
 
 		QString posText;
 		if (!posList.isEmpty()) posText = QString(" (") + posList.join(",") + ") ";
@@ -224,6 +234,25 @@ QString JMdictEntryFormatter::shortDesc(const ConstEntryPointer &_entry) const
 	return ret;
 }
 
+QString JMdictEntryFormatter::displaySettingsKey() const
+{
+	QStringList settings;
+	settings << QString::number(showJLPT.value()) << QString::number(showKanjis.value()) << QString::number(showJMdictID.value()) << QString::number(searchVerbBuddy.value()) << QString::number(maxHomophonesToDisplay.value()) << QString::number(displayStudiedHomophonesOnly.value()) << QString::number(maxHomographsToDisplay.value()) << QString::number(displayStudiedHomographsOnly.value()) << QString::number(maxExamplesToDisplay.value()) << exampleSentencesService.value();
+	return settings.join(":");
+}
+
+QString JMdictEntryFormatter::exportStatement(int maxSenses) const
+{
+	// The glosses come from the language databases
+	if (!JMdictPlugin::instance()->attachLanguageDatabases()) return QString();
+	// Use the glosses of the first searched language that has some
+	QStringList glosses;
+	foreach (const QString &lang, JMdictPlugin::instance()->searchedLanguages())
+		glosses << QString("(select FIRSTSENSES(FTSUNCOMPRESS(glosses, 'jmdict_%1'), %2) from jmdict_%1.glosses where glosses.id = displayRows.id)").arg(lang).arg(maxSenses);
+	glosses << "''";
+	return QString("select displayRows.id, substr(writings, 1, instr(writings || char(10), char(10)) - 1), replace(readings, char(10), ', '), coalesce(%1), jlpt.level from jmdict.displayRows left join jmdict.jlpt on jlpt.id = displayRows.id where displayRows.id in ({{ids}})").arg(glosses.join(", "));
+}
+
 QString JMdictEntryFormatter::formatHeadFurigana(const ConstEntryPointer &_entry) const
 {
 	ConstJMdictEntryPointer entry(_entry.staticCast<const JMdictEntry>());
@@ -295,10 +324,10 @@ QString JMdictEntryFormatter::formatAltWritings(const ConstEntryPointer &_entry)
 	else return "";
 }
 
-static QString senseProps(const QSet<QString> &entities, const QString &tag, const QMap<QString, QPair<QString, quint16>> &map)
+static QString senseProps(const SenseProperties &props, const QVector<QString> &shift, const QString &tag, const QMap<QString, QPair<QString, quint16>> &map)
 {
 	QStringList ret;
-	for (const auto &entity : entities) {
+	for (const auto &entity : props.names(shift)) {
 		QString translated = QCoreApplication::translate("JMdictLongDescs", map[entity].first.toLatin1());
 		translated.replace(0, 1, translated[0].toUpper());
 		ret << QString("<a href=\"%1\" title=\"%3\">%2</a>").arg(QString("longdesc://%1#%2").arg(tag).arg(entity)).arg(entity).arg(translated);
@@ -310,10 +339,10 @@ static QString senseProps(const QSet<QString> &entities, const QString &tag, con
 static QString senseProps(const Sense &sense)
 {
 	QStringList ret;
-	ret << senseProps(sense.partOfSpeech(), "pos", JMdictPlugin::posMap());
-	ret << senseProps(sense.misc(), "misc", JMdictPlugin::miscMap());
-	ret << senseProps(sense.dialect(), "dialect", JMdictPlugin::dialMap());
-	ret << senseProps(sense.field(), "field", JMdictPlugin::fieldMap());
+	ret << senseProps(sense.partOfSpeech(), JMdictPlugin::posShift(), "pos", JMdictPlugin::posMap());
+	ret << senseProps(sense.misc(), JMdictPlugin::miscShift(), "misc", JMdictPlugin::miscMap());
+	ret << senseProps(sense.dialect(), JMdictPlugin::dialShift(), "dialect", JMdictPlugin::dialMap());
+	ret << senseProps(sense.field(), JMdictPlugin::fieldShift(), "field", JMdictPlugin::fieldMap());
 	ret.removeAll("");
 	if (!ret.isEmpty()) return QString("<span class=\"senseProps\">%1</span>").arg(ret.join(", "));
 	else return "";
@@ -326,10 +355,10 @@ QString JMdictEntryFormatter::formatSenses(const ConstEntryPointer &_entry) cons
 	const QList<KanaReading> &kanas = entry->getKanaReadings();
 	const QList<const Sense *> senses = entry->getSenses();
 
-	QSet<QString> oldPos;
-	QSet<QString> oldMisc;
-	QSet<QString> oldDialect;
-	QSet<QString> oldField;
+	SenseProperties oldPos;
+	SenseProperties oldMisc;
+	SenseProperties oldDialect;
+	SenseProperties oldField;
 	QStringList oldWritingString;
 	QString ret;
 
@@ -435,7 +464,7 @@ QString JMdictEntryFormatter::formatExampleSentencesLink(const ConstEntryPointer
 			const QList<KanjiReading> &kanji(entry->getKanjiReadings());
 			const QList<KanaReading> &kana(entry->getKanaReadings());
 			const QList<const Sense *> &senses(entry->getSenses());
-			if (kanji.size() == 0 || senses[0]->misc().contains("uk"))
+			if (kanji.size() == 0 || senses[0]->misc().contains(JMdictPlugin::miscMap(), "uk"))
 				tpl = tpl.arg(kana[0].getReading());
 			else
 				tpl = tpl.arg(kanji[0].getReading());
@@ -465,11 +494,11 @@ QList<DetailedViewJob *> JMdictEntryFormatter::jobVerbBuddy(const ConstEntryPoin
 	bool searchVi = true, searchVt = true;
 
 	foreach (const Sense *sense, senses) {
-		if (sense->partOfSpeech().contains("vi") && searchVt) {
+		if (sense->partOfSpeech().contains(JMdictPlugin::posMap(), "vi") && searchVt) {
 			ret << new FindVerbBuddyJob(entry, "vt", cursor);
 			searchVt = false;
 		}
-		if (sense->partOfSpeech().contains("vt") && searchVi) {
+		if (sense->partOfSpeech().contains(JMdictPlugin::posMap(), "vt") && searchVi) {
 			ret << new FindVerbBuddyJob(entry, "vi", cursor);
 			searchVi = false;
 		}
@@ -493,6 +522,15 @@ QList<DetailedViewJob *> JMdictEntryFormatter::jobHomographs(const ConstEntryPoi
 	return ret;
 }
 
+QList<DetailedViewJob *> JMdictEntryFormatter::jobExamples(const ConstEntryPointer& _entry, const QTextCursor& cursor) const
+{
+	ConstJMdictEntryPointer entry(_entry.staticCast<const JMdictEntry>());
+	QList<DetailedViewJob *> ret;
+	// The Tatoeba databases are optional
+	if (maxExamplesToDisplay.value() && Plugin::pluginExists("Tatoeba")) ret << new FindExamplesJob(entry, maxExamplesToDisplay.value(), cursor);
+	return ret;
+}
+
 
 FindVerbBuddyJob::FindVerbBuddyJob(const ConstJMdictEntryPointer& verb, const QString& pos, const QTextCursor& cursor) :
 	DetailedViewJob(cursor), lastKanjiPos(0), searchedPos(pos)
@@ -635,3 +673,31 @@ void FindHomographsJob::result(EntryPointer entry)
 	format += formatter->shortDesc(entry);
 	cursor().insertHtml(format);
 }
+
+FindExamplesJob::FindExamplesJob(const ConstJMdictEntryPointer& entry, int maxToDisplay, const QTextCursor& cursor) : DetailedViewJob(cursor), gotResults(false)
+{
+	_sql = JMdictEntryFormatter::getExamplesSql(entry->id(), maxToDisplay);
+}
+
+void FindExamplesJob::firstResult()
+{
+	cursor().insertHtml(QString("<br/>%1").arg(EntryFormatter::buildSubInfoBlock(tr("Examples"), "")));
+	_cursor.movePosition(QTextCursor::PreviousBlock);
+}
+
+void FindExamplesJob::result(EntryPointer entry)
+{
+	ConstTatoebaEntryPointer sentence(entry.staticCast<const TatoebaEntry>());
+	if (sentence->sentence().isEmpty()) return;
+	QString format;
+	if (!gotResults) gotResults = true;
+	else format = "<br/>\n";
+	format += QString("<span class=\"kanji\">%1</span>").arg(sentence->sentence().toHtmlEscaped());
+	// Translations are loaded in the order of the preferred languages
+	foreach (const QString &lang, Lang::preferredDictLanguages()) {
+		if (!sentence->translations().contains(lang)) continue;
+		format += QString("<br/>\n%1").arg(sentence->translations()[lang].toHtmlEscaped());
+		break;
+	}
+	cursor().insertHtml(format);
+}
@@ -39,6 +39,8 @@ public:
 	static JMdictEntryFormatter &instance();
 	
 	virtual QString shortDesc(const ConstEntryPointer &entry) const;
+	virtual QString exportStatement(int maxSenses = 0) const;
+	virtual QString displaySettingsKey() const;
 
 	virtual void draw(const ConstEntryPointer &entry, QPainter &painter, const QRectF &rectangle, QRectF &usedSpace, const QFont &textFont = QFont()) const { drawCustom(entry, painter, rectangle, usedSpace, textFont); }
 	void drawCustom(const ConstEntryPointer &entry, QPainter &painter, const QRectF &rectangle, QRectF &usedSpace, const QFont &textFont = QFont(), int _headerPrintSize = headerPrintSize.defaultValue(), bool _printKanjis = printKanjis.defaultValue(), bool _printOnlyStudiedKanjis = printOnlyStudiedKanjis.defaultValue(), int _maxDefinitionsToPrint = maxDefinitionsToPrint.defaultValue()) const;
@@ -46,6 +48,7 @@ public:
 	static QString getVerbBuddySql(const QString &matchPattern, quint64 pos, int id);
 	static QString getHomophonesSql(const QString &reading, int id, int maxToDisplay = maxHomophonesToDisplay.value(), bool studiedOnly = displayStudiedHomophonesOnly.value());
 	static QString getHomographsSql(const QString &writing, int id, int maxToDisplay = maxHomophonesToDisplay.value(), bool studiedOnly = displayStudiedHomophonesOnly.value());
+	static QString getExamplesSql(int id, int maxToDisplay = maxExamplesToDisplay.value());
 
 	static const QMap<QString, QString> &getExampleSentencesServices() { return instance()._exampleSentencesServices; }
 	static PreferenceItem<bool> showJLPT;
@@ -56,6 +59,7 @@ public:
 	static PreferenceItem<bool> displayStudiedHomophonesOnly;
 	static PreferenceItem<int> maxHomographsToDisplay;
 	static PreferenceItem<bool> displayStudiedHomographsOnly;
+	static PreferenceItem<int> maxExamplesToDisplay;
 
 	static PreferenceItem<int> headerPrintSize;
 	static PreferenceItem<bool> printKanjis;
@@ -77,6 +81,7 @@ public slots:
 	virtual QList<DetailedViewJob *> jobVerbBuddy(const ConstEntryPointer& _entry, const QTextCursor& cursor) const;
 	virtual QList<DetailedViewJob *> jobHomophones(const ConstEntryPointer &_entry, const QTextCursor& cursor) const;
 	virtual QList<DetailedViewJob *> jobHomographs(const ConstEntryPointer &_entry, const QTextCursor& cursor) const;
+	virtual QList<DetailedViewJob *> jobExamples(const ConstEntryPointer &_entry, const QTextCursor& cursor) const;
 };
 
 class FindVerbBuddyJob : public DetailedViewJob {
@@ -119,4 +124,15 @@ public:
 	virtual void result(EntryPointer entry);
 };
 
+class FindExamplesJob : public DetailedViewJob {
+	Q_DECLARE_TR_FUNCTIONS(FindExamplesJob)
+private:
+	bool gotResults;
+
+public:
+	FindExamplesJob(const ConstJMdictEntryPointer &entry, int maxToDisplay, const QTextCursor &cursor);
+	virtual void firstResult();
+	virtual void result(EntryPointer entry);
+};
+
 #endif
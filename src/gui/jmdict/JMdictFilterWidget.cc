@@ -81,6 +81,16 @@ JMdictFilterWidget::JMdictFilterWidget(QWidget *parent) : SearchFilterWidget(par
 		_miscButton->setMenu(menu);
 		hLayout->addWidget(_miscButton);
 		connect(actionGroup, SIGNAL(triggered(QAction *)), this, SLOT(onMiscTriggered(QAction *)));
+		// Show how many results each property would give when opening
+		// its menu
+		_posButton->menu()->setProperty("TJcommand", "pos");
+		_dialButton->menu()->setProperty("TJcommand", "dial");
+		_fieldButton->menu()->setProperty("TJcommand", "field");
+		_miscButton->menu()->setProperty("TJcommand", "misc");
+		foreach (QPushButton *button, QList<QPushButton *>() << _posButton << _dialButton << _fieldButton << _miscButton)
+			connect(button->menu(), SIGNAL(aboutToShow()), this, SLOT(onPropertiesMenuShown()));
+		connect(&_counter, SIGNAL(counted(QString, int)), this, SLOT(onPropertyCounted(QString, int)));
+
 		updateMiscFilteredProperties();
 		connect(&JMdictEntrySearcher::miscPropertiesFilter, SIGNAL(valueChanged(QVariant)), this, SLOT(updateMiscFilteredProperties()));
 
@@ -178,6 +188,44 @@ void JMdictFilterWidget::__onPropertyTriggered(QAction *action, QStringList &lis
 	commandUpdate();
 }
 
+void JMdictFilterWidget::searchUpdated(const QString &otherCommands)
+{
+	_otherCommands = otherCommands;
+	_counter.clearPending();
+	_countedActions.clear();
+	// Counts of the previous search are not valid anymore
+	foreach (QPushButton *button, QList<QPushButton *>() << _posButton << _dialButton << _fieldButton << _miscButton) {
+		foreach (QAction *action, button->menu()->actions())
+			action->setText(action->property("TJlabel").toString());
+		if (button->menu()->isVisible()) countProperties(button->menu());
+	}
+}
+
+void JMdictFilterWidget::countProperties(QMenu *menu)
+{
+	QString command(menu->property("TJcommand").toString());
+	QString base(_otherCommands + " " + currentCommand());
+	foreach (QAction *action, menu->actions()) {
+		if (!action->isVisible()) continue;
+		QString search(QString("%1 :%2=%3").arg(base).arg(command).arg(action->property("TJpropertyIndex").toString()).simplified());
+		_countedActions[search] = action;
+		_counter.count(search);
+	}
+}
+
+void JMdictFilterWidget::onPropertiesMenuShown()
+{
+	QMenu *menu = qobject_cast<QMenu *>(sender());
+	if (menu) countProperties(menu);
+}
+
+void JMdictFilterWidget::onPropertyCounted(const QString &search, int count)
+{
+	QAction *action = _countedActions.value(search);
+	if (!action) return;
+	action->setText(QString("%1 (%2)").arg(action->property("TJlabel").toString()).arg(count));
+}
+
 void JMdictFilterWidget::onPosTriggered(QAction *action)
 {
 	__onPropertyTriggered(action, _posList, _posButton);
@@ -280,6 +328,7 @@ QActionGroup *JMdictFilterWidget::addCheckableProperties(const QMap<QString, QPa
 		action->setCheckable(true);
 		menu->addAction(action);
 		action->setProperty("TJpropertyIndex", tag);
+		action->setProperty("TJlabel", str);
 	}
 	return actionGroup;
 }
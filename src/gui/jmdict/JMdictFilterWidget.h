@@ -19,6 +19,7 @@
 #define __GUI_JMDICTFILTERWIDGET_H
 
 #include "gui/SearchFilterWidget.h"
+#include "gui/FacetCounter.h"
 
 #include <QLineEdit>
 #include <QCheckBox>
@@ -26,6 +27,7 @@
 #include <QMenu>
 #include <QStringList>
 #include <QAction>
+#include <QHash>
 
 class JMdictFilterWidget : public SearchFilterWidget
 {
@@ -45,7 +47,13 @@ private:
 	QPushButton *_miscButton;
 	QStringList _miscList;
 
+	FacetCounter _counter;
+	QString _otherCommands;
+	/// Actions waiting for their count, by search
+	QHash<QString, QAction *> _countedActions;
+
 	void __onPropertyTriggered(QAction *action, QStringList &list, QPushButton *button);
+	void countProperties(QMenu *menu);
 
 protected:
 	virtual void _reset();
@@ -53,6 +61,8 @@ protected:
 
 protected slots:
 	void updateMiscFilteredProperties();
+	void onPropertiesMenuShown();
+	void onPropertyCounted(const QString &search, int count);
 
 public:
 	JMdictFilterWidget(QWidget *parent = 0);
@@ -60,6 +70,7 @@ public:
 	virtual QString currentTitle() const;
 	virtual QString currentCommand() const;
 	virtual void updateFeatures();
+	virtual void searchUpdated(const QString &otherCommands);
 
 	QString containedKanjis() const { return _containedKanjis->text(); }
 	void setContainedKanjis(const QString &kanjis) { _containedKanjis->setText(kanjis); }
@@ -24,6 +24,7 @@
 #include "gui/jmdict/JMdictEntryFormatter.h"
 #include "gui/jmdict/JMdictPreferences.h"
 #include "gui/jmdict/JMdictGUIPlugin.h"
+#include "gui/jmdict/ClipboardLookup.h"
 #include "gui/TrainSettings.h"
 #include "gui/MainWindow.h"
 
@@ -37,7 +38,7 @@
 
 PreferenceItem<bool> JMdictGUIPlugin::furiganasForTraining("jmdict", "furiganasForTraining", true);
 
-JMdictGUIPlugin::JMdictGUIPlugin() : Plugin("JMdictGUI"), _flashJL(0), _flashJS(0), _flashTL(0), _flashTS(0), _linkhandler(0), _filter(0), _trainer(0)
+JMdictGUIPlugin::JMdictGUIPlugin() : Plugin("JMdictGUI"), _flashJL(0), _flashJS(0), _flashTL(0), _flashTS(0), _linkhandler(0), _filter(0), _trainer(0), _clipboardLookup(0), _clipboardLookupAction(0)
 {
 }
 
@@ -73,6 +74,13 @@ bool JMdictGUIPlugin::onRegister()
 	_filter = new JMdictFilterWidget(0);
 	mainWindow->searchWidget()->addSearchFilter(_filter);
 
+	// Look up the text copied in other programs
+	_clipboardLookup = new ClipboardLookup();
+	_clipboardLookupAction = mainWindow->searchMenu()->addAction(tr("Look up copied Japanese text"));
+	_clipboardLookupAction->setCheckable(true);
+	_clipboardLookupAction->setChecked(_clipboardLookup->isEnabled());
+	connect(_clipboardLookupAction, SIGNAL(toggled(bool)), _clipboardLookup, SLOT(setEnabled(bool)));
+
 	// Add the preference panel
 	PreferencesWindow::addPanel(&JMdictPreferences::staticMetaObject);
 
@@ -88,6 +96,9 @@ bool JMdictGUIPlugin::onUnregister()
 	// Remove the search extender
 	mainWindow->searchWidget()->removeSearchFilterWidget(_filter->name());
 	delete _filter; _filter = 0;
+	// Remove the clipboard lookup
+	delete _clipboardLookupAction; _clipboardLookupAction = 0;
+	delete _clipboardLookup; _clipboardLookup = 0;
 	// Remove the main window entries
 	delete _flashJS; _flashJS = 0;
 	delete _flashJL; _flashJL = 0;
@@ -173,8 +184,7 @@ void JMdictGUIPlugin::trainingJapaneseSet()
 		return;
 	}
 
-	QString queryString(stat->buildSqlStatement());
-	queryString += " " + TrainSettings::buildOrderString("score");
+	QString queryString(TrainSettings::buildQueryString(*stat));
 	training(YesNoTrainer::Japanese, queryString);
 }
 
@@ -192,8 +202,7 @@ void JMdictGUIPlugin::trainingTranslationSet()
 		return;
 	}
 
-	QString queryString(stat->buildSqlStatement());
-	queryString += " " + TrainSettings::buildOrderString("score");
+	QString queryString(TrainSettings::buildQueryString(*stat));
 	training(YesNoTrainer::Translation, queryString);
 }
 
@@ -24,6 +24,7 @@
 
 class JMdictLinkHandler;
 class JMdictFilterWidget;
+class ClipboardLookup;
 
 class JMdictGUIPlugin : public QObject, public Plugin
 {
@@ -33,6 +34,8 @@ private:
 	JMdictLinkHandler *_linkhandler;
 	JMdictFilterWidget *_filter;
 	JMdictYesNoTrainer *_trainer;
+	ClipboardLookup *_clipboardLookup;
+	QAction *_clipboardLookupAction;
 
 	void training(YesNoTrainer::TrainingMode mode, const QString &queryString);
 
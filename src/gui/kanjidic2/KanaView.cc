@@ -20,18 +20,46 @@
 #include "core/TextTools.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
 #include "core/EntriesCache.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
 #include "gui/kanjidic2/KanaView.h"
 #include "gui/EntryFormatter.h"
+#include "gui/EntriesMimeData.h"
 
 #include <QHeaderView>
 #include <QDrag>
 #include <QMimeData>
+#include <QPainter>
+#include <QPixmapCache>
+#include <QApplication>
 
 PreferenceItem<QString> KanaView::characterFont("kanjidic2/kanaSelector", "characterFont", QFont("Helvetica", 15).toString());
 
 KanaModel::KanaModel(QObject *parent) : QAbstractTableModel(parent), _showObsolete(false), _mode(Hiragana), _kanaTable(&TextTools::hiraganaTable)
 {
 	_font.fromString(KanaView::characterFont.value());
+	updateCells();
+	connect(&EntryChanges::instance(), SIGNAL(entryChanged(Entry *)), this, SLOT(onEntryChanged(Entry *)));
+}
+
+void KanaModel::updateCells()
+{
+	for (int i = 0; i < KANASTABLE_NBROWS; i++) for (int j = 0; j < KANASTABLE_NBCOLS; j++) {
+		QChar c((*_kanaTable)[i][j]);
+		if (c.unicode() != 0 && !showObsolete() && TextTools::kanaInfo(c).usage == TextTools::KanaInfo::Rare) c = QChar();
+		_cells[i][j] = c;
+		_entries[i][j].clear();
+	}
+}
+
+void KanaModel::onEntryChanged(Entry *entry)
+{
+	for (int i = 0; i < KANASTABLE_NBROWS; i++) for (int j = 0; j < KANASTABLE_NBCOLS; j++) {
+		if (_entries[i][j].data() != entry) continue;
+		QModelIndex idx(index(i, j));
+		emit dataChanged(idx, idx);
+		return;
+	}
 }
 
 int KanaModel::rowCount(const QModelIndex &parent) const
@@ -47,6 +75,7 @@ int KanaModel::columnCount(const QModelIndex &parent) const
 void KanaModel::setShowObsolete(bool show)
 {
 	_showObsolete = show;
+	updateCells();
 	emit layoutChanged();
 }
 
@@ -55,6 +84,7 @@ void KanaModel::setMode(Mode newMode)
 	_mode = newMode;
 	if (_mode == Hiragana) _kanaTable = &TextTools::hiraganaTable;
 	else _kanaTable = &TextTools::katakanaTable;
+	updateCells();
 	emit layoutChanged();
 }
 
@@ -65,9 +95,8 @@ QVariant KanaModel::data(const QModelIndex &index, int role) const
 	if (index.row() >= rowCount()) return QVariant();
 	if (index.column() >= columnCount()) return QVariant();
 
-	QChar c((*_kanaTable)[index.row()][index.column()]);
-	TextTools::KanaInfo info(TextTools::kanaInfo(c));
-	if (c.unicode() == 0 || (!showObsolete() && info.usage == TextTools::KanaInfo::Rare)) return QVariant();
+	QChar c(cell(index.row(), index.column()));
+	if (c.isNull()) return QVariant();
 
 	switch (role) {
 	case Qt::DisplayRole:
@@ -78,11 +107,15 @@ QVariant KanaModel::data(const QModelIndex &index, int role) const
 		return _font;
 	case Entry::EntryRefRole:
 		return QVariant::fromValue(EntryRef(KANJIDIC2ENTRY_GLOBALID, c.unicode()));
-	default:
+	case Qt::BackgroundRole:
+	case Entry::EntryRole:
 		break;
+	default:
+		return QVariant();
 	}
 
-	EntryPointer entry = EntryRef(KANJIDIC2ENTRY_GLOBALID, c.unicode()).get();
+	EntryPointer &entry = _entries[index.row()][index.column()];
+	if (!entry) entry = EntryRef(KANJIDIC2ENTRY_GLOBALID, c.unicode()).get();
 	switch (role) {
 	case Qt::BackgroundRole:
 		if (!entry || !entry->trained()) return QVariant();
@@ -123,32 +156,62 @@ QVariant KanaModel::headerData(int section, Qt::Orientation orientation, int rol
 
 Qt::ItemFlags KanaModel::flags(const QModelIndex &index) const
 {
-	QChar c((*_kanaTable)[index.row()][index.column()]);
-	TextTools::KanaInfo info(TextTools::kanaInfo(c));
-	if (c.unicode() == 0 || (!showObsolete() && info.usage == TextTools::KanaInfo::Rare)) return Qt::NoItemFlags;
+	if (cell(index.row(), index.column()).isNull()) return Qt::NoItemFlags;
 	else return QAbstractTableModel::flags(index) | Qt::ItemIsDragEnabled;
 }
 
 QMimeData *KanaModel::mimeData(const QModelIndexList &indexes) const
 {
-	QMimeData *mimeData = new QMimeData();
-	QByteArray encodedData;
-
-	QDataStream stream(&encodedData, QIODevice::WriteOnly);
-
+	EntryRefList entries;
 	foreach (QModelIndex index, indexes) {
-		if (index.isValid()) {
-			stream << data(index, Entry::EntryRefRole).value<EntryRef>();
-		}
+		if (index.isValid()) entries << data(index, Entry::EntryRefRole).value<EntryRef>();
 	}
+	return new EntriesMimeData(entries);
+}
+
+static PerfHistogram kanaPaintTime("Kana delegate paint");
 
-	mimeData->setData("tagainijisho/entry", encodedData);
-	return mimeData;
+void KanaDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	PerfTimer timer(kanaPaintTime);
+	TRACE_SCOPE("Kana delegate paint");
+	QStyleOptionViewItem opt(option);
+	initStyleOption(&opt, index);
+	QString text(opt.text);
+	// Draw the cell without its text, which comes from the cache
+	opt.text.clear();
+	const QWidget *widget = opt.widget;
+	QStyle *style = widget ? widget->style() : QApplication::style();
+	style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, widget);
+	if (text.isEmpty()) return;
+
+	QPalette::ColorGroup group = (opt.state & QStyle::State_Enabled) ? QPalette::Normal : QPalette::Disabled;
+	QColor color(opt.palette.color(group, (opt.state & QStyle::State_Selected) ? QPalette::HighlightedText : QPalette::Text));
+	qreal ratio = painter->device()->devicePixelRatioF();
+	QString key(QString("kana:%1:%2:%3:%4").arg(text).arg(opt.font.key()).arg(color.rgba()).arg(ratio));
+	QPixmap pixmap;
+	if (!QPixmapCache::find(key, &pixmap)) {
+		QFontMetrics metrics(opt.font);
+		QSize size(metrics.horizontalAdvance(text), metrics.height());
+		pixmap = QPixmap(size * ratio);
+		pixmap.setDevicePixelRatio(ratio);
+		pixmap.fill(Qt::transparent);
+		QPainter pixPainter(&pixmap);
+		pixPainter.setFont(opt.font);
+		pixPainter.setPen(color);
+		pixPainter.drawText(QRect(QPoint(0, 0), size), Qt::AlignCenter, text);
+		pixPainter.end();
+		QPixmapCache::insert(key, pixmap);
+	}
+	QSize size(pixmap.size() / ratio);
+	QRect rect(QStyle::alignedRect(opt.direction, Qt::AlignCenter, size, opt.rect));
+	painter->drawPixmap(rect.topLeft(), pixmap);
 }
 
-KanaView::KanaView(QWidget *parent, bool viewOnly) : QTableView(parent), _helper(this, 0, true, viewOnly)
+KanaView::KanaView(QWidget *parent, bool viewOnly) : QTableView(parent), _delegate(), _helper(this, 0, true, viewOnly)
 {
 	setModel(&_model);
+	setItemDelegate(&_delegate);
 
 	horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
 	verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
@@ -182,11 +245,7 @@ void KanaView::updateLayout()
 	for (int i = 0; i < _model.rowCount(); ++i) {
 		bool empty = true;
 		for (int j = 0; j < _model.columnCount(); ++j) {
-			QChar c = (*_model.kanaTable())[i][j];
-			if (c.unicode() == 0) continue;
-			TextTools::KanaInfo info(TextTools::kanaInfo(c));
-			if (!showObsolete() && info.usage == TextTools::KanaInfo::Rare) continue;
-			empty = false;
+			if (!_model.cell(i, j).isNull()) empty = false;
 		}
 		setRowHidden(i, empty);
 	}
@@ -24,6 +24,7 @@
 
 #include <QAbstractTableModel>
 #include <QTableView>
+#include <QStyledItemDelegate>
 #include <QFont>
 
 class KanaModel : public QAbstractTableModel {
@@ -36,6 +37,16 @@ private:
 	bool _showObsolete;
 	Mode _mode;
 	TextTools::KanaTable *_kanaTable;
+	/// Characters displayed by the cells, null for the empty cells
+	QChar _cells[KANASTABLE_NBROWS][KANASTABLE_NBCOLS];
+	/// Entries of the cells, kept once loaded so painting a cell does not
+	/// need to look for it in the cache
+	mutable EntryPointer _entries[KANASTABLE_NBROWS][KANASTABLE_NBCOLS];
+
+	void updateCells();
+
+private slots:
+	void onEntryChanged(Entry *entry);
 
 public:
 	KanaModel(QObject *parent = 0);
@@ -51,14 +62,28 @@ public:
 	Mode mode() const { return _mode; }
 	void setMode(Mode newMode);
 	TextTools::KanaTable *kanaTable() const { return _kanaTable; }
+	/// Returns the character of a cell, or a null one if it is empty
+	QChar cell(int row, int column) const { return _cells[row][column]; }
 	const QFont &font() const { return _font; }
 	void setFont(const QFont &font) { _font = font; }
 };
 
+/**
+ * Paints the cells of a KanaView from pixmaps of their characters kept in
+ * the QPixmapCache, so large fonts are only rasterized once.
+ */
+class KanaDelegate : public QStyledItemDelegate {
+Q_OBJECT
+public:
+	KanaDelegate(QObject *parent = 0) : QStyledItemDelegate(parent) {}
+	virtual void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+};
+
 class KanaView : public QTableView {
 Q_OBJECT
 private:
 	KanaModel _model;
+	KanaDelegate _delegate;
 	EntriesViewHelper _helper;
 
 protected:
@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TextTools.h"
+#include "core/kanjidic2/KanjiRecognizer.h"
+#include "gui/kanjidic2/KanjiDrawingInput.h"
+
+#include <QPainter>
+#include <QMouseEvent>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QPushButton>
+
+KanjiDrawingArea::KanjiDrawingArea(QWidget *parent) : QWidget(parent), _drawing(false)
+{
+	setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+	setAttribute(Qt::WA_OpaquePaintEvent);
+	setCursor(Qt::CrossCursor);
+}
+
+QSize KanjiDrawingArea::sizeHint() const
+{
+	return QSize(200, 200);
+}
+
+void KanjiDrawingArea::clear()
+{
+	_strokes.clear();
+	_drawing = false;
+	update();
+	emit strokesChanged();
+}
+
+void KanjiDrawingArea::undo()
+{
+	if (_strokes.isEmpty()) return;
+	_strokes.removeLast();
+	_drawing = false;
+	update();
+	emit strokesChanged();
+}
+
+void KanjiDrawingArea::paintEvent(QPaintEvent *event)
+{
+	QPainter painter(this);
+	painter.fillRect(rect(), palette().base());
+	painter.setRenderHint(QPainter::Antialiasing);
+
+	// Same guides as the kanji grid
+	QPen pen(palette().mid(), 1, Qt::DashLine);
+	painter.setPen(pen);
+	painter.drawLine(QPointF(width() / 2.0, 0), QPointF(width() / 2.0, height()));
+	painter.drawLine(QPointF(0, height() / 2.0), QPointF(width(), height() / 2.0));
+
+	pen = QPen(palette().text(), qMax(3, qMin(width(), height()) / 40), Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+	painter.setPen(pen);
+	foreach (const QPolygonF &stroke, _strokes) {
+		if (stroke.size() == 1) painter.drawPoint(stroke[0]);
+		else painter.drawPolyline(stroke);
+	}
+}
+
+void KanjiDrawingArea::mousePressEvent(QMouseEvent *event)
+{
+	if (event->button() == Qt::RightButton) {
+		undo();
+		return;
+	}
+	if (event->button() != Qt::LeftButton) return;
+	_strokes << QPolygonF();
+	_strokes.last() << event->localPos();
+	_drawing = true;
+	update();
+}
+
+void KanjiDrawingArea::mouseMoveEvent(QMouseEvent *event)
+{
+	if (!_drawing) return;
+	QPolygonF &stroke = _strokes.last();
+	// Ignore jitter, the recognizer resamples the strokes anyway
+	if (QLineF(stroke.last(), event->localPos()).length() < 2.0) return;
+	stroke << event->localPos();
+	update();
+}
+
+void KanjiDrawingArea::mouseReleaseEvent(QMouseEvent *event)
+{
+	if (!_drawing || event->button() != Qt::LeftButton) return;
+	_drawing = false;
+	emit strokesChanged();
+}
+
+KanjiDrawingInputter::KanjiDrawingInputter(QWidget *parent) : KanjiInputter(parent)
+{
+	QVBoxLayout *layout = static_cast<QVBoxLayout *>(this->layout());
+	_area = new KanjiDrawingArea(this);
+	layout->addWidget(_area, 1);
+	QHBoxLayout *buttons = new QHBoxLayout();
+	QPushButton *undoButton = new QPushButton(tr("Undo stroke"), this);
+	undoButton->setFocusPolicy(Qt::NoFocus);
+	buttons->addWidget(undoButton);
+	QPushButton *clearButton = new QPushButton(tr("Clear"), this);
+	clearButton->setFocusPolicy(Qt::NoFocus);
+	buttons->addWidget(clearButton);
+	layout->addLayout(buttons);
+	connect(undoButton, SIGNAL(clicked()), _area, SLOT(undo()));
+	connect(clearButton, SIGNAL(clicked()), _area, SLOT(clear()));
+	connect(_area, SIGNAL(strokesChanged()), this, SLOT(recognize()));
+	setFocusProxy(_area);
+	resize(results()->sizeHint().width(), results()->sizeHint().height() + _area->sizeHint().height() + undoButton->sizeHint().height());
+}
+
+void KanjiDrawingInputter::reset()
+{
+	_area->clear();
+	KanjiInputter::reset();
+}
+
+void KanjiDrawingInputter::recognize()
+{
+	QList<QVector<QPointF> > strokes;
+	foreach (const QPolygonF &stroke, _area->strokes()) strokes << stroke;
+	results()->startReceive();
+	foreach (uint kanji, KanjiRecognizer::instance().recognize(strokes)) results()->addItem(TextTools::unicodeToSingleChar(kanji));
+	results()->endReceive();
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_KANJI_DRAWING_INPUT_H
+#define __GUI_KANJI_DRAWING_INPUT_H
+
+#include "gui/kanjidic2/KanjiSelector.h"
+
+#include <QWidget>
+#include <QPolygonF>
+#include <QList>
+
+/**
+ * An area the user can draw the strokes of a character into with the
+ * mouse or a pen.
+ */
+class KanjiDrawingArea : public QWidget
+{
+	Q_OBJECT
+private:
+	QList<QPolygonF> _strokes;
+	bool _drawing;
+
+protected:
+	virtual void paintEvent(QPaintEvent *event);
+	virtual void mousePressEvent(QMouseEvent *event);
+	virtual void mouseMoveEvent(QMouseEvent *event);
+	virtual void mouseReleaseEvent(QMouseEvent *event);
+
+public:
+	KanjiDrawingArea(QWidget *parent = 0);
+	virtual QSize sizeHint() const;
+	const QList<QPolygonF> &strokes() const { return _strokes; }
+
+public slots:
+	void clear();
+	/// Removes the last drawn stroke
+	void undo();
+
+signals:
+	/// Emitted when a stroke is completed or removed
+	void strokesChanged();
+};
+
+/**
+ * A kanji inputter that proposes the characters the closest to those
+ * drawn by the user, as found by KanjiRecognizer.
+ */
+class KanjiDrawingInputter : public KanjiInputter
+{
+	Q_OBJECT
+private:
+	KanjiDrawingArea *_area;
+
+protected slots:
+	void recognize();
+
+public:
+	KanjiDrawingInputter(QWidget *parent = 0);
+	virtual void reset();
+};
+
+#endif
@@ -41,7 +41,7 @@ PreferenceItem<int> KanjiPlayer::strokesNumbersSizePref("kanjidic", "strokesNumb
 
 static QList<QColor> colList(QList<QColor>() << Qt::black << QColor(0x0d, 0x5b, 0xa6) << QColor(0xce, 0x34, 0x34) << QColor(0x04, 0x9a,0x40) << QColor(0xe6, 0xa6, 0x00) << QColor(0xd2, 0x7d, 0x8e) << Qt::blue << Qt::red << Qt::green << Qt::cyan << Qt::magenta << Qt::yellow);
 
-KanjiPlayer::KanjiPlayer(QWidget *parent) : QWidget(parent), _timer(), _kanji(0), renderer(), _picture(), _state(STATE_STROKE), _showGrid(showGridPref.value()), _showStrokesNumbers(showStrokesNumbersPref.value()), _strokesNumbersSize(strokesNumbersSizePref.value()), _highlightedComponent(0)
+KanjiPlayer::KanjiPlayer(QWidget *parent) : QWidget(parent), _timer(), _kanji(0), renderer(), _picture(), _backgroundValid(false), _backgroundStrokes(0), _backgroundComponent(0), _state(STATE_STROKE), _showGrid(showGridPref.value()), _showStrokesNumbers(showStrokesNumbersPref.value()), _strokesNumbersSize(strokesNumbersSizePref.value()), _highlightedComponent(0)
 {
 	setAnimationSpeed(animationSpeed.value());
 	setDelayBetweenStrokes(delayBetweenStrokes.value());
@@ -136,6 +136,7 @@ void KanjiPlayer::setKanji(const ConstKanjidic2EntryPointer &entry)
 	strokeCountLabel->setText("");
 	playButton->setEnabled(true);
 	renderer.setKanji(_kanji);
+	invalidateBackground();
 	reset();
 	renderCurrentState();
 	updateStrokesCountLabel();
@@ -205,13 +206,40 @@ void KanjiPlayer::unHighlightComponent()
 	highlightComponent(0);
 }
 
-void KanjiPlayer::renderCurrentState()
+static const int strokes_size = 4;
+static const int outline_size = strokes_size + 2;
+static const Qt::PenCapStyle strokeCapStyle = Qt::RoundCap;
+static const uchar HIGHLIGHT_RATIO = 135;
+
+const KanjiComponent *KanjiPlayer::strokeComponent(const KanjiStroke *stroke) const
 {
-	static const int strokes_size = 4;
-	static const int outline_size = strokes_size + 2;
-	static const Qt::PenCapStyle strokeCapStyle = Qt::RoundCap;
+	if (highlightedComponent() && highlightedComponent()->strokes().contains(stroke))
+		return highlightedComponent();
+	foreach (const KanjiComponent *comp, _kanji->rootComponents()) {
+		if (comp->strokes().contains(stroke)) return comp;
+	}
+	return 0;
+}
 
-	QPainter painter(&_picture);
+QColor KanjiPlayer::componentColor(const KanjiComponent *component) const
+{
+	if (!component) return colList[0];
+	return colList[_kanji->rootComponents().indexOf(component) + 1];
+}
+
+void KanjiPlayer::updateBackground()
+{
+	qreal ratio = devicePixelRatioF();
+	QSize size(QSize(pictureSize(), pictureSize()) * ratio);
+	if (_backgroundValid && _background.size() == size && _backgroundStrokes == _strokesCpt && _backgroundComponent == highlightedComponent()) return;
+	_backgroundValid = true;
+	_backgroundStrokes = _strokesCpt;
+	_backgroundComponent = highlightedComponent();
+
+	_background = QPixmap(size);
+	_background.setDevicePixelRatio(ratio);
+	_background.fill(Qt::transparent);
+	QPainter painter(&_background);
 	painter.scale(pictureSize() / KANJI_AREA_WIDTH, pictureSize() / KANJI_AREA_HEIGHT);
 	painter.setRenderHint(QPainter::Antialiasing);
 
@@ -242,54 +270,40 @@ void KanjiPlayer::renderCurrentState()
 	painter.setPen(outLinePen);
 	renderer.renderStrokes(&painter);
 
-	// Render the strokes
+	// Render full strokes
 	QPen strokesPen;
 	strokesPen.setWidth(strokes_size);
 	strokesPen.setCapStyle(strokeCapStyle);
-	painter.setPen(strokesPen);
-
-	const QList<const KanjiComponent *> &kComponents(_kanji->rootComponents());
-	const QList<KanjiStroke> &kStrokes(_kanji->strokes());
-
-	if (renderer.strokes().isEmpty()) return;
-
-	static const uchar HIGHLIGHT_RATIO = 135;
-	// Render full strokes
-	for (int i = 0; i < _strokesCpt; i++) {
-		const KanjiComponent *parent(0);
-		if (highlightedComponent() && highlightedComponent()->strokes().contains(&kStrokes[i]))
-			parent = highlightedComponent();
-		else foreach (const KanjiComponent *comp, kComponents) {
-			if (comp->strokes().contains(&kStrokes[i])) {
-				parent = comp;
-				break;
-			}
-		}
-		if (!parent)
-			strokesPen.setColor(colList[0]);
-		else
-			strokesPen.setColor(colList[kComponents.indexOf(parent) + 1]);
+	for (int i = 0; i < _strokesCpt && i < renderer.strokes().size(); i++) {
+		const KanjiRenderer::Stroke &stroke(renderer.strokes()[i]);
+		const KanjiComponent *parent(strokeComponent(stroke.stroke()));
 		if (highlightedComponent() && parent == highlightedComponent())
 			strokesPen.setColor(palette().color(QPalette::Highlight));
+		else strokesPen.setColor(componentColor(parent));
 		painter.setPen(strokesPen);
-		renderer.strokes()[i].render(&painter);
+		stroke.render(&painter);
 	}
+}
+
+void KanjiPlayer::renderCurrentState()
+{
+	updateBackground();
+
+	QPainter painter(&_picture);
+	painter.drawPixmap(QRect(0, 0, pictureSize(), pictureSize()), _background);
+	painter.scale(pictureSize() / KANJI_AREA_WIDTH, pictureSize() / KANJI_AREA_HEIGHT);
+	painter.setRenderHint(QPainter::Antialiasing);
+
+	if (renderer.strokes().isEmpty()) return;
+
 	// Render partial stroke
 	if (_state == STATE_STROKE && _strokesCpt < renderer.strokes().size()) {
 		const KanjiRenderer::Stroke &currentStroke(renderer.strokes()[_strokesCpt]);
-		const KanjiComponent *parent(0);
-		if (highlightedComponent() && highlightedComponent()->strokes().contains(currentStroke.stroke()))
-			parent = highlightedComponent();
-		else foreach (const KanjiComponent *comp, kComponents) {
-			if (comp->strokes().contains(currentStroke.stroke())) {
-				parent = comp;
-				break;
-			}
-		}
-		if (!parent)
-			strokesPen.setColor(colList[0]);
-		else
-			strokesPen.setColor(colList[kComponents.indexOf(parent) + 1]);
+		const KanjiComponent *parent(strokeComponent(currentStroke.stroke()));
+		QPen strokesPen;
+		strokesPen.setWidth(strokes_size);
+		strokesPen.setCapStyle(strokeCapStyle);
+		strokesPen.setColor(componentColor(parent));
 		if (highlightedComponent() && parent == highlightedComponent())
 			strokesPen.setColor(strokesPen.color().lighter(HIGHLIGHT_RATIO));
 		painter.setPen(strokesPen);
@@ -298,6 +312,7 @@ void KanjiPlayer::renderCurrentState()
 
 	// Render stroke numbers
 	if (showStrokesNumbers()) {
+		const QList<KanjiStroke> &kStrokes(_kanji->strokes());
 		int strokesMax = _strokesCpt + (_state == STATE_STROKE && _strokesCpt < renderer.strokes().size() ? 1 : 0);
 		for (int i = 0; i < strokesMax; i++) {
 			renderer.renderStrokeNumber(kStrokes[i], &painter, strokesNumbersSize());
@@ -307,6 +322,12 @@ void KanjiPlayer::renderCurrentState()
 	painter.end();
 }
 
+void KanjiPlayer::changeEvent(QEvent *event)
+{
+	if (event->type() == QEvent::PaletteChange) invalidateBackground();
+	QWidget::changeEvent(event);
+}
+
 void KanjiPlayer::paintEvent(QPaintEvent * event)
 {
 	renderCurrentState();
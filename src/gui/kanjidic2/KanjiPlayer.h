@@ -41,6 +41,14 @@ private:
 	KanjiRenderer renderer;
 	// Off-screen rendering of the kanji
 	QPicture _picture;
+	/**
+	 * Grid, outlines and completed strokes, which only change between
+	 * strokes. Animating a stroke only draws it over this pixmap.
+	 */
+	QPixmap _background;
+	bool _backgroundValid;
+	int _backgroundStrokes;
+	const KanjiComponent *_backgroundComponent;
 	// Actual display of the kanji
 	QLabel *kanjiView;
 	int _pictureSize;
@@ -66,6 +74,13 @@ protected:
 	 * Render the state of the animation into _picture
 	 */
 	void renderCurrentState();
+	/// Renders _background again if the state it depends on changed
+	void updateBackground();
+	void invalidateBackground() { _backgroundValid = false; }
+	/// Component which color the given stroke is drawn with, or 0
+	const KanjiComponent *strokeComponent(const KanjiStroke *stroke) const;
+	QColor componentColor(const KanjiComponent *component) const;
+	virtual void changeEvent(QEvent *event);
 	virtual void paintEvent(QPaintEvent * event);
 	virtual bool eventFilter(QObject *obj, QEvent *event);
 	void updateStrokesCountLabel();
@@ -106,7 +121,7 @@ public slots:
 	void setAnimationSpeed(int speed) { _animationSpeed = speed / 10.0; }
 	void setDelayBetweenStrokes(int delay) { _delayBetweenStrokes = delay; }
 	void setAnimationLoopDelay(int delay) { _animationLoopDelay = delay; }
-	void setShowGrid(bool show) { _showGrid = show; update(); }
+	void setShowGrid(bool show) { _showGrid = show; invalidateBackground(); update(); }
 	void setShowStrokesNumbers(bool show) { _showStrokesNumbers = show; update(); }
 	void setStrokesNumbersSize(int size) { _strokesNumbersSize = size; update(); }
 
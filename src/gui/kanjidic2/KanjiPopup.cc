@@ -65,16 +65,10 @@ void KanjiComponentWidget::paintEvent(QPaintEvent *event)
 	// First draw the shape
 	ConstKanjidic2EntryPointer kEntry(kanji());
 	if (kEntry && !kEntry->strokes().isEmpty()) {
-		KanjiRenderer renderer(kEntry);
-		QPen pen(painter.pen());
-		pen.setStyle(Qt::SolidLine);
-		pen.setWidth(5);
-		painter.setPen(pen);
-		painter.setBrush(QBrush());
-		painter.save();
-		painter.scale(kanjiSize / 109.0, kanjiSize / 109.0);
-		renderer.renderStrokes(&painter);
-		painter.restore();
+		// Hovering over kanjis displays the same components again and again
+		KanjiRenderer::RenderStyle style;
+		style.strokesColor = painter.pen().color();
+		painter.drawPixmap(0, 0, KanjiRenderer::pixmap(kEntry, kanjiSize, devicePixelRatioF(), style));
 	} else {
 		QString k(component()->element());
 		painter.save();
@@ -0,0 +1,123 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/TextTools.h"
+#include "gui/kanjidic2/KanjiPositionsIndex.h"
+
+#include <QTextDocument>
+#include <QTextBlock>
+
+KanjiPositionsIndex::KanjiPositionsIndex(QTextDocument *document) : QObject(document), _document(document), _dirty(true)
+{
+	setObjectName("kanjiPositionsIndex");
+	_buildTimer.setSingleShot(true);
+	_buildTimer.setInterval(0);
+	connect(&_buildTimer, SIGNAL(timeout()), this, SLOT(build()));
+	connect(document, SIGNAL(contentsChanged()), this, SLOT(onContentsChanged()));
+	_buildTimer.start();
+}
+
+KanjiPositionsIndex *KanjiPositionsIndex::forDocument(QTextDocument *document)
+{
+	KanjiPositionsIndex *ret = document->findChild<KanjiPositionsIndex *>("kanjiPositionsIndex", Qt::FindDirectChildrenOnly);
+	if (!ret) ret = new KanjiPositionsIndex(document);
+	return ret;
+}
+
+void KanjiPositionsIndex::onContentsChanged()
+{
+	// Documents are changed many times in a row when they are displayed,
+	// so only index them once we are back to the event loop
+	_dirty = true;
+	if (!_buildTimer.isActive()) _buildTimer.start();
+}
+
+void KanjiPositionsIndex::build()
+{
+	if (!_dirty) return;
+	_dirty = false;
+	_positions.clear();
+	_kanjis.clear();
+	_anchors.clear();
+
+	for (QTextBlock block = _document->begin(); block.isValid(); block = block.next()) {
+		for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+			QTextFragment fragment(it.fragment());
+			if (!fragment.isValid()) continue;
+			if (fragment.charFormat().isAnchor()) {
+				// Merge with the previous link if they are contiguous
+				if (!_anchors.isEmpty() && _anchors.last() == fragment.position()) _anchors.last() = fragment.position() + fragment.length();
+				else _anchors << fragment.position() << fragment.position() + fragment.length();
+				continue;
+			}
+			const QString text(fragment.text());
+			for (int i = 0; i < text.size(); i++) {
+				uint c = TextTools::singleCharToUnicode(text, i);
+				if (TextTools::isKanjiChar(c)) {
+					_positions << fragment.position() + i;
+					_kanjis << c;
+				}
+				if (text[i].isHighSurrogate()) i++;
+			}
+		}
+	}
+
+	// Forget the entries of the kanjis that are gone and prefetch the new ones
+	_present = QSet<uint>::fromList(_kanjis.toList());
+	QHash<uint, ConstKanjidic2EntryPointer>::iterator it(_entries.begin());
+	while (it != _entries.end()) {
+		if (!_present.contains(it.key())) it = _entries.erase(it);
+		else ++it;
+	}
+	foreach (uint kanji, _present) {
+		if (_entries.contains(kanji) || _pending.contains(kanji)) continue;
+		_pending << kanji;
+		KanjiEntryRef(kanji).getAsync(this, SLOT(onLoaded(EntryRef, EntryPointer)));
+	}
+}
+
+void KanjiPositionsIndex::onLoaded(EntryRef ref, EntryPointer entry)
+{
+	_pending.remove(ref.id());
+	// Kanji may have left the document in the meantime
+	if (!_present.contains(ref.id())) return;
+	_entries[ref.id()] = entry.staticCast<const Kanjidic2Entry>();
+}
+
+uint KanjiPositionsIndex::kanjiAt(int pos)
+{
+	build();
+	QVector<int>::const_iterator it(qBinaryFind(_positions.constBegin(), _positions.constEnd(), pos));
+	if (it == _positions.constEnd()) return 0;
+	return _kanjis[it - _positions.constBegin()];
+}
+
+bool KanjiPositionsIndex::isAnchor(int pos)
+{
+	build();
+	// Positions inside a link follow an odd number of boundaries
+	return (qUpperBound(_anchors.constBegin(), _anchors.constEnd(), pos) - _anchors.constBegin()) % 2 == 1;
+}
+
+ConstKanjidic2EntryPointer KanjiPositionsIndex::entry(uint kanji)
+{
+	QHash<uint, ConstKanjidic2EntryPointer>::const_iterator it(_entries.constFind(kanji));
+	if (it != _entries.constEnd()) return it.value();
+	ConstKanjidic2EntryPointer ret(KanjiEntryRef(kanji).get());
+	_entries[kanji] = ret;
+	return ret;
+}
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_KANJIDIC2_KANJI_POSITIONS_INDEX_H
+#define __GUI_KANJIDIC2_KANJI_POSITIONS_INDEX_H
+
+#include "core/kanjidic2/Kanjidic2Entry.h"
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
+class QTextDocument;
+
+/**
+ * Index of the kanji characters and links of a document, used to find
+ * what lies under the mouse cursor of a detailed view without walking the
+ * document at each mouse move.
+ *
+ * The index is built once every time the contents of the document change,
+ * and the entries of the kanjis it finds are loaded in the background so
+ * they are ready when the user hovers them.
+ */
+class KanjiPositionsIndex : public QObject
+{
+	Q_OBJECT
+private:
+	QTextDocument *_document;
+	/// Sorted positions of the kanjis of the document, and their code points
+	QVector<int> _positions;
+	QVector<uint> _kanjis;
+	QSet<uint> _present;
+	/// Start and end positions of the links of the document, alternated
+	QVector<int> _anchors;
+	QHash<uint, ConstKanjidic2EntryPointer> _entries;
+	QSet<uint> _pending;
+	bool _dirty;
+	QTimer _buildTimer;
+
+	KanjiPositionsIndex(QTextDocument *document);
+
+private slots:
+	void onContentsChanged();
+	void onLoaded(EntryRef ref, EntryPointer entry);
+	/// Indexes the document again if its contents changed
+	void build();
+
+public:
+	/**
+	 * Returns the index of document, creating it if needed. The index
+	 * belongs to the document.
+	 */
+	static KanjiPositionsIndex *forDocument(QTextDocument *document);
+
+	/// Returns the code point of the kanji at position pos, or 0
+	uint kanjiAt(int pos);
+	/// Returns true if the character at position pos is part of a link
+	bool isAnchor(int pos);
+	/**
+	 * Returns the entry of kanji, which is loaded on the spot if it has
+	 * not been prefetched yet. Returns null for kanjis that are not in
+	 * the database.
+	 */
+	ConstKanjidic2EntryPointer entry(uint kanji);
+};
+
+#endif
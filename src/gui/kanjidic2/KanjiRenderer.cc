@@ -16,132 +16,190 @@
  */
 
 #include "KanjiRenderer.h"
+#include "core/kanjidic2/KanjiStrokePath.h"
 
 #include <QDebug>
 
 #include <QPainter>
 #include <QPainterPathStroker>
+#include <QPixmapCache>
 
-KanjiRenderer::Stroke::Stroke()
+KanjiRenderer::Stroke::Stroke() : _stroke(0), _length(-1.0)
 {
 }
 
-KanjiRenderer::Stroke::Stroke(const KanjiStroke *const stroke) : _stroke(stroke), _painterPath(pathFromSVG(stroke->path()))
+KanjiRenderer::Stroke::Stroke(const KanjiStroke *const stroke) : _stroke(stroke), _painterPath(pathFromCommands(stroke->path())), _length(-1.0)
 {
 }
 
-QPainterPath KanjiRenderer::Stroke::pathFromSVG(QString svgPath)
+KanjiRenderer::Stroke::Stroke(const KanjiStroke *const stroke, const QPainterPath &painterPath) : _stroke(stroke), _painterPath(painterPath), _length(-1.0)
+{
+}
+
+/// Scale at which strokes are flattened, so their polylines stay smooth
+/// when drawn at large sizes
+#define FLATTEN_SCALE 10.0
+
+void KanjiRenderer::Stroke::flatten() const
+{
+	_polylines.clear();
+	_distances.clear();
+	_length = 0.0;
+	QTransform toFlatten(QTransform::fromScale(FLATTEN_SCALE, FLATTEN_SCALE));
+	QTransform fromFlatten(QTransform::fromScale(1.0 / FLATTEN_SCALE, 1.0 / FLATTEN_SCALE));
+	foreach (const QPolygonF &polygon, _painterPath.toSubpathPolygons(toFlatten)) {
+		QPolygonF polyline(fromFlatten.map(polygon));
+		if (polyline.isEmpty()) continue;
+		QVector<qreal> distances;
+		distances.reserve(polyline.size());
+		distances << _length;
+		for (int i = 1; i < polyline.size(); i++) {
+			_length += QLineF(polyline[i - 1], polyline[i]).length();
+			distances << _length;
+		}
+		_polylines << polyline;
+		_distances << distances;
+	}
+}
+
+QPainterPath KanjiRenderer::Stroke::pathFromCommands(const QByteArray &commands)
 {
-	enum SVGPathCommand { None = 0, Movepath, movepath, Closepath, Lineto, lineto, HLineto, Hlineto, VLineto, vLineto, Curveto, curveto, sCurveto, scurveto, Ellipse };
 	QPainterPath retPath;
 	retPath.setFillRule(Qt::WindingFill);
 
-	// Process the string - add spaces between unseparated tokens
-	int idx;
-	while ((idx = svgPath.indexOf(QRegExp("[a-zA-Z]\\d|\\d[a-zA-Z]|\\w-"))) != -1) svgPath.insert(idx + 1, ' ');
-
-	QStringList tokens = svgPath.split(QRegExp(" +|,"), QString::SkipEmptyParts);
-
-	SVGPathCommand curAction = None;
-	QPointF dest;
-	QPointF p1;
-	QPointF p2;
-	QPointF lastControl;
-	for (int tokenPos = 0; tokenPos < tokens.count(); tokenPos++) {
-		// Check if a new action is available
-		bool gotCommand = true;
-		do {
-			QString token = tokens[tokenPos];
-			if (token == "M") curAction = Movepath;
-			else if (token == "m") curAction = movepath;
-			else if (token == "L") curAction = Lineto;
-			else if (token == "l") curAction = lineto;
-			else if (token == "C") curAction = Curveto;
-			else if (token == "c") curAction = curveto;
-			else if (token == "S") curAction = sCurveto;
-			else if (token == "s") curAction = scurveto;
-			else if (token == "z" || token == "Z") curAction = Closepath;
-			else gotCommand = false;
-			if (gotCommand) { tokenPos++; if (tokenPos >= tokens.count()) break; }
-		} while (gotCommand);
-		// Now execute the action
-		switch (curAction) {
-			case None:
-				qWarning("Invalid kanji drawing path!");
+	int pos = 0;
+	KanjiStrokePath::Command command;
+	QPointF points[3];
+	while (KanjiStrokePath::read(commands, pos, command, points)) {
+		switch (command) {
+			case KanjiStrokePath::MoveTo:
+				retPath.moveTo(points[0]);
 				break;
-			case Movepath:
-			case movepath:
-				dest = QPointF(tokens[tokenPos].toFloat(), tokens[tokenPos + 1].toFloat());
-				if (curAction == movepath) dest += retPath.currentPosition();
-				retPath.moveTo(dest);
-				tokenPos++;
-				lastControl = retPath.currentPosition();
+			case KanjiStrokePath::LineTo:
+				retPath.lineTo(points[0]);
 				break;
-			case Lineto:
-			case lineto:
-				dest = QPointF(tokens[tokenPos].toFloat(), tokens[tokenPos + 1].toFloat());
-				if (curAction == lineto) dest += retPath.currentPosition();
-				retPath.lineTo(dest);
-				tokenPos++;
-				lastControl = retPath.currentPosition();
+			case KanjiStrokePath::CubicTo:
+				retPath.cubicTo(points[0], points[1], points[2]);
 				break;
-			case Curveto:
-			case curveto:
-				p1 = QPointF(tokens[tokenPos].toFloat(), tokens[tokenPos + 1].toFloat());
-				p2 = QPointF(tokens[tokenPos + 2].toFloat(), tokens[tokenPos + 3].toFloat());
-				dest = QPointF(tokens[tokenPos + 4].toFloat(), tokens[tokenPos + 5].toFloat());
-				if (curAction == curveto) {
-					p1 += retPath.currentPosition();
-					p2 += retPath.currentPosition();
-					dest += retPath.currentPosition();
-				}
-				retPath.cubicTo(p1, p2, dest);
-				tokenPos += 5;
-				lastControl = p2;
-				break;
-			case sCurveto:
-			case scurveto:
-				p1 = retPath.currentPosition() * 2 - lastControl;
-				p2 = QPointF(tokens[tokenPos].toFloat(), tokens[tokenPos + 1].toFloat());
-				dest = QPointF(tokens[tokenPos + 2].toFloat(), tokens[tokenPos + 3].toFloat());
-				if (curAction == scurveto) {
-					p2 += retPath.currentPosition();
-					dest += retPath.currentPosition();
-				}
-				retPath.cubicTo(p1, p2, dest);
-				tokenPos += 3;
-				lastControl = p2;
-				break;
-			case Closepath:
+			case KanjiStrokePath::Close:
 				retPath.closeSubpath();
-				lastControl = retPath.currentPosition();
-				break;
-			default:
-				qWarning("Unknown command while drawing kanji path!");
-				lastControl = retPath.currentPosition();
 				break;
 		}
 	}
+	if (pos != commands.size()) qWarning("Invalid kanji drawing path!");
 	return retPath;
 }
 
-void KanjiRenderer::Stroke::render(QPainter *painter, qreal dLength, qreal startFrom) const
+void KanjiRenderer::Stroke::render(QPainter *painter, qreal dLength) const
 {
-	if (dLength < 0.0 || dLength >= length()) painter->drawPath(painterPath());
-	else {
-		painter->save();
-		// We must divide by the width of the pen because
-		// the dash painting works with pen units.
-		QPen pen(painter->pen());
-		QVector<qreal> dashes;
-		dashes << 0.0 << startFrom << dLength / pen.width() << length();
-		pen.setDashPattern(dashes);
-		painter->setPen(pen);
+	if (dLength < 0.0 || dLength >= length()) {
 		painter->drawPath(painterPath());
-		painter->restore();
+		return;
+	}
+	// Only draw the points of the flattened path up to the requested
+	// length, the last one being interpolated
+	for (int i = 0; i < _polylines.size(); i++) {
+		const QPolygonF &polyline(_polylines[i]);
+		const QVector<qreal> &distances(_distances[i]);
+		if (distances.first() >= dLength) break;
+		int end = qUpperBound(distances.constBegin(), distances.constEnd(), dLength) - distances.constBegin();
+		if (end >= polyline.size()) {
+			painter->drawPolyline(polyline);
+			continue;
+		}
+		QPolygonF partial(polyline.mid(0, end));
+		QLineF last(polyline[end - 1], polyline[end]);
+		partial << last.pointAt((dLength - distances[end - 1]) / (distances[end] - distances[end - 1]));
+		painter->drawPolyline(partial);
+		break;
 	}
 }
 
+QCache<const KanjiGraph *, KanjiRenderer::ParsedGraph> KanjiRenderer::_parsedGraphs(100);
+QCache<QString, QPicture> KanjiRenderer::_pictures(4096);
+QMutex KanjiRenderer::_cachesMutex;
+
+QString KanjiRenderer::RenderStyle::key() const
+{
+	return QString("%1:%2:%3:%4:%5:%6:%7").arg(flags).arg(strokesColor.rgba()).arg(strokesWidth).arg(capStyle).arg(gridColor.rgba()).arg(gridWidth).arg(strokesNumbersSize);
+}
+
+void KanjiRenderer::render(const ConstKanjidic2EntryPointer &kanji, const RenderStyle &style, QPainter *painter)
+{
+	KanjiRenderer renderer(kanji);
+	painter->setRenderHint(QPainter::Antialiasing);
+	if (style.flags & RenderStyle::Grid) {
+		QPen pen;
+		pen.setWidth(style.gridWidth);
+		pen.setColor(style.gridColor);
+		painter->setPen(pen);
+		renderer.renderGrid(painter);
+	}
+	if (style.flags & RenderStyle::Strokes) {
+		QPen pen(style.strokesColor);
+		pen.setWidth(style.strokesWidth);
+		pen.setCapStyle(style.capStyle);
+		painter->setPen(pen);
+		painter->setBrush(QBrush());
+		renderer.renderStrokes(painter);
+	}
+	if (style.flags & RenderStyle::StrokesNumbers) {
+		foreach (const KanjiStroke &stroke, kanji->strokes()) {
+			renderer.renderStrokeNumber(stroke, painter, style.strokesNumbersSize);
+		}
+	}
+}
+
+qint64 KanjiRenderer::cacheMemory()
+{
+	QMutexLocker lock(&_cachesMutex);
+	return _pictures.totalCost() * Q_INT64_C(1024);
+}
+
+void KanjiRenderer::clearCaches()
+{
+	QMutexLocker lock(&_cachesMutex);
+	_pictures.clear();
+	_parsedGraphs.clear();
+}
+
+QPicture KanjiRenderer::picture(const ConstKanjidic2EntryPointer &kanji, const RenderStyle &style)
+{
+	QString key(QString("%1:%2").arg(kanji->id()).arg(style.key()));
+	{
+		QMutexLocker lock(&_cachesMutex);
+		QPicture *picture = _pictures.object(key);
+		if (picture) return *picture;
+	}
+
+	// Render outside of the lock, at worst two threads render the same kanji
+	QPicture *picture = new QPicture();
+	QPainter painter(picture);
+	render(kanji, style, &painter);
+	painter.end();
+	QPicture ret(*picture);
+	QMutexLocker lock(&_cachesMutex);
+	_pictures.insert(key, picture, qMax(1u, picture->size() / 1024));
+	return ret;
+}
+
+QPixmap KanjiRenderer::pixmap(const ConstKanjidic2EntryPointer &kanji, int size, qreal ratio, const RenderStyle &style)
+{
+	QString key(QString("kanji:%1:%2:%3:%4").arg(kanji->id()).arg(size).arg(ratio).arg(style.key()));
+	QPixmap ret;
+	if (QPixmapCache::find(key, &ret)) return ret;
+
+	ret = QPixmap(QSize(size, size) * ratio);
+	ret.setDevicePixelRatio(ratio);
+	ret.fill(Qt::transparent);
+	QPainter painter(&ret);
+	painter.scale(size / KANJI_AREA_WIDTH, size / KANJI_AREA_HEIGHT);
+	render(kanji, style, &painter);
+	painter.end();
+	QPixmapCache::insert(key, ret);
+	return ret;
+}
+
 KanjiRenderer::KanjiRenderer() : _kanji(0)
 {
 }
@@ -155,10 +213,25 @@ void KanjiRenderer::setKanji(ConstKanjidic2EntryPointer kanji)
 {
 	_kanji = kanji;
 	_strokes.clear();
-	const QList<KanjiStroke> &strokes(kanji->strokes());
-	foreach (const KanjiStroke &stroke, strokes) {
-		_strokes << Stroke(&stroke);
-		_strokesMap.insert(&stroke, &_strokes.last());
+	_strokesMap.clear();
+	const ConstKanjiGraphPointer &graph(kanji->graph());
+	const QList<KanjiStroke> &strokes(graph->strokes());
+	QList<QPainterPath> paths;
+	{
+		QMutexLocker lock(&_cachesMutex);
+		ParsedGraph *parsed = _parsedGraphs.object(graph.data());
+		if (!parsed) {
+			parsed = new ParsedGraph();
+			parsed->graph = graph;
+			foreach (const KanjiStroke &stroke, strokes) parsed->paths << Stroke::pathFromCommands(stroke.path());
+			_parsedGraphs.insert(graph.data(), parsed);
+		}
+		// The cache may drop the parsed graph once the lock is released
+		paths = parsed->paths;
+	}
+	for (int i = 0; i < strokes.size(); i++) {
+		_strokes << Stroke(&strokes[i], paths[i]);
+		_strokesMap.insert(&strokes[i], &_strokes.last());
 	}
 	// Center the character horizontally if we are treating a kana
 #if QT_VERSION >= 0x040600
@@ -21,9 +21,13 @@
 #include <QWidget>
 #include <QList>
 #include <QPainterPath>
+#include <QPolygonF>
+#include <QVector>
 #include <QPicture>
 #include <QPainter>
 #include <QMap>
+#include <QCache>
+#include <QMutex>
 
 #include "core/kanjidic2/Kanjidic2Entry.h"
 #include "core/EntriesCache.h"
@@ -44,21 +48,34 @@ public:
 	private:
 		const KanjiStroke *_stroke;
 		QPainterPath _painterPath;
-
-		QPainterPath pathFromSVG(QString svgPath);
+		/**
+		 * Path of the stroke flattened into polylines, along with the
+		 * distance from the start of the stroke to each of their points.
+		 * Built on first use, so partial strokes can be drawn without
+		 * stroking the whole path with a dash pattern.
+		 */
+		mutable QList<QPolygonF> _polylines;
+		mutable QList<QVector<qreal> > _distances;
+		mutable qreal _length;
+		void flatten() const;
 
 	public:
+		/// Builds the painter path of a compiled stroke path
+		static QPainterPath pathFromCommands(const QByteArray &commands);
+
 		Stroke();
 		Stroke(const KanjiStroke *const stroke);
+		Stroke(const KanjiStroke *const stroke, const QPainterPath &painterPath);
 		const KanjiStroke *stroke() const { return _stroke; }
 		const QPainterPath &painterPath() const { return _painterPath; }
-		qreal length() const { return _painterPath.length(); }
+		/// Length of the flattened path of the stroke
+		qreal length() const { if (_length < 0.0) flatten(); return _length; }
 
 		/**
-		 * Render a part of the stroke (if length >= 0) or the complete
-		 * stroke (if length < 0).
+		 * Render the first length units of the stroke (if length >= 0) or
+		 * the complete stroke (if length < 0).
 		 */
-		void render(QPainter *painter, qreal length = -1.0, qreal startFrom = 0.0) const;
+		void render(QPainter *painter, qreal length = -1.0) const;
 		
 		bool operator ==(const Stroke &s) { return this == &s; }
 
@@ -73,7 +90,65 @@ private:
 	// Associates the kanji strokes with their path
 	QMap<const KanjiStroke *, Stroke *> _strokesMap;
 
+	/**
+	 * Painter paths of the strokes of a graph, in the same order as its
+	 * strokes. Graphs never change, so the paths of the last rendered kanjis
+	 * are kept to avoid building them again every time a kanji is displayed.
+	 * The graph is referenced so its address is not reused while cached.
+	 * Renderers can be used from several threads when printing, so this
+	 * cache is protected by _cachesMutex.
+	 */
+	struct ParsedGraph {
+		ConstKanjiGraphPointer graph;
+		QList<QPainterPath> paths;
+	};
+	static QCache<const KanjiGraph *, ParsedGraph> _parsedGraphs;
+
 public:
+	/**
+	 * How a whole kanji is drawn by picture() and pixmap(). The key of the
+	 * style identifies the renderings in the caches.
+	 */
+	struct RenderStyle {
+		enum Flag { Grid = 1, Strokes = 2, StrokesNumbers = 4 };
+		int flags;
+		QColor strokesColor;
+		int strokesWidth;
+		Qt::PenCapStyle capStyle;
+		QColor gridColor;
+		int gridWidth;
+		int strokesNumbersSize;
+
+		RenderStyle() : flags(Strokes), strokesColor(Qt::black), strokesWidth(5), capStyle(Qt::SquareCap), gridColor(Qt::gray), gridWidth(2), strokesNumbersSize(4) {}
+		QString key() const;
+	};
+
+private:
+	/// Renders kanji with style in the kanji area coordinates
+	static void render(const ConstKanjidic2EntryPointer &kanji, const RenderStyle &style, QPainter *painter);
+	/// Recorded renderings, which cost is their size in kilobytes
+	static QCache<QString, QPicture> _pictures;
+	/// Protects _parsedGraphs and _pictures
+	static QMutex _cachesMutex;
+
+public:
+	/**
+	 * Returns a rendering of kanji in the kanji area coordinates, suitable
+	 * for any device including printers. Renderings are kept in a cache
+	 * shared by the whole program, within a memory budget.
+	 */
+	static QPicture picture(const ConstKanjidic2EntryPointer &kanji, const RenderStyle &style = RenderStyle());
+	/**
+	 * Returns a rendering of kanji in a square pixmap of the given size,
+	 * for screens with the given device pixel ratio. Pixmaps are kept in
+	 * the QPixmapCache, and thus can only be used from the GUI thread.
+	 */
+	static QPixmap pixmap(const ConstKanjidic2EntryPointer &kanji, int size, qreal ratio, const RenderStyle &style = RenderStyle());
+	/// Approximate memory used by the cached renderings, in bytes
+	static qint64 cacheMemory();
+	/// Drops the cached parsed graphs and renderings
+	static void clearCaches();
+
 	KanjiRenderer();
 	KanjiRenderer(ConstKanjidic2EntryPointer kanji);
 	void setKanji(ConstKanjidic2EntryPointer kanji);
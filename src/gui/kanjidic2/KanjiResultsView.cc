@@ -26,22 +26,44 @@
 #include <QGraphicsSimpleTextItem>
 #include <QToolTip>
 #include <QGuiApplication>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QtMath>
 
 #define KANJI_SIZE 50
 #define PADDING 5
+/// Number of screens of items rendered into the atlas on each side of the
+/// visible ones
+#define ATLAS_AHEAD 2
+/// Number of cells per row of the atlas
+#define ATLAS_COLUMNS 32
 
 class QGraphicsSceneHoverEvent;
 
 class KanjiGraphicsItem : public QGraphicsSimpleTextItem
 {
+private:
+	const KanjiResultsView *_view;
+
 public:
-	KanjiGraphicsItem(const QString &chr, QGraphicsItem *parent) : QGraphicsSimpleTextItem(chr, parent)
+	KanjiGraphicsItem(const QString &chr, const KanjiResultsView *view, QGraphicsItem *parent) : QGraphicsSimpleTextItem(chr, parent), _view(view)
 	{
 		setAcceptHoverEvents(true);
 	}
 
 	virtual ~KanjiGraphicsItem() {}
 
+	virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+	{
+		// The selection frame is only drawn by the default implementation
+		if ((option->state & QStyle::State_Selected) || !_view->drawFromAtlas(painter, text(), boundingRect()))
+			QGraphicsSimpleTextItem::paint(painter, option, widget);
+	}
+
 protected:
 	virtual void hoverEnterEvent(QGraphicsSceneHoverEvent *event)
 	{
@@ -54,7 +76,77 @@ protected:
 	}
 };
 
-KanjiResultsView::KanjiResultsView(QWidget *parent) : QGraphicsView(parent), _scene()
+/// State shared between a view and its atlas rendering jobs
+struct KanjiAtlasRequest
+{
+	QMutex mutex;
+	/// Incremented every time a new atlas is requested
+	int ticket;
+	/// Null once the view is destroyed
+	KanjiResultsView *view;
+	/// Ticket the rendered atlas is for, -1 if none
+	int resultTicket;
+	QImage image;
+	QHash<QString, QRect> cells;
+
+	KanjiAtlasRequest(KanjiResultsView *v) : ticket(0), view(v), resultTicket(-1) {}
+};
+
+/**
+ * Renders a list of kanji into a single image, one cell per kanji, the
+ * way QGraphicsSimpleTextItem would draw them.
+ */
+class KanjiAtlasJob : public QRunnable
+{
+private:
+	QSharedPointer<KanjiAtlasRequest> _request;
+	int _ticket;
+	QStringList _kanji;
+	QFont _font;
+	QColor _color;
+	QSize _cellSize;
+	qreal _ratio;
+
+public:
+	KanjiAtlasJob(const QSharedPointer<KanjiAtlasRequest> &request, int ticket, const QStringList &kanji, const QFont &font, const QColor &color, const QSize &cellSize, qreal ratio) : _request(request), _ticket(ticket), _kanji(kanji), _font(font), _color(color), _cellSize(cellSize), _ratio(ratio) {}
+
+	virtual void run()
+	{
+		{
+			QMutexLocker lock(&_request->mutex);
+			if (_request->ticket != _ticket || !_request->view) return;
+		}
+
+		// Cells are in device pixels so the atlas can be copied as is
+		QSize cell(qCeil(_cellSize.width() * _ratio), qCeil(_cellSize.height() * _ratio));
+		int columns = qMin(_kanji.size(), ATLAS_COLUMNS);
+		int rows = (_kanji.size() + columns - 1) / columns;
+		QImage image(columns * cell.width(), rows * cell.height(), QImage::Format_ARGB32_Premultiplied);
+		image.fill(Qt::transparent);
+		QHash<QString, QRect> cells;
+		QPainter painter(&image);
+		painter.setRenderHint(QPainter::TextAntialiasing);
+		painter.setPen(_color);
+		painter.setFont(_font);
+		painter.scale(_ratio, _ratio);
+		int ascent = QFontMetrics(_font).ascent();
+		for (int i = 0; i < _kanji.size(); i++) {
+			QRect rect(QPoint((i % columns) * cell.width(), (i / columns) * cell.height()), cell);
+			painter.drawText(QPointF(rect.left() / _ratio, rect.top() / _ratio + ascent), _kanji[i]);
+			cells[_kanji[i]] = rect;
+		}
+		painter.end();
+
+		QMutexLocker lock(&_request->mutex);
+		if (_request->ticket != _ticket || !_request->view) return;
+		_request->resultTicket = _ticket;
+		_request->image = image;
+		_request->cells = cells;
+		QMetaObject::invokeMethod(_request->view, "onAtlasRendered", Qt::QueuedConnection);
+	}
+};
+
+KanjiResultsView::KanjiResultsView(QWidget *parent) : QGraphicsView(parent), _scene(), _atlasFirst(-1), _atlasLast(-1), _atlasRequest(new KanjiAtlasRequest(this))
 {
 	kanjiFont.setPixelSize(KANJI_SIZE);
 	setScene(&_scene);
@@ -67,6 +159,15 @@ KanjiResultsView::KanjiResultsView(QWidget *parent) : QGraphicsView(parent), _sc
 	_smoothScroller.setScrollBar(horizontalScrollBar());
 
 	connect(&_scene, SIGNAL(selectionChanged()), this, SLOT(onSelectionChanged()));
+	connect(horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateAtlas()));
+}
+
+KanjiResultsView::~KanjiResultsView()
+{
+	// Running jobs will drop their atlas
+	QMutexLocker lock(&_atlasRequest->mutex);
+	_atlasRequest->view = 0;
+	++_atlasRequest->ticket;
 }
 
 QSize KanjiResultsView::sizeHint() const
@@ -93,7 +194,7 @@ void KanjiResultsView::startReceive()
 
 void KanjiResultsView::addItem(const QString &kanji)
 {
-	QGraphicsSimpleTextItem *item = new KanjiGraphicsItem(kanji, 0);
+	QGraphicsSimpleTextItem *item = new KanjiGraphicsItem(kanji, this, 0);
 	item->setFont(kanjiFont);
 	item->setBrush(QGuiApplication::palette().brush(QPalette::ColorRole::WindowText));
 	_scene.addItem(item);
@@ -107,10 +208,18 @@ void KanjiResultsView::endReceive()
 	_scene.setSceneRect(_scene.itemsBoundingRect());
 	setSceneRect(_scene.itemsBoundingRect());
 	if (!items.isEmpty()) centerOn(0.0, ITEM_CENTER(items[0]).y());
+	updateAtlas();
 }
 
 void KanjiResultsView::clear()
 {
+	{
+		QMutexLocker lock(&_atlasRequest->mutex);
+		++_atlasRequest->ticket;
+	}
+	_atlas = QImage();
+	_atlasCells.clear();
+	_atlasFirst = _atlasLast = -1;
 	_scene.clear();
 	items.clear();
 	// Used to reset the scrollbar
@@ -121,3 +230,57 @@ void KanjiResultsView::wheelEvent(QWheelEvent *event)
 {
 	QCoreApplication::sendEvent(horizontalScrollBar(), event);
 }
+
+void KanjiResultsView::resizeEvent(QResizeEvent *event)
+{
+	QGraphicsView::resizeEvent(event);
+	updateAtlas();
+}
+
+void KanjiResultsView::updateAtlas()
+{
+	if (items.isEmpty()) return;
+
+	QRectF visible(mapToScene(viewport()->rect()).boundingRect());
+	int step = KANJI_SIZE + PADDING;
+	int first = qBound(0, int((visible.left() - ITEM_POSITION(0)) / step), items.size() - 1);
+	int last = qBound(first, int((visible.right() - ITEM_POSITION(0)) / step), items.size() - 1);
+	// Already rendered or being rendered
+	if (_atlasFirst != -1 && first >= _atlasFirst && last <= _atlasLast) return;
+
+	int ahead = (last - first + 1) * ATLAS_AHEAD;
+	_atlasFirst = qMax(0, first - ahead);
+	_atlasLast = qMin(items.size() - 1, last + ahead);
+	QStringList kanji;
+	for (int i = _atlasFirst; i <= _atlasLast; i++) kanji << items[i]->text();
+
+	int ticket;
+	{
+		QMutexLocker lock(&_atlasRequest->mutex);
+		ticket = ++_atlasRequest->ticket;
+	}
+	QSize cellSize(items[0]->boundingRect().size().toSize() + QSize(1, 1));
+	QColor color(QGuiApplication::palette().color(QPalette::WindowText));
+	QThreadPool::globalInstance()->start(new KanjiAtlasJob(_atlasRequest, ticket, kanji, kanjiFont, color, cellSize, devicePixelRatioF()));
+}
+
+void KanjiResultsView::onAtlasRendered()
+{
+	QMutexLocker lock(&_atlasRequest->mutex);
+	if (_atlasRequest->resultTicket != _atlasRequest->ticket) return;
+	_atlas = _atlasRequest->image;
+	_atlasCells = _atlasRequest->cells;
+	_atlasRequest->resultTicket = -1;
+	_atlasRequest->image = QImage();
+	_atlasRequest->cells.clear();
+	lock.unlock();
+	viewport()->update();
+}
+
+bool KanjiResultsView::drawFromAtlas(QPainter *painter, const QString &kanji, const QRectF &rect) const
+{
+	QHash<QString, QRect>::const_iterator it(_atlasCells.constFind(kanji));
+	if (it == _atlasCells.constEnd()) return false;
+	painter->drawImage(QRectF(rect.topLeft(), QSizeF(it->size()) / devicePixelRatioF()), _atlas, *it);
+	return true;
+}
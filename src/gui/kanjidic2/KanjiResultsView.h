@@ -23,8 +23,12 @@
 #include <QGraphicsView>
 #include <QGraphicsScene>
 #include <QWheelEvent>
+#include <QImage>
+#include <QHash>
+#include <QSharedPointer>
 
 class QGraphicsSimpleTextItem;
+struct KanjiAtlasRequest;
 
 /**
  * A horizontally-scrollable results view designed to display kanji
@@ -38,17 +42,41 @@ private:
 	QList<QGraphicsSimpleTextItem *> items;
 	ScrollBarSmoothScroller _smoothScroller;
 	QFont kanjiFont;
+	/// Glyphs of the visible and nearly visible kanji, rendered together
+	/// in the background so scrolling only has to copy them
+	QImage _atlas;
+	/// Position of each kanji in the atlas, in pixels of the atlas
+	QHash<QString, QRect> _atlasCells;
+	/// Range of items the atlas has last been requested for
+	int _atlasFirst, _atlasLast;
+	/// Shared with the rendering jobs, which may outlive us
+	QSharedPointer<KanjiAtlasRequest> _atlasRequest;
+
+private slots:
+	/// Requests a new atlas if the visible items are not in the current one
+	void updateAtlas();
+	void onAtlasRendered();
 
 protected slots:
 	void onSelectionChanged();
 	void wheelEvent(QWheelEvent *event);
 
+protected:
+	virtual void resizeEvent(QResizeEvent *event);
+
 public:
 	KanjiResultsView(QWidget *parent = 0);
+	virtual ~KanjiResultsView();
 	virtual QSize sizeHint() const;
 	void clear();
 	QGraphicsScene *scene() { return &_scene; }
 
+	/**
+	 * Draws kanji into rect from the atlas. Returns false if it is not
+	 * in the atlas, in which case the caller must draw it by itself.
+	 */
+	bool drawFromAtlas(QPainter *painter, const QString &kanji, const QRectF &rect) const;
+
 public slots:
 	void addItem(const QString &kanji);
 	void startReceive();
@@ -17,10 +17,8 @@
 
 #include <QtDebug>
 
-#include "sqlite/Query.h"
 #include "core/TextTools.h"
 #include "core/kanjidic2/KanjiRadicals.h"
-#include "core/Database.h"
 #include "core/kanjidic2/Kanjidic2Entry.h"
 #include "gui/KanjiValidator.h"
 #include "gui/kanjidic2/KanjiSelector.h"
@@ -32,6 +30,8 @@
 #include <QDesktopWidget>
 #include <QGuiApplication>
 
+#include <algorithm>
+
 ComplementsList::ComplementsList(QWidget *parent) : QListWidget(parent), baseFont(font()), labelFont(baseFont), _sscroll(verticalScrollBar())
 {
 	// Setup the fonts and size of the grid
@@ -182,64 +182,50 @@ uint KanjiSelector::complementCode(const QString &repr) const
 	return TextTools::singleCharToUnicode(repr);
 }
 
-QSet<uint> KanjiSelector::getCandidates(const QSet<uint> &selection)
+KanjiSet KanjiSelector::getCandidates(const QSet<uint> &selection)
 {
-	QSet<uint> res;
+	const KanjiComponentIndex &index = KanjiComponentIndex::instance();
 	// Get the new results
 	emit startQuery();
 	QSet<uint> realSel;
 	foreach (uint kanji, selection) realSel << complementCode(TextTools::unicodeToSingleChar(kanji));
-	QString resQuery(getCandidatesQuery(realSel));
-	if (!resQuery.isEmpty()) {
-		SQLite::Query query(Database::connection());
-		if (!query.exec(resQuery)) qDebug() << query.lastError().message();
-		while (query.next()) {
-			int ch(query.valueInt(0));
-			res << ch;
-			QString c(TextTools::unicodeToSingleChar(ch));
-			emit foundResult(c);
-		}
-	}
+	KanjiSet res(getCandidatesSet(realSel));
+	foreach (int rank, res.ranks()) emit foundResult(TextTools::unicodeToSingleChar(index.kanji(rank)));
 	emit endQuery();
 	return res;
 }
 
-void KanjiSelector::updateComplementsList(const QSet<uint> &selection, const QSet<uint> &candidates)
+void KanjiSelector::updateComplementsList(const QSet<uint> &selection, const KanjiSet &candidates)
 {
+	const KanjiComponentIndex &index = KanjiComponentIndex::instance();
 	_complementsList->blockSignals(true);
 	_complementsList->clear();
 	_currentComplements = QSet<QPair<uint, QString> >();
-	QString compQuery(getComplementsQuery(selection, candidates));
-	if (!compQuery.isEmpty()) {
-		SQLite::Query query(Database::connection());
-		if (!query.exec(compQuery)) qDebug() << query.lastError().message();
-		int curStrokes = 0;
-		uint curKanji = 0;
-		while (query.next()) {
-			uint kanji = query.valueUInt(0);
-			// Do not display the same kanji twice - useful for radical selector
-			if (curKanji == kanji) continue;
-			curKanji = kanji;
-			// Do not display kanji that are already in candidates, excepted if they
-			// are part of the current selection
-			if (candidates.contains(kanji) && !selection.contains(kanji)) continue;
-			int strokeNbr = query.valueUInt(1);
-			if (strokeNbr > curStrokes) {
-				_complementsList->setCurrentStrokeNbr(strokeNbr);
-				curStrokes = strokeNbr;
-			}
-			QString repr(TextTools::unicodeToSingleChar(kanji));
-			QListWidgetItem *item = _complementsList->addComplement(repr, kanji);
-			if (selection.contains(kanji)) item->setSelected(true);
-			_currentComplements << QPair<uint, QString>(kanji, repr);
+	int curStrokes = 0;
+	uint curKanji = 0;
+	foreach (uint kanji, getComplements(selection, candidates)) {
+		// Do not display the same kanji twice - useful for radical selector
+		if (curKanji == kanji) continue;
+		curKanji = kanji;
+		// Do not display kanji that are already in candidates, excepted if they
+		// are part of the current selection
+		if (candidates.contains(index.rank(kanji)) && !selection.contains(kanji)) continue;
+		int strokeNbr = index.strokeCount(kanji);
+		if (strokeNbr > curStrokes) {
+			_complementsList->setCurrentStrokeNbr(strokeNbr);
+			curStrokes = strokeNbr;
 		}
+		QString repr(TextTools::unicodeToSingleChar(kanji));
+		QListWidgetItem *item = _complementsList->addComplement(repr, kanji);
+		if (selection.contains(kanji)) item->setSelected(true);
+		_currentComplements << QPair<uint, QString>(kanji, repr);
 	}
 	_complementsList->blockSignals(false);
 }
 
 void KanjiSelector::setSelection(const QSet<uint> &selection)
 {
-	QSet<uint> candidates(getCandidates(selection));
+	KanjiSet candidates(getCandidates(selection));
 	updateComplementsList(selection, candidates);
 }
 
@@ -281,26 +267,15 @@ QValidator::State KanjiSelectorValidator::validate(QString &input, int &pos) con
 	return QValidator::Acceptable;
 }
 
-QString RadicalKanjiSelector::getCandidatesQuery(const QSet<uint> &selection) const
+KanjiSet RadicalKanjiSelector::getCandidatesSet(const QSet<uint> &selection) const
 {
-	if (selection.isEmpty()) return "";
-	QStringList select;
-	foreach (uint sel, selection) select << QString::number(sel);
-
-	return QString("select r1.kanji from kanjidic2.radicals as r1 join kanjidic2.entries as e on r1.kanji = e.id where r1.number in (%1) and r1.type is not null group by r1.kanji having uniquecount(r1.number) >= %2 order by e.strokeCount, e.frequency, e.id").arg(select.join(", ")).arg(select.size());
+	return KanjiComponentIndex::instance().withRadicals(selection);
 }
 
-QString RadicalKanjiSelector::getComplementsQuery(const QSet<uint> &selection, const QSet<uint> &candidates) const
+QList<uint> RadicalKanjiSelector::getComplements(const QSet<uint> &selection, const KanjiSet &candidates) const
 {
-	if (candidates.isEmpty()) return "select entries.id, strokeCount from kanjidic2.radicalsList join kanjidic2.entries on radicalsList.kanji = entries.id order by strokeCount, number, radicalsList.rowid";
-	else {
-		QString selString;
-		foreach (uint candidate, candidates) {
-			if (selString.isEmpty()) selString = QString::number(candidate);
-			else selString += "," + QString::number(candidate);
-		}
-		return QString("select distinct e.id, strokeCount from kanjidic2.radicals as r join kanjidic2.radicalsList as rl on r.number = rl.number join kanjidic2.entries as e on rl.kanji = e.id where r.kanji in (%1) and r.type is not null order by strokeCount, rl.number, rl.rowid").arg(selString);
-	}
+	// All the radicals are displayed when there are no candidates
+	return KanjiComponentIndex::instance().radicalComplements(candidates);
 }
 
 QString RadicalKanjiSelector::complementRepr(uint kanji) const
@@ -331,64 +306,59 @@ void ComponentKanjiSelector::reset()
 	if (_complementsList->count() == 0) onAssociateChanged();
 }
 
-QString ComponentKanjiSelector::getCandidatesQuery(const QSet<uint> &selection) const
+KanjiSet ComponentKanjiSelector::getCandidatesSet(const QSet<uint> &selection) const
 {
-	if (selection.isEmpty()) return "";
-	QStringList select;
-	foreach (uint sel, selection) select << QString::number(sel);
-
-	return QString("select ks1.kanji from kanjidic2.strokeGroups as ks1 left join kanjidic2.entries as e on ks1.kanji = e.id where (ks1.element in (%1) or ks1.original in (%1)) group by ks1.kanji having uniquecount(CASE WHEN ks1.element IN (%1) THEN ks1.element ELSE NULL END, CASE WHEN ks1.original IN (%1) THEN ks1.original ELSE NULL END) >= %2 order by strokeCount").arg(select.join(", ")).arg(select.size());
+	return KanjiComponentIndex::instance().withComponents(selection);
 }
 
-
-QString ComponentKanjiSelector::getComplementsQuery(const QSet<uint> &selection, const QSet<uint> &candidates) const
+QList<uint> ComponentKanjiSelector::getComplements(const QSet<uint> &selection, const KanjiSet &candidates) const
 {
-	if (selection.isEmpty() && candidates.isEmpty()) return "select distinct kanji, strokeCount from kanjidic2.rootComponents as rc join kanjidic2.entries as e on rc.kanji = e.id order by strokeCount";
+	const KanjiComponentIndex &index = KanjiComponentIndex::instance();
+	if (selection.isEmpty() && candidates.isEmpty()) return index.rootComponents();
 	// Selection but no candidates - just get the selection
 	else if (candidates.isEmpty()) {
-		QString selString;
-		foreach (uint sel, selection) {
-			if (selString.isEmpty()) selString = QString::number(sel);
-			else selString += "," + QString::number(sel);
-		}
-		return QString("select distinct id, strokeCount from kanjidic2.entries where id in (%1)").arg(selString);
-	}
-	else {
-		QString selString;
-		foreach (uint candidate, candidates) {
-			if (selString.isEmpty()) selString = QString::number(candidate);
-			else selString += "," + QString::number(candidate);
-		}
-		return QString("select distinct ks2.element, strokeCount from kanjidic2.strokeGroups as ks join kanjidic2.strokeGroups as ks2 on ks.kanji = ks2.kanji left join kanjidic2.entries as e on ks2.element = e.id where ks.kanji in (%1) order by strokeCount").arg(selString);
+		QList<int> ranks;
+		foreach (uint sel, selection) if (index.rank(sel) != -1) ranks << index.rank(sel);
+		std::sort(ranks.begin(), ranks.end());
+		QList<uint> ret;
+		foreach (int rank, ranks) ret << index.kanji(rank);
+		return ret;
 	}
+	else return index.componentComplements(candidates);
 }
 
-KanjiInputter::KanjiInputter(KanjiSelector *selector, bool useLineEdit, QWidget *parent) : QFrame(parent), _selector(selector)
+KanjiInputter::KanjiInputter(QWidget *parent) : QFrame(parent), _selector(0)
 {
 	QVBoxLayout *layout = new QVBoxLayout(this);
+	_results = new KanjiResultsView(this);
+	layout->addWidget(_results);
+	connect(_results, SIGNAL(kanjiSelected(QString)), this, SIGNAL(kanjiSelected(QString)));
+}
+
+KanjiInputter::KanjiInputter(KanjiSelector *selector, bool useLineEdit, QWidget *parent) : KanjiInputter(parent)
+{
+	_selector = selector;
+	QVBoxLayout *layout = static_cast<QVBoxLayout *>(this->layout());
 	if (useLineEdit) {
 		QLineEdit *associate = new TJLineEdit(this);
 		KanjiValidator *validator = new KanjiValidator(associate);
 		associate->setValidator(validator);
-		layout->addWidget(associate);
+		layout->insertWidget(0, associate);
 		_selector->associateTo(associate);
 		setFocusProxy(associate);
 	}
-	_results = new KanjiResultsView(this);
-	layout->addWidget(_results);
 	_selector->setParent(this);
 	_selector->layout()->setContentsMargins(0, 0, 0, 0);
 	layout->addWidget(_selector);
 	connect(selector, SIGNAL(startQuery()), _results, SLOT(startReceive()));
 	connect(selector, SIGNAL(endQuery()), _results, SLOT(endReceive()));
 	connect(selector, SIGNAL(foundResult(QString)), _results, SLOT(addItem(QString)));
-	connect(_results, SIGNAL(kanjiSelected(QString)), this, SIGNAL(kanjiSelected(QString)));
 	resize(_selector->complementsList()->gridSize().width() * 10 + _selector->complementsList()->verticalScrollBar()->width(), _selector->complementsList()->gridSize().height() * 7 + _results->sizeHint().height());
 }
 
 void KanjiInputter::reset()
 {
-	_selector->reset();
+	if (_selector) _selector->reset();
 	_results->clear();
 }
 
@@ -20,6 +20,7 @@
 
 #include "gui/ScrollBarSmoothScroller.h"
 #include "gui/kanjidic2/KanjiResultsView.h"
+#include "core/kanjidic2/KanjiComponentIndex.h"
 
 #include <QAction>
 #include <QHash>
@@ -83,20 +84,19 @@ protected:
 	virtual QString complementRepr(uint kanji) const;
 	/// Invert method of complementRepr
 	virtual uint complementCode(const QString &repr) const;
-	/// Returns the SQL query that should be run in order to get the results list
-	/// corresponding to the given selection. Results should comprehend a single
-	/// column with the kanji ids.
-	virtual QString getCandidatesQuery(const QSet<uint> &selection) const = 0;
-	/// Returns the SQL query that should be run in order to get the complements list
-	/// corresponding to the given selection
-	virtual QString getComplementsQuery(const QSet<uint> &selection, const QSet<uint> &candidates) const = 0;
+	/// Returns the set of kanji corresponding to the given selection, as given
+	/// by KanjiComponentIndex.
+	virtual KanjiSet getCandidatesSet(const QSet<uint> &selection) const = 0;
+	/// Returns the complements corresponding to the given selection, in the
+	/// order they should be displayed
+	virtual QList<uint> getComplements(const QSet<uint> &selection, const KanjiSet &candidates) const = 0;
 
 	/**
-	 * Returns the list of candidates corresponding to the given selection. Also
+	 * Returns the set of candidates corresponding to the given selection. Also
 	 * emits the startQuery, foundResult and endQuery signals as results are found.
 	 */
-	virtual QSet<uint> getCandidates(const QSet<uint> &selection);
-	virtual void updateComplementsList(const QSet<uint> &selection, const QSet<uint> &candidates);
+	virtual KanjiSet getCandidates(const QSet<uint> &selection);
+	virtual void updateComplementsList(const QSet<uint> &selection, const KanjiSet &candidates);
 	virtual void showEvent (QShowEvent *event);
 
 protected slots:
@@ -153,8 +153,8 @@ class RadicalKanjiSelector : public KanjiSelector
 {
 	Q_OBJECT
 protected:
-	virtual QString getCandidatesQuery(const QSet<uint> &selection) const;
-	virtual QString getComplementsQuery(const QSet<uint> &selection, const QSet<uint> &candidates) const;
+	virtual KanjiSet getCandidatesSet(const QSet<uint> &selection) const;
+	virtual QList<uint> getComplements(const QSet<uint> &selection, const KanjiSet &candidates) const;
 	/// Returns the kanji associated with the given radical code
 	virtual QString complementRepr(uint kanji) const;
 	virtual uint complementCode(const QString &repr) const;
@@ -171,8 +171,8 @@ class ComponentKanjiSelector : public KanjiSelector
 {
 	Q_OBJECT
 protected:
-	virtual QString getCandidatesQuery(const QSet<uint> &selection) const;
-	virtual QString getComplementsQuery(const QSet<uint> &selection, const QSet<uint> &candidates) const;
+	virtual KanjiSet getCandidatesSet(const QSet<uint> &selection) const;
+	virtual QList<uint> getComplements(const QSet<uint> &selection, const KanjiSet &candidates) const;
 
 public:
 	ComponentKanjiSelector(QWidget *parent = 0);
@@ -189,6 +189,14 @@ private:
 	KanjiSelector *_selector;
 	KanjiResultsView *_results;
 
+protected:
+	/**
+	 * Builds an inputter with only the results list, for inputters that
+	 * find their candidates by other means than a kanji selector.
+	 */
+	KanjiInputter(QWidget *parent);
+	KanjiResultsView *results() { return _results; }
+
 public:
 	/**
 	 * Constructor. The inputter takes ownership of the passed selector which
@@ -198,7 +206,7 @@ public:
 	 */
 	KanjiInputter(KanjiSelector *selector, bool useLineEdit = false, QWidget *parent = 0);
 	KanjiSelector *selector() { return _selector; }
-	void reset();
+	virtual void reset();
 
 signals:
 	void kanjiSelected(const QString &kanji);
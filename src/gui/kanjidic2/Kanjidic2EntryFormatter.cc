@@ -23,8 +23,8 @@
 #include "core/Database.h"
 #include "core/jmdict/JMdictEntry.h"
 #include "core/jmdict/JMdictEntrySearcher.h"
-#include "core/jmdict/JMdictPlugin.h"
 #include "gui/kanjidic2/KanjiRenderer.h"
+#include "gui/kanjidic2/StrokeOrderStrips.h"
 #include "gui/jmdict/JMdictEntryFormatter.h"
 #include "gui/kanjidic2/Kanjidic2GUIPlugin.h"
 
@@ -78,6 +78,7 @@ PreferenceItem<bool> Kanjidic2EntryFormatter::printOnlyStudiedVocab("kanjidic",
 PreferenceItem<bool> Kanjidic2EntryFormatter::printStrokesNumbers("kanjidic", "printStrokesNumbers", false);
 PreferenceItem<int> Kanjidic2EntryFormatter::strokesNumbersSize("kanjidic", "strokesNumbersSize", 6);
 PreferenceItem<bool> Kanjidic2EntryFormatter::printGrid("kanjidic", "printStrokesGrid", false);
+PreferenceItem<bool> Kanjidic2EntryFormatter::printStrokeOrder("kanjidic", "printStrokeOrder", false);
 const QMap<QString, const char *> Kanjidic2EntryFormatter::dictTypes = initializeDictTypes();
 
 QMap<QString, const char *> Kanjidic2EntryFormatter::initializeDictTypes()
@@ -91,19 +92,42 @@ QMap<QString, const char *> Kanjidic2EntryFormatter::initializeDictTypes()
 
 QString Kanjidic2EntryFormatter::getQueryUsedInWordsSql(int kanji, int limit, bool onlyStudied)
 {
-	const QString queryUsedInWordsSql("select distinct " QUOTEMACRO(JMDICTENTRY_GLOBALID) ", jmdict.entries.id "
+	// The most relevant words using the kanji are precomputed, see
+	// JMdictDBParser::createKanjiWordsTable(). Each word comes with the
+	// first misc column of its first sense, for the user filter.
+	QStringList ids;
+	SQLite::Query query(Database::threadConnection());
+	query.prepare("select words from jmdict.kanjiWords where kanji = ?");
+	query.bindValue(kanji);
+	if (query.exec() && query.next()) {
+		quint64 misc0Mask = JMdictEntrySearcher::miscFilterMask()[0];
+		QByteArray words(query.valueBlob(0));
+		QVector<quint64> values;
+		quint64 value = 0;
+		int shift = 0;
+		foreach (char c, words) {
+			value |= (quint64)(c & 0x7f) << shift;
+			if (c & 0x80) shift += 7;
+			else {
+				values << value;
+				value = 0;
+				shift = 0;
+			}
+		}
+		for (int i = 0; i + 1 < values.size(); i += 2) {
+			if (!(values[i + 1] & misc0Mask)) ids << QString::number(values[i]);
+		}
+	}
+
+	// Only the training data remains to be looked at
+	const QString queryUsedInWordsSql("select " QUOTEMACRO(JMDICTENTRY_GLOBALID) ", jmdict.entries.id "
 		"from jmdict.entries "
-		"join jmdict.kanjiChar on jmdict.kanjiChar.id = jmdict.entries.id "
-		"join jmdict.senses as senses on senses.id = jmdict.entries.id "
-			"and senses.priority = 0 "
-			"and senses.misc0 & %4 = 0 "
 		"%3join training on training.id = jmdict.entries.id and training.type = " QUOTEMACRO(JMDICTENTRY_GLOBALID) " "
-		"left join jmdict.jlpt on jmdict.entries.id = jmdict.jlpt.id "
-		"where jmdict.kanjiChar.kanji = %1 and jmdict.kanjiChar.priority = 0 "
-		"order by training.dateAdded is null ASC, training.score ASC, jmdict.jlpt.level DESC, jmdict.entries.frequency DESC "
+		"where jmdict.entries.id in (%1) "
+		"order by training.dateAdded is null ASC, training.score ASC, jmdict.entries.relevance DESC "
 		"limit %2");
 
-	return queryUsedInWordsSql.arg(kanji).arg(limit).arg(onlyStudied ? "" : "left ").arg(JMdictEntrySearcher::miscFilterMask()[0] | (1 << JMdictPlugin::miscMap()["uk"].second));
+	return queryUsedInWordsSql.arg(ids.join(", ")).arg(limit).arg(onlyStudied ? "" : "left ");
 }
 
 QString Kanjidic2EntryFormatter::getQueryUsedInKanjiSql(int kanji, int limit, bool onlyStudied)
@@ -120,6 +144,17 @@ QString Kanjidic2EntryFormatter::getQueryUsedInKanjiSql(int kanji, int limit, bo
 	return queryUsedInKanjiSql.arg(kanji).arg(limit).arg(onlyStudied ? "" : "left ");
 }
 
+QString Kanjidic2EntryFormatter::getQuerySimilarKanjiSql(int kanji)
+{
+	// Precomputed by build_kanji_db, most similar first
+	const QString querySimilarKanjiSql("select " QUOTEMACRO(KANJIDIC2ENTRY_GLOBALID) ", similar "
+		"from kanjidic2.similarKanji "
+		"where kanji = %1 "
+		"order by score desc, similar");
+
+	return querySimilarKanjiSql.arg(kanji);
+}
+
 Kanjidic2EntryFormatter &Kanjidic2EntryFormatter::instance()
 {
 	static Kanjidic2EntryFormatter _instance;
@@ -135,7 +170,46 @@ void Kanjidic2EntryFormatter::draw(const ConstEntryPointer &entry, QPainter &pai
 	drawCustom(entry.staticCast<const Kanjidic2Entry>(), painter, rectangle, usedSpace, textFont);
 }
 
-void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry, QPainter& painter, const QRectF& rectangle, QRectF& usedSpace, const QFont& textFont, int printSize, bool printWithFont, bool printMeanings, bool printOnyomi, bool printKunyomi, bool printComponents, bool printOnlyStudiedComponents, int maxWordsToPrint, bool printOnlyStudiedVocab, bool printStrokesNumbers, int printStrokesNumbersSize, bool printGrid) const
+QString Kanjidic2EntryFormatter::preparedWordsKey(int kanji, int limit, bool onlyStudied)
+{
+	return QString("%1:%2:%3").arg(kanji).arg(limit).arg(onlyStudied);
+}
+
+QList<int> Kanjidic2EntryFormatter::usedInWords(int kanji, int limit, bool onlyStudied)
+{
+	QList<int> ret;
+	SQLite::Query query(Database::threadConnection());
+	query.exec(getQueryUsedInWordsSql(kanji, limit, onlyStudied));
+	while (query.next()) ret << query.valueInt(1);
+	return ret;
+}
+
+QString Kanjidic2EntryFormatter::drawSettingsKey() const
+{
+	QStringList settings;
+	settings << QString::number(printSize.value()) << QString::number(printWithFont.value()) << QString::number(printMeanings.value()) << QString::number(printOnyomi.value()) << QString::number(printKunyomi.value()) << QString::number(printComponents.value()) << QString::number(printOnlyStudiedComponents.value()) << QString::number(maxWordsToPrint.value()) << QString::number(printOnlyStudiedVocab.value()) << QString::number(printStrokesNumbers.value()) << QString::number(strokesNumbersSize.value()) << QString::number(printGrid.value()) << QString::number(printStrokeOrder.value());
+	return settings.join(":");
+}
+
+QString Kanjidic2EntryFormatter::displaySettingsKey() const
+{
+	QStringList settings;
+	settings << QString::number(showReadings.value()) << QString::number(showNanori.value()) << QString::number(showUnicode.value()) << QString::number(showSKIP.value()) << QString::number(showFourCorner.value()) << QString::number(showJLPT.value()) << QString::number(showHeisig.value()) << QString::number(showGrade.value()) << QString::number(showRadicals.value()) << QString::number(showComponents.value()) << QString::number(showDictionaries.value()) << QString::number(showStrokesNumber.value()) << QString::number(showFrequency.value()) << QString::number(showVariations.value()) << QString::number(showVariationOf.value()) << QString::number(maxWordsToDisplay.value()) << QString::number(showOnlyStudiedVocab.value()) << QString::number(maxCompoundsToDisplay.value()) << QString::number(showOnlyStudiedCompounds.value());
+	return settings.join(":");
+}
+
+bool Kanjidic2EntryFormatter::prepareDraw(const ConstEntryPointer &entry) const
+{
+	EntryFormatter::prepareDraw(entry);
+	if (maxWordsToPrint.value()) {
+		QList<int> words(usedInWords(entry->id(), maxWordsToPrint.value(), printOnlyStudiedVocab.value()));
+		QMutexLocker lock(&_preparedWordsMutex);
+		_preparedWords.insert(preparedWordsKey(entry->id(), maxWordsToPrint.value(), printOnlyStudiedVocab.value()), words);
+	}
+	return true;
+}
+
+void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry, QPainter& painter, const QRectF& rectangle, QRectF& usedSpace, const QFont& textFont, int printSize, bool printWithFont, bool printMeanings, bool printOnyomi, bool printKunyomi, bool printComponents, bool printOnlyStudiedComponents, int maxWordsToPrint, bool printOnlyStudiedVocab, bool printStrokesNumbers, int printStrokesNumbersSize, bool printGrid, bool printStrokeOrder) const
 {
 	QFont kanjiFont;
 	kanjiFont.setPointSizeF(textFont.pointSize() * 5);
@@ -151,41 +225,26 @@ void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry
 		kanjiFont.setPointSize(kanjiFont.pointSize() - 1);
 
 	QRectF textBB;
-	// Render the grid, if relevant
-	if (printGrid) {
-		KanjiRenderer renderer(entry);
+	// Grid, strokes and their numbers are recorded once per kanji and
+	// style, which is all the same along a printed kanji sheet
+	KanjiRenderer::RenderStyle style;
+	style.strokesColor = painter.pen().color();
+	style.strokesNumbersSize = printStrokesNumbersSize;
+	style.flags = 0;
+	if (printGrid) style.flags |= KanjiRenderer::RenderStyle::Grid;
+	if (!printWithFont) style.flags |= KanjiRenderer::RenderStyle::Strokes;
+	// Numbers must be drawn on top of the kanji if it is printed with a font
+	else if (printGrid) {
 		painter.save();
-		QPen pen;
-		pen.setWidth(2);
-		pen.setColor(Qt::gray);
-		painter.setPen(pen);
 		painter.translate((leftArea.width() - printSize) / 2.0, 0.0);
 		painter.scale(printSize / 109.0, printSize / 109.0);
-		painter.setRenderHint(QPainter::Antialiasing);
-
-		renderer.renderGrid(&painter);
+		painter.drawPicture(0, 0, KanjiRenderer::picture(entry, style));
 		painter.restore();
+		style.flags = 0;
 	}
-	// Draw the kanji
-	if (!printWithFont) {
-		//painter.setFont(kanjiFont);
-		KanjiRenderer renderer(entry);
-		painter.save();
-		QPen pen(painter.pen());
-		pen.setWidth(5);
-		pen.setCapStyle(Qt::SquareCap);
-		painter.translate((leftArea.width() - printSize) / 2.0, 0.0);
-		painter.scale(printSize / 109.0, printSize / 109.0);
-		painter.setRenderHint(QPainter::Antialiasing);
+	if (printStrokesNumbers) style.flags |= KanjiRenderer::RenderStyle::StrokesNumbers;
 
-		foreach (const KanjiStroke &stroke, entry->strokes()) {
-			painter.setPen(pen);
-			renderer.strokeFor(stroke)->render(&painter);
-		}
-		painter.restore();
-		textBB.setTop(leftArea.top());
-		textBB.setBottom(leftArea.top() + printSize);
-	} else {
+	if (printWithFont) {
 		painter.save();
 		QFont font;
 		font.setPixelSize(printSize);
@@ -193,18 +252,15 @@ void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry
 		textBB = painter.boundingRect(leftArea, Qt::AlignHCenter | Qt::AlignTop, entry->kanji());
 		painter.drawText(leftArea, Qt::AlignHCenter | Qt::AlignTop, entry->kanji());
 		painter.restore();
+	} else {
+		textBB.setTop(leftArea.top());
+		textBB.setBottom(leftArea.top() + printSize);
 	}
-
-	if (printStrokesNumbers) {
-		KanjiRenderer renderer(entry);
+	if (style.flags) {
 		painter.save();
 		painter.translate((leftArea.width() - printSize) / 2.0, 0.0);
 		painter.scale(printSize / 109.0, printSize / 109.0);
-		painter.setRenderHint(QPainter::Antialiasing);
-
-		foreach (const KanjiStroke &stroke, entry->strokes()) {
-			renderer.renderStrokeNumber(stroke, &painter, printStrokesNumbersSize);
-		}
+		painter.drawPicture(0, 0, KanjiRenderer::picture(entry, style));
 		painter.restore();
 	}
 
@@ -285,11 +341,19 @@ void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry
 
 	// Now display words using this kanji
 	if (maxWordsToPrint) {
-		SQLite::Query query(Database::connection());
-		query.exec(getQueryUsedInWordsSql(entry->id(), maxWordsToPrint, printOnlyStudiedVocab));
+		QString key(preparedWordsKey(entry->id(), maxWordsToPrint, printOnlyStudiedVocab));
+		QList<int> words;
+		bool prepared;
+		{
+			QMutexLocker lock(&_preparedWordsMutex);
+			prepared = _preparedWords.contains(key);
+			if (prepared) words = _preparedWords.take(key);
+		}
+		// Not prepared, we are drawing from the GUI thread
+		if (!prepared) words = usedInWords(entry->id(), maxWordsToPrint, printOnlyStudiedVocab);
 		painter.setFont(textFont);
-		while (query.next()) {
-			ConstJMdictEntryPointer jmEntry(JMdictEntryRef(query.valueInt(1)).get());
+		foreach (int wordId, words) {
+			ConstJMdictEntryPointer jmEntry(JMdictEntryRef(wordId).get());
 
 			QString str = QFontMetrics(painter.font(), painter.device()).elidedText(jmEntry->shortVersion(Entry::TinyVersion), Qt::ElideRight, (int) rightArea.width());
 			textBB = painter.boundingRect(rightArea, Qt::AlignLeft, str);
@@ -304,6 +368,29 @@ void Kanjidic2EntryFormatter::drawCustom(const ConstKanjidic2EntryPointer& entry
 
 	painter.drawLine(QPointF(rectangle.left() + leftArea.width(), usedSpace.top()),
 					 QPointF(rectangle.left() + leftArea.width(), usedSpace.bottom()));
+
+	// The stroke order goes below, in frames half the size of the kanji. As
+	// print jobs format entries on a thread pool, strips are rendered in
+	// parallel
+	if (printStrokeOrder) {
+		const qreal frameSize = printSize / 2.0;
+		KanjiRenderer::RenderStyle stripStyle;
+		stripStyle.strokesColor = painter.pen().color();
+		stripStyle.strokesNumbersSize = printStrokesNumbersSize;
+		stripStyle.flags = 0;
+		if (printGrid) stripStyle.flags |= KanjiRenderer::RenderStyle::Grid;
+		if (printStrokesNumbers) stripStyle.flags |= KanjiRenderer::RenderStyle::StrokesNumbers;
+		QPicture strip(StrokeOrderStrips::render(entry, stripStyle, Qt::red, qMax(1, (int)(rectangle.width() / frameSize))));
+		if (!strip.isNull()) {
+			const qreal scale = frameSize / KANJI_AREA_WIDTH;
+			painter.save();
+			painter.translate(rectangle.left(), usedSpace.bottom() + frameSize / 10.0);
+			painter.scale(scale, scale);
+			painter.drawPicture(0, 0, strip);
+			painter.restore();
+			usedSpace.setBottom(usedSpace.bottom() + frameSize / 10.0 + strip.boundingRect().height() * scale);
+		}
+	}
 }
 
 void Kanjidic2EntryFormatter::showToolTip(const ConstKanjidic2EntryPointer entry, const QPoint &pos) const
@@ -522,7 +609,7 @@ QString Kanjidic2EntryFormatter::formatVariations(const ConstEntryPointer &_entr
 {
 	if (showVariations.value()) {
 		ConstKanjidic2EntryPointer entry(_entry.staticCast<const Kanjidic2Entry>());
-		SQLite::Query query(Database::connection());
+		SQLite::Query query(Database::threadConnection());
 		query.prepare("select distinct element from kanjidic2.strokeGroups where original = ?");
 		query.bindValue(entry->id());
 		query.exec();
@@ -701,6 +788,33 @@ void ShowUsedInKanjiJob::completed()
 	cursor().insertHtml(QString("<a href=\"component:?reset=true&kanji=%1\" title=\"%4\">%2</a> <a href=\"component:?kanji=%1\" title=\"%5\">%3</a>").arg(_kanji).arg(tr("All compounds")).arg(tr("(+)")).arg(tr("Make a new search using only this filter")).arg(tr("Add this filter to the current search")));
 }
 
+QList<DetailedViewJob *> Kanjidic2EntryFormatter::jobSimilarKanji(const ConstEntryPointer &_entry, const QTextCursor &cursor) const
+{
+	ConstKanjidic2EntryPointer entry(_entry.staticCast<const Kanjidic2Entry>());
+	QList<DetailedViewJob *> ret;
+	ret << new ShowSimilarKanjiJob(entry->kanji(), cursor);
+	return ret;
+}
+
+ShowSimilarKanjiJob::ShowSimilarKanjiJob(const QString &kanji, const QTextCursor &cursor) :
+		DetailedViewJob(Kanjidic2EntryFormatter::getQuerySimilarKanjiSql(TextTools::singleCharToUnicode(kanji)), cursor)
+{
+}
+
+void ShowSimilarKanjiJob::firstResult()
+{
+	cursor().insertHtml(QString("<br/>%1").arg(EntryFormatter::buildSubInfoLine(tr("Similar kanji"), "")));
+	_cursor.movePosition(QTextCursor::PreviousBlock);
+}
+
+void ShowSimilarKanjiJob::result(EntryPointer entry)
+{
+	ConstKanjidic2EntryPointer kEntry = entry.staticCast<const Kanjidic2Entry>();
+	Q_ASSERT(kEntry);
+	const EntryFormatter *formatter(EntryFormatter::getFormatter(kEntry));
+	cursor().insertHtml(formatter->entryTitle(kEntry) + "&nbsp;");
+}
+
 ShowUsedInWordsJob::ShowUsedInWordsJob(const QString &kanji, const QTextCursor &cursor) :
 		DetailedViewJob(Kanjidic2EntryFormatter::getQueryUsedInWordsSql(TextTools::singleCharToUnicode(kanji), Kanjidic2EntryFormatter::maxWordsToDisplay.value(), Kanjidic2EntryFormatter::showOnlyStudiedVocab.value()), cursor), _kanji(kanji), gotResults(false)
 {
@@ -22,6 +22,9 @@
 #include "gui/EntryFormatter.h"
 #include "gui/DetailedView.h"
 
+#include <QMultiHash>
+#include <QMutex>
+
 class Kanjidic2EntryFormatter : public EntryFormatter
 {
 	Q_OBJECT
@@ -41,6 +44,16 @@ protected:
 	 */
 	ConstKanjidic2EntryPointer getMeaningEntry(const KanjiComponent *comp) const;
 
+	/**
+	 * Words using a kanji, queried by prepareDraw() for the next drawing of
+	 * the kanji. Indexed by the kanji and the query parameters, with one
+	 * value per pending drawing.
+	 */
+	mutable QMultiHash<QString, QList<int> > _preparedWords;
+	mutable QMutex _preparedWordsMutex;
+	static QString preparedWordsKey(int kanji, int limit, bool onlyStudied);
+	static QList<int> usedInWords(int kanji, int limit, bool onlyStudied);
+
 public:
 	static Kanjidic2EntryFormatter &instance();
 
@@ -56,9 +69,13 @@ public:
 
 	static QString getQueryUsedInWordsSql(int kanji, int limit = maxWordsToDisplay.value(), bool onlyStudied = showOnlyStudiedVocab.value());
 	static QString getQueryUsedInKanjiSql(int kanji, int limit = maxCompoundsToDisplay.value(), bool onlyStudied = showOnlyStudiedCompounds.value());
+	static QString getQuerySimilarKanjiSql(int kanji);
 
 	virtual void draw(const ConstEntryPointer &entry, QPainter &painter, const QRectF &rectangle, QRectF &usedSpace, const QFont &textFont = QFont()) const;
-	void drawCustom(const ConstKanjidic2EntryPointer& entry, QPainter& painter, const QRectF& rectangle, QRectF& usedSpace, const QFont& textFont = QFont(), int _printSize = printSize.value(), bool _printWithFont = printWithFont.value(), bool _printMeanings = printMeanings.value(), bool _printOnyomi = printOnyomi.value(), bool _printKunyomi = printKunyomi.value(), bool _printComponents = printComponents.value(), bool _printOnlyStudiedComponents = printOnlyStudiedComponents.value(), int _maxWordsToPrint = maxWordsToPrint.value(), bool _printOnlyStudiedVocab = printOnlyStudiedVocab.value(), bool _printStrokesNumbers = printStrokesNumbers.value(), int _printStrokesNumbersSize = strokesNumbersSize.value(), bool _printGrid = printGrid.value()) const;
+	virtual bool prepareDraw(const ConstEntryPointer &entry) const;
+	virtual QString drawSettingsKey() const;
+	virtual QString displaySettingsKey() const;
+	void drawCustom(const ConstKanjidic2EntryPointer& entry, QPainter& painter, const QRectF& rectangle, QRectF& usedSpace, const QFont& textFont = QFont(), int _printSize = printSize.value(), bool _printWithFont = printWithFont.value(), bool _printMeanings = printMeanings.value(), bool _printOnyomi = printOnyomi.value(), bool _printKunyomi = printKunyomi.value(), bool _printComponents = printComponents.value(), bool _printOnlyStudiedComponents = printOnlyStudiedComponents.value(), int _maxWordsToPrint = maxWordsToPrint.value(), bool _printOnlyStudiedVocab = printOnlyStudiedVocab.value(), bool _printStrokesNumbers = printStrokesNumbers.value(), int _printStrokesNumbersSize = strokesNumbersSize.value(), bool _printGrid = printGrid.value(), bool _printStrokeOrder = printStrokeOrder.value()) const;
 
 	static PreferenceItem<bool> showReadings;
 	static PreferenceItem<bool> showNanori;
@@ -102,6 +119,8 @@ public:
 	static PreferenceItem<bool> printStrokesNumbers;
 	static PreferenceItem<int> strokesNumbersSize;
 	static PreferenceItem<bool> printGrid;
+	/// Prints the stroke order of kanjis below them, see StrokeOrderStrips
+	static PreferenceItem<bool> printStrokeOrder;
 	static const QMap<QString, const char *> dictTypes;
 	static QMap<QString, const char *> initializeDictTypes();
 
@@ -127,6 +146,7 @@ public slots:
 
 	virtual QList<DetailedViewJob *> jobUsedInKanji(const ConstEntryPointer &_entry, const QTextCursor &cursor) const;
 	virtual QList<DetailedViewJob *> jobUsedInWords(const ConstEntryPointer &_entry, const QTextCursor &cursor) const;
+	virtual QList<DetailedViewJob *> jobSimilarKanji(const ConstEntryPointer &_entry, const QTextCursor &cursor) const;
 };
 
 class ShowUsedInKanjiJob : public DetailedViewJob {
@@ -141,6 +161,14 @@ public:
 	virtual void completed();
 };
 
+class ShowSimilarKanjiJob : public DetailedViewJob {
+	Q_DECLARE_TR_FUNCTIONS(ShowSimilarKanjiJob)
+public:
+	ShowSimilarKanjiJob(const QString &kanji, const QTextCursor &cursor);
+	virtual void firstResult();
+	virtual void result(EntryPointer entry);
+};
+
 class ShowUsedInWordsJob : public DetailedViewJob {
 	Q_DECLARE_TR_FUNCTIONS(ShowUsedInWordsJob)
 private:
@@ -164,6 +164,7 @@ Kanjidic2FilterWidget::Kanjidic2FilterWidget(QWidget *parent) : SearchFilterWidg
 			if (i == 7) continue;
 			action = actionGroup->addAction(QCoreApplication::translate("Kanjidic2GUIPlugin", Kanjidic2GUIPlugin::kanjiGrades[i].toLatin1()));
 			action->setProperty("Agrade", i);
+			action->setProperty("Alabel", action->text());
 			action->setCheckable(true);
 		}
 		connect(actionGroup, SIGNAL(triggered(QAction *)), this, SLOT(onGradeTriggered(QAction *)));
@@ -178,6 +179,10 @@ Kanjidic2FilterWidget::Kanjidic2FilterWidget(QWidget *parent) : SearchFilterWidg
 
 		_gradeButton->setMenu(menu);
 		hLayout->addWidget(_gradeButton);
+		// Show how many results each grade would give when opening the
+		// menu
+		connect(menu, SIGNAL(aboutToShow()), this, SLOT(countGrades()));
+		connect(&_counter, SIGNAL(counted(QString, int)), this, SLOT(onGradeCounted(QString, int)));
 	}
 	
 	QHBoxLayout *mainLayout = new QHBoxLayout(this);
@@ -335,6 +340,42 @@ void Kanjidic2FilterWidget::allJouyouKanjis(bool checked)
 }
 
 QString Kanjidic2FilterWidget::currentCommand() const
+{
+	QString ret(commandWithoutGrades());
+	if (!_gradesList.isEmpty()) ret += " :grade=" + _gradesList.join(",");
+	return ret;
+}
+
+QString Kanjidic2FilterWidget::gradeSearch(int grade) const
+{
+	return QString("%1 %2 :grade=%3").arg(_otherCommands).arg(commandWithoutGrades()).arg(grade).simplified();
+}
+
+void Kanjidic2FilterWidget::searchUpdated(const QString &otherCommands)
+{
+	_otherCommands = otherCommands;
+	_counter.clearPending();
+	// Counts of the previous search are not valid anymore
+	foreach (QAction *action, actionGroup->actions())
+		action->setText(action->property("Alabel").toString());
+	if (_gradeButton->menu()->isVisible()) countGrades();
+}
+
+void Kanjidic2FilterWidget::countGrades()
+{
+	foreach (QAction *action, actionGroup->actions())
+		_counter.count(gradeSearch(action->property("Agrade").toInt()));
+}
+
+void Kanjidic2FilterWidget::onGradeCounted(const QString &search, int count)
+{
+	foreach (QAction *action, actionGroup->actions()) {
+		if (search == gradeSearch(action->property("Agrade").toInt()))
+			action->setText(QString("%1 (%2)").arg(action->property("Alabel").toString()).arg(count));
+	}
+}
+
+QString Kanjidic2FilterWidget::commandWithoutGrades() const
 {
 	QString ret;
 
@@ -369,7 +410,6 @@ QString Kanjidic2FilterWidget::currentCommand() const
 	if (_unicode->value()) ret += QString(" :unicode=%1").arg(_unicode->text());
 	if (_skip1->value() || _skip2->value() || _skip3->value()) ret += QString(" :skip=%1").arg(skip());
 	if (_fcTopLeft->currentIndex() > 0 || _fcTopRight->currentIndex() > 0 || _fcBotLeft->currentIndex() > 0 || _fcBotRight->currentIndex() > 0 || _fcExtra->currentIndex() > 0) ret += QString(" :fourcorner=%1").arg(fourCorner());
-	if (!_gradesList.isEmpty()) ret += " :grade=" + _gradesList.join(",");
 	return ret;
 }
 
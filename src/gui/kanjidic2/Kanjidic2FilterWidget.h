@@ -20,6 +20,7 @@
 
 #include "gui/SearchWidget.h"
 #include "gui/kanjidic2/KanjiSelector.h"
+#include "gui/FacetCounter.h"
 
 #include <QSpinBox>
 #include <QCheckBox>
@@ -46,6 +47,13 @@ private:
 	/// Actiongroup used to store the kanjis grades options
 	QActionGroup *actionGroup;
 	QAction *allKyouku, *allJouyou;
+	FacetCounter _counter;
+	QString _otherCommands;
+
+	/// Commands of the widget, except for the grades
+	QString commandWithoutGrades() const;
+	/// Search giving the results the given grade would have
+	QString gradeSearch(int grade) const;
 
 protected:
 	virtual void _reset();
@@ -57,6 +65,7 @@ public:
 	virtual QString name() const { return "kanjidicoptions"; }
 	virtual QString currentTitle() const;
 	virtual QString currentCommand() const;
+	virtual void searchUpdated(const QString &otherCommands);
 
 	virtual void updateFeatures();
 
@@ -102,6 +111,8 @@ protected slots:
 	void onGradeTriggered(QAction *action);
 	void allKyoukuKanjis(bool checked);
 	void allJouyouKanjis(bool checked);
+	void countGrades();
+	void onGradeCounted(const QString &search, int count);
 };
 
 #endif
@@ -16,14 +16,20 @@
  */
 
 #include "core/TextTools.h"
+#include "core/EntriesCache.h"
 #include "gui/TrainSettings.h"
 #include "gui/kanjidic2/Kanjidic2EntryFormatter.h"
 #include "gui/kanjidic2/KanjiPopup.h"
+#include "gui/kanjidic2/KanjiPositionsIndex.h"
 #include "gui/MainWindow.h"
 #include "gui/EntryTypeFilterWidget.h"
 #include "gui/kanjidic2/Kanjidic2Preferences.h"
 #include "gui/kanjidic2/Kanjidic2GUIPlugin.h"
 #include "gui/kanjidic2/KanaSelector.h"
+#include "gui/kanjidic2/KanjiDrawingInput.h"
+#include "gui/kanjidic2/StrokeOrderStrips.h"
+#include "gui/ResultsView.h"
+#include "gui/EntriesMimeData.h"
 // TODO BAD - dependency against JMdict!
 #include "gui/jmdict/JMdictGUIPlugin.h"
 
@@ -34,6 +40,7 @@
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QInputDialog>
+#include <QFileDialog>
 #include <QCoreApplication>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
@@ -63,7 +70,7 @@ Kanjidic2GUIPlugin *Kanjidic2GUIPlugin::_instance = 0;
 
 PreferenceItem<bool> Kanjidic2GUIPlugin::kanjiTooltipEnabled("kanjidic", "kanjiTooltipEnabled", true);
 
-Kanjidic2GUIPlugin::Kanjidic2GUIPlugin() : Plugin("kanjidic2GUI"), _flashKL(0), _flashKS(0), _flashML(0), _flashMS(0), _readingPractice(0), _showKanjiPopup(0), _linkHandler(0), _wordsLinkHandler(0), _componentsLinkHandler(0), _filter(0), _trainer(0), _readingTrainer(0), _cAction(0), _kAction(0), _dragStarted(false), _dragEntryRef(0)
+Kanjidic2GUIPlugin::Kanjidic2GUIPlugin() : Plugin("kanjidic2GUI"), _flashKL(0), _flashKS(0), _flashML(0), _flashMS(0), _readingPractice(0), _showKanjiPopup(0), _exportStrokeOrder(0), _linkHandler(0), _wordsLinkHandler(0), _componentsLinkHandler(0), _filter(0), _trainer(0), _readingTrainer(0), _cAction(0), _kAction(0), _dAction(0), _dragStarted(false), _dragEntryRef(0)
 {
 	_instance = this;
 }
@@ -131,6 +138,9 @@ bool Kanjidic2GUIPlugin::onRegister()
 	_cAction = new KanjiInputPopupAction(new KanjiInputter(new ComponentKanjiSelector(), true, mainWindow), tr("Component search input"), mainWindow);
 	_cAction->setShortcut(QKeySequence("Ctrl+j"));
 	mainWindow->searchMenu()->addAction(_cAction);
+	_dAction = new KanjiInputPopupAction(new KanjiDrawingInputter(mainWindow), tr("Handwriting input"), mainWindow);
+	_dAction->setShortcut(QKeySequence("Ctrl+d"));
+	mainWindow->searchMenu()->addAction(_dAction);
 
 	_showKanjiPopup = new QAction(tr("Show stroke popup for currently displayed kanji"), this);
 	_showKanjiPopup->setShortcut(QKeySequence("Ctrl+s"));
@@ -138,6 +148,10 @@ bool Kanjidic2GUIPlugin::onRegister()
 	connect(_showKanjiPopup, SIGNAL(triggered()), this, SLOT(popupDetailedViewKanjiEntry()));
 	MainWindow::instance()->addAction(_showKanjiPopup);
 
+	_exportStrokeOrder = new QAction(QIcon(":/images/icons/document-export.png"), tr("Export &stroke order..."), this);
+	connect(_exportStrokeOrder, SIGNAL(triggered()), this, SLOT(exportStrokeOrder()));
+	mainWindow->searchWidget()->resultsView()->helper()->entriesMenu()->addAction(_exportStrokeOrder);
+
 	// Register the searchbar extender
 	_filter = new Kanjidic2FilterWidget(0);
 	mainWindow->searchWidget()->addSearchFilter(_filter);
@@ -164,6 +178,8 @@ bool Kanjidic2GUIPlugin::onUnregister()
 	mainWindow->removeAction(_showKanjiPopup);
 	delete _showKanjiPopup;
 	_showKanjiPopup = 0;
+	delete _exportStrokeOrder;
+	_exportStrokeOrder = 0;
 
 	// Remove the search extender
 	mainWindow->searchWidget()->removeSearchFilterWidget(_filter->name());
@@ -171,6 +187,7 @@ bool Kanjidic2GUIPlugin::onUnregister()
 	// Remove the components searchers
 	delete _cAction; _cAction = 0;
 	delete _kAction; _kAction = 0;
+	delete _dAction; _dAction = 0;
 
 	// Remove the kana dock widget
 	delete _kanaDockWidget;
@@ -230,8 +247,7 @@ void Kanjidic2GUIPlugin::trainingKanjiSet()
 		return;
 	}
 
-	QString queryString(stat->buildSqlStatement());
-	queryString += " " + TrainSettings::buildOrderString("score");
+	QString queryString(TrainSettings::buildQueryString(*stat));
 	training(YesNoTrainer::Japanese, queryString);
 }
 
@@ -248,11 +264,39 @@ void Kanjidic2GUIPlugin::trainingMeaningSet()
 		return;
 	}
 
-	QString queryString(stat->buildSqlStatement());
-	queryString += " " + TrainSettings::buildOrderString("score");
+	QString queryString(TrainSettings::buildQueryString(*stat));
 	training(YesNoTrainer::Translation, queryString);
 }
 
+void Kanjidic2GUIPlugin::exportStrokeOrder()
+{
+	MainWindow *mainWindow(MainWindow::instance());
+	QList<EntryRef> refs;
+	foreach (const EntryRef &ref, mainWindow->searchWidget()->resultsList()->results().mid(0))
+		if (ref.type() == KANJIDIC2ENTRY_GLOBALID) refs << ref;
+	if (refs.isEmpty()) {
+		QMessageBox::information(mainWindow, tr("Nothing to export"), tr("There are no kanji entries in the results to export."));
+		return;
+	}
+
+	static const char *formats[] = { "PNG", "SVG", "PDF" };
+	QStringList items;
+	for (int i = 0; i < 3; i++) items << formats[i];
+	bool ok;
+	QString format(QInputDialog::getItem(mainWindow, tr("Export stroke order"), tr("File format:"), items, 0, false, &ok));
+	if (!ok) return;
+	QString dir(QFileDialog::getExistingDirectory(mainWindow, tr("Export stroke order to directory...")));
+	if (dir.isEmpty()) return;
+
+	QList<ConstKanjidic2EntryPointer> kanjis;
+	foreach (const EntryPointer &entry, EntriesCache::getMany(refs))
+		if (entry) kanjis << entry.staticCast<const Kanjidic2Entry>();
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	bool success = StrokeOrderStrips::writeAll(kanjis, dir, (StrokeOrderStrips::Format)items.indexOf(format));
+	QApplication::restoreOverrideCursor();
+	if (!success) QMessageBox::warning(mainWindow, tr("Error writing files"), tr("Some stroke order files could not be written into %1.").arg(dir));
+}
+
 void Kanjidic2GUIPlugin::trainerDeleted()
 {
 	_trainer = 0;
@@ -302,6 +346,18 @@ bool Kanjidic2GUIPlugin::eventFilter(QObject *obj, QEvent *_event)
 {
 	DetailedView *view(qobject_cast<DetailedView *>(obj->parent()));
 	if (!view) return false;
+	// Getting the index of a newly displayed document starts
+	// prefetching its kanjis
+	KanjiPositionsIndex *index(KanjiPositionsIndex::forDocument(view->document()));
+	switch(_event->type()) {
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseMove:
+	case QEvent::MouseButtonRelease:
+	case QEvent::ContextMenu:
+		break;
+	default:
+		return false;
+	}
 	int pos = view->document()->documentLayout()->hitTest(view->viewport()->mapFromGlobal(QCursor::pos() + QPoint(0, view->verticalScrollBar()->value())), Qt::ExactHit);
 	switch(_event->type()) {
 	case QEvent::MouseButtonPress:
@@ -311,22 +367,13 @@ bool Kanjidic2GUIPlugin::eventFilter(QObject *obj, QEvent *_event)
 		if (e->button() == Qt::LeftButton && pos != -1) {
 			// Either prepare for a drag or a click to display the kanji popup
 			// if we are on a kanji
-			QTextCursor cursor(view->document());
-			cursor.setPosition(pos);
-			cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-			if (cursor.charFormat().isAnchor()) return false;
-			QChar t(cursor.selectedText()[0]);
-			QString c(t);
-			if (t.isHighSurrogate()) {
-				cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-				c += cursor.selectedText()[1];
-			}
-			if (TextTools::isKanjiChar(c)) {
+			uint kanji = index->kanjiAt(pos);
+			if (kanji) {
 				// Yes, it is a kanji - prepare for a drag or a click
 				// and consume the event.
 				_dragStarted = true;
 				_dragPos = e->pos();
-				_dragEntryRef = KanjiEntryRef(TextTools::singleCharToUnicode(c));
+				_dragEntryRef = KanjiEntryRef(kanji);
 				return true;
 			}
 		}
@@ -340,12 +387,7 @@ bool Kanjidic2GUIPlugin::eventFilter(QObject *obj, QEvent *_event)
 			if ((e->pos() - _dragPos).manhattanLength() >= QApplication::startDragDistance()) {
 				_dragStarted = false;
 				QDrag *drag = new QDrag(view);
-				QMimeData *data = new QMimeData();
-				QByteArray encodedData;
-				QDataStream stream(&encodedData, QIODevice::WriteOnly);
-				stream << _dragEntryRef;
-				data->setData("tagainijisho/entry", encodedData);
-				drag->setMimeData(data);
+				drag->setMimeData(new EntriesMimeData(_dragEntryRef));
 				drag->exec(Qt::CopyAction, Qt::CopyAction);
 				_dragStarted = false;
 			}
@@ -354,21 +396,14 @@ bool Kanjidic2GUIPlugin::eventFilter(QObject *obj, QEvent *_event)
 		}
 		// See if we have to show the kanji tooltip
 		if (pos != -1) {
-			QTextCursor cursor(view->document());
-			cursor.setPosition(pos);
-			cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-			if (!cursor.charFormat().isAnchor()) {
-				QChar t(cursor.selectedText()[0]);
-				QString c(t);
-				if (t.isHighSurrogate()) {
-					cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-					c += cursor.selectedText()[1];
-				}
-				if (TextTools::isKanjiChar(c)) {
-					ConstKanjidic2EntryPointer entry(KanjiEntryRef(TextTools::singleCharToUnicode(c)).get());
+			if (!index->isAnchor(pos)) {
+				uint kanji = index->kanjiAt(pos);
+				if (kanji) {
 					// If kanji are clickable, change the cursor
 					if (view->kanjiClickable()) {
 						view->viewport()->setCursor(QCursor(Qt::PointingHandCursor));
+						// Usually prefetched when the document was displayed
+						ConstKanjidic2EntryPointer entry(index->entry(kanji));
 						// Only show the tooltip if the entry exists in the database!
 						if (kanjiTooltipEnabled.value() && entry) {
 							const Kanjidic2EntryFormatter *formatter(static_cast<const Kanjidic2EntryFormatter *>(EntryFormatter::getFormatter(KANJIDIC2ENTRY_GLOBALID)));
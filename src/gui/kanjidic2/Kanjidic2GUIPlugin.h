@@ -37,14 +37,14 @@ class Kanjidic2GUIPlugin : public QObject, public Plugin
 {
 	Q_OBJECT
 private:
-	QAction *_flashKL, *_flashKS, *_flashML, *_flashMS, *_readingPractice, *_showKanjiPopup;
+	QAction *_flashKL, *_flashKS, *_flashML, *_flashMS, *_readingPractice, *_showKanjiPopup, *_exportStrokeOrder;
 	KanjiLinkHandler *_linkHandler;
 	KanjiAllWordsHandler *_wordsLinkHandler;
 	KanjiAllComponentsOfHandler *_componentsLinkHandler;
 	Kanjidic2FilterWidget *_filter;
 	YesNoTrainer *_trainer;
 	ReadingTrainer *_readingTrainer;
-	KanjiInputPopupAction * _cAction, *_kAction;
+	KanjiInputPopupAction * _cAction, *_kAction, *_dAction;
 	KanaSelector *_kanaSelector;
 	QDockWidget *_kanaDockWidget;
 	/// Used for drag'n drop of kanji from the detailed view
@@ -67,6 +67,8 @@ protected slots:
 	void trainingMeaningSet();
 	void readingPractice();
 	void popupDetailedViewKanjiEntry();
+	/// Writes the stroke order strips of the kanjis of the results
+	void exportStrokeOrder();
 
 public:
 	Kanjidic2GUIPlugin();
@@ -0,0 +1,240 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/kanjidic2/StrokeOrderStrips.h"
+
+#include <QtDebug>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QImage>
+#include <QPdfWriter>
+#include <QPageSize>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+
+/// Number of frames of the strip of a kanji of count strokes on a row
+static int columnsCount(int count, int framesPerRow)
+{
+	return framesPerRow > 0 ? qMin(count, framesPerRow) : count;
+}
+
+static QSizeF framesSize(int count, int framesPerRow)
+{
+	if (count == 0) return QSizeF();
+	int columns = columnsCount(count, framesPerRow);
+	int rows = (count + columns - 1) / columns;
+	return QSizeF(columns * KANJI_AREA_WIDTH, rows * KANJI_AREA_HEIGHT);
+}
+
+QSizeF StrokeOrderStrips::stripSize(const ConstKanjidic2EntryPointer &kanji, int framesPerRow)
+{
+	KanjiRenderer renderer(kanji);
+	return framesSize(renderer.strokes().size(), framesPerRow);
+}
+
+QPicture StrokeOrderStrips::render(const ConstKanjidic2EntryPointer &kanji, const KanjiRenderer::RenderStyle &style, const QColor &highlightColor, int framesPerRow)
+{
+	QPicture ret;
+	KanjiRenderer renderer(kanji);
+	const QList<KanjiRenderer::Stroke> &strokes(renderer.strokes());
+	if (strokes.isEmpty()) return ret;
+	const int columns = columnsCount(strokes.size(), framesPerRow);
+
+	QPen gridPen;
+	gridPen.setWidth(style.gridWidth);
+	gridPen.setColor(style.gridColor);
+	QPen strokesPen(style.strokesColor);
+	strokesPen.setWidth(style.strokesWidth);
+	strokesPen.setCapStyle(style.capStyle);
+	QPen highlightPen(strokesPen);
+	highlightPen.setColor(highlightColor);
+
+	QPainter painter(&ret);
+	painter.setRenderHint(QPainter::Antialiasing);
+	for (int frame = 0; frame < strokes.size(); frame++) {
+		painter.save();
+		painter.translate((frame % columns) * KANJI_AREA_WIDTH, (frame / columns) * KANJI_AREA_HEIGHT);
+		if (style.flags & KanjiRenderer::RenderStyle::Grid) {
+			painter.setPen(gridPen);
+			renderer.renderGrid(&painter);
+		}
+		painter.setBrush(QBrush());
+		for (int i = 0; i <= frame; i++) {
+			painter.setPen(i == frame ? highlightPen : strokesPen);
+			strokes[i].render(&painter);
+		}
+		if (style.flags & KanjiRenderer::RenderStyle::StrokesNumbers)
+			renderer.renderStrokeNumber(*strokes[frame].stroke(), &painter, style.strokesNumbersSize);
+		painter.restore();
+	}
+	painter.end();
+	// Strokes do not necessarily reach the borders of the frames
+	ret.setBoundingRect(QRectF(QPointF(0, 0), framesSize(strokes.size(), framesPerRow)).toAlignedRect());
+	return ret;
+}
+
+static QString svgPath(const QPainterPath &path)
+{
+	QStringList ret;
+	for (int i = 0; i < path.elementCount(); i++) {
+		const QPainterPath::Element &e = path.elementAt(i);
+		QString point(QString("%1 %2").arg(e.x).arg(e.y));
+		switch (e.type) {
+		case QPainterPath::MoveToElement:
+			ret << "M" + point;
+			break;
+		case QPainterPath::LineToElement:
+			ret << "L" + point;
+			break;
+		case QPainterPath::CurveToElement:
+			ret << "C" + point;
+			break;
+		case QPainterPath::CurveToDataElement:
+			ret << point;
+			break;
+		}
+	}
+	return ret.join(" ");
+}
+
+static QString svgLine(qreal x1, qreal y1, qreal x2, qreal y2, const QString &attributes)
+{
+	return QString("<line x1=\"%1\" y1=\"%2\" x2=\"%3\" y2=\"%4\" %5/>\n").arg(x1).arg(y1).arg(x2).arg(y2).arg(attributes);
+}
+
+QString StrokeOrderStrips::renderSvg(const ConstKanjidic2EntryPointer &kanji, const KanjiRenderer::RenderStyle &style, const QColor &highlightColor, int framesPerRow)
+{
+	KanjiRenderer renderer(kanji);
+	const QList<KanjiRenderer::Stroke> &strokes(renderer.strokes());
+	if (strokes.isEmpty()) return QString();
+	const int columns = columnsCount(strokes.size(), framesPerRow);
+	const QSizeF size(framesSize(strokes.size(), framesPerRow));
+	const QString cap(style.capStyle == Qt::RoundCap ? "round" : style.capStyle == Qt::FlatCap ? "butt" : "square");
+	const QString strokeAttributes(QString("fill=\"none\" stroke-width=\"%1\" stroke-linecap=\"%2\"").arg(style.strokesWidth).arg(cap));
+	const qreal w = KANJI_AREA_WIDTH, h = KANJI_AREA_HEIGHT;
+	// Same lines as KanjiRenderer::renderGrid()
+	QString grid;
+	if (style.flags & KanjiRenderer::RenderStyle::Grid) {
+		QString solid(QString("stroke=\"%1\" stroke-width=\"%2\"").arg(style.gridColor.name()).arg(style.gridWidth));
+		QString dotted(QString("stroke=\"%1\" stroke-width=\"%2\" stroke-dasharray=\"%3\"").arg(style.gridColor.name()).arg(style.gridWidth / 3.0).arg(style.gridWidth / 3.0));
+		grid += svgLine(0, h / 2, w, h / 2, solid) + svgLine(w / 2, 0, w / 2, h, solid);
+		grid += svgLine(0, h / 4, w, h / 4, dotted) + svgLine(0, h * 3 / 4, w, h * 3 / 4, dotted);
+		grid += svgLine(w / 4, 0, w / 4, h, dotted) + svgLine(w * 3 / 4, 0, w * 3 / 4, h, dotted);
+	}
+
+	QString ret(QString("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%1\" height=\"%2\" viewBox=\"0 0 %1 %2\">\n").arg(size.width()).arg(size.height()));
+	QStringList paths;
+	foreach (const KanjiRenderer::Stroke &stroke, strokes) paths << svgPath(stroke.painterPath());
+	for (int frame = 0; frame < strokes.size(); frame++) {
+		ret += QString("<g transform=\"translate(%1,%2)\">\n").arg((frame % columns) * w).arg((frame / columns) * h);
+		ret += grid;
+		for (int i = 0; i <= frame; i++)
+			ret += QString("<path d=\"%1\" stroke=\"%2\" %3/>\n").arg(paths[i]).arg((i == frame ? highlightColor : style.strokesColor).name()).arg(strokeAttributes);
+		if (style.flags & KanjiRenderer::RenderStyle::StrokesNumbers) {
+			// Placed like KanjiRenderer::renderStrokeNumber() does
+			const QPainterPath &path(strokes[frame].painterPath());
+			QLineF line(path.pointAtPercent(0.0), path.pointAtPercent(0.1));
+			line.setLength(-style.strokesNumbersSize * 1.5);
+			ret += QString("<text x=\"%1\" y=\"%2\" font-size=\"%3\" text-anchor=\"middle\" dominant-baseline=\"central\">%4</text>\n").arg(line.p2().x()).arg(line.p2().y()).arg(style.strokesNumbersSize * 2 - 2).arg(frame + 1);
+		}
+		ret += "</g>\n";
+	}
+	ret += "</svg>\n";
+	return ret;
+}
+
+QString StrokeOrderStrips::fileName(const ConstKanjidic2EntryPointer &kanji, Format format)
+{
+	static const char *extensions[] = { "png", "svg", "pdf" };
+	return QString("%1.%2").arg(kanji->id(), 5, 16, QChar('0')).arg(extensions[format]);
+}
+
+bool StrokeOrderStrips::write(const ConstKanjidic2EntryPointer &kanji, const QString &file, Format format, int frameSize, const KanjiRenderer::RenderStyle &style, const QColor &highlightColor, int framesPerRow)
+{
+	if (format == SVG) {
+		QString svg(renderSvg(kanji, style, highlightColor, framesPerRow));
+		if (svg.isEmpty()) return true;
+		QFile out(file);
+		if (!out.open(QIODevice::WriteOnly)) return false;
+		return out.write(svg.toUtf8()) != -1;
+	}
+
+	QPicture strip(render(kanji, style, highlightColor, framesPerRow));
+	if (strip.isNull()) return true;
+	const qreal scale = frameSize / KANJI_AREA_WIDTH;
+	const QSizeF size(QSizeF(strip.boundingRect().size()) * scale);
+	if (format == PNG) {
+		QImage image(size.toSize(), QImage::Format_ARGB32_Premultiplied);
+		image.fill(Qt::transparent);
+		QPainter painter(&image);
+		painter.scale(scale, scale);
+		painter.drawPicture(0, 0, strip);
+		painter.end();
+		return image.save(file, "PNG");
+	}
+	// PDF, one point per unit
+	QPdfWriter writer(file);
+	writer.setResolution(72);
+	writer.setPageSize(QPageSize(size, QPageSize::Point));
+	writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+	QPainter painter;
+	if (!painter.begin(&writer)) return false;
+	painter.scale(scale, scale);
+	painter.drawPicture(0, 0, strip);
+	return painter.end();
+}
+
+/**
+ * Writes the strip of one kanji of a batch into a file.
+ */
+class StrokeOrderStripJob : public QRunnable
+{
+private:
+	ConstKanjidic2EntryPointer _kanji;
+	KanjiRenderer::RenderStyle _style;
+	QColor _highlightColor;
+	int _framesPerRow;
+	QString _file;
+	StrokeOrderStrips::Format _format;
+	int _frameSize;
+	QAtomicInt *_failures;
+
+public:
+	StrokeOrderStripJob(const ConstKanjidic2EntryPointer &kanji, const KanjiRenderer::RenderStyle &style, const QColor &highlightColor, int framesPerRow, const QString &file, StrokeOrderStrips::Format format, int frameSize, QAtomicInt *failures) : _kanji(kanji), _style(style), _highlightColor(highlightColor), _framesPerRow(framesPerRow), _file(file), _format(format), _frameSize(frameSize), _failures(failures) {}
+
+	virtual void run()
+	{
+		if (!StrokeOrderStrips::write(_kanji, _file, _format, _frameSize, _style, _highlightColor, _framesPerRow)) {
+			qWarning("Cannot write stroke order file %s", _file.toLocal8Bit().constData());
+			_failures->ref();
+		}
+	}
+};
+
+bool StrokeOrderStrips::writeAll(const QList<ConstKanjidic2EntryPointer> &kanjis, const QString &dir, Format format, int frameSize, const KanjiRenderer::RenderStyle &style, const QColor &highlightColor, int framesPerRow)
+{
+	QDir outDir(dir);
+	if (!outDir.mkpath(".")) return false;
+	QAtomicInt failures;
+	QThreadPool pool;
+	foreach (const ConstKanjidic2EntryPointer &kanji, kanjis)
+		pool.start(new StrokeOrderStripJob(kanji, style, highlightColor, framesPerRow, outDir.absoluteFilePath(fileName(kanji, format)), format, frameSize, &failures));
+	pool.waitForDone();
+	return failures.loadAcquire() == 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GUI_KANJIDIC2_STROKE_ORDER_STRIPS_H
+#define __GUI_KANJIDIC2_STROKE_ORDER_STRIPS_H
+
+#include "gui/kanjidic2/KanjiRenderer.h"
+
+#include <QList>
+#include <QPicture>
+#include <QSizeF>
+#include <QString>
+
+/**
+ * Renders the stroke order of kanjis as strips of frames, the n-th frame
+ * showing the n first strokes of the kanji with the last one highlighted.
+ * Frames are laid out from left to right in the kanji area coordinates,
+ * framesPerRow by row, or all in a single row if framesPerRow is 0.
+ *
+ * Batches of kanjis are written in parallel on a thread pool, from the
+ * compiled stroke paths of the kanjis.
+ */
+class StrokeOrderStrips
+{
+public:
+	typedef enum { PNG, SVG, PDF } Format;
+
+	/// Size of the strip of kanji, in the kanji area coordinates
+	static QSizeF stripSize(const ConstKanjidic2EntryPointer &kanji, int framesPerRow = 0);
+	/**
+	 * Renders the strip of kanji. Can be called from any thread, e.g. by
+	 * the threads of a print job. Returns an empty picture if the strokes
+	 * of kanji are unknown.
+	 */
+	static QPicture render(const ConstKanjidic2EntryPointer &kanji, const KanjiRenderer::RenderStyle &style = KanjiRenderer::RenderStyle(), const QColor &highlightColor = Qt::red, int framesPerRow = 0);
+	/// Returns the strip of kanji as a SVG document
+	static QString renderSvg(const ConstKanjidic2EntryPointer &kanji, const KanjiRenderer::RenderStyle &style = KanjiRenderer::RenderStyle(), const QColor &highlightColor = Qt::red, int framesPerRow = 0);
+
+	/**
+	 * Writes the strips of kanjis into dir in parallel, named after the
+	 * code point of the kanjis like the KanjiVG files. PNG images use
+	 * frameSize pixels per frame, PDF documents frameSize points. Kanjis
+	 * without strokes are skipped. Returns false if a file could not be
+	 * written.
+	 */
+	static bool writeAll(const QList<ConstKanjidic2EntryPointer> &kanjis, const QString &dir, Format format, int frameSize = 109, const KanjiRenderer::RenderStyle &style = KanjiRenderer::RenderStyle(), const QColor &highlightColor = Qt::red, int framesPerRow = 0);
+	/// Writes the strip of kanji into file, see writeAll()
+	static bool write(const ConstKanjidic2EntryPointer &kanji, const QString &file, Format format, int frameSize = 109, const KanjiRenderer::RenderStyle &style = KanjiRenderer::RenderStyle(), const QColor &highlightColor = Qt::red, int framesPerRow = 0);
+	/// File name of the strip of kanji in format
+	static QString fileName(const ConstKanjidic2EntryPointer &kanji, Format format);
+};
+
+#endif
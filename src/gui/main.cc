@@ -23,19 +23,31 @@
 #include "core/Database.h"
 #include "core/Tag.h"
 #include "core/EntryListCache.h"
+#include "core/ASyncQuery.h"
 #include "core/Entry.h"
 #include "core/EntriesCache.h"
+#include "core/TrainingTrace.h"
+#include "core/StartupTrace.h"
+#include "core/PerfCounters.h"
+#include "core/Tracer.h"
+#include "core/MemoryUsage.h"
+#include "core/DictionaryWarmer.h"
+#include "core/DatabaseVerifier.h"
 #include "core/Plugin.h"
 #include "core/jmdict/JMdictPlugin.h"
 #include "core/kanjidic2/Kanjidic2Plugin.h"
-//#include "core/tatoeba/TatoebaPlugin.h"
+#include "core/kanjidic2/KanjiRadicals.h"
+#include "core/tatoeba/TatoebaPlugin.h"
 #include "gui/PreferencesWindow.h"
+#include "gui/DictionaryDownloader.h"
+#include "gui/SingleInstance.h"
 #include "gui/MainWindow.h"
 
 #include "core/jmdict/JMdictPlugin.h"
 #include "core/kanjidic2/Kanjidic2Plugin.h"
 #include "gui/jmdict/JMdictGUIPlugin.h"
 #include "gui/kanjidic2/Kanjidic2GUIPlugin.h"
+#include "gui/kanjidic2/KanjiRenderer.h"
 
 // Required for exit()
 #include <stdlib.h>
@@ -46,9 +58,11 @@
 #include <QTranslator>
 #include <QLocale>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QLibraryInfo>
 #include <QtGlobal>
 #include <QRandomGenerator>
+#include <QPixmapCache>
 
 // The version must be defined by the compiler
 #ifndef VERSION
@@ -88,6 +102,35 @@ void messageHandler(QtMsgType type, const QMessageLogContext& context, const QSt
 	}
 }
 
+/**
+ * Shows the progress of the upgrade of the user database, which can take
+ * a while for large databases.
+ */
+static void userDBUpgradeProgress(int done, int total)
+{
+	static QProgressDialog *progress = 0;
+	if (!progress) {
+		progress = new QProgressDialog(QCoreApplication::translate("main", "Upgrading user database..."), QString(), 0, total);
+		progress->setWindowTitle("Tagaini Jisho");
+		progress->setWindowModality(Qt::ApplicationModal);
+		progress->setMinimumDuration(0);
+	}
+	progress->setValue(done);
+	if (done == total) {
+		delete progress;
+		progress = 0;
+	}
+}
+
+/**
+ * Reports the problems found by the background verification of the
+ * databases.
+ */
+static void databasesCorrupted(const QStringList &errors)
+{
+	QMessageBox::warning(0, "Tagaini Jisho warning", QCoreApplication::translate("main", "Problems have been found in the databases. Your user data may be damaged: please restore it from a backup or recreate it from the preferences.") + "<p>" + errors.join("<p>"));
+}
+
 /**
  * Used to keep track of the configuration version format. This is useful
  * to update configuration options that have changed or to remove obsolete
@@ -166,6 +209,26 @@ static void copyQt4UserDB()
  * Check if a user DB directory is defined in the application settings, and
  * create a default one in case it doesn't exist.
  */
+/// Qt does not tell how much of the pixmap cache is used, only its limit
+static qint64 pixmapCacheLimit()
+{
+	return QPixmapCache::cacheLimit() * Q_INT64_C(1024);
+}
+
+static void clearPixmapCache()
+{
+	QPixmapCache::clear();
+}
+
+/// Adds the caches of the GUI to the memory accounting and starts it
+static void startMemoryMonitoring()
+{
+	MemoryUsage::addSource("Pixmap cache limit", MemoryUsage::IncludedBytes, &pixmapCacheLimit, &clearPixmapCache);
+	MemoryUsage::addSource("Kanji renderings", MemoryUsage::Bytes, &KanjiRenderer::cacheMemory, &KanjiRenderer::clearCaches);
+	MemoryUsage::addSource("Detailed view documents", MemoryUsage::Bytes, &DetailedView::documentsMemory, &DetailedViewJobRunner::clearResults);
+	MemoryUsage::startMonitoring();
+}
+
 static void checkUserProfileDirectory()
 {
 	// Set the user profile location
@@ -208,10 +271,39 @@ int main(int argc, char *argv[])
 	// Install the error message handler now that we have a GUI
 	qInstallMessageHandler(messageHandler);
 
+	QStringList args(app.arguments());
+
+	// Report the time taken by each of the following steps if asked to
+	StartupTrace::start(args.contains("--trace-startup"));
+
+	StartupTrace::beginPhase("Configuration");
 	checkConfigurationVersion();
 
+	StartupTrace::beginPhase("User profile directory");
 	checkUserProfileDirectory();
 
+	// A search given on the command line is handed over to the instance
+	// already running on this profile, if any, which answers right away
+	QString search;
+	QString profile;
+	foreach (const QString &arg, args.mid(1)) {
+		if (arg.startsWith("--search=")) search = arg.mid(9);
+		else if (arg.startsWith("--profile=")) profile = arg.mid(10);
+		else if (!arg.startsWith('-') && search.isEmpty()) search = arg;
+	}
+	if (!search.isEmpty() && SingleInstance::forward(search, profile)) return 0;
+
+	// Switch to the dictionaries downloaded during the last run before
+	// anything opens them
+	foreach (const QString &file, installPendingFiles()) qDebug("Installed updated %s", file.toLocal8Bit().constData());
+
+	// Collect performance counters if asked to, which also shows the
+	// Performance page of the preferences
+	PerfCounters::setEnabled(PerfCounters::collect.value() || args.contains("--perf-counters"));
+	// Trace the stages of searches and display, which also adds a Debug
+	// menu to export the trace
+	Tracer::setEnabled(args.contains("--trace"));
+
 	// Get the default font from the settings, if set
 	if (!MainWindow::applicationFont.value().isEmpty()) {
 		QFont font;
@@ -220,6 +312,7 @@ int main(int argc, char *argv[])
 	}
 
 	// Load translations, if available
+	StartupTrace::beginPhase("Translations");
 	QString locale;
 	// First check if the language is user-set
 	if (!Lang::preferredGUILanguage.isDefault()) {
@@ -248,17 +341,22 @@ int main(int argc, char *argv[])
 
 	// Register meta-types
 	qRegisterMetaType<EntryRef>("EntryRef");
+	qRegisterMetaType<QVector<EntryRef> >("QVector<EntryRef>");
 	qRegisterMetaType<EntryPointer>("EntryPointer");
 	qRegisterMetaType<ConstEntryPointer>("ConstEntryPointer");
 	qRegisterMetaType<QVariant>("QVariant");
 
+	// The entities tables of JMdict only depend on its database file, so
+	// load them while the user database and the other plugins are set up
+	JMdictPlugin::preloadEntities();
+
 	// Ensure the EntriesCache is instanciated in the main thread - that way we won't have to switch
 	// threads every time an Entry is deleted
+	StartupTrace::beginPhase("Entries cache");
 	EntriesCache::init();
 
-	QStringList args(app.arguments());
-
 	// Start database thread
+	StartupTrace::beginPhase("User database");
 	bool temporaryDB = false;
 	QString userDBFile;
 	foreach (const QString &arg, args) {
@@ -266,7 +364,8 @@ int main(int argc, char *argv[])
 		else if (arg.startsWith("--user-db=")) userDBFile = arg.mid(10);
 	}
 	QStringList dbErrors;
-	if (!Database::init(userDBFile, temporaryDB, dbErrors)) {
+	Database::setUpgradeHandler(&userDBUpgradeProgress);
+	if (!Database::init(userDBFile, temporaryDB, dbErrors, profile)) {
 		QMessageBox::critical(0, "Tagaini Jisho fatal error", dbErrors.join("<p>"));
 		qFatal("All database fallbacks failed, exiting...");
 	} else if (!dbErrors.empty()) {
@@ -274,23 +373,34 @@ int main(int argc, char *argv[])
 	}
 
 	// Initialize tags
+	StartupTrace::beginPhase("Tags");
 	Tag::init();
 
 	// Register core plugins
 	Plugin *kanjidic2Plugin = new Kanjidic2Plugin();
 	Plugin *jmdictPlugin = new JMdictPlugin();
-	//Plugin *tatoebaPlugin = new TatoebaPlugin();
+	Plugin *tatoebaPlugin = new TatoebaPlugin();
+	StartupTrace::beginPhase("Kanjidic2 plugin");
 	if (!Plugin::registerPlugin(kanjidic2Plugin))
 		qFatal("Error registering kanjidic2 plugin!");
+	StartupTrace::beginPhase("JMdict plugin");
 	if (!Plugin::registerPlugin(jmdictPlugin))
 		qFatal("Error registering JMdict plugin!");
-	//if (!Plugin::registerPlugin(tatoebaPlugin))
-		//qFatal("Error registering Tatoeba plugin!");
+	// Example sentences are optional
+	StartupTrace::beginPhase("Tatoeba plugin");
+	if (!Plugin::registerPlugin(tatoebaPlugin))
+		qWarning("Tatoeba plugin not registered, example sentences will not be available");
+
+	// All the dictionaries are attached now, so the radicals table can be
+	// loaded from another connection while the GUI is built
+	KanjiRadicals::preload();
 
 	// Create the main window
+	StartupTrace::beginPhase("Main window");
 	MainWindow *mainWindow = new MainWindow();
 
 	// Register GUI plugins
+	StartupTrace::beginPhase("GUI plugins");
 	Plugin *kanjidic2GUIPlugin = new Kanjidic2GUIPlugin();
 	Plugin *jmdictGUIPlugin = new JMdictGUIPlugin();
 	if (!Plugin::registerPlugin(jmdictGUIPlugin))
@@ -298,11 +408,29 @@ int main(int argc, char *argv[])
 	if (!Plugin::registerPlugin(kanjidic2GUIPlugin))
 		qFatal("Error registering kanjidic2 GUI plugin!");
 
+	StartupTrace::beginPhase("Main window state");
 	mainWindow->restoreWholeState();
+	startMemoryMonitoring();
 
 	// Show the main window and run the program
+	StartupTrace::beginPhase("Main window show");
 	mainWindow->show();
+	SingleInstance singleInstance;
+	QObject::connect(&singleInstance, SIGNAL(searchRequested(const QString &)), mainWindow, SLOT(searchFor(const QString &)));
+	singleInstance.listen(Database::currentProfile());
+	if (!search.isEmpty()) mainWindow->searchFor(search);
+	StartupTrace::endPhase();
+	StartupTrace::markWhenIdle("Main window displayed");
+	// Reload the entries that were cached when we last exited
+	EntriesCache::warmUp();
+	// Read the dictionary indexes while the user is idle
+	DictionaryWarmer::startWarming(&app);
+	// Only the versions of the databases have been checked so far
+	DatabaseVerifier::startVerification(&databasesCorrupted);
 	int ret = app.exec();
+	DatabaseVerifier::stopVerification();
+	DictionaryWarmer::stopWarming();
+	DictionaryDownloader::stopDownload();
 
 	// Remove GUI plugins
 	Plugin::removePlugin("kanjidic2GUI");
@@ -312,8 +440,11 @@ int main(int argc, char *argv[])
 	// GUI thread
 	delete mainWindow;
 
+	// The warm-up of the cache still uses the loaders of the core plugins
+	EntriesCache::stopLoading();
+
 	// Remove core plugins
-	//Plugin::removePlugin("Tatoeba");
+	Plugin::removePlugin("Tatoeba");
 	Plugin::removePlugin("JMdict");
 	Plugin::removePlugin("kanjidic2");
 
@@ -321,17 +452,24 @@ int main(int argc, char *argv[])
 	// in a background thread
 	delete jmdictGUIPlugin;
 	delete kanjidic2GUIPlugin;
+	delete tatoebaPlugin;
 	delete jmdictPlugin;
 	delete kanjidic2Plugin;
 
 	Tag::cleanup();
+	TrainingTrace::cleanup();
 	EntryListCache::cleanup();
+	DatabaseThreadPool::cleanup();
+
+	EntriesCache::saveSnapshot();
 
 	// Free database resources
 	Database::stop();
 
 	// Clean the entries cache
 	EntriesCache::cleanup();
+	// Last, as the warm-up of the cache reports to it
+	StartupTrace::cleanup();
 
 	return ret;
 }
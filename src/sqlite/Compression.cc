@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlite/Compression.h"
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include <QVector>
+#include <QtDebug>
+
+using namespace SQLite;
+
+CompressionDictionary::CompressionDictionary() : _level(19), _cctx(0), _dctx(0), _cdict(0), _ddict(0)
+{
+}
+
+CompressionDictionary::~CompressionDictionary()
+{
+	clear();
+	if (_cctx) ZSTD_freeCCtx(_cctx);
+	if (_dctx) ZSTD_freeDCtx(_dctx);
+}
+
+void CompressionDictionary::clear()
+{
+	if (_cdict) ZSTD_freeCDict(_cdict);
+	if (_ddict) ZSTD_freeDDict(_ddict);
+	_cdict = 0;
+	_ddict = 0;
+	_dict.clear();
+}
+
+bool CompressionDictionary::setDictionary(const QByteArray &dict, int level)
+{
+	clear();
+	if (dict.isEmpty()) return false;
+	_ddict = ZSTD_createDDict(dict.constData(), dict.size());
+	if (!_ddict) {
+		qWarning("Invalid compression dictionary");
+		return false;
+	}
+	_dict = dict;
+	_level = level;
+	return true;
+}
+
+QByteArray CompressionDictionary::compress(const QByteArray &data)
+{
+	if (!_ddict) return QByteArray();
+	// Only the database builders compress, so create the compression
+	// dictionary lazily
+	if (!_cdict) _cdict = ZSTD_createCDict(_dict.constData(), _dict.size(), _level);
+	if (!_cctx) _cctx = ZSTD_createCCtx();
+	if (!_cdict || !_cctx) return QByteArray();
+
+	QByteArray ret((int)ZSTD_compressBound(data.size()), 0);
+	size_t size = ZSTD_compress_usingCDict(_cctx, ret.data(), ret.size(), data.constData(), data.size(), _cdict);
+	if (ZSTD_isError(size)) {
+		qWarning("zstd compression error: %s", ZSTD_getErrorName(size));
+		return QByteArray();
+	}
+	ret.resize(size);
+	return ret;
+}
+
+QByteArray CompressionDictionary::uncompress(const void *data, int size)
+{
+	if (!_ddict) return QByteArray();
+	unsigned long long contentSize = ZSTD_getFrameContentSize(data, size);
+	// Blobs are always written with their content size
+	if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize == ZSTD_CONTENTSIZE_ERROR) return QByteArray();
+	if (!_dctx) _dctx = ZSTD_createDCtx();
+	if (!_dctx) return QByteArray();
+
+	QByteArray ret((int)contentSize, 0);
+	size_t res = ZSTD_decompress_usingDDict(_dctx, ret.data(), ret.size(), data, size, _ddict);
+	if (ZSTD_isError(res)) {
+		qWarning("zstd decompression error: %s", ZSTD_getErrorName(res));
+		return QByteArray();
+	}
+	return ret;
+}
+
+QByteArray CompressionDictionary::uncompress(const QByteArray &data)
+{
+	return uncompress(data.constData(), data.size());
+}
+
+QByteArray CompressionDictionary::train(const QList<QByteArray> &samples, int maxSize)
+{
+	QByteArray buffer;
+	QVector<size_t> sizes;
+	sizes.reserve(samples.size());
+	foreach (const QByteArray &sample, samples) {
+		buffer.append(sample);
+		sizes << sample.size();
+	}
+
+	QByteArray dict(maxSize, 0);
+	size_t size = ZDICT_trainFromBuffer(dict.data(), dict.size(), buffer.constData(), sizes.constData(), sizes.size());
+	if (ZDICT_isError(size)) {
+		qWarning("Cannot train compression dictionary: %s", ZDICT_getErrorName(size));
+		return QByteArray();
+	}
+	dict.resize(size);
+	return dict;
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SQLITE_COMPRESSION_H
+#define __SQLITE_COMPRESSION_H
+
+#include <QByteArray>
+#include <QList>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace SQLite {
+
+/**
+ * zstd compressor using a dictionary shared by all the blobs of a table.
+ * Dictionary databases store many small blobs (e.g. the glosses of an entry)
+ * that compress poorly on their own; training a dictionary on the whole
+ * table and storing it alongside lets each blob only encode what is
+ * specific to it.
+ *
+ * Instances are not thread-safe since they keep their (de)compression
+ * contexts around between calls.
+ */
+class CompressionDictionary
+{
+private:
+	QByteArray _dict;
+	int _level;
+	ZSTD_CCtx_s *_cctx;
+	ZSTD_DCtx_s *_dctx;
+	ZSTD_CDict_s *_cdict;
+	ZSTD_DDict_s *_ddict;
+
+	void clear();
+
+	CompressionDictionary(const CompressionDictionary &);
+	CompressionDictionary &operator=(const CompressionDictionary &);
+
+public:
+	CompressionDictionary();
+	~CompressionDictionary();
+
+	/**
+	 * Sets the dictionary to use for subsequent calls to
+	 * compress() and uncompress(). Returns false if dict is not
+	 * a valid dictionary.
+	 */
+	bool setDictionary(const QByteArray &dict, int level = 19);
+	const QByteArray &dictionary() const { return _dict; }
+	bool isValid() const { return _ddict != 0; }
+
+	QByteArray compress(const QByteArray &data);
+	/**
+	 * Returns a null QByteArray if data could not be decompressed.
+	 */
+	QByteArray uncompress(const QByteArray &data);
+	QByteArray uncompress(const void *data, int size);
+
+	/**
+	 * Trains a dictionary of at most maxSize bytes from the given
+	 * samples. Returns a null QByteArray if training failed, e.g.
+	 * because there were not enough samples.
+	 */
+	static QByteArray train(const QList<QByteArray> &samples, int maxSize = 112640);
+};
+
+}
+
+#endif
@@ -22,10 +22,50 @@
 
 #include <QtDebug>
 #include <QMutexLocker>
+#include <QCache>
+#include <QUrl>
+
+namespace SQLite {
+
+/**
+ * LRU cache of prepared statements, keyed by their SQL text. Statements are
+ * taken out of the cache while they are in use, so two queries running the
+ * same SQL at the same time each get their own statement.
+ */
+class StatementCache
+{
+public:
+	class Entry
+	{
+	public:
+		sqlite3_stmt *stmt;
+		Entry(sqlite3_stmt *_stmt) : stmt(_stmt) {}
+		~Entry() { sqlite3_finalize(stmt); }
+	};
+
+	QMutex mutex;
+	QCache<QString, Entry> statements;
+	quint64 hits;
+	quint64 misses;
+
+	StatementCache(int size) : statements(size), hits(0), misses(0) {}
+};
+
+}
 
 using namespace SQLite;
 
-Connection::Connection() : _handler(0)
+#define DEFAULT_STATEMENT_CACHE_SIZE 64
+/// Page cache of BulkLoad connections, in KiB. Large enough for the index
+/// pages of the whole dictionaries being built
+#define BULK_LOAD_CACHE_SIZE (512 * 1024)
+
+// Dictionaries are read-only, so mapping them is safe and avoids copying
+// their pages into the page cache
+qint64 Connection::_mmapSize = 256 * 1024 * 1024;
+int Connection::_cacheSize = 4096;
+
+Connection::Connection() : _handler(0), _statements(0), _statementCacheSize(DEFAULT_STATEMENT_CACHE_SIZE)
 {
 #ifdef DEBUG_TRANSACTIONS
 	_tr_count = 0;
@@ -58,21 +98,41 @@ bool Connection::connect(const QString &dbFile, OpenFlags flags)
 	// Enable shared-cache mode
 	sqlite3_enable_shared_cache(1);
 
-	int res = sqlite3_open_v2(dbFile.toUtf8().data(), &_handler, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
+	int openFlags = SQLITE_OPEN_URI | (flags & ReadOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	// WAL only lets readers and writers run concurrently if they do not
+	// share their cache
+	if (flags & WAL) openFlags |= SQLITE_OPEN_PRIVATECACHE;
+	int res = sqlite3_open_v2(dbFile.toUtf8().data(), &_handler, openFlags, 0);
 	updateError();
 	if (res != SQLITE_OK) goto err;
 	// Enable extended error codes
 	sqlite3_extended_result_codes(_handler, 1);
 	// Set busy timeout to 20 seconds - this should be more than enough
 	sqlite3_busy_timeout(_handler, 20000);
+	_statements = new StatementCache(_statementCacheSize);
 	// Register our tokenizers (extensions can be handled by SQLite's auto mechanism, not tokenizers
 	// as they need the connection to be opened
 	sqlite3ext_register_tokenizers(_handler);
 	// Configure the connection
 	exec("pragma encoding=\"UTF-16le\"");
-	if (!(flags & JournalInFile)) exec("pragma journal_mode=MEMORY");
+	if (flags & BulkLoad) {
+		exec("pragma journal_mode=OFF");
+		exec("pragma synchronous=OFF");
+		exec("pragma temp_store=MEMORY");
+	}
+	else if (flags & WAL) {
+		exec("pragma journal_mode=WAL");
+		// Durable enough in WAL mode, and does not sync on every commit
+		exec("pragma synchronous=NORMAL");
+		exec("pragma wal_autocheckpoint=0");
+	}
+	else if (!(flags & JournalInFile)) exec("pragma journal_mode=MEMORY");
 	// Set read-uncommited mode so that read queries can not block
 	exec("pragma read_uncommitted=1");
+	// Set without a schema, so it also applies to databases attached later
+	exec(QString("pragma mmap_size=%1").arg(_mmapSize));
+	// Negative values are in KiB
+	exec(QString("pragma cache_size=-%1").arg(flags & BulkLoad ? BULK_LOAD_CACHE_SIZE : _cacheSize));
 
 	_dbFile = dbFile;
 	return true;
@@ -97,6 +157,12 @@ bool Connection::close()
 		return false;
 	}
 
+	// Cached statements would prevent the database from being closed
+#ifdef DEBUG_QUERIES
+	qDebug("Statements cache of connection %p: %llu hits, %llu misses", this, statementCacheHits(), statementCacheMisses());
+#endif
+	delete _statements;
+	_statements = 0;
 	int res = sqlite3_close(_handler);
 	if (res != SQLITE_OK) {
 		updateError();
@@ -109,13 +175,28 @@ bool Connection::close()
 	return true;
 }
 
-bool Connection::attach(const QString &dbFile, const QString &alias)
+bool Connection::attach(const QString &dbFile, const QString &alias, OpenFlags flags)
 {
-	return exec(QString("attach database '%1' as %2").arg(dbFile).arg(alias));
+	QString file(dbFile);
+	if (flags & ReadOnly) {
+		QUrl url(QUrl::fromLocalFile(dbFile));
+		url.setQuery("mode=ro&immutable=1");
+		file = url.toString(QUrl::FullyEncoded);
+	}
+	file.replace('\'', "''");
+	if (!exec(QString("attach database '%1' as %2").arg(file).arg(alias))) return false;
+	// Attached databases do not inherit the cache size of the main one
+	exec(QString("pragma %1.cache_size=-%2").arg(alias).arg(_cacheSize));
+	return true;
 }
 
 bool Connection::detach(const QString &alias)
 {
+	// Cached statements may refer to the detached database
+	if (_statements) {
+		QMutexLocker lock(&_statements->mutex);
+		_statements->statements.clear();
+	}
 	return exec(QString("detach database %1").arg(alias));
 }
 
@@ -124,11 +205,47 @@ const Error &Connection::lastError() const
 	return _lastError;
 }
 
+sqlite3_stmt *Connection::acquireStatement(const QString &statement)
+{
+	if (_statements) {
+		QMutexLocker lock(&_statements->mutex);
+		StatementCache::Entry *entry = _statements->statements.take(statement);
+		if (entry) {
+			++_statements->hits;
+			sqlite3_stmt *stmt = entry->stmt;
+			entry->stmt = 0;
+			delete entry;
+			return stmt;
+		}
+		++_statements->misses;
+	}
+
+	sqlite3_stmt *stmt = 0;
+	// Busy loop while the shared cache is locked. This is ugly.
+	while (sqlite3_prepare_v2(_handler, statement.toUtf8().data(), -1, &stmt, 0) == SQLITE_LOCKED_SHAREDCACHE){};
+	return stmt;
+}
+
+void Connection::releaseStatement(const QString &statement, sqlite3_stmt *stmt)
+{
+	if (!stmt) return;
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if (_statements) {
+		QMutexLocker lock(&_statements->mutex);
+		// Replaces (and finalizes) any statement with the same SQL
+		if (_statements->statements.maxCost() > 0) {
+			_statements->statements.insert(statement, new StatementCache::Entry(stmt));
+			return;
+		}
+	}
+	sqlite3_finalize(stmt);
+}
+
 bool Connection::exec(const QString &statement)
 {
-	sqlite3_stmt *stmt;
-	int res = sqlite3_prepare_v2(_handler, statement.toUtf8().data(), -1, &stmt, 0);
-	if (res != SQLITE_OK) {
+	sqlite3_stmt *stmt = acquireStatement(statement);
+	if (!stmt) {
 		updateError();
 #ifdef DEBUG_QUERIES
 	       if (_lastError.isError())
@@ -136,9 +253,9 @@ bool Connection::exec(const QString &statement)
 #endif
 		return false;
 	}
-	res = sqlite3_step(stmt);
+	sqlite3_step(stmt);
 	updateError();
-	sqlite3_finalize(stmt);
+	releaseStatement(statement, stmt);
 	return !_lastError.isError();
 }
 
@@ -174,7 +291,88 @@ bool Connection::rollback()
 	return res;
 }
 
+Transaction::Transaction(Connection *connection) : _connection(connection), _active(connection->transaction())
+{
+}
+
+Transaction::~Transaction()
+{
+	rollback();
+}
+
+bool Transaction::commit()
+{
+	if (!_active) return false;
+	if (!_connection->commit()) {
+		rollback();
+		return false;
+	}
+	_active = false;
+	return true;
+}
+
+void Transaction::rollback()
+{
+	if (!_active) return;
+	_connection->rollback();
+	_active = false;
+}
+
+bool Connection::checkpoint(bool truncate)
+{
+	int res = sqlite3_wal_checkpoint_v2(_handler, 0, truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE, 0, 0);
+	updateError();
+	// A busy database is expected for passive checkpoints
+	return res == SQLITE_OK || (!truncate && res == SQLITE_BUSY);
+}
+
 void Connection::interrupt()
 {
 	sqlite3_interrupt(_handler);
 }
+
+void Connection::setStatementCacheSize(int size)
+{
+	_statementCacheSize = size;
+	if (_statements) {
+		QMutexLocker lock(&_statements->mutex);
+		_statements->statements.setMaxCost(size);
+	}
+}
+
+int Connection::statementCacheSize() const
+{
+	return _statementCacheSize;
+}
+
+quint64 Connection::statementCacheHits() const
+{
+	return _statements ? _statements->hits : 0;
+}
+
+quint64 Connection::statementCacheMisses() const
+{
+	return _statements ? _statements->misses : 0;
+}
+
+qint64 Connection::memoryUsed() const
+{
+	if (!_handler) return 0;
+	static const int ops[] = { SQLITE_DBSTATUS_CACHE_USED, SQLITE_DBSTATUS_SCHEMA_USED, SQLITE_DBSTATUS_STMT_USED };
+	qint64 ret = 0;
+	for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		int current = 0, highwater = 0;
+		if (sqlite3_db_status(_handler, ops[i], &current, &highwater, 0) == SQLITE_OK) ret += current;
+	}
+	return ret;
+}
+
+void Connection::releaseMemory()
+{
+	if (_handler) sqlite3_db_release_memory(_handler);
+}
+
+qint64 Connection::totalMemoryUsed()
+{
+	return sqlite3_memory_used();
+}
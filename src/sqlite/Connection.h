@@ -26,8 +26,11 @@
 #include <QList>
 
 struct sqlite3;
+struct sqlite3_stmt;
 namespace SQLite {
 
+class StatementCache;
+
 class Connection
 {
 friend class Error;
@@ -38,9 +41,28 @@ private:
 	mutable Error _lastError;
 
 	QList<Query> _queries;
+	/// Only allocated while connected, so unconnected instances can be copied
+	StatementCache *_statements;
+	int _statementCacheSize;
+
+	static qint64 _mmapSize;
+	static int _cacheSize;
 
 	const Error &updateError() const;
 
+	/**
+	 * Returns a prepared statement for the given SQL text, either from the
+	 * statements cache or freshly prepared. Returns 0 in case of error.
+	 * The statement belongs to the caller until it is given back using
+	 * releaseStatement().
+	 */
+	sqlite3_stmt *acquireStatement(const QString &statement);
+	/**
+	 * Resets stmt and keeps it in the statements cache for later reuse
+	 * (or finalizes it if it cannot be cached).
+	 */
+	void releaseStatement(const QString &statement, sqlite3_stmt *stmt);
+
 #ifdef DEBUG_TRANSACTIONS
 	int _tr_count;
 #endif
@@ -49,7 +71,18 @@ public:
 	Connection();
 	~Connection();
 
-	typedef enum { None = 0, JournalInFile = (1 << 0), ReadOnly = (1 << 1) } OpenFlags;
+	/**
+	 * WAL opens the database with a write-ahead log and a private cache,
+	 * so readers and writers of other connections do not block each other.
+	 * Automatic checkpoints are disabled for such connections - the owner
+	 * of the database is expected to call checkpoint() regularly.
+	 *
+	 * BulkLoad is meant for the database builders: it disables the journal
+	 * and syncing, and uses a large cache kept in memory with temporary
+	 * tables. A crash or a rollback leaves the database corrupted, so only
+	 * use it for files that are rebuilt from scratch.
+	 */
+	typedef enum { None = 0, JournalInFile = (1 << 0), ReadOnly = (1 << 1), WAL = (1 << 2), BulkLoad = (1 << 3) } OpenFlags;
 	/**
 	 * Connect to the database file given as parameter. Returns true in case
 	 * of success, false otherwise.
@@ -65,8 +98,13 @@ public:
 	/**
 	 * Attach the database file given as parameter to alias. Returns true
 	 * in case of success, false otherwise.
+	 *
+	 * If flags contains ReadOnly, the file is attached read-only and
+	 * flagged as immutable, so SQLite does not need to lock it nor check
+	 * whether it has changed. Only use this for files that are never
+	 * written to while they are attached, like the dictionaries.
 	 */
-	bool attach(const QString &dbFile, const QString &alias);
+	bool attach(const QString &dbFile, const QString &alias, OpenFlags flags = None);
 
 	/**
 	 * Detach the previously attached database alias.
@@ -88,11 +126,83 @@ public:
 	bool commit();
 	bool rollback();
 
+	/**
+	 * Checkpoints the write-ahead log of a WAL database. A passive
+	 * checkpoint never waits for other connections and does as much as it
+	 * can; if truncate is true, waits for readers and writers to be done
+	 * and truncates the log afterwards.
+	 */
+	bool checkpoint(bool truncate = false);
+
 	/**
 	 * Interrupts all queries being executed on this connection.
 	 * Interrupted queries will return SQLITE_INTERRUPT.
 	 */
 	void interrupt();
+
+	/**
+	 * Sets the amount of memory-mapped I/O, in bytes, used by connections
+	 * opened after this call. 0 disables memory-mapping.
+	 */
+	static void setMmapSize(qint64 size) { _mmapSize = size; }
+	static qint64 mmapSize() { return _mmapSize; }
+	/**
+	 * Sets the size of the page cache, in KiB, given to each database
+	 * opened or attached after this call.
+	 */
+	static void setCacheSize(int size) { _cacheSize = size; }
+	static int cacheSize() { return _cacheSize; }
+
+	/**
+	 * Sets the maximum number of prepared statements kept around by
+	 * this connection. 0 disables the cache.
+	 */
+	void setStatementCacheSize(int size);
+	int statementCacheSize() const;
+	/// Number of statements that could be reused from the cache
+	quint64 statementCacheHits() const;
+	/// Number of statements that had to be prepared
+	quint64 statementCacheMisses() const;
+
+	/**
+	 * Memory used by this connection for its page cache, schema and
+	 * prepared statements, in bytes.
+	 */
+	qint64 memoryUsed() const;
+	/// Frees as much of the page cache of this connection as possible
+	void releaseMemory();
+	/// Memory currently allocated by SQLite for all connections, in bytes
+	static qint64 totalMemoryUsed();
+};
+
+/**
+ * Transaction scope on a connection: the transaction is started by the
+ * constructor and rolled back by the destructor unless commit() succeeded,
+ * so that early returns never leave the database half-changed. What was
+ * read from the database into memory is not rolled back though. Scopes
+ * can be nested since transactions are savepoints.
+ */
+class Transaction
+{
+private:
+	Connection *_connection;
+	bool _active;
+
+	Transaction(const Transaction &);
+	Transaction &operator=(const Transaction &);
+
+public:
+	Transaction(Connection *connection);
+	~Transaction();
+
+	/// Returns false if the transaction could not be started
+	bool isActive() const { return _active; }
+	/**
+	 * Commits the transaction. If this fails, the transaction is rolled
+	 * back and false is returned.
+	 */
+	bool commit();
+	void rollback();
 };
 
 }
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlite/FTS.h"
+#include "sqlite/Connection.h"
+#include "sqlite/Query.h"
+
+namespace SQLite {
+namespace FTS {
+
+QString createTableStatement(Version version, const QString &table, Tokenizer tokenizer, Usage usage)
+{
+	if (version == FTS5) {
+		// The ascii tokenizer splits text like the FTS4 simple one
+		QString options(QString("tokenize='%1'").arg(tokenizer == Katakana ? "katakana" : "ascii"));
+		// Prefixes are indexed up to the length most searches are typed
+		// to before their results settle
+		options += ", prefix='1 2 3'";
+		// Readings are single words, phrase queries need the positions
+		// of the free text
+		if (usage == Readings) options += ", detail=column";
+		return QString("create virtual table %1 using fts5(reading, %2)").arg(table).arg(options);
+	}
+	return QString("create virtual table %1 using fts4(reading%2)").arg(table).arg(tokenizer == Katakana ? ", TOKENIZE katakana" : "");
+}
+
+QString createTermsTableStatement(Version version, const QString &table, const QString &ftsTable)
+{
+	if (version == FTS5) return QString("create virtual table %1 using fts5vocab(%2, 'row')").arg(table).arg(ftsTable);
+	return QString("create virtual table %1 using fts4aux(%2)").arg(table).arg(ftsTable);
+}
+
+QString termsCondition(Version version)
+{
+	// fts4aux also has a row per term and column
+	return version == FTS5 ? "1" : "col = '*'";
+}
+
+QString docsizeIdColumn(Version version)
+{
+	return version == FTS5 ? "id" : "docid";
+}
+
+QString segmentsTable(Version version, const QString &ftsTable)
+{
+	return ftsTable + (version == FTS5 ? "_data" : "_segments");
+}
+
+QString segmentsKeyColumn(Version version)
+{
+	return version == FTS5 ? "id" : "blockid";
+}
+
+QString phrase(const QString &text)
+{
+	QString escaped(text);
+	escaped.replace('"', "\"\"");
+	return "\"" + escaped + "\"";
+}
+
+QString prefixPhrase(Version version, const QString &prefix)
+{
+	QString escaped(prefix);
+	escaped.replace('"', "\"\"");
+	if (version == FTS5) return "\"" + escaped + "\" *";
+	return "\"" + escaped + "*\"";
+}
+
+Version databaseVersion(Connection &connection, const QString &alias)
+{
+	SQLite::Query query(&connection);
+	if (!query.exec(QString("select count(*) from %1.sqlite_master where type = 'table' and sql like '%using fts5%'").arg(alias)) || !query.next()) return FTS4;
+	return query.valueInt(0) > 0 ? FTS5 : FTS4;
+}
+
+}
+}
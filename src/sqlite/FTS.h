@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2008  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SQLITE_FTS_H
+#define __SQLITE_FTS_H
+
+#include <QString>
+
+namespace SQLite {
+
+class Connection;
+
+/**
+ * Helpers for the full-text indexes of the dictionaries, which can be built
+ * either with FTS4 or with FTS5. Both versions of a database have the same
+ * tables; the FTS tables only differ by their creation statement and by the
+ * query syntax of prefix searches. They are always joined on their rowid,
+ * which FTS4 aliases to the docid.
+ */
+namespace FTS {
+	typedef enum { FTS4 = 4, FTS5 = 5 } Version;
+
+	/// Tokenizers of the FTS tables
+	typedef enum {
+		/// SQLite's simple tokenizer for FTS4, ascii for FTS5
+		Simple = 0,
+		/// See the katakana tokenizer of sqlite3ext.cc
+		Katakana
+	} Tokenizer;
+
+	/// How the FTS table is mostly searched
+	typedef enum {
+		/// Free text, which may be searched for phrases
+		Text = 0,
+		/// Single-word readings, searched by prefix as they are typed.
+		/// With FTS5, these get prefix indexes and do not store the
+		/// positions of their tokens
+		Readings
+	} Usage;
+
+	/**
+	 * Returns the statement creating the FTS table of the given name,
+	 * which single column is named reading.
+	 */
+	QString createTableStatement(Version version, const QString &table, Tokenizer tokenizer = Simple, Usage usage = Text);
+	/**
+	 * Returns the statement creating a table listing the terms of the FTS
+	 * table ftsTable in its term column. Only its rows matching
+	 * termsCondition() give each term once.
+	 */
+	QString createTermsTableStatement(Version version, const QString &table, const QString &ftsTable);
+	QString termsCondition(Version version);
+	/// Name of the column giving the rowids in the docsize table of an
+	/// FTS table
+	QString docsizeIdColumn(Version version);
+	/// Shadow table holding the index of an FTS table in its block
+	/// column, and the column ordering it
+	QString segmentsTable(Version version, const QString &ftsTable);
+	QString segmentsKeyColumn(Version version);
+
+	/// Returns the MATCH expression of a phrase
+	QString phrase(const QString &text);
+	/// Returns the MATCH expression of the tokens starting with prefix
+	QString prefixPhrase(Version version, const QString &prefix);
+
+	/**
+	 * Returns the version of the FTS tables of the given database alias
+	 * (e.g. "main") of connection. The builders use the same version for
+	 * all the tables of a database. FTS4 is returned if it has no FTS5
+	 * table.
+	 */
+	Version databaseVersion(Connection &connection, const QString &alias);
+}
+
+}
+
+#endif
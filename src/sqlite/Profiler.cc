@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlite/Profiler.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QDateTime>
+#include <QtDebug>
+
+using namespace SQLite;
+
+bool QueryProfiler::_enabled = false;
+int QueryProfiler::_threshold = 50;
+QueryProfiler::TraceHandler QueryProfiler::_traceHandler = 0;
+
+static QMutex logMutex;
+static QFile *logFile = 0;
+
+QString QueryProfile::toString() const
+{
+	QString ret = QString("prepare %1us, first row %2us, step %3us, %4 rows, %5 full scan steps, %6 sorts, %7 autoindexes: %8").arg(prepareTime).arg(firstRowTime).arg(stepTime).arg(rows).arg(fullScanSteps).arg(sorts).arg(autoIndexes).arg(sql);
+	if (!plan.isEmpty()) ret += "\n" + plan;
+	return ret;
+}
+
+bool QueryProfiler::setLogFile(const QString &file)
+{
+	QMutexLocker lock(&logMutex);
+	delete logFile;
+	logFile = 0;
+	if (file.isEmpty()) return true;
+
+	logFile = new QFile(file);
+	if (!logFile->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		qWarning("Cannot open query profile log %s", file.toUtf8().constData());
+		delete logFile;
+		logFile = 0;
+		return false;
+	}
+	return true;
+}
+
+static void logLine(const QString &line)
+{
+	QMutexLocker lock(&logMutex);
+	if (logFile) {
+		QTextStream out(logFile);
+		out << QDateTime::currentDateTime().toString(Qt::ISODate) << " " << line << "\n";
+	}
+	else qDebug("%s", line.toUtf8().constData());
+}
+
+void QueryProfiler::record(const QueryProfile &profile)
+{
+	logLine(profile.toString());
+}
+
+void QueryProfiler::recordASync(const QString &sql, qint64 waitTime, qint64 totalTime, int rows)
+{
+	logLine(QString("async: queued %1ms, total %2ms, %3 results: %4").arg(waitTime).arg(totalTime).arg(rows).arg(sql));
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2010  Alexandre Courbot
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SQLITE_PROFILER_H
+#define __SQLITE_PROFILER_H
+
+#include <QString>
+
+namespace SQLite {
+
+/**
+ * Measures of one run of a query. Times are in microseconds.
+ */
+class QueryProfile
+{
+public:
+	QString sql;
+	/// Time spent preparing the statement, small if it came from the cache
+	qint64 prepareTime;
+	/// Time between the start of the run and the first result row
+	qint64 firstRowTime;
+	/// Total time spent stepping through the statement
+	qint64 stepTime;
+	int rows;
+	/// Number of calls to sqlite3_step()
+	int steps;
+	/// Values of the SQLITE_STMTSTATUS_* counters for this run
+	int fullScanSteps;
+	int sorts;
+	int autoIndexes;
+	/// Output of EXPLAIN QUERY PLAN, only set for slow queries
+	QString plan;
+
+	QueryProfile() : prepareTime(0), firstRowTime(-1), stepTime(0), rows(0), steps(0), fullScanSteps(0), sorts(0), autoIndexes(0) {}
+	qint64 totalTime() const { return prepareTime + stepTime; }
+	QString toString() const;
+};
+
+/**
+ * Opt-in instrumentation of queries. When enabled, every run of a Query
+ * is measured and logged, either to the file given to setLogFile() or
+ * through qDebug(). The query plan is also captured for queries that took
+ * longer than threshold() milliseconds.
+ *
+ * Profiling must be enabled or disabled before queries start running in
+ * other threads; recording is thread-safe.
+ */
+class QueryProfiler
+{
+public:
+	/**
+	 * Function receiving the duration of each prepare and step of the
+	 * queries, in nanoseconds, e.g. to record them in a trace.
+	 */
+	typedef void (*TraceHandler)(const char *stage, qint64 duration);
+
+private:
+	static bool _enabled;
+	static int _threshold;
+	static TraceHandler _traceHandler;
+
+public:
+	static bool enabled() { return _enabled; }
+	static void setEnabled(bool enabled) { _enabled = enabled; }
+	static int threshold() { return _threshold; }
+	static void setThreshold(int msecs) { _threshold = msecs; }
+	static TraceHandler traceHandler() { return _traceHandler; }
+	/// Sets the handler of prepare and step durations, 0 to disable it
+	static void setTraceHandler(TraceHandler handler) { _traceHandler = handler; }
+	/**
+	 * Sets the file profiles are appended to. An empty string logs
+	 * them through qDebug() instead. Returns false if the file cannot
+	 * be opened.
+	 */
+	static bool setLogFile(const QString &file);
+
+	static void record(const QueryProfile &profile);
+	/**
+	 * Records the run of an asynchronous query, as seen by its caller.
+	 * Times are in milliseconds.
+	 */
+	static void recordASync(const QString &sql, qint64 waitTime, qint64 totalTime, int rows);
+};
+
+}
+
+#endif
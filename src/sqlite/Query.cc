@@ -18,17 +18,20 @@
 #include "sqlite3.h"
 #include "sqlite/Query.h"
 #include "sqlite/Connection.h"
+#include "sqlite/Profiler.h"
 #include "tagaini_config.h"
 
 #include <QtDebug>
+#include <QStringList>
+#include <QHash>
 
 using namespace SQLite;
 
-Query::Query() : _stmt(0), _connection(0), _state(INVALID), _bindIndex(0)
+Query::Query() : _stmt(0), _connection(0), _state(INVALID), _bindIndex(0), _profile(0)
 {
 }
 
-Query::Query(Connection *connection) : _stmt(0)
+Query::Query(Connection *connection) : _stmt(0), _profile(0)
 {
 	useWith(connection);
 }
@@ -62,19 +65,70 @@ bool Query::prepare(const QString &statement)
 	if (!_connection) return false;
 	clear();
 
-	int res;
-	// Busy loop while the shared cache is locked. This is ugly.
-	while ((res = sqlite3_prepare_v2(_connection->_handler, statement.toUtf8().data(), -1, &_stmt, 0)) == SQLITE_LOCKED_SHAREDCACHE){};
-	_lastError = _connection->updateError();
-	checkQueryError(*this, statement);
-	if (res != SQLITE_OK) {
+	QueryProfiler::TraceHandler trace = QueryProfiler::traceHandler();
+	QElapsedTimer prepareTimer;
+	if (QueryProfiler::enabled() || trace) prepareTimer.start();
+	_stmt = _connection->acquireStatement(statement);
+	if (trace) trace("SQL prepare", prepareTimer.nsecsElapsed());
+	if (!_stmt) {
+		_lastError = _connection->updateError();
+		checkQueryError(*this, statement);
 		_state = ERROR;
 		return false;
 	}
+	// The statement may come from the cache, in which case the connection
+	// error is not related to it
+	_lastError = Error();
+	_sql = statement;
 	_state = PREPARED;
+	if (QueryProfiler::enabled()) {
+		_profile = new QueryProfile();
+		_profile->sql = statement;
+		_profile->prepareTime = prepareTimer.nsecsElapsed() / 1000;
+		// Cached statements keep the counters of their previous uses
+		sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+		sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_SORT, 1);
+		sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+	}
 	return true;
 }
 
+int Query::step()
+{
+	QueryProfiler::TraceHandler trace = QueryProfiler::traceHandler();
+	if (!_profile && !trace) return sqlite3_step(_stmt);
+
+	QElapsedTimer timer;
+	timer.start();
+	int res = sqlite3_step(_stmt);
+	qint64 elapsed = timer.nsecsElapsed();
+	if (trace) trace("SQL step", elapsed);
+	if (!_profile) return res;
+	_profile->stepTime += elapsed / 1000;
+	++_profile->steps;
+	if (res == SQLITE_ROW) {
+		if (_profile->firstRowTime == -1) _profile->firstRowTime = _profile->stepTime;
+		++_profile->rows;
+	}
+	return res;
+}
+
+void Query::endProfile()
+{
+	if (_profile->steps == 0) return;
+
+	_profile->fullScanSteps = sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+	_profile->sorts = sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_SORT, 1);
+	_profile->autoIndexes = sqlite3_stmt_status(_stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+	if (_profile->totalTime() >= (qint64)QueryProfiler::threshold() * 1000) _profile->plan = queryPlan();
+	QueryProfiler::record(*_profile);
+
+	// Further runs of the same statement are measured separately
+	QString sql(_profile->sql);
+	*_profile = QueryProfile();
+	_profile->sql = sql;
+}
+
 bool Query::checkBind(int &col)
 {
 	if (!_stmt) return false;
@@ -163,13 +217,14 @@ void Query::reset()
 	_lastError = _connection->updateError();
 	checkQueryError(*this, queryText());
 	_state = PREPARED;
+	if (_profile) endProfile();
 }
 
 bool Query::exec()
 {
 	if (_state != PREPARED) return false;
 	// Busy-loop while the shared cache is locked. This is ugly.
-	while (sqlite3_step(_stmt) == SQLITE_LOCKED_SHAREDCACHE){};
+	while (step() == SQLITE_LOCKED_SHAREDCACHE){};
 	_lastError = _connection->updateError();
 	checkQueryError(*this, queryText());
 	switch (_lastError.code()) {
@@ -192,7 +247,7 @@ bool Query::next()
 		_state = RUN;
 		return true;
 	case RUN:
-		sqlite3_step(_stmt);
+		step();
 		_lastError = _connection->updateError();
 		checkQueryError(*this, queryText());
 		switch (_lastError.code()) {
@@ -293,6 +348,44 @@ QByteArray Query::valueBlob(int column) const
 	return QByteArray((const char *)sqlite3_column_blob(_stmt, column), sqlite3_column_bytes(_stmt, column));
 }
 
+QStringView Query::valueStringView(int column) const
+{
+	const QChar *text = static_cast<const QChar *>(sqlite3_column_text16(_stmt, column));
+	// Must be called after sqlite3_column_text16 to get the UTF-16 size
+	int size = sqlite3_column_bytes16(_stmt, column) / sizeof(QChar);
+	return QStringView(text, size);
+}
+
+QByteArray Query::valueBlobRaw(int column) const
+{
+	const char *data = static_cast<const char *>(sqlite3_column_blob(_stmt, column));
+	return QByteArray::fromRawData(data, sqlite3_column_bytes(_stmt, column));
+}
+
+QVector<int> Query::valueIntList(int column, char sep) const
+{
+	QVector<int> ret;
+	const char *text = reinterpret_cast<const char *>(sqlite3_column_text(_stmt, column));
+	if (!text) return ret;
+
+	int val = 0;
+	bool inNumber = false, negative = false;
+	for (const char *c = text; ; c++) {
+		if (*c == sep || *c == 0) {
+			if (inNumber) ret << (negative ? -val : val);
+			if (*c == 0) break;
+			val = 0;
+			inNumber = negative = false;
+		}
+		else if (*c >= '0' && *c <= '9') {
+			val = val * 10 + (*c - '0');
+			inNumber = true;
+		}
+		else if (*c == '-' && !inNumber) negative = true;
+	}
+	return ret;
+}
+
 bool Query::valueIsNull(int column) const
 {
 	return valueType(column) == Null;
@@ -300,12 +393,16 @@ bool Query::valueIsNull(int column) const
 
 void Query::clear()
 {
+	if (_profile) {
+		if (_stmt) endProfile();
+		delete _profile;
+		_profile = 0;
+	}
 	if (_stmt) {
-		QString qtext = queryText();
-		sqlite3_finalize(_stmt);
-		_lastError = _connection->updateError();
-		checkQueryError(*this, qtext);
+		// Give the statement back for reuse
+		_connection->releaseStatement(_sql, _stmt);
 		_stmt = 0;
+		_sql.clear();
 	}
 	_state = INVALID;
 	_bindIndex = 0;
@@ -316,3 +413,25 @@ QString Query::queryText() const
 	if (_state >= PREPARED) return sqlite3_sql(_stmt);
 	else return QString();
 }
+
+QString Query::queryPlan() const
+{
+	if (!_stmt) return QString();
+
+	sqlite3_stmt *stmt;
+	QByteArray sql(("EXPLAIN QUERY PLAN " + _sql).toUtf8());
+	if (sqlite3_prepare_v2(_connection->_handler, sql.constData(), -1, &stmt, 0) != SQLITE_OK) return QString();
+
+	// Rows are (id, parent, notused, detail), and form a tree
+	QStringList lines;
+	QHash<int, int> depths;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		int id = sqlite3_column_int(stmt, 0);
+		int parent = sqlite3_column_int(stmt, 1);
+		int depth = depths.contains(parent) ? depths[parent] + 1 : 0;
+		depths[id] = depth;
+		lines << QString(depth * 2, ' ') + QString::fromUtf8((const char *)sqlite3_column_text(stmt, 3));
+	}
+	sqlite3_finalize(stmt);
+	return lines.join("\n");
+}
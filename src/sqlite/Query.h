@@ -20,11 +20,16 @@
 
 #include "sqlite/Error.h"
 
+#include <QStringView>
+#include <QVector>
+#include <QElapsedTimer>
+
 struct sqlite3_stmt;
 
 namespace SQLite {
 
 class Connection;
+class QueryProfile;
 
 typedef enum { None, Null, Integer, Float, String, Blob } Type;
 
@@ -37,16 +42,22 @@ class Query
 friend class Connection;
 private:
 	sqlite3_stmt *_stmt;
+	/// SQL text the statement was prepared from, used as cache key
+	QString _sql;
 	Connection *_connection;
 	Error _lastError;
 	enum { INVALID, ERROR, BLANK, PREPARED, RUN, FIRSTRES } _state;
 	quint8 _bindIndex;
+	/// Only allocated when QueryProfiler is enabled
+	QueryProfile *_profile;
 
 	/// Copy is forbidden
 	//Query &operator =(const Query &query);
 
 	bool checkBind(int &col);
 	bool checkBindRes();
+	int step();
+	void endProfile();
 
 public:
 	/**
@@ -95,10 +106,25 @@ public:
 	QByteArray valueBlob(int column) const;
 	bool valueIsNull(int column) const;
 
+	/**
+	 * Non-owning accessors. The returned data points directly into
+	 * SQLite's memory and is only valid until the next call to next(),
+	 * reset() or clear(). Copy it if it must live longer.
+	 */
+	QStringView valueStringView(int column) const;
+	QByteArray valueBlobRaw(int column) const;
+	/**
+	 * Parses a column made of integers separated by sep (e.g. "0,2,3")
+	 * without building any intermediate string. Empty fields are skipped.
+	 */
+	QVector<int> valueIntList(int column, char sep = ',') const;
+
 	void clear();
 
 	const Error &lastError() const { return _lastError; }
 	QString queryText() const;
+	/// Returns the output of EXPLAIN QUERY PLAN for the prepared statement
+	QString queryPlan() const;
 };
 
 }
@@ -22,9 +22,21 @@
 extern "C" {
 #endif
 
+/* Engines that can back the REGEXP function */
+typedef enum {
+	/* QRegExp, matching on katakana-converted text */
+	SQLITE3EXT_REGEXP_QREGEXP = 0,
+	/* JIT-compiled QRegularExpression (PCRE2) with kana-insensitive patterns */
+	SQLITE3EXT_REGEXP_PCRE = 1
+} sqlite3ext_regexp_engine;
+
 /* Register the callback that will automatically call register_functions
  * for every new SQLite connection */
 void sqlite3ext_init();
+/* Select the REGEXP engine used by connections opened from now on */
+void sqlite3ext_set_regexp_engine(sqlite3ext_regexp_engine engine);
+/* (Re-)register the REGEXP function of a connection with the given engine */
+int sqlite3ext_register_regexp(sqlite3 *handler, sqlite3ext_regexp_engine engine);
 /* Register all our custom functions */
 int sqlite3ext_register_functions(sqlite3 *handler);
 /* Register all our custom tokenizers */
@@ -19,24 +19,107 @@
 #include "sqlite/fts3_tokenizer.h"
 #include "core/TextTools.h"
 #include "sqlite/SQLite.h"
+#include "sqlite/Compression.h"
 
 #include <QSet>
+#include <QStringList>
 #include <QtDebug>
 #include <QRegExp>
+#include <QRegularExpression>
 #include <QRandomGenerator>
 #include <qrandom.h>
+#include <math.h>
 
 static QSet<QString> ignoredWords;
-static QByteArray kanasConverted;
+static sqlite3ext_regexp_engine regexpEngine = SQLITE3EXT_REGEXP_QREGEXP;
 
+static void regexpDelete(void *regexp)
+{
+	delete static_cast<QRegExp *>(regexp);
+}
+
+/**
+ * The pattern of a REGEXP expression is usually constant for the whole
+ * statement, so the compiled (and katakana-converted) expression is kept
+ * as auxiliary data of the pattern argument and only built once per
+ * statement instead of once per row.
+ */
 static void regexpFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
+	QRegExp *regexp = static_cast<QRegExp *>(sqlite3_get_auxdata(context, 0));
+	bool cached = regexp != 0;
+	if (!cached) {
+		regexp = new QRegExp(TextTools::hiragana2Katakana(QString::fromUtf8((const char *)sqlite3_value_text(argv[0]))));
+		regexp->setCaseSensitivity(Qt::CaseInsensitive);
+	}
+
 	const QString text(TextTools::hiragana2Katakana(QString::fromUtf8((const char *)sqlite3_value_text(argv[1]))));
-	QRegExp regexp = QRegExp(TextTools::hiragana2Katakana(QString::fromUtf8((const char *)sqlite3_value_text(argv[0]))));
-	regexp.setCaseSensitivity(Qt::CaseInsensitive);
+	bool res = text.contains(*regexp);
+	sqlite3_result_int(context, res);
+
+	// SQLite may destroy the auxiliary data at any time after it is set,
+	// so only hand it over once we are done using it
+	if (!cached) sqlite3_set_auxdata(context, 0, regexp, regexpDelete);
+}
+
+/**
+ * Turns every kana of the pattern into a class matching both its hiragana
+ * and katakana forms, so that the matched text does not need to be
+ * converted to katakana beforehand.
+ */
+static QString kanaInsensitivePattern(const QString &pattern)
+{
+	QString ret;
+	bool inClass = false;
+	for (int i = 0; i < pattern.size(); i++) {
+		const QChar c(pattern[i]);
+		// Escaped characters are kept as-is
+		if (c == '\\' && i < pattern.size() - 1) {
+			ret += c;
+			ret += pattern[++i];
+			continue;
+		}
+		if (c == '[') inClass = true;
+		else if (c == ']') inClass = false;
+
+		const QChar kata(TextTools::hiraganaChar2Katakana(c));
+		const QChar hira(kata.unicode() - 0x60);
+		if (!TextTools::isHiraganaChar(hira) || TextTools::hiraganaChar2Katakana(hira) != kata) {
+			ret += c;
+			continue;
+		}
+		if (!inClass) ret += '[';
+		ret += hira;
+		ret += kata;
+		if (!inClass) ret += ']';
+	}
+	return ret;
+}
+
+static void regexpPcreDelete(void *regexp)
+{
+	delete static_cast<QRegularExpression *>(regexp);
+}
+
+/**
+ * REGEXP implementation using a JIT-compiled QRegularExpression. Kana
+ * folding is handled by the pattern itself, so rows are only decoded
+ * from UTF-8 once and matched as-is.
+ */
+static void regexpPcreFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	QRegularExpression *regexp = static_cast<QRegularExpression *>(sqlite3_get_auxdata(context, 0));
+	bool cached = regexp != 0;
+	if (!cached) {
+		regexp = new QRegularExpression(kanaInsensitivePattern(QString::fromUtf8((const char *)sqlite3_value_text(argv[0]))), QRegularExpression::CaseInsensitiveOption | QRegularExpression::UseUnicodePropertiesOption);
+		regexp->optimize();
+	}
 
-	bool res = text.contains(regexp);
+	const char *text = (const char *)sqlite3_value_text(argv[1]);
+	bool res = text && regexp->match(QString::fromUtf8(text, sqlite3_value_bytes(argv[1]))).hasMatch();
 	sqlite3_result_int(context, res);
+
+	if (!cached) sqlite3_set_auxdata(context, 0, regexp, regexpPcreDelete);
 }
 
 /**
@@ -56,6 +139,50 @@ static void biased_random(sqlite3_context *context, int nParams, sqlite3_value *
 	sqlite3_result_int(context, res);
 }
 
+/**
+ * editdistance(a, b) returns the Levenshtein distance between a and b,
+ * ignoring the differences between hiragana and katakana. Meant to rank
+ * the few candidates of fuzzy searches, not to scan whole tables.
+ */
+static void edit_distance(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		sqlite3_result_null(context);
+		return;
+	}
+	const QString a(TextTools::hiragana2Katakana(QString::fromUtf8((const char *)sqlite3_value_text(argv[0]))));
+	const QString b(TextTools::hiragana2Katakana(QString::fromUtf8((const char *)sqlite3_value_text(argv[1]))));
+	sqlite3_result_int(context, TextTools::editDistance(a, b));
+}
+
+/**
+ * firstsenses(glosses, n) returns the first n senses of glosses as stored
+ * by the JMdict language databases (senses separated by empty lines,
+ * glosses by newlines), as one line: glosses are separated by commas and
+ * senses by semicolons. Senses without glosses are skipped, and all senses
+ * are returned if n is 0. Returns NULL if there are no glosses.
+ */
+static void first_senses(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_null(context);
+		return;
+	}
+	const QString text(QString::fromUtf8((const char *)sqlite3_value_text(argv[0]), sqlite3_value_bytes(argv[0])));
+	const int n = sqlite3_value_int(argv[1]);
+	QStringList senses;
+	foreach (const QString &sense, text.split("\n\n", QString::SkipEmptyParts)) {
+		if (n > 0 && senses.size() >= n) break;
+		senses << QString(sense).replace('\n', ", ");
+	}
+	if (senses.isEmpty()) {
+		sqlite3_result_null(context);
+		return;
+	}
+	const QByteArray res(senses.join("; ").toUtf8());
+	sqlite3_result_text(context, res.constData(), res.size(), SQLITE_TRANSIENT);
+}
+
 typedef struct {
 	QSet<int>* _set;
 } uniquecount_aggr;
@@ -78,6 +205,45 @@ static void uniquecount_aggr_finalize(sqlite3_context *context)
 	sqlite3_result_int(context, res);
 }
 
+/**
+ * ftsrank(matchinfo(table, 'pcnalx')) returns the Okapi BM25 relevance of
+ * a full-text match, the higher the more relevant. FTS4 does not provide
+ * any ranking function by itself.
+ */
+static void fts_rank(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	const double k1 = 1.2;
+	const double b = 0.75;
+	const quint32 *info = static_cast<const quint32 *>(sqlite3_value_blob(argv[0]));
+	int size = sqlite3_value_bytes(argv[0]) / sizeof(quint32);
+	if (!info || size < 3) {
+		sqlite3_result_null(context);
+		return;
+	}
+	quint32 nPhrases = info[0], nCols = info[1], nDocs = info[2];
+	const quint32 *avgLength = info + 3;
+	const quint32 *length = avgLength + nCols;
+	const quint32 *hits = length + nCols;
+	if (size < (int)(3 + 2 * nCols + 3 * nPhrases * nCols)) {
+		sqlite3_result_error(context, "ftsrank expects matchinfo 'pcnalx'", -1);
+		return;
+	}
+
+	double score = 0.0;
+	for (quint32 i = 0; i < nPhrases; i++) {
+		for (quint32 j = 0; j < nCols; j++) {
+			const quint32 *hit = hits + 3 * (i * nCols + j);
+			if (!hit[0]) continue;
+			// Terms found in most documents must still weigh a little
+			double idf = log((nDocs - hit[2] + 0.5) / (hit[2] + 0.5));
+			if (idf < 1e-6) idf = 1e-6;
+			double norm = avgLength[j] ? (double)length[j] / avgLength[j] : 1.0;
+			score += idf * (hit[0] * (k1 + 1)) / (hit[0] + k1 * (1 - b + b * norm));
+		}
+	}
+	sqlite3_result_double(context, score);
+}
+
 static void fts_compress(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
 	QByteArray text(reinterpret_cast<const char *>(sqlite3_value_text(argv[0])));
@@ -85,11 +251,66 @@ static void fts_compress(sqlite3_context *context, int argc, sqlite3_value **arg
 	sqlite3_result_blob(context, compressed.data(), compressed.length(), 0);
 }
 
+static void compressionDictionaryDelete(void *dict)
+{
+	delete static_cast<SQLite::CompressionDictionary *>(dict);
+}
+
+/**
+ * Loads the compression dictionary stored in the info table of the given
+ * database, or returns 0 if it cannot be loaded.
+ */
+static SQLite::CompressionDictionary *loadCompressionDictionary(sqlite3 *db, const char *schema)
+{
+	char *sql = sqlite3_mprintf("select glossesDict from \"%w\".info", schema);
+	sqlite3_stmt *stmt;
+	int res = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+	sqlite3_free(sql);
+	if (res != SQLITE_OK) return 0;
+	QByteArray dictData;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		dictData = QByteArray(static_cast<const char *>(sqlite3_column_blob(stmt, 0)), sqlite3_column_bytes(stmt, 0));
+	sqlite3_finalize(stmt);
+
+	SQLite::CompressionDictionary *dict = new SQLite::CompressionDictionary();
+	if (!dict->setDictionary(dictData)) {
+		delete dict;
+		return 0;
+	}
+	return dict;
+}
+
+/**
+ * ftsuncompress(blob) inflates a blob produced by qCompress.
+ * ftsuncompress(blob, 'db') decompresses a zstd blob using the dictionary
+ * stored in the info table of database db.
+ */
 static void fts_uncompress(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
-	QByteArray data(static_cast<const char *>(sqlite3_value_blob(argv[0])), sqlite3_value_bytes(argv[0]));
-	QByteArray text(qUncompress(data));
-	sqlite3_result_text(context, text.data(), text.size(), 0);
+	if (argc == 1) {
+		QByteArray data(static_cast<const char *>(sqlite3_value_blob(argv[0])), sqlite3_value_bytes(argv[0]));
+		QByteArray text(qUncompress(data));
+		sqlite3_result_text(context, text.data(), text.size(), SQLITE_TRANSIENT);
+		return;
+	}
+
+	// The database name is a literal, so the dictionary is kept for the
+	// whole statement and only loaded once
+	SQLite::CompressionDictionary *dict = static_cast<SQLite::CompressionDictionary *>(sqlite3_get_auxdata(context, 1));
+	bool cached = dict != 0;
+	if (!cached) {
+		const char *schema = reinterpret_cast<const char *>(sqlite3_value_text(argv[1]));
+		if (schema) dict = loadCompressionDictionary(sqlite3_context_db_handle(context), schema);
+		if (!dict) {
+			sqlite3_result_error(context, "cannot load compression dictionary", -1);
+			return;
+		}
+	}
+
+	QByteArray text(dict->uncompress(sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0])));
+	sqlite3_result_text(context, text.data(), text.size(), SQLITE_TRANSIENT);
+
+	if (!cached) sqlite3_set_auxdata(context, 1, dict, compressionDictionaryDelete);
 }
 
 int isToIgnore(const char *token)
@@ -102,15 +323,29 @@ int isToIgnore(const char *token)
 	//return ignoredWords.contains(token);
 }
 
-const char *hiraganasToKatakanas(const char *src)
+/**
+ * Converts the hiraganas of the UTF-8 string str of n bytes into katakanas,
+ * in place. Hiraganas and their katakana counterparts are all encoded on 3
+ * bytes and are separated by a fixed offset of 0x60 code points, so the
+ * conversion never changes the size of the string.
+ */
+static void hiraganasToKatakanas(char *str, int n)
 {
-	QString s(QString::fromUtf8(src));
-//	qDebug("%x", s[0].unicode());
-//	return src;
-//	printf("%x %x %x\n", (unsigned char)src[0], (unsigned char)src[1], (unsigned char)src[2]);
-	kanasConverted = TextTools::hiragana2Katakana(s).toUtf8();
-//	qDebug() << src << kanasConverted;
-	return kanasConverted.constData();
+	unsigned char *p = (unsigned char *)str;
+	for (int i = 0; i + 2 < n; ) {
+		if (p[i] != 0xe3 || (p[i + 1] != 0x81 && p[i + 1] != 0x82) || (p[i + 2] & 0xc0) != 0x80) {
+			++i;
+			continue;
+		}
+		unsigned int code = 0x3000 | ((p[i + 1] & 0x3f) << 6) | (p[i + 2] & 0x3f);
+		// Same range as TextTools::hiraganaChar2Katakana()
+		if (code >= 0x3040 && code <= 0x309f && !(code >= 0x3099 && code <= 0x309c)) {
+			code += 0x60;
+			p[i + 1] = 0x80 | ((code >> 6) & 0x3f);
+			p[i + 2] = 0x80 | (code & 0x3f);
+		}
+		i += 3;
+	}
 }
 
 // Function to register a tokenizer
@@ -343,10 +578,12 @@ typedef struct katakana_tokenizer_cursor {
   int iOffset;                 /* current position in pInput */
   int iToken;                  /* index of next token to be returned */
   char *pToken;                /* storage for current token */
-  size_t nTokenAllocated;         /* space allocated to zToken buffer */
+  int nTokenAllocated;         /* space allocated to zToken buffer */
 
 	bool replay;
-	char *replayToken;
+	char *replayToken;           /* storage for the undotted token to replay */
+	int nReplayAllocated;        /* space allocated to replayToken buffer */
+	int nReplayBytes;
 	int replayStart;
 	int replayEnd;
 	int replayPos;
@@ -448,7 +685,7 @@ static int katakanaOpen(
 static int katakanaClose(sqlite3_tokenizer_cursor *pCursor){
   katakana_tokenizer_cursor *c = (katakana_tokenizer_cursor *) pCursor;
   sqlite3_free(c->pToken);
-  if (c->replayToken) free(c->replayToken);
+  sqlite3_free(c->replayToken);
   sqlite3_free(c);
   return SQLITE_OK;
 }
@@ -472,16 +709,14 @@ static int katakanaNext(
   /* Replay a dotted token */
   if (c->replay) {
 	c->replay = false;
-	if (c->nTokenAllocated <= strlen(c->replayToken + 1)) {
-		c->nTokenAllocated = strlen(c->replayToken + 21);
+	if (c->nReplayBytes+1>c->nTokenAllocated) {
+		c->nTokenAllocated = c->nReplayBytes+21;
 		c->pToken = (char *)sqlite3_realloc(c->pToken, c->nTokenAllocated);
 		if( c->pToken==NULL ) return SQLITE_NOMEM;
 	}
-	strcpy(c->pToken, c->replayToken);
-	free(c->replayToken);
-	c->replayToken = 0;
+	memcpy(c->pToken, c->replayToken, c->nReplayBytes+1);
 	*ppToken = c->pToken;
-	*pnBytes = strlen(c->pToken);
+	*pnBytes = c->nReplayBytes;
 	*piStartOffset = c->replayStart;
 	*piEndOffset = c->replayEnd;
 	*piPosition = c->replayPos;
@@ -503,7 +738,8 @@ static int katakanaNext(
     }
 
     if( c->iOffset>iStartOffset ){
-      size_t i, n = c->iOffset-iStartOffset;
+      int i, n = c->iOffset-iStartOffset;
+      int dotPos = -1;
       if( n+1>c->nTokenAllocated ){
 	c->nTokenAllocated = n+21;
 	c->pToken = (char *)sqlite3_realloc(c->pToken, c->nTokenAllocated);
@@ -515,24 +751,33 @@ static int katakanaNext(
 	*/
 	unsigned char ch = p[iStartOffset+i];
 	c->pToken[i] = ch<0x80 ? tolower(ch) : ch;
+	if (ch == '.' && dotPos == -1) dotPos = i;
       }
       c->pToken[i] = 0;
-      QString katakanaString(TextTools::hiragana2Katakana(QString::fromUtf8(c->pToken)));
-
-      if (katakanaString.contains('.')) {
-	      QString replayString(katakanaString);
-	      replayString.remove('.');
+      hiraganasToKatakanas(c->pToken, n);
+
+      if (dotPos != -1) {
+	      /* The replayed token is the whole token without its dots */
+	      if (n+1>c->nReplayAllocated) {
+		      c->nReplayAllocated = n+21;
+		      c->replayToken = (char *)sqlite3_realloc(c->replayToken, c->nReplayAllocated);
+		      if( c->replayToken==NULL ) return SQLITE_NOMEM;
+	      }
+	      int j = 0;
+	      for (i=0; i<n; i++) if (c->pToken[i] != '.') c->replayToken[j++] = c->pToken[i];
+	      c->replayToken[j] = 0;
+	      c->nReplayBytes = j;
 	      c->replay = true;
-	      c->replayToken = qstrdup(replayString.toUtf8().constData());
-	      katakanaString = katakanaString.left(katakanaString.indexOf('.'));
 	      c->replayStart = iStartOffset;
 	      c->replayEnd = c->iOffset;
 	      c->replayPos = c->iToken;
+	      /* Return the part before the first dot for now */
+	      c->pToken[dotPos] = 0;
+	      n = dotPos;
       }
 
-      strcpy(c->pToken, katakanaString.toUtf8().constData());
       *ppToken = c->pToken;
-      *pnBytes = strlen(c->pToken);
+      *pnBytes = n;
       *piStartOffset = iStartOffset;
       *piEndOffset = c->iOffset;
       *piPosition = c->iToken++;
@@ -555,6 +800,94 @@ static const sqlite3_tokenizer_module katakanaTokenizerModule = {
   katakanaNext,
 };
 
+#if SQLITE_VERSION_NUMBER >= 3020000
+//
+// FTS5 port of the katakana tokenizer, producing the same tokens. The
+// undotted form of dotted tokens is given as a colocated token.
+//
+struct katakana_fts5_tokenizer {
+	char delim[128];
+};
+
+static int katakanaFts5Create(void *pContext, const char **azArg, int nArg, Fts5Tokenizer **ppOut)
+{
+	katakana_fts5_tokenizer *t = new katakana_fts5_tokenizer;
+	memset(t, 0, sizeof(*t));
+	if (nArg > 0) {
+		for (const char *c = azArg[0]; *c; c++) {
+			unsigned char ch = *c;
+			if (ch >= 0x80) {
+				delete t;
+				return SQLITE_ERROR;
+			}
+			t->delim[ch] = 1;
+		}
+	} else {
+		for (int i = 1; i < 0x80; i++) t->delim[i] = !isalnum(i);
+		t->delim[(int)'.'] = 0;
+	}
+	*ppOut = reinterpret_cast<Fts5Tokenizer *>(t);
+	return SQLITE_OK;
+}
+
+static void katakanaFts5Delete(Fts5Tokenizer *pTok)
+{
+	delete reinterpret_cast<katakana_fts5_tokenizer *>(pTok);
+}
+
+static int katakanaFts5Tokenize(Fts5Tokenizer *pTok, void *pCtx, int flags, const char *pText, int nText,
+	int (*xToken)(void *, int, const char *, int, int, int))
+{
+	katakana_fts5_tokenizer *t = reinterpret_cast<katakana_fts5_tokenizer *>(pTok);
+	const unsigned char *p = (const unsigned char *)pText;
+	QByteArray token;
+	int offset = 0;
+	while (offset < nText) {
+		while (offset < nText && p[offset] < 0x80 && t->delim[p[offset]]) offset++;
+		int start = offset;
+		while (offset < nText && !(p[offset] < 0x80 && t->delim[p[offset]])) offset++;
+		int n = offset - start;
+		if (!n) continue;
+
+		token.resize(n);
+		int dotPos = -1;
+		for (int i = 0; i < n; i++) {
+			unsigned char ch = p[start + i];
+			token[i] = ch < 0x80 ? tolower(ch) : ch;
+			if (ch == '.' && dotPos == -1) dotPos = i;
+		}
+		hiraganasToKatakanas(token.data(), n);
+
+		if (dotPos == -1) {
+			int rc = xToken(pCtx, 0, token.constData(), n, start, offset);
+			if (rc != SQLITE_OK) return rc;
+			continue;
+		}
+		// The part before the first dot, then the whole token without
+		// its dots at the same position
+		int rc = xToken(pCtx, 0, token.constData(), dotPos, start, offset);
+		if (rc != SQLITE_OK) return rc;
+		token.replace(".", "");
+		rc = xToken(pCtx, FTS5_TOKEN_COLOCATED, token.constData(), token.size(), start, offset);
+		if (rc != SQLITE_OK) return rc;
+	}
+	return SQLITE_OK;
+}
+
+/// Returns the FTS5 API of db, or 0 if FTS5 is not available
+static fts5_api *fts5Api(sqlite3 *db)
+{
+	fts5_api *api = 0;
+	sqlite3_stmt *stmt = 0;
+	if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &stmt, 0) == SQLITE_OK) {
+		sqlite3_bind_pointer(stmt, 1, (void *)&api, "fts5_api_ptr", 0);
+		sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+	return api;
+}
+#endif
+
 static int load_extensions(sqlite3 *handler, const char **pzErrMsg,
 	const struct sqlite3_api_routines *pThunk)
 {
@@ -571,14 +904,34 @@ void sqlite3ext_init()
 	sqlite3_auto_extension((void (*)())load_extensions);
 }
 
+void sqlite3ext_set_regexp_engine(sqlite3ext_regexp_engine engine)
+{
+	regexpEngine = engine;
+}
+
+int sqlite3ext_register_regexp(sqlite3 *handler, sqlite3ext_regexp_engine engine)
+{
+	switch (engine) {
+	case SQLITE3EXT_REGEXP_PCRE:
+		return sqlite3_create_function(handler, "regexp", 2, SQLITE_UTF8, 0, regexpPcreFunc, 0, 0);
+	case SQLITE3EXT_REGEXP_QREGEXP:
+	default:
+		return sqlite3_create_function(handler, "regexp", 2, SQLITE_UTF8, 0, regexpFunc, 0, 0);
+	}
+}
+
 int sqlite3ext_register_functions(sqlite3 *handler)
 {
 	// Attach custom functions
-	sqlite3_create_function(handler, "regexp", 2, SQLITE_UTF8, 0, regexpFunc, 0, 0);
+	sqlite3ext_register_regexp(handler, regexpEngine);
 	sqlite3_create_function(handler, "biased_random", 1, SQLITE_UTF8, 0, biased_random, 0, 0);
 	sqlite3_create_function(handler, "uniquecount", -1, SQLITE_UTF8, 0, 0, uniquecount_aggr_step, uniquecount_aggr_finalize);
+	sqlite3_create_function(handler, "ftsrank", 1, SQLITE_UTF8, 0, fts_rank, 0, 0);
+	sqlite3_create_function(handler, "editdistance", 2, SQLITE_UTF8, 0, edit_distance, 0, 0);
+	sqlite3_create_function(handler, "firstsenses", 2, SQLITE_UTF8, 0, first_senses, 0, 0);
 	sqlite3_create_function(handler, "ftscompress", 1, SQLITE_UTF8, 0, fts_compress, 0, 0);
 	sqlite3_create_function(handler, "ftsuncompress", 1, SQLITE_UTF8, 0, fts_uncompress, 0, 0);
+	sqlite3_create_function(handler, "ftsuncompress", 2, SQLITE_UTF8, 0, fts_uncompress, 0, 0);
 
 	return SQLITE_OK;
 }
@@ -591,6 +944,19 @@ int sqlite3ext_register_tokenizers(sqlite3 *handler)
 		return err;
 	}
 
+#if SQLITE_VERSION_NUMBER >= 3020000
+	// Without FTS5, only the FTS4 databases can be opened
+	fts5_api *api = fts5Api(handler);
+	if (api) {
+		fts5_tokenizer katakanaFts5 = { katakanaFts5Create, katakanaFts5Delete, katakanaFts5Tokenize };
+		err = api->xCreateTokenizer(api, "katakana", 0, &katakanaFts5, 0);
+		if (err) {
+			qDebug("Could not register FTS5 katakana tokenizer!");
+			return err;
+		}
+	}
+#endif
+
 	return SQLITE_OK;
 }
 